@@ -3,6 +3,7 @@
 #include "array.h"
 #include "buffer.h"
 #include "settings.h"   /* BUFFER_MAX_REUSE_SIZE */
+#include "trie.h"
 
 #include <string.h>
 #include <stdlib.h>
@@ -28,7 +29,14 @@ array *array_init(uint32_t n) {
 	return a;
 }
 
+__attribute_cold__
+static void array_match_index_free(struct array_match_index *m);
+
 void array_free_data(array * const a) {
+	if (a->mindex) {
+		array_match_index_free(a->mindex);
+		a->mindex = NULL;
+	}
 	if (a->sorted) free(a->sorted);
 	data_unset ** const data = a->data;
 	const uint32_t sz = a->size;
@@ -154,6 +162,27 @@ data_unset *array_get_element_klen(const array * const a, const char *key, const
     return ipos >= 0 ? a->sorted[ipos] : NULL;
 }
 
+/* data_string elements tagged with (ext > 0) (e.g. enum http_header_e) are
+ * found with a linear scan of a->data[] comparing integer tags, which is
+ * faster than case-insensitive string compares for the small arrays (< ~30
+ * elements) used for HTTP headers.  (ext <= 0) falls back to key lookup */
+__attribute_hot__
+__attribute_pure__
+static int32_t array_get_index_ext(const array * const a, const int ext, const char * const k, const uint32_t klen) {
+    if (ext <= 0) return array_get_index(a, k, klen);
+    data_string * const * const restrict d = (data_string **)a->data;
+    for (uint32_t i = 0, used = a->used; i < used; ++i) {
+        if (d[i]->ext == ext) return (int32_t)i;
+    }
+    return -1;
+}
+
+__attribute_hot__
+data_unset *array_get_element_klen_ext(const array * const a, const int ext, const char *key, const uint32_t klen) {
+    const int32_t ipos = array_get_index_ext(a, ext, key, klen);
+    return ipos >= 0 ? (ext <= 0 ? a->sorted[ipos] : a->data[ipos]) : NULL;
+}
+
 /* non-const (data_config *) for configparser.y (not array_get_element_klen())*/
 data_unset *array_get_data_unset(const array * const a, const char *key, const size_t klen) {
     const int32_t ipos = array_get_index(a, key, klen);
@@ -269,12 +298,35 @@ buffer * array_get_buf_ptr(array * const a, const char * const k, const size_t k
     data_string * const ds = array_insert_string_at_pos(a, (uint32_t)(-ipos-1));
     buffer_copy_string_len(&ds->key, k, klen);
     buffer_clear(&ds->value);
+    ds->ext = 0;
+    return &ds->value;
+}
+
+buffer * array_get_buf_ptr_ext(array * const a, const int ext, const char * const k, const uint32_t klen) {
+    if (ext > 0) {
+        const int32_t ipos = array_get_index_ext(a, ext, k, klen);
+        if (ipos >= 0) return &((data_string *)a->data[ipos])->value;
+    }
+
+    /* (key might have been inserted without ext tag; tag it if found) */
+    int32_t ipos = array_get_index(a, k, klen);
+    if (ipos >= 0) {
+        data_string * const ds = (data_string *)a->sorted[ipos];
+        if (ext > 0) ds->ext = ext;
+        return &ds->value;
+    }
+
+    data_string * const ds = array_insert_string_at_pos(a, (uint32_t)(-ipos-1));
+    buffer_copy_string_len(&ds->key, k, klen);
+    buffer_clear(&ds->value);
+    ds->ext = ext;
     return &ds->value;
 }
 
 void array_insert_value(array * const a, const char * const v, const size_t vlen) {
     data_string * const ds = array_insert_string_at_pos(a, a->used);
     buffer_clear(&ds->key);
+    ds->ext = 0;
     buffer_copy_string_len(&ds->value, v, vlen);
 }
 
@@ -363,9 +415,151 @@ int array_is_kvstring(const array * const a) {
  * behavior, the interface distinctions are useful to add clarity to the code,
  * and the specialized routines run slightly faster */
 
+/* Optional trie index (see array_match_index()) of array keys or values.
+ * Strings are inserted lowercased (for _nc lookups) and reversed for suffix
+ * matching; array entries which lowercase to the same string are chained
+ * (in array order) through next[] and are compared case-sensitively when
+ * needed.  path_or_ext uses prefix trie for "/path" and suffix trie for rest.
+ * Lookups walk the trie along the input and return the longest match. */
+
+struct array_match_index {
+    int kind;
+    int32_t *next;  /* next array entry with same lowercased string or -1 */
+    trie prefix;
+    trie suffix;
+};
+
+enum {
+  ARRAY_MATCH_REV   = 0x1
+ ,ARRAY_MATCH_NC    = 0x2
+ ,ARRAY_MATCH_VALUE = 0x4
+};
+
+static void array_match_index_free(struct array_match_index * const m) {
+    trie_free(&m->prefix);
+    trie_free(&m->suffix);
+    free(m->next);
+    free(m);
+}
+
+static const buffer * array_match_index_str (const array * const a, const int32_t x, const int flags) {
+    return (flags & ARRAY_MATCH_VALUE)
+      ? &((const data_string *)a->data[x])->value
+      : &a->data[x]->key;
+}
+
+__attribute_cold__
+static void array_match_index_insert (const array * const a, struct array_match_index * const m, trie * const t, const int32_t x, const int flags) {
+    const buffer * const b = array_match_index_str(a, x, flags);
+    const uint32_t len = buffer_string_length(b);
+    char lc[256];
+    char * const s = len < sizeof(lc) ? lc : malloc(len);
+    force_assert(s);
+    for (uint32_t i = 0; i < len; ++i) {
+        const unsigned char c = ((unsigned char *)b->ptr)[i];
+        s[i] = (c >= 'A' && c <= 'Z') ? (char)(c | 0x20) : (char)c;
+    }
+    int32_t y = trie_insert(t, s, len, x, flags & ARRAY_MATCH_REV);
+    if (s != lc) free(s);
+    if (y != x) { /* append to chain of entries with same lowercased string */
+        while (m->next[y] >= 0) y = m->next[y];
+        m->next[y] = x;
+    }
+}
+
+void array_match_index (array * const a, const int kind) {
+    if (a->mindex) {
+        array_match_index_free(a->mindex);
+        a->mindex = NULL;
+    }
+    if (0 == a->used) return;
+
+    struct array_match_index * const m = calloc(1, sizeof(*m));
+    force_assert(m);
+    m->kind = kind;
+    m->next = malloc(a->used * sizeof(int32_t));
+    force_assert(m->next);
+    trie_init(&m->prefix);
+    trie_init(&m->suffix);
+    for (uint32_t i = 0; i < a->used; ++i) m->next[i] = -1;
+
+    for (uint32_t i = 0; i < a->used; ++i) {
+        switch (kind) {
+          case ARRAY_MATCH_KEY_PREFIX:
+            array_match_index_insert(a, m, &m->prefix, (int32_t)i, 0);
+            break;
+          case ARRAY_MATCH_VALUE_PREFIX:
+            array_match_index_insert(a, m, &m->prefix, (int32_t)i,
+                                     ARRAY_MATCH_VALUE);
+            break;
+          case ARRAY_MATCH_KEY_SUFFIX:
+            array_match_index_insert(a, m, &m->suffix, (int32_t)i,
+                                     ARRAY_MATCH_REV);
+            break;
+          case ARRAY_MATCH_VALUE_SUFFIX:
+            array_match_index_insert(a, m, &m->suffix, (int32_t)i,
+                                     ARRAY_MATCH_REV | ARRAY_MATCH_VALUE);
+            break;
+          case ARRAY_MATCH_PATH_OR_EXT:
+            if (a->data[i]->key.ptr[0] == '/')
+                array_match_index_insert(a, m, &m->prefix, (int32_t)i, 0);
+            else
+                array_match_index_insert(a, m, &m->suffix, (int32_t)i,
+                                         ARRAY_MATCH_REV);
+            break;
+          default:
+            array_match_index_free(m);
+            return;
+        }
+    }
+
+    a->mindex = m;
+}
+
+__attribute_pure__
+static int32_t array_match_index_lookup (const array * const a, const trie * const t, const char * const s, const size_t slen, const int flags) {
+    /* returns ndx of longest match in a->data[], or -1 if no match */
+    if (0 == t->used) return -1;
+    const int32_t * const next = a->mindex->next;
+    const unsigned char * const u = (const unsigned char *)s;
+    int32_t match = -1;
+    size_t i = 0;
+    uint32_t n = 0;
+    do {
+        /* (i is length of string at trie node n) */
+        for (int32_t x = t->nodes[n].v; x >= 0; x = next[x]) {
+            if (!(flags & ARRAY_MATCH_NC)) {
+                const char * const e = array_match_index_str(a, x, flags)->ptr;
+                if (0 != memcmp((flags & ARRAY_MATCH_REV) ? s+slen-i : s,e,i))
+                    continue;
+            }
+            match = x;
+            break;
+        }
+        if (i == slen) break;
+        unsigned int c = u[(flags & ARRAY_MATCH_REV) ? slen-1-i : i];
+        if (c >= 'A' && c <= 'Z') c |= 0x20;
+        n = trie_child(t, n, (unsigned char)c);
+        ++i;
+    } while (n);
+    return match;
+}
+
+static data_unset * array_match_index_data (const array * const a, const int32_t x) {
+    return x >= 0 ? a->data[x] : NULL;
+}
+
+static const buffer * array_match_index_value (const array * const a, const int32_t x) {
+    return x >= 0 ? &((data_string *)a->data[x])->value : NULL;
+}
+
 data_unset *
 array_match_key_prefix_klen (const array * const a, const char * const s, const size_t slen)
 {
+    if (a->mindex && a->mindex->kind == ARRAY_MATCH_KEY_PREFIX)
+        return array_match_index_data(a,
+          array_match_index_lookup(a, &a->mindex->prefix, s, slen, 0));
+
     for (uint32_t i = 0; i < a->used; ++i) {
         const buffer * const key = &a->data[i]->key;
         const size_t klen = buffer_string_length(key);
@@ -378,6 +572,11 @@ array_match_key_prefix_klen (const array * const a, const char * const s, const
 data_unset *
 array_match_key_prefix_nc_klen (const array * const a, const char * const s, const size_t slen)
 {
+    if (a->mindex && a->mindex->kind == ARRAY_MATCH_KEY_PREFIX)
+        return array_match_index_data(a,
+          array_match_index_lookup(a, &a->mindex->prefix, s, slen,
+                                   ARRAY_MATCH_NC));
+
     for (uint32_t i = 0; i < a->used; ++i) {
         const buffer * const key = &a->data[i]->key;
         const size_t klen = buffer_string_length(key);
@@ -405,6 +604,11 @@ array_match_key_prefix_nc (const array * const a, const buffer * const b)
 const buffer *
 array_match_value_prefix (const array * const a, const buffer * const b)
 {
+    if (a->mindex && a->mindex->kind == ARRAY_MATCH_VALUE_PREFIX)
+        return array_match_index_value(a,
+          array_match_index_lookup(a, &a->mindex->prefix, CONST_BUF_LEN(b),
+                                   ARRAY_MATCH_VALUE));
+
     const size_t blen = buffer_string_length(b);
 
     for (uint32_t i = 0; i < a->used; ++i) {
@@ -419,6 +623,11 @@ array_match_value_prefix (const array * const a, const buffer * const b)
 const buffer *
 array_match_value_prefix_nc (const array * const a, const buffer * const b)
 {
+    if (a->mindex && a->mindex->kind == ARRAY_MATCH_VALUE_PREFIX)
+        return array_match_index_value(a,
+          array_match_index_lookup(a, &a->mindex->prefix, CONST_BUF_LEN(b),
+                                   ARRAY_MATCH_VALUE | ARRAY_MATCH_NC));
+
     const size_t blen = buffer_string_length(b);
 
     for (uint32_t i = 0; i < a->used; ++i) {
@@ -433,6 +642,11 @@ array_match_value_prefix_nc (const array * const a, const buffer * const b)
 data_unset *
 array_match_key_suffix (const array * const a, const buffer * const b)
 {
+    if (a->mindex && a->mindex->kind == ARRAY_MATCH_KEY_SUFFIX)
+        return array_match_index_data(a,
+          array_match_index_lookup(a, &a->mindex->suffix, CONST_BUF_LEN(b),
+                                   ARRAY_MATCH_REV));
+
     const size_t blen = buffer_string_length(b);
     const char * const end = b->ptr + blen;
 
@@ -448,6 +662,11 @@ array_match_key_suffix (const array * const a, const buffer * const b)
 data_unset *
 array_match_key_suffix_nc (const array * const a, const buffer * const b)
 {
+    if (a->mindex && a->mindex->kind == ARRAY_MATCH_KEY_SUFFIX)
+        return array_match_index_data(a,
+          array_match_index_lookup(a, &a->mindex->suffix, CONST_BUF_LEN(b),
+                                   ARRAY_MATCH_REV | ARRAY_MATCH_NC));
+
     const size_t blen = buffer_string_length(b);
     const char * const end = b->ptr + blen;
 
@@ -463,6 +682,11 @@ array_match_key_suffix_nc (const array * const a, const buffer * const b)
 const buffer *
 array_match_value_suffix (const array * const a, const buffer * const b)
 {
+    if (a->mindex && a->mindex->kind == ARRAY_MATCH_VALUE_SUFFIX)
+        return array_match_index_value(a,
+          array_match_index_lookup(a, &a->mindex->suffix, CONST_BUF_LEN(b),
+                                   ARRAY_MATCH_REV | ARRAY_MATCH_VALUE));
+
     const size_t blen = buffer_string_length(b);
     const char * const end = b->ptr + blen;
 
@@ -478,6 +702,12 @@ array_match_value_suffix (const array * const a, const buffer * const b)
 const buffer *
 array_match_value_suffix_nc (const array * const a, const buffer * const b)
 {
+    if (a->mindex && a->mindex->kind == ARRAY_MATCH_VALUE_SUFFIX)
+        return array_match_index_value(a,
+          array_match_index_lookup(a, &a->mindex->suffix, CONST_BUF_LEN(b),
+                                   ARRAY_MATCH_REV | ARRAY_MATCH_VALUE
+                                   | ARRAY_MATCH_NC));
+
     const size_t blen = buffer_string_length(b);
     const char * const end = b->ptr + blen;
 
@@ -493,6 +723,18 @@ array_match_value_suffix_nc (const array * const a, const buffer * const b)
 data_unset *
 array_match_path_or_ext (const array * const a, const buffer * const b)
 {
+    if (a->mindex && a->mindex->kind == ARRAY_MATCH_PATH_OR_EXT) {
+        const int32_t x = array_match_index_lookup(a, &a->mindex->prefix,
+                                                   CONST_BUF_LEN(b), 0);
+        const int32_t y = array_match_index_lookup(a, &a->mindex->suffix,
+                                                   CONST_BUF_LEN(b),
+                                                   ARRAY_MATCH_REV);
+        if (x < 0 || y < 0) return array_match_index_data(a, x < 0 ? y : x);
+        const uint32_t xlen = buffer_string_length(&a->data[x]->key);
+        const uint32_t ylen = buffer_string_length(&a->data[y]->key);
+        return a->data[xlen > ylen || (xlen == ylen && x < y) ? x : y];
+    }
+
     const size_t blen = buffer_string_length(b);
 
     for (uint32_t i = 0; i < a->used; ++i) {
@@ -5,6 +5,7 @@
 #include "buffer.h"
 
 struct data_unset; /* declaration */
+struct array_match_index; /* declaration */
 
 struct data_methods {
 	struct data_unset *(*copy)(const struct data_unset *src); \
@@ -29,10 +30,13 @@ typedef struct {
 
 	uint32_t used; /* <= INT32_MAX */
 	uint32_t size;
+
+	struct array_match_index *mindex; /* (see array_match_index()) */
 } array;
 
 typedef struct {
 	DATA_UNSET;
+	int ext; /* extension tag; e.g. enum http_header_e for HTTP headers */
 
 	buffer value;
 } data_string;
@@ -94,6 +98,9 @@ int array_is_kvstring(const array *a);
 __attribute_pure__
 data_unset *array_get_element_klen(const array *a, const char *key, size_t klen);
 
+__attribute_pure__
+data_unset *array_get_element_klen_ext(const array *a, int ext, const char *key, uint32_t klen);
+
 __attribute_cold__
 __attribute_pure__
 data_unset *array_get_data_unset(const array *a, const char *key, size_t klen);
@@ -107,6 +114,9 @@ int * array_get_int_ptr(array *a, const char *k, size_t klen);
 __attribute_returns_nonnull__
 buffer * array_get_buf_ptr(array *a, const char *k, size_t klen);
 
+__attribute_returns_nonnull__
+buffer * array_get_buf_ptr_ext(array *a, int ext, const char *k, uint32_t klen);
+
 void array_insert_value(array *a, const char *v, size_t vlen);
 
 static inline void array_set_key_value(array * const a, const char * const k, const size_t klen, const char * const v, const size_t vlen);
@@ -128,6 +138,22 @@ __attribute_cold__
 __attribute_pure__
 size_t array_get_max_key_length(const array *a);
 
+enum {
+  ARRAY_MATCH_KEY_PREFIX = 1
+ ,ARRAY_MATCH_VALUE_PREFIX
+ ,ARRAY_MATCH_KEY_SUFFIX
+ ,ARRAY_MATCH_VALUE_SUFFIX
+ ,ARRAY_MATCH_PATH_OR_EXT
+};
+
+/* build trie index of array keys or values for corresponding array_match_*()
+ * (both case-sensitive and _nc variants), which then return longest match
+ * (instead of first match in array) in time bounded by length of string.
+ * Array must not be modified after index is built (until array_free_data()).
+ * Intended to be called on config arrays at startup in module set_defaults */
+__attribute_cold__
+void array_match_index (array *a, int kind);
+
 __attribute_pure__
 data_unset * array_match_key_prefix_klen (const array * const a, const char * const s, const size_t slen);
 
@@ -0,0 +1,298 @@
+#include "first.h"
+
+#include "async_pool.h"
+#include "base.h"
+#include "connections.h"
+#include "fdevent.h"
+#include "log.h"
+
+#include <sys/types.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
+#ifdef HAVE_SYS_EVENTFD_H
+#include <sys/eventfd.h>
+#endif
+
+struct async_pool {
+    const char *name;
+    void *(*tctx_init)(void *ctx);
+    void (*tctx_free)(void *tctx);
+    void *ctx;
+    void *tctx;             /* context for jobs run synchronously */
+    unsigned int nthreads;
+    unsigned int started;   /* number of worker threads started */
+    int initialized;        /* attempted to start worker threads */
+    int fd[2];              /* completion notification (eventfd or pipe) */
+    fdnode *fdn;
+    fdevents *ev;
+    log_error_st *errh;
+  #ifdef HAVE_PTHREAD_H
+    pthread_t *threads;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    async_job *queue;       /* (protected by mutex) */
+    async_job **queue_tail; /* (protected by mutex) */
+    async_job *completed;   /* (protected by mutex) */
+    int shutdown;           /* (protected by mutex) */
+  #endif
+};
+
+async_pool * async_pool_init (const char *name, unsigned int nthreads, void *(*tctx_init)(void *ctx), void (*tctx_free)(void *tctx), void *ctx)
+{
+    async_pool * const pool = calloc(1, sizeof(*pool));
+    force_assert(pool);
+    pool->name = name;
+    pool->nthreads = nthreads ? nthreads : 1;
+    pool->tctx_init = tctx_init;
+    pool->tctx_free = tctx_free;
+    pool->ctx = ctx;
+    pool->fd[0] = -1;
+    pool->fd[1] = -1;
+  #ifdef HAVE_PTHREAD_H
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->cond, NULL);
+    pool->queue_tail = &pool->queue;
+  #endif
+    return pool;
+}
+
+static void async_pool_sync_run (async_pool * const pool, async_job * const job, log_error_st * const errh)
+{
+    if (NULL == pool->tctx && NULL != pool->tctx_init)
+        pool->tctx = pool->tctx_init(pool->ctx);
+    job->run(job, pool->tctx, errh);
+    job->done = 1;
+}
+
+#ifdef HAVE_PTHREAD_H
+
+static void async_pool_notify (async_pool * const pool)
+{
+  #ifdef HAVE_SYS_EVENTFD_H
+    const uint64_t u = 1;
+  #else
+    const char u = 0;
+  #endif
+    ssize_t wr;
+    do { wr = write(pool->fd[1], &u, sizeof(u)); } while (-1 == wr && errno == EINTR);
+    /*(ignore EAGAIN; pending notification not yet read by main thread)*/
+}
+
+static void * async_pool_worker (void *arg)
+{
+    async_pool * const pool = arg;
+    void * const tctx = pool->tctx_init ? pool->tctx_init(pool->ctx) : NULL;
+
+    /* log_error() is not thread-safe on shared log_error_st (uses errh->b);
+     * use private log_error_st which writes to same error log
+     * (fd remains valid when log is cycled; fdevent_cycle_logger() reopens
+     *  log file at the same fd number) */
+    log_error_st errh;
+    memset(&errh, 0, sizeof(errh));
+    errh.errorlog_mode = pool->errh->errorlog_mode;
+    errh.errorlog_fd   = pool->errh->errorlog_fd;
+    errh.fn            = pool->errh->fn;
+
+    pthread_mutex_lock(&pool->mutex);
+    for (;;) {
+        while (NULL == pool->queue && !pool->shutdown)
+            pthread_cond_wait(&pool->cond, &pool->mutex);
+        if (pool->shutdown) break;
+
+        async_job * const job = pool->queue;
+        if (NULL == (pool->queue = job->next))
+            pool->queue_tail = &pool->queue;
+        pthread_mutex_unlock(&pool->mutex);
+
+        job->run(job, tctx, &errh);
+
+        pthread_mutex_lock(&pool->mutex);
+        job->next = pool->completed;
+        pool->completed = job;
+        async_pool_notify(pool);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+
+    if (pool->tctx_free) pool->tctx_free(tctx);
+    free(errh.b.ptr);
+    return NULL;
+}
+
+static void async_pool_complete (async_job *job)
+{
+    /* (completed jobs are in reverse order of completion; order is
+     *  unimportant since each job resumes a different request) */
+    for (async_job *next; job; job = next) {
+        next = job->next;
+        job->next = NULL;
+        request_st * const r = job->r;
+        if (NULL == r) { /* detached */
+            job->free(job);
+            continue;
+        }
+        job->done = 1;
+        if (job->complete) {
+            job->complete(job);
+            continue;
+        }
+        r->async_callback = 1;
+        joblist_append(r->con);
+    }
+}
+
+static handler_t async_pool_handle_fdevent (void *ctx, int revents)
+{
+    async_pool * const pool = ctx;
+    if (revents & FDEVENT_IN) {
+      #ifdef HAVE_SYS_EVENTFD_H
+        uint64_t u; /*(eventfd read resets counter)*/
+        if (read(pool->fd[0], &u, sizeof(u))) {}
+      #else
+        char buf[64];
+        while (read(pool->fd[0], buf, sizeof(buf)) == (ssize_t)sizeof(buf)) ;
+      #endif
+    }
+
+    pthread_mutex_lock(&pool->mutex);
+    async_job * const job = pool->completed;
+    pool->completed = NULL;
+    pthread_mutex_unlock(&pool->mutex);
+
+    async_pool_complete(job);
+    return HANDLER_GO_ON;
+}
+
+__attribute_cold__
+static int async_pool_start (async_pool * const pool, server * const srv)
+{
+    /* (started upon first use, which is after fork() of server.max-worker) */
+  #ifdef HAVE_SYS_EVENTFD_H
+    pool->fd[0] = pool->fd[1] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (-1 == pool->fd[0]) {
+        log_perror(srv->errh, __FILE__, __LINE__, "%s: eventfd()", pool->name);
+        return 0;
+    }
+  #else
+    if (0 != pipe(pool->fd)) {
+        log_perror(srv->errh, __FILE__, __LINE__, "%s: pipe()", pool->name);
+        return 0;
+    }
+    fdevent_fcntl_set_nb_cloexec(pool->fd[0]);
+    fdevent_fcntl_set_nb_cloexec(pool->fd[1]);
+  #endif
+
+    pool->ev = srv->ev;
+    pool->errh = srv->errh;
+    pool->fdn = fdevent_register(pool->ev, pool->fd[0],
+                                 async_pool_handle_fdevent, pool);
+    fdevent_fdnode_event_set(pool->ev, pool->fdn, FDEVENT_IN);
+
+    pool->threads = calloc(pool->nthreads, sizeof(pthread_t));
+    force_assert(pool->threads);
+
+    /* block signals in worker threads; signals are handled in main thread */
+    sigset_t set, oset;
+    sigfillset(&set);
+    pthread_sigmask(SIG_BLOCK, &set, &oset);
+    for (; pool->started < pool->nthreads; ++pool->started) {
+        const int rc = pthread_create(pool->threads + pool->started, NULL,
+                                      async_pool_worker, pool);
+        if (0 != rc) {
+            errno = rc;
+            log_perror(srv->errh, __FILE__, __LINE__,
+              "%s: pthread_create()", pool->name);
+            break;
+        }
+    }
+    pthread_sigmask(SIG_SETMASK, &oset, NULL);
+
+    return 0 != pool->started;
+}
+
+#endif /* HAVE_PTHREAD_H */
+
+int async_pool_submit (async_pool * const pool, request_st * const r, async_job * const job)
+{
+    job->r = r;
+    job->done = 0;
+    job->next = NULL;
+
+  #ifdef HAVE_PTHREAD_H
+    if (!pool->initialized) {
+        pool->initialized = 1;
+        if (!async_pool_start(pool, r->con->srv))
+            log_error(r->conf.errh, __FILE__, __LINE__,
+              "%s: running blocking calls in main thread", pool->name);
+    }
+    if (0 != pool->started) {
+        pthread_mutex_lock(&pool->mutex);
+        *pool->queue_tail = job;
+        pool->queue_tail = &job->next;
+        pthread_cond_signal(&pool->cond);
+        pthread_mutex_unlock(&pool->mutex);
+        return 1;
+    }
+  #endif
+
+    async_pool_sync_run(pool, job, r->conf.errh);
+    if (job->complete) job->complete(job);
+    return 0;
+}
+
+void async_job_detach (async_job * const job)
+{
+    if (job->done)
+        job->free(job);
+    else
+        job->r = NULL; /* freed by async_pool when job completes */
+}
+
+void async_pool_free (async_pool * const pool)
+{
+    if (NULL == pool) return;
+
+  #ifdef HAVE_PTHREAD_H
+    if (pool->started) {
+        pthread_mutex_lock(&pool->mutex);
+        pool->shutdown = 1;
+        pthread_cond_broadcast(&pool->cond);
+        pthread_mutex_unlock(&pool->mutex);
+        for (unsigned int i = 0; i < pool->started; ++i)
+            pthread_join(pool->threads[i], NULL);
+    }
+    free(pool->threads);
+
+    /* free detached jobs; jobs still attached to requests are freed by the
+     * modules which submitted them (not expected at shutdown) */
+    for (async_job *job = pool->completed, *next; job; job = next) {
+        next = job->next;
+        if (NULL == job->r) job->free(job); else job->done = 1;
+    }
+    for (async_job *job = pool->queue, *next; job; job = next) {
+        next = job->next;
+        if (NULL == job->r) job->free(job);
+    }
+
+    if (NULL != pool->fdn) {
+        fdevent_fdnode_event_del(pool->ev, pool->fdn);
+        fdevent_unregister(pool->ev, pool->fd[0]);
+        close(pool->fd[0]);
+        if (pool->fd[1] != pool->fd[0]) close(pool->fd[1]);
+    }
+
+    pthread_cond_destroy(&pool->cond);
+    pthread_mutex_destroy(&pool->mutex);
+  #endif
+
+    if (NULL != pool->tctx && NULL != pool->tctx_free)
+        pool->tctx_free(pool->tctx);
+    free(pool);
+}
@@ -0,0 +1,62 @@
+#ifndef INCLUDED_ASYNC_POOL_H
+#define INCLUDED_ASYNC_POOL_H
+#include "first.h"
+
+#include "base_decls.h"
+
+/* pool of worker threads for blocking calls (e.g. LDAP, SQL, PAM) made on
+ * behalf of a request, so that slow backends do not stall the event loop
+ *
+ * A module embeds an async_job at the start of its own job struct, copies
+ * into the job everything needed for the blocking call, and submits the job
+ * with async_pool_submit().  If the job was queued, the module saves the job
+ * (e.g. in r->plugin_ctx[p->id]) and returns HANDLER_WAIT_FOR_EVENT.
+ *
+ * job->run() is called in a worker thread with the private context of that
+ * thread (e.g. a backend connection kept open for reuse by the thread) and a
+ * private log_error_st.  job->run() must not access the request_st or other
+ * server state.
+ *
+ * The main thread is notified of completed jobs through an eventfd (or pipe)
+ * registered with fdevent.  For each completed job, job->done is set and the
+ * request is scheduled to run again, with r->async_callback set.  The module
+ * then finds its job completed, collects the result, and frees the job.
+ *
+ * If job->complete is set, job->complete() is instead called in the main
+ * thread for the completed job, and is responsible for freeing the job.
+ *
+ * If the request is reset before the job completes, the module must call
+ * async_job_detach() instead of freeing the job.  The job is then freed with
+ * job->free() when the job completes.
+ *
+ * If threads are not available, job->run() is called in async_pool_submit()
+ * and the job is complete when async_pool_submit() returns.  (job->complete(),
+ * if set, has then also been called, and the job must not be accessed.)
+ */
+
+typedef struct async_job {
+    void (*run)(struct async_job *job, void *tctx, log_error_st *errh);
+    void (*free)(struct async_job *job);
+    void (*complete)(struct async_job *job); /* (optional) */
+    request_st *r;          /* (NULL if detached) */
+    int done;               /* job completed (set in main thread) */
+    struct async_job *next; /*(internal)*/
+} async_job;
+
+typedef struct async_pool async_pool;
+
+/* tctx_init() and tctx_free() are called in each worker thread to create and
+ * destroy the private context of the thread; either may be NULL */
+__attribute_cold__
+__attribute_returns_nonnull__
+async_pool * async_pool_init (const char *name, unsigned int nthreads, void *(*tctx_init)(void *ctx), void (*tctx_free)(void *tctx), void *ctx);
+
+__attribute_cold__
+void async_pool_free (async_pool *pool);
+
+/* returns 1 if job queued, 0 if job completed (run synchronously) */
+int async_pool_submit (async_pool *pool, request_st *r, async_job *job);
+
+void async_job_detach (async_job *job);
+
+#endif
@@ -35,6 +35,7 @@ struct connection {
 	signed char is_writable;
 	char is_ssl_sock;
 	char traffic_limit_reached;
+	char mem_limit_reached;      /* deferred reading request body */
 
 	chunkqueue *write_queue;      /* a large queue for low-level write ( HTTP response ) [ file, mem ] */
 	chunkqueue *read_queue;       /* a small queue for low-level read ( HTTP request ) [ mem ] */
@@ -64,6 +65,10 @@ struct connection {
 	uint32_t request_count;      /* number of requests handled in this connection */
 	int keep_alive_idle;         /* remember max_keep_alive_idle from config */
 
+	void *io_prefetch;           /* pending prefetch of file data (io_prefetch.c) */
+	off_t io_prefetch_end;       /* end of file window checked or prefetched */
+	int io_prefetch_fd;          /* fd of file for io_prefetch_end */
+
 	uint16_t proto_default_port;
 };
 
@@ -83,6 +88,7 @@ typedef struct {
 	/*(used sparsely, if at all, after config at startup)*/
 
 	uint32_t max_request_field_size;
+	uint32_t cond_index_used; /* number of data_config_index (== conds) */
 	unsigned char log_state_handling;
 	unsigned char log_request_header_on_error;
 	unsigned char http_header_strict;
@@ -96,9 +102,11 @@ typedef struct {
 	unsigned short max_fds;
 	unsigned short max_conns;
 	unsigned short port;
+	unsigned short io_threads;
 
 	unsigned int upload_temp_file_size;
 	array *upload_tempdirs;
+	uint32_t file_cache_size; /* kbytes */
 
 	unsigned char dont_daemonize;
 	unsigned char preflight_check;
@@ -8,12 +8,16 @@
 
 #include "chunk.h"
 #include "fdevent.h"
+#include "file_cache.h"
 #include "log.h"
 
 #include <sys/types.h>
 #include <sys/stat.h>
 #include "sys-mmap.h"
 
+#include <sys/uio.h>     /* writev() */
+
+#include <limits.h>
 #include <stdlib.h>
 #include <fcntl.h>
 #include <unistd.h>
@@ -25,21 +29,149 @@
 #define DEFAULT_TEMPFILE_SIZE (1 * 1024 * 1024)
 #define MAX_TEMPFILE_SIZE (128 * 1024 * 1024)
 
+/* space is reserved (fallocate()) in 1MB extents ahead of writes to tempfile */
+#define TEMPFILE_FALLOC_SIZE (1 * 1024 * 1024)
+
+/* consecutive mem chunks are written to tempfile with a single writev() */
+#if defined(IOV_MAX) && IOV_MAX < 32
+#define TEMPFILE_MAX_IOVEC IOV_MAX
+#else
+#define TEMPFILE_MAX_IOVEC 32
+#endif
+
 static size_t chunk_buf_sz = 8192;
 static chunk *chunks, *chunks_oversized;
 static chunk *chunk_buffers;
 static const array *chunkqueue_default_tempdirs = NULL;
 static off_t chunkqueue_default_tempfile_size = DEFAULT_TEMPFILE_SIZE;
 
+/* server-wide accounting of memory in chunks of chunkqueues
+ * (not counting chunks in pools; those are freed periodically) */
+static off_t chunk_mem_used;
+static off_t chunk_mem_soft_limit;
+static off_t chunk_mem_hard_limit;
+
+/* server-wide accounting of tempfile (spool) bytes in each server.upload-dirs
+ * entry, and in memory (memfd) tempfiles */
+static off_t *chunk_spool_dir_used;
+static uint32_t chunk_spool_dir_n;
+static off_t chunk_spool_dir_limit;
+static off_t chunk_spool_memfd_used;
+static off_t chunk_spool_memfd_limit;
+
 void chunkqueue_set_chunk_size (size_t sz)
 {
     chunk_buf_sz = sz > 0 ? ((sz + 1023) & ~1023uL) : 8192;
 }
 
+void chunkqueue_set_mem_limits (off_t soft_limit, off_t hard_limit)
+{
+    /* 0 is unlimited; soft limit defaults to (and is capped at) hard limit */
+    if (hard_limit && (0 == soft_limit || soft_limit > hard_limit))
+        soft_limit = hard_limit;
+    chunk_mem_soft_limit = soft_limit;
+    chunk_mem_hard_limit = hard_limit;
+}
+
+off_t chunkqueue_mem_used (void)
+{
+    return chunk_mem_used;
+}
+
+int chunkqueue_mem_pressure (void)
+{
+    if (0 == chunk_mem_soft_limit || chunk_mem_used < chunk_mem_soft_limit)
+        return 0;
+    return (chunk_mem_hard_limit && chunk_mem_used >= chunk_mem_hard_limit)
+      ? CHUNK_MEM_HARD
+      : CHUNK_MEM_SOFT;
+}
+
+static void chunk_mem_update (chunk * const c)
+{
+    /* (re)count chunk buffer in use; buffer might have been resized */
+    chunk_mem_used += (off_t)c->mem->size - (off_t)c->msize;
+    c->msize = c->mem->size;
+}
+
+void chunkqueue_set_spool_limits (off_t memfd_limit, off_t dir_limit)
+{
+    /* 0 disables memfd tempfiles; 0 is unlimited for each upload dir */
+    chunk_spool_memfd_limit = memfd_limit;
+    chunk_spool_dir_limit = dir_limit;
+}
+
+static off_t * chunk_spool_used (const int spool)
+{
+    return (spool < 0)
+      ? &chunk_spool_memfd_used
+      : (spool > 0 && (uint32_t)spool <= chunk_spool_dir_n)
+      ? chunk_spool_dir_used + spool - 1
+      : NULL;
+}
+
+static int chunk_spool_dir_full (const uint32_t idx, const size_t len)
+{
+    return chunk_spool_dir_limit && idx < chunk_spool_dir_n
+        && chunk_spool_dir_used[idx] + (off_t)len > chunk_spool_dir_limit;
+}
+
+static int chunk_spool_memfd_avail (const size_t len)
+{
+    return chunk_spool_memfd_limit
+        && chunk_spool_memfd_used + (off_t)len <= chunk_spool_memfd_limit;
+}
+
+/* unnamed tempfile shared by split chunks (each with dup() of fd);
+ * tempfile space is in use until the last of the chunks is released */
+typedef struct chunk_spool {
+    off_t size;
+    int refcnt;
+} chunk_spool;
+
+static void chunk_spool_share (chunk * const restrict d, chunk * const restrict c)
+{
+    chunk_spool *ref = c->file.spool_ref;
+    if (NULL == ref) {
+        /* (tempfile is not appended to once partially read) */
+        ref = malloc(sizeof(*ref));
+        force_assert(NULL != ref);
+        ref->size = c->file.start + c->file.length;
+        ref->refcnt = 1;
+        c->file.spool_ref = ref;
+    }
+    ++ref->refcnt;
+    d->file.spool = c->file.spool;
+    d->file.spool_ref = ref;
+}
+
+static void chunk_spool_release (chunk * const c)
+{
+    /* tempfile size (split chunks refer to front of same file) */
+    off_t sz = c->file.start + c->file.length;
+    chunk_spool * const ref = c->file.spool_ref;
+    if (ref) {
+        c->file.spool_ref = NULL;
+        if (--ref->refcnt) {
+            c->file.spool = 0;
+            return;
+        }
+        sz = ref->size;
+        free(ref);
+    }
+    off_t * const used = chunk_spool_used(c->file.spool);
+    if (used) *used = (*used > sz) ? *used - sz : 0;
+    c->file.spool = 0;
+}
+
 void chunkqueue_set_tempdirs_default_reset (void)
 {
     chunkqueue_default_tempdirs = NULL;
     chunkqueue_default_tempfile_size = DEFAULT_TEMPFILE_SIZE;
+    free(chunk_spool_dir_used);
+    chunk_spool_dir_used = NULL;
+    chunk_spool_dir_n = 0;
+    chunk_spool_memfd_used = 0;
 }
 
 /* chunk buffer (c->mem) is never NULL; specialize routines from buffer.h */
@@ -84,7 +216,10 @@ static chunk *chunk_init(size_t sz) {
 	c->file.fd = -1;
 	c->file.mmap.start = MAP_FAILED;
 	c->file.mmap.length = 0;
+	c->file.ref = NULL;
 	c->file.is_temp = 0;
+	c->file.spool = 0;
+	c->file.spool_ref = NULL;
 	c->offset = 0;
 	c->next = NULL;
 
@@ -94,6 +229,7 @@ static chunk *chunk_init(size_t sz) {
 }
 
 static void chunk_reset_file_chunk(chunk *c) {
+	if (c->file.spool) chunk_spool_release(c);
 	if (c->file.is_temp && !chunk_buffer_string_is_empty(c->mem)) {
 		unlink(c->mem->ptr);
 	}
@@ -105,6 +241,10 @@ static void chunk_reset_file_chunk(chunk *c) {
 		munmap(c->file.mmap.start, c->file.mmap.length);
 		c->file.mmap.start = MAP_FAILED;
 	}
+	if (NULL != c->file.ref) {
+		file_cache_release(c->file.ref);
+		c->file.ref = NULL;
+	}
 	c->file.start = c->file.length = c->file.mmap.offset = 0;
 	c->file.mmap.length = 0;
 	c->file.is_temp = 0;
@@ -158,10 +298,12 @@ void chunk_buffer_release(buffer *b) {
 
 __attribute_returns_nonnull__
 static chunk * chunk_acquire(size_t sz) {
+    chunk *c;
     if (sz <= chunk_buf_sz) {
         if (chunks) {
-            chunk *c = chunks;
+            c = chunks;
             chunks = c->next;
+            chunk_mem_update(c);
             return c;
         }
         sz = chunk_buf_sz;
@@ -170,17 +312,22 @@ static chunk * chunk_acquire(size_t sz) {
         sz = (sz + 8191) & ~8191uL;
         /* future: might have buckets of certain sizes, up to socket buf sizes*/
         if (chunks_oversized && chunks_oversized->mem->size >= sz) {
-            chunk *c = chunks_oversized;
+            c = chunks_oversized;
             chunks_oversized = c->next;
+            chunk_mem_update(c);
             return c;
         }
     }
 
-    return chunk_init(sz);
+    c = chunk_init(sz);
+    chunk_mem_update(c);
+    return c;
 }
 
 static void chunk_release(chunk *c) {
     const size_t sz = c->mem->size;
+    chunk_mem_used -= (off_t)c->msize;
+    c->msize = 0;
     if (sz == chunk_buf_sz) {
         chunk_reset(c);
         c->next = chunks;
@@ -305,6 +452,13 @@ void chunkqueue_append_file(chunkqueue * const restrict cq, const buffer * const
     }
 }
 
+void chunkqueue_append_file_ref(chunkqueue * const restrict cq, const buffer * const restrict fn, struct file_cache_entry * const restrict ref, off_t offset, off_t len) {
+    if (len > 0) {
+        file_cache_acquire(ref);
+        (chunkqueue_append_file_chunk(cq, fn, offset, len))->file.ref = ref;
+    }
+}
+
 
 static int chunkqueue_append_mem_extend_chunk(chunkqueue * const restrict cq, const char * const restrict mem, size_t len) {
 	chunk *c = cq->last;
@@ -327,6 +481,7 @@ void chunkqueue_append_buffer(chunkqueue * const restrict cq, buffer * const res
 	c = chunkqueue_append_mem_chunk(cq, chunk_buf_sz);
 	cq->bytes_in += len;
 	buffer_move(c->mem, mem);
+	chunk_mem_update(c);
 }
 
 
@@ -347,6 +502,7 @@ void chunkqueue_append_mem_min(chunkqueue * const restrict cq, const char * cons
 		return;
 
 	c = chunk_init(len+1);
+	chunk_mem_update(c);
 	chunkqueue_append_chunk(cq, c);
 	cq->bytes_in += len;
 	buffer_copy_string_len(c->mem, mem, len);
@@ -383,6 +539,7 @@ buffer * chunkqueue_prepend_buffer_open(chunkqueue *cq) {
 
 void chunkqueue_prepend_buffer_commit(chunkqueue *cq) {
 	cq->bytes_in += chunk_buffer_string_length(cq->first->mem);
+	chunk_mem_update(cq->first);
 }
 
 
@@ -399,6 +556,7 @@ buffer * chunkqueue_append_buffer_open(chunkqueue *cq) {
 
 void chunkqueue_append_buffer_commit(chunkqueue *cq) {
 	cq->bytes_in += chunk_buffer_string_length(cq->last->mem);
+	chunk_mem_update(cq->last);
 }
 
 
@@ -428,6 +586,9 @@ char * chunkqueue_get_memory(chunkqueue * const restrict cq, size_t * const rest
 void chunkqueue_use_memory(chunkqueue * const restrict cq, chunk *ckpt, size_t len) {
     buffer *b = cq->last->mem;
 
+    /*(caller might have grown buffer after chunkqueue_get_memory())*/
+    chunk_mem_update(cq->last);
+
     if (len > 0) {
         buffer_commit(b, len);
         cq->bytes_in += len;
@@ -435,6 +596,7 @@ void chunkqueue_use_memory(chunkqueue * const restrict cq, chunk *ckpt, size_t l
             || len > chunk_buffer_string_space(ckpt->mem)) return;
 
         buffer_append_string_buffer(ckpt->mem, b);
+        chunk_mem_update(ckpt);
     }
     else if (!chunk_buffer_string_is_empty(b)) { /*(cq->last == ckpt)*/
         return; /* last chunk is not empty */
@@ -448,6 +610,14 @@ void chunkqueue_use_memory(chunkqueue * const restrict cq, chunk *ckpt, size_t l
 
 void chunkqueue_set_tempdirs_default (const array *tempdirs, off_t upload_temp_file_size) {
 	chunkqueue_default_tempdirs = tempdirs;
+	if (tempdirs && tempdirs->used > chunk_spool_dir_n) {
+		chunk_spool_dir_used =
+		  realloc(chunk_spool_dir_used, tempdirs->used * sizeof(off_t));
+		force_assert(NULL != chunk_spool_dir_used);
+		memset(chunk_spool_dir_used + chunk_spool_dir_n, 0,
+		       (tempdirs->used - chunk_spool_dir_n) * sizeof(off_t));
+		chunk_spool_dir_n = tempdirs->used;
+	}
 	chunkqueue_default_tempfile_size
 		= (0 == upload_temp_file_size)                ? DEFAULT_TEMPFILE_SIZE
 		: (upload_temp_file_size > MAX_TEMPFILE_SIZE) ? MAX_TEMPFILE_SIZE
@@ -464,7 +634,23 @@ void chunkqueue_set_tempdirs(chunkqueue * const restrict cq, const array * const
 	cq->tempdir_idx = 0;
 }
 
-void chunkqueue_steal(chunkqueue * const restrict dest, chunkqueue * const restrict src, off_t len) {
+static int chunkqueue_append_file_split(chunkqueue * const restrict dest, chunk * const restrict c, off_t use) {
+	/* tempfile flag is in "last" chunk after the split */
+	if (!chunk_buffer_string_is_empty(c->mem)) {
+		chunkqueue_append_file(dest, c->mem, c->file.start + c->offset, use);
+		return 0;
+	}
+
+	/* unnamed tempfile (O_TMPFILE or memfd) can not be reopened */
+	const int fd = (c->file.fd >= 0) ? dup(c->file.fd) : (errno = EBADF, -1);
+	if (fd < 0) return -1;
+	fdevent_setfd_cloexec(fd);
+	chunkqueue_append_file_fd(dest, c->mem, fd, c->file.start + c->offset, use);
+	if (c->file.spool) chunk_spool_share(dest->last, c);
+	return 0;
+}
+
+int chunkqueue_steal(chunkqueue * const restrict dest, chunkqueue * const restrict src, off_t len) {
 	while (len > 0) {
 		chunk *c = src->first;
 		off_t clen = 0, use;
@@ -498,8 +684,8 @@ void chunkqueue_steal(chunkqueue * const restrict dest, chunkqueue * const restr
 				chunkqueue_append_mem(dest, c->mem->ptr + c->offset, use);
 				break;
 			case FILE_CHUNK:
-				/* tempfile flag is in "last" chunk after the split */
-				chunkqueue_append_file(dest, c->mem, c->file.start + c->offset, use);
+				if (0 != chunkqueue_append_file_split(dest, c, use))
+					return -1;
 				break;
 			}
 
@@ -509,25 +695,62 @@ void chunkqueue_steal(chunkqueue * const restrict dest, chunkqueue * const restr
 
 		src->bytes_out += use;
 	}
+
+	return 0;
 }
 
-static chunk *chunkqueue_get_append_tempfile(chunkqueue * const restrict cq, log_error_st * const restrict errh) {
+static int chunkqueue_tempfile_open(buffer * const restrict template, const char * const restrict dir, size_t dlen) {
+	buffer_copy_string_len(template, dir, dlen);
+  #if (defined(__linux__) || defined(__CYGWIN__)) && defined(O_TMPFILE)
+	/* unnamed tempfile; nothing to unlink() later
+	 * (fall back to mkstemp() if not supported by filesystem) */
+	const int fd = fdevent_open_cloexec(template->ptr, 1,
+	                                    O_RDWR | O_TMPFILE | O_APPEND, 0600);
+	if (fd >= 0) {
+		buffer_clear(template);
+		return fd;
+	}
+  #endif
+	buffer_append_path_len(template, CONST_STR_LEN("lighttpd-upload-XXXXXX"));
+	return fdevent_mkstemp_append(template->ptr);
+}
+
+static chunk *chunkqueue_get_append_tempfile(chunkqueue * const restrict cq, size_t len, log_error_st * const restrict errh) {
 	chunk *c;
-	buffer *template = buffer_init_string("/var/tmp/lighttpd-upload-XXXXXX");
+	buffer *template = buffer_init();
 	int fd = -1;
-
+	int spool = 0;
+
+  #ifdef HAVE_MEMFD_CREATE
+	/* keep tempfiles in memory (up to server.upload-memfd-size in total),
+	 * except while chunk memory is above server.chunk-memory-soft-limit */
+	if (chunk_spool_memfd_avail(len) && !chunkqueue_mem_pressure()
+	    && -1 != (fd = memfd_create("lighttpd-upload", MFD_CLOEXEC))) {
+		spool = -1;
+	}
+	else
+  #endif
 	if (cq->tempdirs && cq->tempdirs->used) {
 		/* we have several tempdirs, only if all of them fail we jump out */
 
 		for (errno = EIO; cq->tempdir_idx < cq->tempdirs->used; ++cq->tempdir_idx) {
 			data_string *ds = (data_string *)cq->tempdirs->data[cq->tempdir_idx];
 
-			buffer_copy_buffer(template, &ds->value);
-			buffer_append_path_len(template, CONST_STR_LEN("lighttpd-upload-XXXXXX"));
-			if (-1 != (fd = fdevent_mkstemp_append(template->ptr))) break;
+			if (chunk_spool_dir_full(cq->tempdir_idx, len)) {
+				/* server.upload-dir-max-size reached */
+				buffer_copy_buffer(template, &ds->value);
+				errno = ENOSPC;
+				continue;
+			}
+
+			if (-1 != (fd = chunkqueue_tempfile_open(template, CONST_BUF_LEN(&ds->value)))) {
+				if (cq->tempdirs == chunkqueue_default_tempdirs)
+					spool = (int)cq->tempdir_idx + 1;
+				break;
+			}
 		}
 	} else {
-		fd = fdevent_mkstemp_append(template->ptr);
+		fd = chunkqueue_tempfile_open(template, CONST_STR_LEN("/var/tmp"));
 	}
 
 	if (fd < 0) {
@@ -542,13 +765,41 @@ static chunk *chunkqueue_get_append_tempfile(chunkqueue * const restrict cq, log
 	c = chunkqueue_append_file_chunk(cq, template, 0, 0);
 	c->file.fd = fd;
 	c->file.is_temp = 1;
+	c->file.spool = spool;
 
 	buffer_free(template);
 
 	return c;
 }
 
-int chunkqueue_append_mem_to_tempfile(chunkqueue * const restrict dest, const char * restrict mem, size_t len, log_error_st * const restrict errh) {
+#if defined(HAVE_FALLOCATE) && defined(FALLOC_FL_KEEP_SIZE)
+static void chunk_tempfile_fallocate(const chunk * const c, size_t len) {
+	/* reserve space ahead of writes so that tempfile is allocated in larger
+	 * extents instead of block by block with each write()
+	 * (file size is unchanged; errors are ignored, e.g. if not supported
+	 *  by filesystem, since write() reports ENOSPC) */
+	const off_t sz = c->file.start + c->file.length;
+	const off_t m = TEMPFILE_FALLOC_SIZE - 1;
+	const off_t alloc = (sz + m) & ~m; /*(reserved by previous calls)*/
+	const off_t end = (sz + (off_t)len + m) & ~m;
+	if (end > alloc)
+		(void)fallocate(c->file.fd, FALLOC_FL_KEEP_SIZE, alloc, end - alloc);
+}
+#endif
+
+static int chunk_tempfile_append_ok(const chunkqueue * const cq, const chunk * const c, size_t len) {
+	/* unnamed tempfile can not be reopened, so is not closed when it reaches
+	 * cq->upload_temp_file_size.  Stop appending to it (start a new tempfile)
+	 * when server.upload-memfd-size is reached (memfd), or if cq->tempdir_idx
+	 * has moved on to the next tempdir (ENOSPC or server.upload-dir-max-size)*/
+	return (c->file.spool < 0)
+	  ? chunk_spool_memfd_avail(len)
+	  : (c->file.spool > 0)
+	  ? (uint32_t)c->file.spool == cq->tempdir_idx + 1
+	  : 1;
+}
+
+static int chunkqueue_append_iov_to_tempfile(chunkqueue * const restrict dest, struct iovec * restrict iov, int iovcnt, size_t len, log_error_st * const restrict errh) {
 	chunk *dst_c;
 	ssize_t written;
 
@@ -571,7 +822,11 @@ int chunkqueue_append_mem_to_tempfile(chunkqueue * const restrict dest, const ch
 			&& 0 == dst_c->offset) {
 			/* ok, take the last chunk for our job */
 
-			if (dst_c->file.length >= (off_t)dest->upload_temp_file_size) {
+			if (!chunk_tempfile_append_ok(dest, dst_c, len)) {
+				dst_c = NULL;
+			}
+			else if (dst_c->file.length >= (off_t)dest->upload_temp_file_size
+			         && !chunk_buffer_string_is_empty(dst_c->mem)) {
 				/* the chunk is too large now, close it */
 				int rc = close(dst_c->file.fd);
 				dst_c->file.fd = -1;
@@ -586,16 +841,33 @@ int chunkqueue_append_mem_to_tempfile(chunkqueue * const restrict dest, const ch
 			dst_c = NULL;
 		}
 
-		if (NULL == dst_c && NULL == (dst_c = chunkqueue_get_append_tempfile(dest, errh))) {
+		if (NULL == dst_c && NULL == (dst_c = chunkqueue_get_append_tempfile(dest, len, errh))) {
 			return -1;
 		}
 	      #ifdef __COVERITY__
 		if (dst_c->file.fd < 0) return -1;
 	      #endif
 
-		/* (dst_c->file.fd >= 0) */
-		/* coverity[negative_returns : FALSE] */
-		written = write(dst_c->file.fd, mem, len);
+		if (dst_c->file.spool > 0
+		    && chunk_spool_dir_full((uint32_t)dst_c->file.spool - 1, len)) {
+			/* server.upload-dir-max-size reached */
+			errno = ENOSPC;
+			written = -1;
+		}
+		else {
+		  #if defined(HAVE_FALLOCATE) && defined(FALLOC_FL_KEEP_SIZE)
+			if (dst_c->file.spool >= 0)
+				chunk_tempfile_fallocate(dst_c, len);
+		  #endif
+			/* (dst_c->file.fd >= 0) */
+			/* coverity[negative_returns : FALSE] */
+			written = writev(dst_c->file.fd, iov, iovcnt);
+		}
+
+		if (written >= 0) {
+			off_t * const used = chunk_spool_used(dst_c->file.spool);
+			if (used) *used += written;
+		}
 
 		if ((size_t) written == len) {
 			dst_c->file.length += len;
@@ -606,9 +878,12 @@ int chunkqueue_append_mem_to_tempfile(chunkqueue * const restrict dest, const ch
 			/*(assume EINTR if partial write and retry write();
 			 * retry write() might fail with ENOSPC if no more space on volume)*/
 			dest->bytes_in += written;
-			mem += written;
 			len -= (size_t)written;
 			dst_c->file.length += (size_t)written;
+			for (; (size_t)written >= iov->iov_len; ++iov, --iovcnt)
+				written -= (ssize_t)iov->iov_len;
+			iov->iov_base = (char *)iov->iov_base + written;
+			iov->iov_len -= (size_t)written;
 			/* continue; retry */
 		} else if (errno == EINTR) {
 			/* continue; retry */
@@ -622,7 +897,10 @@ int chunkqueue_append_mem_to_tempfile(chunkqueue * const restrict dest, const ch
 			if (0 == chunk_remaining_length(dst_c)) {
 				/*(remove empty chunk and unlink tempfile)*/
 				chunkqueue_remove_empty_chunks(dest);
-			} else {/*(close tempfile; avoid later attempts to append)*/
+			} else if (!chunk_buffer_string_is_empty(dst_c->mem)) {
+				/*(close tempfile; avoid later attempts to append)*/
+				/*(unnamed tempfile is kept open; not appended to
+				 * once dest->tempdir_idx has changed)*/
 				int rc = close(dst_c->file.fd);
 				dst_c->file.fd = -1;
 				if (0 != rc) {
@@ -641,6 +919,11 @@ int chunkqueue_append_mem_to_tempfile(chunkqueue * const restrict dest, const ch
 	return -1;
 }
 
+int chunkqueue_append_mem_to_tempfile(chunkqueue * const restrict dest, const char * restrict mem, size_t len, log_error_st * const restrict errh) {
+	struct iovec iov = { (void *)(uintptr_t)mem, len };
+	return chunkqueue_append_iov_to_tempfile(dest, &iov, 1, len, errh);
+}
+
 int chunkqueue_steal_with_tempfiles(chunkqueue * const restrict dest, chunkqueue * const restrict src, off_t len, log_error_st * const restrict errh) {
 	while (len > 0) {
 		chunk *c = src->first;
@@ -670,8 +953,11 @@ int chunkqueue_steal_with_tempfiles(chunkqueue * const restrict dest, chunkqueue
 				dest->bytes_in += use;
 			} else {
 				/* partial chunk with length "use" */
-				/* tempfile flag is in "last" chunk after the split */
-				chunkqueue_append_file(dest, c->mem, c->file.start + c->offset, use);
+				if (0 != chunkqueue_append_file_split(dest, c, use)) {
+					log_perror(errh, __FILE__, __LINE__,
+					  "dup() temp-file failed");
+					return -1;
+				}
 
 				c->offset += use;
 				force_assert(0 == len);
@@ -679,21 +965,47 @@ int chunkqueue_steal_with_tempfiles(chunkqueue * const restrict dest, chunkqueue
 			break;
 
 		case MEM_CHUNK:
-			/* store "use" bytes from memory chunk in tempfile */
-			if (0 != chunkqueue_append_mem_to_tempfile(dest, c->mem->ptr + c->offset, use, errh)) {
+		  {
+			/* store "use" bytes from consecutive memory chunks in tempfile
+			 * (single writev() for up to TEMPFILE_MAX_IOVEC chunks) */
+			struct iovec iov[TEMPFILE_MAX_IOVEC];
+			int iovcnt = 1;
+			iov[0].iov_base = c->mem->ptr + c->offset;
+			iov[0].iov_len = (size_t)use;
+			for (const chunk *n = c->next;
+			     NULL != n && MEM_CHUNK == n->type
+			       && iovcnt < TEMPFILE_MAX_IOVEC && len > 0;
+			     n = n->next) {
+				off_t nlen = chunk_remaining_length(n);
+				if (0 == nlen) continue;
+				if (nlen > len) nlen = len;
+				iov[iovcnt].iov_base = n->mem->ptr + n->offset;
+				iov[iovcnt].iov_len = (size_t)nlen;
+				++iovcnt;
+				use += nlen;
+				len -= nlen;
+			}
+
+			if (0 != chunkqueue_append_iov_to_tempfile(dest, iov, iovcnt, (size_t)use, errh)) {
 				return -1;
 			}
 
-			if (use == clen) {
-				/* finished chunk */
-				src->first = c->next;
-				if (c == src->last) src->last = NULL;
-				chunk_release(c);
-			} else {
-				/* partial chunk */
-				c->offset += use;
-				force_assert(0 == len);
+			for (off_t n = use; n > 0; n -= clen) {
+				c = src->first;
+				clen = chunk_remaining_length(c);
+				if (clen <= n) {
+					/* finished chunk */
+					src->first = c->next;
+					if (c == src->last) src->last = NULL;
+					chunk_release(c);
+				} else {
+					/* partial chunk */
+					c->offset += n;
+					force_assert(0 == len);
+					break;
+				}
 			}
+		  }
 			break;
 		}
 
@@ -779,7 +1091,11 @@ void chunkqueue_compact_mem(chunkqueue *cq, size_t clen) {
     }
     for (chunk *fc = c; ((clen -= len) && (c = fc->next)); ) {
         len = buffer_string_length(c->mem) - c->offset;
-        if (len > clen) len = clen;
+        if (len > clen) { /* consolidate partial chunk; keep remainder */
+            buffer_append_string_len(b, c->mem->ptr + c->offset, clen);
+            c->offset += clen;
+            break;
+        }
         buffer_append_string_len(b, c->mem->ptr + c->offset, len);
         fc->next = c->next;
         if (NULL == c->next) cq->last = fc;
@@ -10,12 +10,15 @@
 #include "array.h"
 
 struct log_error_st;    /*(declaration)*/
+struct file_cache_entry;/*(declaration)*/
+struct chunk_spool;     /*(declaration)*/
 
 typedef struct chunk {
 	struct chunk *next;
 	enum { MEM_CHUNK, FILE_CHUNK } type;
 
 	buffer *mem; /* either the storage of the mem-chunk or the name of the file */
+	uint32_t msize; /* mem->size counted in chunk memory in use */
 
 	/* the size of the chunk is either:
 	 * - mem-chunk: buffer_string_length(chunk::mem)
@@ -30,11 +33,14 @@ typedef struct chunk {
 
 		int    fd;
 		int is_temp; /* file is temporary and will be deleted if on cleanup */
+		int spool; /* (temp file) server.upload-dirs index + 1; -1 if memfd */
+		struct chunk_spool *spool_ref; /* (temp file) shared by split chunks */
 		struct {
 			char   *start; /* the start pointer of the mmap'ed area */
 			size_t length; /* size of the mmap'ed area */
 			off_t  offset; /* start is <n> octet away from the start of the file */
 		} mmap;
+		struct file_cache_entry *ref; /* cached file content (see file_cache.h) */
 	} file;
 } chunk;
 
@@ -61,11 +67,26 @@ __attribute_returns_nonnull__
 chunkqueue *chunkqueue_init(void);
 
 void chunkqueue_set_chunk_size (size_t sz);
+void chunkqueue_set_mem_limits (off_t soft_limit, off_t hard_limit);
+
+/* server-wide memory held in chunks of all chunkqueues (bytes) */
+__attribute_pure__
+off_t chunkqueue_mem_used (void);
+
+#define CHUNK_MEM_SOFT 1 /* above soft limit: spill to temp files sooner */
+#define CHUNK_MEM_HARD 2 /* above hard limit: defer reading request bodies */
+
+/* 0 if chunk memory in use is below soft limit (or no limits configured),
+ * else CHUNK_MEM_SOFT or CHUNK_MEM_HARD */
+__attribute_pure__
+int chunkqueue_mem_pressure (void);
 void chunkqueue_set_tempdirs_default_reset (void);
 void chunkqueue_set_tempdirs_default (const array *tempdirs, off_t upload_temp_file_size);
 void chunkqueue_set_tempdirs(chunkqueue * restrict cq, const array * restrict tempdirs, off_t upload_temp_file_size);
+void chunkqueue_set_spool_limits (off_t memfd_limit, off_t dir_limit);
 void chunkqueue_append_file(chunkqueue * restrict cq, const buffer * restrict fn, off_t offset, off_t len); /* copies "fn" */
 void chunkqueue_append_file_fd(chunkqueue * restrict cq, const buffer * restrict fn, int fd, off_t offset, off_t len); /* copies "fn" */
+void chunkqueue_append_file_ref(chunkqueue * restrict cq, const buffer * restrict fn, struct file_cache_entry * restrict ref, off_t offset, off_t len); /* copies "fn"; acquires reference to "ref" */
 void chunkqueue_append_mem(chunkqueue * restrict cq, const char * restrict mem, size_t len); /* copies memory */
 void chunkqueue_append_mem_min(chunkqueue * restrict cq, const char * restrict mem, size_t len); /* copies memory */
 void chunkqueue_append_buffer(chunkqueue * restrict cq, buffer * restrict mem); /* may reset "mem" */
@@ -109,7 +130,9 @@ void chunkqueue_mark_written(chunkqueue *cq, off_t len);
 
 void chunkqueue_remove_finished_chunks(chunkqueue *cq);
 
-void chunkqueue_steal(chunkqueue * restrict dest, chunkqueue * restrict src, off_t len);
+/* returns -1 (errno set) if part of an unnamed temp file could not be split
+ * off (dup() failed); src is left unchanged from that chunk onwards */
+int chunkqueue_steal(chunkqueue * restrict dest, chunkqueue * restrict src, off_t len);
 int chunkqueue_steal_with_tempfiles(chunkqueue * restrict dest, chunkqueue * restrict src, off_t len, struct log_error_st * const restrict errh);
 
 int chunkqueue_open_file_chunk(chunkqueue * restrict cq, struct log_error_st * const restrict errh);
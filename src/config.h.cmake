@@ -15,6 +15,7 @@
 /* System */
 #cmakedefine  HAVE_SYS_DEVPOLL_H
 #cmakedefine  HAVE_SYS_EPOLL_H
+#cmakedefine  HAVE_SYS_EVENTFD_H
 #cmakedefine  HAVE_SYS_EVENT_H
 #cmakedefine  HAVE_SYS_LOADAVG_H
 #cmakedefine  HAVE_SYS_MMAN_H
@@ -63,6 +64,7 @@
 /* LDAP */
 #cmakedefine  HAVE_LDAP_H
 #cmakedefine  HAVE_LIBLDAP
+#cmakedefine  HAVE_LIBLDAP_R
 #cmakedefine  HAVE_LBER_H
 #cmakedefine  HAVE_LIBLBER
 
@@ -71,6 +73,9 @@
 #cmakedefine  HAVE_LIBXML
 
 /* PCRE */
+#cmakedefine  HAVE_PCRE
+#cmakedefine  HAVE_PCRE2_H
+#cmakedefine  HAVE_LIBPCRE2
 #cmakedefine  HAVE_PCRE_H
 #cmakedefine  HAVE_LIBPCRE
 
@@ -116,6 +121,7 @@
 /* Functions */
 #cmakedefine  HAVE_CHROOT
 #cmakedefine  HAVE_EPOLL_CTL
+#cmakedefine  HAVE_FALLOCATE
 #cmakedefine  HAVE_FORK
 #cmakedefine  HAVE_GETRLIMIT
 #cmakedefine  HAVE_GETUID
@@ -126,6 +132,7 @@
 #cmakedefine  HAVE_LSTAT
 #cmakedefine  HAVE_MADVISE
 #cmakedefine  HAVE_MEMCPY
+#cmakedefine  HAVE_MEMFD_CREATE
 #cmakedefine  HAVE_MEMSET
 #cmakedefine  HAVE_MMAP
 #cmakedefine  HAVE_PATHCONF
@@ -133,6 +140,7 @@
 #cmakedefine  HAVE_PORT_CREATE
 #cmakedefine  HAVE_PRCTL
 #cmakedefine  HAVE_PREAD
+#cmakedefine  HAVE_PREADV2
 #cmakedefine  HAVE_POSIX_FADVISE
 #cmakedefine  HAVE_SELECT
 #cmakedefine  HAVE_SENDFILE
@@ -6,6 +6,7 @@
 #include "log.h"
 #include "http_header.h"
 #include "sock_addr.h"
+#include "ipset.h"
 
 #include "configfile.h"
 #include "plugin.h"
@@ -28,6 +29,7 @@
 static struct {
     const data_config * const *data; /* (srv->config_context->data) */
     uint32_t used;                   /* (srv->config_context->used) */
+    uint32_t nindex;                 /* (srv->srvconf.cond_index_used) */
 } config_reference;
 
 
@@ -61,6 +63,15 @@ int config_plugin_value_tobool (data_unset *du, int default_value)
         return default_value;
 }
 
+int config_feature_bool (const server *srv, const char *feature, int default_value)
+{
+    return srv->srvconf.feature_flags
+      ? config_plugin_value_tobool(
+          array_get_element_klen(srv->srvconf.feature_flags,
+                                 feature, strlen(feature)), default_value)
+      : default_value;
+}
+
 int config_plugin_values_init_block(server * const srv, const array * const ca, const config_plugin_keys_t * const cpk, const char * const mname, config_plugin_value_t *cpv) {
     /*(cpv must be list with sufficient elements to store all matches + 1)*/
 
@@ -259,6 +270,7 @@ int config_plugin_values_init(server * const srv, void *p_d, const config_plugin
      * (config_plugin_values_init() is called with same srv->config_context) */
     config_reference.data = (const data_config * const *)srv->config_context->data;
     config_reference.used = srv->config_context->used;
+    config_reference.nindex = srv->srvconf.cond_index_used;
 
     /* traverse config contexts twice: once to count, once to store matches */
 
@@ -413,6 +425,17 @@ static int config_addrbuf_eq_remote_ip_mask(request_st * const r, const buffer *
 
 static int data_config_pcre_exec(const data_config *dc, cond_cache_t *cache, const buffer *b, cond_match_t *cond_match);
 
+static int config_cond_index_match(request_st * const r, const data_config * const dc, const buffer * const l) {
+    /* hash lookup once per request for all == conditions in index
+     * (l is the same for all members of index) */
+    int32_t * const m = r->cond_index + dc->index->id;
+    if (0 == *m) {
+        const data_config * const e = data_config_index_lookup(dc->index, l);
+        *m = (NULL != e) ? e->context_ndx : -1;
+    }
+    return (*m == dc->context_ndx);
+}
+
 static cond_result_t config_check_cond_nocache(request_st * const r, const data_config * const dc, const int debug_cond, cond_cache_t * const cache) {
 	static struct const_char_buffer {
 	  const char *ptr;
@@ -532,6 +555,14 @@ static cond_result_t config_check_cond_nocache(request_st * const r, const data_
 
 		break;
 	case COMP_HTTP_REMOTE_IP: {
+		if (dc->ipset) { /* == or != CIDR mask(s) (see configfile.c) */
+			/*("file:" ipset reloaded by config_remoteip_ipset_check())*/
+			return (dc->cond == CONFIG_COND_EQ)
+			       == ipset_contains(dc->ipset, &r->con->dst_addr)
+			  ? COND_RESULT_TRUE
+			  : COND_RESULT_FALSE;
+		}
+
 		char *nm_slash;
 		/* handle remoteip limitations
 		 *
@@ -597,7 +628,9 @@ static cond_result_t config_check_cond_nocache(request_st * const r, const data_
 	switch(dc->cond) {
 	case CONFIG_COND_NE:
 	case CONFIG_COND_EQ:
-		if (buffer_is_equal(l, &dc->string)) {
+		if (NULL != dc->index
+		    ? config_cond_index_match(r, dc, l)
+		    : buffer_is_equal(l, &dc->string)) {
 			return (dc->cond == CONFIG_COND_EQ) ? COND_RESULT_TRUE : COND_RESULT_FALSE;
 		} else {
 			return (dc->cond == CONFIG_COND_EQ) ? COND_RESULT_FALSE : COND_RESULT_TRUE;
@@ -640,6 +673,68 @@ int config_check_cond(request_st * const r, const int context_ndx) {
               : config_check_cond_calc(r, context_ndx, cache));
 }
 
+__attribute_noinline__
+static void config_check_cond_true_calc(request_st * const r) {
+    /* evaluate all conditions and save list of those which match request
+     * (list is recalculated if conditional_is_valid changes or if cond_cache
+     *  is reset; high bit of cond_true_valid marks list as calculated) */
+    uint32_t * const cond_true = r->cond_true;
+    uint32_t n = 0;
+    for (uint32_t i = 1, used = config_reference.used; i < used; ++i) {
+        const data_config * const dc = config_reference.data[i];
+        if (!(r->conditional_is_valid & (1 << dc->comp)))
+            continue; /* not yet valid; cond is not true */
+        if (dc->index) {
+            /* skip members of index which did not match lookup */
+            const int32_t m = r->cond_index[dc->index->id];
+            if (0 != m && (int32_t)i != m) continue;
+        }
+        if (config_check_cond(r, (int)i)) cond_true[n++] = i;
+    }
+    r->cond_true_used = n;
+    r->cond_true_valid = r->conditional_is_valid | 0x80000000u;
+}
+
+/* Return index of next element in plugin cvlist[] at or after i whose
+ * condition matches request, or used if there are no more matches.
+ * (cvlist[1..used-1] is sorted by condition context_ndx (cvlist[].k_id)) */
+int config_check_cond_next(request_st * const r, const config_plugin_value_t * const cvlist, int i, const int used) {
+    if (used - i <= CONFIG_COND_SCAN_MAX || NULL == r->cond_true) {
+        for (; i < used; ++i) {
+            if (config_check_cond(r, cvlist[i].k_id)) break;
+        }
+        return i;
+    }
+
+    if (r->cond_true_valid != (r->conditional_is_valid | 0x80000000u))
+        config_check_cond_true_calc(r);
+
+    /* binary search for first matching condition >= cvlist[i].k_id */
+    const uint32_t * const cond_true = r->cond_true;
+    const uint32_t n = r->cond_true_used;
+    uint32_t lo = 0, hi = n;
+    while (lo < hi) {
+        const uint32_t mid = (lo + hi) >> 1;
+        if (cond_true[mid] < (uint32_t)cvlist[i].k_id) lo = mid + 1;
+        else hi = mid;
+    }
+
+    /* binary search in remainder of cvlist for each matching condition */
+    for (; lo < n; ++lo) {
+        const int k_id = (int)cond_true[lo];
+        int l = i, h = used;
+        while (l < h) {
+            const int mid = (l + h) >> 1;
+            if (cvlist[mid].k_id < k_id) l = mid + 1;
+            else h = mid;
+        }
+        if (l == used) break;
+        if (cvlist[l].k_id == k_id) return l;
+        i = l;
+    }
+    return used;
+}
+
 /* if we reset the cache result for a node, we also need to clear all
  * child nodes and else-branches*/
 static void config_cond_clear_node(cond_cache_t * const cond_cache, const data_config * const dc) {
@@ -667,12 +762,14 @@ void config_cond_cache_reset_item(request_st * const r, comp_key_t item) {
 	cond_cache_t * const cond_cache = r->cond_cache;
 	const data_config * const * const data = config_reference.data;
 	const uint32_t used = config_reference.used;
+	r->cond_true_valid = 0;
 	for (uint32_t i = 0; i < used; ++i) {
 		const data_config * const dc = data[i];
 
 		if (item == dc->comp) {
 			/* clear local_result */
 			cond_cache[i].local_result = COND_RESULT_UNSET;
+			if (dc->index) r->cond_index[dc->index->id] = 0;
 			/* clear result in subtree (including the node itself) */
 			config_cond_clear_node(cond_cache, dc);
 		}
@@ -686,16 +783,37 @@ void config_cond_cache_reset(request_st * const r) {
 	/* resetting all entries; no need to follow children as in config_cond_cache_reset_item */
 	/* static_assert(0 == COND_RESULT_UNSET); */
 	const uint32_t used = config_reference.used;
+	r->cond_true_valid = 0;
 	if (used > 1)
 		memset(r->cond_cache, 0, used*sizeof(cond_cache_t));
+	if (config_reference.nindex)
+		memset(r->cond_index, 0, config_reference.nindex*sizeof(int32_t));
 }
 
-#ifdef HAVE_PCRE_H
+#ifdef HAVE_PCRE2_H
+#define PCRE2_CODE_UNIT_WIDTH 8
+#include <pcre2.h>
+#elif defined(HAVE_PCRE_H)
 #include <pcre.h>
 #endif
 
 static int data_config_pcre_exec(const data_config *dc, cond_cache_t *cache, const buffer *b, cond_match_t *cond_match) {
-#ifdef HAVE_PCRE_H
+#ifdef HAVE_PCRE2_H
+    /* match data is shared by all requests and is overwritten by the next
+     * match with this regex, so copy capture offsets to cond_match
+     * (captures <= 9, so ovector fits in cond_match->matches) */
+    cache->patterncount =
+      pcre2_match(dc->code, (PCRE2_SPTR)CONST_BUF_LEN(b), 0, 0,
+                  dc->match_data, NULL);
+    if (cache->patterncount > 0) {
+        const PCRE2_SIZE * const ovec =
+          pcre2_get_ovector_pointer(dc->match_data);
+        for (int i = 0, n = cache->patterncount << 1; i < n; ++i)
+            cond_match->matches[i] = (int)ovec[i]; /*(PCRE2_UNSET => -1)*/
+        cond_match->comp_value = b; /*holds pointer to b (!) for pattern subst*/
+    }
+    return cache->patterncount;
+#elif defined(HAVE_PCRE_H)
     #ifndef elementsof
     #define elementsof(x) (sizeof(x) / sizeof(x[0]))
     #endif
@@ -4,6 +4,7 @@
 #include "burl.h"
 #include "etag.h"
 #include "fdevent.h"
+#include "ipset.h"
 #include "keyvalue.h"
 #include "log.h"
 #include "stream.h"
@@ -204,7 +205,7 @@ void config_patch_config(request_st * const r) {
     /*memcpy(&r->conf, &p->defaults, sizeof(request_config));*/
 
     for (int i = 1, used = p->nconfig; i < used; ++i) {
-        if (config_check_cond(r, (uint32_t)p->cvlist[i].k_id))
+        if ((i = config_check_cond_next(r, p->cvlist, i, used)) < used)
             config_merge_config(&r->conf, p->cvlist + p->cvlist[i].v.u2[0]);
     }
 }
@@ -216,7 +217,7 @@ void config_reset_config(request_st * const r) {
     memcpy(&r->conf, &p->defaults, sizeof(request_config));
 }
 
-static int config_burl_normalize_cond (server *srv) {
+static int config_burl_normalize_cond (server *srv, const int pcre_jit) {
     buffer * const tb = srv->tmp_buf;
     for (uint32_t i = 0; i < srv->config_context->used; ++i) {
         data_config * const config =(data_config *)srv->config_context->data[i];
@@ -231,7 +232,7 @@ static int config_burl_normalize_cond (server *srv) {
         case CONFIG_COND_NOMATCH:
         case CONFIG_COND_MATCH:
             pcre_keyvalue_burl_normalize_key(&config->string, tb);
-            if (!data_config_pcre_compile(config)) return 0;
+            if (!data_config_pcre_compile(config, pcre_jit)) return 0;
             break;
         default:
             break;
@@ -241,6 +242,133 @@ static int config_burl_normalize_cond (server *srv) {
     return 1;
 }
 
+static int config_pcre_jit_cond (server *srv) {
+    /* recompile regex conditions with JIT
+     * (configparser compiles regex without JIT since server.feature-flags
+     *  has not yet been processed; skip query string conditions which were
+     *  already recompiled by config_burl_normalize_cond()) */
+    for (uint32_t i = 0; i < srv->config_context->used; ++i) {
+        data_config * const config =(data_config *)srv->config_context->data[i];
+        if (COMP_HTTP_QUERY_STRING == config->comp
+            && srv->srvconf.http_url_normalize) continue;
+        switch(config->cond) {
+        case CONFIG_COND_NOMATCH:
+        case CONFIG_COND_MATCH:
+            if (!data_config_pcre_compile(config, 1)) return 0;
+            break;
+        default:
+            break;
+        }
+    }
+
+    return 1;
+}
+
+static int config_remoteip_ipset (server *srv) {
+    /* compile $HTTP["remoteip"] == and != conditions with CIDR mask, list of
+     * addrs and CIDR masks, or "file:/path/to/list" into radix tree ipset
+     * (instead of parsing addr and mask strings for each request) */
+    for (uint32_t i = 0; i < srv->config_context->used; ++i) {
+        data_config * const dc = (data_config *)srv->config_context->data[i];
+        if (COMP_HTTP_REMOTE_IP != dc->comp) continue;
+        if (dc->cond != CONFIG_COND_EQ && dc->cond != CONFIG_COND_NE) continue;
+        const char * const s = dc->string.ptr;
+        int rc;
+        if (0 == strncmp(s, "file:", 5)) {
+            dc->ipset = ipset_init();
+            rc = ipset_load_file(dc->ipset, s+5, srv->errh);
+        }
+        else if (s[0] != '/' && NULL != strpbrk(s, "/, \t\r\n")) {
+            dc->ipset = ipset_init();
+            rc = ipset_insert_list(dc->ipset, s, srv->errh);
+        }
+        else /*(single addr is compared as string; skip AF_UNIX /path/file)*/
+            continue;
+        if (!rc) {
+            log_error(srv->errh, __FILE__, __LINE__,
+              "invalid condition: $HTTP[\"remoteip\"] %s \"%s\"", dc->op, s);
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+void config_remoteip_ipset_check (server * const srv) {
+    /* reload $HTTP["remoteip"] "file:..." ipsets if file changed
+     * (periodic; requests only read current set in config_check_cond()) */
+    for (uint32_t i = 0; i < srv->config_context->used; ++i) {
+        data_config * const dc = (data_config *)srv->config_context->data[i];
+        if (dc->ipset) ipset_file_check(dc->ipset, srv->errh);
+    }
+}
+
+__attribute_pure__
+static int config_cond_indexable (const data_config * const dc) {
+    if (dc->cond != CONFIG_COND_EQ) return 0;
+    switch (dc->comp) {
+      case COMP_HTTP_HOST:
+        /*("host:port" compares with port appended to request host, if missing)*/
+        return (NULL == strchr(dc->string.ptr, ':'));
+      case COMP_HTTP_REMOTE_IP:
+        /*("addr/mask" and lists of addrs compare with ipset)
+         *(test string, too, and not only dc->ipset, so that result does not
+         * depend on whether ipsets have been compiled yet)*/
+        return (NULL == dc->ipset
+                && NULL == strpbrk(dc->string.ptr, "/, \t\r\n"));
+      case COMP_SERVER_SOCKET:
+      case COMP_HTTP_URL:
+      case COMP_HTTP_QUERY_STRING:
+      case COMP_HTTP_SCHEME:
+      case COMP_HTTP_REQUEST_METHOD:
+      case COMP_HTTP_REQUEST_HEADER:
+        return 1;
+      default:
+        return 0;
+    }
+}
+
+__attribute_pure__
+static int config_cond_index_same (const data_config * const a, const data_config * const b) {
+    return a->comp == b->comp
+        && (a->comp != COMP_HTTP_REQUEST_HEADER
+            || buffer_is_equal_caseless_string(a->comp_tag,
+                                               CONST_BUF_LEN(b->comp_tag)))
+        && config_cond_indexable(b);
+}
+
+static void config_cond_index_build (server *srv) {
+    /* build hash index over == conditions on same comp_key in sibling blocks
+     * when there are many, e.g. thousands of $HTTP["host"] == "..." vhosts
+     * (indexes are not shared between different parents, so that the result
+     *  of a lookup is valid for all members once parent cond is true) */
+    const array * const a = srv->config_context;
+    uint32_t nindex = 0;
+    for (uint32_t i = 0; i < a->used; ++i) {
+        const vector_config_weak * const children =
+          &((data_config *)a->data[i])->children;
+        for (uint32_t j = 0; j < children->used; ++j) {
+            data_config * const dc = children->data[j];
+            if (NULL != dc->index || !config_cond_indexable(dc)) continue;
+            uint32_t n = 1;
+            for (uint32_t k = j+1; k < children->used; ++k) {
+                const data_config * const dck = children->data[k];
+                if (NULL == dck->index && config_cond_index_same(dc, dck)) ++n;
+            }
+            if (n < 8) continue; /* not worthwhile for a few conditions */
+            data_config_index * const idx =
+              data_config_index_init(dc, n, nindex++);
+            data_config_index_insert(idx, dc);
+            for (uint32_t k = j+1; k < children->used; ++k) {
+                data_config * const dck = children->data[k];
+                if (NULL == dck->index && config_cond_index_same(dc, dck))
+                    data_config_index_insert(idx, dck);
+            }
+        }
+    }
+    srv->srvconf.cond_index_used = nindex;
+}
+
 #if defined(HAVE_MYSQL) || (defined(HAVE_LDAP_H) && defined(HAVE_LBER_H) && defined(HAVE_LIBLDAP) && defined(HAVE_LIBLBER))
 static void config_warn_authn_module (server *srv, const char *module, size_t len) {
 	for (uint32_t i = 0; i < srv->config_context->used; ++i) {
@@ -650,6 +778,24 @@ static int config_insert_srvconf(server *srv) {
      ,{ CONST_STR_LEN("server.feature-flags"),
         T_CONFIG_ARRAY_KVANY,
         T_CONFIG_SCOPE_SERVER }
+     ,{ CONST_STR_LEN("server.io-threads"),
+        T_CONFIG_SHORT,
+        T_CONFIG_SCOPE_SERVER }
+     ,{ CONST_STR_LEN("server.file-cache-size"),
+        T_CONFIG_INT,
+        T_CONFIG_SCOPE_SERVER }
+     ,{ CONST_STR_LEN("server.chunk-memory-soft-limit"),
+        T_CONFIG_INT,
+        T_CONFIG_SCOPE_SERVER }
+     ,{ CONST_STR_LEN("server.chunk-memory-hard-limit"),
+        T_CONFIG_INT,
+        T_CONFIG_SCOPE_SERVER }
+     ,{ CONST_STR_LEN("server.upload-memfd-size"),
+        T_CONFIG_INT,
+        T_CONFIG_SCOPE_SERVER }
+     ,{ CONST_STR_LEN("server.upload-dir-max-size"),
+        T_CONFIG_INT,
+        T_CONFIG_SCOPE_SERVER }
      ,{ NULL, 0,
         T_CONFIG_UNSET,
         T_CONFIG_SCOPE_UNSET }
@@ -663,6 +809,8 @@ static int config_insert_srvconf(server *srv) {
         return HANDLER_ERROR;
 
     int ssl_enabled = 0; /*(directive checked here only to set default port)*/
+    off_t chunk_mem_soft_limit = 0, chunk_mem_hard_limit = 0; /* kbytes */
+    off_t upload_memfd_size = 0, upload_dir_max_size = 0;     /* kbytes */
 
     /* process and validate T_CONFIG_SCOPE_SERVER config directives */
     if (p->cvlist[0].v.u2[1]) {
@@ -785,6 +933,24 @@ static int config_insert_srvconf(server *srv) {
               case 33:/* server.feature-flags */
                 srv->srvconf.feature_flags = cpv->v.a;
                 break;
+              case 34:/* server.io-threads */
+                srv->srvconf.io_threads = cpv->v.shrt;
+                break;
+              case 35:/* server.file-cache-size */
+                srv->srvconf.file_cache_size = cpv->v.u;
+                break;
+              case 36:/* server.chunk-memory-soft-limit */
+                chunk_mem_soft_limit = (off_t)cpv->v.u;
+                break;
+              case 37:/* server.chunk-memory-hard-limit */
+                chunk_mem_hard_limit = (off_t)cpv->v.u;
+                break;
+              case 38:/* server.upload-memfd-size */
+                upload_memfd_size = (off_t)cpv->v.u;
+                break;
+              case 39:/* server.upload-dir-max-size */
+                upload_dir_max_size = (off_t)cpv->v.u;
+                break;
               default:/* should not happen */
                 break;
             }
@@ -794,14 +960,33 @@ static int config_insert_srvconf(server *srv) {
     if (0 == srv->srvconf.port)
         srv->srvconf.port = ssl_enabled ? 443 : 80;
 
+    chunkqueue_set_mem_limits(chunk_mem_soft_limit << 10,
+                              chunk_mem_hard_limit << 10);
+    chunkqueue_set_spool_limits(upload_memfd_size << 10,
+                                upload_dir_max_size << 10);
+
     if (srv->srvconf.compat_module_load)
         config_compat_module_load(srv);
 
     config_deprecate_module_compress(srv);
 
-    if (srv->srvconf.http_url_normalize && !config_burl_normalize_cond(srv))
+    const int pcre_jit = config_feature_bool(srv, "server.pcre_jit", 1);
+
+    if (srv->srvconf.http_url_normalize
+        && !config_burl_normalize_cond(srv, pcre_jit))
+        rc = HANDLER_ERROR;
+
+    if (pcre_jit && !config_pcre_jit_cond(srv))
+        rc = HANDLER_ERROR;
+
+    if (!config_remoteip_ipset(srv))
         rc = HANDLER_ERROR;
 
+    /* (must be built after == condition strings are final, i.e. after query
+     *  string conditions are normalized and remoteip ipsets are compiled;
+     *  strings are hashed into index) */
+    config_cond_index_build(srv);
+
     free(srvplug.cvlist);
     return rc;
 }
@@ -1379,9 +1564,10 @@ void config_log_error_cycle(server *srv) {
                     log_perror(srv->errh, __FILE__, __LINE__,
                       "cycling errorlog '%s' failed", errh->fn);
                 }
-                else if (0 == i && errh != srv->errh) { /*(server.breakagelog)*/
+                else if (0 == i && errh != srv->errh /*(server.breakagelog)*/
+                         && STDERR_FILENO != errh->errorlog_fd) {
                     int fd = errh->errorlog_fd;
-                    if (STDERR_FILENO != dup2(fd, STDERR_FILENO)) {
+                    if (STDERR_FILENO == dup2(fd, STDERR_FILENO)) {
                         errh->errorlog_fd = STDERR_FILENO;
                         close(fd);
                     }
@@ -13,13 +13,26 @@
  * for compare: comp          cond  string/regex
  */
 
-#ifdef HAVE_PCRE_H
+#ifdef HAVE_PCRE2_H
+struct pcre2_real_code_8;       /* declaration */
+struct pcre2_real_match_data_8; /* declaration */
+#elif defined(HAVE_PCRE_H)
 struct pcre_extra;      /* declaration */
 #endif
 
 typedef struct data_config data_config;
 DEFINE_TYPED_VECTOR_NO_RELEASE(config_weak, data_config*);
 
+/* hash index over == conditions on the same comp_key in sibling blocks
+ * (blocks with same parent), so that the matching block is found with one
+ * hash lookup per request instead of a string compare per block */
+typedef struct data_config_index {
+	const data_config *owner; /* (first member in index) */
+	uint32_t id;              /* ndx into per-request lookup results */
+	uint32_t mask;            /* (hash table size - 1); size is power of 2 */
+	const data_config *table[];
+} data_config_index;
+
 struct data_config {
 	DATA_UNSET;
 	int context_ndx; /* more or less like an id */
@@ -33,13 +46,18 @@ struct data_config {
 	data_config *next;
 
 	buffer string;
-#ifdef HAVE_PCRE_H
+#ifdef HAVE_PCRE2_H
+	struct pcre2_real_code_8 *code;
+	struct pcre2_real_match_data_8 *match_data;
+#elif defined(HAVE_PCRE_H)
 	void *regex;
 	struct pcre_extra *regex_study;
 #endif
 	buffer *comp_tag;
 	buffer *comp_key;
 	const char *op;
+	data_config_index *index; /* (if == condition is in hash index) */
+	struct ipset *ipset;      /* (remoteip == or != CIDR mask(s)) */
 
 	vector_config_weak children;
 	array *value;
@@ -49,7 +67,17 @@ __attribute_cold__
 data_config *data_config_init(void);
 
 __attribute_cold__
-int data_config_pcre_compile(data_config *dc);
+int data_config_pcre_compile(data_config *dc, int pcre_jit);
+
+__attribute_cold__
+__attribute_returns_nonnull__
+data_config_index *data_config_index_init(const data_config *owner, uint32_t n, uint32_t id);
+
+__attribute_cold__
+int data_config_index_insert(data_config_index *idx, data_config *dc);
+
+__attribute_pure__
+const data_config *data_config_index_lookup(const data_config_index *idx, const buffer *b);
 /*struct cond_cache_t;*/    /* declaration */ /*(moved to plugin_config.h)*/
 /*int data_config_pcre_exec(const data_config *dc, struct cond_cache_t *cache, buffer *b);*/
 
@@ -642,6 +642,10 @@ context ::= DOLLAR SRVVARNAME(B) LBRACKET stringop(C) RBRACKET cond(E) expressio
         char * const colon = strchr(rvalue->ptr, ':'); /* IPv6 */
         if (NULL != slash && slash == rvalue->ptr){/*(skip AF_UNIX /path/file)*/
         }
+        else if (0 == strncmp(rvalue->ptr, "file:", 5)
+                 || NULL != strpbrk(rvalue->ptr, ", \t\r\n")) {
+          /*(set of addrs or CIDR masks; parsed in config_remoteip_ipset())*/
+        }
         else if (NULL != slash) {
           char *nptr;
           const unsigned long nm_bits = strtoul(slash + 1, &nptr, 10);
@@ -701,7 +705,7 @@ context ::= DOLLAR SRVVARNAME(B) LBRACKET stringop(C) RBRACKET cond(E) expressio
         break;
       case CONFIG_COND_NOMATCH:
       case CONFIG_COND_MATCH: {
-        if (!data_config_pcre_compile(dc)) {
+        if (!data_config_pcre_compile(dc, 0)) {
           ctx->ok = 0;
         }
         break;
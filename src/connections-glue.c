@@ -250,7 +250,10 @@ static handler_t connection_handle_read_post_chunked(request_st * const r, chunk
             if (len > te_chunked-2) len = te_chunked-2;
             if (dst_cq->bytes_in + te_chunked <= 64*1024) {
                 /* avoid buffering request bodies <= 64k on disk */
-                chunkqueue_steal(dst_cq, cq, len);
+                if (0 != chunkqueue_steal(dst_cq, cq, len)) {
+                    /* 500 Internal Server Error */
+                    return connection_handle_read_post_error(r, 500);
+                }
             }
             else if (0 != chunkqueue_steal_with_tempfiles(dst_cq, cq, len,
                                                           r->conf.errh)) {
@@ -422,7 +425,15 @@ handler_t connection_handle_read_post_state(request_st * const r) {
 
 	int is_closed = 0;
 
-	if (con->is_readable) {
+	if (0 == dst_cq->bytes_in && !con->mem_limit_reached
+	    && chunkqueue_mem_pressure() == CHUNK_MEM_HARD) {
+		/* do not begin reading request body while server-wide chunk
+		 * memory is above server.chunk-memory-hard-limit
+		 * (resumed by connection_periodic_maint()) */
+		con->mem_limit_reached = 1;
+	}
+
+	if (con->is_readable && !con->mem_limit_reached) {
 		con->read_idle_ts = log_epoch_secs;
 
 		switch(con->network_read(con, cq, MAX_READ_LIMIT)) {
@@ -442,6 +453,7 @@ handler_t connection_handle_read_post_state(request_st * const r) {
 	/* Check for Expect: 100-continue in request headers
 	 * if no request body received yet */
 	if (chunkqueue_is_empty(cq) && 0 == dst_cq->bytes_in
+	    && !con->mem_limit_reached
 	    && r->http_version != HTTP_VERSION_1_0
 	    && chunkqueue_is_empty(r->write_queue) && con->is_writable) {
 		const buffer *vb = http_header_request_get(r, HTTP_HEADER_EXPECT, CONST_STR_LEN("Expect"));
@@ -462,7 +474,9 @@ handler_t connection_handle_read_post_state(request_st * const r) {
 	}
 	else if (r->reqbody_length <= 64*1024) {
 		/* don't buffer request bodies <= 64k on disk */
-		chunkqueue_steal(dst_cq, cq, (off_t)r->reqbody_length - dst_cq->bytes_in);
+		if (0 != chunkqueue_steal(dst_cq, cq, (off_t)r->reqbody_length - dst_cq->bytes_in)) {
+			return connection_handle_read_post_error(r, 500); /* Internal Server Error */
+		}
 	}
 	else if (0 != chunkqueue_steal_with_tempfiles(dst_cq, cq, (off_t)r->reqbody_length - dst_cq->bytes_in, r->conf.errh)) {
 		/* writing to temp file failed */
@@ -484,7 +498,10 @@ handler_t connection_handle_read_post_state(request_st * const r) {
 	      #endif
 		return HANDLER_ERROR;
 	} else {
-		r->conf.stream_request_body |= FDEVENT_STREAM_REQUEST_POLLIN;
+		if (!con->mem_limit_reached)
+			r->conf.stream_request_body |= FDEVENT_STREAM_REQUEST_POLLIN;
+		else
+			r->conf.stream_request_body &= ~FDEVENT_STREAM_REQUEST_POLLIN;
 		return (r->conf.stream_request_body & FDEVENT_STREAM_REQUEST)
 		  ? HANDLER_GO_ON
 		  : HANDLER_WAIT_FOR_EVENT;
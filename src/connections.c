@@ -18,6 +18,7 @@
 #include "plugin.h"
 
 #include "inet_ntop_cache.h"
+#include "io_prefetch.h"
 
 #include <sys/stat.h>
 
@@ -256,12 +257,18 @@ __attribute_cold__
 static void connection_handle_errdoc_init(request_st * const r) {
 	/* modules that produce headers required with error response should
 	 * typically also produce an error document.  Make an exception for
-	 * mod_auth WWW-Authenticate response header. */
+	 * mod_auth WWW-Authenticate response header, and for Retry-After
+	 * response header (e.g. from mod_evasive) with 429 or 503 response. */
 	buffer *www_auth = NULL;
+	buffer *retry_after = NULL;
 	if (401 == r->http_status) {
 		const buffer *vb = http_header_response_get(r, HTTP_HEADER_OTHER, CONST_STR_LEN("WWW-Authenticate"));
 		if (NULL != vb) www_auth = buffer_init_buffer(vb);
 	}
+	else if (429 == r->http_status || 503 == r->http_status) {
+		const buffer *vb = http_header_response_get(r, HTTP_HEADER_OTHER, CONST_STR_LEN("Retry-After"));
+		if (NULL != vb) retry_after = buffer_init_buffer(vb);
+	}
 
 	buffer_reset(&r->physical.path);
 	r->resp_htags = 0;
@@ -272,6 +279,10 @@ static void connection_handle_errdoc_init(request_st * const r) {
 		http_header_response_set(r, HTTP_HEADER_OTHER, CONST_STR_LEN("WWW-Authenticate"), CONST_BUF_LEN(www_auth));
 		buffer_free(www_auth);
 	}
+	if (NULL != retry_after) {
+		http_header_response_set(r, HTTP_HEADER_OTHER, CONST_STR_LEN("Retry-After"), CONST_BUF_LEN(retry_after));
+		buffer_free(retry_after);
+	}
 }
 
 __attribute_cold__
@@ -515,6 +526,7 @@ static int connection_handle_write_prepare(request_st * const r) {
 }
 
 static void connection_handle_write(connection *con) {
+	if (io_prefetch_defer(con)) return; /* wait for file data prefetch */
 	int rc = connection_write_chunkqueue(con, con->write_queue, MAX_WRITE_LIMIT);
 	request_st * const r = &con->request;
 	switch (rc) {
@@ -601,7 +613,18 @@ request_init (request_st * const r, connection * const con, server * const srv)
 	r->cond_cache = calloc(srv->config_context->used, sizeof(cond_cache_t));
 	force_assert(NULL != r->cond_cache);
 
-      #ifdef HAVE_PCRE_H
+	if (srv->srvconf.cond_index_used) {
+		r->cond_index =
+		  calloc(srv->srvconf.cond_index_used, sizeof(int32_t));
+		force_assert(NULL != r->cond_index);
+	}
+
+	if (srv->config_context->used > CONFIG_COND_SCAN_MAX) {
+		r->cond_true = malloc(srv->config_context->used * sizeof(uint32_t));
+		force_assert(NULL != r->cond_true);
+	}
+
+      #ifdef HAVE_PCRE
 	if (srv->config_context->used > 1) {/*(save 128b per con if no conditions)*/
 		r->cond_match =
 		  calloc(srv->config_context->used, sizeof(cond_match_t));
@@ -619,6 +642,7 @@ static connection *connection_init(server *srv) {
 
 	con->fd = 0;
 	con->ndx = -1;
+	con->io_prefetch_fd = -1;
 	con->bytes_written = 0;
 	con->bytes_read = 0;
 
@@ -670,6 +694,8 @@ request_free (request_st * const r)
 		free(r->plugin_ctx);
 		free(r->cond_cache);
 		free(r->cond_match);
+		free(r->cond_true);
+		free(r->cond_index);
 
 		/* note: r is not zeroed here and r is not freed here */
 }
@@ -763,8 +789,10 @@ request_reset (request_st * const r) {
 
 static void connection_reset(connection *con) {
 	request_st * const r = &con->request;
+	io_prefetch_detach(con);
 	request_reset(r);
 	con->is_readable = 1;
+	con->mem_limit_reached = 0;
 
 	con->bytes_written = 0;
 	con->bytes_written_cur_second = 0;
@@ -1438,7 +1466,8 @@ int connection_state_machine(connection *con) {
 		 */
 		if (!chunkqueue_is_empty(con->write_queue) &&
 		    (con->is_writable == 0) &&
-		    (con->traffic_limit_reached == 0)) {
+		    (con->traffic_limit_reached == 0) &&
+		    NULL == con->io_prefetch) {
 			rc |= FDEVENT_OUT;
 		}
 		/* fall through */
@@ -1563,6 +1592,14 @@ static void connection_check_timeout (connection * const con, const time_t cur_t
 
     con->bytes_written_cur_second = 0;
 
+    if (con->mem_limit_reached
+        && chunkqueue_mem_pressure() < CHUNK_MEM_HARD) {
+        /* resume reading request body */
+        con->mem_limit_reached = 0;
+
+        changed = 1;
+    }
+
     if (changed) {
         connection_state_machine(con);
     }
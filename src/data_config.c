@@ -2,13 +2,22 @@
 
 #include "array.h"
 #include "configfile.h"
+#include "ipset.h"
+#include "splaytree.h"  /* djbhash() */
 
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
 
-#ifdef HAVE_PCRE_H
+#ifdef HAVE_PCRE2_H
+#define PCRE2_CODE_UNIT_WIDTH 8
+#include <pcre2.h>
+#elif defined(HAVE_PCRE_H)
 #include <pcre.h>
+#ifndef PCRE_STUDY_JIT_COMPILE
+#define PCRE_STUDY_JIT_COMPILE 0
+#define pcre_free_study(x) pcre_free(x)
+#endif
 #endif
 
 __attribute_cold__
@@ -36,9 +45,14 @@ static void data_config_free(data_unset *d) {
 	vector_config_weak_clear(&ds->children);
 
 	free(ds->string.ptr);
-#ifdef HAVE_PCRE_H
+	if (ds->index && ds->index->owner == ds) free(ds->index);
+	ipset_free(ds->ipset);
+#ifdef HAVE_PCRE2_H
+	if (ds->code) pcre2_code_free(ds->code);
+	if (ds->match_data) pcre2_match_data_free(ds->match_data);
+#elif defined(HAVE_PCRE_H)
 	if (ds->regex) pcre_free(ds->regex);
-	if (ds->regex_study) pcre_free(ds->regex_study);
+	if (ds->regex_study) pcre_free_study(ds->regex_study);
 #endif
 
 	free(d);
@@ -147,14 +161,59 @@ data_config *data_config_init(void) {
 	return ds;
 }
 
-int data_config_pcre_compile(data_config *dc) {
-#ifdef HAVE_PCRE_H
+int data_config_pcre_compile(data_config *dc, const int pcre_jit) {
+#ifdef HAVE_PCRE2_H
+    /* (use fprintf() on error, as this is called from configparser.y) */
+    int errcode;
+    PCRE2_SIZE erroff;
+    uint32_t captures;
+    PCRE2_UCHAR errbuf[1024];
+
+    if (dc->code) pcre2_code_free(dc->code);
+    if (dc->match_data) pcre2_match_data_free(dc->match_data);
+    dc->match_data = NULL;
+
+    dc->code = pcre2_compile((PCRE2_SPTR)CONST_BUF_LEN(&dc->string),
+                             0, &errcode, &erroff, NULL);
+    if (NULL == dc->code) {
+        pcre2_get_error_message(errcode, errbuf, sizeof(errbuf));
+        fprintf(stderr, "parsing regex failed: %s -> %s at offset %zu\n",
+                dc->string.ptr, (char *)errbuf, erroff);
+        return 0;
+    }
+
+    /* (pcre2_match() falls back to interpreter if JIT compile fails,
+     *  e.g. if JIT is unsupported or exec memory is denied by policy) */
+    if (pcre_jit)
+        pcre2_jit_compile(dc->code, PCRE2_JIT_COMPLETE);
+
+    errcode = pcre2_pattern_info(dc->code, PCRE2_INFO_CAPTURECOUNT, &captures);
+    if (0 != errcode) {
+        fprintf(stderr, "getting capture count for regex failed: %s\n",
+                dc->string.ptr);
+        return 0;
+    } else if (captures > 9) {
+        fprintf(stderr, "Too many captures in regex, use (?:...) instead of (...): %s\n",
+                dc->string.ptr);
+        return 0;
+    }
+
+    /* match data is reused for each match with this regex
+     * (capture offsets are copied to per-request cond_match_t) */
+    dc->match_data = pcre2_match_data_create_from_pattern(dc->code, NULL);
+    if (NULL == dc->match_data) {
+        fprintf(stderr, "allocating match data for regex failed: %s\n",
+                dc->string.ptr);
+        return 0;
+    }
+    return 1;
+#elif defined(HAVE_PCRE_H)
     /* (use fprintf() on error, as this is called from configparser.y) */
     const char *errptr;
     int erroff, captures;
 
     if (dc->regex) pcre_free(dc->regex);
-    if (dc->regex_study) pcre_free(dc->regex_study);
+    if (dc->regex_study) pcre_free_study(dc->regex_study);
 
     dc->regex = pcre_compile(dc->string.ptr, 0, &errptr, &erroff, NULL);
     if (NULL == dc->regex) {
@@ -163,7 +222,8 @@ int data_config_pcre_compile(data_config *dc) {
         return 0;
     }
 
-    dc->regex_study = pcre_study(dc->regex, 0, &errptr);
+    dc->regex_study =
+      pcre_study(dc->regex, pcre_jit ? PCRE_STUDY_JIT_COMPILE : 0, &errptr);
     if (NULL == dc->regex_study && errptr != NULL) {
         fprintf(stderr, "studying regex failed: %s -> %s\n",
                 dc->string.ptr, errptr);
@@ -186,6 +246,39 @@ int data_config_pcre_compile(data_config *dc) {
     fprintf(stderr, "can't handle '$%s[%s] =~ ...' as you compiled without pcre support. \n"
                     "(perhaps just a missing pcre-devel package ?) \n",
                     dc->comp_key->ptr, dc->comp_tag->ptr);
+    UNUSED(pcre_jit);
     return 0;
 #endif
 }
+
+data_config_index *data_config_index_init(const data_config *owner, uint32_t n, uint32_t id) {
+    /* hash table size: power of 2 at least twice number of elements */
+    uint32_t sz = 8;
+    while (sz < (n << 1)) sz <<= 1;
+    data_config_index * const idx =
+      calloc(1, sizeof(data_config_index) + sz * sizeof(data_config *));
+    force_assert(idx);
+    idx->owner = owner;
+    idx->id = id;
+    idx->mask = sz - 1;
+    return idx;
+}
+
+int data_config_index_insert(data_config_index * const idx, data_config * const dc) {
+    uint32_t h = djbhash(CONST_BUF_LEN(&dc->string), DJBHASH_INIT) & idx->mask;
+    for (const data_config *e; NULL != (e = idx->table[h]); h = (h+1) & idx->mask) {
+        if (buffer_is_equal(&e->string, &dc->string))
+            return 0; /* duplicate; leave dc out of index */
+    }
+    idx->table[h] = dc;
+    dc->index = idx;
+    return 1;
+}
+
+const data_config *data_config_index_lookup(const data_config_index * const idx, const buffer * const b) {
+    uint32_t h = djbhash(CONST_BUF_LEN(b), DJBHASH_INIT) & idx->mask;
+    for (const data_config *e; NULL != (e = idx->table[h]); h = (h+1) & idx->mask) {
+        if (buffer_is_equal(&e->string, b)) return e;
+    }
+    return NULL;
+}
@@ -13,6 +13,7 @@ static data_unset *data_string_copy(const data_unset *s) {
 
 	if (!buffer_is_empty(&src->key)) buffer_copy_buffer(&ds->key, &src->key);
 	buffer_copy_buffer(&ds->value, &src->value);
+	ds->ext = src->ext;
 	return (data_unset *)ds;
 }
 
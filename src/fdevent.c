@@ -974,8 +974,16 @@ int fdevent_cycle_logger(const char *logger, int *curfd) {
     if (logger[0] != '|') {
         int fd = fdevent_open_logger(logger);
         if (-1 == fd) return -1; /*(error; leave *curfd as-is)*/
-        if (-1 != *curfd) close(*curfd);
-        *curfd = fd;
+        /* reopen at same fd number, if possible, so that copies of *curfd
+         * (e.g. in async_pool worker threads) refer to the new file */
+        if (-1 != *curfd && *curfd == dup2(fd, *curfd)) {
+            if (*curfd > STDERR_FILENO) fdevent_setfd_cloexec(*curfd);
+            close(fd);
+        }
+        else {
+            if (-1 != *curfd) close(*curfd);
+            *curfd = fd;
+        }
     }
     return *curfd;
 }
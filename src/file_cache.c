@@ -0,0 +1,290 @@
+#include "first.h"
+
+#include "file_cache.h"
+#include "fdevent.h"
+#include "log.h"
+#include "splaytree.h"
+#include "status_counter.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined HAVE_SYS_MMAN_H && defined HAVE_MMAP && defined ENABLE_MMAP
+#define FILE_CACHE_USE_MMAP
+#include "sys-mmap.h"
+#include <setjmp.h>
+#include <signal.h>
+#endif
+
+/* files up to this size are cached upon first request
+ * (same as size of files read into memory in http_chunk.c) */
+#define FILE_CACHE_SMALL 32768
+
+typedef struct {
+    splay_tree *files;      /* nodes of tree are (file_cache_entry *) */
+    file_cache_entry *hand; /* CLOCK hand in ring of cached entries */
+    off_t used;
+    off_t max;
+} file_cache;
+
+static file_cache fc;
+
+
+static off_t file_cache_entry_cost (const file_cache_entry * const fce)
+{
+    /* (entries without data (not yet loaded) track first request of large
+     *  file, and are small, but also count against cache budget) */
+    return (off_t)(sizeof(*fce) + fce->name.size)
+         + (NULL != fce->data ? fce->size : 0);
+}
+
+static int file_cache_entry_matches (const file_cache_entry * const fce, const struct stat * const st)
+{
+    return fce->ino   == st->st_ino
+        && fce->dev   == st->st_dev
+        && fce->mtime == st->st_mtime
+        && fce->size  == st->st_size;
+}
+
+static file_cache_entry * file_cache_entry_init (const buffer * const name, const struct stat * const st)
+{
+    file_cache_entry * const fce = calloc(1, sizeof(*fce));
+    force_assert(fce);
+    buffer_copy_buffer(&fce->name, name);
+    fce->size  = st->st_size;
+    fce->ino   = st->st_ino;
+    fce->dev   = st->st_dev;
+    fce->mtime = st->st_mtime;
+    fce->refcnt = 1;
+    return fce;
+}
+
+static void file_cache_entry_free (file_cache_entry * const fce)
+{
+    if (NULL != fce->data) {
+      #ifdef FILE_CACHE_USE_MMAP
+        if (fce->is_mmap)
+            munmap(fce->data, (size_t)fce->size);
+        else
+      #endif
+            free(fce->data);
+    }
+    free(fce->name.ptr);
+    free(fce);
+}
+
+void file_cache_release (file_cache_entry * const fce)
+{
+    if (0 == --fce->refcnt)
+        file_cache_entry_free(fce);
+}
+
+static int file_cache_entry_load (file_cache_entry * const fce)
+{
+    /* (permit symlinks; caller should already have checked) */
+    const int fd = fdevent_open_cloexec(fce->name.ptr, 1, O_RDONLY, 0);
+    if (fd < 0) return 0;
+
+    struct stat st;
+    if (0 != fstat(fd, &st) || !file_cache_entry_matches(fce, &st)) {
+        close(fd);
+        return 0;
+    }
+
+  #ifdef FILE_CACHE_USE_MMAP
+    if (fce->size > FILE_CACHE_SMALL) {
+        char * const data = mmap(NULL, (size_t)fce->size, PROT_READ,
+                                 MAP_SHARED, fd, 0);
+        close(fd);
+        if (MAP_FAILED == data) return 0;
+        fce->data = data;
+        fce->is_mmap = 1;
+        return 1;
+    }
+  #endif
+
+    char * const data = malloc((size_t)fce->size);
+    force_assert(data);
+    off_t off = 0;
+    ssize_t rd;
+    do {
+        rd = read(fd, data+off, (size_t)(fce->size - off));
+    } while (rd > 0 ? (off += rd) < fce->size : -1 == rd && errno == EINTR);
+    close(fd);
+    if (off != fce->size) { /*(error, or file changed since stat())*/
+        free(data);
+        return 0;
+    }
+    fce->data = data;
+    return 1;
+}
+
+static void file_cache_remove (file_cache_entry * const fce)
+{
+    /* remove entry from CLOCK ring and release reference held by cache
+     * (caller must remove entry from fc.files) */
+    fc.used -= file_cache_entry_cost(fce);
+    if (fce->next == fce)
+        fc.hand = NULL;
+    else {
+        fce->prev->next = fce->next;
+        fce->next->prev = fce->prev;
+        if (fc.hand == fce) fc.hand = fce->next;
+    }
+    fce->prev = fce->next = NULL;
+    file_cache_release(fce);
+}
+
+static void file_cache_evict (file_cache_entry * const fce)
+{
+    const int ndx =
+      splaytree_djbhash(fce->name.ptr, buffer_string_length(&fce->name));
+    fc.files = splaytree_splay(fc.files, ndx);
+    if (fc.files && fc.files->key == ndx && fc.files->data == fce)
+        fc.files = splaytree_delete(fc.files, ndx);
+    file_cache_remove(fce);
+}
+
+static void file_cache_reclaim (const off_t cost)
+{
+    /* CLOCK: advance hand, clearing reference bit of each entry referenced
+     * since hand last passed, until enough entries not referenced are evicted
+     * (entries still referenced by chunks are freed upon last release) */
+    while (fc.used + cost > fc.max && NULL != fc.hand) {
+        file_cache_entry * const fce = fc.hand;
+        if (fce->clock) {
+            fce->clock = 0;
+            fc.hand = fce->next;
+        }
+        else
+            file_cache_evict(fce);
+    }
+}
+
+static void file_cache_insert (file_cache_entry * const fce, const int ndx)
+{
+    const off_t cost = file_cache_entry_cost(fce);
+    file_cache_reclaim(cost);
+    fc.used += cost;
+    fc.files = splaytree_insert(fc.files, ndx, fce);
+
+    /* insert behind hand (visited last by hand) */
+    if (NULL == fc.hand) {
+        fce->prev = fce->next = fce;
+        fc.hand = fce;
+    }
+    else {
+        fce->next = fc.hand;
+        fce->prev = fc.hand->prev;
+        fce->prev->next = fce;
+        fc.hand->prev = fce;
+    }
+}
+
+file_cache_entry * file_cache_get (const buffer * const name, const struct stat * const st, const int allow_large)
+{
+    if (0 == fc.max) return NULL;
+    if (st->st_size <= 0 || st->st_size > fc.max / 8) return NULL;
+    const int large = (st->st_size > FILE_CACHE_SMALL);
+    if (large && !allow_large) return NULL;
+
+    const uint32_t len = buffer_string_length(name);
+    const int ndx = splaytree_djbhash(name->ptr, len);
+    fc.files = splaytree_splay(fc.files, ndx);
+
+    int seen = 0;
+    if (fc.files && fc.files->key == ndx) {
+        file_cache_entry * const fce = fc.files->data;
+        if (buffer_is_equal_string(&fce->name, name->ptr, len)
+            && file_cache_entry_matches(fce, st)) {
+            if (NULL != fce->data) {
+                fce->clock = 1;
+                ++fce->refcnt;
+                status_counter_inc(CONST_STR_LEN("server.file-cache.hits"));
+                return fce;
+            }
+            seen = 1; /* repeated request for large file; load below */
+        }
+        /* (replace stale entry, hash collision, or entry not yet loaded) */
+        fc.files = splaytree_delete(fc.files, ndx);
+        file_cache_remove(fce);
+    }
+
+    status_counter_inc(CONST_STR_LEN("server.file-cache.misses"));
+
+    file_cache_entry * const fce = file_cache_entry_init(name, st);
+    if (large && !seen) {
+        /* admit large file into cache upon repeated request
+         * (track first request with entry without data) */
+        file_cache_insert(fce, ndx);
+        return NULL;
+    }
+
+    if (!file_cache_entry_load(fce)) {
+        file_cache_entry_free(fce);
+        return NULL;
+    }
+    fce->clock = 1;
+    file_cache_insert(fce, ndx);
+    ++fce->refcnt;
+    return fce;
+}
+
+#ifdef FILE_CACHE_USE_MMAP
+
+static volatile int sigbus_jmp_valid;
+static sigjmp_buf sigbus_jmp;
+
+static void sigbus_handler (int sig)
+{
+    UNUSED(sig);
+    if (sigbus_jmp_valid) siglongjmp(sigbus_jmp, 1);
+    log_failed_assert(__FILE__, __LINE__, "SIGBUS");
+}
+
+#endif
+
+const char * file_cache_data (const file_cache_entry * const fce, const off_t offset, char * const buf, const size_t len)
+{
+    if (offset < 0 || offset > fce->size || (off_t)len > fce->size - offset)
+        return NULL;
+    const char * const data = fce->data + offset;
+
+  #ifdef FILE_CACHE_USE_MMAP
+    if (fce->is_mmap) {
+        if (0 == sigsetjmp(sigbus_jmp, 1)) {
+            signal(SIGBUS, sigbus_handler);
+            sigbus_jmp_valid = 1;
+            memcpy(buf, data, len);
+            sigbus_jmp_valid = 0;
+            return buf;
+        }
+        else {
+            sigbus_jmp_valid = 0;
+            return NULL;
+        }
+    }
+  #endif
+
+    UNUSED(buf);
+    return data;
+}
+
+void file_cache_init (const uint32_t max_kbytes)
+{
+    fc.max = (off_t)max_kbytes << 10;
+}
+
+void file_cache_free (void)
+{
+    while (NULL != fc.hand)
+        file_cache_evict(fc.hand);
+    fc.used = 0;
+    fc.max = 0;
+}
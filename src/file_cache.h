@@ -0,0 +1,65 @@
+#ifndef INCLUDED_FILE_CACHE_H
+#define INCLUDED_FILE_CACHE_H
+#include "first.h"
+
+#include "buffer.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+/* cache of hot static file content (server.file-cache-size)
+ *
+ * Small files are read into memory upon first request.  Larger files are
+ * cached upon a repeated request, when permitted by caller (e.g. over TLS,
+ * where sendfile() can not be used), and are mmap()ed read-only, keeping the
+ * mapping for reuse (or are read into memory if built without mmap support).
+ * Entries are keyed on path and validated against the stat_cache_entry
+ * (inode, mtime, size) of the file upon each use.  Memory used by the cache
+ * is limited to a byte budget and entries are evicted by CLOCK (second-chance)
+ * approximation of LRU.
+ *
+ * A FILE_CHUNK referencing a cache entry (c->file.ref) holds a reference to
+ * the entry and is sent from cached memory without per-request open(), mmap()
+ * or read() of the file.  Entries evicted or invalidated while referenced are
+ * freed when the last reference is released.  Code unaware of c->file.ref
+ * treats the chunk as any other FILE_CHUNK and opens the file by name.
+ */
+
+typedef struct file_cache_entry {
+    char *data;             /* file content (malloc()ed or mmap()ed) */
+    off_t size;
+    ino_t ino;
+    dev_t dev;
+    time_t mtime;
+    int refcnt;             /* references held by chunks (+1 if in cache) */
+    unsigned char is_mmap;
+    unsigned char clock;    /* CLOCK reference bit */
+    struct file_cache_entry *prev; /* CLOCK ring */
+    struct file_cache_entry *next; /* CLOCK ring */
+    buffer name;
+} file_cache_entry;
+
+__attribute_cold__
+void file_cache_init (uint32_t max_kbytes);
+
+__attribute_cold__
+void file_cache_free (void);
+
+/* returns cache entry (with reference acquired) if file content is cached,
+ * loading content of file into the cache if eligible; NULL otherwise
+ * (allow_large permits caching files larger than small file size) */
+file_cache_entry * file_cache_get (const buffer *name, const struct stat *st, int allow_large);
+
+static inline void file_cache_acquire (file_cache_entry *fce);
+static inline void file_cache_acquire (file_cache_entry * const fce) {
+    ++fce->refcnt;
+}
+
+void file_cache_release (file_cache_entry *fce);
+
+/* returns pointer to len bytes of file content at offset, or NULL on error
+ * (content of mmap()ed entry is copied into buf to protect against SIGBUS,
+ *  e.g. if file is truncated, when the data is accessed in user space) */
+const char * file_cache_data (const file_cache_entry *fce, off_t offset, char *buf, size_t len);
+
+#endif
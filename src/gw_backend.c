@@ -31,7 +31,9 @@
 #include "buffer.h"
 #include "crc32.h"
 #include "fdevent.h"
+#include "http_header.h"
 #include "log.h"
+#include "rand.h"
 #include "sock_addr.h"
 #include "settings.h"   /* MAX_WRITE_LIMIT */
 
@@ -101,6 +103,12 @@ static int gw_status_init(gw_host *host, gw_proc *proc) {
     *gw_status_get_counter(host, proc, CONST_STR_LEN(".load")) = 0;
 
     *gw_status_get_counter(host, NULL, CONST_STR_LEN(".load")) = 0;
+    *gw_status_get_counter(host, NULL, CONST_STR_LEN(".ejected")) = 0;
+    if (host->queue_size) {
+        *gw_status_get_counter(host, NULL, CONST_STR_LEN(".queued")) = 0;
+        *gw_status_get_counter(host, NULL, CONST_STR_LEN(".queue-wait-ms")) = 0;
+        *gw_status_get_counter(host, NULL, CONST_STR_LEN(".queue-timeouts")) = 0;
+    }
 
     return 0;
 }
@@ -113,7 +121,8 @@ static void gw_proc_set_state(gw_host *host, gw_proc *proc, int state) {
     if (proc->state == PROC_STATE_RUNNING) {
         --host->active_procs;
     } else if (state == PROC_STATE_RUNNING) {
-        ++host->active_procs;
+        if (0 == host->active_procs++)
+            host->enabled_ts = log_epoch_secs; /* (slow-start) */
     }
     proc->state = state;
 }
@@ -129,15 +138,77 @@ static gw_proc *gw_proc_init(void) {
     f->prev = NULL;
     f->next = NULL;
     f->state = PROC_STATE_DIED;
+    f->mpx_supported = -1;
 
     return f;
 }
 
+static void gw_mpx_free(gw_mpx *mpx) {
+    if (-1 != mpx->fd) {
+        fdevent_fdnode_event_del(mpx->ev, mpx->fdn);
+        fdevent_unregister(mpx->ev, mpx->fd);
+        close(mpx->fd);
+    }
+    if (mpx->proto->free) mpx->proto->free(mpx);
+    chunkqueue_free(mpx->rb);
+    chunkqueue_free(mpx->wb);
+    free(mpx->streams);
+    free(mpx->aborting);
+    free(mpx);
+}
+
+typedef struct gw_hc {
+    gw_host *host;
+    gw_proc *proc;
+    server *srv;
+    fdnode *fdn;
+    int fd;
+    int state;              /* GW_HC_CONNECT, GW_HC_SEND, GW_HC_RECV */
+    time_t ts;              /* time probe started */
+    unsigned short ok;      /* consecutive passed probes */
+    unsigned short fail;    /* consecutive failed probes */
+    uint32_t woff;          /* bytes of request written */
+    buffer *b;              /* request, then response */
+} gw_hc;
+
+static void gw_hc_free(gw_hc *hc) {
+    if (-1 != hc->fd) {
+        fdevent_fdnode_event_del(hc->srv->ev, hc->fdn);
+        fdevent_unregister(hc->srv->ev, hc->fd);
+        close(hc->fd);
+    }
+    buffer_free(hc->b);
+    free(hc);
+}
+
+static void gw_proc_hc_reset(gw_proc * const proc) {
+    /* proc (re)started; results of prior health checks do not apply */
+    gw_hc * const hc = proc->hc;
+    proc->hc_down = 0;
+    if (NULL == hc) return;
+    if (-1 != hc->fd) {
+        fdevent_fdnode_event_del(hc->srv->ev, hc->fdn);
+        fdevent_sched_close(hc->srv->ev, hc->fd, 1);
+        hc->fdn = NULL;
+        hc->fd = -1;
+    }
+    hc->ok = 0;
+    hc->fail = 0;
+    hc->ts = 0; /*(probe at next trigger)*/
+}
+
 static void gw_proc_free(gw_proc *f) {
     if (!f) return;
 
     gw_proc_free(f->next);
 
+    if (f->hc) gw_hc_free(f->hc);
+
+    for (gw_mpx *mpx = f->mpx, *next; mpx; mpx = next) {
+        next = mpx->next;
+        gw_mpx_free(mpx);
+    }
+
     buffer_free(f->unixsocket);
     buffer_free(f->connection_name);
     free(f->saddr);
@@ -307,13 +378,15 @@ static void gw_proc_release(gw_host *host, gw_proc *proc, int debug, log_error_s
 static void gw_proc_check_enable(gw_host * const host, gw_proc * const proc, log_error_st * const errh) {
     if (log_epoch_secs <= proc->disabled_until) return;
     if (proc->state != PROC_STATE_OVERLOADED) return;
+    if (proc->hc_down) return; /* enabled by passing health checks */
 
     gw_proc_set_state(host, proc, PROC_STATE_RUNNING);
 
     log_error(errh, __FILE__, __LINE__,
       "gw-server re-enabled: %s %s %hu %s",
-      proc->connection_name->ptr, host->host->ptr, host->port,
-      host->unixsocket->ptr ? host->unixsocket->ptr : "");
+      proc->connection_name->ptr,
+      host->host ? host->host->ptr : "", host->port,
+      host->unixsocket ? host->unixsocket->ptr : "");
 }
 
 static void gw_proc_waitpid_log(const gw_host * const host, const gw_proc * const proc, log_error_st * const errh, const int status) {
@@ -616,6 +689,7 @@ static int gw_spawn_connection(gw_host * const host, gw_proc * const proc, log_e
         }
     }
 
+    gw_proc_hc_reset(proc);
     gw_proc_set_state(host, proc, PROC_STATE_RUNNING);
     return 0;
 }
@@ -784,10 +858,240 @@ enum {
   GW_BALANCE_LEAST_CONNECTION,
   GW_BALANCE_RR,
   GW_BALANCE_HASH,
-  GW_BALANCE_STICKY
+  GW_BALANCE_STICKY,
+  GW_BALANCE_LEAST_LATENCY,
+  GW_BALANCE_P2C,
+  GW_BALANCE_CONSISTENT_HASH
 };
 
-static gw_host * gw_host_get(request_st * const r, gw_extension *extension, int balance, int debug) {
+#define gw_balance_latency(balance) \
+  ((balance) == GW_BALANCE_LEAST_LATENCY || (balance) == GW_BALANCE_P2C)
+
+#define GW_EWMA_DECAY_US    10000000 /* (10 s) */
+#define GW_EWMA_FLOOR_US    1000
+#define GW_OUTLIER_WINDOW   10       /* seconds */
+#define GW_OUTLIER_MIN_REQS 10
+#define GW_OUTLIER_ERR_PCT  50
+#define GW_OUTLIER_MAX_EJECTIONS 6   /* (max ejection 60 s) */
+
+static uint64_t gw_time_us(void) {
+    /* (monotonic; intervals unaffected by changes to system time) */
+    struct timespec ts;
+    log_clock_gettime_monotonic(&ts);
+    return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)(ts.tv_nsec / 1000);
+}
+
+static void gw_host_latency(gw_host * const host, gw_handler_ctx * const hctx) {
+    const uint64_t now = gw_time_us();
+    uint64_t rtt = (now > hctx->ttfb_ts) ? now - hctx->ttfb_ts : 0;
+    const uint64_t dt = (now > host->ewma_ts) ? now - host->ewma_ts : 0;
+    hctx->ttfb_ts = 0;
+    host->ewma_ts = now;
+    if (rtt > UINT32_MAX) rtt = UINT32_MAX;
+
+    /* peak-EWMA: rise immediately to a sample above the average, and decay
+     * toward samples below the average with weight dt/(dt+tau), so that a
+     * host which becomes slow is avoided at once and recovers gradually */
+    if (rtt >= host->ewma_us || dt >= (uint64_t)GW_EWMA_DECAY_US * 16)
+        host->ewma_us = (uint32_t)rtt;
+    else
+        host->ewma_us -= (uint32_t)
+          ((host->ewma_us - rtt) * dt / (dt + GW_EWMA_DECAY_US));
+}
+
+static void gw_host_outcome(gw_host * const host, const int err, log_error_st * const errh) {
+    const time_t cur_ts = log_epoch_secs;
+    if (cur_ts - host->win_ts >= GW_OUTLIER_WINDOW) {
+        /* reset consecutive ejections after a window without excess errors */
+        if (host->win_reqs >= GW_OUTLIER_MIN_REQS
+            && host->win_errs * 100 < host->win_reqs * GW_OUTLIER_ERR_PCT)
+            host->ejections = 0;
+        host->win_ts = cur_ts;
+        host->win_reqs = 0;
+        host->win_errs = 0;
+    }
+
+    ++host->win_reqs;
+    if (!err) return;
+    ++host->win_errs;
+
+    if (host->win_reqs < GW_OUTLIER_MIN_REQS
+        || host->win_errs * 100 < host->win_reqs * GW_OUTLIER_ERR_PCT
+        || host->ejected_until >= cur_ts)
+        return;
+
+    /* passive outlier ejection; eject host from balancing for a period
+     * increasing with consecutive ejections, then ramp up with slow-start */
+    if (host->ejections < GW_OUTLIER_MAX_EJECTIONS) ++host->ejections;
+    host->ejected_until = cur_ts + GW_OUTLIER_WINDOW * host->ejections;
+    host->enabled_ts = host->ejected_until;
+    log_error(errh, __FILE__, __LINE__,
+      "backend %s ejected for %d seconds: %u of %u requests failed",
+      host->id->ptr, GW_OUTLIER_WINDOW * host->ejections,
+      host->win_errs, host->win_reqs);
+    ++(*gw_status_get_counter(host, NULL, CONST_STR_LEN(".ejected")));
+    host->win_ts = cur_ts;
+    host->win_reqs = 0;
+    host->win_errs = 0;
+}
+
+static uint64_t gw_host_cost(const gw_host * const host, const time_t cur_ts, const uint64_t now) {
+    /* expected latency of another request: latency * (outstanding + 1),
+     * inflated while host is ramping up after being (re)enabled.
+     * latency decays with time since last sample (weight tau/(dt+tau)) so
+     * that a host which was slow, and is therefore avoided, is retried */
+    const uint64_t dt = (now > host->ewma_ts) ? now - host->ewma_ts : 0;
+    const uint64_t ewma = (dt < (uint64_t)GW_EWMA_DECAY_US * 16)
+      ? (uint64_t)host->ewma_us * GW_EWMA_DECAY_US / (dt + GW_EWMA_DECAY_US)
+      : 0;
+    uint64_t cost = (ewma + GW_EWMA_FLOOR_US) * (uint64_t)(host->load + 1);
+    const time_t elapsed = cur_ts - host->enabled_ts;
+    if (elapsed < (time_t)host->slow_start)
+        cost = cost * host->slow_start / (elapsed > 0 ? (uint64_t)elapsed+1 : 1);
+    return cost;
+}
+
+static int gw_host_get_latency(const gw_extension * const extension, const int balance) {
+    const time_t cur_ts = log_epoch_secs;
+    const uint64_t now = gw_time_us();
+
+    /* skip ejected hosts, unless all active hosts are ejected */
+    for (int pass = 0; pass < 2; ++pass) {
+        uint32_t n = 0, a = 0, b = 0;
+        for (uint32_t k = 0; k < extension->used; ++k) {
+            const gw_host * const host = extension->hosts[k];
+            if (0 != host->active_procs
+                && (pass || host->ejected_until < cur_ts)) ++n;
+        }
+        if (0 == n) continue;
+
+        /* power-of-two: choose the better of two hosts at random;
+         * least-latency: choose the best of all hosts */
+        const int pick2 = (GW_BALANCE_P2C == balance && n > 2);
+        if (pick2) {
+            a = (uint32_t)li_rand_pseudo() % n;
+            b = (uint32_t)li_rand_pseudo() % (n - 1);
+            if (b >= a) ++b;
+        }
+
+        int ndx = -1;
+        uint64_t min_cost = UINT64_MAX;
+        for (uint32_t k = 0, i = 0; k < extension->used; ++k) {
+            const gw_host * const host = extension->hosts[k];
+            if (0 == host->active_procs
+                || (!pass && host->ejected_until >= cur_ts)) continue;
+            if (pick2 && i != a && i != b) { ++i; continue; }
+            ++i;
+            const uint64_t cost = gw_host_cost(host, cur_ts, now);
+            if (cost < min_cost) {
+                min_cost = cost;
+                ndx = (int)k;
+            }
+        }
+        return ndx;
+    }
+
+    return -1;
+}
+
+#define GW_HASH_LOAD_FACTOR 125 /* percent of average load */
+
+static uint64_t gw_hash_mix(uint64_t h) {
+    /* (splitmix64 finalizer) */
+    h ^= h >> 30;
+    h *= 0xbf58476d1ce4e5b9ULL;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111ebULL;
+    h ^= h >> 31;
+    return h;
+}
+
+static const char * gw_cookie_get(const buffer * const b, const char * const name, const uint32_t nlen, uint32_t * const vlen) {
+    for (const char *s = b->ptr, *e; *s; s = e) {
+        while (*s == ' ' || *s == '\t' || *s == ';') ++s;
+        e = strchr(s, ';');
+        if (NULL == e) e = s + strlen(s);
+        if ((uint32_t)(e - s) > nlen && s[nlen] == '='
+            && 0 == memcmp(s, name, nlen)) {
+            *vlen = (uint32_t)(e - s - nlen - 1);
+            return s + nlen + 1;
+        }
+    }
+    return NULL;
+}
+
+static uint64_t gw_balance_key_hash(const request_st * const r, const buffer * const key) {
+    /* balance key: "path" (default), "query" (path and query string),
+     * "header:<name>" or "cookie:<name>" (path, if header or cookie absent)*/
+    const uint64_t h = generate_crc32c(CONST_BUF_LEN(&r->uri.path));
+    if (buffer_string_is_empty(key) || buffer_eq_slen(key, CONST_STR_LEN("path")))
+        return h;
+    if (buffer_eq_slen(key, CONST_STR_LEN("query")))
+        return (h << 32) | generate_crc32c(CONST_BUF_LEN(&r->uri.query));
+
+    if (key->ptr[0] == 'h') { /* "header:<name>" */
+        const char * const k = key->ptr + sizeof("header:")-1;
+        const uint32_t klen = buffer_string_length(key) - (sizeof("header:")-1);
+        const buffer * const vb =
+          http_header_request_get(r, http_header_hkey_get(k, klen), k, klen);
+        return (NULL != vb)
+          ? (1uLL << 32) | generate_crc32c(CONST_BUF_LEN(vb))
+          : h;
+    }
+    else { /* "cookie:<name>" */
+        const char * const k = key->ptr + sizeof("cookie:")-1;
+        const uint32_t klen = buffer_string_length(key) - (sizeof("cookie:")-1);
+        const buffer * const vb =
+          http_header_request_get(r, HTTP_HEADER_COOKIE, CONST_STR_LEN("Cookie"));
+        uint32_t vlen;
+        const char * const v = vb ? gw_cookie_get(vb, k, klen, &vlen) : NULL;
+        return (NULL != v)
+          ? (1uLL << 32) | generate_crc32c(v, vlen)
+          : h;
+    }
+}
+
+static int gw_host_get_consistent(const request_st * const r, const gw_extension * const extension, const buffer * const balance_key) {
+    /* rendezvous (highest random weight) hashing: choose host with highest
+     * hash of (key, host), so that adding or removing a host remaps only the
+     * keys of that host, with bounded loads: skip hosts at c times the
+     * average load, so that popular keys overflow to the next host */
+    const uint64_t key = gw_hash_mix(gw_balance_key_hash(r, balance_key));
+    uint64_t total = 0;
+    uint32_t n = 0;
+    for (uint32_t k = 0; k < extension->used; ++k) {
+        const gw_host * const host = extension->hosts[k];
+        if (0 == host->active_procs) continue;
+        total += (uint64_t)host->load;
+        ++n;
+    }
+    if (0 == n) return -1;
+
+    const uint64_t bound =
+      ((total + 1) * GW_HASH_LOAD_FACTOR + n * 100 - 1) / (n * 100);
+
+    int ndx = -1;
+    uint64_t max_score = 0;
+    for (uint32_t k = 0; k < extension->used; ++k) {
+        const gw_host * const host = extension->hosts[k];
+        if (0 == host->active_procs) continue;
+        if ((uint64_t)host->load >= bound) continue;
+        /* identify host by address (not label), e.g. "127.0.0.1" + port */
+        const buffer * const addr = !buffer_string_is_empty(host->host)
+          ? host->host
+          : host->unixsocket;
+        const uint64_t hh = (uint64_t)host->port << 32
+                          | (addr ? generate_crc32c(CONST_BUF_LEN(addr)) : 0);
+        const uint64_t score = gw_hash_mix(key ^ gw_hash_mix(hh));
+        if (-1 == ndx || score > max_score) {
+            max_score = score;
+            ndx = (int)k;
+        }
+    }
+    return ndx;
+}
+
+static gw_host * gw_host_get(request_st * const r, gw_extension *extension, int balance, const buffer *balance_key, int debug) {
     gw_host *host;
     buffer *dst_addr_buf;
     unsigned long last_max = ULONG_MAX;
@@ -920,6 +1224,29 @@ static gw_host * gw_host_get(request_st * const r, gw_extension *extension, int
             }
         }
 
+        break;
+    case GW_BALANCE_LEAST_LATENCY:
+    case GW_BALANCE_P2C:
+        /* latency-aware balancing */
+        if (debug) {
+            log_error(r->conf.errh, __FILE__, __LINE__,
+              "proxy - used %s balancing",
+              GW_BALANCE_P2C == balance ? "power-of-two" : "least-latency");
+        }
+
+        ndx = gw_host_get_latency(extension, balance);
+
+        break;
+    case GW_BALANCE_CONSISTENT_HASH:
+        /* consistent hashing with bounded loads */
+        if (debug) {
+            log_error(r->conf.errh, __FILE__, __LINE__,
+              "proxy - used consistent-hash balancing, hosts: %u",
+              extension->used);
+        }
+
+        ndx = gw_host_get_consistent(r, extension, balance_key);
+
         break;
     default:
         break;
@@ -947,6 +1274,12 @@ static gw_host * gw_host_get(request_st * const r, gw_extension *extension, int
         }
     }
 
+    /* wait in queue of a host for a proc to be re-enabled */
+    for (k = 0; k < extension->used; ++k) {
+        host = extension->hosts[k];
+        if (host->queue_len < host->queue_size) return host;
+    }
+
     /* all hosts are down */
     /* sorry, we don't have a server alive for this ext */
     r->http_status = 503; /* Service Unavailable */
@@ -1125,6 +1458,13 @@ static void handler_ctx_clear(gw_handler_ctx *hctx) {
     hctx->reconnects = 0;
     hctx->request_id = 0;
     hctx->send_content_body = 1;
+    hctx->mpx = NULL;
+    hctx->mpx_wb_end = 0;
+    hctx->mpx_event = 0;
+    hctx->ttfb_ts = 0;
+    hctx->queue_next = NULL;
+    hctx->queue_prev = NULL;
+    hctx->queue_state = 0;
 
     /*plugin_config conf;*//*(no need to reset for same request)*/
 
@@ -1205,6 +1545,15 @@ void gw_exts_clear_check_local(gw_exts *exts) {
     }
 }
 
+void gw_exts_set_health_check(gw_exts *exts, const gw_hc_proto *proto) {
+    for (uint32_t j = 0; j < exts->used; ++j) {
+        gw_extension *ex = exts->exts+j;
+        for (uint32_t n = 0; n < ex->used; ++n) {
+            ex->hosts[n]->hc_proto = proto;
+        }
+    }
+}
+
 int gw_set_defaults_backend(server *srv, gw_plugin_data *p, const array *a, gw_plugin_config *s, int sh_exec, const char *cpkkey) {
     /* per-module plugin_config MUST have common "base class" gw_plugin_config*/
     /* per-module plugin_data MUST have pointer-compatible common "base class"
@@ -1280,6 +1629,39 @@ int gw_set_defaults_backend(server *srv, gw_plugin_data *p, const array *a, gw_p
      ,{ CONST_STR_LEN("tcp-fin-propagate"),
         T_CONFIG_BOOL,
         T_CONFIG_SCOPE_CONNECTION }
+     ,{ CONST_STR_LEN("multiplex"),
+        T_CONFIG_SHORT,
+        T_CONFIG_SCOPE_CONNECTION }
+     ,{ CONST_STR_LEN("slow-start"),
+        T_CONFIG_SHORT,
+        T_CONFIG_SCOPE_CONNECTION }
+     ,{ CONST_STR_LEN("max-requests-per-proc"),
+        T_CONFIG_SHORT,
+        T_CONFIG_SCOPE_CONNECTION }
+     ,{ CONST_STR_LEN("queue-size"),
+        T_CONFIG_SHORT,
+        T_CONFIG_SCOPE_CONNECTION }
+     ,{ CONST_STR_LEN("queue-timeout"),
+        T_CONFIG_SHORT,
+        T_CONFIG_SCOPE_CONNECTION }
+     ,{ CONST_STR_LEN("health-check-interval"),
+        T_CONFIG_SHORT,
+        T_CONFIG_SCOPE_CONNECTION }
+     ,{ CONST_STR_LEN("health-check-timeout"),
+        T_CONFIG_SHORT,
+        T_CONFIG_SCOPE_CONNECTION }
+     ,{ CONST_STR_LEN("health-check-rise"),
+        T_CONFIG_SHORT,
+        T_CONFIG_SCOPE_CONNECTION }
+     ,{ CONST_STR_LEN("health-check-fall"),
+        T_CONFIG_SHORT,
+        T_CONFIG_SCOPE_CONNECTION }
+     ,{ CONST_STR_LEN("health-check-status"),
+        T_CONFIG_SHORT,
+        T_CONFIG_SCOPE_CONNECTION }
+     ,{ CONST_STR_LEN("health-check-path"),
+        T_CONFIG_STRING,
+        T_CONFIG_SCOPE_CONNECTION }
      ,{ NULL, 0,
         T_CONFIG_UNSET,
         T_CONFIG_SCOPE_UNSET }
@@ -1349,6 +1731,12 @@ int gw_set_defaults_backend(server *srv, gw_plugin_data *p, const array *a, gw_p
             host->fix_root_path_name = 0;
             host->listen_backlog = 1024;
             host->xsendfile_allow = 0;
+            host->slow_start = 10;
+            host->queue_timeout = 1;
+            host->hc_timeout = 2;
+            host->hc_rise = 2;
+            host->hc_fall = 3;
+            host->hc_status = 200;
             host->refcount = 0;
 
             config_plugin_value_t *cpv = cvlist;
@@ -1453,6 +1841,39 @@ int gw_set_defaults_backend(server *srv, gw_plugin_data *p, const array *a, gw_p
                   case 22:/* tcp-fin-propagate */
                     host->tcp_fin_propagate = (0 != cpv->v.u);
                     break;
+                  case 23:/* multiplex */
+                    host->multiplex = cpv->v.shrt;
+                    break;
+                  case 24:/* slow-start */
+                    host->slow_start = cpv->v.shrt;
+                    break;
+                  case 25:/* max-requests-per-proc */
+                    host->max_reqs_per_proc = cpv->v.shrt;
+                    break;
+                  case 26:/* queue-size */
+                    host->queue_size = cpv->v.shrt;
+                    break;
+                  case 27:/* queue-timeout */
+                    host->queue_timeout = cpv->v.shrt;
+                    break;
+                  case 28:/* health-check-interval */
+                    host->hc_interval = cpv->v.shrt;
+                    break;
+                  case 29:/* health-check-timeout */
+                    host->hc_timeout = cpv->v.shrt;
+                    break;
+                  case 30:/* health-check-rise */
+                    host->hc_rise = cpv->v.shrt;
+                    break;
+                  case 31:/* health-check-fall */
+                    host->hc_fall = cpv->v.shrt;
+                    break;
+                  case 32:/* health-check-status */
+                    host->hc_status = cpv->v.shrt;
+                    break;
+                  case 33:/* health-check-path */
+                    host->hc_path = cpv->v.b;
+                    break;
                   default:
                     break;
                 }
@@ -1724,13 +2145,37 @@ int gw_get_defaults_balance(server *srv, const buffer *b) {
         return GW_BALANCE_HASH;
     if (buffer_eq_slen(b, CONST_STR_LEN("sticky")))
         return GW_BALANCE_STICKY;
+    if (buffer_eq_slen(b, CONST_STR_LEN("least-latency")))
+        return GW_BALANCE_LEAST_LATENCY;
+    if (buffer_eq_slen(b, CONST_STR_LEN("power-of-two")))
+        return GW_BALANCE_P2C;
+    if (buffer_eq_slen(b, CONST_STR_LEN("consistent-hash")))
+        return GW_BALANCE_CONSISTENT_HASH;
 
     log_error(srv->errh, __FILE__, __LINE__,
       "xxxxx.balance has to be one of: "
-      "least-connection, round-robin, hash, sticky, but not: %s", b->ptr);
+      "least-connection, round-robin, hash, sticky, least-latency, "
+      "power-of-two, consistent-hash, but not: %s", b->ptr);
     return GW_BALANCE_LEAST_CONNECTION;
 }
 
+int gw_get_defaults_balance_key(server *srv, const buffer *b) {
+    if (buffer_eq_slen(b, CONST_STR_LEN("path"))
+        || buffer_eq_slen(b, CONST_STR_LEN("query")))
+        return 1;
+    if (buffer_string_length(b) > sizeof("header:")-1
+        && 0 == memcmp(b->ptr, CONST_STR_LEN("header:")))
+        return 1;
+    if (buffer_string_length(b) > sizeof("cookie:")-1
+        && 0 == memcmp(b->ptr, CONST_STR_LEN("cookie:")))
+        return 1;
+
+    log_error(srv->errh, __FILE__, __LINE__,
+      "xxxxx.balance-key has to be one of: "
+      "path, query, header:<name>, cookie:<name>, but not: %s", b->ptr);
+    return 0;
+}
+
 
 static void gw_set_state(gw_handler_ctx *hctx, gw_connection_state_t state) {
     hctx->state = state;
@@ -1749,6 +2194,106 @@ void gw_set_transparent(gw_handler_ctx *hctx) {
 }
 
 
+enum {
+  GW_QUEUE_NONE,
+  GW_QUEUE_WAITING,
+  GW_QUEUE_WOKEN,
+  GW_QUEUE_TIMEOUT
+};
+
+static void gw_queue_counters(gw_host * const host) {
+    *gw_status_get_counter(host, NULL, CONST_STR_LEN(".queued")) =
+      host->queue_len;
+}
+
+static void gw_queue_push(gw_host * const host, gw_handler_ctx * const hctx, const int head) {
+    if (hctx->queue_state != GW_QUEUE_WOKEN) /*(keep time first queued)*/
+        hctx->queue_ts = gw_time_us();
+    hctx->queue_state = GW_QUEUE_WAITING;
+    if (head) {
+        hctx->queue_prev = NULL;
+        hctx->queue_next = host->queue_first;
+        if (host->queue_first)
+            host->queue_first->queue_prev = hctx;
+        else
+            host->queue_last = hctx;
+        host->queue_first = hctx;
+    }
+    else {
+        hctx->queue_next = NULL;
+        hctx->queue_prev = host->queue_last;
+        if (host->queue_last)
+            host->queue_last->queue_next = hctx;
+        else
+            host->queue_first = hctx;
+        host->queue_last = hctx;
+    }
+    ++host->queue_len;
+    gw_queue_counters(host);
+}
+
+static void gw_queue_remove(gw_host * const host, gw_handler_ctx * const hctx) {
+    if (hctx->queue_prev)
+        hctx->queue_prev->queue_next = hctx->queue_next;
+    else
+        host->queue_first = hctx->queue_next;
+    if (hctx->queue_next)
+        hctx->queue_next->queue_prev = hctx->queue_prev;
+    else
+        host->queue_last = hctx->queue_prev;
+    hctx->queue_next = hctx->queue_prev = NULL;
+    --host->queue_len;
+    gw_queue_counters(host);
+}
+
+static void gw_queue_wake(gw_host * const host) {
+    /* resume as many waiting requests (in order) as procs have capacity */
+    uint32_t avail = 0;
+    for (gw_proc *proc = host->first; proc; proc = proc->next) {
+        if (proc->state != PROC_STATE_RUNNING) continue;
+        if (0 == host->max_reqs_per_proc) { avail = host->queue_len; break; }
+        if (proc->load < host->max_reqs_per_proc)
+            avail += (uint32_t)(host->max_reqs_per_proc - proc->load);
+    }
+    avail = (avail > host->queue_woken) ? avail - host->queue_woken : 0;
+
+    for (gw_handler_ctx *hctx; avail && (hctx = host->queue_first); --avail) {
+        gw_queue_remove(host, hctx);
+        hctx->queue_state = GW_QUEUE_WOKEN;
+        ++host->queue_woken;
+        *gw_status_get_counter(host, NULL, CONST_STR_LEN(".queue-wait-ms")) =
+          (int)((gw_time_us() - hctx->queue_ts) / 1000);
+        joblist_append(hctx->r->con);
+    }
+}
+
+static void gw_queue_trigger(gw_host * const host) {
+    /* resume waiting requests if procs were re-enabled */
+    gw_queue_wake(host);
+
+    /* expire requests waiting longer than queue-timeout (oldest first) */
+    const uint64_t cur_us = gw_time_us();
+    const uint64_t timeout_us = (uint64_t)host->queue_timeout * 1000000;
+    for (gw_handler_ctx *hctx; (hctx = host->queue_first); ) {
+        if (cur_us - hctx->queue_ts < timeout_us) break;
+        gw_queue_remove(host, hctx);
+        hctx->queue_state = GW_QUEUE_TIMEOUT;
+        ++(*gw_status_get_counter(host, NULL, CONST_STR_LEN(".queue-timeouts")));
+        joblist_append(hctx->r->con);
+    }
+}
+
+static void gw_queue_detach(gw_handler_ctx * const hctx) {
+    if (hctx->queue_state == GW_QUEUE_WAITING)
+        gw_queue_remove(hctx->host, hctx);
+    else if (hctx->queue_state == GW_QUEUE_WOKEN)
+        --hctx->host->queue_woken;
+    hctx->queue_state = GW_QUEUE_NONE;
+}
+
+
+static void gw_mpx_detach(gw_handler_ctx *hctx);
+
 static void gw_backend_close(gw_handler_ctx * const hctx, request_st * const r) {
     if (hctx->fd >= 0) {
         fdevent_fdnode_event_del(hctx->ev, hctx->fdn);
@@ -1757,12 +2302,20 @@ static void gw_backend_close(gw_handler_ctx * const hctx, request_st * const r)
         hctx->fdn = NULL;
         hctx->fd = -1;
     }
+    else if (hctx->mpx) {
+        gw_mpx_detach(hctx);
+    }
+    hctx->mpx_wb_end = 0;
+    hctx->mpx_event = 0;
 
     if (hctx->host) {
+        if (hctx->queue_state) gw_queue_detach(hctx);
+
         if (hctx->proc) {
             gw_proc_release(hctx->host, hctx->proc, hctx->conf.debug,
                             r->conf.errh);
             hctx->proc = NULL;
+            if (hctx->host->queue_first) gw_queue_wake(hctx->host);
         }
 
         gw_host_reset(hctx->host);
@@ -1785,7 +2338,8 @@ static void gw_connection_close(gw_handler_ctx * const hctx, request_st * const
 static handler_t gw_reconnect(gw_handler_ctx * const hctx, request_st * const r) {
     gw_backend_close(hctx, r);
 
-    hctx->host = gw_host_get(r,hctx->ext,hctx->conf.balance,hctx->conf.debug);
+    hctx->host = gw_host_get(r, hctx->ext, hctx->conf.balance,
+                             hctx->conf.balance_key, hctx->conf.debug);
     if (NULL == hctx->host) return HANDLER_FINISHED;
 
     gw_host_assign(hctx->host);
@@ -1810,6 +2364,7 @@ static void gw_conditional_tcp_fin(gw_handler_ctx * const hctx, request_st * con
     /*assert(r->conf.stream_request_body & FDEVENT_STREAM_REQUEST_TCP_FIN);*/
     if (!chunkqueue_is_empty(hctx->wb)) return;
     if (!hctx->host->tcp_fin_propagate) return;
+    if (-1 == hctx->fd) return; /*(shared connection if multiplexed)*/
     if (hctx->gw_mode == GW_AUTHORIZER) return;
     if (r->conf.stream_request_body & FDEVENT_STREAM_REQUEST_BACKEND_SHUT_WR)
         return;
@@ -1822,9 +2377,491 @@ static void gw_conditional_tcp_fin(gw_handler_ctx * const hctx, request_st * con
     fdevent_fdnode_event_clr(hctx->ev, hctx->fdn, FDEVENT_OUT);
 }
 
+/*
+ * multiplexing requests over shared connections to a proc
+ *
+ * Each proc has up to host->multiplex persistent connections, over which
+ * requests are sent as interleaved protocol records with request ids
+ * (slots in mpx->streams).  Capabilities of the backend are queried once
+ * a connection is established (mpx->proto->probe()); a backend which does
+ * not support multiplexing is used with a separate connection per request.
+ * Request records of each request are moved from hctx->wb to the shared
+ * mpx->wb only after records previously moved have been sent, so a request
+ * with a large request body does not monopolize the shared connection, and
+ * reading of the request body from the client is paused as usual while
+ * hctx->wb is full.  (There is no flow control of responses in FastCGI;
+ * response records are passed to each request as they are received.)
+ * Protocols with framing and flow control of their own (HTTP/2) move request
+ * data with mpx->proto->send() and are notified with mpx->proto->resume()
+ * when a request is ready for more response data.
+ */
+
+#define GW_MPX_STREAMS_DEFAULT 16
+
+#define GW_MPX_EV_RESTART 1 /* backend does not multiplex; restart request */
+#define GW_MPX_EV_ERROR   2 /* shared connection failed */
+
+static handler_t gw_recv_response_rc(gw_handler_ctx *hctx, request_st *r, handler_t rc);
+static handler_t gw_mpx_handle_fdevent(void *ctx, int revents);
+
+static void gw_mpx_close(gw_mpx * const mpx, const int event) {
+    gw_mpx **m = &mpx->proc->mpx;
+    while (*m != mpx) m = &(*m)->next;
+    *m = mpx->next;
+
+    mpx->state = GW_MPX_CLOSED;
+    fdevent_fdnode_event_del(mpx->ev, mpx->fdn);
+    fdevent_sched_close(mpx->ev, mpx->fd, 1);
+    mpx->fdn = NULL;
+    mpx->fd = -1;
+
+    for (uint32_t id = 1; id <= GW_MPX_STREAMS_MAX; ++id) {
+        gw_handler_ctx * const hctx = mpx->streams[id];
+        if (NULL == hctx) continue;
+        hctx->mpx = NULL;
+        hctx->mpx_event = event;
+        joblist_append(hctx->r->con);
+    }
+
+    gw_mpx_free(mpx);
+}
+
+static int gw_mpx_write(gw_mpx * const mpx) {
+    if (!chunkqueue_is_empty(mpx->wb)) {
+        server * const srv = mpx->srv;
+        if (srv->network_backend_write(mpx->fd, mpx->wb,
+                                       MAX_WRITE_LIMIT, srv->errh) < 0) {
+            log_perror(srv->errh, __FILE__, __LINE__,
+              "write failed on shared connection to %s",
+              mpx->proc->connection_name->ptr);
+            return -1;
+        }
+    }
+
+    if (chunkqueue_is_empty(mpx->wb))
+        fdevent_fdnode_event_clr(mpx->ev, mpx->fdn, FDEVENT_OUT);
+    else
+        fdevent_fdnode_event_add(mpx->ev, mpx->fdn, FDEVENT_OUT);
+
+    /* resume requests waiting for their prior records to be sent
+     * (including ids above max_streams if limit lowered by backend) */
+    for (uint32_t id = 1; id <= GW_MPX_STREAMS_MAX; ++id) {
+        gw_handler_ctx * const hctx = mpx->streams[id];
+        if (NULL != hctx && hctx->state == GW_STATE_WRITE
+            && hctx->mpx_wb_end <= mpx->wb->bytes_out
+            && !chunkqueue_is_empty(hctx->wb))
+            joblist_append(hctx->r->con);
+    }
+
+    return 0;
+}
+
+static int gw_mpx_read(gw_mpx * const mpx) {
+    /* 0: ok, -1: error, -2: connection closed by backend */
+    chunkqueue * const cq = mpx->rb;
+    off_t max_bytes = MAX_READ_LIMIT;
+    size_t mem_len = 0;
+    ssize_t len;
+    do {
+        chunk * const ckpt = cq->last;
+        char * const mem = chunkqueue_get_memory(cq, &mem_len);
+        len = read(mpx->fd, mem, mem_len);
+        chunkqueue_use_memory(cq, ckpt, len > 0 ? len : 0);
+        if (len != (ssize_t)mem_len) break;
+        max_bytes -= len;
+        mem_len = 0;
+    } while (max_bytes > 0);
+
+    if (len > 0 || !chunkqueue_is_empty(cq)) {
+        if (0 != mpx->proto->recv(mpx)) return -1;
+        chunkqueue_remove_finished_chunks(cq);
+        /*(protocol might have queued replies, e.g. acks)*/
+        if (!chunkqueue_is_empty(mpx->wb) && mpx->state != GW_MPX_CLOSED)
+            fdevent_fdnode_event_add(mpx->ev, mpx->fdn, FDEVENT_OUT);
+    }
+
+    if (len < 0) {
+        switch (errno) {
+          case EAGAIN:
+         #ifdef EWOULDBLOCK
+         #if EWOULDBLOCK != EAGAIN
+          case EWOULDBLOCK:
+         #endif
+         #endif
+          case EINTR:
+            return 0;
+          default:
+            log_perror(mpx->srv->errh, __FILE__, __LINE__,
+              "read failed on shared connection to %s",
+              mpx->proc->connection_name->ptr);
+            return -1;
+        }
+    }
+
+    return (0 == len) ? -2 : 0;
+}
+
+static uint32_t gw_mpx_max_streams(const gw_mpx * const mpx) {
+    const gw_proc * const proc = mpx->proc;
+    uint32_t max_streams = GW_MPX_STREAMS_DEFAULT;
+    if (proc->mpx_max_reqs) {
+        /* share FCGI_MAX_REQS between connections to proc */
+        max_streams = proc->mpx_max_reqs / mpx->host->multiplex;
+        if (0 == max_streams) max_streams = 1;
+    }
+    if (max_streams > GW_MPX_STREAMS_MAX) max_streams = GW_MPX_STREAMS_MAX;
+    return max_streams;
+}
+
+static void gw_mpx_ready(gw_mpx * const mpx) {
+    const uint32_t max_streams = gw_mpx_max_streams(mpx);
+    mpx->max_streams = max_streams;
+    mpx->state = GW_MPX_READY;
+    mpx->state_ts = log_epoch_secs;
+
+    for (uint32_t id = 1; id <= GW_MPX_STREAMS_MAX; ++id) {
+        gw_handler_ctx * const hctx = mpx->streams[id];
+        if (NULL == hctx) continue;
+        if (id > max_streams) { /* exceeds limit reported by backend */
+            mpx->streams[id] = NULL;
+            --mpx->nstreams;
+            hctx->mpx = NULL;
+            hctx->mpx_event = GW_MPX_EV_RESTART;
+        }
+        joblist_append(hctx->r->con);
+    }
+}
+
+static int gw_mpx_connected(gw_mpx * const mpx) {
+    fdevent_fdnode_event_set(mpx->ev, mpx->fdn, FDEVENT_IN | FDEVENT_RDHUP);
+    if (mpx->proto->init) mpx->proto->init(mpx);
+    if (1 == mpx->proc->mpx_supported)
+        gw_mpx_ready(mpx);
+    else {
+        /* query backend for capabilities */
+        mpx->state = GW_MPX_PROBE;
+        mpx->state_ts = log_epoch_secs;
+        if (mpx->proto->probe) mpx->proto->probe(mpx);
+    }
+    if (0 == gw_mpx_write(mpx)) return 0;
+    gw_mpx_close(mpx, GW_MPX_EV_ERROR);
+    return -1;
+}
+
+void gw_mpx_probe_result(gw_mpx * const mpx, uint32_t max_conns, uint32_t max_reqs, int mpxs) {
+    gw_proc * const proc = mpx->proc;
+    if (mpx->state != GW_MPX_PROBE) return;
+
+    proc->mpx_max_conns = max_conns;
+    proc->mpx_max_reqs = max_reqs;
+    proc->mpx_supported = (0 != mpxs);
+    if (!mpxs) {
+        log_error(mpx->srv->errh, __FILE__, __LINE__,
+          "backend does not multiplex requests; "
+          "using separate connections to %s",
+          proc->connection_name->ptr);
+        mpx->state = GW_MPX_CLOSED; /*(closed once records are parsed)*/
+        return;
+    }
+
+    gw_mpx_ready(mpx);
+}
+
+void gw_mpx_max_reqs(gw_mpx * const mpx, uint32_t max_reqs) {
+    /* limit changed by backend after probe; requests already sent continue
+     * (new requests are not started until below the new limit) */
+    mpx->proc->mpx_max_reqs = max_reqs;
+    mpx->max_streams = gw_mpx_max_streams(mpx);
+}
+
+void gw_mpx_deliver(gw_mpx * const mpx, const uint32_t id, buffer * const b, const int end) {
+    gw_handler_ctx * const hctx =
+      (id <= GW_MPX_STREAMS_MAX) ? mpx->streams[id] : NULL;
+    if (NULL == hctx) {
+        /* discard records for aborted (or unknown) request id */
+        if (end && id <= GW_MPX_STREAMS_MAX && mpx->aborting[id]) {
+            mpx->aborting[id] = 0;
+            --mpx->nstreams;
+        }
+        return;
+    }
+
+    request_st * const r = hctx->r;
+    if (end) { /* release request id; request ended */
+        mpx->streams[id] = NULL;
+        --mpx->nstreams;
+        mpx->state_ts = log_epoch_secs;
+        hctx->mpx = NULL;
+    }
+
+    joblist_append(r->con);
+    handler_t rc =
+      hctx->opts.parse(r, &hctx->opts, b, buffer_string_length(b));
+    if (HANDLER_GO_ON == rc && end) rc = HANDLER_FINISHED;
+    gw_recv_response_rc(hctx, r, rc); /*(might invalidate hctx)*/
+}
+
+void gw_mpx_reset(gw_mpx * const mpx, const uint32_t id, const int retry) {
+    /* request id reset by backend; retry request if backend did not process
+     * it (and if request can be resent, i.e. has no request body) */
+    gw_handler_ctx * const hctx =
+      (id <= GW_MPX_STREAMS_MAX) ? mpx->streams[id] : NULL;
+    if (NULL == hctx) {
+        gw_mpx_deliver(mpx, id, NULL, 1);
+        return;
+    }
+
+    request_st * const r = hctx->r;
+    mpx->streams[id] = NULL;
+    --mpx->nstreams;
+    mpx->state_ts = log_epoch_secs;
+    hctx->mpx = NULL;
+    if (retry && (0 == hctx->mpx_wb_end || 0 == r->reqbody_length)
+        && hctx->reconnects++ < 5) {
+        chunkqueue_reset(hctx->wb); /*(request is recreated)*/
+        hctx->mpx_event = GW_MPX_EV_RESTART;
+    }
+    else
+        hctx->mpx_event = GW_MPX_EV_ERROR;
+    joblist_append(r->con);
+}
+
+static void gw_mpx_detach(gw_handler_ctx * const hctx) {
+    gw_mpx * const mpx = hctx->mpx;
+    const uint32_t id = (uint32_t)hctx->request_id;
+    hctx->mpx = NULL;
+    mpx->streams[id] = NULL;
+    mpx->state_ts = log_epoch_secs;
+    if (0 != hctx->mpx_wb_end) {
+        /* request was (partially) sent; abort and await end of request */
+        mpx->aborting[id] = 1;
+        mpx->proto->abort(mpx, id);
+        fdevent_fdnode_event_add(mpx->ev, mpx->fdn, FDEVENT_OUT);
+    }
+    else
+        --mpx->nstreams;
+}
+
+static gw_mpx * gw_mpx_init(gw_handler_ctx * const hctx, request_st * const r) {
+    gw_host * const host = hctx->host;
+    gw_proc * const proc = hctx->proc;
+    server * const srv = r->con->srv;
+
+    const int fd = fdevent_socket_nb_cloexec(host->family, SOCK_STREAM, 0);
+    if (-1 == fd) {
+        log_perror(r->conf.errh, __FILE__, __LINE__,
+          "socket failed %d %d", srv->cur_fds, srv->max_fds);
+        return NULL;
+    }
+    ++srv->cur_fds;
+
+    gw_mpx * const mpx = calloc(1, sizeof(*mpx));
+    force_assert(mpx);
+    mpx->streams = calloc(GW_MPX_STREAMS_MAX+1, sizeof(*mpx->streams));
+    force_assert(mpx->streams);
+    mpx->aborting = calloc(GW_MPX_STREAMS_MAX+1, sizeof(*mpx->aborting));
+    force_assert(mpx->aborting);
+    mpx->rb = chunkqueue_init();
+    mpx->wb = chunkqueue_init();
+    mpx->proc = proc;
+    mpx->host = host;
+    mpx->proto = hctx->mpx_proto;
+    mpx->srv = srv;
+    mpx->ev = hctx->ev;
+    mpx->fd = fd;
+    mpx->fdn = fdevent_register(mpx->ev, fd, gw_mpx_handle_fdevent, mpx);
+    mpx->pid = hctx->pid;
+    mpx->state = GW_MPX_CONNECT;
+    mpx->state_ts = log_epoch_secs;
+    mpx->max_streams = GW_MPX_STREAMS_DEFAULT;
+    mpx->next_id = 1;
+    mpx->next = proc->mpx;
+    proc->mpx = mpx;
+
+    if (AF_UNIX != host->family) {
+        if (-1 == fdevent_set_tcp_nodelay(fd, 1)) {
+            /*(error, but not critical)*/
+        }
+    }
+
+    switch (gw_establish_connection(r, host, proc, mpx->pid, fd,
+                                    hctx->conf.debug)) {
+    case 1: /* connection is in progress */
+        fdevent_fdnode_event_set(mpx->ev, mpx->fdn, FDEVENT_OUT);
+        break;
+    case -1:/* connection error */
+        gw_mpx_close(mpx, 0);
+        return NULL;
+    case 0: /* everything is ok, go on */
+        if (0 != gw_mpx_connected(mpx)) return NULL;
+        break;
+    }
+
+    return mpx;
+}
+
+static int gw_mpx_attach(gw_handler_ctx * const hctx, request_st * const r) {
+    /* 1: attached to shared connection, 0: not multiplexed, -1: error */
+    gw_proc * const proc = hctx->proc;
+    if (0 == proc->mpx_supported) return 0;
+
+    gw_mpx *mpx = NULL;
+    uint32_t nconns = 0;
+    for (gw_mpx *m = proc->mpx; m; m = m->next) {
+        if (m->state == GW_MPX_DRAIN) continue;
+        ++nconns;
+        if (m->nstreams >= m->max_streams) continue;
+        if (NULL == mpx || m->nstreams < mpx->nstreams) mpx = m;
+    }
+
+    if (NULL == mpx) {
+        uint32_t max_conns = hctx->host->multiplex;
+        if (proc->mpx_max_conns && proc->mpx_max_conns < max_conns)
+            max_conns = proc->mpx_max_conns;
+        if (nconns >= max_conns && !hctx->mpx_proto->shared_only)
+            return 0; /* use separate connection */
+        mpx = gw_mpx_init(hctx, r);
+        if (NULL == mpx) return -1;
+    }
+
+    uint32_t id = mpx->next_id;
+    if (id > mpx->max_streams) id = 1; /*(max_streams reduced by backend)*/
+    while (NULL != mpx->streams[id] || mpx->aborting[id]) {
+        if (++id > mpx->max_streams) id = 1;
+    }
+    mpx->next_id = (id < mpx->max_streams) ? id + 1 : 1;
+    mpx->streams[id] = hctx;
+    ++mpx->nstreams;
+
+    hctx->mpx = mpx;
+    hctx->request_id = (int)id;
+    hctx->mpx_wb_end = 0;
+    hctx->mpx_event = 0;
+    return 1;
+}
+
+static int gw_mpx_stream_write(gw_handler_ctx * const hctx) {
+    /* move request records to shared connection once records previously
+     * moved have been sent (leaving excess in hctx->wb as backpressure) */
+    gw_mpx * const mpx = hctx->mpx;
+    if (hctx->mpx_wb_end > mpx->wb->bytes_out) return 0;
+    const off_t bytes_in = mpx->wb->bytes_in;
+    if (!mpx->proto->send)
+        chunkqueue_append_chunkqueue(mpx->wb, hctx->wb);
+    else if (0 != mpx->proto->send(mpx, hctx)) {
+        gw_mpx_close(mpx, GW_MPX_EV_ERROR);
+        return -1;
+    }
+    if (bytes_in == mpx->wb->bytes_in) return 0;
+    hctx->mpx_wb_end = mpx->wb->bytes_in;
+    if (0 == gw_mpx_write(mpx)) return 0;
+    gw_mpx_close(mpx, GW_MPX_EV_ERROR);
+    return -1;
+}
+
+__attribute_cold__
+static void gw_mpx_connect_error(gw_mpx * const mpx, const int errnum) {
+    /* mark proc using first request waiting on connection */
+    for (uint32_t id = 1; id <= GW_MPX_STREAMS_MAX; ++id) {
+        gw_handler_ctx * const hctx = mpx->streams[id];
+        if (NULL == hctx) continue;
+        gw_proc_connect_error(hctx->r, mpx->host, mpx->proc, mpx->pid,
+                              errnum, hctx->conf.debug);
+        break;
+    }
+    gw_mpx_close(mpx, GW_MPX_EV_ERROR);
+}
+
+static handler_t gw_mpx_handle_fdevent(void *ctx, int revents) {
+    gw_mpx * const mpx = ctx;
+
+    if (mpx->state == GW_MPX_CONNECT) {
+        const int socket_error = fdevent_connect_status(mpx->fd);
+        if (0 != socket_error)
+            gw_mpx_connect_error(mpx, socket_error);
+        else
+            gw_mpx_connected(mpx);
+        return HANDLER_FINISHED;
+    }
+
+    if (revents & (FDEVENT_IN | FDEVENT_HUP | FDEVENT_RDHUP)) {
+        const int rc = gw_mpx_read(mpx);
+        if (mpx->state == GW_MPX_CLOSED) { /* backend does not multiplex */
+            gw_mpx_close(mpx, GW_MPX_EV_RESTART);
+            return HANDLER_FINISHED;
+        }
+        if (mpx->state == GW_MPX_DRAIN && 0 == mpx->nstreams) {
+            gw_mpx_close(mpx, 0);
+            return HANDLER_FINISHED;
+        }
+        if (0 != rc) {
+            if (mpx->state == GW_MPX_PROBE) {
+                /* backend closed connection instead of reporting
+                 * capabilities; treat as not supporting multiplexing */
+                mpx->proc->mpx_supported = 0;
+                gw_mpx_close(mpx, GW_MPX_EV_RESTART);
+                return HANDLER_FINISHED;
+            }
+            if (-2 == rc && 0 == mpx->nstreams) {
+                /* idle connection closed by backend */
+                gw_mpx_close(mpx, 0);
+                return HANDLER_FINISHED;
+            }
+            log_error(mpx->srv->errh, __FILE__, __LINE__,
+              "unexpected close of shared connection to %s "
+              "with %u active requests",
+              mpx->proc->connection_name->ptr, mpx->nstreams);
+            gw_mpx_close(mpx, GW_MPX_EV_ERROR);
+            return HANDLER_FINISHED;
+        }
+    }
+
+    if (revents & FDEVENT_OUT) {
+        if (0 != gw_mpx_write(mpx)) {
+            gw_mpx_close(mpx, GW_MPX_EV_ERROR);
+            return HANDLER_FINISHED;
+        }
+    }
+
+    if (revents & FDEVENT_ERR) {
+        log_error(mpx->srv->errh, __FILE__, __LINE__,
+          "error on shared connection to %s",
+          mpx->proc->connection_name->ptr);
+        gw_mpx_close(mpx, GW_MPX_EV_ERROR);
+    }
+
+    return HANDLER_FINISHED;
+}
+
+static void gw_mpx_trigger(gw_host * const host) {
+    const time_t cur_ts = log_epoch_secs;
+    for (gw_proc *proc = host->first; proc; proc = proc->next) {
+        for (gw_mpx *mpx = proc->mpx, *next; mpx; mpx = next) {
+            next = mpx->next;
+            if (mpx->state == GW_MPX_PROBE && cur_ts - mpx->state_ts >= 2) {
+                log_error(mpx->srv->errh, __FILE__, __LINE__,
+                  "backend did not report capabilities; "
+                  "using separate connections to %s",
+                  proc->connection_name->ptr);
+                proc->mpx_supported = 0;
+                gw_mpx_close(mpx, GW_MPX_EV_RESTART);
+            }
+            else if (0 == mpx->nstreams
+                     && (mpx->state == GW_MPX_DRAIN
+                         || (mpx->state == GW_MPX_READY
+                             && cur_ts - mpx->state_ts > host->idle_timeout))) {
+                gw_mpx_close(mpx, 0);
+            }
+        }
+    }
+}
+
 static handler_t gw_write_request(gw_handler_ctx * const hctx, request_st * const r) {
     switch(hctx->state) {
     case GW_STATE_INIT:
+        if (hctx->queue_state == GW_QUEUE_WAITING)
+            return HANDLER_WAIT_FOR_EVENT; /* waiting for backend capacity */
+
         /* do we have a running process for this host (max-procs) ? */
         hctx->proc = NULL;
 
@@ -1835,19 +2872,69 @@ static handler_t gw_write_request(gw_handler_ctx * const hctx, request_st * cons
              }
         }
 
+        /* check the other procs if they have a lower load */
+        if (hctx->proc) {
+            for (gw_proc *proc = hctx->proc->next; proc; proc = proc->next) {
+                if (proc->state != PROC_STATE_RUNNING) continue;
+                if (proc->load < hctx->proc->load) hctx->proc = proc;
+            }
+        }
+
+        if (hctx->host->queue_size || hctx->host->max_reqs_per_proc) {
+            /* wait in queue if all procs are at capacity (or disabled),
+             * or behind requests already waiting (first in, first out) */
+            gw_host * const host = hctx->host;
+            const int woken = (hctx->queue_state == GW_QUEUE_WOKEN);
+            if (woken) {
+                --host->queue_woken;
+                hctx->queue_state = GW_QUEUE_NONE;
+            }
+            if (NULL == hctx->proc
+                || (host->max_reqs_per_proc
+                    && hctx->proc->load >= host->max_reqs_per_proc)
+                || (!woken && (host->queue_len || host->queue_woken))) {
+                if (woken || host->queue_len < host->queue_size) {
+                    hctx->queue_state = woken ? GW_QUEUE_WOKEN : GW_QUEUE_NONE;
+                    hctx->proc = NULL;
+                    gw_queue_push(host, hctx, woken);
+                    gw_queue_wake(host);
+                    return (hctx->queue_state == GW_QUEUE_WAITING)
+                      ? HANDLER_WAIT_FOR_EVENT
+                      : gw_write_request(hctx, r);
+                }
+                /* queue full (or no queue); try another host */
+                hctx->proc = NULL;
+                return HANDLER_ERROR;
+            }
+        }
+
         /* all children are dead */
         if (hctx->proc == NULL) {
             return HANDLER_ERROR;
         }
 
-        /* check the other procs if they have a lower load */
-        for (gw_proc *proc = hctx->proc->next; proc; proc = proc->next) {
-            if (proc->state != PROC_STATE_RUNNING) continue;
-            if (proc->load < hctx->proc->load) hctx->proc = proc;
-        }
-
         gw_proc_load_inc(hctx->host, hctx->proc);
 
+        if (gw_balance_latency(hctx->conf.balance))
+            hctx->ttfb_ts = gw_time_us();
+
+        if (hctx->mpx_proto && hctx->host->multiplex) {
+            if (hctx->proc->is_local) {
+                hctx->pid = hctx->proc->pid;
+            }
+            switch (gw_mpx_attach(hctx, r)) {
+            case 1: /* multiplexed over shared connection */
+                gw_set_state(hctx, GW_STATE_CONNECT_DELAYED);
+                return (hctx->mpx->state == GW_MPX_READY)
+                  ? gw_write_request(hctx, r)
+                  : HANDLER_WAIT_FOR_EVENT;
+            case -1:
+                return HANDLER_ERROR;
+            default: /* use separate connection */
+                break;
+            }
+        }
+
         hctx->fd = fdevent_socket_nb_cloexec(hctx->host->family,SOCK_STREAM,0);
         if (-1 == hctx->fd) {
             log_error_st * const errh = r->conf.errh;
@@ -1884,7 +2971,12 @@ static handler_t gw_write_request(gw_handler_ctx * const hctx, request_st * cons
         }
         /* fall through */
     case GW_STATE_CONNECT_DELAYED:
-        if (hctx->state == GW_STATE_CONNECT_DELAYED) { /*(not GW_STATE_INIT)*/
+        if (hctx->mpx) {
+            /*(requests attached before GW_MPX_DRAIN are sent)*/
+            if (hctx->mpx->state < GW_MPX_READY)
+                return HANDLER_WAIT_FOR_EVENT;
+        }
+        else if (hctx->state == GW_STATE_CONNECT_DELAYED) { /*(not GW_STATE_INIT)*/
             int socket_error = fdevent_connect_status(hctx->fd);
             if (socket_error != 0) {
                 gw_proc_connect_error(r, hctx->host, hctx->proc, hctx->pid,
@@ -1911,7 +3003,7 @@ static handler_t gw_write_request(gw_handler_ctx * const hctx, request_st * cons
         }
 
         /*(disable Nagle algorithm if streaming and content-length unknown)*/
-        if (AF_UNIX != hctx->host->family) {
+        if (AF_UNIX != hctx->host->family && -1 != hctx->fd) {
             if (r->reqbody_length < 0) {
                 if (-1 == fdevent_set_tcp_nodelay(hctx->fd, 1)) {
                     /*(error, but not critical)*/
@@ -1923,7 +3015,11 @@ static handler_t gw_write_request(gw_handler_ctx * const hctx, request_st * cons
         gw_set_state(hctx, GW_STATE_WRITE);
         /* fall through */
     case GW_STATE_WRITE:
-        if (!chunkqueue_is_empty(hctx->wb)) {
+        if (hctx->mpx) {
+            if (0 != gw_mpx_stream_write(hctx))
+                return HANDLER_WAIT_FOR_EVENT; /*(hctx->mpx_event set)*/
+        }
+        else if (!chunkqueue_is_empty(hctx->wb)) {
             log_error_st * const errh = r->conf.errh;
           #if 0
             if (hctx->conf.debug > 1) {
@@ -1997,6 +3093,11 @@ __attribute_cold__
 static handler_t gw_write_error(gw_handler_ctx * const hctx, request_st * const r) {
     int status = r->http_status;
 
+    if (hctx->ttfb_ts) { /* (latency-aware balancing) */
+        hctx->ttfb_ts = 0;
+        gw_host_outcome(hctx->host, 1, r->conf.errh);
+    }
+
     if (hctx->state == GW_STATE_INIT ||
         hctx->state == GW_STATE_CONNECT_DELAYED) {
 
@@ -2030,8 +3131,31 @@ handler_t gw_handle_subrequest(request_st * const r, void *p_d) {
     gw_handler_ctx *hctx = r->plugin_ctx[p->id];
     if (NULL == hctx) return HANDLER_GO_ON;
 
+    if (hctx->mpx_event) {
+        const int event = hctx->mpx_event;
+        hctx->mpx_event = 0;
+        if (GW_MPX_EV_RESTART == event) /* retry (on separate connection if
+                                         * backend does not multiplex) */
+            return gw_reconnect(hctx, r);
+        /* shared connection failed */
+        return (hctx->state == GW_STATE_CONNECT_DELAYED)
+          ? gw_write_error(hctx, r)
+          : gw_recv_response_rc(hctx, r, HANDLER_ERROR);
+    }
+
+    if (hctx->queue_state == GW_QUEUE_TIMEOUT) {
+        log_error(r->conf.errh, __FILE__, __LINE__,
+          "no backend capacity within %hu s for %s?%.*s",
+          hctx->host->queue_timeout,
+          r->uri.path.ptr, BUFFER_INTLEN_PTR(&r->uri.query));
+        if (hctx->backend_error) hctx->backend_error(hctx);
+        gw_connection_close(hctx, r);
+        r->http_status = 503;
+        return HANDLER_FINISHED;
+    }
+
     if ((r->conf.stream_response_body & FDEVENT_STREAM_RESPONSE_BUFMIN)
-        && r->resp_body_started) {
+        && r->resp_body_started && -1 != hctx->fd /*(not multiplexed)*/) {
         if (chunkqueue_length(r->write_queue) > 65536 - 4096) {
             fdevent_fdnode_event_clr(hctx->ev, hctx->fdn, FDEVENT_IN);
         }
@@ -2043,6 +3167,12 @@ handler_t gw_handle_subrequest(request_st * const r, void *p_d) {
             fdevent_fdnode_event_add(hctx->ev, hctx->fdn, FDEVENT_IN);
         }
     }
+    else if (hctx->mpx && hctx->mpx->proto->resume) {
+        gw_mpx * const mpx = hctx->mpx;
+        mpx->proto->resume(mpx, hctx);
+        if (!chunkqueue_is_empty(mpx->wb))
+            fdevent_fdnode_event_add(mpx->ev, mpx->fdn, FDEVENT_OUT);
+    }
 
     /* (do not receive request body before GW_AUTHORIZER has run or else
      *  the request body is discarded with handler_ctx_clear() after running
@@ -2060,7 +3190,10 @@ handler_t gw_handle_subrequest(request_st * const r, void *p_d) {
             if (r->conf.stream_request_body & FDEVENT_STREAM_REQUEST_BUFMIN) {
                 r->conf.stream_request_body &= ~FDEVENT_STREAM_REQUEST_POLLIN;
             }
-            if (0 != hctx->wb->bytes_in) return HANDLER_WAIT_FOR_EVENT;
+            /*(if multiplexed, continue below to move hctx->wb to shared
+             * connection; there is no fdevent on hctx->fd to resume write)*/
+            if (0 != hctx->wb->bytes_in && NULL == hctx->mpx)
+                return HANDLER_WAIT_FOR_EVENT;
         }
         else {
             handler_t rc = connection_handle_read_post_state(r);
@@ -2103,7 +3236,8 @@ handler_t gw_handle_subrequest(request_st * const r, void *p_d) {
 
     {
         handler_t rc =((0==hctx->wb->bytes_in || !chunkqueue_is_empty(hctx->wb))
-                       && hctx->state != GW_STATE_CONNECT_DELAYED)
+                       && (hctx->state != GW_STATE_CONNECT_DELAYED
+                           || (hctx->mpx && hctx->mpx->state >= GW_MPX_READY)))
           ? gw_send_request(hctx, r)
           : HANDLER_WAIT_FOR_EVENT;
         if (HANDLER_WAIT_FOR_EVENT != rc) return rc;
@@ -2117,8 +3251,6 @@ handler_t gw_handle_subrequest(request_st * const r, void *p_d) {
 
 
 static handler_t gw_recv_response(gw_handler_ctx * const hctx, request_st * const r) {
-    gw_proc *proc = hctx->proc;
-    gw_host *host = hctx->host;
     /*(XXX: make this a configurable flag for other protocols)*/
     buffer *b = hctx->opts.backend == BACKEND_FASTCGI
       ? chunk_buffer_acquire()
@@ -2128,6 +3260,25 @@ static handler_t gw_recv_response(gw_handler_ctx * const hctx, request_st * cons
 
     if (b != hctx->response) chunk_buffer_release(b);
 
+    return gw_recv_response_rc(hctx, r, rc);
+}
+
+
+static handler_t gw_recv_response_rc(gw_handler_ctx * const hctx, request_st * const r, handler_t rc) {
+    gw_proc *proc = hctx->proc;
+    gw_host *host = hctx->host;
+
+    if (hctx->ttfb_ts) { /* (latency-aware balancing) */
+        if (HANDLER_ERROR == rc || HANDLER_COMEBACK == rc) {
+            hctx->ttfb_ts = 0;
+            gw_host_outcome(host, 1, r->conf.errh);
+        }
+        else if (HANDLER_FINISHED == rc || r->resp_body_started) {
+            gw_host_latency(host, hctx);
+            gw_host_outcome(host, r->http_status >= 500, r->conf.errh);
+        }
+    }
+
     switch (rc) {
     default:
         return HANDLER_GO_ON;
@@ -2412,7 +3563,8 @@ handler_t gw_check_extension(request_st * const r, gw_plugin_data * const p, int
     }
 
     /* check if we have at least one server for this extension up and running */
-    host = gw_host_get(r, extension, p->conf.balance, p->conf.debug);
+    host = gw_host_get(r, extension, p->conf.balance,
+                       p->conf.balance_key, p->conf.debug);
     if (NULL == host) {
         return HANDLER_FINISHED;
     }
@@ -2504,6 +3656,7 @@ handler_t gw_check_extension(request_st * const r, gw_plugin_data * const p, int
     /*hctx->conf.exts_resp   = p->conf.exts_resp;*/
     /*hctx->conf.ext_mapping = p->conf.ext_mapping;*/
     hctx->conf.balance     = p->conf.balance;
+    hctx->conf.balance_key = p->conf.balance_key;
     hctx->conf.proto       = p->conf.proto;
     hctx->conf.debug       = p->conf.debug;
 
@@ -2524,7 +3677,197 @@ handler_t gw_check_extension(request_st * const r, gw_plugin_data * const p, int
     return HANDLER_GO_ON;
 }
 
-static void gw_handle_trigger_host(gw_host * const host, log_error_st * const errh, const int debug) {
+/* active health checks */
+
+enum { GW_HC_CONNECT, GW_HC_SEND, GW_HC_RECV };
+
+int gw_health_check_http_status(const gw_host * const host, const buffer * const b) {
+    /* check status of HTTP/1.x response status-line */
+    const uint32_t len = buffer_string_length(b);
+    if (len < sizeof("HTTP/1.x 200")-1) return -1;
+    if (0 != memcmp(b->ptr, "HTTP/1.", sizeof("HTTP/1.")-1)) return 0;
+    const char * const s = b->ptr + sizeof("HTTP/1.x ")-1;
+    if (!light_isdigit(s[0]) || !light_isdigit(s[1]) || !light_isdigit(s[2]))
+        return 0;
+    const int status = (s[0]-'0')*100 + (s[1]-'0')*10 + (s[2]-'0');
+    return (status == host->hc_status);
+}
+
+static void gw_hc_close(gw_hc * const hc) {
+    fdevent_fdnode_event_del(hc->srv->ev, hc->fdn);
+    fdevent_sched_close(hc->srv->ev, hc->fd, 1);
+    hc->fdn = NULL;
+    hc->fd = -1;
+}
+
+static void gw_hc_result(gw_hc * const hc, const int ok, const char * const reason) {
+    gw_host * const host = hc->host;
+    gw_proc * const proc = hc->proc;
+    log_error_st * const errh = hc->srv->errh;
+    if (-1 != hc->fd) gw_hc_close(hc);
+    buffer_clear(hc->b);
+
+    if (ok) {
+        hc->fail = 0;
+        if (hc->ok < USHRT_MAX) ++hc->ok;
+        if (proc->hc_down && hc->ok >= host->hc_rise) {
+            proc->hc_down = 0;
+            log_error(errh, __FILE__, __LINE__,
+              "health check passed %hu times: %s",
+              hc->ok, proc->connection_name->ptr);
+            proc->disabled_until = 0;
+            gw_proc_check_enable(host, proc, errh);
+        }
+    }
+    else {
+        hc->ok = 0;
+        if (hc->fail < USHRT_MAX) ++hc->fail;
+        if (!proc->hc_down && hc->fail >= host->hc_fall) {
+            proc->hc_down = 1;
+            log_error(errh, __FILE__, __LINE__,
+              "health check failed %hu times (%s); disabling: %s",
+              hc->fail, reason, proc->connection_name->ptr);
+            gw_proc_tag_inc(host, proc, CONST_STR_LEN(".health-check-down"));
+            if (proc->state == PROC_STATE_RUNNING) {
+                proc->disabled_until = log_epoch_secs;
+                gw_proc_set_state(host, proc, PROC_STATE_OVERLOADED);
+            }
+        }
+    }
+}
+
+static int gw_hc_write(gw_hc * const hc) {
+    const uint32_t len = buffer_string_length(hc->b);
+    while (hc->woff < len) {
+        const ssize_t wr = write(hc->fd, hc->b->ptr+hc->woff, len-hc->woff);
+        if (wr > 0)
+            hc->woff += (uint32_t)wr;
+        else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            fdevent_fdnode_event_set(hc->srv->ev, hc->fdn,
+                                     FDEVENT_IN | FDEVENT_OUT);
+            return 0;
+        }
+        else if (errno != EINTR)
+            return -1;
+    }
+    /* request sent; receive response into same buffer */
+    hc->state = GW_HC_RECV;
+    buffer_clear(hc->b);
+    fdevent_fdnode_event_set(hc->srv->ev, hc->fdn, FDEVENT_IN);
+    return 0;
+}
+
+static void gw_hc_connected(gw_hc * const hc) {
+    if (NULL == hc->host->hc_proto) { /* connect succeeded */
+        gw_hc_result(hc, 1, NULL);
+        return;
+    }
+    hc->state = GW_HC_SEND;
+    hc->host->hc_proto->request(hc->host, hc->b);
+    hc->woff = 0;
+    if (0 != gw_hc_write(hc))
+        gw_hc_result(hc, 0, strerror(errno));
+}
+
+static void gw_hc_read(gw_hc * const hc) {
+    if (hc->state == GW_HC_SEND) {
+        if (0 != gw_hc_write(hc))
+            gw_hc_result(hc, 0, strerror(errno));
+        return;
+    }
+
+    for (;;) {
+        char * const s = buffer_string_prepare_append(hc->b, 1023);
+        const ssize_t rd = read(hc->fd, s, 1023);
+        if (rd > 0) {
+            buffer_commit(hc->b, (size_t)rd);
+            const int rc = hc->host->hc_proto->response(hc->host, hc->b);
+            if (-1 != rc)
+                gw_hc_result(hc, rc, "unexpected response");
+            else if (buffer_string_length(hc->b) >= 8192)
+                gw_hc_result(hc, 0, "response too large");
+            else
+                continue;
+        }
+        else if (0 == rd)
+            gw_hc_result(hc, 0, "connection closed");
+        else if (errno == EINTR)
+            continue;
+        else if (errno != EAGAIN && errno != EWOULDBLOCK)
+            gw_hc_result(hc, 0, strerror(errno));
+        return;
+    }
+}
+
+static handler_t gw_hc_handle_fdevent(void *ctx, int revents) {
+    gw_hc * const hc = ctx;
+    if (hc->state == GW_HC_CONNECT) {
+        const int socket_error = fdevent_connect_status(hc->fd);
+        if (0 != socket_error)
+            gw_hc_result(hc, 0, strerror(socket_error));
+        else
+            gw_hc_connected(hc);
+        return HANDLER_FINISHED;
+    }
+    if (revents & (FDEVENT_IN | FDEVENT_OUT))
+        gw_hc_read(hc);
+    else if (revents & (FDEVENT_HUP | FDEVENT_ERR | FDEVENT_RDHUP))
+        gw_hc_result(hc, 0, "connection closed");
+    return HANDLER_FINISHED;
+}
+
+static void gw_hc_start(server * const srv, gw_host * const host, gw_proc * const proc) {
+    gw_hc *hc = proc->hc;
+    if (NULL == hc) {
+        hc = proc->hc = calloc(1, sizeof(*hc));
+        force_assert(hc);
+        hc->host = host;
+        hc->proc = proc;
+        hc->srv = srv;
+        hc->fd = -1;
+        hc->b = buffer_init();
+    }
+    hc->ts = log_epoch_secs;
+    hc->state = GW_HC_CONNECT;
+
+    hc->fd = fdevent_socket_nb_cloexec(host->family, SOCK_STREAM, 0);
+    if (-1 == hc->fd) {
+        const int errnum = errno;
+        log_perror(srv->errh, __FILE__, __LINE__,
+          "health check socket failed %d %d", srv->cur_fds, srv->max_fds);
+        gw_hc_result(hc, 0, strerror(errnum));
+        return;
+    }
+    ++srv->cur_fds;
+    hc->fdn = fdevent_register(srv->ev, hc->fd, gw_hc_handle_fdevent, hc);
+
+    if (-1 == connect(hc->fd, proc->saddr, proc->saddrlen)) {
+        if (errno == EINPROGRESS || errno == EALREADY || errno == EINTR) {
+            fdevent_fdnode_event_set(srv->ev, hc->fdn, FDEVENT_OUT);
+        }
+        else
+            gw_hc_result(hc, 0, strerror(errno));
+        return;
+    }
+    gw_hc_connected(hc);
+}
+
+static void gw_hc_trigger(server * const srv, gw_host * const host) {
+    const time_t cur_ts = log_epoch_secs;
+    for (gw_proc *proc = host->first; proc; proc = proc->next) {
+        if (proc->state != PROC_STATE_RUNNING
+            && proc->state != PROC_STATE_OVERLOADED) continue;
+        gw_hc * const hc = proc->hc;
+        if (NULL != hc && -1 != hc->fd) {
+            if (cur_ts - hc->ts >= (time_t)host->hc_timeout)
+                gw_hc_result(hc, 0, "timeout");
+        }
+        else if (NULL == hc || cur_ts - hc->ts >= (time_t)host->hc_interval)
+            gw_hc_start(srv, host, proc);
+    }
+}
+
+static void gw_handle_trigger_host(server * const srv, gw_host * const host, log_error_st * const errh, const int debug) {
     /*
      * TODO:
      *
@@ -2548,6 +3891,12 @@ static void gw_handle_trigger_host(gw_host * const host, log_error_st * const er
 
     gw_restart_dead_procs(host, errh, debug, 1);
 
+    if (host->multiplex) gw_mpx_trigger(host);
+
+    if (host->queue_first) gw_queue_trigger(host);
+
+    if (host->hc_interval) gw_hc_trigger(srv, host);
+
     /* check if adaptive spawning enabled */
     if (host->min_procs == host->max_procs) return;
     if (buffer_string_is_empty(host->bin_path)) return;
@@ -2594,16 +3943,16 @@ static void gw_handle_trigger_host(gw_host * const host, log_error_st * const er
     }
 }
 
-static void gw_handle_trigger_exts(gw_exts * const exts, log_error_st * const errh, const int debug) {
+static void gw_handle_trigger_exts(server * const srv, gw_exts * const exts, log_error_st * const errh, const int debug) {
     for (uint32_t j = 0; j < exts->used; ++j) {
         gw_extension *ex = exts->exts+j;
         for (uint32_t n = 0; n < ex->used; ++n) {
-            gw_handle_trigger_host(ex->hosts[n], errh, debug);
+            gw_handle_trigger_host(srv, ex->hosts[n], errh, debug);
         }
     }
 }
 
-static void gw_handle_trigger_exts_wkr(gw_exts *exts, log_error_st *errh) {
+static void gw_handle_trigger_exts_wkr(server *srv, gw_exts *exts, log_error_st *errh) {
     for (uint32_t j = 0; j < exts->used; ++j) {
         gw_extension * const ex = exts->exts+j;
         for (uint32_t n = 0; n < ex->used; ++n) {
@@ -2612,6 +3961,9 @@ static void gw_handle_trigger_exts_wkr(gw_exts *exts, log_error_st *errh) {
                 if (proc->state == PROC_STATE_OVERLOADED)
                     gw_proc_check_enable(host, proc, errh);
             }
+            if (host->multiplex) gw_mpx_trigger(host);
+            if (host->queue_first) gw_queue_trigger(host);
+            if (host->hc_interval) gw_hc_trigger(srv, host);
         }
     }
 }
@@ -2648,8 +4000,8 @@ handler_t gw_handle_trigger(server *srv, void *p_d) {
          * (unable to use p->defaults.debug since gw_plugin_config
          *  might be part of a larger plugin_config) */
         wkr
-          ? gw_handle_trigger_exts_wkr(conf->exts, errh)
-          : gw_handle_trigger_exts(conf->exts, errh, debug);
+          ? gw_handle_trigger_exts_wkr(srv, conf->exts, errh)
+          : gw_handle_trigger_exts(srv, conf->exts, errh, debug);
     }
 
     return HANDLER_GO_ON;
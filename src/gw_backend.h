@@ -37,6 +37,14 @@ typedef struct gw_proc {
 
     int is_local;
 
+    struct gw_mpx *mpx; /* shared (multiplexed) connections to this proc */
+    int mpx_supported;  /* -1 unknown, 0 no, 1 yes (FCGI_MPXS_CONNS) */
+    uint32_t mpx_max_conns; /* limits reported by backend (0 if unknown) */
+    uint32_t mpx_max_reqs;
+
+    struct gw_hc *hc;   /* active health check (probe) */
+    int hc_down;        /* disabled by failed health checks */
+
     enum {
         PROC_STATE_RUNNING,    /* alive */
         PROC_STATE_OVERLOADED, /* listen-queue is full */
@@ -202,6 +210,57 @@ typedef struct {
     const buffer *strip_request_uri;
 
     unsigned short tcp_fin_propagate;
+
+    /*
+     * number of shared connections per proc over which requests are
+     * multiplexed, if supported by protocol and backend (0: disabled)
+     */
+    unsigned short multiplex;
+
+    /*
+     * latency-aware balancing (balance "least-latency" or "power-of-two")
+     *
+     * ewma_us is the peak-EWMA of time to first response byte.
+     * A host newly enabled (or returning from ejection) receives a share of
+     * traffic increasing over slow_start seconds.  A host with a high rate of
+     * errors in a window is ejected (skipped) for a period which increases
+     * with consecutive ejections.
+     */
+    uint32_t ewma_us;
+    uint64_t ewma_ts;
+    time_t enabled_ts;
+    unsigned short slow_start;
+    unsigned short ejections;
+    time_t ejected_until;
+    time_t win_ts;
+    uint32_t win_reqs;
+    uint32_t win_errs;
+
+    /*
+     * bounded wait queue for requests while all procs are at
+     * max-requests-per-proc or disabled (0 == queue_size: disabled)
+     */
+    unsigned short max_reqs_per_proc; /* (0: unlimited) */
+    unsigned short queue_size;
+    unsigned short queue_timeout;     /* seconds */
+    uint32_t queue_len;
+    uint32_t queue_woken;             /* dequeued; not yet resumed */
+    struct gw_handler_ctx *queue_first;
+    struct gw_handler_ctx *queue_last;
+
+    /*
+     * active health checks (0 == hc_interval: disabled)
+     * each proc is probed every hc_interval seconds, disabled after hc_fall
+     * consecutive failed probes, and enabled after hc_rise passed probes
+     */
+    unsigned short hc_interval;
+    unsigned short hc_timeout;
+    unsigned short hc_rise;
+    unsigned short hc_fall;
+    unsigned short hc_status;
+    const buffer *hc_path;
+    const struct gw_hc_proto *hc_proto;
+
     unsigned short kill_signal; /* we need a setting for this as libfcgi
                                    applications prefer SIGUSR1 while the
                                    rest of the world would use SIGTERM
@@ -266,6 +325,7 @@ typedef struct gw_plugin_config {
     int balance;
     int proto;
     int debug;
+    const buffer *balance_key;
 } gw_plugin_config;
 
 /* generic plugin data, shared between all connections */
@@ -286,6 +346,76 @@ typedef enum {
 } gw_connection_state_t;
 
 struct fdevents;        /* declaration */
+struct gw_handler_ctx;  /* declaration */
+
+#define GW_MPX_STREAMS_MAX 256 /* max requests per shared connection */
+
+/* shared connection to a proc over which requests are multiplexed */
+typedef struct gw_mpx {
+    struct gw_mpx *next;
+    gw_proc *proc;
+    gw_host *host;
+    const struct gw_mpx_proto *proto;
+
+    enum {
+        GW_MPX_CONNECT, /* connect() in progress */
+        GW_MPX_PROBE,   /* waiting for backend to report capabilities */
+        GW_MPX_READY,
+        GW_MPX_DRAIN,   /* no new requests (e.g. backend is shutting down) */
+        GW_MPX_CLOSED
+    } state;
+    time_t state_ts;
+
+    struct fdevents *ev;
+    fdnode   *fdn;
+    int       fd;
+    pid_t     pid;
+    server   *srv;
+
+    chunkqueue *rb; /* read queue (protocol records) */
+    chunkqueue *wb; /* write queue (records of all streams) */
+
+    uint32_t nstreams;
+    uint32_t max_streams;
+    uint32_t next_id;
+    struct gw_handler_ctx **streams; /* indexed by request id; [0] unused */
+    unsigned char *aborting;         /* request id aborted; awaiting end */
+    void *pctx;                      /* protocol state (if any) */
+} gw_mpx;
+
+/* protocol hooks for multiplexing requests over shared connections */
+typedef struct gw_mpx_proto {
+    /* queue request for backend capabilities to mpx->wb
+     * (optional if backend reports capabilities unprompted) */
+    void (*probe)(gw_mpx *mpx);
+    /* parse records in mpx->rb; call gw_mpx_probe_result(), gw_mpx_deliver()
+     * (return -1 on protocol error) */
+    int (*recv)(gw_mpx *mpx);
+    /* queue abort of request id to mpx->wb */
+    void (*abort)(gw_mpx *mpx, uint32_t id);
+    /* (optional) init mpx->pctx and queue connection preface to mpx->wb */
+    void (*init)(gw_mpx *mpx);
+    /* (optional) free mpx->pctx */
+    void (*free)(gw_mpx *mpx);
+    /* (optional) move request data from hctx->wb to mpx->wb, e.g. framed
+     * and subject to flow control (default: moved as-is)
+     * (return -1 if request data could not be moved; connection is closed) */
+    int (*send)(gw_mpx *mpx, struct gw_handler_ctx *hctx);
+    /* (optional) request is ready for more response data, e.g. to replenish
+     * flow control window */
+    void (*resume)(gw_mpx *mpx, struct gw_handler_ctx *hctx);
+    /* requests can not be sent on separate (non-shared) connections to a
+     * backend which multiplexes; open more shared connections if needed */
+    int shared_only;
+} gw_mpx_proto;
+
+/* protocol hooks for active health checks (if not set, probe connects) */
+typedef struct gw_hc_proto {
+    /* append probe request to b */
+    void (*request)(const gw_host *host, buffer *b);
+    /* check (partial) response in b: 1 healthy, 0 unhealthy, -1 incomplete*/
+    int (*response)(const gw_host *host, const buffer *b);
+} gw_hc_proto;
 
 #define GW_RESPONDER  1
 #define GW_AUTHORIZER 2
@@ -314,6 +444,18 @@ typedef struct gw_handler_ctx {
     pid_t     pid;
     int       reconnects; /* number of reconnect attempts */
 
+    gw_mpx   *mpx;       /* shared connection (if multiplexed) */
+    const gw_mpx_proto *mpx_proto; /* (set by module to enable multiplex) */
+    off_t     mpx_wb_end; /* end of data moved from wb to mpx->wb */
+    int       mpx_event;  /* event from shared connection to handle */
+
+    uint64_t  ttfb_ts;    /* request start (us); 0 once latency sampled */
+
+    struct gw_handler_ctx *queue_next; /* wait queue (if host saturated) */
+    struct gw_handler_ctx *queue_prev;
+    uint64_t  queue_ts;   /* time queued (us) */
+    int       queue_state;
+
     int       request_id;
     int       send_content_body;
 
@@ -340,12 +482,15 @@ void gw_free(void *p_d);
 
 __attribute_cold__
 void gw_exts_clear_check_local(gw_exts *exts);
+void gw_exts_set_health_check(gw_exts *exts, const gw_hc_proto *proto);
+int gw_health_check_http_status(const gw_host *host, const buffer *b);
 
 __attribute_cold__
 int gw_set_defaults_backend(server *srv, gw_plugin_data *p, const array *a, gw_plugin_config *s, int sh_exec, const char *cpkkey);
 
 __attribute_cold__
 int gw_get_defaults_balance(server *srv, const buffer *b);
+int gw_get_defaults_balance_key(server *srv, const buffer *b);
 
 handler_t gw_check_extension(request_st *r, gw_plugin_data *p, int uri_path_handler, size_t hctx_sz);
 handler_t gw_handle_request_reset(request_st *r, void *p_d);
@@ -355,4 +500,9 @@ handler_t gw_handle_waitpid_cb(server *srv, void *p_d, pid_t pid, int status);
 
 void gw_set_transparent(gw_handler_ctx *hctx);
 
+void gw_mpx_probe_result(gw_mpx *mpx, uint32_t max_conns, uint32_t max_reqs, int mpxs);
+void gw_mpx_max_reqs(gw_mpx *mpx, uint32_t max_reqs);
+void gw_mpx_deliver(gw_mpx *mpx, uint32_t id, buffer *b, int end);
+void gw_mpx_reset(gw_mpx *mpx, uint32_t id, int retry);
+
 #endif
@@ -0,0 +1,385 @@
+#include "first.h"
+
+#include "hpack.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* static table (RFC 7541 Appendix A) */
+static const struct hpack_static_field {
+    const char *k;
+    uint32_t klen;
+    const char *v;
+    uint32_t vlen;
+} hpack_static_table[] = {
+    { CONST_STR_LEN(":authority"), CONST_STR_LEN("") }, /* 1 */
+    { CONST_STR_LEN(":method"), CONST_STR_LEN("GET") }, /* 2 */
+    { CONST_STR_LEN(":method"), CONST_STR_LEN("POST") }, /* 3 */
+    { CONST_STR_LEN(":path"), CONST_STR_LEN("/") }, /* 4 */
+    { CONST_STR_LEN(":path"), CONST_STR_LEN("/index.html") }, /* 5 */
+    { CONST_STR_LEN(":scheme"), CONST_STR_LEN("http") }, /* 6 */
+    { CONST_STR_LEN(":scheme"), CONST_STR_LEN("https") }, /* 7 */
+    { CONST_STR_LEN(":status"), CONST_STR_LEN("200") }, /* 8 */
+    { CONST_STR_LEN(":status"), CONST_STR_LEN("204") }, /* 9 */
+    { CONST_STR_LEN(":status"), CONST_STR_LEN("206") }, /* 10 */
+    { CONST_STR_LEN(":status"), CONST_STR_LEN("304") }, /* 11 */
+    { CONST_STR_LEN(":status"), CONST_STR_LEN("400") }, /* 12 */
+    { CONST_STR_LEN(":status"), CONST_STR_LEN("404") }, /* 13 */
+    { CONST_STR_LEN(":status"), CONST_STR_LEN("500") }, /* 14 */
+    { CONST_STR_LEN("accept-charset"), CONST_STR_LEN("") }, /* 15 */
+    { CONST_STR_LEN("accept-encoding"), CONST_STR_LEN("gzip, deflate") }, /* 16 */
+    { CONST_STR_LEN("accept-language"), CONST_STR_LEN("") }, /* 17 */
+    { CONST_STR_LEN("accept-ranges"), CONST_STR_LEN("") }, /* 18 */
+    { CONST_STR_LEN("accept"), CONST_STR_LEN("") }, /* 19 */
+    { CONST_STR_LEN("access-control-allow-origin"), CONST_STR_LEN("") }, /* 20 */
+    { CONST_STR_LEN("age"), CONST_STR_LEN("") }, /* 21 */
+    { CONST_STR_LEN("allow"), CONST_STR_LEN("") }, /* 22 */
+    { CONST_STR_LEN("authorization"), CONST_STR_LEN("") }, /* 23 */
+    { CONST_STR_LEN("cache-control"), CONST_STR_LEN("") }, /* 24 */
+    { CONST_STR_LEN("content-disposition"), CONST_STR_LEN("") }, /* 25 */
+    { CONST_STR_LEN("content-encoding"), CONST_STR_LEN("") }, /* 26 */
+    { CONST_STR_LEN("content-language"), CONST_STR_LEN("") }, /* 27 */
+    { CONST_STR_LEN("content-length"), CONST_STR_LEN("") }, /* 28 */
+    { CONST_STR_LEN("content-location"), CONST_STR_LEN("") }, /* 29 */
+    { CONST_STR_LEN("content-range"), CONST_STR_LEN("") }, /* 30 */
+    { CONST_STR_LEN("content-type"), CONST_STR_LEN("") }, /* 31 */
+    { CONST_STR_LEN("cookie"), CONST_STR_LEN("") }, /* 32 */
+    { CONST_STR_LEN("date"), CONST_STR_LEN("") }, /* 33 */
+    { CONST_STR_LEN("etag"), CONST_STR_LEN("") }, /* 34 */
+    { CONST_STR_LEN("expect"), CONST_STR_LEN("") }, /* 35 */
+    { CONST_STR_LEN("expires"), CONST_STR_LEN("") }, /* 36 */
+    { CONST_STR_LEN("from"), CONST_STR_LEN("") }, /* 37 */
+    { CONST_STR_LEN("host"), CONST_STR_LEN("") }, /* 38 */
+    { CONST_STR_LEN("if-match"), CONST_STR_LEN("") }, /* 39 */
+    { CONST_STR_LEN("if-modified-since"), CONST_STR_LEN("") }, /* 40 */
+    { CONST_STR_LEN("if-none-match"), CONST_STR_LEN("") }, /* 41 */
+    { CONST_STR_LEN("if-range"), CONST_STR_LEN("") }, /* 42 */
+    { CONST_STR_LEN("if-unmodified-since"), CONST_STR_LEN("") }, /* 43 */
+    { CONST_STR_LEN("last-modified"), CONST_STR_LEN("") }, /* 44 */
+    { CONST_STR_LEN("link"), CONST_STR_LEN("") }, /* 45 */
+    { CONST_STR_LEN("location"), CONST_STR_LEN("") }, /* 46 */
+    { CONST_STR_LEN("max-forwards"), CONST_STR_LEN("") }, /* 47 */
+    { CONST_STR_LEN("proxy-authenticate"), CONST_STR_LEN("") }, /* 48 */
+    { CONST_STR_LEN("proxy-authorization"), CONST_STR_LEN("") }, /* 49 */
+    { CONST_STR_LEN("range"), CONST_STR_LEN("") }, /* 50 */
+    { CONST_STR_LEN("referer"), CONST_STR_LEN("") }, /* 51 */
+    { CONST_STR_LEN("refresh"), CONST_STR_LEN("") }, /* 52 */
+    { CONST_STR_LEN("retry-after"), CONST_STR_LEN("") }, /* 53 */
+    { CONST_STR_LEN("server"), CONST_STR_LEN("") }, /* 54 */
+    { CONST_STR_LEN("set-cookie"), CONST_STR_LEN("") }, /* 55 */
+    { CONST_STR_LEN("strict-transport-security"), CONST_STR_LEN("") }, /* 56 */
+    { CONST_STR_LEN("transfer-encoding"), CONST_STR_LEN("") }, /* 57 */
+    { CONST_STR_LEN("user-agent"), CONST_STR_LEN("") }, /* 58 */
+    { CONST_STR_LEN("vary"), CONST_STR_LEN("") }, /* 59 */
+    { CONST_STR_LEN("via"), CONST_STR_LEN("") }, /* 60 */
+    { CONST_STR_LEN("www-authenticate"), CONST_STR_LEN("") } /* 61 */
+};
+
+#define HPACK_STATIC_TABLE_LEN \
+  (sizeof(hpack_static_table)/sizeof(*hpack_static_table))
+
+/* Huffman code (RFC 7541 Appendix B) is canonical: codes of each length are
+ * consecutive, and are assigned in order of code length, then symbol.  The
+ * code is therefore fully described by the number of codes of each length
+ * (hpack_huff_count[len]) and the symbols ordered by (len, symbol) */
+static const uint8_t hpack_huff_count[31] = {
+    0, 0, 0, 0, 0, 10, 26, 32, 6, 0, 5, 3, 2, 6, 2, 3, 0, 0, 0, 3, 8, 13, 26, 29, 12, 4, 15, 19, 29, 0, 4
+};
+static const uint16_t hpack_huff_sym[257] = {
+    48, 49, 50, 97, 99, 101, 105, 111, 115, 116, 32, 37,
+    45, 46, 47, 51, 52, 53, 54, 55, 56, 57, 61, 65,
+    95, 98, 100, 102, 103, 104, 108, 109, 110, 112, 114, 117,
+    58, 66, 67, 68, 69, 70, 71, 72, 73, 74, 75, 76,
+    77, 78, 79, 80, 81, 82, 83, 84, 85, 86, 87, 89,
+    106, 107, 113, 118, 119, 120, 121, 122, 38, 42, 44, 59,
+    88, 90, 33, 34, 40, 41, 63, 39, 43, 124, 35, 62,
+    0, 36, 64, 91, 93, 126, 94, 125, 60, 96, 123, 92,
+    195, 208, 128, 130, 131, 162, 184, 194, 224, 226, 153, 161,
+    167, 172, 176, 177, 179, 209, 216, 217, 227, 229, 230, 129,
+    132, 133, 134, 136, 146, 154, 156, 160, 163, 164, 169, 170,
+    173, 178, 181, 185, 186, 187, 189, 190, 196, 198, 228, 232,
+    233, 1, 135, 137, 138, 139, 140, 141, 143, 147, 149, 150,
+    151, 152, 155, 157, 158, 165, 166, 168, 174, 175, 180, 182,
+    183, 188, 191, 197, 231, 239, 9, 142, 144, 145, 148, 159,
+    171, 206, 215, 225, 236, 237, 199, 207, 234, 235, 192, 193,
+    200, 201, 202, 205, 210, 213, 218, 219, 238, 240, 242, 243,
+    255, 203, 204, 211, 212, 214, 221, 222, 223, 241, 244, 245,
+    246, 247, 248, 250, 251, 252, 253, 254, 2, 3, 4, 5,
+    6, 7, 8, 11, 12, 14, 15, 16, 17, 18, 19, 20,
+    21, 23, 24, 25, 26, 27, 28, 29, 30, 31, 127, 220,
+    249, 10, 13, 22, 256
+};
+
+
+void hpack_table_init (hpack_table * const t, const uint32_t limit)
+{
+    memset(t, 0, sizeof(*t));
+    t->max_size = t->limit = limit;
+    /* (each entry is at least 32 bytes) */
+    uint32_t n = 8;
+    while (n <= limit / 32) n <<= 1;
+    t->ents = calloc(n, sizeof(*t->ents));
+    force_assert(t->ents);
+    t->mask = n - 1;
+}
+
+static void hpack_table_evict (hpack_table * const t, const uint32_t size)
+{
+    while (t->size > size) {
+        hpack_entry * const e = t->ents[(t->head - t->used + 1) & t->mask];
+        t->size -= e->klen + e->vlen + 32;
+        --t->used;
+        free(e);
+    }
+}
+
+void hpack_table_free (hpack_table * const t)
+{
+    if (NULL == t->ents) return;
+    hpack_table_evict(t, 0);
+    free(t->ents);
+    t->ents = NULL;
+}
+
+void hpack_table_resize (hpack_table * const t, uint32_t size)
+{
+    if (size > t->limit) size = t->limit;
+    if (size == t->max_size) return;
+    t->max_size = size;
+    hpack_table_evict(t, size);
+    t->update = 1;
+}
+
+static void hpack_table_insert (hpack_table * const t, const char * const k, const uint32_t klen, const char * const v, const uint32_t vlen)
+{
+    const uint32_t sz = klen + vlen + 32;
+    if (sz > t->max_size) { /* entry larger than table empties table */
+        hpack_table_evict(t, 0);
+        return;
+    }
+    /* (copy before evicting; k might refer to name of entry evicted) */
+    hpack_entry * const e = malloc(sizeof(hpack_entry) + klen + vlen);
+    force_assert(e);
+    e->klen = klen;
+    e->vlen = vlen;
+    memcpy(e->data, k, klen);
+    memcpy(e->data + klen, v, vlen);
+    hpack_table_evict(t, t->max_size - sz);
+    t->head = (t->head + 1) & t->mask;
+    t->ents[t->head] = e;
+    t->size += sz;
+    ++t->used;
+}
+
+static int hpack_table_get (const hpack_table * const t, uint32_t ndx, const char ** const k, uint32_t * const klen, const char ** const v, uint32_t * const vlen)
+{
+    if (0 == ndx) return -1;
+    if (ndx <= HPACK_STATIC_TABLE_LEN) {
+        const struct hpack_static_field * const f = hpack_static_table+ndx-1;
+        *k = f->k;
+        *klen = f->klen;
+        *v = f->v;
+        *vlen = f->vlen;
+        return 0;
+    }
+    ndx -= HPACK_STATIC_TABLE_LEN + 1;
+    if (ndx >= t->used) return -1;
+    const hpack_entry * const e = t->ents[(t->head - ndx) & t->mask];
+    *k = e->data;
+    *klen = e->klen;
+    *v = e->data + e->klen;
+    *vlen = e->vlen;
+    return 0;
+}
+
+static uint32_t hpack_table_find (const hpack_table * const t, const char * const k, const uint32_t klen, const char * const v, const uint32_t vlen, uint32_t * const kndx)
+{
+    /* return index of field matching name and value (0 if none), and set
+     * kndx to index of a field matching name (0 if none) */
+    *kndx = 0;
+    for (uint32_t i = 0; i < HPACK_STATIC_TABLE_LEN; ++i) {
+        const struct hpack_static_field * const f = hpack_static_table+i;
+        if (f->klen != klen || !buffer_eq_icase_ssn(f->k, k, klen)) continue;
+        if (f->vlen == vlen && 0 == memcmp(f->v, v, vlen)) return i+1;
+        if (0 == *kndx) *kndx = i+1;
+    }
+    for (uint32_t i = 0; i < t->used; ++i) {
+        const hpack_entry * const e = t->ents[(t->head - i) & t->mask];
+        if (e->klen != klen || !buffer_eq_icase_ssn(e->data, k, klen)) continue;
+        if (e->vlen == vlen && 0 == memcmp(e->data+klen, v, vlen))
+            return i + HPACK_STATIC_TABLE_LEN + 1;
+        if (0 == *kndx) *kndx = i + HPACK_STATIC_TABLE_LEN + 1;
+    }
+    return 0;
+}
+
+static void hpack_encode_int (buffer * const b, uint32_t n, const int prefix, const unsigned char bits)
+{
+    char * const s = buffer_string_prepare_append(b, 6);
+    const uint32_t max = (1u << prefix) - 1;
+    uint32_t i = 0;
+    if (n < max)
+        s[i++] = (char)(bits | n);
+    else {
+        s[i++] = (char)(bits | max);
+        for (n -= max; n >= 128; n >>= 7)
+            s[i++] = (char)((n & 0x7f) | 0x80);
+        s[i++] = (char)n;
+    }
+    buffer_commit(b, i);
+}
+
+void hpack_encode_field (hpack_table * const t, buffer * const b, const char * const k, const uint32_t klen, const char * const v, const uint32_t vlen, const int how)
+{
+    if (t->update) { /* dynamic table size update (start of header block) */
+        t->update = 0;
+        hpack_encode_int(b, t->max_size, 5, 0x20);
+    }
+
+    uint32_t kndx;
+    const uint32_t ndx = hpack_table_find(t, k, klen, v, vlen, &kndx);
+    if (ndx && how != HPACK_FIELD_NEVERINDEX) { /* indexed field */
+        hpack_encode_int(b, ndx, 7, 0x80);
+        return;
+    }
+
+    if (how == HPACK_FIELD_INDEX)
+        hpack_encode_int(b, kndx, 6, 0x40);
+    else
+        hpack_encode_int(b, kndx, 4,
+                         how == HPACK_FIELD_NEVERINDEX ? 0x10 : 0x00);
+    if (0 == kndx) { /* literal name (lowercase) */
+        hpack_encode_int(b, klen, 7, 0);
+        char * const s = buffer_string_prepare_append(b, klen);
+        for (uint32_t i = 0; i < klen; ++i)
+            s[i] = (k[i] >= 'A' && k[i] <= 'Z') ? k[i] | 0x20 : k[i];
+        buffer_commit(b, klen);
+    }
+    hpack_encode_int(b, vlen, 7, 0);
+    buffer_append_string_len(b, v, vlen);
+
+    if (how == HPACK_FIELD_INDEX)
+        hpack_table_insert(t, k, klen, v, vlen);
+}
+
+static int hpack_decode_int (const unsigned char ** const s, const unsigned char * const end, const int prefix, uint32_t * const n)
+{
+    const uint32_t max = (1u << prefix) - 1;
+    uint32_t v = *(*s)++ & max;
+    if (v == max) {
+        unsigned char c;
+        int m = 0;
+        do {
+            if (*s == end || m > 21) return -1; /*(limit to 2^28)*/
+            c = *(*s)++;
+            v += (uint32_t)(c & 0x7f) << m;
+            m += 7;
+        } while (c & 0x80);
+    }
+    *n = v;
+    return 0;
+}
+
+static int hpack_huff_decode (buffer * const tb, const unsigned char * const s, const uint32_t len)
+{
+    /* (shortest code is 5 bits) */
+    char * const d = buffer_string_prepare_append(tb, len * 8 / 5 + 1);
+    uint32_t n = 0;
+    int code = 0, first = 0, index = 0, bits = 0, ones = 1;
+    for (uint32_t i = 0; i < len; ++i) {
+        for (int j = 7; j >= 0; --j) {
+            const int bit = (s[i] >> j) & 1;
+            code |= bit;
+            ones &= bit;
+            const int count = hpack_huff_count[++bits];
+            if (code - first < count) {
+                const int sym = hpack_huff_sym[index + (code - first)];
+                if (256 == sym) return -1; /* EOS must not be decoded */
+                d[n++] = (char)sym;
+                code = first = index = bits = 0;
+                ones = 1;
+                continue;
+            }
+            if (30 == bits) return -1;
+            index += count;
+            first += count;
+            first <<= 1;
+            code <<= 1;
+        }
+    }
+    /* padding must be shorter than 8 bits and be a prefix of EOS (all 1s) */
+    if (bits > 7 || !ones) return -1;
+    buffer_commit(tb, n);
+    return 0;
+}
+
+static int hpack_decode_str (const unsigned char ** const s, const unsigned char * const end, buffer * const tb, const char ** const str, uint32_t * const len)
+{
+    /* *str is NULL if string is decoded to tb (at offset *str_off) */
+    if (*s == end) return -1;
+    const int huff = (**s & 0x80);
+    uint32_t n;
+    if (0 != hpack_decode_int(s, end, 7, &n)) return -1;
+    if ((size_t)(end - *s) < n) return -1;
+    if (huff) {
+        const uint32_t off = buffer_string_length(tb);
+        if (0 != hpack_huff_decode(tb, *s, n)) return -1;
+        *str = NULL;
+        *len = buffer_string_length(tb) - off;
+    }
+    else {
+        *str = (const char *)*s;
+        *len = n;
+    }
+    *s += n;
+    return 0;
+}
+
+int hpack_decode (hpack_table * const t, const unsigned char *s, const size_t len, buffer * const tb, hpack_field_cb cb, void *ctx)
+{
+    const unsigned char * const end = s + len;
+    int nfields = 0;
+    while (s < end) {
+        const unsigned char c = *s;
+        const char *k, *v;
+        uint32_t ndx, klen, vlen;
+
+        if (c & 0x80) { /* indexed field */
+            if (0 != hpack_decode_int(&s, end, 7, &ndx)) return -1;
+            if (0 != hpack_table_get(t, ndx, &k, &klen, &v, &vlen)) return -1;
+            cb(ctx, k, klen, v, vlen);
+            ++nfields;
+            continue;
+        }
+
+        if ((c & 0xe0) == 0x20) { /* dynamic table size update */
+            if (nfields) return -1; /*(must be at start of header block)*/
+            if (0 != hpack_decode_int(&s, end, 5, &ndx)) return -1;
+            if (ndx > t->limit) return -1;
+            t->max_size = ndx;
+            hpack_table_evict(t, ndx);
+            continue;
+        }
+
+        /* literal field with incremental indexing (01xxxxxx),
+         * without indexing (0000xxxx), or never indexed (0001xxxx) */
+        const int index = ((c & 0xc0) == 0x40);
+        if (0 != hpack_decode_int(&s, end, index ? 6 : 4, &ndx)) return -1;
+        buffer_clear(tb);
+        if (ndx) {
+            if (0 != hpack_table_get(t, ndx, &k, &klen, &v, &vlen)) return -1;
+        }
+        else if (0 != hpack_decode_str(&s, end, tb, &k, &klen))
+            return -1;
+        const uint32_t voff = buffer_string_length(tb);
+        if (0 != hpack_decode_str(&s, end, tb, &v, &vlen)) return -1;
+        /* (resolve strings decoded to tb after tb might be reallocated) */
+        if (NULL == k) k = tb->ptr;
+        if (NULL == v) v = tb->ptr + voff;
+
+        cb(ctx, k, klen, v, vlen);
+        ++nfields;
+        if (index) hpack_table_insert(t, k, klen, v, vlen);
+    }
+    return 0;
+}
@@ -0,0 +1,61 @@
+#ifndef INCLUDED_HPACK_H
+#define INCLUDED_HPACK_H
+#include "first.h"
+
+#include "buffer.h"
+
+/* HPACK header compression for HTTP/2 (RFC 7541)
+ *
+ * An encoder and a decoder each keep a dynamic table, which must mirror the
+ * table of the peer, so header blocks must be encoded in the order in which
+ * they are sent, and every header block received must be decoded (even for
+ * streams which have been reset), in the order in which it is received.
+ *
+ * The encoder sends string literals without Huffman coding; the decoder
+ * accepts Huffman coded string literals. */
+
+#define HPACK_TABLE_SIZE_DEFAULT 4096 /* SETTINGS_HEADER_TABLE_SIZE default */
+
+typedef struct hpack_entry {
+    uint32_t klen;
+    uint32_t vlen;
+    char data[];        /* name followed by value (not '\0'-terminated) */
+} hpack_entry;
+
+typedef struct hpack_table {
+    hpack_entry **ents; /* ring of entries; ents[head] is newest */
+    uint32_t mask;      /* ring capacity - 1 */
+    uint32_t head;
+    uint32_t used;      /* number of entries */
+    uint32_t size;      /* sum of entry sizes (name + value + 32 each) */
+    uint32_t max_size;  /* current max size of table */
+    uint32_t limit;     /* max of max_size (SETTINGS_HEADER_TABLE_SIZE) */
+    int update;         /* (encoder) size update to send in next block */
+} hpack_table;
+
+__attribute_cold__
+void hpack_table_init (hpack_table *t, uint32_t limit);
+
+__attribute_cold__
+void hpack_table_free (hpack_table *t);
+
+/* (encoder) peer sent SETTINGS_HEADER_TABLE_SIZE (clamped to limit) */
+void hpack_table_resize (hpack_table *t, uint32_t size);
+
+/* encoding of each field */
+#define HPACK_FIELD_INDEX      0  /* add field to dynamic table */
+#define HPACK_FIELD_NOINDEX    1  /* do not add field to dynamic table */
+#define HPACK_FIELD_NEVERINDEX 2  /* sensitive; must not be indexed by any
+                                   * intermediary (e.g. Authorization) */
+
+/* append field to header block in b; name k is lowercased */
+void hpack_encode_field (hpack_table *t, buffer *b, const char *k, uint32_t klen, const char *v, uint32_t vlen, int how);
+
+/* called for each field decoded (k and v are valid only during callback) */
+typedef void (*hpack_field_cb)(void *ctx, const char *k, uint32_t klen, const char *v, uint32_t vlen);
+
+/* decode complete header block s; tb is used to decode Huffman literals
+ * (return 0 on success, -1 on decoding error (HTTP/2 COMPRESSION_ERROR)) */
+int hpack_decode (hpack_table *t, const unsigned char *s, size_t len, buffer *tb, hpack_field_cb cb, void *ctx);
+
+#endif
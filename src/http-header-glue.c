@@ -4,6 +4,7 @@
 #include "array.h"
 #include "buffer.h"
 #include "fdevent.h"
+#include "file_cache.h"
 #include "log.h"
 #include "etag.h"
 #include "http_chunk.h"
@@ -255,7 +256,7 @@ void http_response_body_clear (request_st * const r, int preserve_length) {
 }
 
 
-static int http_response_parse_range(request_st * const r, buffer * const path, stat_cache_entry * const sce, const char * const range) {
+static int http_response_parse_range(request_st * const r, buffer * const path, stat_cache_entry * const sce, file_cache_entry * const fce, const char * const range) {
 	int multipart = 0;
 	int error;
 	off_t start, end;
@@ -404,7 +405,10 @@ static int http_response_parse_range(request_st * const r, buffer * const path,
 				chunkqueue_append_mem(r->write_queue, CONST_BUF_LEN(b));
 			}
 
-			chunkqueue_append_file(r->write_queue, path, start, end - start + 1);
+			if (fce)
+				chunkqueue_append_file_ref(r->write_queue, path, fce, start, end - start + 1);
+			else
+				chunkqueue_append_file(r->write_queue, path, start, end - start + 1);
 			r->content_length += end - start + 1;
 		}
 	}
@@ -449,6 +453,10 @@ static int http_response_parse_range(request_st * const r, buffer * const path,
 
 
 void http_response_send_file (request_st * const r, buffer * const path) {
+	http_response_send_file_encoded(r, path, NULL, 0);
+}
+
+void http_response_send_file_encoded (request_st * const r, buffer * const path, const char * const encoding, const size_t elen) {
 	stat_cache_entry * const sce = stat_cache_get_entry(path);
 	const buffer *mtime = NULL;
 	const buffer *vb;
@@ -484,12 +492,18 @@ void http_response_send_file (request_st * const r, buffer * const path) {
 		return;
 	}
 
+	/* use cached file content, if available; larger files are cached only
+	 * for TLS, since sendfile() is preferred to send larger files otherwise */
+	file_cache_entry * const fce = (0 != sce->st.st_size)
+	  ? file_cache_get(path, &sce->st, r->con->srv_socket->is_ssl)
+	  : NULL;
+
 	/*(Note: O_NOFOLLOW affects only the final path segment,
 	 * the target file, not any intermediate symlinks along path)*/
-	const int fd = (0 != sce->st.st_size)
+	const int fd = (0 != sce->st.st_size && NULL == fce)
 	  ? fdevent_open_cloexec(path->ptr, r->conf.follow_symlink, O_RDONLY, 0)
 	  : -1;
-	if (fd < 0 && 0 != sce->st.st_size) {
+	if (fd < 0 && NULL == fce && 0 != sce->st.st_size) {
 		r->http_status = (errno == ENOENT) ? 404 : 403;
 		if (r->conf.log_request_handling) {
 			log_perror(r->conf.errh, __FILE__, __LINE__,
@@ -529,6 +543,14 @@ void http_response_send_file (request_st * const r, buffer * const path) {
 			if (NULL == http_header_response_get(r, HTTP_HEADER_ETAG, CONST_STR_LEN("ETag"))) {
 				/* generate e-tag */
 				etag_mutate(&r->physical.etag, etag);
+				if (elen) {
+					/* variant ETag of pre-compressed file, e.g. "123-gzip"
+					 * (same form as ETag of response encoded by mod_deflate) */
+					buffer * const eb = &r->physical.etag;
+					eb->ptr[buffer_string_length(eb)-1] = '-'; /*(overwrite end '"')*/
+					buffer_append_string_len(eb, encoding, elen);
+					buffer_append_string_len(eb, CONST_STR_LEN("\""));
+				}
 
 				http_header_response_set(r, HTTP_HEADER_ETAG, CONST_STR_LEN("ETag"), CONST_BUF_LEN(&r->physical.etag));
 			}
@@ -542,11 +564,12 @@ void http_response_send_file (request_st * const r, buffer * const path) {
 
 		if (HANDLER_FINISHED == http_response_handle_cachable(r, mtime)) {
 			if (fd >= 0) close(fd);
+			if (fce) file_cache_release(fce);
 			return;
 		}
 	}
 
-	if (fd < 0) { /* 0-length file */
+	if (0 == sce->st.st_size) { /* 0-length file */
 		r->http_status = 200;
 		r->resp_body_finished = 1;
 		return;
@@ -555,7 +578,8 @@ void http_response_send_file (request_st * const r, buffer * const path) {
 	if (r->conf.range_requests
 	    && (200 == r->http_status || 0 == r->http_status)
 	    && NULL != (vb = http_header_request_get(r, HTTP_HEADER_RANGE, CONST_STR_LEN("Range")))
-	    && NULL == http_header_response_get(r, HTTP_HEADER_CONTENT_ENCODING, CONST_STR_LEN("Content-Encoding"))) {
+	    && (elen /*(ranges of pre-compressed file are ranges of encoded content)*/
+	        || NULL == http_header_response_get(r, HTTP_HEADER_CONTENT_ENCODING, CONST_STR_LEN("Content-Encoding")))) {
 		const buffer *range = vb;
 		int do_range_request = 1;
 		/* check if we have a conditional GET */
@@ -590,10 +614,11 @@ void http_response_send_file (request_st * const r, buffer * const path) {
 			/* content prepared, I'm done */
 			r->resp_body_finished = 1;
 
-			if (0 == http_response_parse_range(r, path, sce, range->ptr+6)) {
+			if (0 == http_response_parse_range(r, path, sce, fce, range->ptr+6)) {
 				r->http_status = 206;
 			}
-			close(fd);
+			if (fd >= 0) close(fd);
+			if (fce) file_cache_release(fce);
 			return;
 		}
 	}
@@ -604,7 +629,13 @@ void http_response_send_file (request_st * const r, buffer * const path) {
 	 * the HEAD request will drop it afterwards again
 	 */
 
-	if (0 == http_chunk_append_file_fd(r, path, fd, sce->st.st_size)) {
+	if (fce) {
+		http_chunk_append_file_ref(r, path, fce, 0, sce->st.st_size);
+		file_cache_release(fce);
+		r->http_status = 200;
+		r->resp_body_finished = 1;
+	}
+	else if (0 == http_chunk_append_file_fd(r, path, fd, sce->st.st_size)) {
 		r->http_status = 200;
 		r->resp_body_finished = 1;
 	}
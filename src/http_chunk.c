@@ -145,6 +145,18 @@ int http_chunk_append_file_fd(request_st * const r, const buffer * const fn, con
     return rc;
 }
 
+void http_chunk_append_file_ref(request_st * const r, const buffer * const fn, struct file_cache_entry * const ref, const off_t offset, const off_t len) {
+    chunkqueue * const cq = r->write_queue;
+
+    if (r->resp_send_chunked)
+        http_chunk_len_append(cq, (uintmax_t)len);
+
+    chunkqueue_append_file_ref(cq, fn, ref, offset, len);
+
+    if (r->resp_send_chunked)
+        chunkqueue_append_mem(cq, CONST_STR_LEN("\r\n"));
+}
+
 static int http_chunk_append_to_tempfile(request_st * const r, const char * const mem, const size_t len) {
     chunkqueue * const cq = r->write_queue;
     log_error_st * const errh = r->conf.errh;
@@ -195,11 +207,16 @@ static int http_chunk_uses_tempfile(const request_st * const r, const chunkqueue
      * to reduce creation of temp files when backend producer will be
      * blocked until more data is sent to network to client)*/
 
+    /*(spill to temp files sooner while server-wide chunk memory is above
+     * server.chunk-memory-soft-limit)*/
+
     const chunk * const c = cq->last;
     return
       ((c && c->type == FILE_CHUNK && c->file.is_temp)
        || cq->bytes_in - cq->bytes_out + len
-          > ((r->conf.stream_response_body & FDEVENT_STREAM_RESPONSE_BUFMIN)
+          > (chunkqueue_mem_pressure()
+             ?  16*1024
+             : (r->conf.stream_response_body & FDEVENT_STREAM_RESPONSE_BUFMIN)
              ? 128*1024
              :  64*1024));
 }
@@ -256,7 +273,8 @@ int http_chunk_transfer_cqlen(request_st * const r, chunkqueue * const src, cons
     if (r->resp_send_chunked)
         http_chunk_len_append(cq, len);
 
-    chunkqueue_steal(cq, src, len);
+    if (0 != chunkqueue_steal(cq, src, len))
+        return -1;
 
     if (r->resp_send_chunked)
         chunkqueue_append_mem(cq, CONST_STR_LEN("\r\n"));
@@ -13,6 +13,7 @@ int http_chunk_decode_append_buffer(request_st * const r, buffer * const mem); /
 int http_chunk_transfer_cqlen(request_st *r, chunkqueue *src, size_t len);
 int http_chunk_append_file(request_st *r, const buffer *fn); /* copies "fn" */
 int http_chunk_append_file_fd(request_st *r, const buffer *fn, int fd, off_t sz);
+void http_chunk_append_file_ref(request_st *r, const buffer *fn, struct file_cache_entry *ref, off_t offset, off_t len); /* copies "fn"; acquires reference to "ref" */
 int http_chunk_append_file_range(request_st *r, const buffer *fn, off_t offset, off_t len); /* copies "fn" */
 void http_chunk_close(request_st *r);
 
@@ -136,24 +136,36 @@ static inline void http_header_token_append(buffer * const vb, const char * cons
     buffer_append_string_len(vb, v, vlen);
 }
 
+/* r->rqst_headers and r->resp_headers are arrays of data_string tagged with
+ * enum http_header_e id (ds->ext); known headers are found by id, others by
+ * key.  Elements and their buffers are kept when the request is reset, so
+ * later requests on a connection (request_st) typically allocate no header
+ * memory.
+ * (A flat table of offsets into a single arena is not used, since getters
+ *  return (buffer *) values which callers modify and append to in place) */
+
 __attribute_pure__
-static inline buffer * http_header_generic_get_ifnotempty(const array * const a, const char * const k, const uint32_t klen) {
+static inline buffer * http_header_generic_get_ifnotempty(const array * const a, const enum http_header_e id, const char * const k, const uint32_t klen) {
     data_string * const ds =
-      (data_string *)array_get_element_klen(a, k, klen);
+      (data_string *)array_get_element_klen_ext(a, id, k, klen);
     return ds && !buffer_string_is_empty(&ds->value) ? &ds->value : NULL;
 }
 
+static inline void http_header_set_key_value(array * const a, const enum http_header_e id, const char * const k, const uint32_t klen, const char * const v, const uint32_t vlen) {
+    buffer_copy_string_len(array_get_buf_ptr_ext(a, id, k, klen), v, vlen);
+}
+
 
 buffer * http_header_response_get(const request_st * const r, enum http_header_e id, const char *k, uint32_t klen) {
     return (id <= HTTP_HEADER_OTHER || (r->resp_htags & id))
-      ? http_header_generic_get_ifnotempty(&r->resp_headers, k, klen)
+      ? http_header_generic_get_ifnotempty(&r->resp_headers, id, k, klen)
       : NULL;
 }
 
 void http_header_response_unset(request_st * const r, enum http_header_e id, const char *k, uint32_t klen) {
     if (id <= HTTP_HEADER_OTHER || (r->resp_htags & id)) {
         if (id > HTTP_HEADER_OTHER) r->resp_htags &= ~id;
-        array_set_key_value(&r->resp_headers, k, klen, CONST_STR_LEN(""));
+        http_header_set_key_value(&r->resp_headers, id, k, klen, CONST_STR_LEN(""));
     }
 }
 
@@ -164,20 +176,20 @@ void http_header_response_set(request_st * const r, enum http_header_e id, const
      */
     if (id > HTTP_HEADER_OTHER)
         (vlen) ? (r->resp_htags |= id) : (r->resp_htags &= ~id);
-    array_set_key_value(&r->resp_headers, k, klen, v, vlen);
+    http_header_set_key_value(&r->resp_headers, id, k, klen, v, vlen);
 }
 
 void http_header_response_append(request_st * const r, enum http_header_e id, const char *k, uint32_t klen, const char *v, uint32_t vlen) {
     if (0 == vlen) return;
     if (id > HTTP_HEADER_OTHER) r->resp_htags |= id;
-    buffer * const vb = array_get_buf_ptr(&r->resp_headers, k, klen);
+    buffer * const vb = array_get_buf_ptr_ext(&r->resp_headers, id, k, klen);
     http_header_token_append(vb, v, vlen);
 }
 
 void http_header_response_insert(request_st * const r, enum http_header_e id, const char *k, uint32_t klen, const char *v, uint32_t vlen) {
     if (0 == vlen) return;
     if (id > HTTP_HEADER_OTHER) r->resp_htags |= id;
-    buffer * const vb = array_get_buf_ptr(&r->resp_headers, k, klen);
+    buffer * const vb = array_get_buf_ptr_ext(&r->resp_headers, id, k, klen);
     if (!buffer_string_is_empty(vb)) { /* append value */
         buffer_append_string_len(vb, CONST_STR_LEN("\r\n"));
         buffer_append_string_len(vb, k, klen);
@@ -189,14 +201,14 @@ void http_header_response_insert(request_st * const r, enum http_header_e id, co
 
 buffer * http_header_request_get(const request_st * const r, enum http_header_e id, const char *k, uint32_t klen) {
     return (id <= HTTP_HEADER_OTHER || (r->rqst_htags & id))
-      ? http_header_generic_get_ifnotempty(&r->rqst_headers, k, klen)
+      ? http_header_generic_get_ifnotempty(&r->rqst_headers, id, k, klen)
       : NULL;
 }
 
 void http_header_request_unset(request_st * const r, enum http_header_e id, const char *k, uint32_t klen) {
     if (id <= HTTP_HEADER_OTHER || (r->rqst_htags & id)) {
         if (id > HTTP_HEADER_OTHER) r->rqst_htags &= ~id;
-        array_set_key_value(&r->rqst_headers, k, klen, CONST_STR_LEN(""));
+        http_header_set_key_value(&r->rqst_headers, id, k, klen, CONST_STR_LEN(""));
     }
 }
 
@@ -207,19 +219,19 @@ void http_header_request_set(request_st * const r, enum http_header_e id, const
      */
     if (id > HTTP_HEADER_OTHER)
         (vlen) ? (r->rqst_htags |= id) : (r->rqst_htags &= ~id);
-    array_set_key_value(&r->rqst_headers, k, klen, v, vlen);
+    http_header_set_key_value(&r->rqst_headers, id, k, klen, v, vlen);
 }
 
 void http_header_request_append(request_st * const r, enum http_header_e id, const char *k, uint32_t klen, const char *v, uint32_t vlen) {
     if (0 == vlen) return;
     if (id > HTTP_HEADER_OTHER) r->rqst_htags |= id;
-    buffer * const vb = array_get_buf_ptr(&r->rqst_headers, k, klen);
+    buffer * const vb = array_get_buf_ptr_ext(&r->rqst_headers, id, k, klen);
     http_header_token_append(vb, v, vlen);
 }
 
 
 buffer * http_header_env_get(const request_st * const r, const char *k, uint32_t klen) {
-    return http_header_generic_get_ifnotempty(&r->env, k, klen);
+    return http_header_generic_get_ifnotempty(&r->env, HTTP_HEADER_OTHER, k, klen);
 }
 
 void http_header_env_set(request_st * const r, const char *k, uint32_t klen, const char *v, uint32_t vlen) {
@@ -110,6 +110,7 @@ static const keyvalue http_status[] = {
 	{ 423, CONST_LEN_STR("423 Locked") }, /* WebDAV */
 	{ 424, CONST_LEN_STR("424 Failed Dependency") }, /* WebDAV */
 	{ 426, CONST_LEN_STR("426 Upgrade Required") }, /* TLS */
+	{ 429, CONST_LEN_STR("429 Too Many Requests") },
 	{ 500, CONST_LEN_STR("500 Internal Server Error") },
 	{ 501, CONST_LEN_STR("501 Not Implemented") },
 	{ 502, CONST_LEN_STR("502 Bad Gateway") },
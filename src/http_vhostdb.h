@@ -11,6 +11,9 @@ struct http_vhostdb_backend_t;
 
 typedef struct http_vhostdb_backend_t {
     const char *name;
+    /* query() returns 0 on success (result empty if no such vhost), -1 on
+     * error, or 1 if query is in progress (query() is called again for the
+     * request after the backend schedules the request to run again) */
     int(*query)(request_st *r, void *p_d, buffer *result);
     void *p_d;
 } http_vhostdb_backend_t;
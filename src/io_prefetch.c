@@ -0,0 +1,271 @@
+#include "first.h"
+
+#include "io_prefetch.h"
+#include "async_pool.h"
+#include "base.h"
+#include "chunk.h"
+#include "connections.h"
+#include "fdevent.h"
+#include "log.h"
+#include "status_counter.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/uio.h>    /* preadv2() RWF_NOWAIT */
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined(HAVE_PREADV2) && defined(RWF_NOWAIT)
+#define IO_PREFETCH
+#endif
+
+/* size of file window probed (and prefetched, if not cached) at a time */
+#define IO_PREFETCH_WINDOW (512*1024)
+
+/* size of buffer into which each worker thread reads file data */
+#define IO_PREFETCH_BUFSZ  (64*1024)
+
+typedef struct {
+    async_job job;      /* (must be first member) */
+    int fd;             /* dup() of chunk fd, or fd opened in worker thread */
+    int opened;         /* fd opened in worker thread */
+    int err;
+    off_t offset;
+    off_t len;
+    char fn[];          /* (file name, if opened in worker thread) */
+} io_prefetch_job;
+
+static async_pool *io_pool;
+
+#ifdef IO_PREFETCH
+
+static void * io_prefetch_tctx_init (void * const ctx)
+{
+    UNUSED(ctx);
+    void * const buf = malloc(IO_PREFETCH_BUFSZ);
+    force_assert(buf);
+    return buf;
+}
+
+static void io_prefetch_tctx_free (void * const tctx)
+{
+    free(tctx);
+}
+
+static void io_prefetch_job_run (async_job * const job, void * const tctx, log_error_st * const errh)
+{
+    /* (called in worker thread) */
+    io_prefetch_job * const j = (io_prefetch_job *)job;
+    char * const buf = tctx;
+    UNUSED(errh); /*(errors are reported when writing file chunk)*/
+
+    if (-1 == j->fd) {
+        struct stat st;
+        j->fd = fdevent_open_cloexec(j->fn, 1, O_RDONLY, 0);
+        if (-1 == j->fd || 0 != fstat(j->fd, &st)) {
+            j->err = errno;
+            return;
+        }
+        j->opened = 1;
+    }
+
+    /* read window into page cache (data read is discarded) */
+    for (off_t offset = j->offset, len = j->len; len > 0; ) {
+        const ssize_t rd = pread(j->fd, buf,
+                                 len < IO_PREFETCH_BUFSZ
+                                   ? (size_t)len
+                                   : IO_PREFETCH_BUFSZ,
+                                 offset);
+        if (rd > 0) {
+            offset += rd;
+            len -= rd;
+        }
+        else if (0 == rd) /*(file shrunk; detected when writing file chunk)*/
+            break;
+        else if (errno != EINTR) {
+            j->err = errno;
+            break;
+        }
+    }
+}
+
+static void io_prefetch_job_free (async_job * const job)
+{
+    io_prefetch_job * const j = (io_prefetch_job *)job;
+    if (-1 != j->fd) close(j->fd);
+    free(j);
+}
+
+static void io_prefetch_job_complete (async_job * const job)
+{
+    /* (called in main thread) */
+    io_prefetch_job * const j = (io_prefetch_job *)job;
+    connection * const con = job->r->con;
+    con->io_prefetch = NULL;
+
+    if (j->err)
+        status_counter_inc(CONST_STR_LEN("server.io-prefetch.errors"));
+
+    /* (con->write_queue is not written while prefetch is pending,
+     *  so con->write_queue->first is the chunk for which job was created) */
+    chunk * const c = con->write_queue->first;
+    if (NULL != c && c->type == FILE_CHUNK) {
+        if (j->opened && -1 == c->file.fd) {
+            c->file.fd = j->fd;
+            j->fd = -1;
+        }
+        con->io_prefetch_fd = c->file.fd;
+        con->io_prefetch_end = j->offset + j->len;
+    }
+
+    io_prefetch_job_free(job);
+
+    /* resume writing */
+    con->is_writable = 1;
+    joblist_append(con);
+}
+
+static io_prefetch_job * io_prefetch_job_init (const chunk * const c, const off_t offset, const off_t len)
+{
+    const size_t fnlen = (-1 == c->file.fd) ? buffer_string_length(c->mem)+1 : 0;
+    io_prefetch_job * const j = calloc(1, sizeof(io_prefetch_job) + fnlen);
+    force_assert(j);
+    j->job.run      = io_prefetch_job_run;
+    j->job.free     = io_prefetch_job_free;
+    j->job.complete = io_prefetch_job_complete;
+    j->offset = offset;
+    j->len    = len;
+    if (fnlen) {
+        j->fd = -1; /*(file opened in worker thread)*/
+        memcpy(j->fn, c->mem->ptr, fnlen);
+    }
+    else {
+        /* dup() fd so that worker thread does not read from fd which might
+         * be closed (and fd number reused) if request is reset */
+      #ifdef F_DUPFD_CLOEXEC
+        j->fd = fcntl(c->file.fd, F_DUPFD_CLOEXEC, 0);
+      #else
+        j->fd = dup(c->file.fd);
+        if (-1 != j->fd) fdevent_setfd_cloexec(j->fd);
+      #endif
+        if (-1 == j->fd) {
+            free(j);
+            return NULL;
+        }
+    }
+    return j;
+}
+
+static int io_prefetch_is_cached (const int fd, const off_t offset, const off_t len)
+{
+    /* probe first and last byte of window without blocking on disk I/O
+     * (not exhaustive, but kernel readahead generally populates the page
+     *  cache for sequential ranges of a file) */
+    static int nowait_supported = 1;
+    if (!nowait_supported) return 1;
+    char b;
+    struct iovec iov = { &b, 1 };
+    const off_t probe[2] = { offset, offset + len - 1 };
+    for (int i = 0; i < (len > 1 ? 2 : 1); ++i) {
+        if (preadv2(fd, &iov, 1, probe[i], RWF_NOWAIT) >= 0) continue;
+        if (errno == EAGAIN) return 0;
+        if (errno == ENOSYS || errno == EOPNOTSUPP || errno == EINVAL)
+            nowait_supported = 0; /* (e.g. kernel or filesystem support) */
+        break; /*(other errors are reported when writing file chunk)*/
+    }
+    return 1;
+}
+
+int io_prefetch_defer (connection * const con)
+{
+    if (NULL == io_pool) return 0;
+
+    if (NULL != con->io_prefetch) { /* prefetch pending */
+        con->is_writable = 0;
+        return 1;
+    }
+
+    const chunk * const c = con->write_queue->first;
+    if (NULL == c || c->type != FILE_CHUNK || c->file.is_temp) return 0;
+    if (NULL != c->file.ref) return 0; /* cached file content */
+
+    const off_t offset = c->file.start + c->offset;
+    off_t len = c->file.length - c->offset;
+    if (len <= 0) return 0;
+    if (len > IO_PREFETCH_WINDOW) len = IO_PREFETCH_WINDOW;
+
+    if (-1 != c->file.fd) {
+        /* skip check if still within window previously checked/prefetched */
+        if (c->file.fd == con->io_prefetch_fd
+            && offset < con->io_prefetch_end
+            && offset >= con->io_prefetch_end - IO_PREFETCH_WINDOW)
+            return 0;
+        con->io_prefetch_fd = c->file.fd;
+        con->io_prefetch_end = offset + len;
+        if (io_prefetch_is_cached(c->file.fd, offset, len)) {
+            status_counter_inc(CONST_STR_LEN("server.io-prefetch.cached"));
+            return 0;
+        }
+    }
+    /*(else file not yet open; open() and fstat() might block, too)*/
+
+    io_prefetch_job * const j = io_prefetch_job_init(c, offset, len);
+    if (NULL == j) return 0;
+    status_counter_inc(CONST_STR_LEN("server.io-prefetch.deferred"));
+    con->io_prefetch = j;
+    if (!async_pool_submit(io_pool, &con->request, &j->job))
+        return 0; /* completed (run synchronously) */
+    con->is_writable = 0;
+    return 1;
+}
+
+void io_prefetch_detach (connection * const con)
+{
+    io_prefetch_job * const j = con->io_prefetch;
+    con->io_prefetch_fd = -1;
+    con->io_prefetch_end = 0;
+    if (NULL == j) return;
+    con->io_prefetch = NULL;
+    async_job_detach(&j->job);
+}
+
+void io_prefetch_init (server * const srv)
+{
+    const unsigned short nthreads = srv->srvconf.io_threads;
+    if (0 == nthreads) return;
+    io_pool = async_pool_init("io-prefetch", nthreads,
+                              io_prefetch_tctx_init, io_prefetch_tctx_free,
+                              NULL);
+}
+
+#else /* !IO_PREFETCH */
+
+int io_prefetch_defer (connection * const con)
+{
+    UNUSED(con);
+    return 0;
+}
+
+void io_prefetch_detach (connection * const con)
+{
+    UNUSED(con);
+}
+
+void io_prefetch_init (server * const srv)
+{
+    if (srv->srvconf.io_threads)
+        log_error(srv->errh, __FILE__, __LINE__,
+          "server.io-threads ignored; "
+          "preadv2(RWF_NOWAIT) not available on this platform");
+}
+
+#endif /* !IO_PREFETCH */
+
+void io_prefetch_free (void)
+{
+    async_pool_free(io_pool);
+    io_pool = NULL;
+}
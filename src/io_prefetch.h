@@ -0,0 +1,31 @@
+#ifndef INCLUDED_IO_PREFETCH_H
+#define INCLUDED_IO_PREFETCH_H
+#include "first.h"
+
+#include "base_decls.h"
+
+/* prefetch of cold file data into the page cache by worker threads
+ * (server.io-threads), so that sending file chunks from disk does not block
+ * the event loop
+ *
+ * Before a FILE_CHUNK at the head of the connection write queue is written,
+ * the next window of the file is probed with preadv2(RWF_NOWAIT).  If the
+ * data is already in the page cache, the write proceeds.  Otherwise, the
+ * write is deferred while a worker thread reads the window into the page
+ * cache (and opens and fstat()s the file, if not already open).
+ *
+ * Deferred and cached windows are counted in status counters reported by
+ * mod_status (server-statistics) */
+
+__attribute_cold__
+void io_prefetch_init (server *srv);
+
+__attribute_cold__
+void io_prefetch_free (void);
+
+/* returns 1 if write of con->write_queue is deferred (data not cached) */
+int io_prefetch_defer (connection *con);
+
+void io_prefetch_detach (connection *con);
+
+#endif
@@ -0,0 +1,323 @@
+#include "first.h"
+
+#include "ipset.h"
+#include "buffer.h"
+#include "log.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* interval (in seconds) between checks if set file has changed */
+#define IPSET_FILE_CHECK_INTERVAL 5
+
+static void ipset_clear (ipset * const s)
+{
+    /* root node ::/0 (not a member unless inserted) */
+    s->used = 1;
+    s->count = 0;
+    memset(s->nodes, 0, sizeof(ipset_node));
+}
+
+ipset * ipset_init (void)
+{
+    ipset * const s = calloc(1, sizeof(*s));
+    force_assert(s);
+    s->size = 16;
+    s->nodes = malloc(s->size * sizeof(ipset_node));
+    force_assert(s->nodes);
+    ipset_clear(s);
+    return s;
+}
+
+void ipset_free (ipset * const s)
+{
+    if (NULL == s) return;
+    free(s->nodes);
+    free(s->fn);
+    free(s);
+}
+
+static uint32_t ipset_node_new (ipset * const s, const uint8_t * const addr, const uint32_t plen, const uint8_t member)
+{
+    if (s->used == s->size) {
+        s->size <<= 1;
+        s->nodes = realloc(s->nodes, s->size * sizeof(ipset_node));
+        force_assert(s->nodes);
+    }
+    ipset_node * const n = s->nodes + s->used;
+    /* copy prefix, zeroing bits past plen */
+    memset(n->addr, 0, sizeof(n->addr));
+    memcpy(n->addr, addr, (plen + 7) >> 3);
+    if (plen & 7) n->addr[plen >> 3] &= (uint8_t)(0xFF << (8 - (plen & 7)));
+    n->plen = (uint8_t)plen;
+    n->member = member;
+    n->child[0] = 0;
+    n->child[1] = 0;
+    return s->used++;
+}
+
+__attribute_pure__
+static int ipset_bit (const uint8_t * const addr, const uint32_t i)
+{
+    return (addr[i >> 3] >> (7 - (i & 7))) & 1;
+}
+
+__attribute_pure__
+static uint32_t ipset_common_bits (const uint8_t * const a, const uint8_t * const b, const uint32_t max)
+{
+    uint32_t i = 0;
+    while (i < max && a[i >> 3] == b[i >> 3]) i += 8;
+    if (i >= max) return max;
+    const unsigned int x = a[i >> 3] ^ b[i >> 3];
+    while (!(x & (0x80 >> (i & 7)))) ++i;
+    return i < max ? i : max;
+}
+
+static int ipset_insert_prefix (ipset * const s, const uint8_t * const addr, const uint32_t plen)
+{
+    uint32_t n = 0; /* invariant: nodes[n] prefix is a prefix of addr/plen */
+    for (;;) {
+        if (s->nodes[n].plen == plen) {
+            s->nodes[n].member = 1;
+            return 1;
+        }
+        const int b = ipset_bit(addr, s->nodes[n].plen);
+        const uint32_t c = s->nodes[n].child[b];
+        if (0 == c) {
+            const uint32_t x = ipset_node_new(s, addr, plen, 1);
+            s->nodes[n].child[b] = x;
+            return 1;
+        }
+        const uint32_t cplen = s->nodes[c].plen;
+        const uint32_t d = ipset_common_bits(addr, s->nodes[c].addr,
+                                             plen < cplen ? plen : cplen);
+        if (d == cplen) { /* child prefix is a prefix of addr/plen */
+            n = c;
+            continue;
+        }
+        /* split edge to child: insert node for common prefix of length d
+         * (s->nodes may be realloc'd by ipset_node_new(); use indexes) */
+        const uint32_t m = ipset_node_new(s, addr, d, d == plen);
+        s->nodes[m].child[ipset_bit(s->nodes[c].addr, d)] = c;
+        if (d != plen) {
+            const uint32_t x = ipset_node_new(s, addr, plen, 1);
+            s->nodes[m].child[ipset_bit(addr, d)] = x;
+        }
+        s->nodes[n].child[b] = m;
+        return 1;
+    }
+}
+
+static const uint8_t * ipset_addr (const sock_addr * const addr, uint8_t * const v4mapped)
+{
+    switch (sock_addr_get_family(addr)) {
+      case AF_INET:
+        memset(v4mapped, 0, 10);
+        v4mapped[10] = 0xFF;
+        v4mapped[11] = 0xFF;
+        memcpy(v4mapped+12, &addr->ipv4.sin_addr.s_addr, 4);
+        return v4mapped;
+     #ifdef HAVE_IPV6
+      case AF_INET6:
+        return (const uint8_t *)addr->ipv6.sin6_addr.s6_addr;
+     #endif
+      default:
+        return NULL;
+    }
+}
+
+int ipset_insert (ipset * const s, const sock_addr * const addr, int bits)
+{
+    uint8_t v4mapped[16];
+    const uint8_t * const a = ipset_addr(addr, v4mapped);
+    if (NULL == a) return 0;
+    if (a == v4mapped) {
+        if (bits > 32) return 0;
+        bits += 96;
+    }
+    else if (bits > 128) return 0;
+    if (bits < 0) return 0;
+    ++s->count;
+    return ipset_insert_prefix(s, a, (uint32_t)bits);
+}
+
+int ipset_insert_str (ipset * const s, const char * const str, const size_t len, log_error_st * const errh)
+{
+    /* "addr" or "addr/bits" */
+    char addrstr[64]; /*(larger than INET_ADDRSTRLEN and INET6_ADDRSTRLEN)*/
+    const char * const slash = memchr(str, '/', len);
+    const size_t alen = slash ? (size_t)(slash - str) : len;
+    int bits = -1;
+    sock_addr addr;
+    if (alen >= sizeof(addrstr)) {
+        log_error(errh, __FILE__, __LINE__,
+          "address string too long: %.*s", (int)len, str);
+        return 0;
+    }
+    if (slash) {
+        bits = 0;
+        const char *p = slash + 1;
+        const char * const end = str + len;
+        if (p == end || end - p > 3) bits = -1;
+        for (; p < end && bits >= 0; ++p)
+            bits = light_isdigit(*p) ? bits * 10 + (*p - '0') : -1;
+        if (bits < 0) {
+            log_error(errh, __FILE__, __LINE__,
+              "invalid or missing netmask: %.*s", (int)len, str);
+            return 0;
+        }
+    }
+    memcpy(addrstr, str, alen);
+    addrstr[alen] = '\0';
+    if (1 == sock_addr_inet_pton(&addr, addrstr, AF_INET, 0)) {
+        if (bits < 0) bits = 32;
+    }
+  #ifdef HAVE_IPV6
+    else if (1 == sock_addr_inet_pton(&addr, addrstr, AF_INET6, 0)) {
+        if (bits < 0) bits = 128;
+    }
+  #endif
+    else {
+        log_error(errh, __FILE__, __LINE__,
+          "invalid IP addr: %.*s", (int)len, str);
+        return 0;
+    }
+    if (!ipset_insert(s, &addr, bits)) {
+        log_error(errh, __FILE__, __LINE__,
+          "netmask too large: %.*s", (int)len, str);
+        return 0;
+    }
+    return 1;
+}
+
+int ipset_insert_list (ipset * const s, const char *str, log_error_st * const errh)
+{
+    /* list of addr or addr/bits separated by commas and/or whitespace */
+    for (;;) {
+        while (*str == ',' || *str == ' ' || *str == '\t'
+               || *str == '\r' || *str == '\n') ++str;
+        if (*str == '\0') return 1;
+        const size_t len = strcspn(str, ", \t\r\n");
+        if (!ipset_insert_str(s, str, len, errh)) return 0;
+        str += len;
+    }
+}
+
+static int ipset_load_stream (ipset * const s, FILE * const fp, const char * const fn, log_error_st * const errh)
+{
+    char line[256];
+    for (int lineno = 1; fgets(line, sizeof(line), fp); ++lineno) {
+        size_t len = strlen(line);
+        if (len == sizeof(line)-1 && line[len-1] != '\n' && !feof(fp)) {
+            log_error(errh, __FILE__, __LINE__,
+              "%s:%d: line too long", fn, lineno);
+            return 0;
+        }
+        char * const hash = strchr(line, '#');
+        if (hash) *hash = '\0';
+        if (!ipset_insert_list(s, line, errh)) {
+            log_error(errh, __FILE__, __LINE__,
+              "%s:%d: invalid entry", fn, lineno);
+            return 0;
+        }
+    }
+    if (ferror(fp)) {
+        log_perror(errh, __FILE__, __LINE__, "reading %s", fn);
+        return 0;
+    }
+    return 1;
+}
+
+int ipset_load_file (ipset * const s, const char * const fn, log_error_st * const errh)
+{
+    /* (re)load set from file; set is unchanged if error loading file */
+    struct stat st;
+    FILE * const fp = fopen(fn, "r");
+    if (NULL == fp || 0 != fstat(fileno(fp), &st)) {
+        log_perror(errh, __FILE__, __LINE__, "opening %s", fn);
+        if (fp) fclose(fp);
+        return 0;
+    }
+
+    ipset * const t = ipset_init();
+    const int rc = ipset_load_stream(t, fp, fn, errh);
+    fclose(fp);
+    if (!rc) {
+        ipset_free(t);
+        return 0;
+    }
+
+    /* swap in new tree */
+    ipset_node * const nodes = s->nodes;
+    s->nodes = t->nodes;
+    s->used  = t->used;
+    s->size  = t->size;
+    s->count = t->count;
+    t->nodes = nodes;
+    ipset_free(t);
+
+    if (s->fn != fn) {
+        free(s->fn);
+        s->fn = strdup(fn);
+        force_assert(s->fn);
+    }
+    s->fcheck = log_epoch_secs;
+    s->fmtime = st.st_mtime;
+    s->fsize  = st.st_size;
+    s->fino   = st.st_ino;
+    return 1;
+}
+
+void ipset_file_check (ipset * const s, log_error_st * const errh)
+{
+    if (NULL == s->fn) return;
+    if (log_epoch_secs - s->fcheck < IPSET_FILE_CHECK_INTERVAL) return;
+    s->fcheck = log_epoch_secs;
+
+    struct stat st;
+    if (0 != stat(s->fn, &st)) {
+        if (errno != ENOENT)
+            log_perror(errh, __FILE__, __LINE__, "stat %s", s->fn);
+        return; /* keep using current set */
+    }
+    if (st.st_mtime == s->fmtime && st.st_size == s->fsize
+        && st.st_ino == s->fino) return;
+
+    if (ipset_load_file(s, s->fn, errh))
+        log_error(errh, __FILE__, __LINE__,
+          "reloaded %s (%u entries)", s->fn, s->count);
+    else {
+        /* keep using current set; retry when file changes again */
+        s->fmtime = st.st_mtime;
+        s->fsize  = st.st_size;
+        s->fino   = st.st_ino;
+    }
+}
+
+int ipset_contains (const ipset * const s, const sock_addr * const addr)
+{
+    uint8_t v4mapped[16];
+    const uint8_t * const a = ipset_addr(addr, v4mapped);
+    if (NULL == a) return 0;
+
+    const ipset_node * const nodes = s->nodes;
+    uint32_t n = 0;
+    for (;;) {
+        if (nodes[n].member) return 1;
+        const uint32_t plen = nodes[n].plen;
+        if (plen == 128) return 0;
+        n = nodes[n].child[ipset_bit(a, plen)];
+        if (0 == n) return 0;
+        /* check that child prefix matches addr */
+        const ipset_node * const c = nodes + n;
+        const uint32_t nbytes = c->plen >> 3;
+        if (0 != memcmp(c->addr, a, nbytes)) return 0;
+        if ((c->plen & 7)
+            && ((a[nbytes] ^ c->addr[nbytes]) >> (8 - (c->plen & 7))))
+            return 0;
+    }
+}
@@ -0,0 +1,63 @@
+#ifndef INCLUDED_IPSET_H
+#define INCLUDED_IPSET_H
+#include "first.h"
+
+#include "base_decls.h"
+#include "sock_addr.h"
+
+/* set of IPv4 and IPv6 CIDR prefixes stored in a radix (Patricia) tree
+ *
+ * IPv4 addresses are stored as IPv4-mapped IPv6 addresses (::ffff:a.b.c.d),
+ * so an IPv4 prefix also matches a client connecting with an IPv4-mapped
+ * IPv6 address, as with sock_addr_is_addr_eq_bits().  Membership lookups
+ * are bounded by address length (128 bits), not by number of prefixes.
+ *
+ * A set may be loaded from a file (one address or CIDR per line, with
+ * '#' comments) and is reloaded by ipset_file_check() if the file changes
+ * (called periodically, not from request processing, since it stat()s and
+ *  might reload the file) */
+
+typedef struct ipset_node {
+    uint8_t addr[16];   /* prefix (bits past plen are 0) */
+    uint8_t plen;       /* prefix length in bits */
+    uint8_t member;     /* prefix is a member of set */
+    uint32_t child[2];  /* ndx of child on next bit 0 or 1 (0 if none) */
+} ipset_node;
+
+typedef struct ipset {
+    ipset_node *nodes;  /* nodes[0] is root (::/0) */
+    uint32_t used;
+    uint32_t size;
+    uint32_t count;     /* number of prefixes inserted */
+    char *fn;           /* (optional) file from which set is loaded */
+    time_t fcheck;      /* time of last check of file for changes */
+    time_t fmtime;
+    off_t fsize;
+    ino_t fino;
+} ipset;
+
+__attribute_cold__
+__attribute_returns_nonnull__
+ipset * ipset_init (void);
+
+__attribute_cold__
+void ipset_free (ipset *s);
+
+__attribute_cold__
+int ipset_insert (ipset *s, const sock_addr *addr, int bits);
+
+__attribute_cold__
+int ipset_insert_str (ipset *s, const char *str, size_t len, log_error_st *errh);
+
+__attribute_cold__
+int ipset_insert_list (ipset *s, const char *str, log_error_st *errh);
+
+__attribute_cold__
+int ipset_load_file (ipset *s, const char *fn, log_error_st *errh);
+
+void ipset_file_check (ipset *s, log_error_st *errh);
+
+__attribute_pure__
+int ipset_contains (const ipset *s, const sock_addr *addr);
+
+#endif
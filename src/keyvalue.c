@@ -15,31 +15,145 @@
 #include <stdlib.h>
 #include <string.h>
 
-#ifdef HAVE_PCRE_H
+#ifdef HAVE_PCRE2_H
+#define PCRE2_CODE_UNIT_WIDTH 8
+#include <pcre2.h>
+#elif defined(HAVE_PCRE_H)
 #include <pcre.h>
+#ifndef PCRE_STUDY_JIT_COMPILE
+#define PCRE_STUDY_JIT_COMPILE 0
+#define pcre_free_study(x) pcre_free(x)
+#endif
 #endif
 
 typedef struct pcre_keyvalue {
-#ifdef HAVE_PCRE_H
+#ifdef HAVE_PCRE2_H
+	pcre2_code *code;
+	pcre2_match_data *match_data;
+#elif defined(HAVE_PCRE_H)
 	pcre *key;
 	pcre_extra *key_extra;
 #endif
+	int32_t pnext; /* next regex with same literal prefix (-1 if none) */
 	buffer value;
 } pcre_keyvalue;
 
+#ifdef HAVE_PCRE2_H
+typedef PCRE2_SIZE pcre_keyvalue_ovec_t;
+#elif defined(HAVE_PCRE_H)
+typedef int pcre_keyvalue_ovec_t;
+#endif
+
 pcre_keyvalue_buffer *pcre_keyvalue_buffer_init(void) {
 	pcre_keyvalue_buffer *kvb;
 
 	kvb = calloc(1, sizeof(*kvb));
 	force_assert(NULL != kvb);
 
+	trie_init(&kvb->prefixes);
+
 	return kvb;
 }
 
-int pcre_keyvalue_buffer_append(log_error_st *errh, pcre_keyvalue_buffer *kvb, const buffer *key, const buffer *value) {
-#ifdef HAVE_PCRE_H
-	const char *errptr;
-	int erroff;
+#ifdef HAVE_PCRE
+__attribute_cold__
+static uint32_t pcre_keyvalue_literal_prefix(const buffer *key, char *pfx, const uint32_t sz) {
+	/* conservatively extract literal prefix which input must begin with
+	 * in order to match regex anchored with '^' (and not multiline).
+	 * Return 0 (no prefix) if regex contains top-level alternation or
+	 * contains constructs which are not analyzed by this simple scan.
+	 * (prefix is truncated to sz; truncated prefix is still required) */
+	const char * const s = key->ptr;
+	const uint32_t len = buffer_string_length(key);
+	if (len < 2 || s[0] != '^') return 0;
+
+	int depth = 0;
+	for (uint32_t i = 1; i < len; ++i) {
+		switch (s[i]) {
+		  case '\\':
+			if (s[++i] == 'Q') return 0; /* \Q...\E quoting */
+			break;
+		  case '[': /* skip char class (']' first in class is literal) */
+			if (s[i+1] == '^') ++i;
+			if (s[i+1] == ']') ++i;
+			while (++i < len && s[i] != ']') {
+				if (s[i] == '\\') {
+					if (s[++i] == 'Q') return 0;
+				}
+				else if (s[i] == '[' && s[i+1] == ':')
+					return 0; /* POSIX class, e.g. [[:alpha:]] */
+			}
+			break;
+		  case '(':
+			if (s[i+1] == '?') {
+				/* comment or option setting which might enable (?x) */
+				uint32_t j = i+2;
+				if (s[j] == '#') return 0;
+				for (; light_isalpha(s[j]) || s[j] == '-' || s[j] == '^'; ++j)
+					if (s[j] == 'x') return 0;
+			}
+			++depth;
+			break;
+		  case ')':
+			--depth;
+			break;
+		  case '|':
+			if (0 == depth) return 0;
+			break;
+		  default:
+			break;
+		}
+	}
+
+	uint32_t n = 0;
+	for (uint32_t i = 1; i < len && n < sz; ++i) {
+		char c = s[i];
+		if (c == '\\') {
+			c = s[++i];
+			if (light_isalnum(c) || c == '\0') break; /* e.g. \d \x20 */
+		}
+		else if (NULL != strchr(".^$|?*+()[]{}", c)) break; /*(or c == '\0')*/
+		/* char is optional if followed by quantifier permitting zero */
+		const char q = s[i+1];
+		if (q == '?' || q == '*' || q == '{') break;
+		pfx[n++] = c;
+	}
+	return n;
+}
+
+__attribute_cold__
+static void pcre_keyvalue_buffer_prefix(pcre_keyvalue_buffer * const kvb, const buffer * const key) {
+	const int32_t i = (int32_t)kvb->used - 1;
+	if (0 == (i & 31)) { /*(allocate bitmaps 32 bits at a time)*/
+		const uint32_t nw = ((uint32_t)i >> 5) + 1;
+		kvb->noprefix = realloc(kvb->noprefix, nw * sizeof(uint32_t));
+		force_assert(NULL != kvb->noprefix);
+		kvb->noprefix[nw-1] = 0;
+		kvb->cand = realloc(kvb->cand, nw * sizeof(uint32_t));
+		force_assert(NULL != kvb->cand);
+	}
+
+	pcre_keyvalue * const kv = kvb->kv + i;
+	kv->pnext = -1;
+
+	char pfx[256];
+	const uint32_t n = pcre_keyvalue_literal_prefix(key, pfx, sizeof(pfx));
+	if (0 == n) {
+		kvb->noprefix[i >> 5] |= 1u << (i & 31);
+		return;
+	}
+
+	/* chain regexes with same literal prefix */
+	const int32_t x = trie_insert(&kvb->prefixes, pfx, n, i, 0);
+	if (x != i) {
+		kv->pnext = kvb->kv[x].pnext;
+		kvb->kv[x].pnext = i;
+	}
+}
+#endif
+
+int pcre_keyvalue_buffer_append(log_error_st *errh, pcre_keyvalue_buffer *kvb, const buffer *key, const buffer *value, const int pcre_jit) {
+#ifdef HAVE_PCRE
 	pcre_keyvalue *kv;
 
 	if (0 == (kvb->used & 3)) { /*(allocate in groups of 4)*/
@@ -48,12 +162,43 @@ int pcre_keyvalue_buffer_append(log_error_st *errh, pcre_keyvalue_buffer *kvb, c
 	}
 
 	kv = kvb->kv + kvb->used++;
-	kv->key_extra = NULL;
 
         /* copy persistent config data, and elide free() in free_data below */
 	memcpy(&kv->value, value, sizeof(buffer));
 	/*buffer_copy_buffer(&kv->value, value);*/
 
+  #ifdef HAVE_PCRE2_H
+
+	int errcode;
+	PCRE2_SIZE erroff;
+	PCRE2_UCHAR errbuf[1024];
+
+	kv->match_data = NULL;
+	kv->code = pcre2_compile((PCRE2_SPTR)CONST_BUF_LEN(key),
+	                         0, &errcode, &erroff, NULL);
+	if (NULL == kv->code) {
+		pcre2_get_error_message(errcode, errbuf, sizeof(errbuf));
+		log_error(errh, __FILE__, __LINE__,
+		  "pcre2_compile: %s at offset %zu, regex: %s",
+		  (char *)errbuf, erroff, key->ptr);
+		return 0;
+	}
+
+	/* (pcre2_match() falls back to interpreter if JIT compile fails,
+	 *  e.g. if JIT is unsupported or exec memory is denied by policy) */
+	if (pcre_jit)
+		pcre2_jit_compile(kv->code, PCRE2_JIT_COMPLETE);
+
+	/* match data is reused for each match with this regex */
+	kv->match_data = pcre2_match_data_create_from_pattern(kv->code, NULL);
+	force_assert(kv->match_data);
+
+  #else /* HAVE_PCRE_H */
+
+	const char *errptr;
+	int erroff;
+
+	kv->key_extra = NULL;
 	if (NULL == (kv->key = pcre_compile(key->ptr,
 					  0, &errptr, &erroff, NULL))) {
 
@@ -62,42 +207,59 @@ int pcre_keyvalue_buffer_append(log_error_st *errh, pcre_keyvalue_buffer *kvb, c
 		return 0;
 	}
 
-	if (NULL == (kv->key_extra = pcre_study(kv->key, 0, &errptr)) &&
-			errptr != NULL) {
+	const int study_options = pcre_jit ? PCRE_STUDY_JIT_COMPILE : 0;
+	if (NULL == (kv->key_extra = pcre_study(kv->key, study_options, &errptr))
+	    && errptr != NULL) {
 		return 0;
 	}
+
+  #endif
+
+	pcre_keyvalue_buffer_prefix(kvb, key);
 #else
 	static int logged_message = 0;
 	if (logged_message) return 1;
 	logged_message = 1;
 	log_error(errh, __FILE__, __LINE__,
-	  "pcre support is missing, please install libpcre and the headers");
+	  "pcre support is missing, please install libpcre2 and the headers");
 	UNUSED(kvb);
 	UNUSED(key);
 	UNUSED(value);
+	UNUSED(pcre_jit);
 #endif
 
 	return 1;
 }
 
 void pcre_keyvalue_buffer_free(pcre_keyvalue_buffer *kvb) {
-#ifdef HAVE_PCRE_H
+#ifdef HAVE_PCRE
 	for (uint32_t i = 0; i < kvb->used; ++i) {
 		pcre_keyvalue * const kv = kvb->kv+i;
+	  #ifdef HAVE_PCRE2_H
+		if (kv->match_data) pcre2_match_data_free(kv->match_data);
+		if (kv->code) pcre2_code_free(kv->code);
+	  #else
 		if (kv->key) pcre_free(kv->key);
-		if (kv->key_extra) pcre_free(kv->key_extra);
+		if (kv->key_extra) pcre_free_study(kv->key_extra);
+	  #endif
 		/*free (kv->value.ptr);*//*(see pcre_keyvalue_buffer_append)*/
 	}
 
 	if (kvb->kv) free(kvb->kv);
+	free(kvb->noprefix);
+	free(kvb->cand);
 #endif
+	trie_free(&kvb->prefixes);
 	free(kvb);
 }
 
-#ifdef HAVE_PCRE_H
-static void pcre_keyvalue_buffer_append_match(buffer *b, const char **list, int n, unsigned int num, int flags) {
+#ifdef HAVE_PCRE
+static void pcre_keyvalue_buffer_append_match(buffer *b, const char *s, const pcre_keyvalue_ovec_t *ovec, int n, unsigned int num, int flags) {
     if (num < (unsigned int)n) { /* n is always > 0 */
-        burl_append(b, list[num], strlen(list[num]), flags);
+        num <<= 1; /*(num *= 2)*/
+        /*(unset capture group has same start and end offset; len 0)*/
+        const size_t len = (size_t)(ovec[num+1] - ovec[num]);
+        if (len) burl_append(b, s + ovec[num], len, flags);
     }
 }
 
@@ -111,7 +273,7 @@ static void pcre_keyvalue_buffer_append_ctxmatch(buffer *b, pcre_keyvalue_ctx *c
     }
 }
 
-static int pcre_keyvalue_buffer_subst_ext(buffer *b, const char *pattern, const char **list, int n, pcre_keyvalue_ctx *ctx) {
+static int pcre_keyvalue_buffer_subst_ext(buffer *b, const char *pattern, const char *s, const pcre_keyvalue_ovec_t *ovec, int n, pcre_keyvalue_ctx *ctx) {
     const unsigned char *p = (unsigned char *)pattern+2;/* +2 past ${} or %{} */
     int flags = 0;
     while (!light_isdigit(*p) && *p != '}' && *p != '\0') {
@@ -243,13 +405,13 @@ static int pcre_keyvalue_buffer_subst_ext(buffer *b, const char *pattern, const
         }
         if (0 == flags) flags = BURL_ENCODE_PSNDE; /* default */
         pattern[0] == '$' /*(else '%')*/
-          ? pcre_keyvalue_buffer_append_match(b, list, n, num, flags)
+          ? pcre_keyvalue_buffer_append_match(b, s, ovec, n, num, flags)
           : pcre_keyvalue_buffer_append_ctxmatch(b, ctx, num, flags);
     }
     return (int)(p + 1 - (unsigned char *)pattern - 2);
 }
 
-static void pcre_keyvalue_buffer_subst(buffer *b, const buffer *patternb, const char **list, int n, pcre_keyvalue_ctx *ctx) {
+static void pcre_keyvalue_buffer_subst(buffer *b, const buffer *patternb, const char *s, const pcre_keyvalue_ovec_t *ovec, int n, pcre_keyvalue_ctx *ctx) {
 	const char *pattern = patternb->ptr;
 	const size_t pattern_len = buffer_string_length(patternb);
 	size_t start = 0;
@@ -264,13 +426,13 @@ static void pcre_keyvalue_buffer_subst(buffer *b, const buffer *patternb, const
 			buffer_append_string_len(b, pattern + start, k - start);
 
 			if (pattern[k + 1] == '{') {
-				int num = pcre_keyvalue_buffer_subst_ext(b, pattern+k, list, n, ctx);
+				int num = pcre_keyvalue_buffer_subst_ext(b, pattern+k, s, ovec, n, ctx);
 				if (num < 0) return; /* error; truncate result */
 				k += (size_t)num;
 			} else if (light_isdigit(((unsigned char *)pattern)[k + 1])) {
 				unsigned int num = (unsigned int)pattern[k + 1] - '0';
 				pattern[k] == '$' /*(else '%')*/
-				  ? pcre_keyvalue_buffer_append_match(b, list, n, num, 0)
+				  ? pcre_keyvalue_buffer_append_match(b, s, ovec, n, num, 0)
 				  : pcre_keyvalue_buffer_append_ctxmatch(b, ctx, num, 0);
 			} else {
 				/* enable escape: "%%" => "%", "%a" => "%a", "$$" => "$" */
@@ -285,35 +447,69 @@ static void pcre_keyvalue_buffer_subst(buffer *b, const buffer *patternb, const
 	buffer_append_string_len(b, pattern + start, pattern_len - start);
 }
 
+static handler_t pcre_keyvalue_buffer_match(const pcre_keyvalue_buffer *kvb, const int i, pcre_keyvalue_ctx *ctx, const buffer *input, buffer *result) {
+    /* returns HANDLER_UNSET if regex at ndx i does not match input */
+    const pcre_keyvalue * const kv = kvb->kv+i;
+  #ifdef HAVE_PCRE2_H
+    int n = pcre2_match(kv->code, (PCRE2_SPTR)CONST_BUF_LEN(input),
+                        0, 0, kv->match_data, NULL);
+    if (n < 0) {
+        return (n != PCRE2_ERROR_NOMATCH) ? HANDLER_ERROR : HANDLER_UNSET;
+    }
+    const PCRE2_SIZE * const ovec = pcre2_get_ovector_pointer(kv->match_data);
+  #else
+    #define N 20
+    int ovec[N * 3];
+    #undef N
+    int n = pcre_exec(kv->key, kv->key_extra, CONST_BUF_LEN(input),
+                      0, 0, ovec, sizeof(ovec)/sizeof(int));
+    if (n < 0) {
+        return (n != PCRE_ERROR_NOMATCH) ? HANDLER_ERROR : HANDLER_UNSET;
+    }
+  #endif
+    if (buffer_string_is_empty(&kv->value)) {
+        /* short-circuit if blank replacement pattern
+         * (do not attempt to match against remaining kvb rules) */
+        ctx->m = i;
+        return HANDLER_GO_ON;
+    }
+    else { /* it matched */
+        ctx->m = i;
+        pcre_keyvalue_buffer_subst(result, &kv->value, input->ptr, ovec, n, ctx);
+        return HANDLER_FINISHED;
+    }
+}
+
 handler_t pcre_keyvalue_buffer_process(const pcre_keyvalue_buffer *kvb, pcre_keyvalue_ctx *ctx, const buffer *input, buffer *result) {
-    for (int i = 0, used = (int)kvb->used; i < used; ++i) {
-        const pcre_keyvalue * const kv = kvb->kv+i;
-        #define N 20
-        int ovec[N * 3];
-        #undef N
-        int n = pcre_exec(kv->key, kv->key_extra, CONST_BUF_LEN(input),
-                          0, 0, ovec, sizeof(ovec)/sizeof(int));
-        if (n < 0) {
-            if (n != PCRE_ERROR_NOMATCH) {
-                return HANDLER_ERROR;
-            }
-        }
-        else if (buffer_string_is_empty(&kv->value)) {
-            /* short-circuit if blank replacement pattern
-             * (do not attempt to match against remaining kvb rules) */
-            ctx->m = i;
-            return HANDLER_GO_ON;
-        }
-        else { /* it matched */
-            const char **list;
-            ctx->m = i;
-            pcre_get_substring_list(input->ptr, ovec, n, &list);
-            pcre_keyvalue_buffer_subst(result, &kv->value, list, n, ctx);
-            pcre_free(list);
-            return HANDLER_FINISHED;
+    const trie * const t = &kvb->prefixes;
+    if (0 == t->used) { /* no regex has literal prefix; try each in order */
+        for (int i = 0, used = (int)kvb->used; i < used; ++i) {
+            handler_t rc = pcre_keyvalue_buffer_match(kvb, i, ctx, input, result);
+            if (rc != HANDLER_UNSET) return rc;
         }
+        return HANDLER_GO_ON;
+    }
+
+    /* candidates are regexes without literal prefix, plus regexes with
+     * literal prefix which is a prefix of input; try candidates in order */
+    const uint32_t nw = (kvb->used + 31) >> 5;
+    uint32_t * const cand = kvb->cand;
+    memcpy(cand, kvb->noprefix, nw * sizeof(uint32_t));
+    const unsigned char * const s = (const unsigned char *)input->ptr;
+    const uint32_t len = buffer_string_length(input);
+    for (uint32_t i = 0, n = 0; i < len && (n = trie_child(t, n, s[i])); ++i) {
+        for (int32_t x = t->nodes[n].v; x >= 0; x = kvb->kv[x].pnext)
+            cand[x >> 5] |= 1u << (x & 31);
     }
 
+    for (uint32_t w = 0; w < nw; ++w) {
+        uint32_t m = cand[w];
+        for (int i = (int)(w << 5); m; ++i, m >>= 1) {
+            if (!(m & 1)) continue;
+            handler_t rc = pcre_keyvalue_buffer_match(kvb, i, ctx, input, result);
+            if (rc != HANDLER_UNSET) return rc;
+        }
+    }
     return HANDLER_GO_ON;
 }
 #else
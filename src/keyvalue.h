@@ -4,6 +4,7 @@
 
 #include "base_decls.h"
 #include "buffer.h"
+#include "trie.h"
 
 struct burl_parts_t;    /* declaration */
 struct cond_match_t;    /* declaration */
@@ -21,13 +22,16 @@ typedef struct {
 	uint32_t used;
 	uint16_t x0;
 	uint16_t x1;
+	trie prefixes;     /* literal prefixes of regexes anchored with '^' */
+	uint32_t *noprefix;/* bitmap of regexes without literal prefix */
+	uint32_t *cand;    /* bitmap of candidate regexes (scratch space) */
 } pcre_keyvalue_buffer;
 
 __attribute_cold__
 pcre_keyvalue_buffer *pcre_keyvalue_buffer_init(void);
 
 __attribute_cold__
-int pcre_keyvalue_buffer_append(log_error_st *errh, pcre_keyvalue_buffer *kvb, const buffer *key, const buffer *value);
+int pcre_keyvalue_buffer_append(log_error_st *errh, pcre_keyvalue_buffer *kvb, const buffer *key, const buffer *value, int pcre_jit);
 
 __attribute_cold__
 void pcre_keyvalue_buffer_free(pcre_keyvalue_buffer *kvb);
@@ -42,6 +42,14 @@ int log_clock_gettime_realtime (struct timespec *ts) {
       #endif
 }
 
+int log_clock_gettime_monotonic (struct timespec *ts) {
+      #if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_MONOTONIC)
+	return clock_gettime(CLOCK_MONOTONIC, ts);
+      #else
+	return log_clock_gettime_realtime(ts);
+      #endif
+}
+
 /* retry write on EINTR or when not all data was written */
 ssize_t write_all(int fd, const void * const buf, size_t count) {
     ssize_t written = 0;
@@ -58,23 +66,26 @@ ssize_t write_all(int fd, const void * const buf, size_t count) {
     return written;
 }
 
-static int log_buffer_prepare(const log_error_st *errh, const char *filename, unsigned int line, buffer *b) {
-	static time_t tlast;
-	static char tstr[20]; /* 20-chars needed for "%Y-%m-%d %H:%M:%S" */
-	static size_t tlen;
+static int log_buffer_prepare(log_error_st *errh, const char *filename, unsigned int line, buffer *b) {
 	switch(errh->errorlog_mode) {
 	case ERRORLOG_PIPE:
 	case ERRORLOG_FILE:
 	case ERRORLOG_FD:
 		if (-1 == errh->errorlog_fd) return -1;
 		/* cache the generated timestamp */
-		if (tlast != log_epoch_secs) {
-			tlast = log_epoch_secs;
-			tlen = strftime(tstr, sizeof(tstr),
-			                "%Y-%m-%d %H:%M:%S", localtime(&tlast));
+		if (errh->tlast != log_epoch_secs) {
+			const time_t t = errh->tlast = log_epoch_secs;
+		  #ifdef HAVE_LOCALTIME_R
+			struct tm tm;
+			errh->tlen = (uint32_t)strftime(errh->tstr, sizeof(errh->tstr),
+			                "%Y-%m-%d %H:%M:%S", localtime_r(&t, &tm));
+		  #else
+			errh->tlen = (uint32_t)strftime(errh->tstr, sizeof(errh->tstr),
+			                "%Y-%m-%d %H:%M:%S", localtime(&t));
+		  #endif
 		}
 
-		buffer_copy_string_len(b, tstr, tlen);
+		buffer_copy_string_len(b, errh->tstr, errh->tlen);
 		buffer_append_string_len(b, CONST_STR_LEN(": ("));
 		break;
 	case ERRORLOG_SYSLOG:
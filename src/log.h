@@ -9,6 +9,7 @@ extern time_t log_epoch_secs;
 
 struct timespec; /* declaration */
 int log_clock_gettime_realtime (struct timespec *ts);
+int log_clock_gettime_monotonic (struct timespec *ts);
 
 ssize_t write_all(int fd, const void* buf, size_t count);
 
@@ -17,6 +18,9 @@ struct log_error_st {
     int errorlog_fd;
     buffer b;
     const char *fn;
+    time_t tlast;       /* cached timestamp (per log_error_st so that worker */
+    uint32_t tlen;      /*  threads can log with a private log_error_st) */
+    char tstr[20];      /* 20-chars needed for "%Y-%m-%d %H:%M:%S" */
 };
 
 __attribute_cold__
@@ -48,7 +48,7 @@ static void mod_access_patch_config(request_st * const r, plugin_data * const p)
     p->conf = p->defaults; /* copy small struct instead of memcpy() */
     /*memcpy(&p->conf, &p->defaults, sizeof(plugin_config));*/
     for (int i = 1, used = p->nconfig; i < used; ++i) {
-        if (config_check_cond(r, (uint32_t)p->cvlist[i].k_id))
+        if ((i = config_check_cond_next(r, p->cvlist, i, used)) < used)
             mod_access_merge_config(&p->conf, p->cvlist + p->cvlist[i].v.u2[0]);
     }
 }
@@ -70,6 +70,22 @@ SETDEFAULTS_FUNC(mod_access_set_defaults) {
     if (!config_plugin_values_init(srv, p, cpk, "mod_access"))
         return HANDLER_ERROR;
 
+    /* process and validate config directives
+     * (init i to 0 if global context; to 1 to skip empty global context) */
+    for (int i = !p->cvlist[0].v.u2[1]; i < p->nconfig; ++i) {
+        const config_plugin_value_t *cpv = p->cvlist + p->cvlist[i].v.u2[0];
+        for (; -1 != cpv->k_id; ++cpv) {
+            switch (cpv->k_id) {
+              case 0: /* url.access-deny */
+              case 1: /* url.access-allow */
+                array_match_index((array *)cpv->v.a, ARRAY_MATCH_VALUE_SUFFIX);
+                break;
+              default:/* should not happen */
+                break;
+            }
+        }
+    }
+
     /* initialize p->defaults from global config context */
     if (p->nconfig > 0 && p->cvlist->v.u2[1]) {
         const config_plugin_value_t *cpv = p->cvlist + p->cvlist->v.u2[0];
@@ -44,7 +44,7 @@ static void mod_alias_patch_config(request_st * const r, plugin_data * const p)
     p->conf = p->defaults; /* copy small struct instead of memcpy() */
     /*memcpy(&p->conf, &p->defaults, sizeof(plugin_config));*/
     for (int i = 1, used = p->nconfig; i < used; ++i) {
-        if (config_check_cond(r, (uint32_t)p->cvlist[i].k_id))
+        if ((i = config_check_cond_next(r, p->cvlist, i, used)) < used)
             mod_alias_merge_config(&p->conf, p->cvlist + p->cvlist[i].v.u2[0]);
     }
 }
@@ -100,6 +100,7 @@ SETDEFAULTS_FUNC(mod_alias_set_defaults) {
               case 0: /* alias.url */
                 if (cpv->v.a->used >= 2 && !mod_alias_check_order(srv,cpv->v.a))
                     return HANDLER_ERROR;
+                array_match_index((array *)cpv->v.a, ARRAY_MATCH_KEY_PREFIX);
                 break;
               default:/* should not happen */
                 break;
@@ -32,6 +32,9 @@
 #ifdef HAVE_CRYPT_H
 #include <crypt.h>
 #endif
+#if !defined(HAVE_CRYPT_R) && defined(HAVE_CRYPT) && defined(HAVE_PTHREAD_H)
+#include <pthread.h>
+#endif
 
 #include <dbi/dbi.h>
 
@@ -40,6 +43,7 @@
 
 #include "sys-crypto-md.h"
 #include "safe_memclear.h"
+#include "async_pool.h"
 #include "base.h"
 #include "http_auth.h"
 #include "fdevent.h"
@@ -47,11 +51,10 @@
 #include "plugin.h"
 
 typedef struct {
-    dbi_conn dbconn;
-    dbi_inst dbinst;
+    uint32_t ndx;           /* index into per-thread connections */
     const buffer *sqlquery;
-    log_error_st *errh;
-    short reconnect_count;
+    const buffer *dbtype;
+    const array *opts;
 } dbi_config;
 
 typedef struct {
@@ -62,18 +65,46 @@ typedef struct {
     PLUGIN_DATA;
     plugin_config defaults;
     plugin_config conf;
+
+    uint32_t ndbconf;
+    async_pool *pool;
 } plugin_data;
 
+/* DBI connection kept open by each worker thread for each auth.backend.dbi
+ * (libdbi instance is per-thread; dbi_initialize_r() per thread) */
+typedef struct {
+    dbi_conn dbconn;
+    dbi_inst dbinst;
+    log_error_st *errh;
+    short reconnect_count;
+} mod_authn_dbi_conn;
+
+typedef struct {
+    uint32_t used;
+    mod_authn_dbi_conn c[];
+} mod_authn_dbi_tctx;
+
+typedef struct {
+    async_job job;          /* (must be first member) */
+    handler_t rc;
+    const dbi_config *dbconf;
+    http_auth_info_t ai;    /* (ai.username and ai.realm point into job) */
+    buffer username;
+    buffer realm;
+    buffer sqlquery;
+    char *pw;               /* (NULL if HTTP Digest auth) */
+} mod_authn_dbi_job;
+
 
 /* used to reconnect to the database when we get disconnected */
 static void
 mod_authn_dbi_error_callback (dbi_conn dbconn, void *vdata)
 {
-    dbi_config *dbconf = (dbi_config *)vdata;
+    mod_authn_dbi_conn * const c = (mod_authn_dbi_conn *)vdata;
     const char *errormsg = NULL;
-    /*assert(dbconf->dbconn == dbconn);*/
+    /*assert(c->dbconn == dbconn);*/
 
-    while (++dbconf->reconnect_count <= 3) { /* retry */
+    while (++c->reconnect_count <= 3) { /* retry */
         if (0 == dbi_conn_connect(dbconn)) {
             fdevent_setfd_cloexec(dbi_conn_get_socket(dbconn));
             return;
@@ -81,7 +112,97 @@ mod_authn_dbi_error_callback (dbi_conn dbconn, void *vdata)
     }
 
     dbi_conn_error(dbconn, &errormsg);
-    log_error(dbconf->errh,__FILE__,__LINE__,"dbi_conn_connect(): %s",errormsg);
+    log_error(c->errh, __FILE__, __LINE__, "dbi_conn_connect(): %s", errormsg);
+}
+
+
+static void
+mod_authn_dbi_conn_close (mod_authn_dbi_conn * const c)
+{
+    if (NULL != c->dbconn) dbi_conn_close(c->dbconn);
+    if (NULL != c->dbinst) dbi_shutdown_r(c->dbinst);
+    c->dbconn = NULL;
+    c->dbinst = NULL;
+}
+
+
+static int
+mod_authn_dbi_conn_open (mod_authn_dbi_conn * const c, const dbi_config * const dbconf, log_error_st * const errh)
+{
+    /* create/initialise database */
+    c->errh = errh;
+    c->reconnect_count = 0;
+    if (dbi_initialize_r(NULL, &c->dbinst) < 1) {
+        log_error(errh, __FILE__, __LINE__,
+          "dbi_initialize_r() failed.  "
+          "Do you have the DBD for this db type installed?");
+        mod_authn_dbi_conn_close(c);
+        return -1;
+    }
+    c->dbconn = dbi_conn_new_r(dbconf->dbtype->ptr, c->dbinst);
+    if (NULL == c->dbconn) {
+        log_error(errh, __FILE__, __LINE__,
+          "dbi_conn_new_r() failed.  "
+          "Do you have the DBD for this db type installed?");
+        mod_authn_dbi_conn_close(c);
+        return -1;
+    }
+
+    /* set options */
+    const array * const opts = dbconf->opts;
+    for (size_t j = 0; j < opts->used; ++j) {
+        data_unset *du = opts->data[j];
+        const buffer *opt = &du->key;
+        if (!buffer_string_is_empty(opt)) {
+            if (du->type == TYPE_INTEGER) {
+                data_integer *di = (data_integer *)du;
+                dbi_conn_set_option_numeric(c->dbconn, opt->ptr, di->value);
+            }
+            else if (du->type == TYPE_STRING) {
+                data_string *ds = (data_string *)du;
+                if (&ds->value != dbconf->sqlquery
+                    && &ds->value != dbconf->dbtype) {
+                    dbi_conn_set_option(c->dbconn, opt->ptr, ds->value.ptr);
+                }
+            }
+        }
+    }
+
+    /* used to automatically reconnect to the database */
+    dbi_conn_error_handler(c->dbconn, mod_authn_dbi_error_callback, c);
+
+    /* connect to database */
+    mod_authn_dbi_error_callback(c->dbconn, c);
+    if (c->reconnect_count >= 3) {
+        mod_authn_dbi_conn_close(c);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+static void *
+mod_authn_dbi_tctx_init (void * const ctx)
+{
+    const plugin_data * const p = ctx;
+    mod_authn_dbi_tctx * const tctx =
+      calloc(1, sizeof(mod_authn_dbi_tctx)
+                + p->ndbconf * sizeof(mod_authn_dbi_conn));
+    force_assert(tctx);
+    tctx->used = p->ndbconf;
+    return tctx;
+}
+
+
+static void
+mod_authn_dbi_tctx_free (void * const ctx)
+{
+    mod_authn_dbi_tctx * const tctx = ctx;
+    if (NULL == tctx) return;
+    for (uint32_t i = 0; i < tctx->used; ++i)
+        mod_authn_dbi_conn_close(tctx->c + i);
+    free(tctx);
 }
 
 
@@ -90,8 +211,6 @@ mod_authn_dbi_dbconf_free (void *vdata)
 {
     dbi_config *dbconf = (dbi_config *)vdata;
     if (!dbconf) return;
-    dbi_conn_close(dbconf->dbconn);
-    dbi_shutdown_r(dbconf->dbinst);
     free(dbconf);
 }
 
@@ -130,60 +249,22 @@ mod_authn_dbi_dbconf_setup (server *srv, const array *opts, void **vdata)
 
     if (!buffer_string_is_empty(sqlquery)
         && !buffer_is_empty(dbname) && !buffer_is_empty(dbtype)) {
-        /* create/initialise database */
-        dbi_config *dbconf;
-        dbi_inst dbinst = NULL;
-        dbi_conn dbconn;
-        if (dbi_initialize_r(NULL, &dbinst) < 1) {
-            log_error(srv->errh, __FILE__, __LINE__,
-              "dbi_initialize_r() failed.  "
-              "Do you have the DBD for this db type installed?");
-            return -1;
-        }
-        dbconn = dbi_conn_new_r(dbtype->ptr, dbinst);
-        if (NULL == dbconn) {
-            log_error(srv->errh, __FILE__, __LINE__,
-              "dbi_conn_new_r() failed.  "
-              "Do you have the DBD for this db type installed?");
-            dbi_shutdown_r(dbinst);
-            return -1;
-        }
-
-        /* set options */
-        for (size_t j = 0; j < opts->used; ++j) {
-            data_unset *du = opts->data[j];
-            const buffer *opt = &du->key;
-            if (!buffer_string_is_empty(opt)) {
-                if (du->type == TYPE_INTEGER) {
-                    data_integer *di = (data_integer *)du;
-                    dbi_conn_set_option_numeric(dbconn, opt->ptr, di->value);
-                }
-                else if (du->type == TYPE_STRING) {
-                    data_string *ds = (data_string *)du;
-                    if (&ds->value != sqlquery && &ds->value != dbtype) {
-                        dbi_conn_set_option(dbconn, opt->ptr, ds->value.ptr);
-                    }
-                }
-            }
-        }
-
-        dbconf = (dbi_config *)calloc(1, sizeof(*dbconf));
-        dbconf->dbinst = dbinst;
-        dbconf->dbconn = dbconn;
+        dbi_config *dbconf = (dbi_config *)calloc(1, sizeof(*dbconf));
+        force_assert(dbconf);
         dbconf->sqlquery = sqlquery;
-        dbconf->errh = srv->errh;
-        dbconf->reconnect_count = 0;
-        *vdata = dbconf;
-
-        /* used to automatically reconnect to the database */
-        dbi_conn_error_handler(dbconn, mod_authn_dbi_error_callback, dbconf);
+        dbconf->dbtype = dbtype;
+        dbconf->opts = opts;
 
-        /* connect to database */
-        mod_authn_dbi_error_callback(dbconn, dbconf);
-        if (dbconf->reconnect_count >= 3) {
+        /* check database connection at startup
+         * (queries are made in worker threads, each with its own connection)*/
+        mod_authn_dbi_conn c = { NULL, NULL, NULL, 0 };
+        if (0 != mod_authn_dbi_conn_open(&c, dbconf, srv->errh)) {
             mod_authn_dbi_dbconf_free(dbconf);
             return -1;
         }
+        mod_authn_dbi_conn_close(&c);
+
+        *vdata = dbconf;
     }
 
     return 0;
@@ -208,6 +289,7 @@ INIT_FUNC(mod_authn_dbi_init) {
 
 FREE_FUNC(mod_authn_dbi_cleanup) {
     plugin_data * const p = p_d;
+    async_pool_free(p->pool); /*(before freeing config used by threads)*/
     if (NULL == p->cvlist) return;
     /* (init i to 0 if global context; to 1 to skip empty global context) */
     for (int i = !p->cvlist[0].v.u2[1], used = p->nconfig; i < used; ++i) {
@@ -234,6 +316,8 @@ mod_authn_dbi_merge_config_cpv (plugin_config * const pconf, const config_plugin
         if (cpv->vtype == T_CONFIG_LOCAL)
             pconf->vdata = cpv->v.v;
         break;
+      case 1: /* auth.backend.dbi.threads */
+        break;
       default:/* should not happen */
         return;
     }
@@ -255,7 +339,7 @@ mod_authn_dbi_patch_config(request_st * const r, plugin_data * const p)
     p->conf = p->defaults; /* copy small struct instead of memcpy() */
     /*memcpy(&p->conf, &p->defaults, sizeof(plugin_config));*/
     for (int i = 1, used = p->nconfig; i < used; ++i) {
-        if (config_check_cond(r, (uint32_t)p->cvlist[i].k_id))
+        if ((i = config_check_cond_next(r, p->cvlist, i, used)) < used)
             mod_authn_dbi_merge_config(&p->conf,
                                        p->cvlist + p->cvlist[i].v.u2[0]);
     }
@@ -267,6 +351,9 @@ SETDEFAULTS_FUNC(mod_authn_dbi_set_defaults) {
       { CONST_STR_LEN("auth.backend.dbi"),
         T_CONFIG_ARRAY_KVANY,
         T_CONFIG_SCOPE_CONNECTION }
+     ,{ CONST_STR_LEN("auth.backend.dbi.threads"),
+        T_CONFIG_SHORT,
+        T_CONFIG_SCOPE_SERVER }
      ,{ NULL, 0,
         T_CONFIG_UNSET,
         T_CONFIG_SCOPE_UNSET }
@@ -276,6 +363,8 @@ SETDEFAULTS_FUNC(mod_authn_dbi_set_defaults) {
     if (!config_plugin_values_init(srv, p, cpk, "mod_authn_dbi"))
         return HANDLER_ERROR;
 
+    unsigned short nthreads = 4;
+
     /* process and validate config directives
      * (init i to 0 if global context; to 1 to skip empty global context) */
     for (int i = !p->cvlist[0].v.u2[1]; i < p->nconfig; ++i) {
@@ -286,10 +375,15 @@ SETDEFAULTS_FUNC(mod_authn_dbi_set_defaults) {
                 if (cpv->v.a->used) {
                     if (0 != mod_authn_dbi_dbconf_setup(srv,cpv->v.a,&cpv->v.v))
                         return HANDLER_ERROR;
-                    if (NULL != cpv->v.v)
+                    if (NULL != cpv->v.v) {
                         cpv->vtype = T_CONFIG_LOCAL;
+                        ((dbi_config *)cpv->v.v)->ndx = p->ndbconf++;
+                    }
                 }
                 break;
+              case 1: /* auth.backend.dbi.threads */
+                nthreads = cpv->v.shrt;
+                break;
               default:/* should not happen */
                 break;
             }
@@ -303,6 +397,11 @@ SETDEFAULTS_FUNC(mod_authn_dbi_set_defaults) {
             mod_authn_dbi_merge_config(&p->defaults, cpv);
     }
 
+    if (p->ndbconf)
+        p->pool = async_pool_init("mod_authn_dbi", nthreads,
+                                  mod_authn_dbi_tctx_init,
+                                  mod_authn_dbi_tctx_free, p);
+
     return HANDLER_GO_ON;
 }
 
@@ -322,38 +421,25 @@ SETDEFAULTS_FUNC(mod_authn_dbi_set_defaults) {
  *   https://github.com/P-H-C/phc-string-format/blob/master/phc-sf-spec.md
  * Note: (struct crypt_data) is large and might not fit on the stack
  *   On some systems it is 32k, on others 128k or more.
- *   Therefore, since lighttpd is single-threaded, simply use crypt(),
- *     which is not thread-safe but fine for single-threaded lighttpd.
- *   If crypt_r() is preferred, then safest method is to allocate from heap
- *   rather than using (struct crypt_data) on stack.
+ *   Passwords are checked in async_pool worker threads, and crypt() is not
+ *   thread-safe, so use crypt_r() with (struct crypt_data) allocated from
+ *   heap rather than on stack, or else serialize calls to crypt().
  */
 #if defined(HAVE_CRYPT_R) || defined(HAVE_CRYPT)
+#if !defined(HAVE_CRYPT_R) && defined(HAVE_PTHREAD_H)
+static pthread_mutex_t mod_authn_crypt_mutex = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
 static int
 mod_authn_crypt_cmp (const char *reqpw, const char *userpw, unsigned long userpwlen)
 {
- #if 1
-
-    char *crypted = crypt(reqpw, userpw);
-    size_t crypwlen = (NULL != crypted) ? strlen(crypted) : 0;
-    int rc = (crypwlen == userpwlen) ? memcmp(crypted, userpw, crypwlen) : -1;
-    if (crypwlen) safe_memclear(crypted, crypwlen);
-    return rc;
-
- #else
-
   #if defined(HAVE_CRYPT_R)
-   #if 1 /* (must free() before returning if allocated here) */
-    struct crypt_data *crypt_tmp_data = malloc(sizeof(struct crypt_data));
+    /* (must free() before returning if allocated here) */
+    /*(calloc() also sets crypt_tmp_data->initialized = 0 (or for _AIX))*/
+    struct crypt_data *crypt_tmp_data = calloc(1, sizeof(struct crypt_data));
     force_assert(crypt_tmp_data);
-   #else /* safe if sizeof(struct crypt_data) <= 32768 */
-    struct crypt_data crypt_tmp_data_stack;
-    struct crypt_data *crypt_tmp_data = &crypt_tmp_data_stack;
-   #endif
-   #ifdef _AIX
-    memset(&crypt_tmp_data_stack, 0, sizeof(struct crypt_data));
-   #else
-    crypt_tmp_data_stack.initialized = 0;
-   #endif
+  #elif defined(HAVE_PTHREAD_H)
+    pthread_mutex_lock(&mod_authn_crypt_mutex);
   #endif
 
   #if defined(HAVE_CRYPT_R)
@@ -364,16 +450,13 @@ mod_authn_crypt_cmp (const char *reqpw, const char *userpw, unsigned long userpw
     size_t crypwlen = (NULL != crypted) ? strlen(crypted) : 0;
     int rc = (crypwlen == userpwlen) ? memcmp(crypted, userpw, crypwlen) : -1;
 
-    safe_memclear(crypted, crypwlen);
+    if (crypwlen) safe_memclear(crypted, crypwlen);
   #if defined(HAVE_CRYPT_R)
-   #if 1 /* (must free() if allocated above) */
-    free(crypt_tmp_data);
-   #else /* safe if sizeof(struct crypt_data) <= 32768 */
-   #endif
+    free(crypt_tmp_data); /* (must free() if allocated above) */
+  #elif defined(HAVE_PTHREAD_H)
+    pthread_mutex_unlock(&mod_authn_crypt_mutex);
   #endif
     return rc;
-
- #endif
 }
 #endif
 
@@ -433,7 +516,7 @@ mod_authn_dbi_password_cmp (const char *userpw, unsigned long userpwlen, http_au
 
 
 static buffer *
-mod_authn_dbi_query_build (buffer * const sqlquery, dbi_config * const dbconf, http_auth_info_t * const ai)
+mod_authn_dbi_query_build (buffer * const sqlquery, const dbi_config * const dbconf, dbi_conn dbconn, http_auth_info_t * const ai)
 {
     buffer_clear(sqlquery);
     int qcount = 0;
@@ -467,7 +550,7 @@ mod_authn_dbi_query_build (buffer * const sqlquery, dbi_config * const dbconf, h
             /* escape the value */
             char *esc = NULL;
             size_t elen =
-              dbi_conn_escape_string_copy(dbconf->dbconn, v, &esc);
+              dbi_conn_escape_string_copy(dbconn, v, &esc);
             if (0 == elen) return NULL; /*('esc' must not be freed if error)*/
             buffer_append_string_len(sqlquery, b, (size_t)(d - b));
             buffer_append_string_len(sqlquery, esc, elen);
@@ -484,32 +567,45 @@ mod_authn_dbi_query_build (buffer * const sqlquery, dbi_config * const dbconf, h
 }
 
 
-static handler_t
-mod_authn_dbi_query (request_st * const r, void *p_d, http_auth_info_t * const ai, const char * const pw)
+static void
+mod_authn_dbi_job_run (async_job * const job, void * const tctx, log_error_st * const errh)
 {
-    plugin_data * const p = (plugin_data *)p_d;
-    mod_authn_dbi_patch_config(r, p);
-    if (NULL == p->conf.vdata) return HANDLER_ERROR; /*(should not happen)*/
-    dbi_config * const dbconf = (dbi_config *)p->conf.vdata;
+    /* (called in worker thread) */
+    mod_authn_dbi_job * const dj = (mod_authn_dbi_job *)job;
+    const dbi_config * const dbconf = dj->dbconf;
+    mod_authn_dbi_conn * const c = ((mod_authn_dbi_tctx *)tctx)->c + dbconf->ndx;
+    http_auth_info_t * const ai = &dj->ai;
+    const char * const pw = dj->pw;
+
+    dj->rc = HANDLER_ERROR;
+
+    if (NULL == c->dbconn) {
+        if (0 != mod_authn_dbi_conn_open(c, dbconf, errh))
+            return;
+    }
+    else
+        c->errh = errh;
 
-    buffer * const sqlquery = mod_authn_dbi_query_build(r->tmp_buf, dbconf, ai);
+    buffer * const sqlquery =
+      mod_authn_dbi_query_build(&dj->sqlquery, dbconf, c->dbconn, ai);
     if (NULL == sqlquery)
-        return HANDLER_ERROR;
+        return;
 
     /* reset our reconnect-attempt counter, this is a new query. */
-    dbconf->reconnect_count = 0;
+    c->reconnect_count = 0;
 
+    /* (synchronous; blocking; called in worker thread) */
     dbi_result result;
     int retry_count = 0;
     do {
-        result = dbi_conn_query(dbconf->dbconn, sqlquery->ptr);
+        result = dbi_conn_query(c->dbconn, sqlquery->ptr);
     } while (!result && ++retry_count < 2);
 
     if (!result) {
         const char *errmsg;
-        dbi_conn_error(dbconf->dbconn, &errmsg);
-        log_error(r->conf.errh, __FILE__, __LINE__, "%s", errmsg);
-        return HANDLER_ERROR;
+        dbi_conn_error(c->dbconn, &errmsg);
+        log_error(errh, __FILE__, __LINE__, "%s", errmsg);
+        return;
     }
 
     handler_t rc = HANDLER_ERROR;
@@ -535,6 +631,70 @@ mod_authn_dbi_query (request_st * const r, void *p_d, http_auth_info_t * const a
     } /* else not found */
 
     dbi_result_free(result);
+    dj->rc = rc;
+}
+
+
+static void
+mod_authn_dbi_job_free (async_job * const job)
+{
+    mod_authn_dbi_job * const dj = (mod_authn_dbi_job *)job;
+    free(dj->username.ptr);
+    free(dj->realm.ptr);
+    free(dj->sqlquery.ptr);
+    if (dj->pw) {
+        safe_memclear(dj->pw, strlen(dj->pw));
+        free(dj->pw);
+    }
+    free(dj);
+}
+
+
+static mod_authn_dbi_job *
+mod_authn_dbi_job_init (const dbi_config * const dbconf, const http_auth_info_t * const ai, const char * const pw)
+{
+    mod_authn_dbi_job * const dj = calloc(1, sizeof(mod_authn_dbi_job));
+    force_assert(dj);
+    dj->job.run  = mod_authn_dbi_job_run;
+    dj->job.free = mod_authn_dbi_job_free;
+    dj->rc = HANDLER_ERROR;
+    dj->dbconf = dbconf;
+    dj->ai = *ai;
+    buffer_copy_string_len(&dj->username, ai->username, ai->ulen);
+    buffer_copy_string_len(&dj->realm, ai->realm, ai->rlen);
+    dj->ai.username = dj->username.ptr;
+    dj->ai.realm = dj->realm.ptr;
+    if (pw) {
+        dj->pw = strdup(pw);
+        force_assert(dj->pw);
+    }
+    return dj;
+}
+
+
+static handler_t
+mod_authn_dbi_query (request_st * const r, void *p_d, http_auth_info_t * const ai, const char * const pw)
+{
+    plugin_data * const p = (plugin_data *)p_d;
+
+    mod_authn_dbi_job *dj = r->plugin_ctx[p->id];
+    if (NULL == dj) {
+        mod_authn_dbi_patch_config(r, p);
+        if (NULL == p->conf.vdata) return HANDLER_ERROR; /*(should not happen)*/
+        dj = mod_authn_dbi_job_init(p->conf.vdata, ai, pw);
+        r->plugin_ctx[p->id] = dj;
+        /* DBI query is made in worker thread (synchronous; blocking) */
+        if (async_pool_submit(p->pool, r, &dj->job))
+            return HANDLER_WAIT_FOR_EVENT;
+    }
+    else if (!dj->job.done)
+        return HANDLER_WAIT_FOR_EVENT;
+
+    r->plugin_ctx[p->id] = NULL;
+    const handler_t rc = dj->rc;
+    if (HANDLER_GO_ON == rc && NULL == pw) /* used with HTTP Digest auth */
+        memcpy(ai->digest, dj->ai.digest, sizeof(ai->digest));
+    mod_authn_dbi_job_free(&dj->job);
     return rc;
 }
 
@@ -565,6 +725,17 @@ mod_authn_dbi_digest (request_st * const r, void *p_d, http_auth_info_t * const
 }
 
 
+REQUEST_FUNC(mod_authn_dbi_handle_reset) {
+    plugin_data * const p = p_d;
+    mod_authn_dbi_job * const dj = r->plugin_ctx[p->id];
+    if (NULL != dj) {
+        r->plugin_ctx[p->id] = NULL;
+        async_job_detach(&dj->job);
+    }
+    return HANDLER_GO_ON;
+}
+
+
 int mod_authn_dbi_plugin_init (plugin *p);
 int mod_authn_dbi_plugin_init (plugin *p)
 {
@@ -573,6 +744,7 @@ int mod_authn_dbi_plugin_init (plugin *p)
     p->init             = mod_authn_dbi_init;
     p->cleanup          = mod_authn_dbi_cleanup;
     p->set_defaults     = mod_authn_dbi_set_defaults;
+    p->handle_request_reset = mod_authn_dbi_handle_reset;
 
     return 0;
 }
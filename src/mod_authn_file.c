@@ -19,9 +19,12 @@
 #include "safe_memclear.h"
 
 #include "base.h"
+#include "fdevent.h"
 #include "plugin.h"
 #include "http_auth.h"
 #include "log.h"
+#include "splaytree.h"  /* djbhash() */
+#include "stat_cache.h"
 
 #include "base64.h"
 
@@ -37,11 +40,36 @@
  * htdigest, htpasswd, plain auth backends
  */
 
+/* user files are loaded into memory and indexed by a hash table keyed on
+ * "user" (htpasswd, plain) or "user:realm" (htdigest), and are reloaded
+ * when stat_cache reports that the file mtime, size, or inode changed */
+
+typedef struct {
+    uint32_t k;         /* offset of key in data */
+    uint32_t klen;
+    uint32_t v;         /* offset of value (hashed password) in data */
+    uint32_t vlen;
+} authn_file_entry;
+
+typedef struct {
+    const buffer *fn;
+    char *data;         /* file contents (keys and values not '\0'-term) */
+    uint32_t dlen;
+    uint32_t used;
+    authn_file_entry *ents;
+    uint32_t *ht;       /* open addressing; ndx+1 into ents (0 if empty) */
+    uint32_t mask;
+    int realm;          /* key is "user:realm" (htdigest) */
+    time_t mtime;
+    off_t size;
+    ino_t ino;
+} authn_file_db;
+
 typedef struct {
     const buffer *auth_plain_groupfile;
-    const buffer *auth_plain_userfile;
-    const buffer *auth_htdigest_userfile;
-    const buffer *auth_htpasswd_userfile;
+    authn_file_db *auth_plain_userfile;
+    authn_file_db *auth_htdigest_userfile;
+    authn_file_db *auth_htpasswd_userfile;
 } plugin_config;
 
 typedef struct {
@@ -80,19 +108,59 @@ INIT_FUNC(mod_authn_file_init) {
     return p;
 }
 
+static void mod_authn_file_db_clear(authn_file_db * const db) {
+    if (db->data) {
+        safe_memclear(db->data, db->dlen);
+        free(db->data);
+    }
+    free(db->ents);
+    free(db->ht);
+    db->data = NULL;
+    db->ents = NULL;
+    db->ht = NULL;
+    db->dlen = 0;
+    db->used = 0;
+    db->mask = 0;
+}
+
+FREE_FUNC(mod_authn_file_free) {
+    plugin_data * const p = p_d;
+    if (NULL == p->cvlist) return;
+    /* (init i to 0 if global context; to 1 to skip empty global context) */
+    for (int i = !p->cvlist[0].v.u2[1], used = p->nconfig; i < used; ++i) {
+        config_plugin_value_t *cpv = p->cvlist + p->cvlist[i].v.u2[0];
+        for (; -1 != cpv->k_id; ++cpv) {
+            if (cpv->vtype != T_CONFIG_LOCAL || NULL == cpv->v.v) continue;
+            switch (cpv->k_id) {
+              case 1: /* auth.backend.plain.userfile */
+              case 2: /* auth.backend.htdigest.userfile */
+              case 3: /* auth.backend.htpasswd.userfile */
+                mod_authn_file_db_clear(cpv->v.v);
+                free(cpv->v.v);
+                break;
+              default:
+                break;
+            }
+        }
+    }
+}
+
 static void mod_authn_file_merge_config_cpv(plugin_config * const pconf, const config_plugin_value_t * const cpv) {
     switch (cpv->k_id) { /* index into static config_plugin_keys_t cpk[] */
       case 0: /* auth.backend.plain.groupfile */
         pconf->auth_plain_groupfile = cpv->v.b;
         break;
       case 1: /* auth.backend.plain.userfile */
-        pconf->auth_plain_userfile = cpv->v.b;
+        pconf->auth_plain_userfile =
+          cpv->vtype == T_CONFIG_LOCAL ? cpv->v.v : NULL;
         break;
       case 2: /* auth.backend.htdigest.userfile */
-        pconf->auth_htdigest_userfile = cpv->v.b;
+        pconf->auth_htdigest_userfile =
+          cpv->vtype == T_CONFIG_LOCAL ? cpv->v.v : NULL;
         break;
       case 3: /* auth.backend.htpasswd.userfile */
-        pconf->auth_htpasswd_userfile = cpv->v.b;
+        pconf->auth_htpasswd_userfile =
+          cpv->vtype == T_CONFIG_LOCAL ? cpv->v.v : NULL;
         break;
       default:/* should not happen */
         return;
@@ -109,7 +177,7 @@ static void mod_authn_file_patch_config(request_st * const r, plugin_data * cons
     p->conf = p->defaults; /* copy small struct instead of memcpy() */
     /*memcpy(&p->conf, &p->defaults, sizeof(plugin_config));*/
     for (int i = 1, used = p->nconfig; i < used; ++i) {
-        if (config_check_cond(r, (uint32_t)p->cvlist[i].k_id))
+        if ((i = config_check_cond_next(r, p->cvlist, i, used)) < used)
             mod_authn_file_merge_config(&p->conf,
                                         p->cvlist + p->cvlist[i].v.u2[0]);
     }
@@ -138,6 +206,33 @@ SETDEFAULTS_FUNC(mod_authn_file_set_defaults) {
     if (!config_plugin_values_init(srv, p, cpk, "mod_authn_file"))
         return HANDLER_ERROR;
 
+    /* process and validate config directives
+     * (init i to 0 if global context; to 1 to skip empty global context) */
+    for (int i = !p->cvlist[0].v.u2[1]; i < p->nconfig; ++i) {
+        config_plugin_value_t *cpv = p->cvlist + p->cvlist[i].v.u2[0];
+        for (; -1 != cpv->k_id; ++cpv) {
+            switch (cpv->k_id) {
+              case 0: /* auth.backend.plain.groupfile */
+                break;
+              case 1: /* auth.backend.plain.userfile */
+              case 2: /* auth.backend.htdigest.userfile */
+              case 3: /* auth.backend.htpasswd.userfile */
+                if (!buffer_string_is_empty(cpv->v.b)) {
+                    /* (file is loaded upon first use) */
+                    authn_file_db * const db = calloc(1, sizeof(*db));
+                    force_assert(db);
+                    db->fn = cpv->v.b;
+                    db->realm = (cpv->k_id == 2);
+                    cpv->v.v = db;
+                    cpv->vtype = T_CONFIG_LOCAL;
+                }
+                break;
+              default:/* should not happen */
+                break;
+            }
+        }
+    }
+
     /* initialize p->defaults from global config context */
     if (p->nconfig > 0 && p->cvlist->v.u2[1]) {
         const config_plugin_value_t *cpv = p->cvlist + p->cvlist->v.u2[0];
@@ -207,73 +302,142 @@ static void mod_authn_file_digest(http_auth_info_t *ai, const char *pw, size_t p
 
 
 
-static int mod_authn_file_htdigest_get_loop(FILE *fp, const buffer *auth_fn, http_auth_info_t *ai, log_error_st *errh) {
-    char f_user[1024];
+static uint32_t mod_authn_file_db_hash(const char * const user, const uint32_t ulen, const char * const realm, const uint32_t rlen) {
+    uint32_t h = djbhash(user, ulen, DJBHASH_INIT);
+    if (realm) {
+        h = djbhash(":", 1, h);
+        h = djbhash(realm, rlen, h);
+    }
+    return h;
+}
 
-    while (NULL != fgets(f_user, sizeof(f_user), fp)) {
-        char *f_pwd, *f_realm;
-        size_t u_len, r_len;
+__attribute_cold__
+static void mod_authn_file_db_parse(authn_file_db * const db, char * const data, const uint32_t dlen, log_error_st * const errh) {
+    /* count lines to size entry list and hash table */
+    uint32_t n = 1;
+    for (const char *s = data; (s = memchr(s, '\n', dlen-(s-data))); ++s) ++n;
+    authn_file_entry * const ents = malloc(n * sizeof(authn_file_entry));
+    force_assert(ents);
+    uint32_t mask = 15;
+    while (mask < n * 2) mask = (mask << 1) | 1;
+    uint32_t * const ht = calloc(mask+1, sizeof(uint32_t));
+    force_assert(ht);
+
+    uint32_t used = 0;
+    for (char *line = data, *eol; line < data + dlen; line = eol + 1) {
+        eol = memchr(line, '\n', dlen - (line - data));
+        if (NULL == eol) eol = data + dlen;
 
         /* skip blank lines and comment lines (beginning '#') */
-        if (f_user[0] == '#' || f_user[0] == '\n' || f_user[0] == '\0') continue;
+        if (line[0] == '#' || line == eol || line[0] == '\0') continue;
 
         /*
+         * htpasswd format
+         *
+         * user:crypted passwd
+         *
          * htdigest format
          *
          * user:realm:md5(user:realm:password)
          */
 
-        if (NULL == (f_realm = strchr(f_user, ':'))
-            || NULL == (f_pwd = strchr(f_realm + 1, ':'))) {
-            log_error(errh, __FILE__, __LINE__,
-              "parsed error in %s expected 'username:realm:hashed password'",
-              auth_fn->ptr);
+        char *f_pwd = memchr(line, ':', eol - line);
+        if (NULL != f_pwd && db->realm)
+            f_pwd = memchr(f_pwd + 1, ':', eol - f_pwd - 1);
+        if (NULL == f_pwd) {
+            log_error(errh, __FILE__, __LINE__, db->realm
+              ? "parsed error in %s expected 'username:realm:hashed password'"
+              : "parsed error in %s expected 'username:hashed password'",
+              db->fn->ptr);
             continue; /* skip bad lines */
         }
 
-        /* get pointers to the fields */
-        u_len = f_realm - f_user;
-        f_realm++;
-        r_len = f_pwd - f_realm;
-        f_pwd++;
+        authn_file_entry * const ent = ents + used;
+        ent->k = (uint32_t)(line - data);
+        ent->klen = (uint32_t)(f_pwd - line);
+        ent->v = ent->k + ent->klen + 1;
+        ent->vlen = (uint32_t)(eol - f_pwd - 1);
 
-        if (ai->ulen == u_len && ai->rlen == r_len
-            && 0 == memcmp(ai->username, f_user, u_len)
-            && 0 == memcmp(ai->realm, f_realm, r_len)) {
-            /* found */
+        /* insert after any entries with same key (preserve file order) */
+        uint32_t h = djbhash(line, ent->klen, DJBHASH_INIT) & mask;
+        while (ht[h]) h = (h + 1) & mask;
+        ht[h] = ++used;
+    }
 
-            size_t pwd_len = strlen(f_pwd);
-            if (f_pwd[pwd_len-1] == '\n') --pwd_len;
+    mod_authn_file_db_clear(db);
+    db->data = data;
+    db->dlen = dlen;
+    db->ents = ents;
+    db->used = used;
+    db->ht = ht;
+    db->mask = mask;
+}
 
-            if (pwd_len != (ai->dlen << 1)) continue;
-            return http_auth_digest_hex2bin(f_pwd, pwd_len,
-                                            ai->digest, sizeof(ai->digest));
-        }
+static authn_file_db * mod_authn_file_db_check(authn_file_db * const db, log_error_st * const errh) {
+    /* (re)load file if not yet loaded or if file changed */
+    stat_cache_entry * const sce = stat_cache_get_entry(db->fn);
+    if (NULL == sce) {
+        log_perror(errh, __FILE__, __LINE__, "opening %s", db->fn->ptr);
+        return NULL;
     }
+    if (NULL != db->data
+        && sce->st.st_mtime == db->mtime
+        && sce->st.st_size == db->size
+        && sce->st.st_ino == db->ino)
+        return db;
+
+    off_t dlen = (off_t)UINT32_MAX;
+    char * const data =
+      fdevent_load_file(db->fn->ptr, &dlen, errh, malloc, free);
+    if (NULL == data) /* use previously loaded data, if any */
+        return NULL != db->data ? db : NULL;
+    mod_authn_file_db_parse(db, data, (uint32_t)dlen, errh);
+    db->mtime = sce->st.st_mtime;
+    db->size  = sce->st.st_size;
+    db->ino   = sce->st.st_ino;
+    return db;
+}
 
-    return -1;
+static const authn_file_entry * mod_authn_file_db_next(const authn_file_db * const db, uint32_t * const h, const char * const user, const uint32_t ulen, const char * const realm, const uint32_t rlen) {
+    /* (*h initialized by caller to mod_authn_file_db_hash() & db->mask) */
+    const uint32_t klen = realm ? ulen + 1 + rlen : ulen;
+    for (uint32_t x; (x = db->ht[*h]); *h = (*h + 1) & db->mask) {
+        const authn_file_entry * const ent = db->ents + x - 1;
+        const char * const k = db->data + ent->k;
+        if (ent->klen == klen && 0 == memcmp(k, user, ulen)
+            && (NULL == realm
+                || (k[ulen] == ':' && 0 == memcmp(k+ulen+1, realm, rlen)))) {
+            *h = (*h + 1) & db->mask;
+            return ent;
+        }
+    }
+    return NULL;
 }
 
 static int mod_authn_file_htdigest_get(request_st * const r, void *p_d, http_auth_info_t * const ai) {
     plugin_data *p = (plugin_data *)p_d;
-    const buffer *auth_fn;
-    FILE *fp;
+    authn_file_db *db;
 
     mod_authn_file_patch_config(r, p);
-    auth_fn = p->conf.auth_htdigest_userfile;
-    if (buffer_string_is_empty(auth_fn)) return -1;
-
-    fp = fopen(auth_fn->ptr, "r");
-    if (NULL != fp) {
-        int rc = mod_authn_file_htdigest_get_loop(fp,auth_fn,ai,r->conf.errh);
-        fclose(fp);
-        return rc;
-    }
-    else {
-        log_perror(r->conf.errh, __FILE__, __LINE__,
-          "opening digest-userfile %s", auth_fn->ptr);
-        return -1;
+    db = p->conf.auth_htdigest_userfile;
+    if (NULL == db) return -1;
+    db = mod_authn_file_db_check(db, r->conf.errh);
+    if (NULL == db) return -1;
+
+    uint32_t h = mod_authn_file_db_hash(ai->username, (uint32_t)ai->ulen,
+                                        ai->realm, (uint32_t)ai->rlen)
+               & db->mask;
+    const authn_file_entry *ent;
+    while ((ent = mod_authn_file_db_next(db, &h, ai->username,
+                                         (uint32_t)ai->ulen,
+                                         ai->realm, (uint32_t)ai->rlen))) {
+        /* found */
+        if (ent->vlen != (ai->dlen << 1)) continue;
+        return http_auth_digest_hex2bin(db->data + ent->v, ent->vlen,
+                                        ai->digest, sizeof(ai->digest));
     }
+
+    return -1;
 }
 
 static handler_t mod_authn_file_htdigest_digest(request_st * const r, void *p_d, http_auth_info_t * const ai) {
@@ -310,60 +474,22 @@ static handler_t mod_authn_file_htdigest_basic(request_st * const r, void *p_d,
 
 
 
-static int mod_authn_file_htpasswd_get(const buffer *auth_fn, const char *username, size_t userlen, buffer *password, log_error_st *errh) {
-    FILE *fp;
-    char f_user[1024];
-
+static int mod_authn_file_htpasswd_get(authn_file_db *db, const char *username, size_t userlen, buffer *password, log_error_st *errh) {
     if (NULL == username) return -1;
 
-    if (buffer_string_is_empty(auth_fn)) return -1;
-    fp = fopen(auth_fn->ptr, "r");
-    if (NULL == fp) {
-        log_perror(errh, __FILE__, __LINE__,
-                "opening plain-userfile %s", auth_fn->ptr);
+    if (NULL == db) return -1;
+    db = mod_authn_file_db_check(db, errh);
+    if (NULL == db) return -1;
 
-        return -1;
-    }
+    uint32_t h = mod_authn_file_db_hash(username, (uint32_t)userlen, NULL, 0)
+               & db->mask;
+    const authn_file_entry * const ent =
+      mod_authn_file_db_next(db, &h, username, (uint32_t)userlen, NULL, 0);
+    if (NULL == ent) return -1;
 
-    while (NULL != fgets(f_user, sizeof(f_user), fp)) {
-        char *f_pwd;
-        size_t u_len;
-
-        /* skip blank lines and comment lines (beginning '#') */
-        if (f_user[0] == '#' || f_user[0] == '\n' || f_user[0] == '\0') continue;
-
-        /*
-         * htpasswd format
-         *
-         * user:crypted passwd
-         */
-
-        if (NULL == (f_pwd = strchr(f_user, ':'))) {
-            log_error(errh, __FILE__, __LINE__,
-              "parsed error in %s expected 'username:hashed password'",
-              auth_fn->ptr);
-            continue; /* skip bad lines */
-        }
-
-        /* get pointers to the fields */
-        u_len = f_pwd - f_user;
-        f_pwd++;
-
-        if (userlen == u_len && 0 == memcmp(username, f_user, u_len)) {
-            /* found */
-
-            size_t pwd_len = strlen(f_pwd);
-            if (f_pwd[pwd_len-1] == '\n') --pwd_len;
-
-            buffer_copy_string_len(password, f_pwd, pwd_len);
-
-            fclose(fp);
-            return 0;
-        }
-    }
-
-    fclose(fp);
-    return -1;
+    /* found */
+    buffer_copy_string_len(password, db->data + ent->v, ent->vlen);
+    return 0;
 }
 
 static handler_t mod_authn_file_plain_digest(request_st * const r, void *p_d, http_auth_info_t * const ai) {
@@ -715,6 +841,7 @@ int mod_authn_file_plugin_init(plugin *p) {
     p->name        = "authn_file";
     p->init        = mod_authn_file_init;
     p->set_defaults= mod_authn_file_set_defaults;
+    p->cleanup     = mod_authn_file_free;
 
     return 0;
 }
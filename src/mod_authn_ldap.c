@@ -9,17 +9,25 @@
 
 #include <ldap.h>
 
+/* LDAP calls are made in async_pool worker threads.  libldap in OpenLDAP < 2.5
+ * is not thread-safe; the thread-safe libldap_r must be linked instead */
+#if defined(LDAP_API_FEATURE_X_OPENLDAP) && defined(LDAP_VENDOR_VERSION) \
+ && LDAP_VENDOR_VERSION < 20500 && !defined(HAVE_LIBLDAP_R)
+#error "OpenLDAP < 2.5 requires libldap_r (thread-safe libldap)"
+#endif
+
+#include "async_pool.h"
 #include "base.h"
 #include "http_auth.h"
 #include "log.h"
 #include "plugin.h"
+#include "safe_memclear.h"
 
 #include <stdlib.h>
 #include <string.h>
 
 typedef struct {
-    LDAP *ldap;
-    log_error_st *errh;
+    uint32_t ndx;           /* index into per-thread connections */
     const char *auth_ldap_hostname;
     const char *auth_ldap_binddn;
     const char *auth_ldap_bindpw;
@@ -46,9 +54,36 @@ typedef struct {
     plugin_config defaults;
     plugin_config conf;
 
-    buffer ldap_filter;
+    uint32_t nldc;
+    async_pool *pool;
 } plugin_data;
 
+/* LDAP connection kept open by each worker thread for each
+ * auth.backend.ldap.hostname (LDAP calls are synchronous and blocking,
+ * and are made in async_pool worker threads) */
+typedef struct {
+    LDAP *ldap;
+    log_error_st *errh;
+    const plugin_config_ldap *s;
+} mod_authn_ldap_conn;
+
+typedef struct {
+    uint32_t used;
+    mod_authn_ldap_conn c[];
+} mod_authn_ldap_tctx;
+
+typedef struct {
+    async_job job;          /* (must be first member) */
+    handler_t rc;
+    plugin_config conf;     /* (conf.ldc might point to ldc_custom) */
+    plugin_config_ldap *ldc_base;
+    plugin_config_ldap ldc_custom;
+    const http_auth_require_t *require;
+    buffer username;
+    buffer ldap_filter;
+    char *pw;
+} mod_authn_ldap_job;
+
 static handler_t mod_authn_ldap_basic(request_st * const r, void *p_d, const http_auth_require_t *require, const buffer *username, const char *pw);
 
 INIT_FUNC(mod_authn_ldap_init) {
@@ -65,6 +100,7 @@ INIT_FUNC(mod_authn_ldap_init) {
 
 FREE_FUNC(mod_authn_ldap_free) {
     plugin_data * const p = p_d;
+    async_pool_free(p->pool); /*(before freeing config used by threads)*/
     if (NULL == p->cvlist) return;
     /* (init i to 0 if global context; to 1 to skip empty global context) */
     for (int i = !p->cvlist[0].v.u2[1], used = p->nconfig; i < used; ++i) {
@@ -72,19 +108,14 @@ FREE_FUNC(mod_authn_ldap_free) {
         for (; -1 != cpv->k_id; ++cpv) {
             switch (cpv->k_id) {
               case 0: /* auth.backend.ldap.hostname */
-                if (cpv->vtype == T_CONFIG_LOCAL) {
-                    plugin_config_ldap *s = cpv->v.v;
-                    if (NULL != s->ldap) ldap_unbind_ext_s(s->ldap, NULL, NULL);
-                    free(s);
-                }
+                if (cpv->vtype == T_CONFIG_LOCAL)
+                    free(cpv->v.v);
                 break;
               default:
                 break;
             }
         }
     }
-
-    free(p->ldap_filter.ptr);
 }
 
 static void mod_authn_ldap_merge_config_cpv(plugin_config * const pconf, const config_plugin_value_t * const cpv) {
@@ -123,6 +154,8 @@ static void mod_authn_ldap_merge_config_cpv(plugin_config * const pconf, const c
          * supported in same scope as auth.backend.ldap.hostname)*/
         /*pconf->auth_ldap_timeout = cpv->v.b;*/
         break;
+      case 10:/* auth.backend.ldap.threads */
+        break;
       default:/* should not happen */
         return;
     }
@@ -137,7 +170,7 @@ static void mod_authn_ldap_merge_config(plugin_config * const pconf, const confi
 static void mod_authn_ldap_patch_config(request_st * const r, plugin_data * const p) {
     memcpy(&p->conf, &p->defaults, sizeof(plugin_config));
     for (int i = 1, used = p->nconfig; i < used; ++i) {
-        if (config_check_cond(r, (uint32_t)p->cvlist[i].k_id))
+        if ((i = config_check_cond_next(r, p->cvlist, i, used)) < used)
             mod_authn_ldap_merge_config(&p->conf,
                                         p->cvlist + p->cvlist[i].v.u2[0]);
     }
@@ -176,6 +209,26 @@ static void mod_authn_add_scheme (server *srv, buffer *host)
     }
 }
 
+static void * mod_authn_ldap_tctx_init (void * const ctx) {
+    const plugin_data * const p = ctx;
+    mod_authn_ldap_tctx * const tctx =
+      calloc(1, sizeof(mod_authn_ldap_tctx)
+                + p->nldc * sizeof(mod_authn_ldap_conn));
+    force_assert(tctx);
+    tctx->used = p->nldc;
+    return tctx;
+}
+
+static void mod_authn_ldap_tctx_free (void * const ctx) {
+    mod_authn_ldap_tctx * const tctx = ctx;
+    if (NULL == tctx) return;
+    for (uint32_t i = 0; i < tctx->used; ++i) {
+        if (NULL != tctx->c[i].ldap)
+            ldap_unbind_ext_s(tctx->c[i].ldap, NULL, NULL);
+    }
+    free(tctx);
+}
+
 SETDEFAULTS_FUNC(mod_authn_ldap_set_defaults) {
     static const config_plugin_keys_t cpk[] = {
       { CONST_STR_LEN("auth.backend.ldap.hostname"),
@@ -208,6 +261,9 @@ SETDEFAULTS_FUNC(mod_authn_ldap_set_defaults) {
      ,{ CONST_STR_LEN("auth.backend.ldap.timeout"),
         T_CONFIG_STRING,
         T_CONFIG_SCOPE_CONNECTION }
+     ,{ CONST_STR_LEN("auth.backend.ldap.threads"),
+        T_CONFIG_SHORT,
+        T_CONFIG_SCOPE_SERVER }
      ,{ NULL, 0,
         T_CONFIG_UNSET,
         T_CONFIG_SCOPE_UNSET }
@@ -217,6 +273,8 @@ SETDEFAULTS_FUNC(mod_authn_ldap_set_defaults) {
     if (!config_plugin_values_init(srv, p, cpk, "mod_authn_ldap"))
         return HANDLER_ERROR;
 
+    unsigned short nthreads = 4;
+
     /* process and validate config directives
      * (init i to 0 if global context; to 1 to skip empty global context) */
     for (int i = !p->cvlist[0].v.u2[1]; i < p->nconfig; ++i) {
@@ -234,7 +292,7 @@ SETDEFAULTS_FUNC(mod_authn_ldap_set_defaults) {
                     mod_authn_add_scheme(srv, b);
                     ldc = malloc(sizeof(plugin_config_ldap));
                     force_assert(ldc);
-                    ldc->errh = srv->errh;
+                    ldc->ndx = p->nldc++;
                     ldc->auth_ldap_hostname = b->ptr;
                     cpv->v.v = ldc;
                 }
@@ -298,6 +356,9 @@ SETDEFAULTS_FUNC(mod_authn_ldap_set_defaults) {
               case 9: /* auth.backend.ldap.timeout */
                 timeout = strtol(cpv->v.b->ptr, NULL, 10);
                 break;
+              case 10:/* auth.backend.ldap.threads */
+                nthreads = cpv->v.shrt;
+                break;
               default:/* should not happen */
                 break;
             }
@@ -325,6 +386,11 @@ SETDEFAULTS_FUNC(mod_authn_ldap_set_defaults) {
             mod_authn_ldap_merge_config(&p->defaults, cpv);
     }
 
+    if (p->nldc)
+        p->pool = async_pool_init("mod_authn_ldap", nthreads,
+                                  mod_authn_ldap_tctx_init,
+                                  mod_authn_ldap_tctx_free, p);
+
     return HANDLER_GO_ON;
 }
 
@@ -473,7 +539,7 @@ static void mod_authn_append_ldap_filter_escape(buffer * const filter, const buf
     }
 }
 
-static LDAP * mod_authn_ldap_host_init(log_error_st *errh, plugin_config_ldap *s) {
+static LDAP * mod_authn_ldap_host_init(log_error_st *errh, const plugin_config_ldap *s) {
     LDAP *ld;
     int ret;
 
@@ -552,18 +618,19 @@ static int mod_authn_ldap_bind(log_error_st *errh, LDAP *ld, const char *dn, con
 }
 
 static int mod_authn_ldap_rebind_proc (LDAP *ld, LDAP_CONST char *url, ber_tag_t ldap_request, ber_int_t msgid, void *params) {
-    const plugin_config_ldap *s = (const plugin_config_ldap *)params;
+    const mod_authn_ldap_conn * const c = (const mod_authn_ldap_conn *)params;
+    const plugin_config_ldap * const s = c->s;
     UNUSED(url);
     UNUSED(ldap_request);
     UNUSED(msgid);
     return s->auth_ldap_binddn
-      ? mod_authn_ldap_bind(s->errh, ld,
+      ? mod_authn_ldap_bind(c->errh, ld,
                             s->auth_ldap_binddn,
                             s->auth_ldap_bindpw)
-      : mod_authn_ldap_bind(s->errh, ld, NULL, NULL);
+      : mod_authn_ldap_bind(c->errh, ld, NULL, NULL);
 }
 
-static LDAPMessage * mod_authn_ldap_search(log_error_st *errh, plugin_config_ldap *s, const char *base, const char *filter) {
+static LDAPMessage * mod_authn_ldap_search(mod_authn_ldap_conn *c, const char *base, const char *filter) {
     LDAPMessage *lm = NULL;
     char *attrs[] = { LDAP_NO_ATTRS, NULL };
     int ret;
@@ -574,62 +641,63 @@ static LDAPMessage * mod_authn_ldap_search(log_error_st *errh, plugin_config_lda
      * 2. issue search using filter
      */
 
-    if (s->ldap != NULL) {
-        ret = ldap_search_ext_s(s->ldap, base, LDAP_SCOPE_SUBTREE, filter,
+    if (c->ldap != NULL) {
+        ret = ldap_search_ext_s(c->ldap, base, LDAP_SCOPE_SUBTREE, filter,
                                 attrs, 0, NULL, NULL, NULL, 0, &lm);
         if (LDAP_SUCCESS == ret) {
             return lm;
         } else if (LDAP_SERVER_DOWN != ret) {
             /* try again (or initial request);
              * ldap lib sometimes fails for the first call but reconnects */
-            ret = ldap_search_ext_s(s->ldap, base, LDAP_SCOPE_SUBTREE, filter,
+            ret = ldap_search_ext_s(c->ldap, base, LDAP_SCOPE_SUBTREE, filter,
                                     attrs, 0, NULL, NULL, NULL, 0, &lm);
             if (LDAP_SUCCESS == ret) {
                 return lm;
             }
         }
 
-        ldap_unbind_ext_s(s->ldap, NULL, NULL);
+        ldap_unbind_ext_s(c->ldap, NULL, NULL);
     }
 
-    s->ldap = mod_authn_ldap_host_init(errh, s);
-    if (NULL == s->ldap) {
+    c->ldap = mod_authn_ldap_host_init(c->errh, c->s);
+    if (NULL == c->ldap) {
         return NULL;
     }
 
-    ldap_set_rebind_proc(s->ldap, mod_authn_ldap_rebind_proc, s);
-    ret = mod_authn_ldap_rebind_proc(s->ldap, NULL, 0, 0, s);
+    ldap_set_rebind_proc(c->ldap, mod_authn_ldap_rebind_proc, c);
+    ret = mod_authn_ldap_rebind_proc(c->ldap, NULL, 0, 0, c);
     if (LDAP_SUCCESS != ret) {
-        ldap_destroy(s->ldap);
-        s->ldap = NULL;
+        ldap_destroy(c->ldap);
+        c->ldap = NULL;
         return NULL;
     }
 
-    ret = ldap_search_ext_s(s->ldap, base, LDAP_SCOPE_SUBTREE, filter,
+    ret = ldap_search_ext_s(c->ldap, base, LDAP_SCOPE_SUBTREE, filter,
                             attrs, 0, NULL, NULL, NULL, 0, &lm);
     if (LDAP_SUCCESS != ret) {
-        log_error(errh, __FILE__, __LINE__,
+        log_error(c->errh, __FILE__, __LINE__,
           "ldap: %s; filter: %s", ldap_err2string(ret), filter);
-        ldap_unbind_ext_s(s->ldap, NULL, NULL);
-        s->ldap = NULL;
+        ldap_unbind_ext_s(c->ldap, NULL, NULL);
+        c->ldap = NULL;
         return NULL;
     }
 
     return lm;
 }
 
-static char * mod_authn_ldap_get_dn(log_error_st *errh, plugin_config_ldap *s, const char *base, const char *filter) {
+static char * mod_authn_ldap_get_dn(mod_authn_ldap_conn *c, const char *base, const char *filter) {
+    log_error_st * const errh = c->errh;
     LDAP *ld;
     LDAPMessage *lm, *first;
     char *dn;
     int count;
 
-    lm = mod_authn_ldap_search(errh, s, base, filter);
+    lm = mod_authn_ldap_search(c, base, filter);
     if (NULL == lm) {
         return NULL;
     }
 
-    ld = s->ldap; /*(must be after mod_authn_ldap_search(); might reconnect)*/
+    ld = c->ldap; /*(must be after mod_authn_ldap_search(); might reconnect)*/
 
     count = ldap_count_entries(ld, lm);
     if (0 == count) { /*(no entries found)*/
@@ -657,7 +725,7 @@ static char * mod_authn_ldap_get_dn(log_error_st *errh, plugin_config_ldap *s, c
     return dn;
 }
 
-static handler_t mod_authn_ldap_memberOf(log_error_st *errh, plugin_config *s, const http_auth_require_t *require, const buffer *username, const char *userdn) {
+static handler_t mod_authn_ldap_memberOf(mod_authn_ldap_conn *c, plugin_config *s, const http_auth_require_t *require, const buffer *username, const char *userdn) {
     const array *groups = &require->group;
     buffer *filter = buffer_init();
     handler_t rc = HANDLER_ERROR;
@@ -673,12 +741,11 @@ static handler_t mod_authn_ldap_memberOf(log_error_st *errh, plugin_config *s, c
     }
     buffer_append_string_len(filter, CONST_STR_LEN(")"));
 
-    plugin_config_ldap * const ldc = s->ldc;
     for (size_t i = 0; i < groups->used; ++i) {
         const char *base = groups->data[i]->key.ptr;
-        LDAPMessage *lm = mod_authn_ldap_search(errh, ldc, base, filter->ptr);
+        LDAPMessage *lm = mod_authn_ldap_search(c, base, filter->ptr);
         if (NULL != lm) {
-            int count = ldap_count_entries(ldc->ldap, lm);
+            int count = ldap_count_entries(c->ldap, lm);
             ldap_msgfree(lm);
             if (count > 0) {
                 rc = HANDLER_GO_ON;
@@ -691,31 +758,112 @@ static handler_t mod_authn_ldap_memberOf(log_error_st *errh, plugin_config *s, c
     return rc;
 }
 
-static handler_t mod_authn_ldap_basic(request_st * const r, void *p_d, const http_auth_require_t * const require, const buffer * const username, const char * const pw) {
-    plugin_data *p = (plugin_data *)p_d;
+static void mod_authn_ldap_job_run(async_job * const job, void * const tctx, log_error_st * const errh) {
+    /* (called in worker thread) */
+    mod_authn_ldap_job * const lj = (mod_authn_ldap_job *)job;
+    const http_auth_require_t * const require = lj->require;
+    const buffer * const username = &lj->username;
+    mod_authn_ldap_tctx * const t = tctx;
     LDAP *ld;
     char *dn;
 
-    mod_authn_ldap_patch_config(r, p);
+    lj->rc = HANDLER_ERROR;
+
+    mod_authn_ldap_conn * const c = t->c + lj->ldc_base->ndx;
+    c->s = lj->ldc_base;
+    c->errh = errh;
+
+    if (*lj->conf.auth_ldap_filter->ptr == ',') {
+        /* special-case filter template beginning with ',' to be explicit DN */
+        dn = lj->ldap_filter.ptr;
+    }
+    else {
+        /* ldap_search for DN (synchronous; blocking) */
+        dn = mod_authn_ldap_get_dn(c, lj->conf.auth_ldap_basedn,
+                                   lj->ldap_filter.ptr);
+        if (NULL == dn) return;
+    }
+
+    /* (connection for ldc_custom is not kept open after this request) */
+    mod_authn_ldap_conn ccustom = { NULL, errh, &lj->ldc_custom };
+    mod_authn_ldap_conn * const cc =
+      (lj->conf.ldc == lj->ldc_base) ? c : &ccustom;
+
+    do {
+        /* auth against LDAP server (synchronous; blocking) */
+
+        ld = mod_authn_ldap_host_init(errh, lj->conf.ldc);
+        if (NULL == ld)
+            break;
+
+        /* Disable referral tracking; target user should be in provided scope */
+        int ret = ldap_set_option(ld, LDAP_OPT_REFERRALS, LDAP_OPT_OFF);
+        if (LDAP_OPT_SUCCESS != ret) {
+            mod_authn_ldap_err(errh,__FILE__,__LINE__,"ldap_set_option()",ret);
+            break;
+        }
+
+        if (LDAP_SUCCESS != mod_authn_ldap_bind(errh, ld, dn, lj->pw))
+            break;
+
+        ldap_unbind_ext_s(ld, NULL, NULL); /* disconnect */
+        ld = NULL;
+
+        if (http_auth_match_rules(require, username->ptr, NULL, NULL)) {
+            lj->rc = HANDLER_GO_ON; /* access granted */
+        }
+        else if (require->group.used) {
+            /*(must not re-use ldap_filter, since it might be used for dn)*/
+            lj->rc = mod_authn_ldap_memberOf(cc, &lj->conf, require,
+                                             username, dn);
+        }
+    } while (0);
+
+    if (NULL != ld) ldap_destroy(ld);
+    if (NULL != ccustom.ldap) ldap_unbind_ext_s(ccustom.ldap, NULL, NULL);
+    if (dn != lj->ldap_filter.ptr) ldap_memfree(dn);
+}
+
+static void mod_authn_ldap_job_free(async_job * const job) {
+    mod_authn_ldap_job * const lj = (mod_authn_ldap_job *)job;
+    free(lj->username.ptr);
+    free(lj->ldap_filter.ptr);
+    safe_memclear(lj->pw, strlen(lj->pw));
+    free(lj->pw);
+    free(lj);
+}
 
+static mod_authn_ldap_job * mod_authn_ldap_job_init(plugin_data * const p, const http_auth_require_t * const require, const buffer * const username, const char * const pw) {
     if (pw[0] == '\0' && !p->conf.auth_ldap_allow_empty_pw)
-        return HANDLER_ERROR;
+        return NULL;
 
     const buffer * const template = p->conf.auth_ldap_filter;
     if (NULL == template)
-        return HANDLER_ERROR;
+        return NULL;
 
-    log_error_st * const errh = r->conf.errh;
+    plugin_config_ldap * const ldc_base = p->conf.ldc;
+    if (NULL == ldc_base) /*(auth.backend.ldap.hostname not set)*/
+        return NULL;
+
+    mod_authn_ldap_job * const lj = calloc(1, sizeof(mod_authn_ldap_job));
+    force_assert(lj);
+    lj->job.run  = mod_authn_ldap_job_run;
+    lj->job.free = mod_authn_ldap_job_free;
+    lj->rc = HANDLER_ERROR;
+    lj->require = require;
+    lj->conf = p->conf;
+    lj->ldc_base = ldc_base;
+    buffer_copy_buffer(&lj->username, username);
+    lj->pw = strdup(pw);
+    force_assert(lj->pw);
 
     /* build filter to get DN for uid = username */
-    buffer * const ldap_filter = &p->ldap_filter;
-    buffer_clear(ldap_filter);
+    buffer * const ldap_filter = &lj->ldap_filter;
     if (*template->ptr == ',') {
         /* special-case filter template beginning with ',' to be explicit DN */
         buffer_append_string_len(ldap_filter, CONST_STR_LEN("uid="));
         mod_authn_append_ldap_dn_escape(ldap_filter, username);
         buffer_append_string_buffer(ldap_filter, template);
-        dn = ldap_filter->ptr;
     }
     else {
         for (const char *b = template->ptr, *d; *b; b = d+1) {
@@ -729,11 +877,6 @@ static handler_t mod_authn_ldap_basic(request_st * const r, void *p_d, const htt
                 break;
             }
         }
-
-        /* ldap_search for DN (synchronous; blocking) */
-        dn = mod_authn_ldap_get_dn(errh, p->conf.ldc,
-                                   p->conf.auth_ldap_basedn, ldap_filter->ptr);
-        if (NULL == dn) return HANDLER_ERROR;
     }
 
     /*(Check ldc here rather than further up to preserve historical behavior
@@ -741,67 +884,64 @@ static handler_t mod_authn_ldap_basic(request_st * const r, void *p_d, const htt
      * same context as auth_ldap_hostname.  Preference: admin intentions are
      * clearer if directives are always together in a set in same context)*/
 
-    plugin_config_ldap * const ldc_base = p->conf.ldc;
-    plugin_config_ldap ldc_custom;
-
-    if ( p->conf.ldc->auth_ldap_starttls != p->conf.auth_ldap_starttls
-        || p->conf.ldc->auth_ldap_binddn != p->conf.auth_ldap_binddn
-        || p->conf.ldc->auth_ldap_bindpw != p->conf.auth_ldap_bindpw
-        || p->conf.ldc->auth_ldap_cafile != p->conf.auth_ldap_cafile ) {
-        ldc_custom.ldap = NULL;
-        ldc_custom.errh = errh;
-        ldc_custom.auth_ldap_hostname = ldc_base->auth_ldap_hostname;
-        ldc_custom.auth_ldap_starttls = p->conf.auth_ldap_starttls;
-        ldc_custom.auth_ldap_binddn = p->conf.auth_ldap_binddn;
-        ldc_custom.auth_ldap_bindpw = p->conf.auth_ldap_bindpw;
-        ldc_custom.auth_ldap_cafile = p->conf.auth_ldap_cafile;
-        ldc_custom.auth_ldap_timeout= ldc_base->auth_ldap_timeout;
-        p->conf.ldc = &ldc_custom;
+    if ( ldc_base->auth_ldap_starttls != p->conf.auth_ldap_starttls
+        || ldc_base->auth_ldap_binddn != p->conf.auth_ldap_binddn
+        || ldc_base->auth_ldap_bindpw != p->conf.auth_ldap_bindpw
+        || ldc_base->auth_ldap_cafile != p->conf.auth_ldap_cafile ) {
+        plugin_config_ldap * const ldc_custom = &lj->ldc_custom;
+        ldc_custom->ndx = ldc_base->ndx;
+        ldc_custom->auth_ldap_hostname = ldc_base->auth_ldap_hostname;
+        ldc_custom->auth_ldap_starttls = p->conf.auth_ldap_starttls;
+        ldc_custom->auth_ldap_binddn = p->conf.auth_ldap_binddn;
+        ldc_custom->auth_ldap_bindpw = p->conf.auth_ldap_bindpw;
+        ldc_custom->auth_ldap_cafile = p->conf.auth_ldap_cafile;
+        ldc_custom->auth_ldap_timeout= ldc_base->auth_ldap_timeout;
+        lj->conf.ldc = ldc_custom;
     }
 
-    handler_t rc = HANDLER_ERROR;
-    do {
-        /* auth against LDAP server (synchronous; blocking) */
-
-        ld = mod_authn_ldap_host_init(errh, p->conf.ldc);
-        if (NULL == ld)
-            break;
-
-        /* Disable referral tracking; target user should be in provided scope */
-        int ret = ldap_set_option(ld, LDAP_OPT_REFERRALS, LDAP_OPT_OFF);
-        if (LDAP_OPT_SUCCESS != ret) {
-            mod_authn_ldap_err(errh,__FILE__,__LINE__,"ldap_set_option()",ret);
-            break;
-        }
-
-        if (LDAP_SUCCESS != mod_authn_ldap_bind(errh, ld, dn, pw))
-            break;
+    return lj;
+}
 
-        ldap_unbind_ext_s(ld, NULL, NULL); /* disconnect */
-        ld = NULL;
+static handler_t mod_authn_ldap_basic(request_st * const r, void *p_d, const http_auth_require_t * const require, const buffer * const username, const char * const pw) {
+    plugin_data *p = (plugin_data *)p_d;
 
-        if (http_auth_match_rules(require, username->ptr, NULL, NULL)) {
-            rc = HANDLER_GO_ON; /* access granted */
-        }
-        else if (require->group.used) {
-            /*(must not re-use ldap_filter, since it might be used for dn)*/
-            rc = mod_authn_ldap_memberOf(errh,&p->conf,require,username,dn);
-        }
-    } while (0);
+    mod_authn_ldap_job *lj = r->plugin_ctx[p->id];
+    if (NULL == lj) {
+        mod_authn_ldap_patch_config(r, p);
+        lj = mod_authn_ldap_job_init(p, require, username, pw);
+        if (NULL == lj)
+            return HANDLER_ERROR;
+        r->plugin_ctx[p->id] = lj;
+        /* LDAP calls are made in worker thread (synchronous; blocking) */
+        if (async_pool_submit(p->pool, r, &lj->job))
+            return HANDLER_WAIT_FOR_EVENT;
+    }
+    else if (!lj->job.done)
+        return HANDLER_WAIT_FOR_EVENT;
 
-    if (NULL != ld) ldap_destroy(ld);
-    if (ldc_base != p->conf.ldc && NULL != p->conf.ldc->ldap)
-        ldap_unbind_ext_s(p->conf.ldc->ldap, NULL, NULL);
-    if (dn != ldap_filter->ptr) ldap_memfree(dn);
+    r->plugin_ctx[p->id] = NULL;
+    const handler_t rc = lj->rc;
+    mod_authn_ldap_job_free(&lj->job);
     return rc;
 }
 
+REQUEST_FUNC(mod_authn_ldap_handle_reset) {
+    plugin_data * const p = p_d;
+    mod_authn_ldap_job * const lj = r->plugin_ctx[p->id];
+    if (NULL != lj) {
+        r->plugin_ctx[p->id] = NULL;
+        async_job_detach(&lj->job);
+    }
+    return HANDLER_GO_ON;
+}
+
 int mod_authn_ldap_plugin_init(plugin *p);
 int mod_authn_ldap_plugin_init(plugin *p) {
     p->version     = LIGHTTPD_VERSION_ID;
     p->name        = "authn_ldap";
     p->init        = mod_authn_ldap_init;
     p->set_defaults = mod_authn_ldap_set_defaults;
+    p->handle_request_reset = mod_authn_ldap_handle_reset;
     p->cleanup     = mod_authn_ldap_free;
 
     return 0;
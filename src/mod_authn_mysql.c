@@ -10,10 +10,11 @@
  *     (or limit number of entries (size) of cache)
  *     (maybe have negative cache (limited size) of names not found in database)
  * - database query is synchronous and blocks waiting for response
- *   TODO: https://mariadb.com/kb/en/mariadb/using-the-non-blocking-library/
+ *   (fixed) queries are made in async_pool worker threads
+ *   (auth.backend.mysql.threads, default 4)
  * - opens and closes connection to MySQL db for each request (inefficient)
- *   (fixed) one-element cache for persistent connection open to last used db
- *   TODO: db connection pool (if asynchronous requests)
+ *   (fixed) each worker thread keeps a one-element cache for persistent
+ *   connection open to last used db
  */
 #include "first.h"
 
@@ -26,9 +27,13 @@
 #ifdef HAVE_CRYPT_H
 #include <crypt.h>
 #endif
+#if !defined(HAVE_CRYPT_R) && defined(HAVE_CRYPT) && defined(HAVE_PTHREAD_H)
+#include <pthread.h>
+#endif
 
 #include <mysql.h>
 
+#include "async_pool.h"
 #include "base.h"
 #include "http_auth.h"
 #include "log.h"
@@ -52,7 +57,6 @@ typedef struct {
     const char *auth_mysql_col_user;
     const char *auth_mysql_col_pass;
     const char *auth_mysql_col_realm;
-    log_error_st *errh;
 } plugin_config;
 
 typedef struct {
@@ -60,39 +64,56 @@ typedef struct {
     plugin_config defaults;
     plugin_config conf;
 
+    async_pool *pool;
+} plugin_data;
+
+/* MySQL connection kept open by each worker thread
+ * (one-element cache for persistent connection open to last used db) */
+typedef struct {
     MYSQL *mysql_conn;
     const char *mysql_conn_host;
     const char *mysql_conn_user;
     const char *mysql_conn_pass;
     const char *mysql_conn_db;
     int mysql_conn_port;
-} plugin_data;
+    log_error_st *errh;
+} mod_authn_mysql_tctx;
 
-static void mod_authn_mysql_sock_close(void *p_d) {
-    plugin_data * const p = p_d;
-    if (NULL != p->mysql_conn) {
-        mysql_close(p->mysql_conn);
-        p->mysql_conn = NULL;
+typedef struct {
+    async_job job;          /* (must be first member) */
+    handler_t rc;
+    plugin_config conf;
+    http_auth_info_t ai;    /* (ai.username and ai.realm point into job) */
+    buffer username;
+    buffer realm;
+    char *pw;               /* (NULL if HTTP Digest auth) */
+} mod_authn_mysql_job;
+
+static void mod_authn_mysql_sock_close(mod_authn_mysql_tctx * const t) {
+    if (NULL != t->mysql_conn) {
+        mysql_close(t->mysql_conn);
+        t->mysql_conn = NULL;
     }
 }
 
-static MYSQL * mod_authn_mysql_sock_connect(plugin_data *p) {
-    plugin_config * const pconf = &p->conf;
-    if (NULL != p->mysql_conn) {
+static MYSQL * mod_authn_mysql_sock_connect(mod_authn_mysql_tctx * const t, const plugin_config * const pconf) {
+    if (NULL != t->mysql_conn) {
         /* reuse open db connection if same ptrs to host user pass db port */
-        if (   p->mysql_conn_host == pconf->auth_mysql_host
-            && p->mysql_conn_user == pconf->auth_mysql_user
-            && p->mysql_conn_pass == pconf->auth_mysql_pass
-            && p->mysql_conn_db   == pconf->auth_mysql_db
-            && p->mysql_conn_port == pconf->auth_mysql_port) {
-            return p->mysql_conn;
+        if (   t->mysql_conn_host == pconf->auth_mysql_host
+            && t->mysql_conn_user == pconf->auth_mysql_user
+            && t->mysql_conn_pass == pconf->auth_mysql_pass
+            && t->mysql_conn_db   == pconf->auth_mysql_db
+            && t->mysql_conn_port == pconf->auth_mysql_port) {
+            return t->mysql_conn;
         }
-        mod_authn_mysql_sock_close(p);
+        mod_authn_mysql_sock_close(t);
     }
 
-    /* !! mysql_init() is not thread safe !! (see MySQL doc) */
-    p->mysql_conn = mysql_init(NULL);
-    if (mysql_real_connect(p->mysql_conn,
+    /* (mysql_init() is thread-safe after mysql_library_init(), which is
+     *  called in mod_authn_mysql_set_defaults(), and mysql_thread_init(),
+     *  which is called in mod_authn_mysql_tctx_init()) */
+    t->mysql_conn = mysql_init(NULL);
+    if (mysql_real_connect(t->mysql_conn,
                            pconf->auth_mysql_host,
                            pconf->auth_mysql_user,
                            pconf->auth_mysql_pass,
@@ -103,43 +124,60 @@ static MYSQL * mod_authn_mysql_sock_connect(plugin_data *p) {
                              : NULL,
                            CLIENT_IGNORE_SIGPIPE)) {
         /* (copy ptrs to plugin data (has lifetime until server shutdown)) */
-        p->mysql_conn_host = pconf->auth_mysql_host;
-        p->mysql_conn_user = pconf->auth_mysql_user;
-        p->mysql_conn_pass = pconf->auth_mysql_pass;
-        p->mysql_conn_db   = pconf->auth_mysql_db;
-        p->mysql_conn_port = pconf->auth_mysql_port;
-        return p->mysql_conn;
+        t->mysql_conn_host = pconf->auth_mysql_host;
+        t->mysql_conn_user = pconf->auth_mysql_user;
+        t->mysql_conn_pass = pconf->auth_mysql_pass;
+        t->mysql_conn_db   = pconf->auth_mysql_db;
+        t->mysql_conn_port = pconf->auth_mysql_port;
+        return t->mysql_conn;
     }
     else {
         /*(note: any of these params might be NULL)*/
-        log_error(pconf->errh, __FILE__, __LINE__,
+        log_error(t->errh, __FILE__, __LINE__,
           "opening connection to mysql: %s user: %s db: %s failed: %s",
           pconf->auth_mysql_host ? pconf->auth_mysql_host : "",
           pconf->auth_mysql_user ? pconf->auth_mysql_user : "",
           /*"pass:",*//*(omit pass from logs)*/
           /*p->conf.auth_mysql_pass ? p->conf.auth_mysql_pass : "",*/
           pconf->auth_mysql_db ? pconf->auth_mysql_db : "",
-          mysql_error(p->mysql_conn));
-        mod_authn_mysql_sock_close(p);
+          mysql_error(t->mysql_conn));
+        mod_authn_mysql_sock_close(t);
         return NULL;
     }
 }
 
-static MYSQL * mod_authn_mysql_sock_acquire(plugin_data *p) {
-    return mod_authn_mysql_sock_connect(p);
+static MYSQL * mod_authn_mysql_sock_acquire(mod_authn_mysql_tctx * const t, const plugin_config * const pconf) {
+    return mod_authn_mysql_sock_connect(t, pconf);
 }
 
-static void mod_authn_mysql_sock_release(plugin_data *p) {
-    UNUSED(p);
+static void mod_authn_mysql_sock_release(mod_authn_mysql_tctx * const t) {
+    UNUSED(t);
     /*(empty; leave db connection open)*/
     /* Note: mod_authn_mysql_result() calls mod_authn_mysql_sock_error()
      *       on error, so take that into account if making changes here.
-     *       Must check if (NULL == p->mysql_conn) */
+     *       Must check if (NULL == t->mysql_conn) */
 }
 
 __attribute_cold__
-static void mod_authn_mysql_sock_error(plugin_data *p) {
-    mod_authn_mysql_sock_close(p);
+static void mod_authn_mysql_sock_error(mod_authn_mysql_tctx * const t) {
+    mod_authn_mysql_sock_close(t);
+}
+
+static void * mod_authn_mysql_tctx_init(void * const ctx) {
+    UNUSED(ctx);
+    mysql_thread_init();
+    mod_authn_mysql_tctx * const t = calloc(1, sizeof(mod_authn_mysql_tctx));
+    force_assert(t);
+    return t;
+}
+
+static void mod_authn_mysql_tctx_free(void * const ctx) {
+    mod_authn_mysql_tctx * const t = ctx;
+    if (NULL != t) {
+        mod_authn_mysql_sock_close(t);
+        free(t);
+    }
+    mysql_thread_end();
 }
 
 static handler_t mod_authn_mysql_basic(request_st *r, void *p_d, const http_auth_require_t *require, const buffer *username, const char *pw);
@@ -157,6 +195,11 @@ INIT_FUNC(mod_authn_mysql_init) {
     return p;
 }
 
+FREE_FUNC(mod_authn_mysql_free) {
+    plugin_data * const p = p_d;
+    async_pool_free(p->pool); /*(closes db connections in worker threads)*/
+}
+
 static void mod_authn_mysql_merge_config_cpv(plugin_config * const pconf, const config_plugin_value_t * const cpv) {
     switch (cpv->k_id) { /* index into static config_plugin_keys_t cpk[] */
       case 0: /* auth.backend.mysql.host */
@@ -189,6 +232,8 @@ static void mod_authn_mysql_merge_config_cpv(plugin_config * const pconf, const
       case 9: /* auth.backend.mysql.col_realm */
         pconf->auth_mysql_col_realm = cpv->v.b->ptr;
         break;
+      case 10:/* auth.backend.mysql.threads */
+        break;
       default:/* should not happen */
         return;
     }
@@ -203,7 +248,7 @@ static void mod_authn_mysql_merge_config(plugin_config * const pconf, const conf
 static void mod_authn_mysql_patch_config(request_st * const r, plugin_data * const p) {
     memcpy(&p->conf, &p->defaults, sizeof(plugin_config));
     for (int i = 1, used = p->nconfig; i < used; ++i) {
-        if (config_check_cond(r, (uint32_t)p->cvlist[i].k_id))
+        if ((i = config_check_cond_next(r, p->cvlist, i, used)) < used)
             mod_authn_mysql_merge_config(&p->conf,
                                         p->cvlist + p->cvlist[i].v.u2[0]);
     }
@@ -241,6 +286,9 @@ SETDEFAULTS_FUNC(mod_authn_mysql_set_defaults) {
      ,{ CONST_STR_LEN("auth.backend.mysql.col_realm"),
         T_CONFIG_STRING,
         T_CONFIG_SCOPE_CONNECTION }
+     ,{ CONST_STR_LEN("auth.backend.mysql.threads"),
+        T_CONFIG_SHORT,
+        T_CONFIG_SCOPE_SERVER }
      ,{ NULL, 0,
         T_CONFIG_UNSET,
         T_CONFIG_SCOPE_UNSET }
@@ -250,6 +298,8 @@ SETDEFAULTS_FUNC(mod_authn_mysql_set_defaults) {
     if (!config_plugin_values_init(srv, p, cpk, "mod_authn_mysql"))
         return HANDLER_ERROR;
 
+    unsigned short nthreads = 4;
+
     /* process and validate config directives
      * (init i to 0 if global context; to 1 to skip empty global context) */
     for (int i = !p->cvlist[0].v.u2[1]; i < p->nconfig; ++i) {
@@ -273,6 +323,9 @@ SETDEFAULTS_FUNC(mod_authn_mysql_set_defaults) {
                     return HANDLER_ERROR;
                 }
                 break;
+              case 10:/* auth.backend.mysql.threads */
+                nthreads = cpv->v.shrt;
+                break;
               default:/* should not happen */
                 break;
             }
@@ -282,7 +335,6 @@ SETDEFAULTS_FUNC(mod_authn_mysql_set_defaults) {
     p->defaults.auth_mysql_col_user = "user";
     p->defaults.auth_mysql_col_pass = "password";
     p->defaults.auth_mysql_col_realm = "realm";
-    p->defaults.errh = srv->errh;
 
     /* initialize p->defaults from global config context */
     if (p->nconfig > 0 && p->cvlist->v.u2[1]) {
@@ -291,16 +343,46 @@ SETDEFAULTS_FUNC(mod_authn_mysql_set_defaults) {
             mod_authn_mysql_merge_config(&p->defaults, cpv);
     }
 
+    /* mysql_library_init() is not thread-safe; call before worker threads */
+    if (0 != mysql_library_init(0, NULL, NULL)) {
+        log_error(srv->errh, __FILE__, __LINE__, "mysql_library_init() failed");
+        return HANDLER_ERROR;
+    }
+    p->pool = async_pool_init("mod_authn_mysql", nthreads,
+                              mod_authn_mysql_tctx_init,
+                              mod_authn_mysql_tctx_free, NULL);
+
     return HANDLER_GO_ON;
 }
 
+#if !defined(HAVE_CRYPT_R) && defined(HAVE_CRYPT) && defined(HAVE_PTHREAD_H)
+/* crypt() is not thread-safe; serialize calls from worker threads */
+static pthread_mutex_t mod_authn_mysql_crypt_mutex = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
 static int mod_authn_mysql_password_cmp(const char *userpw, unsigned long userpwlen, const char *reqpw) {
   #if defined(HAVE_CRYPT_R) || defined(HAVE_CRYPT)
     if (userpwlen >= 3 && userpw[0] == '$') {
+        /* (called in worker thread) */
+      #if defined(HAVE_CRYPT_R)
+        /*((struct crypt_data) is large; allocate from heap rather than stack)*/
+        struct crypt_data *crypt_tmp_data = calloc(1, sizeof(*crypt_tmp_data));
+        force_assert(crypt_tmp_data);
+        char *crypted = crypt_r(reqpw, userpw, crypt_tmp_data);
+      #else
+       #ifdef HAVE_PTHREAD_H
+        pthread_mutex_lock(&mod_authn_mysql_crypt_mutex);
+       #endif
         char *crypted = crypt(reqpw, userpw);
+      #endif
         size_t crypwlen = (NULL != crypted) ? strlen(crypted) : 0;
         int rc = (crypwlen == userpwlen) ? memcmp(crypted, userpw, crypwlen) : -1;
         if (crypwlen) safe_memclear(crypted, crypwlen);
+      #if defined(HAVE_CRYPT_R)
+        free(crypt_tmp_data);
+      #elif defined(HAVE_PTHREAD_H)
+        pthread_mutex_unlock(&mod_authn_mysql_crypt_mutex);
+      #endif
         return rc;
     }
     else
@@ -325,18 +407,18 @@ static int mod_authn_mysql_password_cmp(const char *userpw, unsigned long userpw
     return -1;
 }
 
-static int mod_authn_mysql_result(plugin_data *p, http_auth_info_t *ai, const char *pw) {
-    MYSQL_RES *result = mysql_store_result(p->mysql_conn);
+static int mod_authn_mysql_result(mod_authn_mysql_tctx * const t, http_auth_info_t * const ai, const char * const pw) {
+    MYSQL_RES *result = mysql_store_result(t->mysql_conn);
     int rc = -1;
     my_ulonglong num_rows;
 
     if (NULL == result) {
         /*(future: might log mysql_error() string)*/
       #if 0
-        log_error(errh, __FILE__, __LINE__,
-          "mysql_store_result: %s", mysql_error(p->mysql_conn));
+        log_error(t->errh, __FILE__, __LINE__,
+          "mysql_store_result: %s", mysql_error(t->mysql_conn));
       #endif
-        mod_authn_mysql_sock_error(p);
+        mod_authn_mysql_sock_error(t);
         return -1;
     }
 
@@ -369,59 +451,55 @@ static int mod_authn_mysql_result(plugin_data *p, http_auth_info_t *ai, const ch
     return rc;
 }
 
-static handler_t mod_authn_mysql_query(request_st * const r, void *p_d, http_auth_info_t * const ai, const char * const pw) {
-    plugin_data *p = (plugin_data *)p_d;
+static void mod_authn_mysql_job_run(async_job * const job, void * const tctx, log_error_st * const errh) {
+    /* (called in worker thread) */
+    mod_authn_mysql_job * const mj = (mod_authn_mysql_job *)job;
+    mod_authn_mysql_tctx * const t = tctx;
+    const plugin_config * const pconf = &mj->conf;
+    http_auth_info_t * const ai = &mj->ai;
+    const char * const pw = mj->pw;
     int rc = -1;
 
-    mod_authn_mysql_patch_config(r, p);
-    p->conf.errh = r->conf.errh;
-
-    if (NULL == p->conf.auth_mysql_users_table) {
-        /*(auth.backend.mysql.host, auth.backend.mysql.db might be NULL; do not log)*/
-        log_error(r->conf.errh, __FILE__, __LINE__,
-          "auth config missing auth.backend.mysql.users_table for uri: %s",
-          r->target.ptr);
-        return HANDLER_ERROR;
-    }
+    t->errh = errh;
 
     do {
         char q[1024], uname[512], urealm[512];
         unsigned long mrc;
 
         if (ai->ulen > sizeof(uname)/2-1)
-            return HANDLER_ERROR;
+            break;
         if (ai->rlen > sizeof(urealm)/2-1)
-            return HANDLER_ERROR;
+            break;
 
-        if (!mod_authn_mysql_sock_acquire(p)) {
-            return HANDLER_ERROR;
+        if (!mod_authn_mysql_sock_acquire(t, pconf)) {
+            break;
         }
 
       #if 0
-        mrc = mysql_real_escape_string_quote(p->mysql_conn, uname,
+        mrc = mysql_real_escape_string_quote(t->mysql_conn, uname,
                                              ai->username, ai->ulen, '\'');
         if ((unsigned long)~0 == mrc) break;
 
-        mrc = mysql_real_escape_string_quote(p->mysql_conn, urealm,
+        mrc = mysql_real_escape_string_quote(t->mysql_conn, urealm,
                                              ai->realm, ai->rlen, '\'');
         if ((unsigned long)~0 == mrc) break;
       #else
-        mrc = mysql_real_escape_string(p->mysql_conn, uname,
+        mrc = mysql_real_escape_string(t->mysql_conn, uname,
                                        ai->username, ai->ulen);
         if ((unsigned long)~0 == mrc) break;
 
-        mrc = mysql_real_escape_string(p->mysql_conn, urealm,
+        mrc = mysql_real_escape_string(t->mysql_conn, urealm,
                                        ai->realm, ai->rlen);
         if ((unsigned long)~0 == mrc) break;
       #endif
 
         rc = snprintf(q, sizeof(q),
                       "SELECT %s FROM %s WHERE %s='%s' AND %s='%s'",
-                      p->conf.auth_mysql_col_pass,
-                      p->conf.auth_mysql_users_table,
-                      p->conf.auth_mysql_col_user,
+                      pconf->auth_mysql_col_pass,
+                      pconf->auth_mysql_users_table,
+                      pconf->auth_mysql_col_user,
                       uname,
-                      p->conf.auth_mysql_col_realm,
+                      pconf->auth_mysql_col_realm,
                       urealm);
 
         if (rc >= (int)sizeof(q)) {
@@ -429,36 +507,98 @@ static handler_t mod_authn_mysql_query(request_st * const r, void *p_d, http_aut
             break;
         }
 
-        /* for now we stay synchronous */
-        if (0 != mysql_query(p->mysql_conn, q)) {
+        /* (synchronous; blocking; called in worker thread) */
+        if (0 != mysql_query(t->mysql_conn, q)) {
             /* reconnect to db and retry once if query error occurs */
-            mod_authn_mysql_sock_error(p);
-            if (!mod_authn_mysql_sock_acquire(p)) {
+            mod_authn_mysql_sock_error(t);
+            if (!mod_authn_mysql_sock_acquire(t, pconf)) {
                 rc = -1;
                 break;
             }
-            if (0 != mysql_query(p->mysql_conn, q)) {
+            if (0 != mysql_query(t->mysql_conn, q)) {
                 /*(note: any of these params might be bufs w/ b->ptr == NULL)*/
-                log_error(r->conf.errh, __FILE__, __LINE__,
+                log_error(errh, __FILE__, __LINE__,
                   "mysql_query host: %s user: %s db: %s query: %s failed: %s",
-                  p->conf.auth_mysql_host ? p->conf.auth_mysql_host : "",
-                  p->conf.auth_mysql_user ? p->conf.auth_mysql_user : "",
+                  pconf->auth_mysql_host ? pconf->auth_mysql_host : "",
+                  pconf->auth_mysql_user ? pconf->auth_mysql_user : "",
                   /*"pass:",*//*(omit pass from logs)*/
-                  /*p->conf.auth_mysql_pass ? p->conf.auth_mysql_pass : "",*/
-                  p->conf.auth_mysql_db ? p->conf.auth_mysql_db : "",
-                  q, mysql_error(p->mysql_conn));
+                  /*pconf->auth_mysql_pass ? pconf->auth_mysql_pass : "",*/
+                  pconf->auth_mysql_db ? pconf->auth_mysql_db : "",
+                  q, mysql_error(t->mysql_conn));
                 rc = -1;
                 break;
             }
         }
 
-        rc = mod_authn_mysql_result(p, ai, pw);
+        rc = mod_authn_mysql_result(t, ai, pw);
 
     } while (0);
 
-    mod_authn_mysql_sock_release(p);
+    mod_authn_mysql_sock_release(t);
+
+    mj->rc = (0 == rc) ? HANDLER_GO_ON : HANDLER_ERROR;
+}
+
+static void mod_authn_mysql_job_free(async_job * const job) {
+    mod_authn_mysql_job * const mj = (mod_authn_mysql_job *)job;
+    free(mj->username.ptr);
+    free(mj->realm.ptr);
+    if (mj->pw) {
+        safe_memclear(mj->pw, strlen(mj->pw));
+        free(mj->pw);
+    }
+    free(mj);
+}
+
+static mod_authn_mysql_job * mod_authn_mysql_job_init(const plugin_config * const pconf, const http_auth_info_t * const ai, const char * const pw) {
+    mod_authn_mysql_job * const mj = calloc(1, sizeof(mod_authn_mysql_job));
+    force_assert(mj);
+    mj->job.run  = mod_authn_mysql_job_run;
+    mj->job.free = mod_authn_mysql_job_free;
+    mj->rc = HANDLER_ERROR;
+    mj->conf = *pconf;
+    mj->ai = *ai;
+    buffer_copy_string_len(&mj->username, ai->username, ai->ulen);
+    buffer_copy_string_len(&mj->realm, ai->realm, ai->rlen);
+    mj->ai.username = mj->username.ptr;
+    mj->ai.realm = mj->realm.ptr;
+    if (pw) {
+        mj->pw = strdup(pw);
+        force_assert(mj->pw);
+    }
+    return mj;
+}
+
+static handler_t mod_authn_mysql_query(request_st * const r, void *p_d, http_auth_info_t * const ai, const char * const pw) {
+    plugin_data *p = (plugin_data *)p_d;
+
+    mod_authn_mysql_job *mj = r->plugin_ctx[p->id];
+    if (NULL == mj) {
+        mod_authn_mysql_patch_config(r, p);
+
+        if (NULL == p->conf.auth_mysql_users_table) {
+            /*(auth.backend.mysql.host, auth.backend.mysql.db might be NULL; do not log)*/
+            log_error(r->conf.errh, __FILE__, __LINE__,
+              "auth config missing auth.backend.mysql.users_table for uri: %s",
+              r->target.ptr);
+            return HANDLER_ERROR;
+        }
 
-    return (0 == rc) ? HANDLER_GO_ON : HANDLER_ERROR;
+        mj = mod_authn_mysql_job_init(&p->conf, ai, pw);
+        r->plugin_ctx[p->id] = mj;
+        /* MySQL query is made in worker thread (synchronous; blocking) */
+        if (async_pool_submit(p->pool, r, &mj->job))
+            return HANDLER_WAIT_FOR_EVENT;
+    }
+    else if (!mj->job.done)
+        return HANDLER_WAIT_FOR_EVENT;
+
+    r->plugin_ctx[p->id] = NULL;
+    const handler_t rc = mj->rc;
+    if (HANDLER_GO_ON == rc && NULL == pw) /* used with HTTP Digest auth */
+        memcpy(ai->digest, mj->ai.digest, sizeof(ai->digest));
+    mod_authn_mysql_job_free(&mj->job);
+    return rc;
 }
 
 static handler_t mod_authn_mysql_basic(request_st * const r, void *p_d, const http_auth_require_t * const require, const buffer * const username, const char * const pw) {
@@ -481,13 +621,24 @@ static handler_t mod_authn_mysql_digest(request_st * const r, void *p_d, http_au
     return mod_authn_mysql_query(r, p_d, ai, NULL);
 }
 
+REQUEST_FUNC(mod_authn_mysql_handle_reset) {
+    plugin_data * const p = p_d;
+    mod_authn_mysql_job * const mj = r->plugin_ctx[p->id];
+    if (NULL != mj) {
+        r->plugin_ctx[p->id] = NULL;
+        async_job_detach(&mj->job);
+    }
+    return HANDLER_GO_ON;
+}
+
 int mod_authn_mysql_plugin_init(plugin *p);
 int mod_authn_mysql_plugin_init(plugin *p) {
     p->version     = LIGHTTPD_VERSION_ID;
     p->name        = "authn_mysql";
     p->init        = mod_authn_mysql_init;
     p->set_defaults= mod_authn_mysql_set_defaults;
-    p->cleanup     = mod_authn_mysql_sock_close;
+    p->handle_request_reset = mod_authn_mysql_handle_reset;
+    p->cleanup     = mod_authn_mysql_free;
 
     return 0;
 }
@@ -14,15 +14,18 @@
  *     (only cache successful logins to prevent cache bloat?)
  *     (or limit number of entries (size) of cache)
  *     (maybe have negative cache (limited size) of names not found in database)
- * - database query is synchronous and blocks waiting for response
+ * - PAM calls are made in async_pool worker threads (PAM modules may block
+ *   waiting for network services) and the request waits for the result
  */
 
 #include <security/pam_appl.h>
 
+#include "async_pool.h"
 #include "base.h"
 #include "http_auth.h"
 #include "log.h"
 #include "plugin.h"
+#include "safe_memclear.h"
 
 #include <stdlib.h>
 #include <string.h>
@@ -35,8 +38,19 @@ typedef struct {
     PLUGIN_DATA;
     plugin_config defaults;
     plugin_config conf;
+    async_pool *pool;
 } plugin_data;
 
+typedef struct {
+    async_job job;              /* (must be first member) */
+    int rc;
+    const char *service;
+    const char *username;
+    const char *pw;
+    const char *addrstr;
+    char data[];                /* (strings copied for use by worker thread) */
+} mod_authn_pam_job;
+
 static handler_t mod_authn_pam_basic(request_st *r, void *p_d, const http_auth_require_t *require, const buffer *username, const char *pw);
 
 INIT_FUNC(mod_authn_pam_init) {
@@ -51,6 +65,11 @@ INIT_FUNC(mod_authn_pam_init) {
     return p;
 }
 
+FREE_FUNC(mod_authn_pam_free) {
+    plugin_data * const p = p_d;
+    async_pool_free(p->pool);
+}
+
 static void mod_authn_pam_merge_config_cpv(plugin_config * const pconf, const config_plugin_value_t * const cpv) {
     switch (cpv->k_id) { /* index into static config_plugin_keys_t cpk[] */
       case 0: /* auth.backend.pam.opts */
@@ -72,7 +91,7 @@ static void mod_authn_pam_patch_config(request_st * const r, plugin_data * const
     p->conf = p->defaults; /* copy small struct instead of memcpy() */
     /*memcpy(&p->conf, &p->defaults, sizeof(plugin_config));*/
     for (int i = 1, used = p->nconfig; i < used; ++i) {
-        if (config_check_cond(r, (uint32_t)p->cvlist[i].k_id))
+        if ((i = config_check_cond_next(r, p->cvlist, i, used)) < used)
             mod_authn_pam_merge_config(&p->conf,
                                         p->cvlist + p->cvlist[i].v.u2[0]);
     }
@@ -83,6 +102,9 @@ SETDEFAULTS_FUNC(mod_authn_pam_set_defaults) {
       { CONST_STR_LEN("auth.backend.pam.opts"),
         T_CONFIG_ARRAY_KVSTRING,
         T_CONFIG_SCOPE_CONNECTION }
+     ,{ CONST_STR_LEN("auth.backend.pam.threads"),
+        T_CONFIG_SHORT,
+        T_CONFIG_SCOPE_SERVER }
      ,{ NULL, 0,
         T_CONFIG_UNSET,
         T_CONFIG_SCOPE_UNSET }
@@ -92,6 +114,8 @@ SETDEFAULTS_FUNC(mod_authn_pam_set_defaults) {
     if (!config_plugin_values_init(srv, p, cpk, "mod_authn_pam"))
         return HANDLER_ERROR;
 
+    unsigned short nthreads = 4;
+
     /* process and validate config directives
      * (init i to 0 if global context; to 1 to skip empty global context) */
     for (int i = !p->cvlist[0].v.u2[1]; i < p->nconfig; ++i) {
@@ -106,6 +130,9 @@ SETDEFAULTS_FUNC(mod_authn_pam_set_defaults) {
                     cpv->vtype = T_CONFIG_LOCAL;
                 }
                 break;
+              case 1: /* auth.backend.pam.threads */
+                nthreads = cpv->v.shrt;
+                break;
               default:/* should not happen */
                 break;
             }
@@ -113,6 +140,7 @@ SETDEFAULTS_FUNC(mod_authn_pam_set_defaults) {
     }
 
     p->defaults.service = "http";
+    p->pool = async_pool_init("mod_authn_pam", nthreads, NULL, NULL, NULL);
 
     /* initialize p->defaults from global config context */
     if (p->nconfig > 0 && p->cvlist->v.u2[1]) {
@@ -138,26 +166,72 @@ static int mod_authn_pam_fn_conv(int num_msg, const struct pam_message **msg, st
     return PAM_SUCCESS;
 }
 
-static handler_t mod_authn_pam_query(request_st * const r, void *p_d, const buffer * const username, const char * const realm, const char * const pw) {
-    plugin_data *p = (plugin_data *)p_d;
+static void mod_authn_pam_job_run(async_job * const job, void * const tctx, log_error_st * const errh) {
+    /* (called in worker thread) */
+    mod_authn_pam_job * const pj = (mod_authn_pam_job *)job;
     pam_handle_t *pamh = NULL;
     struct pam_conv conv = { mod_authn_pam_fn_conv, NULL };
     const int flags = PAM_SILENT | PAM_DISALLOW_NULL_AUTHTOK;
     int rc;
-    UNUSED(realm);
-    *(const char **)&conv.appdata_ptr = pw; /*(cast away const)*/
+    UNUSED(tctx);
+    *(const char **)&conv.appdata_ptr = pj->pw; /*(cast away const)*/
 
-    mod_authn_pam_patch_config(r, p);
-
-    const char * const addrstr = r->con->dst_addr_buf->ptr;
-    rc = pam_start(p->conf.service, username->ptr, &conv, &pamh);
+    rc = pam_start(pj->service, pj->username, &conv, &pamh);
     if (PAM_SUCCESS != rc
-     || PAM_SUCCESS !=(rc = pam_set_item(pamh, PAM_RHOST, addrstr))
+     || PAM_SUCCESS !=(rc = pam_set_item(pamh, PAM_RHOST, pj->addrstr))
      || PAM_SUCCESS !=(rc = pam_authenticate(pamh, flags))
      || PAM_SUCCESS !=(rc = pam_acct_mgmt(pamh, flags)))
-        log_error(r->conf.errh, __FILE__, __LINE__,
+        log_error(errh, __FILE__, __LINE__,
           "pam: %s", pam_strerror(pamh, rc));
     pam_end(pamh, rc);
+    pj->rc = rc;
+}
+
+static void mod_authn_pam_job_free(async_job * const job) {
+    mod_authn_pam_job * const pj = (mod_authn_pam_job *)job;
+    safe_memclear(pj->data, strlen(pj->pw) + (size_t)(pj->pw - pj->data));
+    free(pj);
+}
+
+static mod_authn_pam_job * mod_authn_pam_job_init(const char * const service, const buffer * const username, const char * const pw, const buffer * const addrstr) {
+    const size_t slen = strlen(service) + 1;
+    const size_t ulen = buffer_string_length(username) + 1;
+    const size_t plen = strlen(pw) + 1;
+    const size_t alen = buffer_string_length(addrstr) + 1;
+    mod_authn_pam_job * const pj =
+      malloc(sizeof(mod_authn_pam_job) + slen + ulen + plen + alen);
+    force_assert(pj);
+    memset(&pj->job, 0, sizeof(pj->job));
+    pj->job.run  = mod_authn_pam_job_run;
+    pj->job.free = mod_authn_pam_job_free;
+    pj->rc = PAM_SYSTEM_ERR;
+    char *d = pj->data;
+    pj->username = memcpy(d, username->ptr, ulen); d += ulen;
+    pj->pw       = memcpy(d, pw, plen);            d += plen;
+    pj->service  = memcpy(d, service, slen);       d += slen;
+    pj->addrstr  = memcpy(d, addrstr->ptr, alen);
+    return pj;
+}
+
+static handler_t mod_authn_pam_query(request_st * const r, void *p_d, const buffer * const username, const char * const realm, const char * const pw) {
+    plugin_data *p = (plugin_data *)p_d;
+    UNUSED(realm);
+
+    mod_authn_pam_job *pj = r->plugin_ctx[p->id];
+    if (NULL == pj) {
+        mod_authn_pam_patch_config(r, p);
+        pj = mod_authn_pam_job_init(p->conf.service, username, pw,
+                                    r->con->dst_addr_buf);
+        r->plugin_ctx[p->id] = pj;
+        if (async_pool_submit(p->pool, r, &pj->job))
+            return HANDLER_WAIT_FOR_EVENT;
+    }
+    else if (!pj->job.done)
+        return HANDLER_WAIT_FOR_EVENT;
+
+    r->plugin_ctx[p->id] = NULL;
+    const int rc = pj->rc;
+    mod_authn_pam_job_free(&pj->job);
     return (PAM_SUCCESS == rc) ? HANDLER_GO_ON : HANDLER_ERROR;
 }
 
@@ -170,12 +244,24 @@ static handler_t mod_authn_pam_basic(request_st * const r, void *p_d, const http
       : HANDLER_ERROR;
 }
 
+REQUEST_FUNC(mod_authn_pam_handle_reset) {
+    plugin_data * const p = p_d;
+    mod_authn_pam_job * const pj = r->plugin_ctx[p->id];
+    if (NULL != pj) {
+        r->plugin_ctx[p->id] = NULL;
+        async_job_detach(&pj->job);
+    }
+    return HANDLER_GO_ON;
+}
+
 int mod_authn_pam_plugin_init(plugin *p);
 int mod_authn_pam_plugin_init(plugin *p) {
     p->version     = LIGHTTPD_VERSION_ID;
     p->name        = "authn_pam";
     p->init        = mod_authn_pam_init;
     p->set_defaults= mod_authn_pam_set_defaults;
+    p->handle_request_reset = mod_authn_pam_handle_reset;
+    p->cleanup     = mod_authn_pam_free;
 
     return 0;
 }
@@ -0,0 +1,1129 @@
+#include "first.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "base.h"
+#include "array.h"
+#include "buffer.h"
+#include "chunk.h"
+#include "connections.h"
+#include "etag.h"
+#include "fdevent.h"
+#include "http_chunk.h"
+#include "http_header.h"
+#include "log.h"
+#include "response.h"
+#include "splaytree.h"
+#include "status_counter.h"
+
+#include "plugin.h"
+
+/**
+ * mod_cache - cache of responses from backends (mod_proxy, mod_fastcgi, ...)
+ *
+ * Responses to GET requests which are complete (not streamed), carry explicit
+ * freshness (Cache-Control s-maxage or max-age, or Expires), and are not
+ * marked no-store or private, and do not set cookies, are stored keyed on
+ * scheme, host and URL (request target), and on the request header values
+ * named in Vary, if any.  Fresh responses are served from cache to GET and
+ * HEAD requests without contacting the backend.  Stale responses with an ETag
+ * or Last-Modified are revalidated with a conditional request to the backend,
+ * and are served from cache if the backend responds 304 Not Modified.
+ *
+ * If cache.collapse is enabled, concurrent requests for a response which is
+ * not in cache (or is stale) are collapsed: the first request is sent to the
+ * backend and the other requests wait for its response.  If the response is
+ * stored in cache (and is not to be revalidated upon each use), the waiting
+ * requests are sent the cached response (sharing the same cached body).
+ * Otherwise, or if the response does not arrive within
+ * cache.collapse-timeout seconds, the waiting requests are sent to the
+ * backend independently.
+ *
+ * Entries are kept in a memory tier limited by cache.memory-size.  If
+ * cache.dir is configured, response bodies larger than CACHE_MEM_BODY_MAX are
+ * kept in files in cache.dir (limited by cache.disk-size) and are sent from
+ * the file (e.g. sendfile()).  Least recently used entries are evicted.
+ *
+ * Note: mod_cache must be listed in server.modules after modules which
+ * restrict access (e.g. mod_access, mod_auth) and before backend modules
+ * (e.g. mod_proxy, mod_fastcgi, mod_scgi), since cached responses are served
+ * when the request URI is processed (handle_uri_clean).  The order is checked
+ * at startup.  Requests containing Authorization are neither served from
+ * cache nor stored.
+ */
+
+/* response bodies up to this size are kept in memory even if cache.dir set */
+#define CACHE_MEM_BODY_MAX 16384
+
+typedef struct cache_entry {
+    struct cache_entry *prev;   /* LRU list of tier (most recent first) */
+    struct cache_entry *next;
+    int ndx;                    /* key in splay tree */
+    int refcnt;                 /* (+1 while in cache, +1 while revalidating) */
+    int status;
+    unsigned char is_vary;      /* variants keyed on Vary'd request headers */
+    unsigned char on_disk;      /* body kept in file in cache.dir */
+    time_t date;                /* time response generated (minus Age) */
+    time_t expires;             /* date + freshness lifetime */
+    off_t size;                 /* size of response body */
+    off_t cost;
+    buffer key;
+    buffer vary;                /* (is_vary) Vary response header value */
+    buffer body;                /* response body (memory tier) */
+    buffer path;                /* file containing response body (disk tier) */
+    array headers;              /* response headers */
+} cache_entry;
+
+typedef struct cache_pending {
+    struct cache_pending *prev; /* list of pending backend requests */
+    struct cache_pending *next;
+    int ndx;                    /* key in splay tree */
+    unsigned char timed_out;    /* waiters released to backend independently */
+    time_t start;
+    struct handler_ctx *waiters;
+    buffer key;
+} cache_pending;
+
+typedef struct {
+    unsigned short enabled;
+    unsigned short collapse;
+} plugin_config;
+
+typedef struct {
+    PLUGIN_DATA;
+    plugin_config defaults;
+    plugin_config conf;
+
+    splay_tree *sptree;         /* nodes of tree are (cache_entry *) */
+    cache_entry *lru_head[2];   /* [0] memory tier, [1] disk tier */
+    cache_entry *lru_tail[2];
+    off_t used[2];
+    off_t max[2];
+    off_t max_entry;
+    const buffer *dir;
+    uint32_t collapse_timeout;
+    splay_tree *pending;        /* nodes of tree are (cache_pending *) */
+    cache_pending *pending_list;
+    buffer tmpb;
+} plugin_data;
+
+enum {
+    CACHE_COLLAPSE_NONE,
+    CACHE_COLLAPSE_LEADER,      /* request sent to backend for waiters */
+    CACHE_COLLAPSE_WAITING,     /* request waiting for response of leader */
+    CACHE_COLLAPSE_RELEASED     /* request released by leader (or timeout) */
+};
+
+typedef struct handler_ctx {
+    buffer key;                 /* key of response (without Vary'd values) */
+    cache_entry *ce;            /* stale entry being revalidated,
+                                 * or response shared by leader */
+    cache_pending *pending;     /* (CACHE_COLLAPSE_LEADER or _WAITING) */
+    struct handler_ctx *next;   /* next waiter for response of leader */
+    request_st *r;
+    int collapse;
+} handler_ctx;
+
+
+static handler_ctx * handler_ctx_init (void)
+{
+    handler_ctx * const hctx = calloc(1, sizeof(handler_ctx));
+    force_assert(hctx);
+    return hctx;
+}
+
+static void cache_entry_release (cache_entry *ce);
+
+static void handler_ctx_free (handler_ctx * const hctx)
+{
+    if (hctx->ce) cache_entry_release(hctx->ce);
+    free(hctx->key.ptr);
+    free(hctx);
+}
+
+
+static void cache_entry_free (cache_entry * const ce)
+{
+    if (ce->on_disk && !buffer_string_is_empty(&ce->path))
+        unlink(ce->path.ptr);
+    free(ce->key.ptr);
+    free(ce->vary.ptr);
+    free(ce->body.ptr);
+    free(ce->path.ptr);
+    array_free_data(&ce->headers);
+    free(ce);
+}
+
+static void cache_entry_release (cache_entry * const ce)
+{
+    if (0 == --ce->refcnt)
+        cache_entry_free(ce);
+}
+
+static void cache_remove (plugin_data * const p, cache_entry * const ce)
+{
+    /* remove entry from LRU list of tier and release reference held by cache
+     * (caller must remove entry from p->sptree) */
+    const int tier = ce->on_disk;
+    p->used[tier] -= ce->cost;
+    if (ce->prev) ce->prev->next = ce->next; else p->lru_head[tier] = ce->next;
+    if (ce->next) ce->next->prev = ce->prev; else p->lru_tail[tier] = ce->prev;
+    ce->prev = ce->next = NULL;
+    cache_entry_release(ce);
+}
+
+static void cache_evict (plugin_data * const p, cache_entry * const ce)
+{
+    if (NULL == ce->prev && p->lru_head[ce->on_disk] != ce)
+        return; /*(not in cache, e.g. already replaced)*/
+    p->sptree = splaytree_splay(p->sptree, ce->ndx);
+    if (p->sptree && p->sptree->key == ce->ndx && p->sptree->data == ce)
+        p->sptree = splaytree_delete(p->sptree, ce->ndx);
+    cache_remove(p, ce);
+}
+
+static void cache_touch (plugin_data * const p, cache_entry * const ce)
+{
+    /* move entry to head of LRU list of tier */
+    const int tier = ce->on_disk;
+    if (p->lru_head[tier] == ce) return;
+    ce->prev->next = ce->next;
+    if (ce->next) ce->next->prev = ce->prev; else p->lru_tail[tier] = ce->prev;
+    ce->prev = NULL;
+    ce->next = p->lru_head[tier];
+    p->lru_head[tier]->prev = ce;
+    p->lru_head[tier] = ce;
+}
+
+static void cache_insert (plugin_data * const p, cache_entry * const ce)
+{
+    const int tier = ce->on_disk;
+
+    /* replace existing entry (e.g. stale entry, or hash collision) */
+    p->sptree = splaytree_splay(p->sptree, ce->ndx);
+    if (p->sptree && p->sptree->key == ce->ndx) {
+        cache_entry * const old = p->sptree->data;
+        p->sptree = splaytree_delete(p->sptree, ce->ndx);
+        cache_remove(p, old);
+    }
+
+    /* evict least recently used entries of tier to make room */
+    while (p->used[tier] + ce->cost > p->max[tier] && p->lru_tail[tier])
+        cache_evict(p, p->lru_tail[tier]);
+
+    p->used[tier] += ce->cost;
+    p->sptree = splaytree_insert(p->sptree, ce->ndx, ce);
+    ce->prev = NULL;
+    ce->next = p->lru_head[tier];
+    if (ce->next) ce->next->prev = ce; else p->lru_tail[tier] = ce;
+    p->lru_head[tier] = ce;
+}
+
+static cache_entry * cache_lookup (plugin_data * const p, const buffer * const key)
+{
+    const int ndx = splaytree_djbhash(CONST_BUF_LEN(key));
+    p->sptree = splaytree_splay(p->sptree, ndx);
+    if (NULL == p->sptree || p->sptree->key != ndx) return NULL;
+    cache_entry * const ce = p->sptree->data;
+    return buffer_is_equal(&ce->key, key) ? ce : NULL;
+}
+
+static cache_entry * cache_entry_init (const buffer * const key)
+{
+    cache_entry * const ce = calloc(1, sizeof(cache_entry));
+    force_assert(ce);
+    buffer_copy_buffer(&ce->key, key);
+    ce->ndx = splaytree_djbhash(CONST_BUF_LEN(key));
+    ce->refcnt = 1;
+    return ce;
+}
+
+
+static void mod_cache_collapse_wake (request_st * const r)
+{
+    /* resume processing of request (which repeats http_response_prepare()) */
+    r->async_callback = 1;
+    joblist_append(r->con);
+}
+
+static cache_pending * mod_cache_collapse_find (plugin_data * const p, const buffer * const key)
+{
+    const int ndx = splaytree_djbhash(CONST_BUF_LEN(key));
+    p->pending = splaytree_splay(p->pending, ndx);
+    if (NULL == p->pending || p->pending->key != ndx) return NULL;
+    cache_pending * const pd = p->pending->data;
+    return buffer_is_equal(&pd->key, key) ? pd : NULL;
+}
+
+static void mod_cache_collapse_lead (plugin_data * const p, handler_ctx * const hctx)
+{
+    cache_pending * const pd = calloc(1, sizeof(cache_pending));
+    force_assert(pd);
+    buffer_copy_buffer(&pd->key, &hctx->key);
+    pd->ndx = splaytree_djbhash(CONST_BUF_LEN(&pd->key));
+    pd->start = log_epoch_secs;
+    p->pending = splaytree_splay(p->pending, pd->ndx);
+    if (NULL == p->pending || p->pending->key != pd->ndx)
+        p->pending = splaytree_insert(p->pending, pd->ndx, pd);
+    /*(else hash collision; pd not in tree, but waiters are still released)*/
+    pd->next = p->pending_list;
+    if (pd->next) pd->next->prev = pd;
+    p->pending_list = pd;
+    hctx->pending = pd;
+    hctx->collapse = CACHE_COLLAPSE_LEADER;
+}
+
+static void mod_cache_collapse_release (cache_pending * const pd, cache_entry * const ce)
+{
+    /* wake waiters, sharing response (if ce != NULL) */
+    for (handler_ctx *w = pd->waiters, *next; w; w = next) {
+        next = w->next;
+        w->next = NULL;
+        w->pending = NULL;
+        w->collapse = CACHE_COLLAPSE_RELEASED;
+        if (NULL != ce) {
+            ++ce->refcnt;
+            w->ce = ce;
+        }
+        mod_cache_collapse_wake(w->r);
+    }
+    pd->waiters = NULL;
+}
+
+static void mod_cache_collapse_done (plugin_data * const p, handler_ctx * const hctx, cache_entry * const ce)
+{
+    /* leader received response (or was reset) */
+    cache_pending * const pd = hctx->pending;
+    hctx->pending = NULL;
+    hctx->collapse = CACHE_COLLAPSE_NONE;
+    mod_cache_collapse_release(pd, ce);
+    p->pending = splaytree_splay(p->pending, pd->ndx);
+    if (p->pending && p->pending->key == pd->ndx && p->pending->data == pd)
+        p->pending = splaytree_delete(p->pending, pd->ndx);
+    if (pd->prev) pd->prev->next = pd->next; else p->pending_list = pd->next;
+    if (pd->next) pd->next->prev = pd->prev;
+    free(pd->key.ptr);
+    free(pd);
+}
+
+static void mod_cache_collapse_detach (plugin_data * const p, handler_ctx * const hctx)
+{
+    switch (hctx->collapse) {
+      case CACHE_COLLAPSE_LEADER:
+        mod_cache_collapse_done(p, hctx, NULL);
+        break;
+      case CACHE_COLLAPSE_WAITING: {
+        handler_ctx **w = &hctx->pending->waiters;
+        while (*w != hctx) w = &(*w)->next;
+        *w = hctx->next;
+        hctx->next = NULL;
+        hctx->pending = NULL;
+        hctx->collapse = CACHE_COLLAPSE_NONE;
+        break;
+      }
+      default:
+        break;
+    }
+}
+
+static const buffer * cache_entry_header (const cache_entry * const ce, const enum http_header_e id, const char * const k, const uint32_t klen)
+{
+    const data_string * const ds = (const data_string *)
+      array_get_element_klen_ext(&ce->headers, id, k, klen);
+    return NULL != ds ? &ds->value : NULL;
+}
+
+
+static void mod_cache_merge_config_cpv(plugin_config * const pconf, const config_plugin_value_t * const cpv) {
+    switch (cpv->k_id) { /* index into static config_plugin_keys_t cpk[] */
+      case 0: /* cache.enable */
+        pconf->enabled = (unsigned short)cpv->v.u;
+        break;
+      case 1: /* cache.memory-size */
+      case 2: /* cache.dir */
+      case 3: /* cache.disk-size */
+      case 4: /* cache.max-entry-size */
+        break;
+      case 5: /* cache.collapse */
+        pconf->collapse = (unsigned short)cpv->v.u;
+        break;
+      case 6: /* cache.collapse-timeout */
+        break;
+      default:/* should not happen */
+        return;
+    }
+}
+
+static void mod_cache_merge_config(plugin_config * const pconf, const config_plugin_value_t *cpv) {
+    do {
+        mod_cache_merge_config_cpv(pconf, cpv);
+    } while ((++cpv)->k_id != -1);
+}
+
+static void mod_cache_patch_config(request_st * const r, plugin_data * const p) {
+    p->conf = p->defaults; /* copy small struct instead of memcpy() */
+    /*memcpy(&p->conf, &p->defaults, sizeof(plugin_config));*/
+    for (int i = 1, used = p->nconfig; i < used; ++i) {
+        if ((i = config_check_cond_next(r, p->cvlist, i, used)) < used)
+            mod_cache_merge_config(&p->conf, p->cvlist+p->cvlist[i].v.u2[0]);
+    }
+}
+
+INIT_FUNC(mod_cache_init) {
+    return calloc(1, sizeof(plugin_data));
+}
+
+FREE_FUNC(mod_cache_free) {
+    plugin_data * const p = p_d;
+    for (cache_pending *pd = p->pending_list, *next; pd; pd = next) {
+        next = pd->next;
+        p->pending = splaytree_delete(p->pending, pd->ndx);
+        free(pd->key.ptr);
+        free(pd);
+    }
+    for (int tier = 0; tier < 2; ++tier) {
+        while (p->lru_tail[tier])
+            cache_evict(p, p->lru_tail[tier]);
+    }
+    free(p->tmpb.ptr);
+}
+
+SETDEFAULTS_FUNC(mod_cache_set_defaults) {
+    static const config_plugin_keys_t cpk[] = {
+      { CONST_STR_LEN("cache.enable"),
+        T_CONFIG_BOOL,
+        T_CONFIG_SCOPE_CONNECTION }
+     ,{ CONST_STR_LEN("cache.memory-size"),
+        T_CONFIG_INT,
+        T_CONFIG_SCOPE_SERVER }
+     ,{ CONST_STR_LEN("cache.dir"),
+        T_CONFIG_STRING,
+        T_CONFIG_SCOPE_SERVER }
+     ,{ CONST_STR_LEN("cache.disk-size"),
+        T_CONFIG_INT,
+        T_CONFIG_SCOPE_SERVER }
+     ,{ CONST_STR_LEN("cache.max-entry-size"),
+        T_CONFIG_INT,
+        T_CONFIG_SCOPE_SERVER }
+     ,{ CONST_STR_LEN("cache.collapse"),
+        T_CONFIG_BOOL,
+        T_CONFIG_SCOPE_CONNECTION }
+     ,{ CONST_STR_LEN("cache.collapse-timeout"),
+        T_CONFIG_INT,
+        T_CONFIG_SCOPE_SERVER }
+     ,{ NULL, 0,
+        T_CONFIG_UNSET,
+        T_CONFIG_SCOPE_UNSET }
+    };
+
+    plugin_data * const p = p_d;
+    if (!config_plugin_values_init(srv, p, cpk, "mod_cache"))
+        return HANDLER_ERROR;
+
+    /* (sizes configured in kbytes) */
+    p->max[0] = 16384 << 10;
+    p->max[1] = 1048576L << 10;
+    p->max_entry = 8192 << 10;
+    p->collapse_timeout = 5;
+
+    /* process and validate config directives
+     * (init i to 0 if global context; to 1 to skip empty global context) */
+    for (int i = !p->cvlist[0].v.u2[1]; i < p->nconfig; ++i) {
+        const config_plugin_value_t *cpv = p->cvlist + p->cvlist[i].v.u2[0];
+        for (; -1 != cpv->k_id; ++cpv) {
+            switch (cpv->k_id) {
+              case 0: /* cache.enable */
+                break;
+              case 1: /* cache.memory-size */
+                p->max[0] = (off_t)cpv->v.u << 10;
+                break;
+              case 2: /* cache.dir */
+                if (!buffer_string_is_empty(cpv->v.b)) {
+                    struct stat st;
+                    if (0 != stat(cpv->v.b->ptr, &st) || !S_ISDIR(st.st_mode)){
+                        log_error(srv->errh, __FILE__, __LINE__,
+                          "%s is not a directory: %s",
+                          cpk[cpv->k_id].k, cpv->v.b->ptr);
+                        return HANDLER_ERROR;
+                    }
+                    p->dir = cpv->v.b;
+                }
+                break;
+              case 3: /* cache.disk-size */
+                p->max[1] = (off_t)cpv->v.u << 10;
+                break;
+              case 4: /* cache.max-entry-size */
+                p->max_entry = (off_t)cpv->v.u << 10;
+                break;
+              case 5: /* cache.collapse */
+                break;
+              case 6: /* cache.collapse-timeout */
+                p->collapse_timeout = cpv->v.u;
+                break;
+              default:/* should not happen */
+                break;
+            }
+        }
+    }
+
+    /* mod_cache must handle request before backend modules claim request,
+     * and after modules restricting access have checked request */
+    uint32_t i;
+    for (i = 0; i < srv->plugins.used; ++i) {
+        const char * const name = ((plugin **)srv->plugins.ptr)[i]->name;
+        if (0 == strcmp(name, "cache")) break;
+        if (0 == strcmp(name, "proxy")
+            || 0 == strcmp(name, "fastcgi")
+            || 0 == strcmp(name, "scgi")) {
+            log_error(srv->errh, __FILE__, __LINE__,
+              "mod_cache must be listed in server.modules before mod_%s",
+              name);
+            return HANDLER_ERROR;
+        }
+    }
+    while (++i < srv->plugins.used) {
+        const char * const name = ((plugin **)srv->plugins.ptr)[i]->name;
+        if (0 == strcmp(name, "access")
+            || 0 == strcmp(name, "auth")) {
+            log_error(srv->errh, __FILE__, __LINE__,
+              "mod_cache must be listed in server.modules after mod_%s",
+              name);
+            return HANDLER_ERROR;
+        }
+    }
+
+    /* initialize p->defaults from global config context */
+    if (p->nconfig > 0 && p->cvlist->v.u2[1]) {
+        const config_plugin_value_t *cpv = p->cvlist + p->cvlist->v.u2[0];
+        if (-1 != cpv->k_id)
+            mod_cache_merge_config(&p->defaults, cpv);
+    }
+
+    return HANDLER_GO_ON;
+}
+
+
+static long mod_cache_cc_value (const buffer * const cc, const char * const k, const uint32_t klen)
+{
+    /* returns value of Cache-Control directive k=N; -1 if not present */
+    for (const char *s = cc->ptr; *s; ) {
+        while (*s == ' ' || *s == '\t' || *s == ',') ++s;
+        if (buffer_eq_icase_ssn(s, k, klen) && s[klen] == '=') {
+            s += klen + 1;
+            if (*s == '"') ++s;
+            if (!light_isdigit(*s)) return -1;
+            const long v = strtol(s, NULL, 10);
+            return v >= 0 ? v : -1;
+        }
+        while (*s != ',' && *s != '\0') ++s;
+    }
+    return -1;
+}
+
+static int mod_cache_cc_token (const buffer * const cc, const char * const k, const uint32_t klen)
+{
+    return http_header_str_contains_token(CONST_BUF_LEN(cc), k, klen);
+}
+
+static time_t mod_cache_http_date (const char * const s)
+{
+    /* (returns value in same (local) time domain for all HTTP-dates so that
+     *  differences between HTTP-dates are correct; 0 if invalid) */
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    if (NULL == strptime(s, "%a, %d %b %Y %H:%M:%S GMT", &tm)) return 0;
+    tm.tm_isdst = 0;
+    const time_t t = mktime(&tm);
+    return (t != (time_t)-1) ? t : 0;
+}
+
+static int mod_cache_freshness (request_st * const r, time_t * const lifetime)
+{
+    /* returns 0 if response is storable (explicit freshness lifetime set);
+     * -1 otherwise */
+    const buffer * const cc =
+      http_header_response_get(r, HTTP_HEADER_CACHE_CONTROL,
+                               CONST_STR_LEN("Cache-Control"));
+    long v;
+    if (NULL != cc) {
+        if (mod_cache_cc_token(cc, CONST_STR_LEN("no-store"))
+            || mod_cache_cc_token(cc, CONST_STR_LEN("private")))
+            return -1;
+        if (mod_cache_cc_token(cc, CONST_STR_LEN("no-cache"))) {
+            *lifetime = 0; /* store, but revalidate upon each use */
+            return 0;
+        }
+        if ((v = mod_cache_cc_value(cc, CONST_STR_LEN("s-maxage"))) >= 0
+            || (v = mod_cache_cc_value(cc, CONST_STR_LEN("max-age"))) >= 0) {
+            *lifetime = (time_t)v;
+            return 0;
+        }
+    }
+
+    const buffer * const vb =
+      http_header_response_get(r, HTTP_HEADER_OTHER, CONST_STR_LEN("Expires"));
+    if (NULL != vb) {
+        const buffer * const date =
+          http_header_response_get(r, HTTP_HEADER_DATE, CONST_STR_LEN("Date"));
+        const time_t exp = mod_cache_http_date(vb->ptr);
+        const time_t now = mod_cache_http_date(NULL != date
+          ? date->ptr
+          : strftime_cache_get(log_epoch_secs)->ptr);
+        /* (invalid Expires, e.g. "0", means already expired) */
+        *lifetime = (exp && now && exp > now) ? exp - now : 0;
+        return 0;
+    }
+
+    return -1;
+}
+
+static int mod_cache_handler_is_backend (const request_st * const r)
+{
+    /* responses from backends (and not, e.g. static files) are cached */
+    const plugin * const hm = r->handler_module;
+    if (NULL == hm) return 0;
+    return 0 == strcmp(hm->name, "proxy")
+        || 0 == strcmp(hm->name, "fastcgi")
+        || 0 == strcmp(hm->name, "scgi")
+        || 0 == strcmp(hm->name, "cgi");
+}
+
+static int mod_cache_status_is_cacheable (const int status)
+{
+    switch (status) {
+      case 200: case 203: case 204: case 300: case 301: case 308:
+      case 404: case 405: case 410: case 414: case 501:
+        return 1;
+      default:
+        return 0;
+    }
+}
+
+static int mod_cache_header_is_stored (const data_string * const ds)
+{
+    /* omit hop-by-hop and per-response headers */
+    switch (ds->ext) {
+      case HTTP_HEADER_CONNECTION:
+      case HTTP_HEADER_CONTENT_LENGTH:
+      case HTTP_HEADER_DATE:
+      case HTTP_HEADER_SET_COOKIE:
+      case HTTP_HEADER_STATUS:
+      case HTTP_HEADER_TRANSFER_ENCODING:
+      case HTTP_HEADER_UPGRADE:
+        return 0;
+      case HTTP_HEADER_OTHER:
+        return !buffer_eq_icase_slen(&ds->key, CONST_STR_LEN("Age"))
+            && !buffer_eq_icase_slen(&ds->key, CONST_STR_LEN("Keep-Alive"))
+            && !buffer_eq_icase_slen(&ds->key, CONST_STR_LEN("Trailer"))
+            && !buffer_eq_icase_slen(&ds->key,
+                                     CONST_STR_LEN("Proxy-Connection"));
+      default:
+        return 1;
+    }
+}
+
+static void mod_cache_key (request_st * const r, buffer * const key)
+{
+    buffer_copy_buffer(key, &r->uri.scheme);
+    buffer_append_string_len(key, CONST_STR_LEN("://"));
+    buffer_append_string_buffer(key, &r->uri.authority);
+    buffer_append_string_buffer(key, &r->target);
+}
+
+static int mod_cache_key_vary (request_st * const r, buffer * const b, const buffer * const key, const buffer * const vary)
+{
+    /* append request header values named by Vary to key
+     * (returns -1 if response varies on all requests (Vary: *)) */
+    buffer_copy_buffer(b, key);
+    for (const char *s = vary->ptr; *s; ) {
+        while (*s == ' ' || *s == '\t' || *s == ',') ++s;
+        const char * const k = s;
+        while (*s != ' ' && *s != '\t' && *s != ',' && *s != '\0') ++s;
+        const uint32_t klen = (uint32_t)(s - k);
+        if (0 == klen) break;
+        if (1 == klen && *k == '*') return -1;
+        const enum http_header_e id = http_header_hkey_get(k, klen);
+        const buffer * const vb = http_header_request_get(r, id, k, klen);
+        buffer_append_string_len(b, CONST_STR_LEN("\n"));
+        char * const lk = buffer_string_prepare_append(b, klen);
+        for (uint32_t i = 0; i < klen; ++i)
+            lk[i] = (char)(k[i] | 0x20); /*(lowercase field-name)*/
+        buffer_commit(b, klen);
+        buffer_append_string_len(b, CONST_STR_LEN(":"));
+        if (NULL != vb) buffer_append_string_buffer(b, vb);
+    }
+    return 0;
+}
+
+static cache_entry * mod_cache_lookup (request_st * const r, plugin_data * const p, const buffer * const key)
+{
+    cache_entry *ce = cache_lookup(p, key);
+    if (NULL != ce && ce->is_vary) {
+        buffer * const tb = &p->tmpb;
+        cache_touch(p, ce);
+        ce = (0 == mod_cache_key_vary(r, tb, key, &ce->vary))
+          ? cache_lookup(p, tb)
+          : NULL;
+    }
+    return ce;
+}
+
+static int mod_cache_send (request_st * const r, cache_entry * const ce)
+{
+    /* send response from cache (returns -1 if body no longer available) */
+    if (ce->size) {
+        if (ce->on_disk) {
+            const int fd =
+              fdevent_open_cloexec(ce->path.ptr, 1, O_RDONLY, 0);
+            if (fd < 0) return -1;
+            if (0 != http_chunk_append_file_fd(r, &ce->path, fd, ce->size))
+                return -1;
+        }
+        else
+            http_chunk_append_mem(r, CONST_BUF_LEN(&ce->body));
+    }
+
+    r->http_status = ce->status;
+    for (uint32_t i = 0; i < ce->headers.used; ++i) {
+        const data_string * const ds = (data_string *)ce->headers.data[i];
+        http_header_response_insert(r, (enum http_header_e)ds->ext,
+                                    CONST_BUF_LEN(&ds->key),
+                                    CONST_BUF_LEN(&ds->value));
+    }
+
+    const time_t age = log_epoch_secs - ce->date;
+    char buf[LI_ITOSTRING_LENGTH];
+    http_header_response_set(r, HTTP_HEADER_OTHER, CONST_STR_LEN("Age"),
+                             buf, li_itostrn(buf,sizeof(buf),age > 0 ? age : 0));
+    r->resp_body_finished = 1;
+    return 0;
+}
+
+static int mod_cache_not_modified (request_st * const r, const cache_entry * const ce)
+{
+    /* check client conditional request against cached response */
+    if (200 != ce->status) return 0;
+    const buffer *vb;
+    if ((vb = http_header_request_get(r, HTTP_HEADER_IF_NONE_MATCH,
+                                      CONST_STR_LEN("If-None-Match")))) {
+        const buffer * const etag =
+          cache_entry_header(ce, HTTP_HEADER_ETAG, CONST_STR_LEN("ETag"));
+        return NULL != etag && etag_is_equal(etag, vb->ptr, 1);
+    }
+    if ((vb = http_header_request_get(r, HTTP_HEADER_IF_MODIFIED_SINCE,
+                                      CONST_STR_LEN("If-Modified-Since")))) {
+        const buffer * const mtime =
+          cache_entry_header(ce, HTTP_HEADER_LAST_MODIFIED,
+                             CONST_STR_LEN("Last-Modified"));
+        return NULL != mtime && buffer_is_equal(mtime, vb);
+    }
+    return 0;
+}
+
+static int mod_cache_hit (request_st * const r, cache_entry * const ce)
+{
+    /* send cached response, or 304 Not Modified if client conditional request
+     * matches cached response (returns -1 if body no longer available) */
+    if (mod_cache_not_modified(r, ce)) {
+        for (uint32_t i = 0; i < ce->headers.used; ++i) {
+            const data_string * const ds = (data_string *)ce->headers.data[i];
+            if (ds->ext == HTTP_HEADER_ETAG
+                || ds->ext == HTTP_HEADER_LAST_MODIFIED
+                || ds->ext == HTTP_HEADER_CACHE_CONTROL
+                || ds->ext == HTTP_HEADER_VARY)
+                http_header_response_insert(r, (enum http_header_e)ds->ext,
+                                            CONST_BUF_LEN(&ds->key),
+                                            CONST_BUF_LEN(&ds->value));
+        }
+        r->http_status = 304;
+        r->resp_body_finished = 1;
+        return 0;
+    }
+    if (0 == mod_cache_send(r, ce)) return 0;
+    http_response_body_clear(r, 0);
+    array_reset_data_strings(&r->resp_headers);
+    r->resp_htags = 0;
+    r->http_status = 0;
+    return -1;
+}
+
+static int mod_cache_collapse_match (request_st * const r, plugin_data * const p, const handler_ctx * const hctx, const cache_entry * const ce)
+{
+    /* check that response of leader may be shared with waiter
+     * (response must not require revalidation upon each use, and must match
+     *  the request header values of the waiter named by Vary, if any) */
+    if (ce->expires <= ce->date) return 0;
+    const buffer * const vary =
+      cache_entry_header(ce, HTTP_HEADER_VARY, CONST_STR_LEN("Vary"));
+    if (NULL == vary) return buffer_is_equal(&ce->key, &hctx->key);
+    buffer * const tb = &p->tmpb;
+    return 0 == mod_cache_key_vary(r, tb, &hctx->key, vary)
+        && buffer_is_equal(&ce->key, tb);
+}
+
+static handler_t mod_cache_miss (request_st * const r, plugin_data * const p, handler_ctx * const hctx, cache_entry * const ce, const int use_cache)
+{
+    status_counter_inc(CONST_STR_LEN("cache.misses"));
+
+    /* collapse concurrent requests for the same response */
+    if (p->conf.collapse && use_cache
+        && hctx->collapse == CACHE_COLLAPSE_NONE
+        && r->http_method == HTTP_METHOD_GET) {
+        cache_pending * const pd = mod_cache_collapse_find(p, &hctx->key);
+        if (NULL == pd)
+            mod_cache_collapse_lead(p, hctx);
+        else if (!pd->timed_out) {
+            hctx->r = r;
+            hctx->pending = pd;
+            hctx->next = pd->waiters;
+            pd->waiters = hctx;
+            hctx->collapse = CACHE_COLLAPSE_WAITING;
+            return HANDLER_WAIT_FOR_EVENT;
+        }
+    }
+
+    /* stale; revalidate with backend if response has validator and client
+     * did not send conditional request (conditions for client's own cache) */
+    if (NULL == ce) return HANDLER_GO_ON;
+    if (r->rqst_htags & (HTTP_HEADER_IF_NONE_MATCH
+                        |HTTP_HEADER_IF_MODIFIED_SINCE))
+        return HANDLER_GO_ON;
+    if (200 != ce->status) return HANDLER_GO_ON;
+    const buffer * const etag =
+      cache_entry_header(ce, HTTP_HEADER_ETAG, CONST_STR_LEN("ETag"));
+    const buffer * const mtime =
+      cache_entry_header(ce, HTTP_HEADER_LAST_MODIFIED,
+                         CONST_STR_LEN("Last-Modified"));
+    if (NULL == etag && NULL == mtime) return HANDLER_GO_ON;
+    if (NULL != etag)
+        http_header_request_set(r, HTTP_HEADER_IF_NONE_MATCH,
+                                CONST_STR_LEN("If-None-Match"),
+                                CONST_BUF_LEN(etag));
+    if (NULL != mtime)
+        http_header_request_set(r, HTTP_HEADER_IF_MODIFIED_SINCE,
+                                CONST_STR_LEN("If-Modified-Since"),
+                                CONST_BUF_LEN(mtime));
+    ++ce->refcnt;
+    hctx->ce = ce;
+    return HANDLER_GO_ON;
+}
+
+URIHANDLER_FUNC(mod_cache_uri_handler) {
+    plugin_data * const p = p_d;
+
+    if (NULL != r->handler_module) return HANDLER_GO_ON;
+    if (!http_method_get_or_head(r->http_method)) return HANDLER_GO_ON;
+    if (r->rqst_htags & (HTTP_HEADER_AUTHORIZATION|HTTP_HEADER_UPGRADE))
+        return HANDLER_GO_ON;
+
+    mod_cache_patch_config(r, p);
+    if (!p->conf.enabled) return HANDLER_GO_ON;
+
+    int use_cache = 1;
+    const buffer * const cc =
+      http_header_request_get(r, HTTP_HEADER_CACHE_CONTROL,
+                              CONST_STR_LEN("Cache-Control"));
+    if (NULL != cc) {
+        if (mod_cache_cc_token(cc, CONST_STR_LEN("no-store")))
+            return HANDLER_GO_ON;
+        if (mod_cache_cc_token(cc, CONST_STR_LEN("no-cache"))
+            || 0 == mod_cache_cc_value(cc, CONST_STR_LEN("max-age")))
+            use_cache = 0; /* (fetch from backend, but store response) */
+    }
+    else {
+        const buffer * const vb =
+          http_header_request_get(r, HTTP_HEADER_OTHER,
+                                  CONST_STR_LEN("Pragma"));
+        if (NULL != vb && mod_cache_cc_token(vb, CONST_STR_LEN("no-cache")))
+            use_cache = 0;
+    }
+
+    handler_ctx *hctx = r->plugin_ctx[p->id];
+    if (NULL == hctx)
+        r->plugin_ctx[p->id] = hctx = handler_ctx_init();
+    else if (hctx->collapse == CACHE_COLLAPSE_WAITING)
+        return HANDLER_WAIT_FOR_EVENT; /* still waiting for leader */
+    else if (hctx->collapse == CACHE_COLLAPSE_LEADER)
+        mod_cache_collapse_done(p, hctx, NULL); /*(e.g. request restarted)*/
+    mod_cache_key(r, &hctx->key);
+
+    if (NULL != hctx->ce) {
+        cache_entry * const ce = hctx->ce;
+        hctx->ce = NULL;
+        if (hctx->collapse == CACHE_COLLAPSE_RELEASED
+            && mod_cache_collapse_match(r, p, hctx, ce)
+            && 0 == mod_cache_hit(r, ce)) {
+            cache_entry_release(ce);
+            handler_ctx_free(hctx);
+            r->plugin_ctx[p->id] = NULL;
+            status_counter_inc(CONST_STR_LEN("cache.collapsed"));
+            return HANDLER_FINISHED;
+        }
+        cache_entry_release(ce);
+    }
+
+    cache_entry * const ce = use_cache
+      ? mod_cache_lookup(r, p, &hctx->key)
+      : NULL;
+
+    if (NULL != ce && ce->expires > log_epoch_secs) { /* fresh */
+        cache_touch(p, ce);
+        if (0 == mod_cache_hit(r, ce)) {
+            handler_ctx_free(hctx);
+            r->plugin_ctx[p->id] = NULL;
+            status_counter_inc(CONST_STR_LEN("cache.hits"));
+            return HANDLER_FINISHED;
+        }
+        cache_evict(p, ce); /* (e.g. cache file removed) */
+        return mod_cache_miss(r, p, hctx, NULL, use_cache);
+    }
+
+    return mod_cache_miss(r, p, hctx, ce, use_cache);
+}
+
+static int mod_cache_body_append (buffer * const b, const int fd, const char *s, size_t len)
+{
+    if (-1 == fd) {
+        buffer_append_string_len(b, s, len);
+        return 0;
+    }
+    ssize_t wr;
+    do {
+        wr = write(fd, s, len);
+    } while (wr > 0 ? ((s += wr), (len -= (size_t)wr)) : errno == EINTR);
+    return (0 == len) ? 0 : -1;
+}
+
+static int mod_cache_body_copy (const chunkqueue * const cq, buffer * const b, const int fd)
+{
+    /* copy response body (without consuming it) into b or into file fd */
+    char buf[16384];
+    for (const chunk *c = cq->first; c; c = c->next) {
+        switch (c->type) {
+          case MEM_CHUNK:
+            if (0 != mod_cache_body_append(b, fd, c->mem->ptr + c->offset,
+                                           buffer_string_length(c->mem)
+                                           - (size_t)c->offset))
+                return -1;
+            break;
+          case FILE_CHUNK: {
+            int cfd = c->file.fd;
+            if (-1 == cfd) {
+                cfd = fdevent_open_cloexec(c->mem->ptr, 1, O_RDONLY, 0);
+                if (-1 == cfd) return -1;
+            }
+            off_t off = c->file.start + c->offset;
+            off_t len = c->file.length - c->offset;
+            while (len > 0) {
+                const ssize_t rd = pread(cfd, buf, len < (off_t)sizeof(buf)
+                                                   ? (size_t)len
+                                                   : sizeof(buf), off);
+                if (rd > 0
+                    && 0 == mod_cache_body_append(b, fd, buf, (size_t)rd)) {
+                    off += rd;
+                    len -= rd;
+                }
+                else if (!(-1 == rd && errno == EINTR))
+                    break;
+            }
+            if (cfd != c->file.fd) close(cfd);
+            if (0 != len) return -1;
+            break;
+          }
+          default:
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int mod_cache_body_store (request_st * const r, plugin_data * const p, cache_entry * const ce)
+{
+    const chunkqueue * const cq = r->write_queue;
+    if (NULL != p->dir && ce->size > CACHE_MEM_BODY_MAX) {
+        buffer * const path = &ce->path;
+        buffer_copy_buffer(path, p->dir);
+        buffer_append_path_len(path, CONST_STR_LEN("lighttpd-cache-XXXXXX"));
+        /*(unique name created with O_EXCL; not predictable or pre-created)*/
+        const int fd = fdevent_mkstemp_append(path->ptr);
+        if (fd < 0) {
+            log_perror(r->conf.errh, __FILE__, __LINE__,
+              "creating cache file failed: %s", path->ptr);
+            return -1;
+        }
+        ce->on_disk = 1; /*(file unlinked upon entry free, if error)*/
+        const int rc = mod_cache_body_copy(cq, NULL, fd);
+        if (0 != close(fd) || 0 != rc) {
+            log_perror(r->conf.errh, __FILE__, __LINE__,
+              "writing cache file failed: %s", path->ptr);
+            return -1;
+        }
+        ce->cost = ce->size;
+        return 0;
+    }
+
+    buffer_string_prepare_copy(&ce->body, (size_t)ce->size);
+    if (0 != mod_cache_body_copy(cq, &ce->body, -1)) return -1;
+    ce->cost = (off_t)(sizeof(*ce) + ce->key.size + ce->body.size);
+    for (uint32_t i = 0; i < ce->headers.used; ++i) {
+        const data_string * const ds = (data_string *)ce->headers.data[i];
+        ce->cost += (off_t)(sizeof(*ds) + ds->key.size + ds->value.size);
+    }
+    return 0;
+}
+
+static cache_entry * mod_cache_store (request_st * const r, plugin_data * const p, const buffer * const key)
+{
+    /* (returns entry stored, or NULL if response not stored) */
+    if (r->http_method != HTTP_METHOD_GET) return NULL;
+    if (!mod_cache_status_is_cacheable(r->http_status)) return NULL;
+    if (!mod_cache_handler_is_backend(r)) return NULL;
+    if (r->resp_htags & (HTTP_HEADER_SET_COOKIE|HTTP_HEADER_UPGRADE))
+        return NULL;
+
+    time_t lifetime;
+    if (0 != mod_cache_freshness(r, &lifetime)) return NULL;
+    if (0 == lifetime
+        && !(r->resp_htags & (HTTP_HEADER_ETAG|HTTP_HEADER_LAST_MODIFIED)))
+        return NULL; /* (must always revalidate, but no validator) */
+
+    const off_t len = chunkqueue_length(r->write_queue);
+    if (len > p->max_entry) return NULL;
+    if (!(NULL != p->dir && len > CACHE_MEM_BODY_MAX) && len > p->max[0] / 8)
+        return NULL;
+
+    buffer * const tb = &p->tmpb;
+    const buffer * const vary =
+      http_header_response_get(r, HTTP_HEADER_VARY, CONST_STR_LEN("Vary"));
+    if (NULL != vary && 0 != mod_cache_key_vary(r, tb, key, vary))
+        return NULL; /* (Vary: *) */
+
+    /* (Age of response received from backend) */
+    const buffer * const age =
+      http_header_response_get(r, HTTP_HEADER_OTHER, CONST_STR_LEN("Age"));
+    const long initial_age = (NULL != age && light_isdigit(age->ptr[0]))
+      ? strtol(age->ptr, NULL, 10)
+      : 0;
+
+    cache_entry * const ce = cache_entry_init(NULL != vary ? tb : key);
+    ce->status  = r->http_status;
+    ce->size    = len;
+    ce->date    = log_epoch_secs - initial_age;
+    ce->expires = ce->date + lifetime;
+    for (uint32_t i = 0; i < r->resp_headers.used; ++i) {
+        const data_string * const ds = (data_string *)r->resp_headers.data[i];
+        if (mod_cache_header_is_stored(ds) && !buffer_is_empty(&ds->value))
+            array_insert_unique(&ce->headers, ds->fn->copy((data_unset *)ds));
+    }
+    if (0 != mod_cache_body_store(r, p, ce)) {
+        cache_entry_free(ce);
+        return NULL;
+    }
+
+    if (NULL != vary) {
+        /* entry keyed on URL marks response varies on request headers */
+        cache_entry * const vce = cache_entry_init(key);
+        vce->is_vary = 1;
+        vce->expires = ce->expires;
+        buffer_copy_buffer(&vce->vary, vary);
+        vce->cost = (off_t)(sizeof(*vce) + vce->key.size + vce->vary.size);
+        cache_insert(p, vce);
+    }
+
+    cache_insert(p, ce);
+    status_counter_inc(CONST_STR_LEN("cache.stores"));
+    return ce;
+}
+
+static void mod_cache_refresh (request_st * const r, cache_entry * const ce)
+{
+    /* update freshness of entry revalidated by backend (304 Not Modified) */
+    time_t lifetime;
+    if (0 != mod_cache_freshness(r, &lifetime))
+        lifetime = ce->expires - ce->date; /* (reuse prior lifetime) */
+    ce->date = log_epoch_secs;
+    ce->expires = ce->date + lifetime;
+}
+
+REQUEST_FUNC(mod_cache_handle_response_start) {
+    plugin_data * const p = p_d;
+    handler_ctx * const hctx = r->plugin_ctx[p->id];
+    if (NULL == hctx) return HANDLER_GO_ON;
+    r->plugin_ctx[p->id] = NULL;
+
+    cache_entry *ce = hctx->ce;
+    if (NULL != ce && 304 == r->http_status
+        && mod_cache_handler_is_backend(r)) {
+        /* revalidated; send cached response (after backend 304 response) */
+        mod_cache_refresh(r, ce);
+        http_response_body_clear(r, 0);
+        array_reset_data_strings(&r->resp_headers);
+        r->resp_htags = 0;
+        if (0 != mod_cache_send(r, ce)) {
+            http_response_body_clear(r, 0);
+            r->http_status = 502;
+            cache_evict(p, ce);
+            ce = NULL;
+        }
+        status_counter_inc(CONST_STR_LEN("cache.revalidated"));
+    }
+    else
+        ce = r->resp_body_finished ? mod_cache_store(r, p, &hctx->key) : NULL;
+
+    /* share response with requests waiting for response of leader */
+    if (hctx->collapse == CACHE_COLLAPSE_LEADER)
+        mod_cache_collapse_done(p, hctx, ce);
+
+    handler_ctx_free(hctx);
+    return HANDLER_GO_ON;
+}
+
+REQUEST_FUNC(mod_cache_handle_request_reset) {
+    plugin_data * const p = p_d;
+    handler_ctx * const hctx = r->plugin_ctx[p->id];
+    if (NULL != hctx) {
+        r->plugin_ctx[p->id] = NULL;
+        mod_cache_collapse_detach(p, hctx);
+        handler_ctx_free(hctx);
+    }
+    return HANDLER_GO_ON;
+}
+
+TRIGGER_FUNC(mod_cache_trigger) {
+    plugin_data * const p = p_d;
+    UNUSED(srv);
+    /* release waiters to backend if response of leader is not received
+     * within cache.collapse-timeout (leader continues, if still pending) */
+    for (cache_pending *pd = p->pending_list; pd; pd = pd->next) {
+        if (pd->timed_out || NULL == pd->waiters) continue;
+        if (log_epoch_secs - pd->start < (time_t)p->collapse_timeout) continue;
+        pd->timed_out = 1;
+        mod_cache_collapse_release(pd, NULL);
+        status_counter_inc(CONST_STR_LEN("cache.collapse-timeouts"));
+    }
+    return HANDLER_GO_ON;
+}
+
+
+int mod_cache_plugin_init(plugin *p);
+int mod_cache_plugin_init(plugin *p) {
+    p->version     = LIGHTTPD_VERSION_ID;
+    p->name        = "cache";
+
+    p->init        = mod_cache_init;
+    p->cleanup     = mod_cache_free;
+    p->set_defaults= mod_cache_set_defaults;
+    p->handle_uri_clean        = mod_cache_uri_handler;
+    p->handle_response_start   = mod_cache_handle_response_start;
+    p->handle_request_reset    = mod_cache_handle_request_reset;
+    p->handle_trigger          = mod_cache_trigger;
+
+    return 0;
+}
@@ -103,6 +103,7 @@
 #include "sys-mmap.h"
 
 #include <fcntl.h>
+#include <limits.h>     /* INT_MAX INT_MIN */
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
@@ -118,6 +119,7 @@
 #include "http_header.h"
 #include "response.h"
 #include "stat_cache.h"
+#include "status_counter.h"
 
 #include "plugin.h"
 
@@ -184,16 +186,42 @@ typedef struct {
 	unsigned short	work_block_size;
 	unsigned short	sync_flush;
 	short		compression_level;
+	short		compression_level_min;
 	short		allowed_encodings;
 	double		max_loadavg;
 } plugin_config;
 
+/* adaptive compression level (deflate.compression-level-min)
+ *
+ * Time spent compressing in the (single-threaded) event loop is measured.
+ * Once a second, "pressure" is raised quickly if compression used more than
+ * DEFLATE_ADAPTIVE_BUSY_HIGH of the past second (smoothed), or if a single
+ * call to compress blocked the event loop longer than DEFLATE_ADAPTIVE_LAG_HIGH,
+ * and pressure is lowered slowly while compression is well below both limits.
+ * The level of each response is chosen between deflate.compression-level
+ * (pressure 0) and deflate.compression-level-min (pressure 1000), and is
+ * raised for small responses (cheap to compress) and lowered for large ones.
+ */
+#define DEFLATE_ADAPTIVE_BUSY_HIGH 250000 /* usec compressing per sec */
+#define DEFLATE_ADAPTIVE_BUSY_LOW  100000
+#define DEFLATE_ADAPTIVE_LAG_HIGH   50000 /* usec in single compress call */
+#define DEFLATE_ADAPTIVE_LAG_LOW    10000
+#define DEFLATE_ADAPTIVE_SMALL      (16 KByte)
+#define DEFLATE_ADAPTIVE_LARGE      (1 MByte)
+
 typedef struct {
     PLUGIN_DATA;
     plugin_config defaults;
     plugin_config conf;
 
     buffer tmp_buf;
+
+    int adaptive;       /* deflate.compression-level-min set in any scope */
+    int pressure;       /* 0 .. 1000 */
+    uint32_t busy_usec; /* usec spent compressing since last trigger */
+    uint32_t lag_usec;  /* max usec of single compress call since trigger */
+    uint32_t busy_avg;  /* moving average of busy_usec per sec */
+    off_t bytes_saved;
 } plugin_data;
 
 typedef struct {
@@ -216,6 +244,7 @@ typedef struct {
 	plugin_data *plugin_data;
 	request_st *r;
 	int compression_type;
+	int compression_level;
 	int cache_fd;
 	char *cache_fn;
 } handler_ctx;
@@ -313,6 +342,7 @@ static void mod_deflate_cache_file_open (handler_ctx * const hctx, const buffer
 static int mod_deflate_cache_file_finish (request_st * const r, handler_ctx * const hctx, const buffer * const fn) {
     if (0 != fdevent_rename(hctx->cache_fn, fn->ptr))
         return -1;
+    stat_cache_invalidate_entry(CONST_BUF_LEN(fn)); /*(negative entry, if any)*/
     free(hctx->cache_fn);
     hctx->cache_fn = NULL;
     chunkqueue_reset(r->write_queue);
@@ -365,6 +395,9 @@ static void mod_deflate_merge_config_cpv(plugin_config * const pconf, const conf
       case 13:/* compress.max-loadavg */
         pconf->max_loadavg = cpv->v.d;
         break;
+      case 14:/* deflate.compression-level-min */
+        pconf->compression_level_min = (short)cpv->v.shrt;
+        break;
       default:/* should not happen */
         return;
     }
@@ -379,7 +412,7 @@ static void mod_deflate_merge_config(plugin_config * const pconf, const config_p
 static void mod_deflate_patch_config(request_st * const r, plugin_data * const p) {
     memcpy(&p->conf, &p->defaults, sizeof(plugin_config));
     for (int i = 1, used = p->nconfig; i < used; ++i) {
-        if (config_check_cond(r, (uint32_t)p->cvlist[i].k_id))
+        if ((i = config_check_cond_next(r, p->cvlist, i, used)) < used)
             mod_deflate_merge_config(&p->conf, p->cvlist + p->cvlist[i].v.u2[0]);
     }
 }
@@ -479,6 +512,9 @@ SETDEFAULTS_FUNC(mod_deflate_set_defaults) {
      ,{ CONST_STR_LEN("compress.max-loadavg"),
         T_CONFIG_STRING,
         T_CONFIG_SCOPE_CONNECTION }
+     ,{ CONST_STR_LEN("deflate.compression-level-min"),
+        T_CONFIG_SHORT,
+        T_CONFIG_SCOPE_CONNECTION }
      ,{ NULL, 0,
         T_CONFIG_UNSET,
         T_CONFIG_SCOPE_UNSET }
@@ -590,6 +626,17 @@ SETDEFAULTS_FUNC(mod_deflate_set_defaults) {
                   ? strtod(cpv->v.b->ptr, NULL)
                   : 0.0;
                 break;
+              case 14:/* deflate.compression-level-min */
+                if ((cpv->v.shrt < 1 || cpv->v.shrt > 9)
+                    && *(short *)&cpv->v.shrt != -1) {
+                    log_error(srv->errh, __FILE__, __LINE__,
+                      "compression-level-min must be between 1 and 9: %hu",
+                      cpv->v.shrt);
+                    return HANDLER_ERROR;
+                }
+                if (*(short *)&cpv->v.shrt != -1)
+                    p->adaptive = 1;
+                break;
               default:/* should not happen */
                 break;
             }
@@ -600,6 +647,7 @@ SETDEFAULTS_FUNC(mod_deflate_set_defaults) {
     p->defaults.max_compress_size = 128*1024; /*(128 MB measured as num KB)*/
     p->defaults.min_compress_size = 256;
     p->defaults.compression_level = -1;
+    p->defaults.compression_level_min = -1;
     p->defaults.output_buffer_size = 0;
     p->defaults.work_block_size = 2048;
     p->defaults.max_loadavg = 0.0;
@@ -638,7 +686,6 @@ static int stream_http_chunk_append_mem(handler_ctx * const hctx, const char * c
 
 static int stream_deflate_init(handler_ctx *hctx) {
 	z_stream * const z = &hctx->u.z;
-	const plugin_data * const p = hctx->plugin_data;
 	z->zalloc = Z_NULL;
 	z->zfree = Z_NULL;
 	z->opaque = Z_NULL;
@@ -648,8 +695,8 @@ static int stream_deflate_init(handler_ctx *hctx) {
 	z->avail_out = hctx->output->size;
 
 	if (Z_OK != deflateInit2(z,
-				 p->conf.compression_level > 0
-				  ? p->conf.compression_level
+				 hctx->compression_level > 0
+				  ? hctx->compression_level
 				  : Z_DEFAULT_COMPRESSION,
 				 Z_DEFLATED,
 				 (hctx->compression_type == HTTP_ACCEPT_ENCODING_GZIP)
@@ -750,7 +797,6 @@ static int stream_deflate_end(handler_ctx *hctx) {
 
 static int stream_bzip2_init(handler_ctx *hctx) {
 	bz_stream * const bz = &hctx->u.bz;
-	const plugin_data * const p = hctx->plugin_data;
 	bz->bzalloc = NULL;
 	bz->bzfree = NULL;
 	bz->opaque = NULL;
@@ -762,8 +808,8 @@ static int stream_bzip2_init(handler_ctx *hctx) {
 	bz->avail_out = hctx->output->size;
 
 	if (BZ_OK != BZ2_bzCompressInit(bz,
-					p->conf.compression_level > 0
-					 ? p->conf.compression_level
+					hctx->compression_level > 0
+					 ? hctx->compression_level
 					 : 9, /* blocksize = 900k */
 					0,    /* verbosity */
 					0)) { /* workFactor: default */
@@ -861,10 +907,9 @@ static int stream_br_init(handler_ctx *hctx) {
     /* future: consider allowing tunables by encoder algorithm,
      * (i.e. not generic "compression_level") */
     /*(note: we ignore any errors while tuning parameters here)*/
-    const plugin_data * const p = hctx->plugin_data;
-    if (p->conf.compression_level >= 0) /* 0 .. 11 are valid values */
+    if (hctx->compression_level >= 0) /* 0 .. 11 are valid values */
         BrotliEncoderSetParameter(br, BROTLI_PARAM_QUALITY,
-                                  p->conf.compression_level);
+                                  hctx->compression_level);
 
     /* XXX: is this worth checking?
      * BROTLI_MODE_GENERIC vs BROTLI_MODE_TEXT or BROTLI_MODE_FONT */
@@ -1001,8 +1046,8 @@ static int mod_deflate_stream_flush(handler_ctx * const hctx, int end) {
 	}
 }
 
-static void mod_deflate_note_ratio(request_st * const r, const off_t bytes_out, const off_t bytes_in) {
-    /* store compression ratio in environment
+static void mod_deflate_note_ratio(request_st * const r, plugin_data * const p, const off_t bytes_out, const off_t bytes_in, const int level) {
+    /* store compression ratio (and level) in environment
      * for possible logging by mod_accesslog
      * (late in response handling, so not seen by most other modules) */
     /*(should be called only at end of successful response compression)*/
@@ -1011,6 +1056,74 @@ static void mod_deflate_note_ratio(request_st * const r, const off_t bytes_out,
     size_t len =
       li_itostrn(ratio, sizeof(ratio), bytes_out * 100 / bytes_in);
     http_header_env_set(r, CONST_STR_LEN("ratio"), ratio, len);
+    if (level > 0) {
+        len = li_itostrn(ratio, sizeof(ratio), level);
+        http_header_env_set(r, CONST_STR_LEN("deflate-level"), ratio, len);
+        status_counter_set(CONST_STR_LEN("deflate.level"), level);
+    }
+
+    /* report bytes saved in server-statistics (mod_status) */
+    p->bytes_saved += bytes_in - bytes_out;
+    const off_t kb = p->bytes_saved >> 10;
+    status_counter_set(CONST_STR_LEN("deflate.kbytes-saved"),
+                       kb > INT_MAX ? INT_MAX : kb < INT_MIN ? INT_MIN : (int)kb);
+}
+
+static int mod_deflate_adaptive_level (const plugin_data * const p, const int compression_type, const off_t len) {
+    /* choose compression level between bounds according to pressure,
+     * adjusted for response size (bounds apply to brotli quality, too) */
+    if (!(compression_type & (HTTP_ACCEPT_ENCODING_GZIP
+                             |HTTP_ACCEPT_ENCODING_DEFLATE
+                             |HTTP_ACCEPT_ENCODING_BR)))
+        return p->conf.compression_level;
+    const int max = p->conf.compression_level > 0
+      ? p->conf.compression_level
+      : 9;
+    const int min = p->conf.compression_level_min < max
+      ? p->conf.compression_level_min
+      : max;
+    int level = max - ((max - min) * p->pressure + 500) / 1000;
+    if (len <= DEFLATE_ADAPTIVE_SMALL)
+        level = (level + max + 1) >> 1;
+    else if (len >= DEFLATE_ADAPTIVE_LARGE)
+        level = (level + min) >> 1;
+    return level;
+}
+
+static void mod_deflate_adaptive_measure (plugin_data * const p, const struct timespec * const ts0) {
+    struct timespec ts;
+    log_clock_gettime_monotonic(&ts);
+    const long long usec = (ts.tv_sec - ts0->tv_sec) * 1000000LL
+                         + (ts.tv_nsec - ts0->tv_nsec) / 1000;
+    if (usec <= 0) return; /*(e.g. realtime clock adjusted if no monotonic)*/
+    const uint32_t u = usec < 1000000 ? (uint32_t)usec : 1000000;
+    p->busy_usec += u;
+    if (p->lag_usec < u) p->lag_usec = u;
+}
+
+TRIGGER_FUNC(mod_deflate_trigger) {
+    plugin_data * const p = p_d;
+    UNUSED(srv);
+    if (!p->adaptive) return HANDLER_GO_ON;
+
+    /* (trigger is called approximately once a second) */
+    const uint32_t busy = p->busy_usec < 1000000 ? p->busy_usec : 1000000;
+    p->busy_avg = (p->busy_avg * 3 + busy) >> 2;
+    if (p->busy_avg > DEFLATE_ADAPTIVE_BUSY_HIGH
+        || p->lag_usec > DEFLATE_ADAPTIVE_LAG_HIGH) {
+        p->pressure += 250;
+        if (p->pressure > 1000) p->pressure = 1000;
+    }
+    else if (p->busy_avg < DEFLATE_ADAPTIVE_BUSY_LOW
+             && p->lag_usec < DEFLATE_ADAPTIVE_LAG_LOW) {
+        p->pressure -= 50;
+        if (p->pressure < 0) p->pressure = 0;
+    }
+    p->busy_usec = 0;
+    p->lag_usec = 0;
+    status_counter_set(CONST_STR_LEN("deflate.pressure"), p->pressure);
+
+    return HANDLER_GO_ON;
 }
 
 static int mod_deflate_stream_end(handler_ctx *hctx) {
@@ -1201,7 +1314,7 @@ static int mod_deflate_file_chunk(request_st * const r, handler_ctx * const hctx
 }
 
 
-static handler_t deflate_compress_response(request_st * const r, handler_ctx * const hctx) {
+static handler_t deflate_compress_response_chunks(request_st * const r, handler_ctx * const hctx) {
 	off_t len, max;
 	int close_stream;
 
@@ -1265,6 +1378,19 @@ static handler_t deflate_compress_response(request_st * const r, handler_ctx * c
 }
 
 
+static handler_t deflate_compress_response(request_st * const r, handler_ctx * const hctx) {
+	plugin_data * const p = hctx->plugin_data;
+	if (!p->adaptive) return deflate_compress_response_chunks(r, hctx);
+
+	/* measure time spent compressing for adaptive compression level */
+	struct timespec ts0;
+	log_clock_gettime_monotonic(&ts0);
+	handler_t rc = deflate_compress_response_chunks(r, hctx);
+	mod_deflate_adaptive_measure(p, &ts0);
+	return rc;
+}
+
+
 static int mod_deflate_choose_encoding (const char *value, plugin_data *p, const char **label) {
 	/* get client side support encodings */
 	int accept_encoding = 0;
@@ -1541,7 +1667,7 @@ REQUEST_FUNC(mod_deflate_handle_response_start) {
 			if (r->resp_htags & HTTP_HEADER_CONTENT_LENGTH)
 				http_header_response_unset(r, HTTP_HEADER_CONTENT_LENGTH,
 				                           CONST_STR_LEN("Content-Length"));
-			mod_deflate_note_ratio(r, sce->st.st_size, len);
+			mod_deflate_note_ratio(r, p, sce->st.st_size, len, 0);
 			return HANDLER_GO_ON;
 		}
 		/* sanity check that response was whole file;
@@ -1559,6 +1685,9 @@ REQUEST_FUNC(mod_deflate_handle_response_start) {
 	hctx = handler_ctx_init();
 	hctx->plugin_data = p;
 	hctx->compression_type = compression_type;
+	hctx->compression_level = (p->conf.compression_level_min > 0)
+	  ? mod_deflate_adaptive_level(p, compression_type, len)
+	  : p->conf.compression_level;
 	hctx->r = r;
 	/* setup output buffer */
 	buffer_clear(&p->tmp_buf);
@@ -1596,7 +1725,8 @@ REQUEST_FUNC(mod_deflate_handle_response_start) {
 	if (HANDLER_FINISHED == rc) {
 		if (-1 == hctx->cache_fd
 		    || 0 == mod_deflate_cache_file_finish(r, hctx, tb)) {
-			mod_deflate_note_ratio(r, hctx->bytes_out, hctx->bytes_in);
+			mod_deflate_note_ratio(r, p, hctx->bytes_out, hctx->bytes_in,
+			                       hctx->compression_level);
 			rc = HANDLER_GO_ON;
 		}
 		else
@@ -1628,6 +1758,7 @@ int mod_deflate_plugin_init(plugin *p) {
 	p->cleanup	= mod_deflate_free;
 	p->set_defaults	= mod_deflate_set_defaults;
 	p->handle_request_reset = mod_deflate_cleanup;
+	p->handle_trigger = mod_deflate_trigger;
 	p->handle_response_start	= mod_deflate_handle_response_start;
 
 	return 0;
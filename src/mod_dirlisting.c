@@ -5,6 +5,7 @@
 #include "buffer.h"
 #include "fdevent.h"
 #include "http_header.h"
+#include "keyvalue.h"
 
 #include "plugin.h"
 
@@ -17,10 +18,6 @@
 #include <unistd.h>
 #include <time.h>
 
-#ifdef HAVE_PCRE_H
-#include <pcre.h>
-#endif
-
 /**
  * this is a dirlisting for a lighttpd plugin
  */
@@ -34,11 +31,7 @@ typedef struct {
 	char encode_header;
 	char auto_layout;
 
-      #ifdef HAVE_PCRE_H
-	pcre **excludes;
-      #else
-	void *excludes;
-      #endif
+	pcre_keyvalue_buffer *excludes;
 
 	const buffer *show_readme;
 	const buffer *show_header;
@@ -56,45 +49,39 @@ typedef struct {
 	buffer tmp_buf;
 } plugin_data;
 
-#ifdef HAVE_PCRE_H
+#ifdef HAVE_PCRE
 
-static pcre ** mod_dirlisting_parse_excludes(server *srv, const array *a) {
-    pcre **regexes = calloc(a->used + 1, sizeof(pcre *));
-    force_assert(regexes);
+static pcre_keyvalue_buffer * mod_dirlisting_parse_excludes(server *srv, const array *a) {
+    /*(re-use keyvalue.[ch] for match-only;
+     *  kvb 'value' is empty for all patterns)*/
+    const int pcre_jit = config_feature_bool(srv, "server.pcre_jit", 1);
+    pcre_keyvalue_buffer * const kvb = pcre_keyvalue_buffer_init();
+    static const buffer empty = { NULL, 0, 0 };
     for (uint32_t j = 0; j < a->used; ++j) {
         const data_string *ds = (const data_string *)a->data[j];
-        const char *errptr;
-        int erroff;
-        regexes[j] = pcre_compile(ds->value.ptr, 0, &errptr, &erroff, NULL);
-        if (NULL == regexes[j]) {
+        if (!pcre_keyvalue_buffer_append(srv->errh, kvb, &ds->value, &empty,
+                                         pcre_jit)) {
             log_error(srv->errh, __FILE__, __LINE__,
               "pcre_compile failed for: %s", ds->value.ptr);
-            for (pcre **regex = regexes; *regex; ++regex) pcre_free(*regex);
-            free(regexes);
+            pcre_keyvalue_buffer_free(kvb);
             return NULL;
         }
     }
-    return regexes;
+    return kvb;
 }
 
-static int mod_dirlisting_exclude(log_error_st *errh, pcre **regex, const char *name, size_t len) {
-    for(; *regex; ++regex) {
-        #define N 10
-        int ovec[N * 3];
-        int n;
-        if ((n = pcre_exec(*regex, NULL, name, len, 0, 0, ovec, 3 * N)) < 0) {
-            if (n == PCRE_ERROR_NOMATCH) continue;
-
-            log_error(errh, __FILE__, __LINE__,
-              "execution error while matching: %d", n);
-            /* aborting would require a lot of manual cleanup here.
-             * skip instead (to not leak names that break pcre matching)
-             */
-        }
+static int mod_dirlisting_exclude(log_error_st *errh, const pcre_keyvalue_buffer *kvb, char *name, size_t len) {
+    const buffer input = { name, (uint32_t)len+1, 0 };
+    pcre_keyvalue_ctx ctx = { NULL, NULL, 0, -1 };
+    if (HANDLER_GO_ON != pcre_keyvalue_buffer_process(kvb,&ctx,&input,NULL)) {
+        log_error(errh, __FILE__, __LINE__,
+          "execution error while matching: %s", name);
+        /* aborting would require a lot of manual cleanup here.
+         * skip instead (to not leak names that break pcre matching)
+         */
         return 1;
-        #undef N
     }
-    return 0; /* no match */
+    return (ctx.m >= 0); /* match if ctx.m set to index of pattern */
 }
 
 #else
@@ -117,12 +104,10 @@ FREE_FUNC(mod_dirlisting_free) {
         config_plugin_value_t *cpv = p->cvlist + p->cvlist[i].v.u2[0];
         for (; -1 != cpv->k_id; ++cpv) {
             switch (cpv->k_id) {
-             #ifdef HAVE_PCRE_H
+             #ifdef HAVE_PCRE
               case 2: /* dir-listing.exclude */
                 if (cpv->vtype != T_CONFIG_LOCAL) continue;
-                for (pcre **regex = cpv->v.v; *regex; ++regex)
-                    pcre_free(*regex);
-                free(cpv->v.v);
+                pcre_keyvalue_buffer_free(cpv->v.v);
                 break;
              #endif
               default:
@@ -192,7 +177,7 @@ static void mod_dirlisting_merge_config(plugin_config * const pconf, const confi
 static void mod_dirlisting_patch_config(request_st * const r, plugin_data * const p) {
     memcpy(&p->conf, &p->defaults, sizeof(plugin_config));
     for (int i = 1, used = p->nconfig; i < used; ++i) {
-        if (config_check_cond(r, (uint32_t)p->cvlist[i].k_id))
+        if ((i = config_check_cond_next(r, p->cvlist, i, used)) < used)
             mod_dirlisting_merge_config(&p->conf, p->cvlist + p->cvlist[i].v.u2[0]);
     }
 }
@@ -263,7 +248,7 @@ SETDEFAULTS_FUNC(mod_dirlisting_set_defaults) {
               case 1: /* server.dir-listing *//*(historical)*/
                 break;
               case 2: /* dir-listing.exclude */
-               #ifndef HAVE_PCRE_H
+               #ifndef HAVE_PCRE
                 if (cpv->v.a->used > 0) {
                     log_error(srv->errh, __FILE__, __LINE__,
                       "pcre support is missing for: %s, "
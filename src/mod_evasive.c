@@ -7,6 +7,8 @@
 #include "sock_addr.h"
 
 #include "plugin.h"
+#include "rand.h"
+#include "splaytree.h"   /* djbhash() */
 
 #include <stdlib.h>
 #include <string.h>
@@ -17,6 +19,7 @@
  * we indent to implement all features the mod_evasive from apache has
  *
  * - limit of connections per IP
+ * - limit of request rate per IP (token bucket, with burst allowance)
  * - provide a list of block-listed ip/networks (no access)
  * - provide a white-list of ips/network which is not affected by the limit
  *   (hmm, conditionals might be enough)
@@ -26,9 +29,36 @@
  * - w1zzard@techpowerup.com
  */
 
+/* clients are tracked in a hash table keyed on client addr (IPv4 addrs as
+ * IPv4-mapped IPv6 addrs), optionally masked to a network prefix, so that
+ * the lookup on each new connection and on each request is O(1) instead of
+ * a scan of all connections.  Entries with no open connections are evicted
+ * by the periodic timer after EVASIVE_IP_IDLE seconds of inactivity. */
+
+#define EVASIVE_IP_IDLE 60
+
+typedef struct evasive_ip {
+    struct evasive_ip *next;  /* hash chain */
+    uint8_t addr[16];         /* client addr (masked to prefix) */
+    uint32_t conns;           /* open connections */
+    uint32_t tokens;          /* token bucket for request rate limit */
+    time_t refill;            /* time of last refill of token bucket (or 0) */
+    time_t atime;             /* time of last activity */
+} evasive_ip;
+
+typedef struct {
+    evasive_ip **ptr;
+    uint32_t used;
+    uint32_t size;            /* power of 2 */
+    uint32_t seed;
+} evasive_ip_table;
+
 typedef struct {
     unsigned short max_conns;
     unsigned short silent;
+    unsigned short max_rps;
+    unsigned short burst;
+    unsigned short http_status;
     const buffer *location;
 } plugin_config;
 
@@ -36,10 +66,35 @@ typedef struct {
     PLUGIN_DATA;
     plugin_config defaults;
     plugin_config conf;
+    evasive_ip_table ips;
+    uint8_t v4_prefix;
+    uint8_t v6_prefix;
 } plugin_data;
 
 INIT_FUNC(mod_evasive_init) {
-    return calloc(1, sizeof(plugin_data));
+    plugin_data * const p = calloc(1, sizeof(plugin_data));
+    force_assert(p);
+    p->ips.size = 64;
+    p->ips.ptr = calloc(p->ips.size, sizeof(evasive_ip *));
+    force_assert(p->ips.ptr);
+    /* seed hash to make it more difficult to force collisions in table */
+    p->ips.seed = (uint32_t)li_rand_pseudo();
+    p->v4_prefix = 32;
+    p->v6_prefix = 128;
+    return p;
+}
+
+FREE_FUNC(mod_evasive_free) {
+    plugin_data * const p = p_d;
+    evasive_ip_table * const ips = &p->ips;
+    if (NULL == ips->ptr) return;
+    for (uint32_t i = 0; i < ips->size; ++i) {
+        for (evasive_ip *e = ips->ptr[i], *next; e; e = next) {
+            next = e->next;
+            free(e);
+        }
+    }
+    free(ips->ptr);
 }
 
 static void mod_evasive_merge_config_cpv(plugin_config * const pconf, const config_plugin_value_t * const cpv) {
@@ -53,6 +108,18 @@ static void mod_evasive_merge_config_cpv(plugin_config * const pconf, const conf
       case 2: /* evasive.location */
         pconf->location = cpv->v.b;
         break;
+      case 3: /* evasive.max-requests-per-sec */
+        pconf->max_rps = cpv->v.shrt;
+        break;
+      case 4: /* evasive.burst */
+        pconf->burst = cpv->v.shrt;
+        break;
+      case 5: /* evasive.http-status */
+        pconf->http_status = cpv->v.shrt;
+        break;
+      case 6: /* evasive.ipv4-prefix */
+      case 7: /* evasive.ipv6-prefix */
+        break;
       default:/* should not happen */
         return;
     }
@@ -68,7 +135,7 @@ static void mod_evasive_patch_config(request_st * const r, plugin_data * const p
     p->conf = p->defaults; /* copy small struct instead of memcpy() */
     /*memcpy(&p->conf, &p->defaults, sizeof(plugin_config));*/
     for (int i = 1, used = p->nconfig; i < used; ++i) {
-        if (config_check_cond(r, (uint32_t)p->cvlist[i].k_id))
+        if ((i = config_check_cond_next(r, p->cvlist, i, used)) < used)
             mod_evasive_merge_config(&p->conf,p->cvlist + p->cvlist[i].v.u2[0]);
     }
 }
@@ -84,6 +151,21 @@ SETDEFAULTS_FUNC(mod_evasive_set_defaults) {
      ,{ CONST_STR_LEN("evasive.location"),
         T_CONFIG_STRING,
         T_CONFIG_SCOPE_CONNECTION }
+     ,{ CONST_STR_LEN("evasive.max-requests-per-sec"),
+        T_CONFIG_SHORT,
+        T_CONFIG_SCOPE_CONNECTION }
+     ,{ CONST_STR_LEN("evasive.burst"),
+        T_CONFIG_SHORT,
+        T_CONFIG_SCOPE_CONNECTION }
+     ,{ CONST_STR_LEN("evasive.http-status"),
+        T_CONFIG_SHORT,
+        T_CONFIG_SCOPE_CONNECTION }
+     ,{ CONST_STR_LEN("evasive.ipv4-prefix"),
+        T_CONFIG_SHORT,
+        T_CONFIG_SCOPE_SERVER }
+     ,{ CONST_STR_LEN("evasive.ipv6-prefix"),
+        T_CONFIG_SHORT,
+        T_CONFIG_SCOPE_SERVER }
      ,{ NULL, 0,
         T_CONFIG_UNSET,
         T_CONFIG_SCOPE_UNSET }
@@ -93,6 +175,56 @@ SETDEFAULTS_FUNC(mod_evasive_set_defaults) {
     if (!config_plugin_values_init(srv, p, cpk, "mod_evasive"))
         return HANDLER_ERROR;
 
+    /* process and validate config directives
+     * (init i to 0 if global context; to 1 to skip empty global context) */
+    for (int i = !p->cvlist[0].v.u2[1]; i < p->nconfig; ++i) {
+        const config_plugin_value_t *cpv = p->cvlist + p->cvlist[i].v.u2[0];
+        for (; -1 != cpv->k_id; ++cpv) {
+            switch (cpv->k_id) {
+              case 0: /* evasive.max-conns-per-ip */
+              case 1: /* evasive.silent */
+              case 2: /* evasive.location */
+              case 3: /* evasive.max-requests-per-sec */
+              case 4: /* evasive.burst */
+                break;
+              case 5: /* evasive.http-status */
+                switch (cpv->v.shrt) {
+                  case 0:
+                  case 403:
+                  case 429:
+                  case 503:
+                    break;
+                  default:
+                    log_error(srv->errh, __FILE__, __LINE__,
+                      "evasive.http-status must be 403, 429, or 503: %hu",
+                      cpv->v.shrt);
+                    return HANDLER_ERROR;
+                }
+                break;
+              case 6: /* evasive.ipv4-prefix */
+                if (0 == cpv->v.shrt || cpv->v.shrt > 32) {
+                    log_error(srv->errh, __FILE__, __LINE__,
+                      "evasive.ipv4-prefix must be between 1 and 32: %hu",
+                      cpv->v.shrt);
+                    return HANDLER_ERROR;
+                }
+                p->v4_prefix = (uint8_t)cpv->v.shrt;
+                break;
+              case 7: /* evasive.ipv6-prefix */
+                if (0 == cpv->v.shrt || cpv->v.shrt > 128) {
+                    log_error(srv->errh, __FILE__, __LINE__,
+                      "evasive.ipv6-prefix must be between 1 and 128: %hu",
+                      cpv->v.shrt);
+                    return HANDLER_ERROR;
+                }
+                p->v6_prefix = (uint8_t)cpv->v.shrt;
+                break;
+              default:/* should not happen */
+                break;
+            }
+        }
+    }
+
     /* initialize p->defaults from global config context */
     if (p->nconfig > 0 && p->cvlist->v.u2[1]) {
         const config_plugin_value_t *cpv = p->cvlist + p->cvlist->v.u2[0];
@@ -103,50 +235,200 @@ SETDEFAULTS_FUNC(mod_evasive_set_defaults) {
     return HANDLER_GO_ON;
 }
 
+static uint32_t mod_evasive_ip_hash(const evasive_ip_table * const ips, const uint8_t * const addr) {
+    return djbhash((const char *)addr, 16, ips->seed) & (ips->size - 1);
+}
+
+static int mod_evasive_ip_key(const plugin_data * const p, const sock_addr * const addr, uint8_t * const key) {
+    uint32_t bits;
+    switch (sock_addr_get_family(addr)) {
+      case AF_INET:
+        memset(key, 0, 10);
+        key[10] = 0xFF;
+        key[11] = 0xFF;
+        memcpy(key+12, &addr->ipv4.sin_addr.s_addr, 4);
+        bits = 96 + p->v4_prefix;
+        break;
+     #ifdef HAVE_IPV6
+      case AF_INET6:
+        memcpy(key, addr->ipv6.sin6_addr.s6_addr, 16);
+        bits = IN6_IS_ADDR_V4MAPPED(&addr->ipv6.sin6_addr)
+          ? 96 + p->v4_prefix
+          : p->v6_prefix;
+        break;
+     #endif
+      default: /* (e.g. AF_UNIX) */
+        return 0;
+    }
+    /* mask addr to prefix */
+    if (bits < 128) {
+        key[bits >> 3] &= (uint8_t)(0xFF << (8 - (bits & 7)));
+        memset(key + (bits >> 3) + 1, 0, 15 - (bits >> 3));
+    }
+    return 1;
+}
+
+__attribute_cold__
+__attribute_noinline__
+static void mod_evasive_ip_table_grow(evasive_ip_table * const ips) {
+    const uint32_t osize = ips->size;
+    evasive_ip ** const optr = ips->ptr;
+    ips->size <<= 1;
+    ips->ptr = calloc(ips->size, sizeof(evasive_ip *));
+    force_assert(ips->ptr);
+    for (uint32_t i = 0; i < osize; ++i) {
+        for (evasive_ip *e = optr[i], *next; e; e = next) {
+            next = e->next;
+            const uint32_t h = mod_evasive_ip_hash(ips, e->addr);
+            e->next = ips->ptr[h];
+            ips->ptr[h] = e;
+        }
+    }
+    free(optr);
+}
+
+static evasive_ip * mod_evasive_ip_get(plugin_data * const p, const sock_addr * const addr) {
+    uint8_t key[16];
+    if (!mod_evasive_ip_key(p, addr, key)) return NULL;
+
+    evasive_ip_table * const ips = &p->ips;
+    uint32_t h = mod_evasive_ip_hash(ips, key);
+    for (evasive_ip *e = ips->ptr[h]; e; e = e->next) {
+        if (0 == memcmp(e->addr, key, 16)) return e;
+    }
+
+    if (ips->used == ips->size) {
+        mod_evasive_ip_table_grow(ips);
+        h = mod_evasive_ip_hash(ips, key);
+    }
+    evasive_ip * const e = calloc(1, sizeof(evasive_ip));
+    force_assert(e);
+    memcpy(e->addr, key, 16);
+    e->atime = log_epoch_secs;
+    e->next = ips->ptr[h];
+    ips->ptr[h] = e;
+    ++ips->used;
+    return e;
+}
+
+static int mod_evasive_rate_limit(const plugin_config * const pconf, evasive_ip * const e) {
+    /* token bucket holding up to max_rps + burst tokens,
+     * refilled at max_rps tokens per second; each request consumes a token */
+    const time_t cur_ts = log_epoch_secs;
+    const uint32_t cap = (uint32_t)pconf->max_rps + pconf->burst;
+    if (0 == e->refill)
+        e->tokens = cap;
+    else if (cur_ts > e->refill) {
+        const uint64_t tokens = (uint64_t)e->tokens
+                              + (uint64_t)(cur_ts - e->refill) * pconf->max_rps;
+        e->tokens = tokens < cap ? (uint32_t)tokens : cap;
+    }
+    else if (e->tokens > cap) /*(config may differ between requests)*/
+        e->tokens = cap;
+    e->refill = cur_ts;
+    e->atime = cur_ts;
+    if (0 == e->tokens) return 1;
+    --e->tokens;
+    return 0;
+}
+
+static handler_t mod_evasive_turn_away(request_st * const r, const plugin_config * const pconf, const unsigned short status, const char * const reason) {
+    if (!pconf->silent) {
+        log_error(r->conf.errh, __FILE__, __LINE__,
+          "%s turned away. %s", r->con->dst_addr_buf->ptr, reason);
+    }
+
+    if (!buffer_is_empty(pconf->location)) {
+        http_header_response_set(r, HTTP_HEADER_LOCATION, CONST_STR_LEN("Location"), CONST_BUF_LEN(pconf->location));
+        r->http_status = 302;
+        r->resp_body_finished = 1;
+    } else {
+        r->http_status = pconf->http_status ? pconf->http_status : status;
+        if (r->http_status != 403) /* 429 or 503 */
+            http_header_response_set(r, HTTP_HEADER_OTHER, CONST_STR_LEN("Retry-After"), CONST_STR_LEN("1"));
+    }
+    r->handler_module = NULL;
+    return HANDLER_FINISHED;
+}
+
 URIHANDLER_FUNC(mod_evasive_uri_handler) {
 	plugin_data *p = p_d;
 
 	mod_evasive_patch_config(r, p);
 
 	/* no limit set, nothing to block */
-	if (p->conf.max_conns == 0) return HANDLER_GO_ON;
-
-	sock_addr * const dst_addr = &r->con->dst_addr;
-	const connections * const conns = &r->con->srv->conns;
-	for (uint32_t i = 0, conns_by_ip = 0; i < conns->used; ++i) {
-		connection *c = conns->ptr[i];
-
-		/* check if other connections are already actively serving data for the same IP
-		 * we can only ban connections which are already behind the 'read request' state
-		 * */
-		if (c->request.state <= CON_STATE_REQUEST_END) continue;
-
-		if (!sock_addr_is_addr_eq(&c->dst_addr, dst_addr)) continue;
-		conns_by_ip++;
-
-		if (conns_by_ip > p->conf.max_conns) {
-			if (!p->conf.silent) {
-				log_error(r->conf.errh, __FILE__, __LINE__,
-				  "%s turned away. Too many connections.",
-				  r->con->dst_addr_buf->ptr);
-			}
-
-			if (!buffer_is_empty(p->conf.location)) {
-				http_header_response_set(r, HTTP_HEADER_LOCATION, CONST_STR_LEN("Location"), CONST_BUF_LEN(p->conf.location));
-				r->http_status = 302;
-				r->resp_body_finished = 1;
-			} else {
-				r->http_status = 403;
-			}
-			r->handler_module = NULL;
-			return HANDLER_FINISHED;
-		}
+	if (p->conf.max_conns == 0 && p->conf.max_rps == 0) return HANDLER_GO_ON;
+
+	/* limit open connections from client addr (counted from socket peer
+	 * addr at accept(); see mod_evasive_handle_con_accept()) */
+	if (p->conf.max_conns) {
+		const evasive_ip * const e = r->con->plugin_ctx[p->id];
+		if (NULL != e && e->conns > p->conf.max_conns)
+			return mod_evasive_turn_away(r, &p->conf, 403,
+			                             "Too many connections.");
+	}
+
+	/* limit request rate from client addr
+	 * (r->con->dst_addr might have been modified, e.g. by mod_extforward) */
+	if (p->conf.max_rps) {
+		evasive_ip * const e = mod_evasive_ip_get(p, &r->con->dst_addr);
+		if (NULL != e && mod_evasive_rate_limit(&p->conf, e))
+			return mod_evasive_turn_away(r, &p->conf, 429,
+			                             "Too many requests.");
 	}
 
 	return HANDLER_GO_ON;
 }
 
 
+CONNECTION_FUNC(mod_evasive_handle_con_accept) {
+    plugin_data * const p = p_d;
+    evasive_ip * const e = mod_evasive_ip_get(p, &con->dst_addr);
+    if (NULL != e) {
+        ++e->conns;
+        e->atime = log_epoch_secs;
+        con->plugin_ctx[p->id] = e;
+    }
+    return HANDLER_GO_ON;
+}
+
+
+CONNECTION_FUNC(mod_evasive_handle_con_close) {
+    plugin_data * const p = p_d;
+    evasive_ip * const e = con->plugin_ctx[p->id];
+    if (NULL != e) {
+        --e->conns;
+        e->atime = log_epoch_secs;
+        con->plugin_ctx[p->id] = NULL;
+    }
+    return HANDLER_GO_ON;
+}
+
+
+TRIGGER_FUNC(mod_evasive_periodic) {
+    /* evict entries with no open connections which have been idle */
+    plugin_data * const p = p_d;
+    const time_t cur_ts = log_epoch_secs;
+    if (cur_ts & 0x7) return HANDLER_GO_ON; /*(continue once each 8 sec)*/
+    UNUSED(srv);
+
+    evasive_ip_table * const ips = &p->ips;
+    for (uint32_t i = 0; i < ips->size; ++i) {
+        for (evasive_ip **ep = ips->ptr + i, *e; (e = *ep); ) {
+            if (0 == e->conns && cur_ts - e->atime > EVASIVE_IP_IDLE) {
+                *ep = e->next;
+                free(e);
+                --ips->used;
+            }
+            else
+                ep = &e->next;
+        }
+    }
+
+    return HANDLER_GO_ON;
+}
+
+
 int mod_evasive_plugin_init(plugin *p);
 int mod_evasive_plugin_init(plugin *p) {
 	p->version     = LIGHTTPD_VERSION_ID;
@@ -155,6 +437,10 @@ int mod_evasive_plugin_init(plugin *p) {
 	p->init        = mod_evasive_init;
 	p->set_defaults = mod_evasive_set_defaults;
 	p->handle_uri_clean  = mod_evasive_uri_handler;
+	p->handle_connection_accept = mod_evasive_handle_con_accept;
+	p->handle_connection_close = mod_evasive_handle_con_close;
+	p->handle_trigger = mod_evasive_periodic;
+	p->cleanup     = mod_evasive_free;
 
 	return 0;
 }
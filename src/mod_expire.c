@@ -188,7 +188,7 @@ static void mod_expire_patch_config(request_st * const r, plugin_data * const p)
     p->conf = p->defaults; /* copy small struct instead of memcpy() */
     /*memcpy(&p->conf, &p->defaults, sizeof(plugin_config));*/
     for (int i = 1, used = p->nconfig; i < used; ++i) {
-        if (config_check_cond(r, (uint32_t)p->cvlist[i].k_id))
+        if ((i = config_check_cond_next(r, p->cvlist, i, used)) < used)
             mod_expire_merge_config(&p->conf, p->cvlist + p->cvlist[i].v.u2[0]);
     }
 }
@@ -219,6 +219,7 @@ SETDEFAULTS_FUNC(mod_expire_set_defaults) {
             switch (cpv->k_id) {
               case 0: /* expire.url */
                 a = cpv->v.a;
+                array_match_index((array *)a, ARRAY_MATCH_KEY_PREFIX);
                 break;
               case 1: /* expire.mimetypes */
                 for (uint32_t k = 0; k < cpv->v.a->used; ++k) {
@@ -232,6 +233,7 @@ SETDEFAULTS_FUNC(mod_expire_set_defaults) {
                         buffer_string_set_length(&ds->key, klen-1);
                 }
                 a = cpv->v.a;
+                array_match_index((array *)a, ARRAY_MATCH_KEY_PREFIX);
                 break;
               default:/* should not happen */
                 break;
@@ -6,6 +6,7 @@
 #include "http_header.h"
 #include "request.h"
 #include "sock_addr.h"
+#include "ipset.h"
 
 #include "plugin.h"
 
@@ -77,27 +78,18 @@ typedef enum {
 	PROXY_FORWARDED_REMOTE_USER  = 0x10
 } proxy_forwarded_t;
 
-struct sock_addr_mask {
-  sock_addr addr;
-  int bits;
-};
-
 struct forwarder_cfg {
   const array *forwarder;
   int forward_all;
-  uint32_t addrs_used;
- #if defined(__STDC_VERSION__) && __STDC_VERSION__-0 >= 199901L /* C99 */
-  struct sock_addr_mask addrs[];
- #else
-  struct sock_addr_mask addrs[1];
- #endif
+  ipset *masks; /* trusted CIDR masks (NULL if none) */
+  ipset *file;  /* trusted addrs and CIDR masks from "file:..." (or NULL) */
 };
 
 typedef struct {
     const array *forwarder;
     int forward_all;
-    uint32_t forward_masks_used;
-    const struct sock_addr_mask *forward_masks;
+    const ipset *forward_masks;
+    const ipset *forward_file;
     const array *headers;
     unsigned int opts;
     char hap_PROXY;
@@ -146,6 +138,12 @@ INIT_FUNC(mod_extforward_init) {
 	return calloc(1, sizeof(plugin_data));
 }
 
+static void mod_extforward_free_forwarder(struct forwarder_cfg * const fwd) {
+    ipset_free(fwd->masks);
+    ipset_free(fwd->file);
+    free(fwd);
+}
+
 FREE_FUNC(mod_extforward_free) {
     plugin_data * const p = p_d;
     array_free(p->default_headers);
@@ -156,7 +154,8 @@ FREE_FUNC(mod_extforward_free) {
         for (; -1 != cpv->k_id; ++cpv) {
             switch (cpv->k_id) {
               case 0: /* extforward.forwarder */
-                if (cpv->vtype == T_CONFIG_LOCAL) free(cpv->v.v);
+                if (cpv->vtype == T_CONFIG_LOCAL)
+                    mod_extforward_free_forwarder(cpv->v.v);
                 break;
               default:
                 break;
@@ -172,8 +171,8 @@ static void mod_extforward_merge_config_cpv(plugin_config * const pconf, const c
             const struct forwarder_cfg * const fwd = cpv->v.v;
             pconf->forwarder = fwd->forwarder;
             pconf->forward_all = fwd->forward_all;
-            pconf->forward_masks_used = fwd->addrs_used;
-            pconf->forward_masks = fwd->addrs;
+            pconf->forward_masks = fwd->masks;
+            pconf->forward_file = fwd->file;
         }
         break;
       case 1: /* extforward.headers */
@@ -203,7 +202,7 @@ static void mod_extforward_merge_config(plugin_config * const pconf, const confi
 static void mod_extforward_patch_config(request_st * const r, plugin_data * const p) {
     memcpy(&p->conf, &p->defaults, sizeof(plugin_config));
     for (int i = 1, used = p->nconfig; i < used; ++i) {
-        if (config_check_cond(r, (uint32_t)p->cvlist[i].k_id))
+        if ((i = config_check_cond_next(r, p->cvlist, i, used)) < used)
             mod_extforward_merge_config(&p->conf, p->cvlist + p->cvlist[i].v.u2[0]);
     }
 }
@@ -214,20 +213,23 @@ static void * mod_extforward_parse_forwarder(server *srv, const array *forwarder
     const int forward_all = (NULL == allds)
       ? 0
       : buffer_eq_icase_slen(&allds->value, CONST_STR_LEN("trust")) ? 1 : -1;
-    uint32_t nmasks = 0;
+
+    struct forwarder_cfg * const fwd = calloc(1, sizeof(struct forwarder_cfg));
+    force_assert(fwd);
+    fwd->forwarder = forwarder;
+    fwd->forward_all = forward_all;
     for (uint32_t j = 0; j < forwarder->used; ++j) {
         data_string * const ds = (data_string *)forwarder->data[j];
-        char * const nm_slash = strchr(ds->key.ptr, '/');
-        if (NULL != nm_slash) ++nmasks;
+        const int is_file =
+          (0 == strncmp(ds->key.ptr, "file:", sizeof("file:")-1));
+        char * const nm_slash = is_file ? NULL : strchr(ds->key.ptr, '/');
         if (!buffer_eq_icase_slen(&ds->value, CONST_STR_LEN("trust"))) {
             if (!buffer_eq_icase_slen(&ds->value, CONST_STR_LEN("untrusted")))
                 log_error(srv->errh, __FILE__, __LINE__,
                   "ERROR: expect \"trust\", not \"%s\" => \"%s\"; "
                   "treating as untrusted", ds->key.ptr, ds->value.ptr);
-            if (NULL != nm_slash) {
-                /* future: consider adding member next to bits in sock_addr_mask
-                 *         with bool trusted/untrusted member */
-                --nmasks;
+            if (NULL != nm_slash || is_file) {
+                /* future: consider separate set of untrusted CIDR masks */
                 log_error(srv->errh, __FILE__, __LINE__,
                   "ERROR: untrusted CIDR masks are ignored (\"%s\" => \"%s\")",
                   ds->key.ptr, ds->value.ptr);
@@ -235,40 +237,41 @@ static void * mod_extforward_parse_forwarder(server *srv, const array *forwarder
             buffer_clear(&ds->value); /* empty is untrusted */
             continue;
         }
-    }
 
-    struct forwarder_cfg * const fwd =
-      malloc(sizeof(struct forwarder_cfg)+sizeof(struct sock_addr_mask)*nmasks);
-    force_assert(fwd);
-    memset(fwd, 0,
-           sizeof(struct forwarder_cfg) + sizeof(struct sock_addr_mask)*nmasks);
-    fwd->forwarder = forwarder;
-    fwd->forward_all = forward_all;
-    fwd->addrs_used = 0;
-    for (uint32_t j = 0; j < forwarder->used; ++j) {
-        data_string * const ds = (data_string *)forwarder->data[j];
-        char * const nm_slash = strchr(ds->key.ptr, '/');
-        if (NULL == nm_slash) continue;
-        if (buffer_string_is_empty(&ds->value)) continue; /* ignored */
-
-        char *err;
-        const int nm_bits = strtol(nm_slash + 1, &err, 10);
-        int rc;
-        if (*err || nm_bits <= 0 || !light_isdigit(nm_slash[1])) {
-            log_error(srv->errh, __FILE__, __LINE__,
-              "ERROR: invalid netmask: %s %s", ds->key.ptr, err);
-            free(fwd);
-            return NULL;
+        if (is_file) {
+            /* set of trusted addrs and CIDR masks from file
+             * (one per line; reloaded if file changes) */
+            if (NULL != fwd->file) {
+                log_error(srv->errh, __FILE__, __LINE__,
+                  "ERROR: only one \"file:...\" entry is permitted: %s",
+                  ds->key.ptr);
+                mod_extforward_free_forwarder(fwd);
+                return NULL;
+            }
+            fwd->file = ipset_init();
+            if (!ipset_load_file(fwd->file, ds->key.ptr+sizeof("file:")-1,
+                                 srv->errh)) {
+                mod_extforward_free_forwarder(fwd);
+                return NULL;
+            }
         }
-        struct sock_addr_mask * const sm = fwd->addrs + fwd->addrs_used++;
-        sm->bits = nm_bits;
-        *nm_slash = '\0';
-        rc = sock_addr_from_str_numeric(&sm->addr, ds->key.ptr, srv->errh);
-        *nm_slash = '/';
-        if (1 != rc) {
-            free(fwd);
-            return NULL;
+        else if (NULL != nm_slash) {
+            if (!light_isdigit(nm_slash[1])) {
+                log_error(srv->errh, __FILE__, __LINE__,
+                  "ERROR: invalid netmask: %s", ds->key.ptr);
+                mod_extforward_free_forwarder(fwd);
+                return NULL;
+            }
+            if (NULL == fwd->masks) fwd->masks = ipset_init();
+            if (!ipset_insert_str(fwd->masks, CONST_BUF_LEN(&ds->key),
+                                  srv->errh)) {
+                mod_extforward_free_forwarder(fwd);
+                return NULL;
+            }
         }
+        else
+            continue;
+
         buffer_clear(&ds->value);
         /* empty is untrusted,
          * e.g. if subnet (incorrectly) appears in X-Forwarded-For */
@@ -495,9 +498,7 @@ static int is_proxy_trusted(plugin_data *p, const char * const ip, size_t iplen)
       (const data_string *)array_get_element_klen(p->conf.forwarder, ip, iplen);
     if (NULL != ds) return !buffer_string_is_empty(&ds->value);
 
-    if (p->conf.forward_masks_used) {
-        const struct sock_addr_mask * const addrs = p->conf.forward_masks;
-        const uint32_t aused = p->conf.forward_masks_used;
+    if (p->conf.forward_masks || p->conf.forward_file) {
         sock_addr addr;
         /* C funcs inet_aton(), inet_pton() require '\0'-terminated IP str */
         char addrstr[64]; /*(larger than INET_ADDRSTRLEN and INET6_ADDRSTRLEN)*/
@@ -508,10 +509,10 @@ static int is_proxy_trusted(plugin_data *p, const char * const ip, size_t iplen)
         if (1 != sock_addr_inet_pton(&addr, addrstr, AF_INET,  0)
          && 1 != sock_addr_inet_pton(&addr, addrstr, AF_INET6, 0)) return 0;
 
-        for (uint32_t i = 0; i < aused; ++i) {
-            if (sock_addr_is_addr_eq_bits(&addr, &addrs[i].addr, addrs[i].bits))
-                return 1;
-        }
+        if (p->conf.forward_masks && ipset_contains(p->conf.forward_masks,&addr))
+            return 1;
+        if (p->conf.forward_file && ipset_contains(p->conf.forward_file, &addr))
+            return 1;
     }
 
     return 0;
@@ -1183,6 +1184,24 @@ CONNECTION_FUNC(mod_extforward_handle_con_close)
 }
 
 
+TRIGGER_FUNC(mod_extforward_periodic)
+{
+    /* reload trusted addrs and CIDR masks from "file:..." if file changed */
+    const plugin_data * const p = p_d;
+    for (int i = 0, used = p->nconfig; i < used; ++i) {
+        const config_plugin_value_t *cpv = p->cvlist + p->cvlist[i].v.u2[0];
+        for (; cpv->k_id != -1; ++cpv) {
+            if (cpv->k_id != 0) continue; /* k_id == 0 for extforward.forwarder */
+            if (cpv->vtype != T_CONFIG_LOCAL) continue;
+            const struct forwarder_cfg * const fwd = cpv->v.v;
+            if (fwd->file) ipset_file_check(fwd->file, srv->errh);
+        }
+    }
+
+    return HANDLER_GO_ON;
+}
+
+
 static int mod_extforward_network_read (connection *con, chunkqueue *cq, off_t max_bytes);
 
 CONNECTION_FUNC(mod_extforward_handle_con_accept)
@@ -1222,6 +1241,7 @@ int mod_extforward_plugin_init(plugin *p) {
 	p->handle_request_reset = mod_extforward_restore;
 	p->handle_connection_close = mod_extforward_handle_con_close;
 	p->set_defaults  = mod_extforward_set_defaults;
+	p->handle_trigger = mod_extforward_periodic;
 	p->cleanup     = mod_extforward_free;
 
 	return 0;
@@ -56,6 +56,9 @@ static void mod_fastcgi_merge_config_cpv(plugin_config * const pconf, const conf
       case 3: /* fastcgi.map-extensions */
         pconf->ext_mapping = cpv->v.a;
         break;
+      case 4: /* fastcgi.balance-key */
+        pconf->balance_key = cpv->v.b;
+        break;
       default:/* should not happen */
         return;
     }
@@ -70,11 +73,19 @@ static void mod_fastcgi_merge_config(plugin_config * const pconf, const config_p
 static void mod_fastcgi_patch_config(request_st * const r, plugin_data * const p) {
     memcpy(&p->conf, &p->defaults, sizeof(plugin_config));
     for (int i = 1, used = p->nconfig; i < used; ++i) {
-        if (config_check_cond(r, (uint32_t)p->cvlist[i].k_id))
+        if ((i = config_check_cond_next(r, p->cvlist, i, used)) < used)
             mod_fastcgi_merge_config(&p->conf,p->cvlist + p->cvlist[i].v.u2[0]);
     }
 }
 
+static void fcgi_hc_request(const gw_host *host, buffer *b);
+static int fcgi_hc_response(const gw_host *host, const buffer *b);
+
+static const gw_hc_proto fcgi_hc_proto = {
+    fcgi_hc_request,
+    fcgi_hc_response
+};
+
 SETDEFAULTS_FUNC(mod_fastcgi_set_defaults) {
     static const config_plugin_keys_t cpk[] = {
       { CONST_STR_LEN("fastcgi.server"),
@@ -89,6 +100,9 @@ SETDEFAULTS_FUNC(mod_fastcgi_set_defaults) {
      ,{ CONST_STR_LEN("fastcgi.map-extensions"),
         T_CONFIG_ARRAY_KVSTRING,
         T_CONFIG_SCOPE_CONNECTION }
+     ,{ CONST_STR_LEN("fastcgi.balance-key"),
+        T_CONFIG_STRING,
+        T_CONFIG_SCOPE_CONNECTION }
      ,{ NULL, 0,
         T_CONFIG_UNSET,
         T_CONFIG_SCOPE_UNSET }
@@ -112,6 +126,7 @@ SETDEFAULTS_FUNC(mod_fastcgi_set_defaults) {
                     gw_plugin_config_free(gw);
                     return HANDLER_ERROR;
                 }
+                if (gw->exts) gw_exts_set_health_check(gw->exts, &fcgi_hc_proto);
                 cpv->v.v = gw;
                 cpv->vtype = T_CONFIG_LOCAL;
                 break;
@@ -122,6 +137,10 @@ SETDEFAULTS_FUNC(mod_fastcgi_set_defaults) {
               case 2: /* fastcgi.debug */
               case 3: /* fastcgi.map-extensions */
                 break;
+              case 4: /* fastcgi.balance-key */
+                if (!gw_get_defaults_balance_key(srv, cpv->v.b))
+                    return HANDLER_ERROR;
+                break;
               default:/* should not happen */
                 break;
             }
@@ -240,7 +259,11 @@ static handler_t fcgi_stdin_append(handler_ctx *hctx) {
 		(chunkqueue_is_empty(hctx->wb) || hctx->wb->first->type == MEM_CHUNK) /* else FILE_CHUNK for temp file */
 		  ? chunkqueue_append_mem(hctx->wb, (const char *)&header, sizeof(header))
 		  : chunkqueue_append_mem_min(hctx->wb, (const char *)&header, sizeof(header));
-		chunkqueue_steal(hctx->wb, req_cq, weWant);
+		if (0 != chunkqueue_steal(hctx->wb, req_cq, weWant)) {
+			log_perror(hctx->r->conf.errh, __FILE__, __LINE__,
+			  "splitting request body temp-file failed");
+			return HANDLER_ERROR;
+		}
 		/*(hctx->wb_reqlen already includes reqbody_length)*/
 	}
 
@@ -278,8 +301,8 @@ static handler_t fcgi_create_env(handler_ctx *hctx) {
 	/* send FCGI_BEGIN_REQUEST */
 
 	if (hctx->request_id == 0) {
-		hctx->request_id = 1; /* always use id 1 as we don't use multiplexing */
-	} else {
+		hctx->request_id = 1; /* use id 1 unless multiplexing */
+	} else if (NULL == hctx->mpx) { /*(else id assigned on shared connection)*/
 		log_error(r->conf.errh, __FILE__, __LINE__,
 		  "fcgi-request is already in use: %d", hctx->request_id);
 	}
@@ -288,7 +311,7 @@ static handler_t fcgi_create_env(handler_ctx *hctx) {
 	fcgi_header(&(beginRecord.header), FCGI_BEGIN_REQUEST, request_id, sizeof(beginRecord.body), 0);
 	beginRecord.body.roleB0 = hctx->gw_mode;
 	beginRecord.body.roleB1 = 0;
-	beginRecord.body.flags = 0;
+	beginRecord.body.flags = hctx->mpx ? FCGI_KEEP_CONN : 0;
 	memset(beginRecord.body.reserved, 0, sizeof(beginRecord.body.reserved));
 
 	buffer_copy_string_len(b, (const char *)&beginRecord, sizeof(beginRecord));
@@ -335,36 +358,32 @@ typedef struct {
 	int      request_id;
 } fastcgi_response_packet;
 
-static int fastcgi_get_packet(handler_ctx *hctx, fastcgi_response_packet *packet) {
-	FCGI_Header header;
-	size_t toread = sizeof(FCGI_Header), flen = 0;
-	off_t rblen = chunkqueue_length(hctx->rb);
-	if (rblen < (off_t)sizeof(FCGI_Header)) {
-		/* no header */
-		if (hctx->conf.debug && 0 != rblen) {
-			log_error(hctx->r->conf.errh, __FILE__, __LINE__,
-			  "FastCGI: header too small: %lld bytes < %zu bytes, "
-			  "waiting for more data", (long long)rblen, sizeof(FCGI_Header));
+static void fastcgi_peek_data(chunkqueue *cq, char *dst, size_t toread) {
+	/* copy data; cq must contain at least toread bytes */
+	for (chunk *c = cq->first; c; c = c->next) {
+		size_t weHave = buffer_string_length(c->mem) - c->offset;
+		if (weHave >= toread) {
+			memcpy(dst, c->mem->ptr + c->offset, toread);
+			break;
 		}
-		return -1;
+
+		memcpy(dst, c->mem->ptr + c->offset, weHave);
+		dst += weHave;
+		toread -= weHave;
 	}
+}
+
+static int fastcgi_peek_packet(chunkqueue *rb, fastcgi_response_packet *packet) {
+	FCGI_Header header;
+	off_t rblen = chunkqueue_length(rb);
+	if (rblen < (off_t)sizeof(FCGI_Header)) return -1; /* no header */
       #ifdef __clang_analyzer__
         /*(unnecessary (length checked above); init to quiet scan-build)*/
         memset(&header, 0, sizeof(FCGI_Header));
       #endif
 
 	/* get at least the FastCGI header */
-	for (chunk *c = hctx->rb->first; c; c = c->next) {
-		size_t weHave = buffer_string_length(c->mem) - c->offset;
-		if (weHave >= toread) {
-			memcpy((char *)&header + flen, c->mem->ptr + c->offset, toread);
-			break;
-		}
-
-		memcpy((char *)&header + flen, c->mem->ptr + c->offset, weHave);
-		flen += weHave;
-		toread -= weHave;
-	}
+	fastcgi_peek_data(rb, (char *)&header, sizeof(FCGI_Header));
 
 	/* we have at least a header, now check how much we have to fetch */
 	packet->len = (header.contentLengthB0 | (header.contentLengthB1 << 8)) + header.paddingLength;
@@ -376,6 +395,21 @@ static int fastcgi_get_packet(handler_ctx *hctx, fastcgi_response_packet *packet
 		return -1; /* we didn't get the full packet */
 	}
 
+	return 0;
+}
+
+static int fastcgi_get_packet(handler_ctx *hctx, fastcgi_response_packet *packet) {
+	if (hctx->conf.debug) {
+		off_t rblen = chunkqueue_length(hctx->rb);
+		if (0 != rblen && rblen < (off_t)sizeof(FCGI_Header)) {
+			log_error(hctx->r->conf.errh, __FILE__, __LINE__,
+			  "FastCGI: header too small: %lld bytes < %zu bytes, "
+			  "waiting for more data", (long long)rblen, sizeof(FCGI_Header));
+		}
+	}
+
+	if (0 != fastcgi_peek_packet(hctx->rb, packet)) return -1;
+
 	chunkqueue_mark_written(hctx->rb, sizeof(FCGI_Header));
 	return 0;
 }
@@ -518,6 +552,145 @@ static handler_t fcgi_recv_parse(request_st * const r, struct http_response_opts
 	return 0 == fin ? HANDLER_GO_ON : HANDLER_FINISHED;
 }
 
+static void fcgi_get_values(buffer * const b) {
+	/* FCGI_GET_VALUES */
+	FCGI_Header header;
+	buffer_string_prepare_copy(b, sizeof(header)); /*(set aside space to fill in later)*/
+	buffer_commit(b, sizeof(header));
+	fcgi_env_add(b, CONST_STR_LEN(FCGI_MAX_CONNS), CONST_STR_LEN(""));
+	fcgi_env_add(b, CONST_STR_LEN(FCGI_MAX_REQS), CONST_STR_LEN(""));
+	fcgi_env_add(b, CONST_STR_LEN(FCGI_MPXS_CONNS), CONST_STR_LEN(""));
+	fcgi_header(&header, FCGI_GET_VALUES, FCGI_NULL_REQUEST_ID,
+		    buffer_string_length(b) - sizeof(header), 0);
+	memcpy(b->ptr, (const char *)&header, sizeof(header));
+}
+
+static void fcgi_mpx_probe(gw_mpx * const mpx) {
+	fcgi_get_values(chunkqueue_append_buffer_open(mpx->wb));
+	chunkqueue_append_buffer_commit(mpx->wb);
+}
+
+static void fcgi_hc_request(const gw_host * const host, buffer * const b) {
+	/* active health check: FCGI_GET_VALUES management record */
+	UNUSED(host);
+	fcgi_get_values(b);
+}
+
+static int fcgi_hc_response(const gw_host * const host, const buffer * const b) {
+	UNUSED(host);
+	if (buffer_string_length(b) < sizeof(FCGI_Header)) return -1;
+	return ((const FCGI_Header *)b->ptr)->type == FCGI_GET_VALUES_RESULT;
+}
+
+static int fcgi_nv_len(const unsigned char **s, size_t *len, uint32_t *n) {
+	const unsigned char *p = *s;
+	if (0 == *len) return -1;
+	if (!(p[0] & 0x80)) {
+		*n = p[0];
+		*s += 1;
+		*len -= 1;
+		return 0;
+	}
+	if (*len < 4) return -1;
+	*n = ((uint32_t)(p[0] & 0x7f) << 24) | ((uint32_t)p[1] << 16)
+	   | ((uint32_t)p[2] << 8) | p[3];
+	*s += 4;
+	*len -= 4;
+	return 0;
+}
+
+static void fcgi_mpx_get_values_result(gw_mpx * const mpx, const buffer * const b) {
+	/* parse name-value pairs of FCGI_GET_VALUES_RESULT */
+	const unsigned char *s = (const unsigned char *)b->ptr;
+	size_t len = buffer_string_length(b);
+	uint32_t max_conns = 0, max_reqs = 0, mpxs = 0;
+	while (len) {
+		uint32_t klen, vlen, v = 0;
+		if (0 != fcgi_nv_len(&s, &len, &klen)) break;
+		if (0 != fcgi_nv_len(&s, &len, &vlen)) break;
+		if ((size_t)klen + vlen > len) break;
+		for (uint32_t i = klen; i < klen + vlen && light_isdigit(s[i]); ++i)
+			v = v * 10 + (s[i] - '0');
+		if (klen == sizeof(FCGI_MAX_CONNS)-1
+		    && 0 == memcmp(s, FCGI_MAX_CONNS, klen))
+			max_conns = v;
+		else if (klen == sizeof(FCGI_MAX_REQS)-1
+			 && 0 == memcmp(s, FCGI_MAX_REQS, klen))
+			max_reqs = v;
+		else if (klen == sizeof(FCGI_MPXS_CONNS)-1
+			 && 0 == memcmp(s, FCGI_MPXS_CONNS, klen))
+			mpxs = v;
+		s += klen + vlen;
+		len -= klen + vlen;
+	}
+	gw_mpx_probe_result(mpx, max_conns, max_reqs, (0 != mpxs));
+}
+
+static int fcgi_mpx_recv(gw_mpx * const mpx) {
+	/* pass complete records to request with the request id of the records */
+	buffer * const b = chunk_buffer_acquire();
+	fastcgi_response_packet packet;
+	uint32_t id = 0;
+
+	while (mpx->state != GW_MPX_CLOSED
+	       && 0 == fastcgi_peek_packet(mpx->rb, &packet)) {
+		const size_t rlen = sizeof(FCGI_Header) + packet.len;
+		if (id != (uint32_t)packet.request_id && !buffer_string_is_empty(b)) {
+			gw_mpx_deliver(mpx, id, b, 0);
+			buffer_clear(b);
+		}
+		id = (uint32_t)packet.request_id;
+
+		if (FCGI_NULL_REQUEST_ID == id) {
+			/* management record */
+			if (FCGI_GET_VALUES_RESULT == packet.type) {
+				chunkqueue_mark_written(mpx->rb, sizeof(FCGI_Header));
+				fastcgi_peek_data(mpx->rb, buffer_string_prepare_copy(b, packet.len), packet.len - packet.padding);
+				buffer_commit(b, packet.len - packet.padding);
+				chunkqueue_mark_written(mpx->rb, packet.len);
+				fcgi_mpx_get_values_result(mpx, b);
+				buffer_clear(b);
+			}
+			else {
+				if (FCGI_UNKNOWN_TYPE == packet.type) /*(FCGI_GET_VALUES)*/
+					gw_mpx_probe_result(mpx, 0, 0, 0);
+				chunkqueue_mark_written(mpx->rb, rlen);
+			}
+			continue;
+		}
+
+		fastcgi_peek_data(mpx->rb, buffer_string_prepare_append(b, rlen), rlen);
+		buffer_commit(b, rlen);
+		chunkqueue_mark_written(mpx->rb, rlen);
+		if (FCGI_END_REQUEST == packet.type) {
+			gw_mpx_deliver(mpx, id, b, 1);
+			buffer_clear(b);
+		}
+	}
+
+	if (!buffer_string_is_empty(b))
+		gw_mpx_deliver(mpx, id, b, 0);
+	chunk_buffer_release(b);
+	return 0;
+}
+
+static void fcgi_mpx_abort(gw_mpx * const mpx, uint32_t id) {
+	FCGI_Header header;
+	fcgi_header(&header, FCGI_ABORT_REQUEST, (int)id, 0, 0);
+	chunkqueue_append_mem(mpx->wb, (const char *)&header, sizeof(header));
+}
+
+static const gw_mpx_proto fcgi_mpx_proto = {
+	fcgi_mpx_probe,
+	fcgi_mpx_recv,
+	fcgi_mpx_abort,
+	NULL,
+	NULL,
+	NULL,
+	NULL,
+	0
+};
+
 static handler_t fcgi_check_extension(request_st * const r, void *p_d, int uri_path_handler) {
 	plugin_data *p = p_d;
 	handler_t rc;
@@ -537,6 +710,7 @@ static handler_t fcgi_check_extension(request_st * const r, void *p_d, int uri_p
 		hctx->opts.pdata = hctx;
 		hctx->stdin_append = fcgi_stdin_append;
 		hctx->create_env = fcgi_create_env;
+		hctx->mpx_proto = &fcgi_mpx_proto;
 		if (!hctx->rb) {
 			hctx->rb = chunkqueue_init();
 		}
@@ -269,7 +269,7 @@ mod_maxmind_patch_config (request_st * const r,
     *pconf = p->defaults; /* copy small struct instead of memcpy() */
     /*memcpy(pconf, &p->defaults, sizeof(plugin_config));*/
     for (int i = 1, used = p->nconfig; i < used; ++i) {
-        if (config_check_cond(r, (uint32_t)p->cvlist[i].k_id))
+        if ((i = config_check_cond_next(r, p->cvlist, i, used)) < used)
             mod_maxminddb_merge_config(pconf, p->cvlist + p->cvlist[i].v.u2[0]);
     }
 }
@@ -84,6 +84,7 @@
 
 #include "base.h"
 #include "fdevent.h"
+#include "file_cache.h"
 #include "http_header.h"
 #include "log.h"
 #include "plugin.h"
@@ -559,7 +560,7 @@ mod_mbedtls_patch_config (request_st * const r, plugin_config * const pconf)
     plugin_data * const p = plugin_data_singleton;
     memcpy(pconf, &p->defaults, sizeof(plugin_config));
     for (int i = 1, used = p->nconfig; i < used; ++i) {
-        if (config_check_cond(r, (uint32_t)p->cvlist[i].k_id))
+        if ((i = config_check_cond_next(r, p->cvlist, i, used)) < used)
             mod_mbedtls_merge_config(pconf, p->cvlist + p->cvlist[i].v.u2[0]);
     }
 }
@@ -1745,7 +1746,8 @@ load_next_chunk (chunkqueue * const cq, off_t max_bytes,
         return 0;
 
     case FILE_CHUNK:
-        if (0 != chunkqueue_open_file_chunk(cq, errh)) return -1;
+        if (NULL == c->file.ref
+            && 0 != chunkqueue_open_file_chunk(cq, errh)) return -1;
 
         {
             off_t offset, toSend;
@@ -1757,6 +1759,18 @@ load_next_chunk (chunkqueue * const cq, off_t max_bytes,
             if (toSend > LOCAL_SEND_BUFSIZE) toSend = LOCAL_SEND_BUFSIZE;
             if (toSend > max_bytes) toSend = max_bytes;
 
+            if (NULL != c->file.ref) { /* cached file content */
+                *data = file_cache_data(c->file.ref, offset,
+                                        local_send_buffer, (size_t)toSend);
+                if (NULL == *data) {
+                    log_error(errh, __FILE__, __LINE__,
+                      "file shrunk: %s", c->mem->ptr);
+                    return -1;
+                }
+                *data_len = toSend;
+                return 0;
+            }
+
             if (-1 == lseek(c->file.fd, offset, SEEK_SET)) {
                 log_perror(errh, __FILE__, __LINE__, "lseek");
                 return -1;
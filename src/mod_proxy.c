@@ -7,10 +7,14 @@
 #include "base.h"
 #include "array.h"
 #include "buffer.h"
+#include "connections.h"
 #include "fdevent.h"
+#include "hpack.h"
+#include "http_chunk.h"
 #include "http_kv.h"
 #include "http_header.h"
 #include "log.h"
+#include "settings.h"
 #include "sock_addr.h"
 #include "status_counter.h"
 
@@ -131,6 +135,9 @@ static void mod_proxy_merge_config_cpv(plugin_config * const pconf, const config
       case 6: /* proxy.replace-http-host */
         pconf->replace_http_host = cpv->v.u;
         break;
+      case 7: /* proxy.balance-key */
+        pconf->gw.balance_key = cpv->v.b;
+        break;
       default:/* should not happen */
         return;
     }
@@ -149,7 +156,7 @@ static void mod_proxy_patch_config(request_st * const r, plugin_data * const p)
 {
     memcpy(&p->conf, &p->defaults, sizeof(plugin_config));
     for (int i = 1, used = p->nconfig; i < used; ++i) {
-        if (config_check_cond(r, (uint32_t)p->cvlist[i].k_id))
+        if ((i = config_check_cond_next(r, p->cvlist, i, used)) < used)
             mod_proxy_merge_config(&p->conf, p->cvlist+p->cvlist[i].v.u2[0]);
     }
 }
@@ -203,6 +210,33 @@ static unsigned int mod_proxy_parse_forwarded(server *srv, const array *a)
 }
 
 
+static void proxy_hc_request(const gw_host * const host, buffer * const b)
+{
+    /* active health check: GET health-check-path (default "/") */
+    buffer_copy_string_len(b, CONST_STR_LEN("GET "));
+    if (!buffer_string_is_empty(host->hc_path))
+        buffer_append_string_buffer(b, host->hc_path);
+    else
+        buffer_append_string_len(b, CONST_STR_LEN("/"));
+    buffer_append_string_len(b, CONST_STR_LEN(" HTTP/1.0\r\nHost: "));
+    if (buffer_string_is_empty(host->host) || AF_UNIX == host->family)
+        buffer_append_string_len(b, CONST_STR_LEN("localhost"));
+    else if (NULL != strchr(host->host->ptr, ':')) { /* IPv6 */
+        buffer_append_string_len(b, CONST_STR_LEN("["));
+        buffer_append_string_buffer(b, host->host);
+        buffer_append_string_len(b, CONST_STR_LEN("]"));
+    }
+    else
+        buffer_append_string_buffer(b, host->host);
+    buffer_append_string_len(b, CONST_STR_LEN("\r\nConnection: close\r\n\r\n"));
+}
+
+static const gw_hc_proto proxy_hc_proto = {
+    proxy_hc_request,
+    gw_health_check_http_status
+};
+
+
 static http_header_remap_opts * mod_proxy_parse_header_opts(server *srv, const array *a)
 {
     http_header_remap_opts header;
@@ -304,6 +338,9 @@ SETDEFAULTS_FUNC(mod_proxy_set_defaults)
      ,{ CONST_STR_LEN("proxy.replace-http-host"),
         T_CONFIG_BOOL,
         T_CONFIG_SCOPE_CONNECTION }
+     ,{ CONST_STR_LEN("proxy.balance-key"),
+        T_CONFIG_STRING,
+        T_CONFIG_SCOPE_CONNECTION }
      ,{ NULL, 0,
         T_CONFIG_UNSET,
         T_CONFIG_SCOPE_UNSET }
@@ -359,6 +396,10 @@ SETDEFAULTS_FUNC(mod_proxy_set_defaults)
                 break;
               case 6: /* proxy.replace-http-host */
                 break;
+              case 7: /* proxy.balance-key */
+                if (!gw_get_defaults_balance_key(srv, cpv->v.b))
+                    return HANDLER_ERROR;
+                break;
               default:/* should not happen */
                 break;
             }
@@ -367,6 +408,7 @@ SETDEFAULTS_FUNC(mod_proxy_set_defaults)
         /* disable check-local for all exts (default enabled) */
         if (gw && gw->exts) { /*(check after gw_set_defaults_backend())*/
             gw_exts_clear_check_local(gw->exts);
+            gw_exts_set_health_check(gw->exts, &proxy_hc_proto);
         }
     }
 
@@ -390,10 +432,7 @@ SETDEFAULTS_FUNC(mod_proxy_set_defaults)
     }
 
     proxy_force_http10 =
-      srv->srvconf.feature_flags
-      && config_plugin_value_tobool(
-           array_get_element_klen(srv->srvconf.feature_flags,
-                                  CONST_STR_LEN("proxy.force-http10")), 0);
+      config_feature_bool(srv, "proxy.force-http10", 0);
 
     return HANDLER_GO_ON;
 }
@@ -821,6 +860,844 @@ static void proxy_set_Forwarded(connection * const con, request_st * const r, co
 }
 
 
+/*
+ * HTTP/2 cleartext (h2c) to backends (host "multiplex" => n)
+ *
+ * Requests are multiplexed as HTTP/2 streams over up to n shared connections
+ * per backend (gw_mpx), started with prior knowledge (RFC 7540 3.4).  A
+ * backend which does not reply to the connection preface with SETTINGS is
+ * sent requests as HTTP/1.1 over separate connections.  Request headers are
+ * HPACK encoded and framed into hctx->gw.wb by proxy_create_env_h2c();
+ * the request body is framed into DATA frames as flow control windows permit
+ * (proxy_h2c_send()).  Response headers are decoded and passed on as an
+ * HTTP/1.1 response header to http_response_parse_headers(), and DATA is
+ * passed on as the response body.  The stream receive window is replenished
+ * as the response is sent to the client (proxy_h2c_resume()), so a slow
+ * client pauses its own stream without stalling the shared connection.
+ */
+
+#define H2_FTYPE_DATA          0x00
+#define H2_FTYPE_HEADERS       0x01
+#define H2_FTYPE_PRIORITY      0x02
+#define H2_FTYPE_RST_STREAM    0x03
+#define H2_FTYPE_SETTINGS      0x04
+#define H2_FTYPE_PUSH_PROMISE  0x05
+#define H2_FTYPE_PING          0x06
+#define H2_FTYPE_GOAWAY        0x07
+#define H2_FTYPE_WINDOW_UPDATE 0x08
+#define H2_FTYPE_CONTINUATION  0x09
+
+#define H2_FLAG_END_STREAM     0x01
+#define H2_FLAG_ACK            0x01
+#define H2_FLAG_END_HEADERS    0x04
+#define H2_FLAG_PADDED         0x08
+#define H2_FLAG_PRIORITY       0x20
+
+#define H2_SETTINGS_HEADER_TABLE_SIZE      0x01
+#define H2_SETTINGS_MAX_CONCURRENT_STREAMS 0x03
+#define H2_SETTINGS_INITIAL_WINDOW_SIZE    0x04
+
+#define H2_E_NO_ERROR           0x00
+#define H2_E_PROTOCOL_ERROR     0x01
+#define H2_E_FLOW_CONTROL_ERROR 0x03
+#define H2_E_REFUSED_STREAM     0x07
+#define H2_E_CANCEL             0x08
+
+#define H2_FRAME_SIZE   16384     /* SETTINGS_MAX_FRAME_SIZE (default) */
+#define H2_WINDOW_SIZE  65535     /* SETTINGS_INITIAL_WINDOW_SIZE (default) */
+#define H2C_CONN_WINDOW (1 << 24) /* connection receive window */
+#define H2C_STREAM_ID_MAX (0x7fffffffu - 2*GW_MPX_STREAMS_MAX)
+
+typedef struct proxy_h2c_stream {
+    uint32_t id;    /* HTTP/2 stream id (0 if request id not in use) */
+    int32_t swin;   /* send window */
+    int32_t rwin;   /* receive window */
+    int hdrs;       /* response headers received */
+    int eos;        /* END_STREAM queued in hctx->gw.wb */
+    off_t hdr_end;  /* end of HEADERS (and CONTINUATION) in hctx->gw.wb */
+    off_t body_end; /* end of request body in hctx->gw.wb (0 if unknown) */
+} proxy_h2c_stream;
+
+typedef struct proxy_h2c {
+    hpack_table enc;
+    hpack_table dec;
+    uint32_t next_id;  /* next stream id */
+    int32_t swin;      /* connection send window */
+    int32_t rwin;      /* connection receive window */
+    int32_t init_swin; /* peer SETTINGS_INITIAL_WINDOW_SIZE */
+    uint32_t hb_id;    /* stream id of header block awaiting CONTINUATION */
+    int hb_flags;
+    buffer *hb;        /* header block */
+    buffer *tb;
+    proxy_h2c_stream streams[GW_MPX_STREAMS_MAX+1]; /* by request id */
+} proxy_h2c;
+
+static void proxy_h2c_frame_hdr (unsigned char * const s, const uint32_t len, const int type, const int flags, const uint32_t id)
+{
+    s[0] = (len >> 16) & 0xff;
+    s[1] = (len >>  8) & 0xff;
+    s[2] =  len        & 0xff;
+    s[3] = type;
+    s[4] = flags;
+    s[5] = (id >> 24) & 0x7f;
+    s[6] = (id >> 16) & 0xff;
+    s[7] = (id >>  8) & 0xff;
+    s[8] =  id        & 0xff;
+}
+
+static uint32_t proxy_h2c_u32 (const unsigned char * const s)
+{
+    return ((uint32_t)s[0] << 24) | ((uint32_t)s[1] << 16)
+         | ((uint32_t)s[2] <<  8) |  (uint32_t)s[3];
+}
+
+static void proxy_h2c_frame_u32 (gw_mpx * const mpx, const int type, const uint32_t id, const uint32_t v)
+{
+    /* RST_STREAM or WINDOW_UPDATE */
+    unsigned char f[13];
+    proxy_h2c_frame_hdr(f, 4, type, 0, id);
+    f[9]  = (v >> 24) & 0xff;
+    f[10] = (v >> 16) & 0xff;
+    f[11] = (v >>  8) & 0xff;
+    f[12] =  v        & 0xff;
+    chunkqueue_append_mem_min(mpx->wb, (char *)f, sizeof(f));
+}
+
+static uint32_t proxy_h2c_stream_slot (const proxy_h2c * const h2, const uint32_t id)
+{
+    /* request id (slot) of stream id (0 if stream closed or unknown) */
+    for (uint32_t i = 1; i <= GW_MPX_STREAMS_MAX; ++i) {
+        if (h2->streams[i].id == id) return i;
+    }
+    return 0;
+}
+
+static void proxy_h2c_stream_reset (gw_mpx * const mpx, proxy_h2c * const h2, const uint32_t i, const uint32_t err)
+{
+    proxy_h2c_frame_u32(mpx, H2_FTYPE_RST_STREAM, h2->streams[i].id, err);
+    h2->streams[i].id = 0;
+    gw_mpx_reset(mpx, i, 0);
+}
+
+static void proxy_h2c_stream_end (gw_mpx * const mpx, proxy_h2c * const h2, const uint32_t i)
+{
+    /* response complete; reset stream if request was not completely sent */
+    proxy_h2c_stream * const st = h2->streams + i;
+    if (!st->eos || !chunkqueue_is_empty(mpx->streams[i]->wb))
+        proxy_h2c_frame_u32(mpx, H2_FTYPE_RST_STREAM, st->id, H2_E_NO_ERROR);
+    st->id = 0;
+}
+
+static void proxy_h2c_stream_wake (gw_mpx * const mpx, const uint32_t i)
+{
+    /* resume request waiting for send window */
+    gw_handler_ctx * const hctx = mpx->streams[i];
+    if (NULL != hctx && !chunkqueue_is_empty(hctx->wb))
+        joblist_append(hctx->r->con);
+}
+
+static void proxy_h2c_stream_window (gw_mpx * const mpx, proxy_h2c * const h2, gw_handler_ctx * const hctx)
+{
+    /* replenish stream receive window unless response is backlogged */
+    proxy_h2c_stream * const st = h2->streams + hctx->request_id;
+    if (0 == st->id || st->rwin > H2_WINDOW_SIZE/2) return;
+    request_st * const r = hctx->r;
+    if ((r->conf.stream_response_body & FDEVENT_STREAM_RESPONSE_BUFMIN)
+        && chunkqueue_length(r->write_queue) > 65536 - 4096) return;
+    proxy_h2c_frame_u32(mpx, H2_FTYPE_WINDOW_UPDATE, st->id,
+                        (uint32_t)(H2_WINDOW_SIZE - st->rwin));
+    st->rwin = H2_WINDOW_SIZE;
+}
+
+
+typedef struct proxy_h2c_hdrs {
+    buffer *b;  /* "HTTP/1.1 NNN\r\n" followed by "k: v\r\n" fields */
+    int status;
+    int err;    /* malformed */
+} proxy_h2c_hdrs;
+
+static int proxy_h2c_field_chars (const char * const s, const uint32_t len)
+{
+    for (uint32_t i = 0; i < len; ++i) {
+        if (s[i] == '\r' || s[i] == '\n' || s[i] == '\0') return 0;
+    }
+    return 1;
+}
+
+static void proxy_h2c_hpack_field (void *ctx, const char *k, uint32_t klen, const char *v, uint32_t vlen)
+{
+    proxy_h2c_hdrs * const h = ctx;
+    if (h->err) return;
+    if (0 == klen || !proxy_h2c_field_chars(k, klen)
+        || !proxy_h2c_field_chars(v, vlen)) {
+        h->err = 1;
+        return;
+    }
+
+    if (k[0] == ':') {
+        /* :status is the only response pseudo-header; must be first */
+        if (klen == 7 && 0 == memcmp(k, ":status", 7) && 0 == h->status
+            && vlen == 3 && buffer_string_length(h->b) == sizeof("HTTP/1.1 000\r\n")-1
+            && light_isdigit(v[0]) && light_isdigit(v[1])
+            && light_isdigit(v[2])) {
+            h->status = (v[0]-'0')*100 + (v[1]-'0')*10 + (v[2]-'0');
+            memcpy(h->b->ptr + sizeof("HTTP/1.1 ")-1, v, 3);
+        }
+        else
+            h->err = 1;
+        return;
+    }
+
+    if (NULL != memchr(k, ':', klen)) {
+        h->err = 1;
+        return;
+    }
+
+    /* omit connection-specific header fields (not valid in HTTP/2) */
+    switch (klen) {
+      case 7:
+        if (0 == memcmp(k, "upgrade", 7)) return;
+        break;
+      case 10:
+        if (0 == memcmp(k, "connection", 10)) return;
+        if (0 == memcmp(k, "keep-alive", 10)) return;
+        break;
+      case 16:
+        if (0 == memcmp(k, "proxy-connection", 16)) return;
+        break;
+      case 17:
+        if (0 == memcmp(k, "transfer-encoding", 17)) return;
+        break;
+      default:
+        break;
+    }
+
+    buffer * const b = h->b;
+    char * const s = buffer_string_prepare_append(b, klen + vlen + 4);
+    memcpy(s, k, klen);
+    s[klen] = ':';
+    s[klen+1] = ' ';
+    memcpy(s+klen+2, v, vlen);
+    s[klen+2+vlen] = '\r';
+    s[klen+3+vlen] = '\n';
+    buffer_commit(b, klen + vlen + 4);
+}
+
+static int proxy_h2c_recv_headers (gw_mpx * const mpx, proxy_h2c * const h2, const uint32_t id, const int flags)
+{
+    /* decode every header block received to keep HPACK state in sync,
+     * even if stream has since been reset */
+    buffer * const b = chunk_buffer_acquire();
+    buffer_copy_string_len(b, CONST_STR_LEN("HTTP/1.1 000\r\n"));
+    proxy_h2c_hdrs h = { b, 0, 0 };
+    const int rc = hpack_decode(&h2->dec, (unsigned char *)h2->hb->ptr,
+                                buffer_string_length(h2->hb), h2->tb,
+                                proxy_h2c_hpack_field, &h);
+    buffer_clear(h2->hb);
+    const uint32_t i = (0 == rc) ? proxy_h2c_stream_slot(h2, id) : 0;
+    if (i) {
+        proxy_h2c_stream * const st = h2->streams + i;
+        const int end = (flags & H2_FLAG_END_STREAM);
+        if (st->hdrs) { /* trailers (not passed on) */
+            if (end) {
+                proxy_h2c_stream_end(mpx, h2, i);
+                gw_mpx_deliver(mpx, i, NULL, 1);
+            }
+            else
+                proxy_h2c_stream_reset(mpx, h2, i, H2_E_PROTOCOL_ERROR);
+        }
+        else if (h.err || 0 == h.status || (h.status < 200 && end))
+            proxy_h2c_stream_reset(mpx, h2, i, H2_E_PROTOCOL_ERROR);
+        else if (h.status >= 200) { /* (1xx informational responses ignored) */
+            st->hdrs = 1;
+            buffer_append_string_len(b, CONST_STR_LEN("\r\n"));
+            if (end) proxy_h2c_stream_end(mpx, h2, i);
+            gw_mpx_deliver(mpx, i, b, end);
+        }
+    }
+    chunk_buffer_release(b);
+    return rc;
+}
+
+static int proxy_h2c_recv_data (gw_mpx * const mpx, proxy_h2c * const h2, const uint32_t id, const int flags, const unsigned char *s, uint32_t len)
+{
+    /* count whole frame (including padding) against flow control windows */
+    const uint32_t flen = len;
+    if (flags & H2_FLAG_PADDED) {
+        if (0 == len || s[0] >= len) return -1;
+        len -= 1 + s[0];
+        ++s;
+    }
+
+    h2->rwin -= (int32_t)flen;
+    if (h2->rwin < 0) return -1;
+    if (h2->rwin < H2C_CONN_WINDOW/2) {
+        proxy_h2c_frame_u32(mpx, H2_FTYPE_WINDOW_UPDATE, 0,
+                            (uint32_t)(H2C_CONN_WINDOW - h2->rwin));
+        h2->rwin = H2C_CONN_WINDOW;
+    }
+
+    const uint32_t i = proxy_h2c_stream_slot(h2, id);
+    if (0 == i) return 0; /* stream closed or reset */
+    proxy_h2c_stream * const st = h2->streams + i;
+    if (!st->hdrs) {
+        proxy_h2c_stream_reset(mpx, h2, i, H2_E_PROTOCOL_ERROR);
+        return 0;
+    }
+    st->rwin -= (int32_t)flen;
+    if (st->rwin < 0) {
+        proxy_h2c_stream_reset(mpx, h2, i, H2_E_FLOW_CONTROL_ERROR);
+        return 0;
+    }
+
+    const int end = (flags & H2_FLAG_END_STREAM);
+    if (end)
+        proxy_h2c_stream_end(mpx, h2, i);
+    else if (0 == len)
+        return 0;
+    buffer_copy_string_len(h2->tb, (const char *)s, len);
+    gw_mpx_deliver(mpx, i, h2->tb, end); /*(might reset stream)*/
+    if (!end && NULL != mpx->streams[i] && st->id == id)
+        proxy_h2c_stream_window(mpx, h2, mpx->streams[i]);
+    return 0;
+}
+
+static int proxy_h2c_recv_settings (gw_mpx * const mpx, proxy_h2c * const h2, const int flags, const unsigned char *s, const uint32_t len)
+{
+    if (flags & H2_FLAG_ACK) return (0 == len) ? 0 : -1;
+    if (len % 6) return -1;
+
+    uint32_t max_reqs = 0;
+    for (const unsigned char * const end = s + len; s < end; s += 6) {
+        const uint32_t v = proxy_h2c_u32(s+2);
+        switch ((s[0] << 8) | s[1]) {
+          case H2_SETTINGS_HEADER_TABLE_SIZE:
+            hpack_table_resize(&h2->enc, v);
+            break;
+          case H2_SETTINGS_MAX_CONCURRENT_STREAMS:
+            /* (limit shared between connections to backend) */
+            max_reqs = (v > GW_MPX_STREAMS_MAX ? GW_MPX_STREAMS_MAX : v ? v : 1)
+                     * mpx->host->multiplex;
+            break;
+          case H2_SETTINGS_INITIAL_WINDOW_SIZE:
+            if (v > 0x7fffffff) return -1;
+            {
+                /* adjust send window of open streams by difference */
+                const int32_t delta = (int32_t)v - h2->init_swin;
+                h2->init_swin = (int32_t)v;
+                for (uint32_t i = 1; i <= GW_MPX_STREAMS_MAX; ++i) {
+                    proxy_h2c_stream * const st = h2->streams + i;
+                    if (0 == st->id) continue;
+                    /* (FLOW_CONTROL_ERROR if window exceeds 2^31-1) */
+                    if (delta > 0 && st->swin > 0x7fffffff - delta) return -1;
+                    st->swin += delta;
+                    if (delta > 0) proxy_h2c_stream_wake(mpx, i);
+                }
+            }
+            break;
+          default:
+            break;
+        }
+    }
+
+    unsigned char f[9];
+    proxy_h2c_frame_hdr(f, 0, H2_FTYPE_SETTINGS, H2_FLAG_ACK, 0);
+    chunkqueue_append_mem_min(mpx->wb, (char *)f, sizeof(f));
+
+    /* SETTINGS is the first frame sent by an HTTP/2 server;
+     * SETTINGS_MAX_CONCURRENT_STREAMS might be changed in later SETTINGS */
+    if (mpx->state == GW_MPX_PROBE)
+        gw_mpx_probe_result(mpx, 0, max_reqs, 1);
+    else if (max_reqs)
+        gw_mpx_max_reqs(mpx, max_reqs);
+    return 0;
+}
+
+static void proxy_h2c_recv_goaway (gw_mpx * const mpx, proxy_h2c * const h2, const uint32_t last_id, const uint32_t err)
+{
+    if (err != H2_E_NO_ERROR)
+        log_error(mpx->srv->errh, __FILE__, __LINE__,
+          "GOAWAY (error %u) on h2c connection to %s",
+          err, mpx->proc->connection_name->ptr);
+    /* send no new streams; retry requests not processed by backend */
+    mpx->state = GW_MPX_DRAIN;
+    for (uint32_t i = 1; i <= GW_MPX_STREAMS_MAX; ++i) {
+        proxy_h2c_stream * const st = h2->streams + i;
+        if (NULL == mpx->streams[i] || (st->id && st->id <= last_id))
+            continue;
+        st->id = 0;
+        gw_mpx_reset(mpx, i, 1);
+    }
+}
+
+static int proxy_h2c_recv_frame (gw_mpx * const mpx, proxy_h2c * const h2, const unsigned char * const s, const uint32_t len)
+{
+    const int type = s[3];
+    const int flags = s[4];
+    const uint32_t id = proxy_h2c_u32(s+5) & 0x7fffffff;
+    const unsigned char *p = s + 9;
+
+    if (mpx->state == GW_MPX_PROBE && type != H2_FTYPE_SETTINGS) {
+        gw_mpx_probe_result(mpx, 0, 0, 0); /* not an HTTP/2 server */
+        return 0;
+    }
+
+    if (h2->hb_id && (type != H2_FTYPE_CONTINUATION || id != h2->hb_id))
+        return -1; /* header block must be contiguous */
+
+    switch (type) {
+      case H2_FTYPE_DATA:
+        if (0 == id) return -1;
+        return proxy_h2c_recv_data(mpx, h2, id, flags, p, len);
+
+      case H2_FTYPE_HEADERS:
+        if (0 == id) return -1;
+        {
+            uint32_t n = len;
+            if (flags & H2_FLAG_PADDED) {
+                if (0 == n || p[0] >= n) return -1;
+                n -= 1 + p[0];
+                ++p;
+            }
+            if (flags & H2_FLAG_PRIORITY) {
+                if (n < 5) return -1;
+                n -= 5;
+                p += 5;
+            }
+            buffer_copy_string_len(h2->hb, (const char *)p, n);
+        }
+        if (flags & H2_FLAG_END_HEADERS)
+            return proxy_h2c_recv_headers(mpx, h2, id, flags);
+        h2->hb_id = id;
+        h2->hb_flags = flags;
+        return 0;
+
+      case H2_FTYPE_CONTINUATION:
+        if (0 == h2->hb_id) return -1;
+        if (buffer_string_length(h2->hb) + len > MAX_HTTP_REQUEST_HEADER*2)
+            return -1; /*(reuse as limit of response header block size)*/
+        buffer_append_string_len(h2->hb, (const char *)p, len);
+        if (!(flags & H2_FLAG_END_HEADERS)) return 0;
+        h2->hb_id = 0;
+        return proxy_h2c_recv_headers(mpx, h2, id, h2->hb_flags);
+
+      case H2_FTYPE_RST_STREAM:
+        if (0 == id || len != 4) return -1;
+        {
+            const uint32_t i = proxy_h2c_stream_slot(h2, id);
+            if (0 == i) return 0;
+            /* retry if refused before processing */
+            const int retry = (proxy_h2c_u32(p) == H2_E_REFUSED_STREAM
+                               && !h2->streams[i].hdrs);
+            h2->streams[i].id = 0;
+            gw_mpx_reset(mpx, i, retry);
+        }
+        return 0;
+
+      case H2_FTYPE_SETTINGS:
+        if (0 != id) return -1;
+        return proxy_h2c_recv_settings(mpx, h2, flags, p, len);
+
+      case H2_FTYPE_PING:
+        if (0 != id || len != 8) return -1;
+        if (!(flags & H2_FLAG_ACK)) {
+            unsigned char f[17];
+            proxy_h2c_frame_hdr(f, 8, H2_FTYPE_PING, H2_FLAG_ACK, 0);
+            memcpy(f+9, p, 8);
+            chunkqueue_append_mem_min(mpx->wb, (char *)f, sizeof(f));
+        }
+        return 0;
+
+      case H2_FTYPE_GOAWAY:
+        if (0 != id || len < 8) return -1;
+        proxy_h2c_recv_goaway(mpx, h2, proxy_h2c_u32(p) & 0x7fffffff,
+                              proxy_h2c_u32(p+4));
+        return 0;
+
+      case H2_FTYPE_WINDOW_UPDATE:
+        if (len != 4) return -1;
+        {
+            const int32_t incr = (int32_t)(proxy_h2c_u32(p) & 0x7fffffff);
+            if (0 == id) {
+                if (0 == incr || h2->swin > 0x7fffffff - incr) return -1;
+                const int wake = (h2->swin <= 0);
+                h2->swin += incr;
+                if (wake) {
+                    for (uint32_t i = 1; i <= GW_MPX_STREAMS_MAX; ++i)
+                        proxy_h2c_stream_wake(mpx, i);
+                }
+                return 0;
+            }
+            const uint32_t i = proxy_h2c_stream_slot(h2, id);
+            if (0 == i) return 0;
+            proxy_h2c_stream * const st = h2->streams + i;
+            if (0 == incr)
+                proxy_h2c_stream_reset(mpx, h2, i, H2_E_PROTOCOL_ERROR);
+            else if (st->swin > 0x7fffffff - incr)
+                proxy_h2c_stream_reset(mpx, h2, i, H2_E_FLOW_CONTROL_ERROR);
+            else {
+                const int wake = (st->swin <= 0);
+                st->swin += incr;
+                if (wake) proxy_h2c_stream_wake(mpx, i);
+            }
+        }
+        return 0;
+
+      case H2_FTYPE_PUSH_PROMISE: /*(SETTINGS_ENABLE_PUSH 0 sent)*/
+        return -1;
+
+      default: /* PRIORITY and unknown frame types are ignored */
+        return 0;
+    }
+}
+
+static int proxy_h2c_recv (gw_mpx * const mpx)
+{
+    proxy_h2c * const h2 = mpx->pctx;
+    chunkqueue * const cq = mpx->rb;
+    while (mpx->state != GW_MPX_CLOSED) {
+        const off_t cqlen = chunkqueue_length(cq);
+        if (cqlen < 9) break;
+        chunk *c = cq->first;
+        if (buffer_string_length(c->mem) - c->offset < 9)
+            chunkqueue_compact_mem(cq, 9);
+        c = cq->first;
+        const unsigned char *s = (unsigned char *)c->mem->ptr + c->offset;
+        const uint32_t len = (s[0] << 16) | (s[1] << 8) | s[2];
+        if (len > H2_FRAME_SIZE) {
+            if (mpx->state == GW_MPX_PROBE) { /* not an HTTP/2 server */
+                gw_mpx_probe_result(mpx, 0, 0, 0);
+                break;
+            }
+            return -1;
+        }
+        if (cqlen < (off_t)(9 + len)) break;
+        if (buffer_string_length(c->mem) - c->offset < 9 + len) {
+            chunkqueue_compact_mem(cq, 9 + len);
+            c = cq->first;
+            s = (unsigned char *)c->mem->ptr + c->offset;
+        }
+        const int rc = proxy_h2c_recv_frame(mpx, h2, s, len);
+        chunkqueue_mark_written(cq, 9 + len);
+        if (0 != rc) {
+            log_error(mpx->srv->errh, __FILE__, __LINE__,
+              "HTTP/2 protocol error on h2c connection to %s",
+              mpx->proc->connection_name->ptr);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void proxy_h2c_init (gw_mpx * const mpx)
+{
+    proxy_h2c * const h2 = calloc(1, sizeof(*h2));
+    force_assert(h2);
+    hpack_table_init(&h2->enc, HPACK_TABLE_SIZE_DEFAULT);
+    hpack_table_init(&h2->dec, HPACK_TABLE_SIZE_DEFAULT);
+    h2->next_id = 1;
+    h2->swin = H2_WINDOW_SIZE;
+    h2->rwin = H2C_CONN_WINDOW;
+    h2->init_swin = H2_WINDOW_SIZE;
+    h2->hb = chunk_buffer_acquire();
+    h2->tb = chunk_buffer_acquire();
+    mpx->pctx = h2;
+
+    /* connection preface, SETTINGS (SETTINGS_ENABLE_PUSH 0),
+     * WINDOW_UPDATE (connection receive window) */
+    static const char preface[] =
+      "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
+      "\x00\x00\x06\x04\x00\x00\x00\x00\x00" "\x00\x02\x00\x00\x00\x00";
+    chunkqueue_append_mem(mpx->wb, preface, sizeof(preface)-1);
+    proxy_h2c_frame_u32(mpx, H2_FTYPE_WINDOW_UPDATE, 0,
+                        H2C_CONN_WINDOW - H2_WINDOW_SIZE);
+}
+
+static void proxy_h2c_free (gw_mpx * const mpx)
+{
+    proxy_h2c * const h2 = mpx->pctx;
+    if (NULL == h2) return;
+    hpack_table_free(&h2->enc);
+    hpack_table_free(&h2->dec);
+    chunk_buffer_release(h2->hb);
+    chunk_buffer_release(h2->tb);
+    free(h2);
+}
+
+static void proxy_h2c_abort (gw_mpx * const mpx, const uint32_t i)
+{
+    proxy_h2c * const h2 = mpx->pctx;
+    proxy_h2c_stream * const st = h2->streams + i;
+    if (st->id) {
+        proxy_h2c_frame_u32(mpx, H2_FTYPE_RST_STREAM, st->id, H2_E_CANCEL);
+        st->id = 0;
+    }
+    /* stream is closed once RST_STREAM is sent; release request id */
+    gw_mpx_deliver(mpx, i, NULL, 1);
+}
+
+static int proxy_h2c_send (gw_mpx * const mpx, gw_handler_ctx * const hctx)
+{
+    proxy_h2c * const h2 = mpx->pctx;
+    proxy_h2c_stream * const st = h2->streams + hctx->request_id;
+    chunkqueue * const wb = hctx->wb;
+
+    /* HEADERS (and CONTINUATION) frames */
+    if (wb->bytes_out < st->hdr_end
+        && 0 != chunkqueue_steal(mpx->wb, wb, st->hdr_end - wb->bytes_out))
+        return -1;
+
+    /* request body as DATA frames, as flow control windows permit */
+    off_t end = wb->bytes_in;
+    if (st->body_end && end > st->body_end) end = st->body_end;
+    while (wb->bytes_out < end && st->swin > 0 && h2->swin > 0) {
+        off_t len = end - wb->bytes_out;
+        if (len > st->swin)      len = st->swin;
+        if (len > h2->swin)      len = h2->swin;
+        if (len > H2_FRAME_SIZE) len = H2_FRAME_SIZE;
+        unsigned char f[9];
+        proxy_h2c_frame_hdr(f, (uint32_t)len, H2_FTYPE_DATA, 0, st->id);
+        chunkqueue_append_mem_min(mpx->wb, (char *)f, sizeof(f));
+        if (0 != chunkqueue_steal(mpx->wb, wb, len)) {
+            /*(DATA frame is incomplete; connection is closed)*/
+            log_perror(hctx->r->conf.errh, __FILE__, __LINE__,
+              "splitting request body temp-file failed");
+            return -1;
+        }
+        st->swin -= (int32_t)len;
+        h2->swin -= (int32_t)len;
+    }
+
+    /* empty DATA frame with END_STREAM (queued by proxy_h2c_stdin_append())*/
+    if (st->body_end && wb->bytes_out == st->body_end
+        && !chunkqueue_is_empty(wb))
+        return chunkqueue_steal(mpx->wb, wb, chunkqueue_length(wb));
+
+    return 0;
+}
+
+static void proxy_h2c_resume (gw_mpx * const mpx, gw_handler_ctx * const hctx)
+{
+    proxy_h2c_stream_window(mpx, mpx->pctx, hctx);
+}
+
+static const gw_mpx_proto proxy_h2c_proto = {
+    NULL, /*(server SETTINGS follow connection preface)*/
+    proxy_h2c_recv,
+    proxy_h2c_abort,
+    proxy_h2c_init,
+    proxy_h2c_free,
+    proxy_h2c_send,
+    proxy_h2c_resume,
+    1  /*(HTTP/1.1 is not sent to backend once h2c is negotiated)*/
+};
+
+
+static handler_t proxy_h2c_parse(request_st * const r, struct http_response_opts_t * const opts, buffer * const b, size_t n) {
+    /* (b is complete response header, or DATA) */
+    if (0 == n) return HANDLER_GO_ON;
+    if (0 == r->resp_body_started)
+        return http_response_parse_headers(r, opts, b);
+    return (0 == http_chunk_append_buffer(r, b)) ? HANDLER_GO_ON : HANDLER_ERROR;
+}
+
+
+static handler_t proxy_h2c_stdin_append(gw_handler_ctx *hctx) {
+    proxy_h2c * const h2 = hctx->mpx->pctx;
+    proxy_h2c_stream * const st = h2->streams + hctx->request_id;
+    chunkqueue * const req_cq = hctx->r->reqbody_queue;
+    const off_t req_cqlen = req_cq->bytes_in - req_cq->bytes_out;
+    if (req_cqlen) {
+        if (0 == st->body_end) /* Transfer-Encoding: chunked from client */
+            hctx->wb_reqlen += (hctx->wb_reqlen >= 0) ? req_cqlen : -req_cqlen;
+        if (0 != chunkqueue_steal(hctx->wb, req_cq, req_cqlen)) {
+            log_perror(hctx->r->conf.errh, __FILE__, __LINE__,
+              "splitting request body temp-file failed");
+            return HANDLER_ERROR;
+        }
+    }
+
+    if (hctx->wb->bytes_in == hctx->wb_reqlen && !st->eos) {
+        /* end request body with empty DATA frame with END_STREAM */
+        unsigned char f[9];
+        proxy_h2c_frame_hdr(f, 0, H2_FTYPE_DATA, H2_FLAG_END_STREAM, st->id);
+        chunkqueue_append_mem(hctx->wb, (char *)f, sizeof(f));
+        st->body_end = hctx->wb_reqlen;
+        st->eos = 1;
+        hctx->wb_reqlen += (off_t)sizeof(f);
+    }
+
+    return HANDLER_GO_ON;
+}
+
+
+static void proxy_h2c_encode_remap (handler_ctx * const hctx, buffer * const hb, const buffer * const k, const buffer * const v)
+{
+    /* remap URI in value, e.g. Destination */
+    buffer * const tb = hctx->gw.r->tmp_buf;
+    buffer_copy_buffer(tb, v);
+    http_header_remap_uri(tb, 0, &hctx->conf.header, 1);
+    hpack_encode_field(&((proxy_h2c *)hctx->gw.mpx->pctx)->enc, hb,
+                       CONST_BUF_LEN(k), CONST_BUF_LEN(tb), HPACK_FIELD_INDEX);
+}
+
+
+static handler_t proxy_create_env_h2c(handler_ctx * const hctx) {
+	request_st * const r = hctx->gw.r;
+	gw_mpx * const mpx = hctx->gw.mpx;
+	proxy_h2c * const h2 = mpx->pctx;
+	proxy_h2c_stream * const st = h2->streams + hctx->gw.request_id;
+	hpack_table * const enc = &h2->enc;
+	const int remap_headers = (NULL != hctx->conf.header.urlpaths
+				   || NULL != hctx->conf.header.hosts_request);
+	buffer * const tb = r->tmp_buf;
+	buffer * const hb = chunk_buffer_acquire(); /* header block */
+
+	/* "Forwarded" and legacy X- headers */
+	proxy_set_Forwarded(r->con, r, hctx->conf.forwarded);
+
+	/* pseudo-header fields */
+	const char * const m = get_http_method_name(r->http_method);
+	hpack_encode_field(enc, hb, CONST_STR_LEN(":method"), m, strlen(m), HPACK_FIELD_INDEX);
+	hpack_encode_field(enc, hb, CONST_STR_LEN(":scheme"), CONST_STR_LEN("http"), HPACK_FIELD_INDEX);
+	buffer_copy_buffer(tb, &r->target);
+	if (remap_headers)
+		http_header_remap_uri(tb, 0, &hctx->conf.header, 1);
+	hpack_encode_field(enc, hb, CONST_STR_LEN(":path"), CONST_BUF_LEN(tb), HPACK_FIELD_NOINDEX);
+	if (hctx->conf.replace_http_host && !buffer_string_is_empty(hctx->gw.host->id)) {
+		hpack_encode_field(enc, hb, CONST_STR_LEN(":authority"), CONST_BUF_LEN(hctx->gw.host->id), HPACK_FIELD_INDEX);
+	} else if (!buffer_string_is_empty(r->http_host)) {
+		buffer_copy_buffer(tb, r->http_host);
+		if (remap_headers)
+			http_header_remap_host(tb, 0, &hctx->conf.header, 1, buffer_string_length(tb));
+		hpack_encode_field(enc, hb, CONST_STR_LEN(":authority"), CONST_BUF_LEN(tb), HPACK_FIELD_INDEX);
+	}
+
+	if (r->reqbody_length > 0
+	    || (0 == r->reqbody_length
+		&& !http_method_get_or_head(r->http_method))) {
+		const buffer *vb = http_header_request_get(r, HTTP_HEADER_CONTENT_LENGTH, CONST_STR_LEN("Content-Length"));
+		if (NULL == vb) {
+			char buf[LI_ITOSTRING_LENGTH];
+			http_header_request_set(r, HTTP_HEADER_CONTENT_LENGTH, CONST_STR_LEN("Content-Length"),
+			                        buf, li_itostrn(buf, sizeof(buf), r->reqbody_length));
+		}
+	}
+
+	/* request header (omitting connection-specific header fields) */
+	for (size_t i = 0, used = r->rqst_headers.used; i < used; ++i) {
+		data_string *ds = (data_string *)r->rqst_headers.data[i];
+		const size_t klen = buffer_string_length(&ds->key);
+		int how = HPACK_FIELD_INDEX;
+		switch (klen) {
+		default:
+			break;
+		case 2:
+			if (buffer_is_equal_caseless_string(&ds->key, CONST_STR_LEN("TE"))) {
+				/* TE is permitted in HTTP/2 only as "trailers" */
+				if (!buffer_eq_icase_slen(&ds->value, CONST_STR_LEN("trailers"))) continue;
+			}
+			break;
+		case 4:
+			if (buffer_is_equal_caseless_string(&ds->key, CONST_STR_LEN("Host"))) continue; /*(:authority)*/
+			break;
+		case 5:
+			if (buffer_is_equal_caseless_string(&ds->key, CONST_STR_LEN("Proxy"))) continue; /*(httpoxy)*/
+			break;
+		case 6:
+			if (buffer_is_equal_caseless_string(&ds->key, CONST_STR_LEN("Expect"))) continue;
+			if (buffer_is_equal_caseless_string(&ds->key, CONST_STR_LEN("Cookie"))) how = HPACK_FIELD_NOINDEX;
+			break;
+		case 7:
+			if (buffer_is_equal_caseless_string(&ds->key, CONST_STR_LEN("Upgrade"))) continue;
+			break;
+		case 10:
+			if (buffer_is_equal_caseless_string(&ds->key, CONST_STR_LEN("Connection"))) continue;
+			if (buffer_is_equal_caseless_string(&ds->key, CONST_STR_LEN("Keep-Alive"))) continue;
+			if (buffer_is_equal_caseless_string(&ds->key, CONST_STR_LEN("Set-Cookie"))) continue;
+			break;
+		case 11:
+			if (remap_headers && buffer_is_equal_caseless_string(&ds->key, CONST_STR_LEN("Destination"))) {
+				proxy_h2c_encode_remap(hctx, hb, &ds->key, &ds->value);
+				continue;
+			}
+			break;
+		case 13:
+			if (buffer_is_equal_caseless_string(&ds->key, CONST_STR_LEN("Authorization"))) how = HPACK_FIELD_NEVERINDEX;
+			break;
+		case 16:
+			if (buffer_is_equal_caseless_string(&ds->key, CONST_STR_LEN("Proxy-Connection"))) continue;
+			if (remap_headers && buffer_is_equal_caseless_string(&ds->key, CONST_STR_LEN("Content-Location"))) {
+				proxy_h2c_encode_remap(hctx, hb, &ds->key, &ds->value);
+				continue;
+			}
+			break;
+		case 17:
+			if (buffer_is_equal_caseless_string(&ds->key, CONST_STR_LEN("Transfer-Encoding"))) continue;
+			break;
+		case 19:
+			if (buffer_is_equal_caseless_string(&ds->key, CONST_STR_LEN("Proxy-Authorization"))) how = HPACK_FIELD_NEVERINDEX;
+			break;
+		case 0:
+			continue;
+		}
+
+		if (buffer_string_is_empty(&ds->value)) continue;
+		hpack_encode_field(enc, hb, CONST_BUF_LEN(&ds->key), CONST_BUF_LEN(&ds->value), how);
+	}
+
+	/* HEADERS frame, and CONTINUATION frames if header block is large
+	 * (header block must be sent in order encoded, and is moved to the shared
+	 *  connection right after proxy_create_env() returns, so stream id is
+	 *  assigned here) */
+	st->id = h2->next_id;
+	h2->next_id += 2;
+	if (h2->next_id > H2C_STREAM_ID_MAX)
+		mpx->state = GW_MPX_DRAIN; /* new connection for new streams */
+	st->swin = h2->init_swin;
+	st->rwin = H2_WINDOW_SIZE;
+	st->hdrs = 0;
+	st->eos = (0 == r->reqbody_length);
+	st->body_end = 0;
+
+	const uint32_t hlen = buffer_string_length(hb);
+	const uint32_t nframes = (hlen + H2_FRAME_SIZE - 1) / H2_FRAME_SIZE;
+	buffer * const b = chunkqueue_prepend_buffer_open_sz(hctx->gw.wb, hlen + 9*nframes);
+	for (uint32_t off = 0; off < hlen; off += H2_FRAME_SIZE) {
+		const uint32_t n = hlen - off < H2_FRAME_SIZE ? hlen - off : H2_FRAME_SIZE;
+		int flags = (off + n == hlen) ? H2_FLAG_END_HEADERS : 0;
+		if (0 == off && st->eos) flags |= H2_FLAG_END_STREAM;
+		unsigned char * const f = (unsigned char *)buffer_string_prepare_append(b, 9 + n);
+		proxy_h2c_frame_hdr(f, n, off ? H2_FTYPE_CONTINUATION : H2_FTYPE_HEADERS, flags, st->id);
+		memcpy(f+9, hb->ptr+off, n);
+		buffer_commit(b, 9 + n);
+	}
+	chunk_buffer_release(hb);
+
+	hctx->gw.wb_reqlen = buffer_string_length(b);
+	st->hdr_end = hctx->gw.wb_reqlen;
+	chunkqueue_prepend_buffer_commit(hctx->gw.wb);
+
+	if (r->reqbody_length) {
+		hctx->gw.stdin_append = proxy_h2c_stdin_append;
+		if (r->reqbody_length > 0) {
+			hctx->gw.wb_reqlen += r->reqbody_length; /* total req size */
+			st->body_end = hctx->gw.wb_reqlen;
+		}
+		else /* as-yet-unknown total request size (Transfer-Encoding: chunked)*/
+			hctx->gw.wb_reqlen = -hctx->gw.wb_reqlen;
+		proxy_h2c_stdin_append(&hctx->gw);
+	}
+	else
+		st->body_end = st->hdr_end;
+
+	hctx->gw.opts.parse = proxy_h2c_parse;
+
+	status_counter_inc(CONST_STR_LEN("proxy.requests"));
+	return HANDLER_GO_ON;
+}
+
+
 static handler_t proxy_stdin_append(gw_handler_ctx *hctx) {
     /*handler_ctx *hctx = (handler_ctx *)gwhctx;*/
     chunkqueue * const req_cq = hctx->r->reqbody_queue;
@@ -842,7 +1719,11 @@ static handler_t proxy_stdin_append(gw_handler_ctx *hctx) {
                                           /* else FILE_CHUNK for temp file */
           ? chunkqueue_append_mem(hctx->wb, CONST_BUF_LEN(tb))
           : chunkqueue_append_mem_min(hctx->wb, CONST_BUF_LEN(tb));
-        chunkqueue_steal(hctx->wb, req_cq, req_cqlen);
+        if (0 != chunkqueue_steal(hctx->wb, req_cq, req_cqlen)) {
+            log_perror(hctx->r->conf.errh, __FILE__, __LINE__,
+              "splitting request body temp-file failed");
+            return HANDLER_ERROR;
+        }
 
         chunkqueue_append_mem_min(hctx->wb, CONST_STR_LEN("\r\n"));
     }
@@ -859,6 +1740,10 @@ static handler_t proxy_stdin_append(gw_handler_ctx *hctx) {
 
 static handler_t proxy_create_env(gw_handler_ctx *gwhctx) {
 	handler_ctx *hctx = (handler_ctx *)gwhctx;
+	if (hctx->gw.mpx) return proxy_create_env_h2c(hctx);
+	/*(reset if request restarted on separate connection)*/
+	hctx->gw.opts.parse = NULL;
+	hctx->gw.stdin_append = NULL;
 	request_st * const r = hctx->gw.r;
 	const int remap_headers = (NULL != hctx->conf.header.urlpaths
 				   || NULL != hctx->conf.header.hosts_request);
@@ -1133,6 +2018,13 @@ static handler_t mod_proxy_check_extension(request_st * const r, void *p_d) {
 			  buffer_is_equal_string(&r->uri.scheme, CONST_STR_LEN("https"));
 		}
 
+		/* h2c to backend (if host "multiplex" is set); not for requests
+		 * which might switch to a transparent (tunnel) connection */
+		if (r->http_method != HTTP_METHOD_CONNECT
+		    && !(hctx->conf.header.upgrade
+			 && (r->rqst_htags & HTTP_HEADER_UPGRADE)))
+			hctx->gw.mpx_proto = &proxy_h2c_proto;
+
 		if (r->http_method == HTTP_METHOD_CONNECT) {
 			/*(note: not requiring HTTP/1.1 due to too many non-compliant
 			 * clients such as 'openssl s_client')*/
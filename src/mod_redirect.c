@@ -70,7 +70,7 @@ static void mod_redirect_patch_config(request_st * const r, plugin_data * const
     p->conf = p->defaults; /* copy small struct instead of memcpy() */
     /*memcpy(&p->conf, &p->defaults, sizeof(plugin_config));*/
     for (int i = 1, used = p->nconfig; i < used; ++i) {
-        if (config_check_cond(r, (uint32_t)p->cvlist[i].k_id))
+        if ((i = config_check_cond_next(r, p->cvlist, i, used)) < used)
             mod_redirect_merge_config(&p->conf, p->cvlist+p->cvlist[i].v.u2[0]);
     }
 }
@@ -80,13 +80,15 @@ static pcre_keyvalue_buffer * mod_redirect_parse_list(server *srv, const array *
     redirect->x0 = (unsigned short)condidx;
     log_error_st * const errh = srv->errh;
     buffer * const tb = srv->tmp_buf;
+    const int pcre_jit = config_feature_bool(srv, "server.pcre_jit", 1);
     for (uint32_t j = 0; j < a->used; ++j) {
         data_string *ds = (data_string *)a->data[j];
         if (srv->srvconf.http_url_normalize) {
             pcre_keyvalue_burl_normalize_key(&ds->key, tb);
             pcre_keyvalue_burl_normalize_value(&ds->value, tb);
         }
-        if (!pcre_keyvalue_buffer_append(errh, redirect, &ds->key, &ds->value)){
+        if (!pcre_keyvalue_buffer_append(errh, redirect, &ds->key, &ds->value,
+                                         pcre_jit)) {
             log_error(errh, __FILE__, __LINE__,
               "pcre-compile failed for %s", ds->key.ptr);
             pcre_keyvalue_buffer_free(redirect);
@@ -88,7 +88,7 @@ static void mod_rewrite_patch_config(request_st * const r, plugin_data * const p
     p->conf = p->defaults; /* copy small struct instead of memcpy() */
     /*memcpy(&p->conf, &p->defaults, sizeof(plugin_config));*/
     for (int i = 1, used = p->nconfig; i < used; ++i) {
-        if (config_check_cond(r, (uint32_t)p->cvlist[i].k_id))
+        if ((i = config_check_cond_next(r, p->cvlist, i, used)) < used)
             mod_rewrite_merge_config(&p->conf, p->cvlist+p->cvlist[i].v.u2[0]);
     }
 }
@@ -102,13 +102,15 @@ static pcre_keyvalue_buffer * mod_rewrite_parse_list(server *srv, const array *a
     }
 
     buffer * const tb = srv->tmp_buf;
+    const int pcre_jit = config_feature_bool(srv, "server.pcre_jit", 1);
     for (uint32_t j = 0; j < a->used; ++j) {
         data_string *ds = (data_string *)a->data[j];
         if (srv->srvconf.http_url_normalize) {
             pcre_keyvalue_burl_normalize_key(&ds->key, tb);
             pcre_keyvalue_burl_normalize_value(&ds->value, tb);
         }
-        if (!pcre_keyvalue_buffer_append(srv->errh, kvb, &ds->key, &ds->value)){
+        if (!pcre_keyvalue_buffer_append(srv->errh, kvb, &ds->key, &ds->value,
+                                         pcre_jit)) {
             log_error(srv->errh, __FILE__, __LINE__,
               "pcre-compile failed for %s", ds->key.ptr);
             if (allocated) pcre_keyvalue_buffer_free(kvb);
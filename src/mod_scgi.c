@@ -43,6 +43,9 @@ static void mod_scgi_merge_config_cpv(plugin_config * const pconf, const config_
         /*if (cpv->vtype == T_CONFIG_LOCAL)*//*always true here for this param*/
             pconf->proto = (int)cpv->v.u;
         break;
+      case 5: /* scgi.balance-key */
+        pconf->balance_key = cpv->v.b;
+        break;
       default:/* should not happen */
         return;
     }
@@ -57,7 +60,7 @@ static void mod_scgi_merge_config(plugin_config * const pconf, const config_plug
 static void mod_scgi_patch_config(request_st * const r, plugin_data * const p) {
     memcpy(&p->conf, &p->defaults, sizeof(plugin_config));
     for (int i = 1, used = p->nconfig; i < used; ++i) {
-        if (config_check_cond(r, (uint32_t)p->cvlist[i].k_id))
+        if ((i = config_check_cond_next(r, p->cvlist, i, used)) < used)
             mod_scgi_merge_config(&p->conf, p->cvlist + p->cvlist[i].v.u2[0]);
     }
 }
@@ -79,6 +82,9 @@ SETDEFAULTS_FUNC(mod_scgi_set_defaults) {
      ,{ CONST_STR_LEN("scgi.protocol"),
         T_CONFIG_STRING,
         T_CONFIG_SCOPE_CONNECTION }
+     ,{ CONST_STR_LEN("scgi.balance-key"),
+        T_CONFIG_STRING,
+        T_CONFIG_SCOPE_CONNECTION }
      ,{ NULL, 0,
         T_CONFIG_UNSET,
         T_CONFIG_SCOPE_UNSET }
@@ -124,6 +130,10 @@ SETDEFAULTS_FUNC(mod_scgi_set_defaults) {
                     return HANDLER_ERROR;
                 }
                 break;
+              case 5: /* scgi.balance-key */
+                if (!gw_get_defaults_balance_key(srv, cpv->v.b))
+                    return HANDLER_ERROR;
+                break;
               default:/* should not happen */
                 break;
             }
@@ -79,7 +79,7 @@ static void mod_setenv_merge_config(plugin_config * const pconf, const config_pl
 static void mod_setenv_patch_config(request_st * const r, plugin_data * const p, plugin_config * const pconf) {
     memcpy(pconf, &p->defaults, sizeof(plugin_config));
     for (int i = 1, used = p->nconfig; i < used; ++i) {
-        if (config_check_cond(r, (uint32_t)p->cvlist[i].k_id))
+        if ((i = config_check_cond_next(r, p->cvlist, i, used)) < used)
             mod_setenv_merge_config(pconf, p->cvlist + p->cvlist[i].v.u2[0]);
     }
 }
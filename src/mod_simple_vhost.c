@@ -65,7 +65,7 @@ static void mod_simple_vhost_patch_config(request_st * const r, plugin_data * co
     p->conf = p->defaults; /* copy small struct instead of memcpy() */
     /*memcpy(&p->conf, &p->defaults, sizeof(plugin_config));*/
     for (int i = 1, used = p->nconfig; i < used; ++i) {
-        if (config_check_cond(r, (uint32_t)p->cvlist[i].k_id))
+        if ((i = config_check_cond_next(r, p->cvlist, i, used)) < used)
             mod_simple_vhost_merge_config(&p->conf,
                                           p->cvlist + p->cvlist[i].v.u2[0]);
     }
@@ -110,7 +110,7 @@ static void mod_ssi_merge_config(plugin_config * const pconf, const config_plugi
 static void mod_ssi_patch_config(request_st * const r, plugin_data * const p) {
     memcpy(&p->conf, &p->defaults, sizeof(plugin_config));
     for (int i = 1, used = p->nconfig; i < used; ++i) {
-        if (config_check_cond(r, (uint32_t)p->cvlist[i].k_id))
+        if ((i = config_check_cond_next(r, p->cvlist, i, used)) < used)
             mod_ssi_merge_config(&p->conf, p->cvlist + p->cvlist[i].v.u2[0]);
     }
 }
@@ -141,6 +141,26 @@ SETDEFAULTS_FUNC(mod_ssi_set_defaults) {
     if (!config_plugin_values_init(srv, p, cpk, "mod_ssi"))
         return HANDLER_ERROR;
 
+    /* process and validate config directives
+     * (init i to 0 if global context; to 1 to skip empty global context) */
+    for (int i = !p->cvlist[0].v.u2[1]; i < p->nconfig; ++i) {
+        const config_plugin_value_t *cpv = p->cvlist + p->cvlist[i].v.u2[0];
+        for (; -1 != cpv->k_id; ++cpv) {
+            switch (cpv->k_id) {
+              case 0: /* ssi.extension */
+                array_match_index((array *)cpv->v.a, ARRAY_MATCH_VALUE_SUFFIX);
+                break;
+              case 1: /* ssi.content-type */
+              case 2: /* ssi.conditional-requests */
+              case 3: /* ssi.exec */
+              case 4: /* ssi.recursion-max */
+                break;
+              default:/* should not happen */
+                break;
+            }
+        }
+    }
+
     p->defaults.ssi_exec = 1;
 
     /* initialize p->defaults from global config context */
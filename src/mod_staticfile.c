@@ -3,11 +3,15 @@
 #include "base.h"
 #include "log.h"
 #include "buffer.h"
+#include "http_header.h"
+#include "stat_cache.h"
 
 #include "plugin.h"
 
 #include "response.h"
 
+#include <sys/types.h>
+#include <sys/stat.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -19,6 +23,7 @@
 
 typedef struct {
 	const array *exclude_ext;
+	const array *precompressed;
 	unsigned short etags_used;
 	unsigned short disable_pathinfo;
 } plugin_config;
@@ -27,12 +32,31 @@ typedef struct {
     PLUGIN_DATA;
     plugin_config defaults;
     plugin_config conf;
+    buffer tmpb;
 } plugin_data;
 
+/* content-codings of pre-compressed files (static-file.precompressed)
+ * and file extensions of pre-compressed siblings of original file */
+static const struct {
+    const char *encoding;
+    uint32_t elen;
+    const char *ext;
+    uint32_t extlen;
+} precompressed_encodings[] = {
+    { CONST_STR_LEN("br"),   CONST_STR_LEN(".br")  }
+   ,{ CONST_STR_LEN("gzip"), CONST_STR_LEN(".gz")  }
+   ,{ CONST_STR_LEN("zstd"), CONST_STR_LEN(".zst") }
+};
+
 INIT_FUNC(mod_staticfile_init) {
     return calloc(1, sizeof(plugin_data));
 }
 
+FREE_FUNC(mod_staticfile_free) {
+    plugin_data * const p = p_d;
+    free(p->tmpb.ptr);
+}
+
 static void mod_staticfile_merge_config_cpv(plugin_config * const pconf, const config_plugin_value_t * const cpv) {
     switch (cpv->k_id) { /* index into static config_plugin_keys_t cpk[] */
       case 0: /* static-file.exclude-extensions */
@@ -44,6 +68,9 @@ static void mod_staticfile_merge_config_cpv(plugin_config * const pconf, const c
       case 2: /* static-file.disable-pathinfo */
         pconf->disable_pathinfo = cpv->v.u;
         break;
+      case 3: /* static-file.precompressed */
+        pconf->precompressed = cpv->v.a;
+        break;
       default:/* should not happen */
         return;
     }
@@ -59,7 +86,7 @@ static void mod_staticfile_patch_config(request_st * const r, plugin_data * cons
     p->conf = p->defaults; /* copy small struct instead of memcpy() */
     /*memcpy(&p->conf, &p->defaults, sizeof(plugin_config));*/
     for (int i = 1, used = p->nconfig; i < used; ++i) {
-        if (config_check_cond(r, (uint32_t)p->cvlist[i].k_id))
+        if ((i = config_check_cond_next(r, p->cvlist, i, used)) < used)
             mod_staticfile_merge_config(&p->conf,
                                         p->cvlist + p->cvlist[i].v.u2[0]);
     }
@@ -76,6 +103,9 @@ SETDEFAULTS_FUNC(mod_staticfile_set_defaults) {
      ,{ CONST_STR_LEN("static-file.disable-pathinfo"),
         T_CONFIG_BOOL,
         T_CONFIG_SCOPE_CONNECTION }
+     ,{ CONST_STR_LEN("static-file.precompressed"),
+        T_CONFIG_ARRAY_VLIST,
+        T_CONFIG_SCOPE_CONNECTION }
      ,{ NULL, 0,
         T_CONFIG_UNSET,
         T_CONFIG_SCOPE_UNSET }
@@ -85,6 +115,46 @@ SETDEFAULTS_FUNC(mod_staticfile_set_defaults) {
     if (!config_plugin_values_init(srv, p, cpk, "mod_staticfile"))
         return HANDLER_ERROR;
 
+    /* process and validate config directives
+     * (init i to 0 if global context; to 1 to skip empty global context) */
+    for (int i = !p->cvlist[0].v.u2[1]; i < p->nconfig; ++i) {
+        config_plugin_value_t *cpv = p->cvlist + p->cvlist[i].v.u2[0];
+        for (; -1 != cpv->k_id; ++cpv) {
+            switch (cpv->k_id) {
+              case 0: /* static-file.exclude-extensions */
+                array_match_index((array *)cpv->v.a, ARRAY_MATCH_VALUE_SUFFIX);
+                break;
+              case 1: /* static-file.etags */
+              case 2: /* static-file.disable-pathinfo */
+                break;
+              case 3: /* static-file.precompressed */
+                for (uint32_t j = 0; j < cpv->v.a->used; ++j) {
+                    const buffer * const v =
+                      &((data_string *)cpv->v.a->data[j])->value;
+                    uint32_t k = 0;
+                    while (k < sizeof(precompressed_encodings)
+                               / sizeof(*precompressed_encodings)
+                           && !buffer_is_equal_string(v,
+                                 precompressed_encodings[k].encoding,
+                                 precompressed_encodings[k].elen)) ++k;
+                    if (k == sizeof(precompressed_encodings)
+                             / sizeof(*precompressed_encodings)) {
+                        log_error(srv->errh, __FILE__, __LINE__,
+                          "unrecognized value for %s: %s "
+                          "(expecting \"br\", \"gzip\", or \"zstd\")",
+                          cpk[cpv->k_id].k, v->ptr);
+                        return HANDLER_ERROR;
+                    }
+                }
+                if (0 == cpv->v.a->used)
+                    cpv->v.a = NULL;
+                break;
+              default:/* should not happen */
+                break;
+            }
+        }
+    }
+
     /* initialize p->defaults from global config context */
     p->defaults.etags_used = 1; /* etags enabled */
     if (p->nconfig > 0 && p->cvlist->v.u2[1]) {
@@ -96,6 +166,133 @@ SETDEFAULTS_FUNC(mod_staticfile_set_defaults) {
     return HANDLER_GO_ON;
 }
 
+static int mod_staticfile_accept_encoding (const char *s, const char * const enc, const uint32_t elen) {
+    /* returns 1 if content-coding enc is acceptable per Accept-Encoding s
+     * (explicitly listed coding takes precedence over "*"; q=0 not acceptable)
+     * (server preference order is used instead of client qvalues) */
+    int wildcard = 0;
+    for (;;) {
+        while (*s == ' ' || *s == '\t' || *s == ',') ++s;
+        if (*s == '\0') return wildcard;
+        const char * const v = s;
+        while (*s != ' ' && *s != '\t' && *s != ',' && *s != ';' && *s != '\0')
+            ++s;
+        const uint32_t vlen = (uint32_t)(s - v);
+        int q0 = 0;
+        while (*s == ' ' || *s == '\t') ++s;
+        if (*s == ';') {
+            do { ++s; } while (*s == ' ' || *s == '\t');
+            if ((*s == 'q' || *s == 'Q') && s[1] == '=' && s[2] == '0') {
+                s += 3;
+                if (*s == '.') do { ++s; } while (*s == '0');
+                q0 = !(*s >= '1' && *s <= '9');
+            }
+            while (*s != ',' && *s != '\0') ++s;
+        }
+        if (vlen == elen && buffer_eq_icase_ssn(v, enc, elen))
+            return !q0;
+        if (vlen == 1 && *v == '*')
+            wildcard = !q0;
+    }
+}
+
+static void mod_staticfile_send_precompressed (request_st * const r, plugin_data * const p) {
+    /* send pre-compressed sibling of file (e.g. file.js.br or file.js.gz),
+     * if present, not older than file, and acceptable to client; else file
+     * (siblings not present are cached as negative entries in stat_cache) */
+    stat_cache_entry *sce = stat_cache_get_entry(&r->physical.path);
+    if (NULL == sce || !S_ISREG(sce->st.st_mode)) {
+        http_response_send_file(r, &r->physical.path);
+        return;
+    }
+    const time_t mtime = sce->st.st_mtime;
+
+    const buffer * const vb =
+      http_header_request_get(r, HTTP_HEADER_ACCEPT_ENCODING,
+                              CONST_STR_LEN("Accept-Encoding"));
+    const array * const precompressed = p->conf.precompressed;
+    buffer * const tb = &p->tmpb;
+    int has_variant = 0;
+    uint32_t i;
+    for (i = 0; i < precompressed->used; ++i) {
+        const buffer * const enc =
+          &((data_string *)precompressed->data[i])->value;
+        uint32_t k = 0;
+        while (!buffer_is_equal_string(enc, precompressed_encodings[k].encoding,
+                                       precompressed_encodings[k].elen)) ++k;
+        buffer_copy_buffer(tb, &r->physical.path);
+        buffer_append_string_len(tb, precompressed_encodings[k].ext,
+                                     precompressed_encodings[k].extlen);
+        const stat_cache_entry * const psce = stat_cache_get_entry(tb);
+        if (NULL == psce || !S_ISREG(psce->st.st_mode)
+            || psce->st.st_mtime < mtime) /*(stale pre-compressed file)*/
+            continue;
+        has_variant = 1;
+        if (NULL != vb
+            && mod_staticfile_accept_encoding(vb->ptr, CONST_BUF_LEN(enc)))
+            break;
+    }
+
+    if (has_variant) {
+        /* Vary: Accept-Encoding (response differs by request Accept-Encoding)*/
+        buffer * const vary =
+          http_header_response_get(r, HTTP_HEADER_VARY, CONST_STR_LEN("Vary"));
+        if (NULL == vary)
+            http_header_response_set(r, HTTP_HEADER_VARY, CONST_STR_LEN("Vary"),
+                                     CONST_STR_LEN("Accept-Encoding"));
+        else if (NULL == strstr(vary->ptr, "Accept-Encoding"))
+            buffer_append_string_len(vary, CONST_STR_LEN(",Accept-Encoding"));
+    }
+
+    if (i == precompressed->used) {
+        http_response_send_file(r, &r->physical.path);
+        return;
+    }
+
+    /* Content-Type of original file (re-lookup; sce might have been replaced)*/
+    if (NULL == http_header_response_get(r, HTTP_HEADER_CONTENT_TYPE,
+                                         CONST_STR_LEN("Content-Type"))) {
+        sce = stat_cache_get_entry(&r->physical.path);
+        const buffer * const content_type = (NULL != sce)
+          ? stat_cache_content_type_get(sce, r)
+          : NULL;
+        if (!buffer_string_is_empty(content_type))
+            http_header_response_set(r, HTTP_HEADER_CONTENT_TYPE,
+                                     CONST_STR_LEN("Content-Type"),
+                                     CONST_BUF_LEN(content_type));
+        else
+            http_header_response_set(r, HTTP_HEADER_CONTENT_TYPE,
+                                     CONST_STR_LEN("Content-Type"),
+                                     CONST_STR_LEN("application/octet-stream"));
+    }
+
+    const buffer * const enc = &((data_string *)precompressed->data[i])->value;
+    http_header_response_set(r, HTTP_HEADER_CONTENT_ENCODING,
+                             CONST_STR_LEN("Content-Encoding"),
+                             CONST_BUF_LEN(enc));
+    if (r->conf.log_request_handling)
+        log_error(r->conf.errh, __FILE__, __LINE__,
+          "-- sending pre-compressed file: %s", tb->ptr);
+    http_response_send_file_encoded(r, tb, CONST_BUF_LEN(enc));
+    if (r->http_status == 403 || r->http_status == 404) {
+        /* stat() or open() of sibling failed (e.g. sibling removed or not
+         * readable); send original file.  (Other errors, e.g. 412 or 416,
+         * are responses to the request conditions and are sent as-is) */
+        http_header_response_unset(r, HTTP_HEADER_CONTENT_ENCODING,
+                                   CONST_STR_LEN("Content-Encoding"));
+        http_header_response_unset(r, HTTP_HEADER_ETAG,
+                                   CONST_STR_LEN("ETag"));
+        http_header_response_unset(r, HTTP_HEADER_LAST_MODIFIED,
+                                   CONST_STR_LEN("Last-Modified"));
+        http_header_response_unset(r, HTTP_HEADER_OTHER,
+                                   CONST_STR_LEN("Accept-Ranges"));
+        http_header_response_unset(r, HTTP_HEADER_OTHER,
+                                   CONST_STR_LEN("Content-Range"));
+        r->http_status = 0;
+        http_response_send_file(r, &r->physical.path);
+    }
+}
+
 URIHANDLER_FUNC(mod_staticfile_subrequest) {
     plugin_data * const p = p_d;
 
@@ -127,7 +324,10 @@ URIHANDLER_FUNC(mod_staticfile_subrequest) {
     }
 
     if (!p->conf.etags_used) r->conf.etag_flags = 0;
-    http_response_send_file(r, &r->physical.path);
+    if (p->conf.precompressed)
+        mod_staticfile_send_precompressed(r, p);
+    else
+        http_response_send_file(r, &r->physical.path);
 
     return HANDLER_FINISHED;
 }
@@ -139,6 +339,7 @@ int mod_staticfile_plugin_init(plugin *p) {
 	p->name        = "staticfile";
 
 	p->init        = mod_staticfile_init;
+	p->cleanup     = mod_staticfile_free;
 	p->handle_subrequest_start = mod_staticfile_subrequest;
 	p->set_defaults  = mod_staticfile_set_defaults;
 
@@ -78,7 +78,7 @@ static void mod_status_patch_config(request_st * const r, plugin_data * const p)
     p->conf = p->defaults; /* copy small struct instead of memcpy() */
     /*memcpy(&p->conf, &p->defaults, sizeof(plugin_config));*/
     for (int i = 1, used = p->nconfig; i < used; ++i) {
-        if (config_check_cond(r, (uint32_t)p->cvlist[i].k_id))
+        if ((i = config_check_cond_next(r, p->cvlist, i, used)) < used)
             mod_status_merge_config(&p->conf, p->cvlist + p->cvlist[i].v.u2[0]);
     }
 }
@@ -344,6 +344,17 @@ static handler_t mod_status_handle_server_status_html(server *srv, request_st *
 	buffer_append_string(b, buf);
 	buffer_append_string_len(b, CONST_STR_LEN("</td></tr>\n"));
 
+	buffer_append_string_len(b, CONST_STR_LEN("<tr><td>Chunk memory</td><td class=\"string\">"));
+	avg = chunkqueue_mem_used();
+
+	mod_status_get_multiplier(&avg, &multiplier, 1024);
+
+	snprintf(buf, sizeof(buf), "%.2f", avg);
+	buffer_append_string(b, buf);
+	buffer_append_string_len(b, CONST_STR_LEN(" "));
+	if (multiplier)	buffer_append_string_len(b, &multiplier, 1);
+	buffer_append_string_len(b, CONST_STR_LEN("byte</td></tr>\n"));
+
 
 	buffer_append_string_len(b, CONST_STR_LEN("<tr><th colspan=\"2\">absolute (since start)</th></tr>\n"));
 
@@ -605,6 +616,11 @@ static handler_t mod_status_handle_server_status_text(server *srv, request_st *
 	buffer_append_int(b, srv->conns.size - srv->conns.used);
 	buffer_append_string_len(b, CONST_STR_LEN("\n"));
 
+	/* output chunk memory in use in bytes */
+	buffer_append_string_len(b, CONST_STR_LEN("ChunkMemory: "));
+	buffer_append_int(b, chunkqueue_mem_used());
+	buffer_append_string_len(b, CONST_STR_LEN("\n"));
+
 	/* output scoreboard */
 	buffer_append_string_len(b, CONST_STR_LEN("Scoreboard: "));
 	for (uint32_t i = 0; i < srv->conns.used; ++i) {
@@ -680,6 +696,10 @@ static handler_t mod_status_handle_server_status_json(server *srv, request_st *
 	buffer_append_int(b, srv->conns.size - srv->conns.used);
 	buffer_append_string_len(b, CONST_STR_LEN(",\n"));
 
+	buffer_append_string_len(b, CONST_STR_LEN("\t\"ChunkMemory\": "));
+	buffer_append_int(b, chunkqueue_mem_used());
+	buffer_append_string_len(b, CONST_STR_LEN(",\n"));
+
 	for (j = 0, avg = 0; j < 5; j++) {
 		avg += p->mod_5s_requests[j];
 	}
@@ -780,7 +800,7 @@ static handler_t mod_status_handle_server_config(request_st * const r) {
 			   "  <table summary=\"status\" border=\"1\">\n"));
 
 	mod_status_header_append(b, "Server-Features");
-#ifdef HAVE_PCRE_H
+#ifdef HAVE_PCRE
 	mod_status_row_append(b, "RegEx Conditionals", "enabled");
 #else
 	mod_status_row_append(b, "RegEx Conditionals", "disabled - pcre missing");
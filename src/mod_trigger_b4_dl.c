@@ -3,7 +3,7 @@
 #include "plugin.h"
 
 
-#if defined(HAVE_PCRE_H)                /* do nothing if PCRE not available */
+#if defined(HAVE_PCRE)                  /* do nothing if PCRE not available */
 #if defined(HAVE_GDBM_H) || defined(USE_MEMCACHED) /* at least one required */
 
 
@@ -11,6 +11,7 @@
 #include "log.h"
 #include "buffer.h"
 #include "http_header.h"
+#include "keyvalue.h"
 
 #include <sys/stat.h>
 #include <stdlib.h>
@@ -21,10 +22,6 @@
 # include <gdbm.h>
 #endif
 
-#if defined(HAVE_PCRE_H)
-# include <pcre.h>
-#endif
-
 #if defined(USE_MEMCACHED)
 # include <libmemcached/memcached.h>
 #endif
@@ -36,8 +33,8 @@
 
 typedef struct {
     const buffer *deny_url;
-    pcre *trigger_regex;
-    pcre *download_regex;
+    pcre_keyvalue_buffer *trigger_regex;
+    pcre_keyvalue_buffer *download_regex;
   #if defined(HAVE_GDBM_H)
     GDBM_FILE db;
   #endif
@@ -74,10 +71,10 @@ FREE_FUNC(mod_trigger_b4_dl_free) {
                 break;
              #endif
               case 1: /* trigger-before-download.trigger-url */
-                pcre_free(cpv->v.v);
+                pcre_keyvalue_buffer_free(cpv->v.v);
                 break;
               case 2: /* trigger-before-download.download-url */
-                pcre_free(cpv->v.v);
+                pcre_keyvalue_buffer_free(cpv->v.v);
                 break;
              #if defined(USE_MEMCACHED)
               case 5: /* trigger-before-download.memcache-hosts */
@@ -168,22 +165,31 @@ static int mod_trigger_b4_dl_init_regex(server * const srv, config_plugin_value_
         return 1;
     }
 
-    const char *errptr;
-    int erroff;
-    cpv->v.v = pcre_compile(b->ptr, 0, &errptr, &erroff, NULL);
-
-    if (cpv->v.v) {
+    /*(re-use keyvalue.[ch] for match-only; kvb 'value' is empty)*/
+    const int pcre_jit = config_feature_bool(srv, "server.pcre_jit", 1);
+    pcre_keyvalue_buffer * const kvb = pcre_keyvalue_buffer_init();
+    static const buffer empty = { NULL, 0, 0 };
+    if (pcre_keyvalue_buffer_append(srv->errh, kvb, b, &empty, pcre_jit)) {
+        cpv->v.v = kvb;
         cpv->vtype = T_CONFIG_LOCAL;
         return 1;
     }
     else {
         log_error(srv->errh, __FILE__, __LINE__,
-          "compiling regex for %s failed: %s pos: %d",
-          str, b->ptr, erroff);
+          "compiling regex for %s failed: %s", str, b->ptr);
+        pcre_keyvalue_buffer_free(kvb);
         return 0;
     }
 }
 
+static int mod_trigger_b4_dl_match(const pcre_keyvalue_buffer * const kvb, const buffer * const input) {
+    /* return -1 on error, 1 on match, 0 if no match */
+    pcre_keyvalue_ctx ctx = { NULL, NULL, 0, -1 };
+    if (HANDLER_GO_ON != pcre_keyvalue_buffer_process(kvb, &ctx, input, NULL))
+        return -1;
+    return (ctx.m >= 0);
+}
+
 static void mod_trigger_b4_dl_merge_config_cpv(plugin_config * const pconf, const config_plugin_value_t * const cpv) {
     switch (cpv->k_id) { /* index into static config_plugin_keys_t cpk[] */
       case 0: /* trigger-before-download.gdbm-filename */
@@ -234,7 +240,7 @@ static void mod_trigger_b4_dl_merge_config(plugin_config * const pconf, const co
 static void mod_trigger_b4_dl_patch_config(request_st * const r, plugin_data * const p) {
     memcpy(&p->conf, &p->defaults, sizeof(plugin_config));
     for (int i = 1, used = p->nconfig; i < used; ++i) {
-        if (config_check_cond(r, (uint32_t)p->cvlist[i].k_id))
+        if ((i = config_check_cond_next(r, p->cvlist, i, used)) < used)
             mod_trigger_b4_dl_merge_config(&p->conf,
                                            p->cvlist + p->cvlist[i].v.u2[0]);
     }
@@ -353,8 +359,6 @@ URIHANDLER_FUNC(mod_trigger_b4_dl_uri_handler) {
 	plugin_data *p = p_d;
 
 	int n;
-# define N 10
-	int ovec[N * 3];
 
 	if (NULL != r->handler_module) return HANDLER_GO_ON;
 
@@ -392,10 +396,10 @@ URIHANDLER_FUNC(mod_trigger_b4_dl_uri_handler) {
 	const time_t cur_ts = log_epoch_secs;
 
 	/* check if URL is a trigger -> insert IP into DB */
-	if ((n = pcre_exec(p->conf.trigger_regex, NULL, CONST_BUF_LEN(&r->uri.path), 0, 0, ovec, 3 * N)) < 0) {
-		if (n != PCRE_ERROR_NOMATCH) {
+	if ((n = mod_trigger_b4_dl_match(p->conf.trigger_regex, &r->uri.path)) <= 0) {
+		if (n < 0) {
 			log_error(r->conf.errh, __FILE__, __LINE__,
-			  "execution error while matching: %d", n);
+			  "execution error while matching: %s", r->uri.path.ptr);
 
 			return HANDLER_ERROR;
 		}
@@ -436,10 +440,10 @@ URIHANDLER_FUNC(mod_trigger_b4_dl_uri_handler) {
 	}
 
 	/* check if URL is a download -> check IP in DB, update timestamp */
-	if ((n = pcre_exec(p->conf.download_regex, NULL, CONST_BUF_LEN(&r->uri.path), 0, 0, ovec, 3 * N)) < 0) {
-		if (n != PCRE_ERROR_NOMATCH) {
+	if ((n = mod_trigger_b4_dl_match(p->conf.download_regex, &r->uri.path)) <= 0) {
+		if (n < 0) {
 			log_error(r->conf.errh, __FILE__, __LINE__,
-			  "execution error while matching: %d", n);
+			  "execution error while matching: %s", r->uri.path.ptr);
 			return HANDLER_ERROR;
 		}
 	} else {
@@ -585,7 +589,7 @@ TRIGGER_FUNC(mod_trigger_b4_dl_handle_trigger) {
 #endif
 
 
-#endif /* defined(HAVE_PCRE_H) */
+#endif /* defined(HAVE_PCRE) */
 #endif /* defined(HAVE_GDBM_H) || defined(USE_MEMCACHED) */
 
 
@@ -594,7 +598,7 @@ int mod_trigger_b4_dl_plugin_init(plugin *p) {
 	p->version     = LIGHTTPD_VERSION_ID;
 	p->name        = "trigger_b4_dl";
 
-#if defined(HAVE_PCRE_H)                /* do nothing if PCRE not available */
+#if defined(HAVE_PCRE)                  /* do nothing if PCRE not available */
 #if defined(HAVE_GDBM_H) || defined(USE_MEMCACHED) /* at least one required */
 
 	p->init        = mod_trigger_b4_dl_init;
@@ -179,7 +179,7 @@ static void mod_vhostdb_merge_config(plugin_config * const pconf, const config_p
 static void mod_vhostdb_patch_config(request_st * const r, plugin_data * const p) {
     memcpy(&p->conf, &p->defaults, sizeof(plugin_config));
     for (int i = 1, used = p->nconfig; i < used; ++i) {
-        if (config_check_cond(r, (uint32_t)p->cvlist[i].k_id))
+        if ((i = config_check_cond_next(r, p->cvlist, i, used)) < used)
             mod_vhostdb_merge_config(&p->conf, p->cvlist + p->cvlist[i].v.u2[0]);
     }
 }
@@ -292,7 +292,10 @@ REQUEST_FUNC(mod_vhostdb_handle_docroot) {
 
     b = &p->tmp_buf;
     backend = p->conf.vhostdb_backend;
-    if (0 != backend->query(r, backend->p_d, b)) {
+    const int rc = backend->query(r, backend->p_d, b);
+    if (0 != rc) {
+        if (rc > 0) /* query in progress (e.g. in async_pool worker thread) */
+            return HANDLER_WAIT_FOR_EVENT;
         return mod_vhostdb_error_500(r); /* HANDLER_FINISHED */
     }
 
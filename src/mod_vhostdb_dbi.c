@@ -11,6 +11,7 @@
 #include <string.h>
 #include <stdlib.h>
 
+#include "async_pool.h"
 #include "base.h"
 #include "http_vhostdb.h"
 #include "fdevent.h"
@@ -28,11 +29,10 @@
  */
 
 typedef struct {
-    dbi_conn dbconn;
-    dbi_inst dbinst;
+    uint32_t ndx;           /* index into per-thread connections */
     const buffer *sqlquery;
-    log_error_st *errh;
-    short reconnect_count;
+    const buffer *dbtype;
+    const array *opts;
 } vhostdb_config;
 
 typedef struct {
@@ -43,16 +43,44 @@ typedef struct {
     PLUGIN_DATA;
     plugin_config defaults;
     plugin_config conf;
+
+    uint32_t ndbconf;
+    async_pool *pool;
 } plugin_data;
 
+/* number of worker threads making (synchronous, blocking) DBI queries */
+#define MOD_VHOSTDB_DBI_THREADS 4
+
+/* DBI connection kept open by each worker thread for each vhostdb.dbi
+ * (libdbi instance is per-thread; dbi_initialize_r() per thread) */
+typedef struct {
+    dbi_conn dbconn;
+    dbi_inst dbinst;
+    log_error_st *errh;
+    short reconnect_count;
+} vhostdb_dbi_conn;
+
+typedef struct {
+    uint32_t used;
+    vhostdb_dbi_conn c[];
+} vhostdb_dbi_tctx;
+
+typedef struct {
+    async_job job;          /* (must be first member) */
+    int rc;
+    const vhostdb_config *dbconf;
+    buffer authority;
+    buffer docroot;
+} vhostdb_dbi_job;
+
 /* used to reconnect to the database when we get disconnected */
 static void mod_vhostdb_dbi_error_callback (dbi_conn dbconn, void *vdata)
 {
-    vhostdb_config *dbconf = (vhostdb_config *)vdata;
+    vhostdb_dbi_conn * const c = (vhostdb_dbi_conn *)vdata;
     const char *errormsg = NULL;
-    /*assert(dbconf->dbconn == dbconn);*/
+    /*assert(c->dbconn == dbconn);*/
 
-    while (++dbconf->reconnect_count <= 3) { /* retry */
+    while (++c->reconnect_count <= 3) { /* retry */
         if (0 == dbi_conn_connect(dbconn)) {
             fdevent_setfd_cloexec(dbi_conn_get_socket(dbconn));
             return;
@@ -60,15 +88,74 @@ static void mod_vhostdb_dbi_error_callback (dbi_conn dbconn, void *vdata)
     }
 
     dbi_conn_error(dbconn, &errormsg);
-    log_error(dbconf->errh,__FILE__,__LINE__,"dbi_conn_connect(): %s",errormsg);
+    log_error(c->errh, __FILE__, __LINE__, "dbi_conn_connect(): %s", errormsg);
+}
+
+static void mod_vhostdb_dbi_conn_close (vhostdb_dbi_conn * const c)
+{
+    if (NULL != c->dbconn) dbi_conn_close(c->dbconn);
+    if (NULL != c->dbinst) dbi_shutdown_r(c->dbinst);
+    c->dbconn = NULL;
+    c->dbinst = NULL;
+}
+
+static int mod_vhostdb_dbi_conn_open (vhostdb_dbi_conn * const c, const vhostdb_config * const dbconf, log_error_st * const errh)
+{
+    /* create/initialise database */
+    c->errh = errh;
+    c->reconnect_count = 0;
+    if (dbi_initialize_r(NULL, &c->dbinst) < 1) {
+        log_error(errh, __FILE__, __LINE__,
+          "dbi_initialize_r() failed.  "
+          "Do you have the DBD for this db type installed?");
+        mod_vhostdb_dbi_conn_close(c);
+        return -1;
+    }
+    c->dbconn = dbi_conn_new_r(dbconf->dbtype->ptr, c->dbinst);
+    if (NULL == c->dbconn) {
+        log_error(errh, __FILE__, __LINE__,
+          "dbi_conn_new_r() failed.  "
+          "Do you have the DBD for this db type installed?");
+        mod_vhostdb_dbi_conn_close(c);
+        return -1;
+    }
+
+    /* set options */
+    const array * const opts = dbconf->opts;
+    for (size_t j = 0; j < opts->used; ++j) {
+        data_unset *du = opts->data[j];
+        const buffer *opt = &du->key;
+        if (!buffer_string_is_empty(opt)) {
+            if (du->type == TYPE_INTEGER) {
+                data_integer *di = (data_integer *)du;
+                dbi_conn_set_option_numeric(c->dbconn, opt->ptr, di->value);
+            } else if (du->type == TYPE_STRING) {
+                data_string *ds = (data_string *)du;
+                if (&ds->value != dbconf->sqlquery
+                    && &ds->value != dbconf->dbtype) {
+                    dbi_conn_set_option(c->dbconn, opt->ptr, ds->value.ptr);
+                }
+            }
+        }
+    }
+
+    /* used to automatically reconnect to the database */
+    dbi_conn_error_handler(c->dbconn, mod_vhostdb_dbi_error_callback, c);
+
+    /* connect to database */
+    mod_vhostdb_dbi_error_callback(c->dbconn, c);
+    if (c->reconnect_count >= 3) {
+        mod_vhostdb_dbi_conn_close(c);
+        return -1;
+    }
+
+    return 0;
 }
 
 static void mod_vhostdb_dbconf_free (void *vdata)
 {
     vhostdb_config *dbconf = (vhostdb_config *)vdata;
     if (!dbconf) return;
-    dbi_conn_close(dbconf->dbconn);
-    dbi_shutdown_r(dbconf->dbinst);
     free(dbconf);
 }
 
@@ -106,91 +193,81 @@ static int mod_vhostdb_dbconf_setup (server *srv, const array *opts, void **vdat
 
     if (!buffer_string_is_empty(sqlquery)
         && !buffer_is_empty(dbname) && !buffer_is_empty(dbtype)) {
-        /* create/initialise database */
         vhostdb_config *dbconf;
-        dbi_inst dbinst = NULL;
-        dbi_conn dbconn;
-        if (dbi_initialize_r(NULL, &dbinst) < 1) {
-            log_error(srv->errh, __FILE__, __LINE__,
-              "dbi_initialize_r() failed.  "
-              "Do you have the DBD for this db type installed?");
-            return -1;
-        }
-        dbconn = dbi_conn_new_r(dbtype->ptr, dbinst);
-        if (NULL == dbconn) {
-            log_error(srv->errh, __FILE__, __LINE__,
-              "dbi_conn_new_r() failed.  "
-              "Do you have the DBD for this db type installed?");
-            dbi_shutdown_r(dbinst);
-            return -1;
-        }
-
-        /* set options */
-        for (size_t j = 0; j < opts->used; ++j) {
-            data_unset *du = opts->data[j];
-            const buffer *opt = &du->key;
-            if (!buffer_string_is_empty(opt)) {
-                if (du->type == TYPE_INTEGER) {
-                    data_integer *di = (data_integer *)du;
-                    dbi_conn_set_option_numeric(dbconn, opt->ptr, di->value);
-                } else if (du->type == TYPE_STRING) {
-                    data_string *ds = (data_string *)du;
-                    if (&ds->value != sqlquery && &ds->value != dbtype) {
-                        dbi_conn_set_option(dbconn, opt->ptr, ds->value.ptr);
-                    }
-                }
-            }
-        }
-
         dbconf = (vhostdb_config *)calloc(1, sizeof(*dbconf));
-        dbconf->dbinst = dbinst;
-        dbconf->dbconn = dbconn;
+        force_assert(dbconf);
         dbconf->sqlquery = sqlquery;
-        dbconf->errh = srv->errh;
-        dbconf->reconnect_count = 0;
-        *vdata = dbconf;
+        dbconf->dbtype = dbtype;
+        dbconf->opts = opts;
 
-        /* used to automatically reconnect to the database */
-        dbi_conn_error_handler(dbconn, mod_vhostdb_dbi_error_callback, dbconf);
-
-        /* connect to database */
-        mod_vhostdb_dbi_error_callback(dbconn, dbconf);
-        if (dbconf->reconnect_count >= 3) {
+        /* check database connection at startup
+         * (queries are made in worker threads, each with its own connection)*/
+        vhostdb_dbi_conn c = { NULL, NULL, NULL, 0 };
+        if (0 != mod_vhostdb_dbi_conn_open(&c, dbconf, srv->errh)) {
             mod_vhostdb_dbconf_free(dbconf);
             return -1;
         }
+        mod_vhostdb_dbi_conn_close(&c);
+
+        *vdata = dbconf;
     }
 
     return 0;
 }
 
-static void mod_vhostdb_patch_config (request_st * const r, plugin_data * const p);
+static void * mod_vhostdb_dbi_tctx_init (void * const ctx)
+{
+    const plugin_data * const p = ctx;
+    vhostdb_dbi_tctx * const tctx =
+      calloc(1, sizeof(vhostdb_dbi_tctx) + p->ndbconf*sizeof(vhostdb_dbi_conn));
+    force_assert(tctx);
+    tctx->used = p->ndbconf;
+    return tctx;
+}
 
-static int mod_vhostdb_dbi_query(request_st * const r, void *p_d, buffer *docroot)
+static void mod_vhostdb_dbi_tctx_free (void * const ctx)
 {
-    plugin_data *p = (plugin_data *)p_d;
-    vhostdb_config *dbconf;
+    vhostdb_dbi_tctx * const tctx = ctx;
+    if (NULL == tctx) return;
+    for (uint32_t i = 0; i < tctx->used; ++i)
+        mod_vhostdb_dbi_conn_close(tctx->c + i);
+    free(tctx);
+}
+
+static void mod_vhostdb_dbi_job_run (async_job * const job, void * const tctx, log_error_st * const errh)
+{
+    /* (called in worker thread) */
+    vhostdb_dbi_job * const vj = (vhostdb_dbi_job *)job;
+    const vhostdb_config * const dbconf = vj->dbconf;
+    vhostdb_dbi_conn * const c = ((vhostdb_dbi_tctx *)tctx)->c + dbconf->ndx;
     dbi_result result;
     unsigned long long nrows;
     int retry_count = 0;
 
-    /*(reuse buffer for sql query before generating docroot result)*/
-    buffer *sqlquery = docroot;
-    buffer_clear(sqlquery); /*(also resets docroot (alias))*/
+    vj->rc = -1;
 
-    mod_vhostdb_patch_config(r, p);
-    if (NULL == p->conf.vdata) return 0; /*(after resetting docroot)*/
-    dbconf = (vhostdb_config *)p->conf.vdata;
+    if (NULL == c->dbconn) {
+        if (0 != mod_vhostdb_dbi_conn_open(c, dbconf, errh))
+            return;
+    }
+    else
+        c->errh = errh;
+
+    /*(reuse buffer for sql query before generating docroot result)*/
+    buffer * const sqlquery = &vj->docroot;
 
     for (char *b = dbconf->sqlquery->ptr, *d; *b; b = d+1) {
         if (NULL != (d = strchr(b, '?'))) {
             /* escape the uri.authority */
             char *esc = NULL;
-            size_t len = dbi_conn_escape_string_copy(dbconf->dbconn, r->uri.authority.ptr, &esc);
+            size_t len = dbi_conn_escape_string_copy(c->dbconn, vj->authority.ptr, &esc);
             buffer_append_string_len(sqlquery, b, (size_t)(d - b));
             buffer_append_string_len(sqlquery, esc, len);
             free(esc);
-            if (0 == len) return -1;
+            if (0 == len) {
+                buffer_clear(sqlquery); /*(reset buffer; no result)*/
+                return;
+            }
         } else {
             d = dbconf->sqlquery->ptr + buffer_string_length(dbconf->sqlquery);
             buffer_append_string_len(sqlquery, b, (size_t)(d - b));
@@ -199,19 +276,21 @@ static int mod_vhostdb_dbi_query(request_st * const r, void *p_d, buffer *docroo
     }
 
     /* reset our reconnect-attempt counter, this is a new query. */
-    dbconf->reconnect_count = 0;
+    c->reconnect_count = 0;
 
+    /* (synchronous; blocking) */
     do {
-        result = dbi_conn_query(dbconf->dbconn, sqlquery->ptr);
+        result = dbi_conn_query(c->dbconn, sqlquery->ptr);
     } while (!result && ++retry_count < 2);
 
+    buffer * const docroot = &vj->docroot;
     buffer_clear(docroot); /*(reset buffer to store result)*/
 
     if (!result) {
         const char *errmsg;
-        dbi_conn_error(dbconf->dbconn, &errmsg);
-        log_error(r->conf.errh, __FILE__, __LINE__, "%s", errmsg);
-        return -1;
+        dbi_conn_error(c->dbconn, &errmsg);
+        log_error(errh, __FILE__, __LINE__, "%s", errmsg);
+        return;
     }
 
     nrows = dbi_result_get_numrows(result);
@@ -220,7 +299,64 @@ static int mod_vhostdb_dbi_query(request_st * const r, void *p_d, buffer *docroo
     } /* else no such virtual host */
 
     dbi_result_free(result);
-    return 0;
+    vj->rc = 0;
+}
+
+static void mod_vhostdb_dbi_job_free (async_job * const job)
+{
+    vhostdb_dbi_job * const vj = (vhostdb_dbi_job *)job;
+    free(vj->authority.ptr);
+    free(vj->docroot.ptr);
+    free(vj);
+}
+
+static vhostdb_dbi_job * mod_vhostdb_dbi_job_init (const vhostdb_config * const dbconf, const buffer * const authority)
+{
+    vhostdb_dbi_job * const vj = calloc(1, sizeof(vhostdb_dbi_job));
+    force_assert(vj);
+    vj->job.run  = mod_vhostdb_dbi_job_run;
+    vj->job.free = mod_vhostdb_dbi_job_free;
+    vj->rc = -1;
+    vj->dbconf = dbconf;
+    buffer_copy_buffer(&vj->authority, authority);
+    return vj;
+}
+
+static void mod_vhostdb_patch_config (request_st * const r, plugin_data * const p);
+
+static int mod_vhostdb_dbi_query(request_st * const r, void *p_d, buffer *docroot)
+{
+    plugin_data *p = (plugin_data *)p_d;
+
+    vhostdb_dbi_job *vj = r->plugin_ctx[p->id];
+    if (NULL == vj) {
+        buffer_clear(docroot);
+        mod_vhostdb_patch_config(r, p);
+        if (NULL == p->conf.vdata) return 0; /*(after resetting docroot)*/
+        vj = mod_vhostdb_dbi_job_init(p->conf.vdata, &r->uri.authority);
+        r->plugin_ctx[p->id] = vj;
+        /* DBI query is made in worker thread (synchronous; blocking) */
+        if (async_pool_submit(p->pool, r, &vj->job))
+            return 1; /* query in progress */
+    }
+    else if (!vj->job.done)
+        return 1; /* query in progress */
+
+    r->plugin_ctx[p->id] = NULL;
+    const int rc = vj->rc;
+    buffer_copy_buffer(docroot, &vj->docroot);
+    mod_vhostdb_dbi_job_free(&vj->job);
+    return rc;
+}
+
+REQUEST_FUNC(mod_vhostdb_dbi_handle_reset) {
+    plugin_data * const p = p_d;
+    vhostdb_dbi_job * const vj = r->plugin_ctx[p->id];
+    if (NULL != vj) {
+        r->plugin_ctx[p->id] = NULL;
+        async_job_detach(&vj->job);
+    }
+    return HANDLER_GO_ON;
 }
 
 
@@ -240,6 +376,7 @@ INIT_FUNC(mod_vhostdb_init) {
 
 FREE_FUNC(mod_vhostdb_cleanup) {
     plugin_data * const p = p_d;
+    async_pool_free(p->pool); /*(before freeing config used by threads)*/
     if (NULL == p->cvlist) return;
     /* (init i to 0 if global context; to 1 to skip empty global context) */
     for (int i = !p->cvlist[0].v.u2[1], used = p->nconfig; i < used; ++i) {
@@ -278,7 +415,7 @@ static void mod_vhostdb_patch_config(request_st * const r, plugin_data * const p
     p->conf = p->defaults; /* copy small struct instead of memcpy() */
     /*memcpy(&p->conf, &p->defaults, sizeof(plugin_config));*/
     for (int i = 1, used = p->nconfig; i < used; ++i) {
-        if (config_check_cond(r, (uint32_t)p->cvlist[i].k_id))
+        if ((i = config_check_cond_next(r, p->cvlist, i, used)) < used)
             mod_vhostdb_merge_config(&p->conf,p->cvlist + p->cvlist[i].v.u2[0]);
     }
 }
@@ -307,8 +444,10 @@ SETDEFAULTS_FUNC(mod_vhostdb_set_defaults) {
                 if (cpv->v.a->used) {
                     if (0 != mod_vhostdb_dbconf_setup(srv, cpv->v.a, &cpv->v.v))
                         return HANDLER_ERROR;
-                    if (NULL != cpv->v.v)
+                    if (NULL != cpv->v.v) {
                         cpv->vtype = T_CONFIG_LOCAL;
+                        ((vhostdb_config *)cpv->v.v)->ndx = p->ndbconf++;
+                    }
                 }
                 break;
               default:/* should not happen */
@@ -324,6 +463,11 @@ SETDEFAULTS_FUNC(mod_vhostdb_set_defaults) {
             mod_vhostdb_merge_config(&p->defaults, cpv);
     }
 
+    if (p->ndbconf)
+        p->pool = async_pool_init("mod_vhostdb_dbi", MOD_VHOSTDB_DBI_THREADS,
+                                  mod_vhostdb_dbi_tctx_init,
+                                  mod_vhostdb_dbi_tctx_free, p);
+
     return HANDLER_GO_ON;
 }
 
@@ -337,6 +481,7 @@ int mod_vhostdb_dbi_plugin_init (plugin *p)
     p->init             = mod_vhostdb_init;
     p->cleanup          = mod_vhostdb_cleanup;
     p->set_defaults     = mod_vhostdb_set_defaults;
+    p->handle_request_reset = mod_vhostdb_dbi_handle_reset;
 
     return 0;
 }
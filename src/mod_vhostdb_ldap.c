@@ -8,9 +8,17 @@
 
 #include <ldap.h>
 
+/* LDAP calls are made in async_pool worker threads.  libldap in OpenLDAP < 2.5
+ * is not thread-safe; the thread-safe libldap_r must be linked instead */
+#if defined(LDAP_API_FEATURE_X_OPENLDAP) && defined(LDAP_VENDOR_VERSION) \
+ && LDAP_VENDOR_VERSION < 20500 && !defined(HAVE_LIBLDAP_R)
+#error "OpenLDAP < 2.5 requires libldap_r (thread-safe libldap)"
+#endif
+
 #include <string.h>
 #include <stdlib.h>
 
+#include "async_pool.h"
 #include "base.h"
 #include "http_vhostdb.h"
 #include "log.h"
@@ -21,9 +29,8 @@
  */
 
 typedef struct {
-    LDAP *ldap;
+    uint32_t ndx;           /* index into per-thread connections */
     const buffer *filter;
-    log_error_st *errh;
 
     const char *attr;
     const char *host;
@@ -43,13 +50,38 @@ typedef struct {
     PLUGIN_DATA;
     plugin_config defaults;
     plugin_config conf;
+
+    uint32_t ndbconf;
+    async_pool *pool;
 } plugin_data;
 
+/* number of worker threads making (synchronous, blocking) LDAP queries */
+#define MOD_VHOSTDB_LDAP_THREADS 4
+
+/* LDAP connection kept open by each worker thread for each vhostdb.ldap */
+typedef struct {
+    LDAP *ldap;
+    log_error_st *errh;
+    const vhostdb_config *s;
+} vhostdb_ldap_conn;
+
+typedef struct {
+    uint32_t used;
+    vhostdb_ldap_conn c[];
+} vhostdb_ldap_tctx;
+
+typedef struct {
+    async_job job;          /* (must be first member) */
+    int rc;
+    const vhostdb_config *dbconf;
+    buffer filter;
+    buffer docroot;
+} vhostdb_ldap_job;
+
 static void mod_vhostdb_dbconf_free (void *vdata)
 {
     vhostdb_config *dbconf = (vhostdb_config *)vdata;
     if (!dbconf) return;
-    if (NULL != dbconf->ldap) ldap_unbind_ext_s(dbconf->ldap, NULL, NULL);
     free(dbconf);
 }
 
@@ -148,7 +180,6 @@ static int mod_vhostdb_dbconf_setup (server *srv, const array *opts, void **vdat
          * (YMMV with other LDAP client libraries) */
 
         dbconf = (vhostdb_config *)calloc(1, sizeof(*dbconf));
-        dbconf->ldap     = NULL;
         dbconf->filter   = filter;
         dbconf->attr     = attr;
         dbconf->host     = host;
@@ -250,7 +281,7 @@ static void mod_authn_append_ldap_filter_escape(buffer * const filter, const buf
     }
 }
 
-static LDAP * mod_authn_ldap_host_init(log_error_st *errh, vhostdb_config *s) {
+static LDAP * mod_authn_ldap_host_init(log_error_st *errh, const vhostdb_config *s) {
     LDAP *ld;
     int ret;
 
@@ -326,14 +357,16 @@ static int mod_authn_ldap_bind(log_error_st *errh, LDAP *ld, const char *dn, con
 }
 
 static int mod_authn_ldap_rebind_proc (LDAP *ld, LDAP_CONST char *url, ber_tag_t ldap_request, ber_int_t msgid, void *params) {
-    vhostdb_config *s = (vhostdb_config *)params;
+    const vhostdb_ldap_conn * const c = (const vhostdb_ldap_conn *)params;
     UNUSED(url);
     UNUSED(ldap_request);
     UNUSED(msgid);
-    return mod_authn_ldap_bind(s->errh, ld, s->binddn, s->bindpw);
+    return mod_authn_ldap_bind(c->errh, ld, c->s->binddn, c->s->bindpw);
 }
 
-static LDAPMessage * mod_authn_ldap_search(log_error_st *errh, vhostdb_config *s, char *base, char *filter) {
+static LDAPMessage * mod_authn_ldap_search(vhostdb_ldap_conn *c, char *base, char *filter) {
+    log_error_st * const errh = c->errh;
+    const vhostdb_config * const s = c->s;
     LDAPMessage *lm = NULL;
     char *attrs[] = { LDAP_NO_ATTRS, NULL };
     int ret;
@@ -344,115 +377,117 @@ static LDAPMessage * mod_authn_ldap_search(log_error_st *errh, vhostdb_config *s
      * 2. issue search using filter
      */
 
-    if (s->ldap != NULL) {
-        ret = ldap_search_ext_s(s->ldap, base, LDAP_SCOPE_SUBTREE, filter,
+    if (c->ldap != NULL) {
+        ret = ldap_search_ext_s(c->ldap, base, LDAP_SCOPE_SUBTREE, filter,
                                 attrs, 0, NULL, NULL, NULL, 0, &lm);
         if (LDAP_SUCCESS == ret) {
             return lm;
         } else if (LDAP_SERVER_DOWN != ret) {
             /* try again (or initial request);
              * ldap lib sometimes fails for the first call but reconnects */
-            ret = ldap_search_ext_s(s->ldap, base, LDAP_SCOPE_SUBTREE, filter,
+            ret = ldap_search_ext_s(c->ldap, base, LDAP_SCOPE_SUBTREE, filter,
                                     attrs, 0, NULL, NULL, NULL, 0, &lm);
             if (LDAP_SUCCESS == ret) {
                 return lm;
             }
         }
 
-        ldap_unbind_ext_s(s->ldap, NULL, NULL);
+        ldap_unbind_ext_s(c->ldap, NULL, NULL);
     }
 
-    s->ldap = mod_authn_ldap_host_init(errh, s);
-    if (NULL == s->ldap) {
+    c->ldap = mod_authn_ldap_host_init(errh, s);
+    if (NULL == c->ldap) {
         return NULL;
     }
 
-    ldap_set_rebind_proc(s->ldap, mod_authn_ldap_rebind_proc, s);
-    ret = mod_authn_ldap_bind(errh, s->ldap, s->binddn, s->bindpw);
+    ldap_set_rebind_proc(c->ldap, mod_authn_ldap_rebind_proc, c);
+    ret = mod_authn_ldap_bind(errh, c->ldap, s->binddn, s->bindpw);
     if (LDAP_SUCCESS != ret) {
-        ldap_destroy(s->ldap);
-        s->ldap = NULL;
+        ldap_destroy(c->ldap);
+        c->ldap = NULL;
         return NULL;
     }
 
-    ret = ldap_search_ext_s(s->ldap, base, LDAP_SCOPE_SUBTREE, filter,
+    ret = ldap_search_ext_s(c->ldap, base, LDAP_SCOPE_SUBTREE, filter,
                             attrs, 0, NULL, NULL, NULL, 0, &lm);
     if (LDAP_SUCCESS != ret) {
         log_error(errh, __FILE__, __LINE__,
           "ldap: %s; filter: %s", ldap_err2string(ret), filter);
-        ldap_unbind_ext_s(s->ldap, NULL, NULL);
-        s->ldap = NULL;
+        ldap_unbind_ext_s(c->ldap, NULL, NULL);
+        c->ldap = NULL;
         return NULL;
     }
 
     return lm;
 }
 
-static void mod_vhostdb_patch_config (request_st * const r, plugin_data * const p);
+static void * mod_vhostdb_ldap_tctx_init (void * const ctx)
+{
+    const plugin_data * const p = ctx;
+    vhostdb_ldap_tctx * const tctx =
+      calloc(1, sizeof(vhostdb_ldap_tctx) + p->ndbconf*sizeof(vhostdb_ldap_conn));
+    force_assert(tctx);
+    tctx->used = p->ndbconf;
+    return tctx;
+}
 
-static int mod_vhostdb_ldap_query(request_st * const r, void *p_d, buffer *docroot)
+static void mod_vhostdb_ldap_tctx_free (void * const ctx)
 {
-    plugin_data *p = (plugin_data *)p_d;
-    vhostdb_config *dbconf;
+    vhostdb_ldap_tctx * const tctx = ctx;
+    if (NULL == tctx) return;
+    for (uint32_t i = 0; i < tctx->used; ++i) {
+        if (NULL != tctx->c[i].ldap)
+            ldap_unbind_ext_s(tctx->c[i].ldap, NULL, NULL);
+    }
+    free(tctx);
+}
+
+static void mod_vhostdb_ldap_job_run (async_job * const job, void * const tctx, log_error_st * const errh)
+{
+    /* (called in worker thread) */
+    vhostdb_ldap_job * const vj = (vhostdb_ldap_job *)job;
+    const vhostdb_config * const dbconf = vj->dbconf;
+    vhostdb_ldap_conn * const c = ((vhostdb_ldap_tctx *)tctx)->c + dbconf->ndx;
+    buffer * const docroot = &vj->docroot;
     LDAP *ld;
     LDAPMessage *lm, *first;
     struct berval **vals;
     int count;
     char *basedn;
-    const buffer *template;
-
-    /*(reuse buffer for ldap query before generating docroot result)*/
-    buffer *filter = docroot;
-    buffer_clear(filter); /*(also resets docroot (alias))*/
 
-    mod_vhostdb_patch_config(r, p);
-    if (NULL == p->conf.vdata) return 0; /*(after resetting docroot)*/
-    dbconf = (vhostdb_config *)p->conf.vdata;
-    log_error_st * const errh = r->conf.errh;
-    dbconf->errh = errh;
-
-    template = dbconf->filter;
-    for (char *b = template->ptr, *d; *b; b = d+1) {
-        if (NULL != (d = strchr(b, '?'))) {
-            buffer_append_string_len(filter, b, (size_t)(d - b));
-            mod_authn_append_ldap_filter_escape(filter, &r->uri.authority);
-        } else {
-            d = template->ptr + buffer_string_length(template);
-            buffer_append_string_len(filter, b, (size_t)(d - b));
-            break;
-        }
-    }
+    vj->rc = -1;
+    c->s = dbconf;
+    c->errh = errh;
 
     /* (cast away const for poor LDAP ldap_search_ext_s() prototype) */
     *(const char **)&basedn = dbconf->basedn;
 
     /* ldap_search (synchronous; blocking) */
-    lm = mod_authn_ldap_search(errh, dbconf, basedn, filter->ptr);
+    lm = mod_authn_ldap_search(c, basedn, vj->filter.ptr);
     if (NULL == lm) {
-        return -1;
+        return;
     }
 
     /*(must be after mod_authn_ldap_search(); might reconnect)*/
-    ld = dbconf->ldap;
+    ld = c->ldap;
 
     count = ldap_count_entries(ld, lm);
     if (count > 1) {
         log_error(errh, __FILE__, __LINE__,
           "ldap: more than one record returned.  "
-          "you might have to refine the filter: %s", filter->ptr);
+          "you might have to refine the filter: %s", vj->filter.ptr);
     }
 
-    buffer_clear(docroot); /*(reset buffer to store result)*/
-
     if (0 == count) { /*(no entries found)*/
         ldap_msgfree(lm);
-        return 0;
+        vj->rc = 0;
+        return;
     }
 
     if (NULL == (first = ldap_first_entry(ld, lm))) {
         mod_authn_ldap_opt_err(errh,__FILE__,__LINE__,"ldap_first_entry()",ld);
         ldap_msgfree(lm);
-        return -1;
+        return;
     }
 
     if (NULL != (vals = ldap_get_values_len(ld, first, dbconf->attr))) {
@@ -461,7 +496,77 @@ static int mod_vhostdb_ldap_query(request_st * const r, void *p_d, buffer *docro
     }
 
     ldap_msgfree(lm);
-    return 0;
+    vj->rc = 0;
+}
+
+static void mod_vhostdb_ldap_job_free (async_job * const job)
+{
+    vhostdb_ldap_job * const vj = (vhostdb_ldap_job *)job;
+    free(vj->filter.ptr);
+    free(vj->docroot.ptr);
+    free(vj);
+}
+
+static vhostdb_ldap_job * mod_vhostdb_ldap_job_init (const vhostdb_config * const dbconf, const buffer * const authority)
+{
+    vhostdb_ldap_job * const vj = calloc(1, sizeof(vhostdb_ldap_job));
+    force_assert(vj);
+    vj->job.run  = mod_vhostdb_ldap_job_run;
+    vj->job.free = mod_vhostdb_ldap_job_free;
+    vj->rc = -1;
+    vj->dbconf = dbconf;
+
+    buffer * const filter = &vj->filter;
+    const buffer * const template = dbconf->filter;
+    for (char *b = template->ptr, *d; *b; b = d+1) {
+        if (NULL != (d = strchr(b, '?'))) {
+            buffer_append_string_len(filter, b, (size_t)(d - b));
+            mod_authn_append_ldap_filter_escape(filter, authority);
+        } else {
+            d = template->ptr + buffer_string_length(template);
+            buffer_append_string_len(filter, b, (size_t)(d - b));
+            break;
+        }
+    }
+
+    return vj;
+}
+
+static void mod_vhostdb_patch_config (request_st * const r, plugin_data * const p);
+
+static int mod_vhostdb_ldap_query(request_st * const r, void *p_d, buffer *docroot)
+{
+    plugin_data *p = (plugin_data *)p_d;
+
+    vhostdb_ldap_job *vj = r->plugin_ctx[p->id];
+    if (NULL == vj) {
+        buffer_clear(docroot);
+        mod_vhostdb_patch_config(r, p);
+        if (NULL == p->conf.vdata) return 0; /*(after resetting docroot)*/
+        vj = mod_vhostdb_ldap_job_init(p->conf.vdata, &r->uri.authority);
+        r->plugin_ctx[p->id] = vj;
+        /* LDAP query is made in worker thread (synchronous; blocking) */
+        if (async_pool_submit(p->pool, r, &vj->job))
+            return 1; /* query in progress */
+    }
+    else if (!vj->job.done)
+        return 1; /* query in progress */
+
+    r->plugin_ctx[p->id] = NULL;
+    const int rc = vj->rc;
+    buffer_copy_buffer(docroot, &vj->docroot);
+    mod_vhostdb_ldap_job_free(&vj->job);
+    return rc;
+}
+
+REQUEST_FUNC(mod_vhostdb_ldap_handle_reset) {
+    plugin_data * const p = p_d;
+    vhostdb_ldap_job * const vj = r->plugin_ctx[p->id];
+    if (NULL != vj) {
+        r->plugin_ctx[p->id] = NULL;
+        async_job_detach(&vj->job);
+    }
+    return HANDLER_GO_ON;
 }
 
 
@@ -481,6 +586,7 @@ INIT_FUNC(mod_vhostdb_init) {
 
 FREE_FUNC(mod_vhostdb_cleanup) {
     plugin_data * const p = p_d;
+    async_pool_free(p->pool); /*(before freeing config used by threads)*/
     if (NULL == p->cvlist) return;
     /* (init i to 0 if global context; to 1 to skip empty global context) */
     for (int i = !p->cvlist[0].v.u2[1], used = p->nconfig; i < used; ++i) {
@@ -519,7 +625,7 @@ static void mod_vhostdb_patch_config(request_st * const r, plugin_data * const p
     p->conf = p->defaults; /* copy small struct instead of memcpy() */
     /*memcpy(&p->conf, &p->defaults, sizeof(plugin_config));*/
     for (int i = 1, used = p->nconfig; i < used; ++i) {
-        if (config_check_cond(r, (uint32_t)p->cvlist[i].k_id))
+        if ((i = config_check_cond_next(r, p->cvlist, i, used)) < used)
             mod_vhostdb_merge_config(&p->conf,p->cvlist + p->cvlist[i].v.u2[0]);
     }
 }
@@ -548,8 +654,10 @@ SETDEFAULTS_FUNC(mod_vhostdb_set_defaults) {
                 if (cpv->v.a->used) {
                     if (0 != mod_vhostdb_dbconf_setup(srv, cpv->v.a, &cpv->v.v))
                         return HANDLER_ERROR;
-                    if (NULL != cpv->v.v)
+                    if (NULL != cpv->v.v) {
                         cpv->vtype = T_CONFIG_LOCAL;
+                        ((vhostdb_config *)cpv->v.v)->ndx = p->ndbconf++;
+                    }
                 }
                 break;
               default:/* should not happen */
@@ -565,6 +673,11 @@ SETDEFAULTS_FUNC(mod_vhostdb_set_defaults) {
             mod_vhostdb_merge_config(&p->defaults, cpv);
     }
 
+    if (p->ndbconf)
+        p->pool = async_pool_init("mod_vhostdb_ldap", MOD_VHOSTDB_LDAP_THREADS,
+                                  mod_vhostdb_ldap_tctx_init,
+                                  mod_vhostdb_ldap_tctx_free, p);
+
     return HANDLER_GO_ON;
 }
 
@@ -578,6 +691,7 @@ int mod_vhostdb_ldap_plugin_init (plugin *p)
     p->init             = mod_vhostdb_init;
     p->cleanup          = mod_vhostdb_cleanup;
     p->set_defaults     = mod_vhostdb_set_defaults;
+    p->handle_request_reset = mod_vhostdb_ldap_handle_reset;
 
     return 0;
 }
@@ -11,6 +11,7 @@
 #include <string.h>
 #include <stdlib.h>
 
+#include "async_pool.h"
 #include "base.h"
 #include "http_vhostdb.h"
 #include "fdevent.h"
@@ -22,8 +23,14 @@
  */
 
 typedef struct {
-    MYSQL *dbconn;
+    uint32_t ndx;           /* index into per-thread connections */
     const buffer *sqlquery;
+    const char *dbname;
+    const char *user;
+    const char *pass;
+    const char *host;
+    const char *sock;
+    unsigned int port;
 } vhostdb_config;
 
 typedef struct {
@@ -34,16 +41,69 @@ typedef struct {
     PLUGIN_DATA;
     plugin_config defaults;
     plugin_config conf;
+
+    uint32_t ndbconf;
+    async_pool *pool;
 } plugin_data;
 
+/* number of worker threads making (synchronous, blocking) MySQL queries */
+#define MOD_VHOSTDB_MYSQL_THREADS 4
+
+/* MySQL connection kept open by each worker thread for each vhostdb.mysql */
+typedef struct {
+    uint32_t used;
+    MYSQL *dbconn[];
+} vhostdb_mysql_tctx;
+
+typedef struct {
+    async_job job;          /* (must be first member) */
+    int rc;
+    const vhostdb_config *dbconf;
+    buffer authority;
+    buffer docroot;
+} vhostdb_mysql_job;
+
 static void mod_vhostdb_dbconf_free (void *vdata)
 {
     vhostdb_config *dbconf = (vhostdb_config *)vdata;
     if (!dbconf) return;
-    mysql_close(dbconf->dbconn);
     free(dbconf);
 }
 
+static MYSQL * mod_vhostdb_mysql_connect (const vhostdb_config * const dbconf, log_error_st * const errh)
+{
+    MYSQL *dbconn = mysql_init(NULL);
+    if (NULL == dbconn) {
+        log_error(errh, __FILE__, __LINE__, "mysql_init() failed");
+        return NULL;
+    }
+
+  #if MYSQL_VERSION_ID >= 50013
+    /* in mysql versions above 5.0.3 the reconnect flag is off by default */
+    {
+        char reconnect = 1;
+        mysql_options(dbconn, MYSQL_OPT_RECONNECT, &reconnect);
+    }
+  #endif
+
+    /* CLIENT_MULTI_STATEMENTS first appeared in 4.1 */
+  #if MYSQL_VERSION_ID < 40100
+    #ifndef CLIENT_MULTI_STATEMENTS
+    #define CLIENT_MULTI_STATEMENTS 0
+    #endif
+  #endif
+    if (!mysql_real_connect(dbconn, dbconf->host, dbconf->user, dbconf->pass,
+                            dbconf->dbname, dbconf->port, dbconf->sock,
+                            CLIENT_MULTI_STATEMENTS)) {
+        log_error(errh, __FILE__, __LINE__, "%s", mysql_error(dbconn));
+        mysql_close(dbconn);
+        return NULL;
+    }
+
+    fdevent_setfd_cloexec(dbconn->net.fd);
+    return dbconn;
+}
+
 static int mod_vhostdb_dbconf_setup (server *srv, const array *opts, void **vdata)
 {
     const buffer *sqlquery = NULL;
@@ -86,73 +146,90 @@ static int mod_vhostdb_dbconf_setup (server *srv, const array *opts, void **vdat
     if (!buffer_string_is_empty(sqlquery)
         && dbname && *dbname && user && *user) {
         vhostdb_config *dbconf;
-        MYSQL *dbconn = mysql_init(NULL);
+        dbconf = (vhostdb_config *)calloc(1, sizeof(*dbconf));
+        force_assert(dbconf);
+        dbconf->sqlquery = sqlquery;
+        dbconf->dbname   = dbname;
+        dbconf->user     = user;
+        dbconf->pass     = pass;
+        dbconf->host     = host;
+        dbconf->sock     = sock;
+        dbconf->port     = port;
+
+        /* check database connection at startup
+         * (queries are made in worker threads, each with its own connection)*/
+        MYSQL * const dbconn = mod_vhostdb_mysql_connect(dbconf, srv->errh);
         if (NULL == dbconn) {
-            log_error(srv->errh, __FILE__, __LINE__,
-              "mysql_init() failed, exiting...");
+            free(dbconf);
             return -1;
         }
+        mysql_close(dbconn);
 
-      #if MYSQL_VERSION_ID >= 50013
-        /* in mysql versions above 5.0.3 the reconnect flag is off by default */
-        {
-            char reconnect = 1;
-            mysql_options(dbconn, MYSQL_OPT_RECONNECT, &reconnect);
-        }
-      #endif
-
-        /* CLIENT_MULTI_STATEMENTS first appeared in 4.1 */
-      #if MYSQL_VERSION_ID < 40100
-        #ifndef CLIENT_MULTI_STATEMENTS
-        #define CLIENT_MULTI_STATEMENTS 0
-        #endif
-      #endif
-        if (!mysql_real_connect(dbconn, host, user, pass, dbname, port, sock,
-                                CLIENT_MULTI_STATEMENTS)) {
-            log_error(srv->errh, __FILE__, __LINE__, "%s", mysql_error(dbconn));
-            mysql_close(dbconn);
-            return -1;
-        }
-
-        fdevent_setfd_cloexec(dbconn->net.fd);
-
-        dbconf = (vhostdb_config *)calloc(1, sizeof(*dbconf));
-        dbconf->dbconn = dbconn;
-        dbconf->sqlquery = sqlquery;
         *vdata = dbconf;
     }
 
     return 0;
 }
 
-static void mod_vhostdb_patch_config (request_st * const r, plugin_data * const p);
+static void * mod_vhostdb_mysql_tctx_init (void * const ctx)
+{
+    const plugin_data * const p = ctx;
+    mysql_thread_init();
+    vhostdb_mysql_tctx * const tctx =
+      calloc(1, sizeof(vhostdb_mysql_tctx) + p->ndbconf*sizeof(MYSQL *));
+    force_assert(tctx);
+    tctx->used = p->ndbconf;
+    return tctx;
+}
 
-static int mod_vhostdb_mysql_query(request_st * const r, void *p_d, buffer *docroot)
+static void mod_vhostdb_mysql_tctx_free (void * const ctx)
 {
-    plugin_data *p = (plugin_data *)p_d;
-    vhostdb_config *dbconf;
+    vhostdb_mysql_tctx * const tctx = ctx;
+    if (NULL != tctx) {
+        for (uint32_t i = 0; i < tctx->used; ++i) {
+            if (NULL != tctx->dbconn[i])
+                mysql_close(tctx->dbconn[i]);
+        }
+        free(tctx);
+    }
+    mysql_thread_end();
+}
+
+static void mod_vhostdb_mysql_job_run (async_job * const job, void * const tctx, log_error_st * const errh)
+{
+    /* (called in worker thread) */
+    vhostdb_mysql_job * const vj = (vhostdb_mysql_job *)job;
+    const vhostdb_config * const dbconf = vj->dbconf;
+    MYSQL ** const dbconnp = ((vhostdb_mysql_tctx *)tctx)->dbconn + dbconf->ndx;
     unsigned  cols;
     MYSQL_ROW row;
     MYSQL_RES *result;
 
-    /*(reuse buffer for sql query before generating docroot result)*/
-    buffer *sqlquery = docroot;
-    buffer_clear(sqlquery); /*(also resets docroot (alias))*/
+    vj->rc = -1;
 
-    mod_vhostdb_patch_config(r, p);
-    if (NULL == p->conf.vdata) return 0; /*(after resetting docroot)*/
-    dbconf = (vhostdb_config *)p->conf.vdata;
+    if (NULL == *dbconnp) {
+        *dbconnp = mod_vhostdb_mysql_connect(dbconf, errh);
+        if (NULL == *dbconnp) return;
+    }
+    MYSQL * const dbconn = *dbconnp;
+
+    /*(reuse buffer for sql query before generating docroot result)*/
+    buffer * const sqlquery = &vj->docroot;
+    const buffer * const authority = &vj->authority;
 
     for (char *b = dbconf->sqlquery->ptr, *d; *b; b = d+1) {
         if (NULL != (d = strchr(b, '?'))) {
             /* escape the uri.authority */
             unsigned long len;
             buffer_append_string_len(sqlquery, b, (size_t)(d - b));
-            buffer_string_prepare_append(sqlquery, buffer_string_length(&r->uri.authority) * 2);
-            len = mysql_real_escape_string(dbconf->dbconn,
+            buffer_string_prepare_append(sqlquery, buffer_string_length(authority) * 2);
+            len = mysql_real_escape_string(dbconn,
                     sqlquery->ptr + buffer_string_length(sqlquery),
-                    CONST_BUF_LEN(&r->uri.authority));
-            if ((unsigned long)~0 == len) return -1;
+                    CONST_BUF_LEN(authority));
+            if ((unsigned long)~0 == len) {
+                buffer_clear(sqlquery); /*(reset buffer; no result)*/
+                return;
+            }
             buffer_commit(sqlquery, len);
         } else {
             d = dbconf->sqlquery->ptr + buffer_string_length(dbconf->sqlquery);
@@ -161,16 +238,17 @@ static int mod_vhostdb_mysql_query(request_st * const r, void *p_d, buffer *docr
         }
     }
 
-    if (mysql_real_query(dbconf->dbconn, CONST_BUF_LEN(sqlquery))) {
-        log_error(r->conf.errh, __FILE__, __LINE__, "%s",
-          mysql_error(dbconf->dbconn));
-        buffer_clear(docroot); /*(reset buffer; no result)*/
-        return -1;
+    /* (synchronous; blocking) */
+    if (mysql_real_query(dbconn, CONST_BUF_LEN(sqlquery))) {
+        log_error(errh, __FILE__, __LINE__, "%s", mysql_error(dbconn));
+        buffer_clear(sqlquery); /*(reset buffer; no result)*/
+        return;
     }
 
+    buffer * const docroot = &vj->docroot;
     buffer_clear(docroot); /*(reset buffer to store result)*/
 
-    result = mysql_store_result(dbconf->dbconn);
+    result = mysql_store_result(dbconn);
     cols = mysql_num_fields(result);
     row = mysql_fetch_row(result);
     if (row && cols >= 1) {
@@ -179,9 +257,66 @@ static int mod_vhostdb_mysql_query(request_st * const r, void *p_d, buffer *docr
 
     mysql_free_result(result);
   #if MYSQL_VERSION_ID >= 40100
-    while (0 == mysql_next_result(dbconf->dbconn)) ;
+    while (0 == mysql_next_result(dbconn)) ;
   #endif
-    return 0;
+    vj->rc = 0;
+}
+
+static void mod_vhostdb_mysql_job_free (async_job * const job)
+{
+    vhostdb_mysql_job * const vj = (vhostdb_mysql_job *)job;
+    free(vj->authority.ptr);
+    free(vj->docroot.ptr);
+    free(vj);
+}
+
+static vhostdb_mysql_job * mod_vhostdb_mysql_job_init (const vhostdb_config * const dbconf, const buffer * const authority)
+{
+    vhostdb_mysql_job * const vj = calloc(1, sizeof(vhostdb_mysql_job));
+    force_assert(vj);
+    vj->job.run  = mod_vhostdb_mysql_job_run;
+    vj->job.free = mod_vhostdb_mysql_job_free;
+    vj->rc = -1;
+    vj->dbconf = dbconf;
+    buffer_copy_buffer(&vj->authority, authority);
+    return vj;
+}
+
+static void mod_vhostdb_patch_config (request_st * const r, plugin_data * const p);
+
+static int mod_vhostdb_mysql_query(request_st * const r, void *p_d, buffer *docroot)
+{
+    plugin_data *p = (plugin_data *)p_d;
+
+    vhostdb_mysql_job *vj = r->plugin_ctx[p->id];
+    if (NULL == vj) {
+        buffer_clear(docroot);
+        mod_vhostdb_patch_config(r, p);
+        if (NULL == p->conf.vdata) return 0; /*(after resetting docroot)*/
+        vj = mod_vhostdb_mysql_job_init(p->conf.vdata, &r->uri.authority);
+        r->plugin_ctx[p->id] = vj;
+        /* MySQL query is made in worker thread (synchronous; blocking) */
+        if (async_pool_submit(p->pool, r, &vj->job))
+            return 1; /* query in progress */
+    }
+    else if (!vj->job.done)
+        return 1; /* query in progress */
+
+    r->plugin_ctx[p->id] = NULL;
+    const int rc = vj->rc;
+    buffer_copy_buffer(docroot, &vj->docroot);
+    mod_vhostdb_mysql_job_free(&vj->job);
+    return rc;
+}
+
+REQUEST_FUNC(mod_vhostdb_mysql_handle_reset) {
+    plugin_data * const p = p_d;
+    vhostdb_mysql_job * const vj = r->plugin_ctx[p->id];
+    if (NULL != vj) {
+        r->plugin_ctx[p->id] = NULL;
+        async_job_detach(&vj->job);
+    }
+    return HANDLER_GO_ON;
 }
 
 
@@ -201,6 +336,7 @@ INIT_FUNC(mod_vhostdb_init) {
 
 FREE_FUNC(mod_vhostdb_cleanup) {
     plugin_data * const p = p_d;
+    async_pool_free(p->pool); /*(before freeing config used by threads)*/
     if (NULL == p->cvlist) return;
     /* (init i to 0 if global context; to 1 to skip empty global context) */
     for (int i = !p->cvlist[0].v.u2[1], used = p->nconfig; i < used; ++i) {
@@ -239,7 +375,7 @@ static void mod_vhostdb_patch_config(request_st * const r, plugin_data * const p
     p->conf = p->defaults; /* copy small struct instead of memcpy() */
     /*memcpy(&p->conf, &p->defaults, sizeof(plugin_config));*/
     for (int i = 1, used = p->nconfig; i < used; ++i) {
-        if (config_check_cond(r, (uint32_t)p->cvlist[i].k_id))
+        if ((i = config_check_cond_next(r, p->cvlist, i, used)) < used)
             mod_vhostdb_merge_config(&p->conf,p->cvlist + p->cvlist[i].v.u2[0]);
     }
 }
@@ -258,6 +394,13 @@ SETDEFAULTS_FUNC(mod_vhostdb_set_defaults) {
     if (!config_plugin_values_init(srv, p, cpk, "mod_vhostdb_mysql"))
         return HANDLER_ERROR;
 
+    /* mysql_library_init() is not thread-safe; call before worker threads
+     * (and before mysql_init() in mod_vhostdb_dbconf_setup()) */
+    if (0 != mysql_library_init(0, NULL, NULL)) {
+        log_error(srv->errh, __FILE__, __LINE__, "mysql_library_init() failed");
+        return HANDLER_ERROR;
+    }
+
     /* process and validate config directives
      * (init i to 0 if global context; to 1 to skip empty global context) */
     for (int i = !p->cvlist[0].v.u2[1]; i < p->nconfig; ++i) {
@@ -268,8 +411,10 @@ SETDEFAULTS_FUNC(mod_vhostdb_set_defaults) {
                 if (cpv->v.a->used) {
                     if (0 != mod_vhostdb_dbconf_setup(srv, cpv->v.a, &cpv->v.v))
                         return HANDLER_ERROR;
-                    if (NULL != cpv->v.v)
+                    if (NULL != cpv->v.v) {
                         cpv->vtype = T_CONFIG_LOCAL;
+                        ((vhostdb_config *)cpv->v.v)->ndx = p->ndbconf++;
+                    }
                 }
                 break;
               default:/* should not happen */
@@ -285,6 +430,11 @@ SETDEFAULTS_FUNC(mod_vhostdb_set_defaults) {
             mod_vhostdb_merge_config(&p->defaults, cpv);
     }
 
+    if (p->ndbconf)
+        p->pool = async_pool_init("mod_vhostdb_mysql", MOD_VHOSTDB_MYSQL_THREADS,
+                                  mod_vhostdb_mysql_tctx_init,
+                                  mod_vhostdb_mysql_tctx_free, p);
+
     return HANDLER_GO_ON;
 }
 
@@ -298,6 +448,7 @@ int mod_vhostdb_mysql_plugin_init (plugin *p)
     p->init             = mod_vhostdb_init;
     p->cleanup          = mod_vhostdb_cleanup;
     p->set_defaults     = mod_vhostdb_set_defaults;
+    p->handle_request_reset = mod_vhostdb_mysql_handle_reset;
 
     return 0;
 }
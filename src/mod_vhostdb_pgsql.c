@@ -11,6 +11,7 @@
 #include <string.h>
 #include <stdlib.h>
 
+#include "async_pool.h"
 #include "base.h"
 #include "http_vhostdb.h"
 #include "log.h"
@@ -21,8 +22,13 @@
  */
 
 typedef struct {
-    PGconn *dbconn;
+    uint32_t ndx;           /* index into per-thread connections */
     const buffer *sqlquery;
+    const char *dbname;
+    const char *user;
+    const char *pass;
+    const char *host;
+    const char *port;
 } vhostdb_config;
 
 typedef struct {
@@ -33,16 +39,56 @@ typedef struct {
     PLUGIN_DATA;
     plugin_config defaults;
     plugin_config conf;
+
+    uint32_t ndbconf;
+    async_pool *pool;
 } plugin_data;
 
+/* number of worker threads making (synchronous, blocking) PostgreSQL queries */
+#define MOD_VHOSTDB_PGSQL_THREADS 4
+
+/* PostgreSQL connection kept open by each worker thread for each vhostdb.pgsql */
+typedef struct {
+    uint32_t used;
+    PGconn *dbconn[];
+} vhostdb_pgsql_tctx;
+
+typedef struct {
+    async_job job;          /* (must be first member) */
+    int rc;
+    const vhostdb_config *dbconf;
+    buffer authority;
+    buffer docroot;
+} vhostdb_pgsql_job;
+
 static void mod_vhostdb_dbconf_free (void *vdata)
 {
     vhostdb_config *dbconf = (vhostdb_config *)vdata;
     if (!dbconf) return;
-    PQfinish(dbconf->dbconn);
     free(dbconf);
 }
 
+static PGconn * mod_vhostdb_pgsql_connect (const vhostdb_config * const dbconf, log_error_st * const errh)
+{
+    PGconn *dbconn = PQsetdbLogin(dbconf->host, dbconf->port, NULL, NULL,
+                                  dbconf->dbname, dbconf->user, dbconf->pass);
+    if (NULL == dbconn) {
+        log_error(errh, __FILE__, __LINE__, "PGsetdbLogin() failed");
+        return NULL;
+    }
+
+    if (CONNECTION_OK != PQstatus(dbconn)) {
+        log_error(errh, __FILE__, __LINE__,
+          "Failed to login to database: %s", PQerrorMessage(dbconn));
+        PQfinish(dbconn);
+        return NULL;
+    }
+
+    /* Postgres sets FD_CLOEXEC on database socket descriptors */
+
+    return dbconn;
+}
+
 static int mod_vhostdb_dbconf_setup (server *srv, const array *opts, void **vdata)
 {
     const buffer *sqlquery = NULL;
@@ -80,47 +126,71 @@ static int mod_vhostdb_dbconf_setup (server *srv, const array *opts, void **vdat
 
     if (!buffer_string_is_empty(sqlquery) && NULL != dbname) {
         vhostdb_config *dbconf;
-        PGconn *dbconn = PQsetdbLogin(host,port,NULL,NULL,dbname,user,pass);
+        dbconf = (vhostdb_config *)calloc(1, sizeof(*dbconf));
+        force_assert(dbconf);
+        dbconf->sqlquery = sqlquery;
+        dbconf->dbname   = dbname;
+        dbconf->user     = user;
+        dbconf->pass     = pass;
+        dbconf->host     = host;
+        dbconf->port     = port;
+
+        /* check database connection at startup
+         * (queries are made in worker threads, each with its own connection)*/
+        PGconn * const dbconn = mod_vhostdb_pgsql_connect(dbconf, srv->errh);
         if (NULL == dbconn) {
-            log_error(srv->errh, __FILE__, __LINE__,
-              "PGsetdbLogin() failed, exiting...");
+            free(dbconf);
             return -1;
         }
+        PQfinish(dbconn);
 
-        if (CONNECTION_OK != PQstatus(dbconn)) {
-            log_error(srv->errh, __FILE__, __LINE__,
-              "Failed to login to database, exiting...");
-            PQfinish(dbconn);
-            return -1;
-        }
-
-        /* Postgres sets FD_CLOEXEC on database socket descriptors */
-
-        dbconf = (vhostdb_config *)calloc(1, sizeof(*dbconf));
-        dbconf->dbconn = dbconn;
-        dbconf->sqlquery = sqlquery;
         *vdata = dbconf;
     }
 
     return 0;
 }
 
-static void mod_vhostdb_patch_config(request_st * const r, plugin_data * const p);
+static void * mod_vhostdb_pgsql_tctx_init (void * const ctx)
+{
+    const plugin_data * const p = ctx;
+    vhostdb_pgsql_tctx * const tctx =
+      calloc(1, sizeof(vhostdb_pgsql_tctx) + p->ndbconf*sizeof(PGconn *));
+    force_assert(tctx);
+    tctx->used = p->ndbconf;
+    return tctx;
+}
 
-static int mod_vhostdb_pgsql_query(request_st * const r, void *p_d, buffer *docroot)
+static void mod_vhostdb_pgsql_tctx_free (void * const ctx)
 {
-    plugin_data *p = (plugin_data *)p_d;
-    vhostdb_config *dbconf;
+    vhostdb_pgsql_tctx * const tctx = ctx;
+    if (NULL == tctx) return;
+    for (uint32_t i = 0; i < tctx->used; ++i) {
+        if (NULL != tctx->dbconn[i])
+            PQfinish(tctx->dbconn[i]);
+    }
+    free(tctx);
+}
+
+static void mod_vhostdb_pgsql_job_run (async_job * const job, void * const tctx, log_error_st * const errh)
+{
+    /* (called in worker thread) */
+    vhostdb_pgsql_job * const vj = (vhostdb_pgsql_job *)job;
+    const vhostdb_config * const dbconf = vj->dbconf;
+    PGconn ** const dbconnp = ((vhostdb_pgsql_tctx *)tctx)->dbconn + dbconf->ndx;
     PGresult *res;
     int cols, rows;
 
-    /*(reuse buffer for sql query before generating docroot result)*/
-    buffer *sqlquery = docroot;
-    buffer_clear(sqlquery); /*(also resets docroot (alias))*/
+    vj->rc = -1;
 
-    mod_vhostdb_patch_config(r, p);
-    if (NULL == p->conf.vdata) return 0; /*(after resetting docroot)*/
-    dbconf = (vhostdb_config *)p->conf.vdata;
+    if (NULL == *dbconnp) {
+        *dbconnp = mod_vhostdb_pgsql_connect(dbconf, errh);
+        if (NULL == *dbconnp) return;
+    }
+    PGconn * const dbconn = *dbconnp;
+
+    /*(reuse buffer for sql query before generating docroot result)*/
+    buffer * const sqlquery = &vj->docroot;
+    const buffer * const authority = &vj->authority;
 
     for (char *b = dbconf->sqlquery->ptr, *d; *b; b = d+1) {
         if (NULL != (d = strchr(b, '?'))) {
@@ -128,12 +198,15 @@ static int mod_vhostdb_pgsql_query(request_st * const r, void *p_d, buffer *docr
             size_t len;
             int err;
             buffer_append_string_len(sqlquery, b, (size_t)(d - b));
-            buffer_string_prepare_append(sqlquery, buffer_string_length(&r->uri.authority) * 2);
-            len = PQescapeStringConn(dbconf->dbconn,
+            buffer_string_prepare_append(sqlquery, buffer_string_length(authority) * 2);
+            len = PQescapeStringConn(dbconn,
                     sqlquery->ptr + buffer_string_length(sqlquery),
-                    CONST_BUF_LEN(&r->uri.authority), &err);
+                    CONST_BUF_LEN(authority), &err);
             buffer_commit(sqlquery, len);
-            if (0 != err) return -1;
+            if (0 != err) {
+                buffer_clear(sqlquery); /*(reset buffer; no result)*/
+                return;
+            }
         } else {
             d = dbconf->sqlquery->ptr + buffer_string_length(dbconf->sqlquery);
             buffer_append_string_len(sqlquery, b, (size_t)(d - b));
@@ -141,15 +214,21 @@ static int mod_vhostdb_pgsql_query(request_st * const r, void *p_d, buffer *docr
         }
     }
 
-    res = PQexec(dbconf->dbconn, sqlquery->ptr);
+    /* (synchronous; blocking) */
+    res = PQexec(dbconn, sqlquery->ptr);
 
+    buffer * const docroot = &vj->docroot;
     buffer_clear(docroot); /*(reset buffer to store result)*/
 
     if (PGRES_TUPLES_OK != PQresultStatus(res)) {
-        log_error(r->conf.errh, __FILE__, __LINE__, "%s",
-          PQerrorMessage(dbconf->dbconn));
+        log_error(errh, __FILE__, __LINE__, "%s", PQerrorMessage(dbconn));
         PQclear(res);
-        return -1;
+        if (CONNECTION_OK != PQstatus(dbconn)) {
+            /* reconnect for next query made in this thread */
+            PQfinish(dbconn);
+            *dbconnp = NULL;
+        }
+        return;
     }
 
     cols = PQnfields(res);
@@ -159,7 +238,64 @@ static int mod_vhostdb_pgsql_query(request_st * const r, void *p_d, buffer *docr
     } /* else no such virtual host */
 
     PQclear(res);
-    return 0;
+    vj->rc = 0;
+}
+
+static void mod_vhostdb_pgsql_job_free (async_job * const job)
+{
+    vhostdb_pgsql_job * const vj = (vhostdb_pgsql_job *)job;
+    free(vj->authority.ptr);
+    free(vj->docroot.ptr);
+    free(vj);
+}
+
+static vhostdb_pgsql_job * mod_vhostdb_pgsql_job_init (const vhostdb_config * const dbconf, const buffer * const authority)
+{
+    vhostdb_pgsql_job * const vj = calloc(1, sizeof(vhostdb_pgsql_job));
+    force_assert(vj);
+    vj->job.run  = mod_vhostdb_pgsql_job_run;
+    vj->job.free = mod_vhostdb_pgsql_job_free;
+    vj->rc = -1;
+    vj->dbconf = dbconf;
+    buffer_copy_buffer(&vj->authority, authority);
+    return vj;
+}
+
+static void mod_vhostdb_patch_config(request_st * const r, plugin_data * const p);
+
+static int mod_vhostdb_pgsql_query(request_st * const r, void *p_d, buffer *docroot)
+{
+    plugin_data *p = (plugin_data *)p_d;
+
+    vhostdb_pgsql_job *vj = r->plugin_ctx[p->id];
+    if (NULL == vj) {
+        buffer_clear(docroot);
+        mod_vhostdb_patch_config(r, p);
+        if (NULL == p->conf.vdata) return 0; /*(after resetting docroot)*/
+        vj = mod_vhostdb_pgsql_job_init(p->conf.vdata, &r->uri.authority);
+        r->plugin_ctx[p->id] = vj;
+        /* PostgreSQL query is made in worker thread (synchronous; blocking) */
+        if (async_pool_submit(p->pool, r, &vj->job))
+            return 1; /* query in progress */
+    }
+    else if (!vj->job.done)
+        return 1; /* query in progress */
+
+    r->plugin_ctx[p->id] = NULL;
+    const int rc = vj->rc;
+    buffer_copy_buffer(docroot, &vj->docroot);
+    mod_vhostdb_pgsql_job_free(&vj->job);
+    return rc;
+}
+
+REQUEST_FUNC(mod_vhostdb_pgsql_handle_reset) {
+    plugin_data * const p = p_d;
+    vhostdb_pgsql_job * const vj = r->plugin_ctx[p->id];
+    if (NULL != vj) {
+        r->plugin_ctx[p->id] = NULL;
+        async_job_detach(&vj->job);
+    }
+    return HANDLER_GO_ON;
 }
 
 
@@ -179,6 +315,7 @@ INIT_FUNC(mod_vhostdb_init) {
 
 FREE_FUNC(mod_vhostdb_cleanup) {
     plugin_data * const p = p_d;
+    async_pool_free(p->pool); /*(before freeing config used by threads)*/
     if (NULL == p->cvlist) return;
     /* (init i to 0 if global context; to 1 to skip empty global context) */
     for (int i = !p->cvlist[0].v.u2[1], used = p->nconfig; i < used; ++i) {
@@ -217,7 +354,7 @@ static void mod_vhostdb_patch_config(request_st * const r, plugin_data * const p
     p->conf = p->defaults; /* copy small struct instead of memcpy() */
     /*memcpy(&p->conf, &p->defaults, sizeof(plugin_config));*/
     for (int i = 1, used = p->nconfig; i < used; ++i) {
-        if (config_check_cond(r, (uint32_t)p->cvlist[i].k_id))
+        if ((i = config_check_cond_next(r, p->cvlist, i, used)) < used)
             mod_vhostdb_merge_config(&p->conf,p->cvlist + p->cvlist[i].v.u2[0]);
     }
 }
@@ -246,8 +383,10 @@ SETDEFAULTS_FUNC(mod_vhostdb_set_defaults) {
                 if (cpv->v.a->used) {
                     if (0 != mod_vhostdb_dbconf_setup(srv, cpv->v.a, &cpv->v.v))
                         return HANDLER_ERROR;
-                    if (NULL != cpv->v.v)
+                    if (NULL != cpv->v.v) {
                         cpv->vtype = T_CONFIG_LOCAL;
+                        ((vhostdb_config *)cpv->v.v)->ndx = p->ndbconf++;
+                    }
                 }
                 break;
               default:/* should not happen */
@@ -263,6 +402,18 @@ SETDEFAULTS_FUNC(mod_vhostdb_set_defaults) {
             mod_vhostdb_merge_config(&p->defaults, cpv);
     }
 
+    if (p->ndbconf) {
+        /* queries are made in worker threads; libpq must be thread-safe */
+        if (!PQisthreadsafe()) {
+            log_error(srv->errh, __FILE__, __LINE__,
+              "libpq is not thread-safe");
+            return HANDLER_ERROR;
+        }
+        p->pool = async_pool_init("mod_vhostdb_pgsql", MOD_VHOSTDB_PGSQL_THREADS,
+                                  mod_vhostdb_pgsql_tctx_init,
+                                  mod_vhostdb_pgsql_tctx_free, p);
+    }
+
     return HANDLER_GO_ON;
 }
 
@@ -276,6 +427,7 @@ int mod_vhostdb_pgsql_plugin_init (plugin *p)
     p->init             = mod_vhostdb_init;
     p->cleanup          = mod_vhostdb_cleanup;
     p->set_defaults     = mod_vhostdb_set_defaults;
+    p->handle_request_reset = mod_vhostdb_pgsql_handle_reset;
 
     return 0;
 }
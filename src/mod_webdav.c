@@ -431,7 +431,7 @@ static void mod_webdav_merge_config(plugin_config * const pconf, const config_pl
 static void mod_webdav_patch_config(request_st * const r, plugin_data * const p, plugin_config * const pconf) {
     memcpy(pconf, &p->defaults, sizeof(plugin_config));
     for (int i = 1, used = p->nconfig; i < used; ++i) {
-        if (config_check_cond(r, (uint32_t)p->cvlist[i].k_id))
+        if ((i = config_check_cond_next(r, p->cvlist, i, used)) < used)
             mod_webdav_merge_config(pconf, p->cvlist + p->cvlist[i].v.u2[0]);
     }
 }
@@ -2239,6 +2239,8 @@ webdav_parent_modified (const buffer *path)
     /*force_assert(0 != dirlen);*/
     /*force_assert(fn[0] == '/');*/
     if (fn[dirlen-1] == '/') --dirlen;
+    /* (path created or removed; invalidate cached (negative) entry, if any) */
+    if (0 != dirlen) stat_cache_invalidate_entry(fn, dirlen);
     if (0 != dirlen) while (fn[--dirlen] != '/') ;
     if (0 == dirlen) dirlen = 1; /* root dir ("/") */
     stat_cache_invalidate_entry(fn, dirlen);
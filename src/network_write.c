@@ -3,6 +3,7 @@
 #include "network_write.h"
 
 #include "base.h"
+#include "file_cache.h"
 #include "log.h"
 
 #include <sys/types.h>
@@ -138,6 +139,45 @@ static int network_write_mem_chunk(int fd, chunkqueue *cq, off_t *p_max_bytes, l
 
 
 
+/* next chunk must be FILE_CHUNK with cached file content (c->file.ref).
+ * send from cache with write() */
+static int network_write_file_chunk_ref(int fd, chunkqueue *cq, off_t *p_max_bytes, log_error_st *errh) {
+    chunk* const c = cq->first;
+    const file_cache_entry * const fce = c->file.ref;
+    off_t offset, toSend;
+    ssize_t wr;
+
+    force_assert(c->offset >= 0 && c->offset <= c->file.length);
+
+    offset = c->file.start + c->offset;
+    toSend = c->file.length - c->offset;
+    if (toSend > *p_max_bytes) toSend = *p_max_bytes;
+
+    if (0 == toSend) {
+        chunkqueue_remove_finished_chunks(cq);
+        return 0;
+    }
+
+    if (offset > fce->size - toSend) {
+        log_error(errh, __FILE__, __LINE__, "file shrunk: %s", c->mem->ptr);
+        return -1;
+    }
+
+    /*(write() from mmap()ed file content returns EFAULT, not SIGBUS,
+     * if file has been truncated)*/
+    wr = network_write_data_len(fd, fce->data + offset, toSend);
+    if (wr >= 0) {
+        *p_max_bytes -= wr;
+        chunkqueue_mark_written(cq, wr);
+        return (wr > 0 && wr == toSend) ? 0 : -3;
+    } else {
+        return network_write_error(fd, errh);
+    }
+}
+
+
+
+
 #if !defined(NETWORK_WRITE_USE_MMAP)
 
 static int network_write_file_chunk_no_mmap(int fd, chunkqueue *cq, off_t *p_max_bytes, log_error_st *errh) {
@@ -554,6 +594,10 @@ static int network_write_chunkqueue_write(int fd, chunkqueue *cq, off_t max_byte
             rc = network_write_mem_chunk(fd, cq, &max_bytes, errh);
             break;
         case FILE_CHUNK:
+            if (NULL != cq->first->file.ref) {
+                rc = network_write_file_chunk_ref(fd, cq, &max_bytes, errh);
+                break;
+            }
           #ifdef NETWORK_WRITE_USE_MMAP
             rc = network_write_file_chunk_mmap(fd, cq, &max_bytes, errh);
           #else
@@ -583,6 +627,10 @@ static int network_write_chunkqueue_writev(int fd, chunkqueue *cq, off_t max_byt
           #endif
             break;
         case FILE_CHUNK:
+            if (NULL != cq->first->file.ref) {
+                rc = network_write_file_chunk_ref(fd, cq, &max_bytes, errh);
+                break;
+            }
           #ifdef NETWORK_WRITE_USE_MMAP
             rc = network_write_file_chunk_mmap(fd, cq, &max_bytes, errh);
           #else
@@ -613,6 +661,10 @@ static int network_write_chunkqueue_sendfile(int fd, chunkqueue *cq, off_t max_b
           #endif
             break;
         case FILE_CHUNK:
+            if (NULL != cq->first->file.ref) {
+                rc = network_write_file_chunk_ref(fd, cq, &max_bytes, errh);
+                break;
+            }
           #if defined(NETWORK_WRITE_USE_SENDFILE)
             rc = network_write_file_chunk_sendfile(fd, cq, &max_bytes, errh);
           #elif defined(NETWORK_WRITE_USE_MMAP)
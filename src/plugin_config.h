@@ -80,6 +80,8 @@ void config_log_error_close(server *srv);
 
 void config_reset_config_bytes_sec(void *p);
 
+void config_remoteip_ipset_check(server *srv);
+
 void config_reset_config(request_st *r);
 void config_patch_config(request_st *r);
 
@@ -133,6 +135,9 @@ typedef struct {
 __attribute_cold__
 int config_plugin_value_tobool(data_unset *du, int default_value);
 
+__attribute_cold__
+int config_feature_bool(const server *srv, const char *feature, int default_value);
+
 __attribute_cold__
 int config_plugin_values_init_block(server * const srv, const array * const ca, const config_plugin_keys_t * const cpk, const char * const mname, config_plugin_value_t *cpv);
 
@@ -173,4 +178,12 @@ typedef struct cond_match_t {
 
 int config_check_cond(request_st *r, int context_ndx);
 
+/* plugin config lists longer than this are merged by walking the list of
+ * conditions which match the request (calculated once per request) instead
+ * of checking each condition in the plugin config list */
+#define CONFIG_COND_SCAN_MAX 16
+
+__attribute_hot__
+int config_check_cond_next(request_st *r, const config_plugin_value_t *cvlist, int i, int used);
+
 #endif
@@ -132,6 +132,10 @@ struct request_st {
     uint32_t conditional_is_valid;
     struct cond_cache_t *cond_cache;
     struct cond_match_t *cond_match;
+    uint32_t *cond_true;      /* list of conditions (context_ndx) which match */
+    uint32_t cond_true_used;
+    uint32_t cond_true_valid; /* conditional_is_valid when list calculated */
+    int32_t *cond_index;      /* data_config_index lookup results */
 
     request_config conf;
 
@@ -52,6 +52,9 @@ int http_response_redirect_to_directory(request_st *r, int status);
 int http_response_handle_cachable(request_st *r, const buffer *mtime);
 void http_response_body_clear(request_st *r, int preserve_length);
 void http_response_send_file (request_st *r, buffer *path);
+/* send file containing content encoded with encoding (e.g. pre-compressed
+ * "file.js.gz"); caller sets Content-Type and Content-Encoding */
+void http_response_send_file_encoded (request_st *r, buffer *path, const char *encoding, size_t elen);
 void http_response_backend_done (request_st *r);
 void http_response_backend_error (request_st *r);
 void http_response_upgrade_read_body_unknown(request_st *r);
@@ -12,6 +12,8 @@
 #include "connections.h"
 #include "sock_addr.h"
 #include "stat_cache.h"
+#include "file_cache.h"
+#include "io_prefetch.h"
 #include "plugin.h"
 #include "network_write.h"  /* network_write_show_handlers() */
 #include "response.h"       /* strftime_cache_reset() */
@@ -270,6 +272,7 @@ static void server_free(server *srv) {
 
 #undef CLEAN
 
+	io_prefetch_free();
 	fdevent_free(srv->ev);
 
 	config_free(srv);
@@ -278,6 +281,7 @@ static void server_free(server *srv) {
 	free(srv->fdwaitqueue.ptr);
 
 	stat_cache_free();
+	file_cache_free();
 
 	li_rand_cleanup();
 	chunkqueue_chunk_pool_free();
@@ -475,7 +479,9 @@ static void show_features (void) {
 #else
       "\t- Nettle support\n"
 #endif
-#ifdef HAVE_LIBPCRE
+#ifdef HAVE_PCRE2_H
+      "\t+ PCRE2 support\n"
+#elif defined(HAVE_LIBPCRE)
       "\t+ PCRE support\n"
 #else
       "\t- PCRE support\n"
@@ -1377,6 +1383,9 @@ static int server_main_setup (server * const srv, int argc, char **argv) {
 		return -1;
 	}
 
+	io_prefetch_init(srv);
+	file_cache_init(srv->srvconf.file_cache_size);
+
 #ifdef USE_ALARM
 	{
 		/* setup periodic timer (1 second) */
@@ -1472,10 +1481,16 @@ static void server_handle_sigalrm (server * const srv, time_t min_ts, time_t las
 					if (0 == srv->srvconf.max_worker)
 						fdevent_restart_logger_pipes(min_ts);
 				}
+				else if (chunkqueue_mem_pressure()) {
+					/* free excess chunkqueue buffers sooner */
+					chunkqueue_chunk_pool_clear();
+				}
 				/* cleanup stat-cache */
 				stat_cache_trigger_cleanup();
 				/* reset global/aggregate rate limit counters */
 				config_reset_config_bytes_sec(srv->config_data_base);
+				/* reload $HTTP["remoteip"] "file:..." lists if changed */
+				config_remoteip_ipset_check(srv);
 				/* if graceful_shutdown, accelerate cleanup of recently completed request/responses */
 				if (graceful_shutdown && !srv_shutdown) connection_graceful_shutdown_maint(srv);
 				connection_periodic_maint(srv, min_ts);
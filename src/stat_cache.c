@@ -36,8 +36,18 @@
  * stat-cache
  *
  * - a splay-tree is used as we can use the caching effect of it
+ * - stat() failures with ENOENT or ENOTDIR are cached as negative entries
+ *   (e.g. for repeated probes of index files or of paths which do not exist),
+ *   valid for the same duration as other entries for the stat-cache-engine,
+ *   and limited to a share of the cache (STAT_CACHE_NEGATIVE_MAX)
  */
 
+/* negative entries are limited to half of the entries in the cache
+ * (but up to STAT_CACHE_NEGATIVE_MIN negative entries are always permitted) */
+#define STAT_CACHE_NEGATIVE_MIN 1024
+#define STAT_CACHE_NEGATIVE_MAX(nentries) \
+  ((nentries)/2 > STAT_CACHE_NEGATIVE_MIN ? (nentries)/2 : STAT_CACHE_NEGATIVE_MIN)
+
 enum {
   STAT_CACHE_ENGINE_SIMPLE, /*(default)*/
   STAT_CACHE_ENGINE_NONE,
@@ -49,6 +59,7 @@ struct stat_cache_fam;  /* declaration */
 typedef struct stat_cache {
 	int stat_cache_engine;
 	splay_tree *files; /* nodes of tree are (stat_cache_entry *) */
+	uint32_t negative; /* number of negative entries in files */
 	struct stat_cache_fam *scf;
 } stat_cache;
 
@@ -270,11 +281,17 @@ static void stat_cache_handle_fdevent_in(stat_cache_fam *scf)
             case FAMCreated:
                 /* file created in monitored dir modifies dir and
                  * we should get a separate FAMChanged event for dir.
-                 * Therefore, ignore file FAMCreated event here.
+                 * Therefore, ignore file FAMCreated event here,
+                 * except to invalidate negative stat_cache entry (if any).
                  * Also, if FAMNoExists() is used, might get spurious
                  * FAMCreated events as changes are made e.g. in monitored
                  * sub-sub-sub dirs and the library discovers new (already
                  * existing) dir entries */
+                len = buffer_string_length(n);
+                buffer_append_string_len(n, CONST_STR_LEN("/"));
+                buffer_append_string_len(n,fe.filename,strlen(fe.filename));
+                stat_cache_invalidate_entry(CONST_BUF_LEN(n));
+                buffer_string_set_length(n, len);
                 continue;
             case FAMChanged:
                 /* file changed in monitored dir does not modify dir */
@@ -545,6 +562,8 @@ static void stat_cache_entry_free(void *data) {
     if (sce->fam_dir) --((fam_dir_entry *)sce->fam_dir)->refcnt;
   #endif
 
+    if (sce->stat_errno) --sc.negative;
+
     free(sce->name.ptr);
     free(sce->etag.ptr);
     if (sce->content_type.size) free(sce->content_type.ptr);
@@ -788,6 +807,7 @@ void stat_cache_update_entry(const char *name, uint32_t len,
     stat_cache_entry *sce =
       stat_cache_sptree_find(sptree, name, len);
     if (sce && buffer_is_equal_string(&sce->name, name, len)) {
+        if (sce->stat_errno) { sce->stat_errno = 0; --sc.negative; }
         sce->stat_ts = log_epoch_secs;
         sce->st = *st; /* etagb might be NULL to clear etag (invalidate) */
         buffer_copy_string_len(&sce->etag, CONST_BUF_LEN(etagb));
@@ -917,6 +937,48 @@ void stat_cache_delete_dir(const char *name, uint32_t len)
   #endif
 }
 
+static void stat_cache_negative_entry(const buffer * const name, const size_t len, stat_cache_entry *sce, splay_tree * const sptree, const int file_ndx, const int errnum, const time_t cur_ts) {
+	/* (sce is existing entry for name (stale), or NULL;
+	 *  sptree is sc.files already splayed for file_ndx) */
+	if (NULL == sce) {
+		if (sc.negative
+		    >= STAT_CACHE_NEGATIVE_MAX((uint32_t)splaytree_size(sptree)))
+			return;
+		sce = stat_cache_entry_init();
+		buffer_copy_string_len(&sce->name, name->ptr, len);
+		if (NULL != sptree && sptree->key == file_ndx) {
+			/* hash collision: replace old entry */
+			stat_cache_entry_free(sptree->data);
+			sptree->data = sce;
+		} else {
+			sc.files = splaytree_insert(sptree, file_ndx, sce);
+		}
+	}
+	else {
+		buffer_clear(&sce->etag);
+	      #if defined(HAVE_XATTR) || defined(HAVE_EXTATTR)
+		buffer_clear(&sce->content_type);
+	      #endif
+	}
+
+	if (0 == sce->stat_errno) ++sc.negative;
+	sce->stat_errno = errnum;
+	memset(&sce->st, 0, sizeof(sce->st));
+
+      #ifdef HAVE_FAM_H
+	if (sc.stat_cache_engine == STAT_CACHE_ENGINE_FAM) {
+		/* monitor parent dir (if it exists) for creation of entry */
+		struct stat st;
+		memset(&st, 0, sizeof(st));
+		if (sce->fam_dir) --((fam_dir_entry *)sce->fam_dir)->refcnt;
+		sce->fam_dir =
+		  fam_dir_monitor(sc.scf, sce->name.ptr, (uint32_t)len, &st);
+	}
+      #endif
+
+	sce->stat_ts = cur_ts;
+}
+
 /***
  *
  *
@@ -965,6 +1027,10 @@ stat_cache_entry * stat_cache_get_entry(const buffer *name) {
 		if (buffer_is_equal_string(&sce->name, name->ptr, len)) {
 			if (sc.stat_cache_engine == STAT_CACHE_ENGINE_SIMPLE) {
 				if (sce->stat_ts == cur_ts) {
+					if (sce->stat_errno) {
+						errno = sce->stat_errno;
+						return NULL;
+					}
 					if (final_slash && !S_ISDIR(sce->st.st_mode)) {
 						errno = ENOTDIR;
 						return NULL;
@@ -979,6 +1045,10 @@ stat_cache_entry * stat_cache_get_entry(const buffer *name) {
 				 * (due to limitations in stat_cache.c use of FAM)
 				 * (gaps due to not continually monitoring an entire tree) */
 				if (cur_ts - sce->stat_ts < 16) {
+					if (sce->stat_errno) {
+						errno = sce->stat_errno;
+						return NULL;
+					}
 					if (final_slash && !S_ISDIR(sce->st.st_mode)) {
 						errno = ENOTDIR;
 						return NULL;
@@ -994,6 +1064,12 @@ stat_cache_entry * stat_cache_get_entry(const buffer *name) {
 	}
 
 	if (-1 == stat(name->ptr, &st)) {
+		const int errnum = errno;
+		if ((errnum == ENOENT || errnum == ENOTDIR)
+		    && sc.stat_cache_engine != STAT_CACHE_ENGINE_NONE)
+			stat_cache_negative_entry(name, len, sce, sptree, file_ndx,
+			                          errnum, cur_ts);
+		errno = errnum;
 		return NULL;
 	}
 
@@ -1025,6 +1101,10 @@ stat_cache_entry * stat_cache_get_entry(const buffer *name) {
 	      #if defined(HAVE_XATTR) || defined(HAVE_EXTATTR)
 		buffer_clear(&sce->content_type);
 	      #endif
+		if (sce->stat_errno) {
+			sce->stat_errno = 0;
+			--sc.negative;
+		}
 
 	}
 
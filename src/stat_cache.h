@@ -13,6 +13,7 @@
 typedef struct {
     buffer name;
     time_t stat_ts;
+    int stat_errno; /* (negative entry: cached stat() ENOENT or ENOTDIR) */
 #ifdef HAVE_FAM_H
     void *fam_dir;
 #endif
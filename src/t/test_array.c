@@ -63,10 +63,115 @@ static void test_array_set_key_value (void) {
     array_free(a);
 }
 
+static void test_array_get_buf_ptr_ext (void) {
+    data_string *ds;
+    buffer *b;
+    array *a = array_init(0);
+
+    b = array_get_buf_ptr_ext(a, 4, CONST_STR_LEN("Host"));
+    buffer_copy_string_len(b, CONST_STR_LEN("example.org"));
+    array_set_key_value(a, CONST_STR_LEN("X-Other"), CONST_STR_LEN("abc"));
+    ds = (data_string *)array_get_element_klen_ext(a, 4, CONST_STR_LEN("Host"));
+    assert(NULL != ds);
+    assert(ds->ext == 4);
+    assert(buffer_eq_slen(&ds->value, CONST_STR_LEN("example.org")));
+    ds = (data_string *)array_get_element_klen_ext(a, 8, CONST_STR_LEN("Date"));
+    assert(NULL == ds);
+    ds = (data_string *)array_get_element_klen_ext(a, 0, CONST_STR_LEN("x-other"));
+    assert(NULL != ds);
+    assert(ds->ext == 0);
+    assert(buffer_eq_slen(&ds->value, CONST_STR_LEN("abc")));
+
+    /* key inserted without tag is tagged when later accessed with tag */
+    array_set_key_value(a, CONST_STR_LEN("Date"), CONST_STR_LEN("def"));
+    b = array_get_buf_ptr_ext(a, 8, CONST_STR_LEN("Date"));
+    assert(buffer_eq_slen(b, CONST_STR_LEN("def")));
+    ds = (data_string *)array_get_element_klen_ext(a, 8, CONST_STR_LEN("Date"));
+    assert(NULL != ds);
+    assert(&ds->value == b);
+    assert(a->used == 3);
+
+    /* reused elements do not retain stale tags */
+    array_reset_data_strings(a);
+    array_set_key_value(a, CONST_STR_LEN("Host"), CONST_STR_LEN("ghi"));
+    ds = (data_string *)array_get_element_klen_ext(a, 4, CONST_STR_LEN("Host"));
+    assert(NULL == ds);
+
+    array_free(a);
+}
+
+static void test_array_match_index (void) {
+    data_string *ds;
+    const buffer *v;
+    buffer *b = buffer_init();
+    array *a = array_init(0);
+
+    /* key prefix; longest match, not first match */
+    array_set_key_value(a, CONST_STR_LEN("/"), CONST_STR_LEN("1"));
+    array_set_key_value(a, CONST_STR_LEN("/abc/"), CONST_STR_LEN("2"));
+    array_set_key_value(a, CONST_STR_LEN("/ABC/def"), CONST_STR_LEN("3"));
+    array_match_index(a, ARRAY_MATCH_KEY_PREFIX);
+    ds = (data_string *)array_match_key_prefix_klen(a, CONST_STR_LEN("/x"));
+    assert(NULL != ds && buffer_eq_slen(&ds->value, CONST_STR_LEN("1")));
+    ds = (data_string *)array_match_key_prefix_klen(a, CONST_STR_LEN("/abc/d"));
+    assert(NULL != ds && buffer_eq_slen(&ds->value, CONST_STR_LEN("2")));
+    ds = (data_string *)array_match_key_prefix_klen(a, CONST_STR_LEN("/ABC/defg"));
+    assert(NULL != ds && buffer_eq_slen(&ds->value, CONST_STR_LEN("3")));
+    ds = (data_string *)array_match_key_prefix_klen(a, CONST_STR_LEN("/abc/defg"));
+    assert(NULL != ds && buffer_eq_slen(&ds->value, CONST_STR_LEN("2")));
+    ds = (data_string *)array_match_key_prefix_klen(a, CONST_STR_LEN("/Abc/def"));
+    assert(NULL != ds && buffer_eq_slen(&ds->value, CONST_STR_LEN("1")));
+    ds = (data_string *)array_match_key_prefix_nc_klen(a, CONST_STR_LEN("/Abc/def"));
+    assert(NULL != ds && buffer_eq_slen(&ds->value, CONST_STR_LEN("3")));
+    ds = (data_string *)array_match_key_prefix_klen(a, CONST_STR_LEN("x"));
+    assert(NULL == ds);
+    array_free_data(a);
+
+    /* value suffix */
+    array_insert_value(a, CONST_STR_LEN("~"));
+    array_insert_value(a, CONST_STR_LEN(".inc"));
+    array_insert_value(a, CONST_STR_LEN("x.inc"));
+    array_match_index(a, ARRAY_MATCH_VALUE_SUFFIX);
+    buffer_copy_string_len(b, CONST_STR_LEN("/index.html~"));
+    v = array_match_value_suffix(a, b);
+    assert(NULL != v && buffer_eq_slen(v, CONST_STR_LEN("~")));
+    buffer_copy_string_len(b, CONST_STR_LEN("/ax.inc"));
+    v = array_match_value_suffix(a, b);
+    assert(NULL != v && buffer_eq_slen(v, CONST_STR_LEN("x.inc")));
+    buffer_copy_string_len(b, CONST_STR_LEN("/aX.INC"));
+    v = array_match_value_suffix(a, b);
+    assert(NULL == v);
+    v = array_match_value_suffix_nc(a, b);
+    assert(NULL != v && buffer_eq_slen(v, CONST_STR_LEN("x.inc")));
+    buffer_copy_string_len(b, CONST_STR_LEN("inc"));
+    v = array_match_value_suffix_nc(a, b);
+    assert(NULL == v);
+    array_free_data(a);
+
+    /* path or ext */
+    array_set_key_value(a, CONST_STR_LEN(".php"), CONST_STR_LEN("1"));
+    array_set_key_value(a, CONST_STR_LEN("/cgi-bin/"), CONST_STR_LEN("2"));
+    array_match_index(a, ARRAY_MATCH_PATH_OR_EXT);
+    buffer_copy_string_len(b, CONST_STR_LEN("/cgi-bin/x.php"));
+    ds = (data_string *)array_match_path_or_ext(a, b);
+    assert(NULL != ds && buffer_eq_slen(&ds->value, CONST_STR_LEN("2")));
+    buffer_copy_string_len(b, CONST_STR_LEN("/x.php"));
+    ds = (data_string *)array_match_path_or_ext(a, b);
+    assert(NULL != ds && buffer_eq_slen(&ds->value, CONST_STR_LEN("1")));
+    buffer_copy_string_len(b, CONST_STR_LEN("/x.html"));
+    ds = (data_string *)array_match_path_or_ext(a, b);
+    assert(NULL == ds);
+
+    buffer_free(b);
+    array_free(a);
+}
+
 int main() {
     test_array_get_int_ptr();
     test_array_insert_value();
     test_array_set_key_value();
+    test_array_get_buf_ptr_ext();
+    test_array_match_index();
 
     return 0;
 }
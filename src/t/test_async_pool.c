@@ -0,0 +1,260 @@
+#include "first.h"
+
+#undef NDEBUG
+#include <sys/types.h>
+#include <assert.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "async_pool.c"
+
+#ifdef HAVE_PTHREAD_H
+
+typedef struct {
+    async_job job;          /* (must be first member) */
+    int in;
+    int out;
+    int gate;               /* fd to read() before completing (or -1) */
+    pthread_t tid;
+    void *tctx;
+} test_job;
+
+static pthread_mutex_t test_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int test_tctx_inits;
+static int test_tctx_frees;
+static int test_jobs_freed;
+static int test_jobs_completed;
+static int test_joblist_appended;
+
+static void * test_tctx_init (void *ctx) {
+    assert(ctx == &test_mutex);
+    pthread_mutex_lock(&test_mutex);
+    int * const tctx = malloc(sizeof(int));
+    assert(tctx);
+    *tctx = ++test_tctx_inits;
+    pthread_mutex_unlock(&test_mutex);
+    return tctx;
+}
+
+static void test_tctx_free (void *tctx) {
+    pthread_mutex_lock(&test_mutex);
+    ++test_tctx_frees;
+    pthread_mutex_unlock(&test_mutex);
+    free(tctx);
+}
+
+static void test_job_run (async_job *job, void *tctx, log_error_st *errh) {
+    test_job * const tj = (test_job *)job;
+    if (-1 != tj->gate) {
+        char c;
+        assert(1 == read(tj->gate, &c, 1));
+    }
+    tj->tid = pthread_self();
+    tj->tctx = tctx;
+    tj->out = tj->in * 2;
+    log_error(errh, __FILE__, __LINE__, "test job %d", tj->in);
+}
+
+static void test_job_free (async_job *job) {
+    ++test_jobs_freed;
+    free(job);
+}
+
+static void test_job_complete (async_job *job) {
+    ++test_jobs_completed;
+    assert(job->done);
+    assert(!pthread_equal(pthread_self(), ((test_job *)job)->tid));
+}
+
+static test_job * test_job_init (int in) {
+    test_job * const tj = calloc(1, sizeof(*tj));
+    assert(tj);
+    tj->job.run = test_job_run;
+    tj->job.free = test_job_free;
+    tj->in = in;
+    tj->gate = -1;
+    return tj;
+}
+
+static void test_async_pool_wait (async_pool * const pool, int * const count, const int n) {
+    /* process completion notifications as the main thread event loop would */
+    while (*count < n) {
+        struct pollfd pfd = { pool->fd[0], POLLIN, 0 };
+        assert(1 == poll(&pfd, 1, 5000));
+        async_pool_handle_fdevent(pool, FDEVENT_IN);
+    }
+    assert(*count == n);
+}
+
+static void test_async_pool_jobs (log_error_st * const errh) {
+    server srv;
+    connection con;
+    request_st r;
+    memset(&srv, 0, sizeof(srv));
+    memset(&con, 0, sizeof(con));
+    memset(&r, 0, sizeof(r));
+    srv.errh = errh;
+    con.srv = &srv;
+    r.con = &con;
+    r.conf.errh = errh;
+
+    async_pool * const pool =
+      async_pool_init("test", 3, test_tctx_init, test_tctx_free, &test_mutex);
+
+    /* jobs run in worker threads, each with private context of thread;
+     * request is scheduled to run again upon completion */
+    enum { NJOBS = 32 };
+    test_job *tj[NJOBS];
+    for (int i = 0; i < NJOBS; ++i) {
+        tj[i] = test_job_init(i);
+        assert(1 == async_pool_submit(pool, &r, &tj[i]->job));
+    }
+    assert(3 == pool->started);
+    test_async_pool_wait(pool, &test_joblist_appended, NJOBS);
+    assert(1 == r.async_callback);
+    for (int i = 0; i < NJOBS; ++i) {
+        assert(tj[i]->job.done);
+        assert(tj[i]->out == i * 2);
+        assert(!pthread_equal(pthread_self(), tj[i]->tid));
+        assert(NULL != tj[i]->tctx);
+        for (int j = 0; j < i; ++j) {
+            /* same worker thread implies same thread context */
+            if (pthread_equal(tj[i]->tid, tj[j]->tid))
+                assert(tj[i]->tctx == tj[j]->tctx);
+            else
+                assert(tj[i]->tctx != tj[j]->tctx);
+        }
+    }
+    for (int i = 0; i < NJOBS; ++i)
+        test_job_free(&tj[i]->job);
+    test_jobs_freed = 0;
+
+    /* job->complete() called in main thread instead of resuming request */
+    test_job * const c = test_job_init(100);
+    c->job.complete = test_job_complete;
+    assert(1 == async_pool_submit(pool, &r, &c->job));
+    test_async_pool_wait(pool, &test_jobs_completed, 1);
+    assert(NULL == c->job.next);
+    assert(c->out == 200);
+    assert(test_joblist_appended == NJOBS);
+    test_job_free(&c->job);
+    test_jobs_freed = 0;
+
+    /* job detached from request before completion is freed by pool */
+    int gate[2];
+    assert(0 == pipe(gate));
+    test_job * const d = test_job_init(200);
+    d->gate = gate[0];
+    assert(1 == async_pool_submit(pool, &r, &d->job));
+    async_job_detach(&d->job);
+    assert(NULL == d->job.r);
+    assert(0 == test_jobs_freed);
+    assert(1 == write(gate[1], "x", 1));
+    test_async_pool_wait(pool, &test_jobs_freed, 1);
+    assert(test_joblist_appended == NJOBS);
+
+    /* detaching a completed job frees the job */
+    test_job * const e = test_job_init(300);
+    assert(1 == async_pool_submit(pool, &r, &e->job));
+    test_async_pool_wait(pool, &test_joblist_appended, NJOBS+1);
+    async_job_detach(&e->job);
+    assert(2 == test_jobs_freed);
+
+    /* detached jobs still queued at shutdown are freed by async_pool_free() */
+    test_job * const f = test_job_init(400);
+    f->gate = gate[0];
+    test_job * const g = test_job_init(500);
+    assert(1 == async_pool_submit(pool, &r, &f->job));
+    assert(1 == async_pool_submit(pool, &r, &g->job));
+    async_job_detach(&f->job);
+    async_job_detach(&g->job);
+    assert(1 == write(gate[1], "x", 1));
+    async_pool_free(pool);
+    assert(4 == test_jobs_freed);
+    assert(test_tctx_inits == 3);
+    assert(test_tctx_frees == 3);
+
+    close(gate[0]);
+    close(gate[1]);
+}
+
+static void test_async_pool_log (void) {
+    /* worker threads write to the error log of the server */
+    char fn[] = "/tmp/lighttpd_test_async_pool.XXXXXX";
+    const int fd = mkstemp(fn);
+    assert(fd >= 0);
+    unlink(fn);
+
+    log_error_st * const errh = log_error_st_init();
+    errh->errorlog_fd = fd;
+    errh->errorlog_mode = ERRORLOG_FD;
+    test_async_pool_jobs(errh);
+    log_error_st_free(errh);
+
+    char buf[65536];
+    const ssize_t rd = pread(fd, buf, sizeof(buf)-1, 0);
+    assert(rd > 0);
+    buf[rd] = '\0';
+    assert(NULL != strstr(buf, "test job 0\n"));
+    assert(NULL != strstr(buf, "test job 31\n"));
+    close(fd);
+}
+
+#endif /* HAVE_PTHREAD_H */
+
+int main (void) {
+  #ifdef HAVE_PTHREAD_H
+    test_async_pool_log();
+  #endif
+    return 0;
+}
+
+/*
+ * stub functions
+ */
+
+#ifdef HAVE_PTHREAD_H
+
+static fdnode test_fdnode;
+
+fdnode * fdevent_register(fdevents *ev, int fd, fdevent_handler handler, void *ctx) {
+    UNUSED(ev);
+    test_fdnode.fd = fd;
+    test_fdnode.handler = handler;
+    test_fdnode.ctx = ctx;
+    return &test_fdnode;
+}
+
+void fdevent_unregister(fdevents *ev, int fd) {
+    UNUSED(ev);
+    assert(fd == test_fdnode.fd);
+    test_fdnode.fd = -1;
+}
+
+void fdevent_fdnode_event_set(fdevents *ev, fdnode *fdn, int events) {
+    UNUSED(ev);
+    fdn->events = events;
+}
+
+void fdevent_fdnode_event_del(fdevents *ev, fdnode *fdn) {
+    UNUSED(ev);
+    fdn->events = 0;
+}
+
+#ifndef HAVE_SYS_EVENTFD_H
+int fdevent_fcntl_set_nb_cloexec(int fd) {
+    UNUSED(fd);
+    return 0;
+}
+#endif
+
+void connection_list_append(connections *conns, connection *con) {
+    UNUSED(conns);
+    UNUSED(con);
+    ++test_joblist_appended;
+}
+
+#endif /* HAVE_PTHREAD_H */
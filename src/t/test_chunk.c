@@ -0,0 +1,432 @@
+#include "first.h"
+
+#undef NDEBUG
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "chunk.c"
+
+static char test_dir[] = "/tmp/lighttpd_test_chunk.XXXXXX";
+static size_t test_writev_max; /* max bytes written per writev() (0: all) */
+static int test_writev_errno;  /* next writev() fails with errno */
+static int test_writev_iovcnt[8];
+static int test_writev_calls;
+static int test_dup_errno;     /* dup() fails with errno */
+
+static void test_chunk_data (char * const data, const size_t len) {
+    for (size_t i = 0; i < len; ++i) data[i] = (char)(i * 7 % 251);
+}
+
+static void test_chunk_append (chunkqueue * const cq, const char * const data, const size_t len) {
+    /* (separate mem chunk for each call; len >= 256) */
+    buffer * const b = buffer_init();
+    buffer_copy_string_len(b, data, len);
+    chunkqueue_append_buffer(cq, b);
+    buffer_free(b);
+}
+
+static off_t test_chunk_mem_size (const chunkqueue * const cq) {
+    off_t sz = 0;
+    for (const chunk *c = cq->first; c; c = c->next) sz += (off_t)c->mem->size;
+    return sz;
+}
+
+static void test_chunk_mem_limits (void) {
+    /* no limits configured */
+    chunkqueue_set_mem_limits(0, 0);
+    assert(0 == chunk_mem_soft_limit && 0 == chunk_mem_hard_limit);
+    assert(0 == chunkqueue_mem_pressure());
+
+    /* soft limit defaults to hard limit */
+    chunkqueue_set_mem_limits(0, 65536);
+    assert(65536 == chunk_mem_soft_limit && 65536 == chunk_mem_hard_limit);
+
+    /* soft limit capped at hard limit */
+    chunkqueue_set_mem_limits(131072, 65536);
+    assert(65536 == chunk_mem_soft_limit && 65536 == chunk_mem_hard_limit);
+
+    /* soft limit without hard limit */
+    chunkqueue_set_mem_limits(32768, 0);
+    assert(32768 == chunk_mem_soft_limit && 0 == chunk_mem_hard_limit);
+
+    chunkqueue_set_mem_limits(16384, 65536);
+    assert(16384 == chunk_mem_soft_limit && 65536 == chunk_mem_hard_limit);
+
+    chunkqueue_set_mem_limits(0, 0);
+}
+
+static void test_chunk_mem_used (void) {
+    chunkqueue * const cq = chunkqueue_init();
+    const off_t used = chunkqueue_mem_used();
+    char data[1024];
+    memset(data, 'x', sizeof(data));
+
+    /* chunk buffers are counted while held in chunkqueue */
+    chunkqueue_append_mem(cq, data, sizeof(data));
+    assert(chunkqueue_mem_used() - used == test_chunk_mem_size(cq));
+    assert(chunkqueue_mem_used() - used >= (off_t)chunk_buf_sz);
+
+    /* oversized chunk */
+    for (int i = 0; i < 20; ++i) buffer_append_string_len(cq->last->mem, data, sizeof(data));
+    chunkqueue_append_buffer(cq, cq->last->mem);
+    assert(chunkqueue_mem_used() - used == test_chunk_mem_size(cq));
+
+    /* chunk buffers returned to pool are not counted */
+    chunkqueue_mark_written(cq, chunkqueue_length(cq));
+    assert(NULL == cq->first);
+    assert(chunkqueue_mem_used() == used);
+
+    chunkqueue_append_mem(cq, data, sizeof(data));
+    chunkqueue_append_mem_min(cq, data, sizeof(data));
+    assert(chunkqueue_mem_used() - used == test_chunk_mem_size(cq));
+    chunkqueue_reset(cq);
+    assert(chunkqueue_mem_used() == used);
+
+    chunkqueue_append_mem(cq, data, sizeof(data));
+    chunkqueue_free(cq);
+    assert(chunkqueue_mem_used() == used);
+}
+
+static void test_chunk_mem_get_use (void) {
+    chunkqueue * const cq = chunkqueue_init();
+    const off_t used = chunkqueue_mem_used();
+    size_t len;
+    char *mem;
+
+    /* buffer grown by caller after chunkqueue_get_memory() */
+    len = 0;
+    mem = chunkqueue_get_memory(cq, &len);
+    assert(NULL != mem && len >= (chunk_buf_sz >> 1));
+    buffer_string_prepare_append(cq->last->mem, 4 * chunk_buf_sz);
+    len = chunk_buffer_string_space(cq->last->mem);
+    memset(cq->last->mem->ptr, 'x', len);
+    chunkqueue_use_memory(cq, NULL, len);
+    assert(chunkqueue_length(cq) == (off_t)len);
+    assert(chunkqueue_mem_used() - used == test_chunk_mem_size(cq));
+
+    /* new chunk from chunkqueue_get_memory() merged into ckpt and released */
+    chunkqueue_mark_written(cq, (off_t)len - 10);
+    chunkqueue_compact_mem(cq, 10);
+    chunk * const ckpt = cq->last;
+    len = chunk_buffer_string_space(ckpt->mem) + 1;
+    mem = chunkqueue_get_memory(cq, &len);
+    assert(ckpt != cq->last);
+    assert(chunkqueue_mem_used() - used == test_chunk_mem_size(cq));
+    memcpy(mem, "abc", 3);
+    chunkqueue_use_memory(cq, ckpt, 3);
+    assert(ckpt == cq->last && cq->first == cq->last);
+    assert(13 == chunkqueue_length(cq));
+    assert(chunkqueue_mem_used() - used == test_chunk_mem_size(cq));
+
+    /* empty chunk from chunkqueue_get_memory() released */
+    len = chunk_buffer_string_space(ckpt->mem) + 1;
+    mem = chunkqueue_get_memory(cq, &len);
+    assert(ckpt != cq->last);
+    chunkqueue_use_memory(cq, ckpt, 0);
+    assert(ckpt == cq->last);
+    assert(chunkqueue_mem_used() - used == test_chunk_mem_size(cq));
+
+    chunkqueue_free(cq);
+    assert(chunkqueue_mem_used() == used);
+}
+
+static void test_chunk_mem_pressure (void) {
+    chunkqueue * const cq = chunkqueue_init();
+    const off_t used = chunkqueue_mem_used();
+    const size_t dlen = chunk_buf_sz - 1; /*(fills one chunk buffer)*/
+    char * const data = malloc(dlen);
+    assert(NULL != data);
+    memset(data, 'x', dlen);
+
+    chunkqueue_set_mem_limits(used + 4 * (off_t)chunk_buf_sz,
+                              used + 8 * (off_t)chunk_buf_sz);
+
+    /* below soft limit */
+    for (int i = 0; i < 3; ++i) chunkqueue_append_mem(cq, data, dlen);
+    assert(0 == chunkqueue_mem_pressure());
+
+    /* soft limit reached */
+    chunkqueue_append_mem(cq, data, dlen);
+    assert(chunkqueue_mem_used() - used == 4 * (off_t)chunk_buf_sz);
+    assert(CHUNK_MEM_SOFT == chunkqueue_mem_pressure());
+    for (int i = 0; i < 3; ++i) chunkqueue_append_mem(cq, data, dlen);
+    assert(CHUNK_MEM_SOFT == chunkqueue_mem_pressure());
+
+    /* hard limit reached */
+    chunkqueue_append_mem(cq, data, dlen);
+    assert(CHUNK_MEM_HARD == chunkqueue_mem_pressure());
+
+    /* buffer grown after chunkqueue_get_memory() counts towards limits */
+    chunkqueue_reset(cq);
+    assert(0 == chunkqueue_mem_pressure());
+    size_t len = 0;
+    chunkqueue_get_memory(cq, &len);
+    buffer_string_prepare_append(cq->last->mem, 8 * chunk_buf_sz);
+    chunkqueue_use_memory(cq, NULL, 1);
+    assert(CHUNK_MEM_HARD == chunkqueue_mem_pressure());
+
+    /* pressure relieved as chunks are released */
+    chunkqueue_mark_written(cq, chunkqueue_length(cq));
+    assert(0 == chunkqueue_mem_pressure());
+
+    /* soft limit without hard limit */
+    chunkqueue_set_mem_limits(used + (off_t)chunk_buf_sz, 0);
+    chunkqueue_append_mem(cq, data, dlen);
+    assert(CHUNK_MEM_SOFT == chunkqueue_mem_pressure());
+    for (int i = 0; i < 16; ++i) chunkqueue_append_mem(cq, data, dlen);
+    assert(CHUNK_MEM_SOFT == chunkqueue_mem_pressure());
+
+    chunkqueue_free(cq);
+    free(data);
+    chunkqueue_set_mem_limits(0, 0);
+    assert(0 == chunkqueue_mem_pressure());
+}
+
+static void test_chunk_compact_mem (void) {
+    chunkqueue * const cq = chunkqueue_init();
+    buffer * const b = buffer_init();
+    char data[1200];
+    test_chunk_data(data, sizeof(data));
+
+    /* mem chunks of 300, 400, 500 bytes; first 100 bytes consumed */
+    test_chunk_append(cq, data, 300);
+    test_chunk_append(cq, data + 300, 400);
+    test_chunk_append(cq, data + 700, 500);
+    chunkqueue_mark_written(cq, 100);
+
+    /* consolidate across end of first chunk into middle of second chunk;
+     * remainder of partially consolidated chunk is kept */
+    chunkqueue_compact_mem(cq, 500);
+    const chunk *c = cq->first;
+    assert(buffer_string_length(c->mem) - c->offset >= 500);
+    assert(0 == memcmp(c->mem->ptr + c->offset, data + 100, 500));
+    assert(1100 == chunkqueue_length(cq));
+    for (c = cq->first; c; c = c->next)
+        buffer_append_string_len(b, c->mem->ptr + c->offset,
+                                 buffer_string_length(c->mem) - c->offset);
+    assert(buffer_is_equal_string(b, data + 100, 1100));
+
+    /* consolidate to end of chunk */
+    chunkqueue_compact_mem(cq, 600);
+    c = cq->first;
+    assert(0 == memcmp(c->mem->ptr + c->offset, data + 100, 600));
+    assert(1100 == chunkqueue_length(cq));
+    buffer_clear(b);
+    for (c = cq->first; c; c = c->next)
+        buffer_append_string_len(b, c->mem->ptr + c->offset,
+                                 buffer_string_length(c->mem) - c->offset);
+    assert(buffer_is_equal_string(b, data + 100, 1100));
+
+    buffer_free(b);
+    chunkqueue_free(cq);
+}
+
+static void test_chunk_tempfile_writev (void) {
+    chunkqueue * const src = chunkqueue_init();
+    chunkqueue * const dest = chunkqueue_init();
+    log_error_st * const errh = log_error_st_init();
+    char data[14500], buf[14500];
+    const chunk *c;
+    test_chunk_data(data, sizeof(data));
+
+    /* mem chunks of 300, 400, 500, 600, 700 bytes; steal all but last 100 */
+    for (int i = 3, n = 0; i <= 7; n += i++ * 100)
+        test_chunk_append(src, data + n, (size_t)i * 100);
+
+    /* partial writes continue at the correct iovec and offset within it */
+    test_writev_max = 600;
+    test_writev_errno = EINTR;
+    test_writev_calls = 0;
+    assert(0 == chunkqueue_steal_with_tempfiles(dest, src, 2400, errh));
+    assert(5 == test_writev_calls);
+    assert(5 == test_writev_iovcnt[0]); /*(EINTR)*/
+    assert(5 == test_writev_iovcnt[1]); /* 300 + 300 of 400 */
+    assert(4 == test_writev_iovcnt[2]); /* 100 + 500 */
+    assert(2 == test_writev_iovcnt[3]); /* 600 */
+    assert(1 == test_writev_iovcnt[4]); /* 600 of 700 */
+    c = dest->first;
+    assert(NULL != c && c == dest->last && FILE_CHUNK == c->type);
+    assert(c->file.is_temp && 1 == c->file.spool);
+    assert(2400 == c->file.length && 2400 == dest->bytes_in);
+    assert(2400 == pread(c->file.fd, buf, sizeof(buf), 0));
+    assert(0 == memcmp(buf, data, 2400));
+    assert(2400 == chunk_spool_dir_used[0]);
+
+    /* remaining 100 bytes left in last mem chunk */
+    c = src->first;
+    assert(NULL != c && c == src->last && MEM_CHUNK == c->type);
+    assert(600 == c->offset && 100 == chunkqueue_length(src));
+    assert(2400 == src->bytes_out);
+
+    /* consecutive mem chunks batched up to TEMPFILE_MAX_IOVEC per writev();
+     * appended to same tempfile */
+    for (int i = 0; i < 40; ++i)
+        test_chunk_append(src, data + 2500 + i * 300, 300);
+    test_writev_max = 0;
+    test_writev_calls = 0;
+    assert(0 == chunkqueue_steal_with_tempfiles(dest, src, 12100, errh));
+    assert(2 == test_writev_calls);
+    assert(TEMPFILE_MAX_IOVEC == test_writev_iovcnt[0]);
+    assert(41 - TEMPFILE_MAX_IOVEC == test_writev_iovcnt[1]);
+    assert(chunkqueue_is_empty(src) && 14500 == src->bytes_out);
+    c = dest->first;
+    assert(c == dest->last && 14500 == c->file.length);
+    assert(14500 == pread(c->file.fd, buf, sizeof(buf), 0));
+    assert(0 == memcmp(buf, data, 14500));
+    assert(14500 == chunk_spool_dir_used[0]);
+
+    chunkqueue_free(dest);
+    assert(0 == chunk_spool_dir_used[0]);
+    chunkqueue_free(src);
+    log_error_st_free(errh);
+}
+
+static void test_chunk_tempfile_split (void) {
+  #ifdef HAVE_MEMFD_CREATE
+    chunkqueue * const src = chunkqueue_init();
+    chunkqueue * const dest = chunkqueue_init();
+    chunkqueue * const cq2 = chunkqueue_init();
+    chunkqueue * const cq3 = chunkqueue_init();
+    log_error_st * const errh = log_error_st_init();
+    char data[3000], buf[3000];
+    const chunk *c;
+    test_chunk_data(data, sizeof(data));
+
+    chunkqueue_set_spool_limits(1 << 20, 0);
+    test_chunk_append(src, data, sizeof(data));
+    assert(0 == chunkqueue_steal_with_tempfiles(dest, src, 3000, errh));
+    c = dest->first;
+    assert(NULL != c && FILE_CHUNK == c->type && -1 == c->file.spool);
+    assert(buffer_string_is_empty(c->mem));
+    assert(3000 == chunk_spool_memfd_used);
+
+    /* dup() fails; error returned and nothing is split off */
+    test_dup_errno = EMFILE;
+    errno = 0;
+    assert(-1 == chunkqueue_steal(cq2, dest, 1000));
+    assert(EMFILE == errno);
+    assert(chunkqueue_is_empty(cq2) && 0 == cq2->bytes_in);
+    assert(0 == c->offset && 0 == dest->bytes_out);
+    assert(-1 == chunkqueue_steal_with_tempfiles(cq2, dest, 1000, errh));
+    assert(chunkqueue_is_empty(cq2) && 0 == cq2->bytes_in);
+    assert(0 == c->offset && 0 == dest->bytes_out);
+    assert(NULL == c->file.spool_ref);
+    test_dup_errno = 0;
+
+    /* split chunks share unnamed tempfile (and its accounting) */
+    assert(0 == chunkqueue_steal(cq2, dest, 1000));
+    assert(0 == chunkqueue_steal_with_tempfiles(cq3, dest, 1000, errh));
+    assert(2000 == c->offset && 2000 == dest->bytes_out);
+    assert(NULL != c->file.spool_ref && 3 == c->file.spool_ref->refcnt);
+    assert(3000 == c->file.spool_ref->size);
+    for (int i = 0; i < 2; ++i) {
+        const chunk * const d = (0 == i ? cq2 : cq3)->first;
+        assert(NULL != d && FILE_CHUNK == d->type && 1000 == d->file.length);
+        assert(d->file.fd >= 0 && d->file.fd != c->file.fd);
+        assert(-1 == d->file.spool && d->file.spool_ref == c->file.spool_ref);
+        assert(1000 == pread(d->file.fd, buf, 1000, d->file.start));
+        assert(0 == memcmp(buf, data + i * 1000, 1000));
+    }
+
+    /* split chunk is split again */
+    chunkqueue_reset(src);
+    assert(0 == chunkqueue_steal(src, cq3, 500));
+    assert(4 == c->file.spool_ref->refcnt);
+    chunkqueue_reset(src);
+    assert(3 == c->file.spool_ref->refcnt);
+
+    /* tempfile space accounted until last chunk is released */
+    chunkqueue_reset(dest);
+    assert(3000 == chunk_spool_memfd_used);
+    chunkqueue_reset(cq3);
+    assert(3000 == chunk_spool_memfd_used);
+    chunkqueue_reset(cq2);
+    assert(0 == chunk_spool_memfd_used);
+
+    chunkqueue_set_spool_limits(0, 0);
+    chunkqueue_free(cq3);
+    chunkqueue_free(cq2);
+    chunkqueue_free(dest);
+    chunkqueue_free(src);
+    log_error_st_free(errh);
+  #endif
+}
+
+int main (void) {
+    test_chunk_mem_limits();
+    test_chunk_mem_used();
+    test_chunk_mem_get_use();
+    test_chunk_mem_pressure();
+    test_chunk_compact_mem();
+
+    array * const tempdirs = array_init(1);
+    assert(NULL != mkdtemp(test_dir));
+    array_insert_value(tempdirs, test_dir, strlen(test_dir));
+    chunkqueue_set_tempdirs_default(tempdirs, 0);
+    test_chunk_tempfile_writev();
+    test_chunk_tempfile_split();
+    chunkqueue_set_tempdirs_default_reset();
+    array_free(tempdirs);
+    assert(0 == rmdir(test_dir));
+
+    chunkqueue_chunk_pool_free();
+    assert(0 == chunkqueue_mem_used());
+    return 0;
+}
+
+/*
+ * stub functions
+ */
+
+int fdevent_open_cloexec(const char *pathname, int symlinks, int flags, mode_t mode) {
+    UNUSED(symlinks);
+    return open(pathname, flags | O_CLOEXEC, mode);
+}
+
+int fdevent_mkstemp_append(char *path) {
+    return mkstemp(path);
+}
+
+void fdevent_setfd_cloexec(int fd) {
+    UNUSED(fd);
+}
+
+void file_cache_release(file_cache_entry *fce) {
+    UNUSED(fce);
+}
+
+int dup(int fd) {
+    if (test_dup_errno) {
+        errno = test_dup_errno;
+        return -1;
+    }
+    return fcntl(fd, F_DUPFD, 0);
+}
+
+ssize_t writev(int fd, const struct iovec *iov, int iovcnt) {
+    size_t max = test_writev_max ? test_writev_max : SIZE_MAX;
+    ssize_t wr = 0;
+    if (test_writev_calls < (int)(sizeof(test_writev_iovcnt)/sizeof(int)))
+        test_writev_iovcnt[test_writev_calls] = iovcnt;
+    ++test_writev_calls;
+    if (test_writev_errno) {
+        errno = test_writev_errno;
+        test_writev_errno = 0;
+        return -1;
+    }
+    for (int i = 0; i < iovcnt && max; ++i) {
+        const size_t n = iov[i].iov_len < max ? iov[i].iov_len : max;
+        const ssize_t w = write(fd, iov[i].iov_base, n);
+        if (w < 0) return wr ? wr : -1;
+        wr += w;
+        max -= (size_t)w;
+        if ((size_t)w != n) break;
+    }
+    return wr;
+}
@@ -72,8 +72,120 @@ static void test_configfile_addrbuf_eq_remote_ip_mask (void) {
 	log_error_st_free(r.conf.errh);
 }
 
+static void test_configfile_check_cond_next (void) {
+	request_st r;
+	memset(&r, 0, sizeof(request_st));
+	r.conditional_is_valid = (1 << COMP_SERVER_SOCKET);
+
+	/* conditions results are preset in cond_cache (not evaluated) */
+	cond_cache_t cond_cache[64];
+	uint32_t cond_true[64];
+	memset(cond_cache, 0, sizeof(cond_cache));
+	for (int i = 0; i < 64; ++i)
+		cond_cache[i].result = (i % 5 == 0 || i == 63)
+		  ? COND_RESULT_TRUE
+		  : COND_RESULT_FALSE;
+	r.cond_cache = cond_cache;
+
+	data_config dcs[64];
+	const data_config *dcp[64];
+	memset(dcs, 0, sizeof(dcs));
+	for (int i = 0; i < 64; ++i) {
+		dcs[i].comp = COMP_SERVER_SOCKET;
+		dcs[i].context_ndx = i;
+		dcp[i] = &dcs[i];
+	}
+	config_reference.data = dcp;
+	config_reference.used = 64;
+
+	/* plugin config list for every third condition */
+	config_plugin_value_t cvlist[32];
+	int used = 1;
+	for (int k = 3; k < 64; k += 3) cvlist[used++].k_id = k;
+
+	for (int pass = 0; pass < 2; ++pass) {
+		/* pass 0: linear scan; pass 1: list of matching conditions */
+		r.cond_true = pass ? cond_true : NULL;
+		int n = 0;
+		for (int i = 1; i < used; ++i) {
+			if ((i = config_check_cond_next(&r, cvlist, i, used)) < used) {
+				assert(cvlist[i].k_id % 15 == 0 || cvlist[i].k_id == 63);
+				++n;
+			}
+		}
+		assert(n == 5); /* 15, 30, 45, 60, 63 */
+	}
+	assert(r.cond_true_used == 13); /* 5, 10, ..., 60, 63 (excluding 0) */
+
+	/* list is recalculated after cond_cache reset */
+	config_cond_cache_reset(&r);
+	assert(r.cond_true_valid == 0);
+	for (int i = 0; i < 64; ++i)
+		cond_cache[i].result = (i % 5 == 0 || i == 63) && i != 30
+		  ? COND_RESULT_TRUE
+		  : COND_RESULT_FALSE;
+	assert(config_check_cond_next(&r, cvlist, 1, used) == 5);  /* 15 */
+	assert(config_check_cond_next(&r, cvlist, 6, used) == 15); /* 45 */
+	assert(r.cond_true_used == 12);
+}
+
+static void test_configfile_cond_index (void) {
+	data_config *dcs[12];
+	char s[] = "host0.example.com";
+	for (int i = 0; i < 12; ++i) {
+		dcs[i] = data_config_init();
+		dcs[i]->comp = COMP_HTTP_HOST;
+		dcs[i]->cond = CONFIG_COND_EQ;
+		dcs[i]->context_ndx = i + 1;
+		s[4] = "0123456789ab"[i];
+		buffer_copy_string(&dcs[i]->string, s);
+	}
+	/* duplicate of dcs[3] */
+	buffer_copy_buffer(&dcs[11]->string, &dcs[3]->string);
+
+	data_config_index * const idx = data_config_index_init(dcs[0], 12, 1);
+	assert(idx->mask + 1 >= 24);
+	for (int i = 0; i < 11; ++i)
+		assert(data_config_index_insert(idx, dcs[i]));
+	assert(!data_config_index_insert(idx, dcs[11])); /* duplicate left out */
+	assert(NULL == dcs[11]->index);
+
+	buffer * const b = buffer_init();
+	for (int i = 0; i < 11; ++i)
+		assert(dcs[i] == data_config_index_lookup(idx, &dcs[i]->string));
+	buffer_copy_string(b, "hostz.example.com");
+	assert(NULL == data_config_index_lookup(idx, b));
+	buffer_copy_string(b, "host0.example.co");
+	assert(NULL == data_config_index_lookup(idx, b));
+
+	/* single lookup per request; result cached in r->cond_index[idx->id] */
+	request_st r;
+	memset(&r, 0, sizeof(request_st));
+	int32_t cond_index[2] = { 0, 0 };
+	r.cond_index = cond_index;
+	buffer_copy_buffer(b, &dcs[5]->string);
+	assert(config_cond_index_match(&r, dcs[5], b));
+	assert(cond_index[1] == dcs[5]->context_ndx);
+	assert(cond_index[0] == 0);
+	for (int i = 0; i < 11; ++i)
+		assert(config_cond_index_match(&r, dcs[i], b) == (i == 5));
+	/* cached result is used until reset (e.g. by config_cond_cache_reset) */
+	buffer_copy_string(b, "hostz.example.com");
+	assert(config_cond_index_match(&r, dcs[5], b));
+	cond_index[1] = 0;
+	for (int i = 0; i < 11; ++i)
+		assert(!config_cond_index_match(&r, dcs[i], b));
+	assert(cond_index[1] == -1);
+
+	buffer_free(b);
+	for (int i = 11; i >= 0; --i) /*(owner dcs[0] frees index last)*/
+		dcs[i]->fn->free((data_unset *)dcs[i]);
+}
+
 int main (void) {
 	test_configfile_addrbuf_eq_remote_ip_mask();
+	test_configfile_check_cond_next();
+	test_configfile_cond_index();
 
 	return 0;
 }
@@ -0,0 +1,271 @@
+#include "first.h"
+
+#undef NDEBUG
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "file_cache.c"
+
+static char test_dir[] = "/tmp/lighttpd_test_file_cache.XXXXXX";
+
+static int test_file_cache_counter (const char * const k, const size_t klen) {
+    const data_integer * const di =
+      (const data_integer *)array_get_element_klen(&plugin_stats, k, klen);
+    return di ? di->value : 0;
+}
+
+#define test_file_cache_hits() \
+        test_file_cache_counter(CONST_STR_LEN("server.file-cache.hits"))
+
+static void test_file_cache_name (buffer * const b, const int n) {
+    char fn[64];
+    snprintf(fn, sizeof(fn), "/f%03d", n);
+    buffer_copy_string(b, test_dir);
+    buffer_append_string(b, fn);
+}
+
+static void test_file_cache_write (const buffer * const name, const off_t size, const int c, struct stat * const st) {
+    char buf[4096];
+    memset(buf, c, sizeof(buf));
+    const int fd = open(name->ptr, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    assert(fd >= 0);
+    for (off_t off = 0; off < size; ) {
+        const size_t len = size - off < (off_t)sizeof(buf)
+          ? (size_t)(size - off)
+          : sizeof(buf);
+        assert((ssize_t)len == write(fd, buf, len));
+        off += (off_t)len;
+    }
+    assert(0 == fstat(fd, st));
+    assert(0 == close(fd));
+}
+
+static file_cache_entry * test_file_cache_get (const buffer * const name, const int allow_large) {
+    struct stat st;
+    assert(0 == stat(name->ptr, &st));
+    return file_cache_get(name, &st, allow_large);
+}
+
+static void test_file_cache_small (void) {
+    buffer * const b = buffer_init();
+    struct stat st;
+    char buf[16];
+
+    /* cache disabled */
+    test_file_cache_name(b, 0);
+    test_file_cache_write(b, 1000, 'a', &st);
+    assert(NULL == file_cache_get(b, &st, 1));
+
+    file_cache_init(64);
+
+    /* small file cached upon first request */
+    const int hits = test_file_cache_hits();
+    file_cache_entry * const fce = file_cache_get(b, &st, 0);
+    assert(NULL != fce);
+    assert(2 == fce->refcnt);
+    assert(!fce->is_mmap);
+    assert(1000 == fce->size);
+    const char *data = file_cache_data(fce, 990, buf, 10);
+    assert(NULL != data && 0 == memcmp(data, "aaaaaaaaaa", 10));
+    assert(NULL == file_cache_data(fce, 995, buf, 10));
+    assert(hits == test_file_cache_hits());
+    assert(fce == file_cache_get(b, &st, 0));
+    assert(hits + 1 == test_file_cache_hits());
+    assert(3 == fce->refcnt);
+    file_cache_release(fce);
+    file_cache_release(fce);
+    assert(1 == fce->refcnt);
+
+    /* empty files and files too large for cache budget are not cached */
+    test_file_cache_name(b, 1);
+    test_file_cache_write(b, 0, 'b', &st);
+    assert(NULL == file_cache_get(b, &st, 1));
+    test_file_cache_write(b, (64 << 10) / 8 + 1, 'b', &st);
+    assert(NULL == file_cache_get(b, &st, 1));
+
+    /* modified file replaces stale entry; stale entry remains valid while
+     * referenced, and is freed upon last release */
+    test_file_cache_name(b, 0);
+    file_cache_entry * const old = test_file_cache_get(b, 0);
+    assert(fce == old);
+    test_file_cache_write(b, 1001, 'c', &st);
+    file_cache_entry * const fce2 = file_cache_get(b, &st, 0);
+    assert(NULL != fce2 && fce2 != old);
+    assert(1 == old->refcnt); /*(reference held by cache released)*/
+    data = file_cache_data(old, 0, buf, 1);
+    assert(NULL != data && 'a' == *data);
+    data = file_cache_data(fce2, 1000, buf, 1);
+    assert(NULL != data && 'c' == *data);
+    file_cache_release(old);
+    file_cache_release(fce2);
+
+    file_cache_free();
+    buffer_free(b);
+}
+
+static void test_file_cache_large (void) {
+    buffer * const b = buffer_init();
+    struct stat st;
+    char buf[16];
+
+    file_cache_init(1024);
+
+    test_file_cache_name(b, 2);
+    test_file_cache_write(b, FILE_CACHE_SMALL * 2, 'd', &st);
+
+    /* large file not cached unless permitted by caller */
+    assert(NULL == file_cache_get(b, &st, 0));
+    assert(NULL == file_cache_get(b, &st, 0));
+
+    /* large file cached upon repeated request */
+    assert(NULL == file_cache_get(b, &st, 1));
+    file_cache_entry * const fce = file_cache_get(b, &st, 1);
+    assert(NULL != fce);
+  #ifdef FILE_CACHE_USE_MMAP
+    assert(fce->is_mmap);
+  #endif
+    const char * const data =
+      file_cache_data(fce, FILE_CACHE_SMALL * 2 - 4, buf, 4);
+    assert(NULL != data && 0 == memcmp(data, "dddd", 4));
+    const int hits = test_file_cache_hits();
+    file_cache_entry * const fce2 = file_cache_get(b, &st, 1);
+    assert(fce == fce2);
+    assert(hits + 1 == test_file_cache_hits());
+    file_cache_release(fce);
+    file_cache_release(fce2);
+
+    /* large file changed between first and repeated request */
+    test_file_cache_name(b, 3);
+    test_file_cache_write(b, FILE_CACHE_SMALL * 2, 'e', &st);
+    assert(NULL == file_cache_get(b, &st, 1));
+    test_file_cache_write(b, FILE_CACHE_SMALL * 2 + 1, 'e', &st);
+    assert(NULL == file_cache_get(b, &st, 1));
+    file_cache_entry * const fce3 = file_cache_get(b, &st, 1);
+    assert(NULL != fce3);
+    file_cache_release(fce3);
+
+    file_cache_free();
+    buffer_free(b);
+}
+
+static void test_file_cache_evict (void) {
+    buffer * const b = buffer_init();
+    struct stat st;
+    char buf[16];
+
+    file_cache_init(16);
+
+    enum { NFILES = 32 };
+    for (int i = 0; i < NFILES; ++i) {
+        test_file_cache_name(b, 100+i);
+        test_file_cache_write(b, 1024, 'A'+(i%26), &st);
+    }
+
+    /* fill cache budget (entries are all the same cost) */
+    test_file_cache_name(b, 100);
+    file_cache_entry *fce = test_file_cache_get(b, 0);
+    assert(NULL != fce);
+    const off_t cost = file_cache_entry_cost(fce);
+    const int nfit = (int)(fc.max / cost);
+    assert(nfit >= 3 && nfit < NFILES - 2);
+    file_cache_release(fce);
+    for (int i = 1; i < nfit; ++i) {
+        test_file_cache_name(b, 100+i);
+        fce = test_file_cache_get(b, 0);
+        assert(NULL != fce);
+        file_cache_release(fce);
+    }
+    assert(fc.used == nfit * cost);
+
+    /* all entries referenced since inserted; hand clears reference bits of
+     * all entries, then evicts oldest entry */
+    test_file_cache_name(b, 100);
+    file_cache_entry * const held = test_file_cache_get(b, 0);
+    assert(NULL != held && 2 == held->refcnt);
+    test_file_cache_name(b, 100+nfit);
+    fce = test_file_cache_get(b, 0);
+    assert(NULL != fce);
+    file_cache_release(fce);
+    assert(fc.used == nfit * cost);
+    assert(1 == held->refcnt); /* evicted, but still referenced */
+    const char *data = file_cache_data(held, 0, buf, 1);
+    assert(NULL != data && 'A' == *data);
+    file_cache_release(held);
+
+    /* entry referenced since hand passed gets second chance; next entry
+     * not referenced is evicted */
+    test_file_cache_name(b, 101);
+    int hits = test_file_cache_hits();
+    fce = test_file_cache_get(b, 0);
+    assert(hits + 1 == test_file_cache_hits());
+    file_cache_release(fce);
+    test_file_cache_name(b, 100+nfit+1);
+    fce = test_file_cache_get(b, 0);
+    file_cache_release(fce);
+    assert(fc.used == nfit * cost);
+    hits = test_file_cache_hits();
+    test_file_cache_name(b, 101);
+    fce = test_file_cache_get(b, 0);
+    assert(hits + 1 == test_file_cache_hits()); /* still cached */
+    file_cache_release(fce);
+    test_file_cache_name(b, 102);
+    fce = test_file_cache_get(b, 0);
+    assert(hits + 1 == test_file_cache_hits()); /* evicted; reloaded */
+    file_cache_release(fce);
+    test_file_cache_name(b, 100);
+    fce = test_file_cache_get(b, 0);
+    assert(hits + 1 == test_file_cache_hits()); /* evicted; reloaded */
+    file_cache_release(fce);
+    assert(fc.used <= fc.max);
+
+    /* cycle through more files than fit; budget is not exceeded */
+    for (int n = 0; n < 3; ++n) {
+        for (int i = 0; i < NFILES; ++i) {
+            test_file_cache_name(b, 100+i);
+            fce = test_file_cache_get(b, 0);
+            assert(NULL != fce);
+            assert('A'+(i%26) == *file_cache_data(fce, 1023, buf, 1));
+            file_cache_release(fce);
+            assert(fc.used <= fc.max);
+        }
+    }
+
+    file_cache_free();
+    assert(NULL == fc.hand);
+    buffer_free(b);
+}
+
+int main (void) {
+    assert(NULL != mkdtemp(test_dir));
+
+    test_file_cache_small();
+    test_file_cache_large();
+    test_file_cache_evict();
+
+    buffer * const b = buffer_init();
+    for (int i = 0; i < 200; ++i) {
+        test_file_cache_name(b, i);
+        unlink(b->ptr);
+    }
+    buffer_free(b);
+    assert(0 == rmdir(test_dir));
+    array_free_data(&plugin_stats);
+    return 0;
+}
+
+/*
+ * stub functions
+ */
+
+array plugin_stats;
+
+int fdevent_open_cloexec(const char *pathname, int symlinks, int flags, mode_t mode) {
+    UNUSED(symlinks);
+    return open(pathname, flags | O_CLOEXEC, mode);
+}
@@ -0,0 +1,1882 @@
+#include "first.h"
+
+#undef NDEBUG
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "gw_backend.c"
+#include "mod_fastcgi.c"
+/*(mod_proxy.c reuses typedef names of mod_fastcgi.c)*/
+#define plugin_config proxy_plugin_config
+#define plugin_data proxy_plugin_data
+#define handler_ctx proxy_handler_ctx
+#include "mod_proxy.c"
+#undef handler_ctx
+#undef plugin_data
+#undef plugin_config
+#include "file_cache.h"
+
+static char test_dir[] = "/tmp/lighttpd_test_gw_backend.XXXXXX";
+static int test_joblist_appended;
+static off_t test_write_max; /* (0: unlimited) */
+static int test_socket_errno; /* (0: socket() succeeds) */
+static buffer *test_response;
+
+typedef struct {
+    server srv;
+    connection con;
+    request_st r;
+    gw_plugin_data p;
+    gw_host *host;
+    gw_proc *proc;
+    buffer *host_id;
+    int lfd; /* listening socket of backend */
+} test_gw;
+
+static handler_t test_gw_parse (request_st * const r, http_response_opts * const opts, buffer * const b, size_t n) {
+    UNUSED(r);
+    UNUSED(opts);
+    buffer_append_string_len(test_response, b->ptr, n);
+    return HANDLER_GO_ON;
+}
+
+static int test_gw_network_write (int fd, chunkqueue * const cq, off_t max_bytes, log_error_st * const errh) {
+    UNUSED(errh);
+    if (test_write_max && max_bytes > test_write_max)
+        max_bytes = test_write_max;
+    while (max_bytes > 0 && !chunkqueue_is_empty(cq)) {
+        const chunk * const c = cq->first;
+        assert(MEM_CHUNK == c->type);
+        size_t len = buffer_string_length(c->mem) - (size_t)c->offset;
+        if ((off_t)len > max_bytes) len = (size_t)max_bytes;
+        const ssize_t wr = write(fd, c->mem->ptr + c->offset, len);
+        if (wr < 0) return (errno == EAGAIN) ? 0 : -1;
+        chunkqueue_mark_written(cq, wr);
+        max_bytes -= wr;
+    }
+    return 0;
+}
+
+static void test_gw_init (test_gw * const t, const unsigned short multiplex) {
+    memset(t, 0, sizeof(*t));
+    t->srv.errh = log_error_st_init();
+    t->srv.network_backend_write = test_gw_network_write;
+    t->con.srv = &t->srv;
+    t->r.con = &t->con;
+    t->r.conf.errh = t->srv.errh;
+    t->r.plugin_ctx = calloc(1, sizeof(void *));
+    t->r.reqbody_queue = chunkqueue_init();
+
+    t->host_id = buffer_init_string("test");
+    t->host = gw_host_init();
+    t->host->id = t->host_id;
+    t->host->family = AF_UNIX;
+    t->host->multiplex = multiplex;
+    t->host->idle_timeout = 60;
+
+    t->proc = gw_proc_init();
+    t->host->first = t->proc;
+    t->host->num_procs = 1;
+    gw_proc_set_state(t->host, t->proc, PROC_STATE_RUNNING);
+
+    struct sockaddr_un * const addr = calloc(1, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    snprintf(addr->sun_path, sizeof(addr->sun_path), "%s/sock", test_dir);
+    buffer_copy_string(t->proc->connection_name, addr->sun_path);
+    t->proc->saddr = (struct sockaddr *)addr;
+    t->proc->saddrlen = sizeof(*addr);
+
+    t->lfd = socket(AF_UNIX, SOCK_STREAM, 0);
+    assert(t->lfd >= 0);
+    assert(0 == bind(t->lfd, t->proc->saddr, t->proc->saddrlen));
+    assert(0 == listen(t->lfd, 8));
+}
+
+static void test_gw_free (test_gw * const t) {
+    close(t->lfd);
+    unlink(((struct sockaddr_un *)t->proc->saddr)->sun_path);
+    gw_host_free(t->host);
+    buffer_free(t->host_id);
+    chunkqueue_free(t->r.reqbody_queue);
+    free(t->r.plugin_ctx);
+    log_error_st_free(t->srv.errh);
+}
+
+static gw_handler_ctx * test_gw_hctx (test_gw * const t) {
+    gw_handler_ctx * const hctx = handler_ctx_init(0);
+    hctx->host = t->host;
+    hctx->proc = t->proc;
+    gw_host_assign(t->host);
+    gw_proc_load_inc(t->host, t->proc);
+    hctx->r = &t->r;
+    hctx->plugin_data = &t->p;
+    hctx->mpx_proto = &fcgi_mpx_proto;
+    hctx->opts.parse = test_gw_parse;
+    return hctx;
+}
+
+static void test_gw_hctx_free (test_gw * const t, gw_handler_ctx * const hctx) {
+    gw_backend_close(hctx, &t->r);
+    handler_ctx_free(hctx);
+}
+
+static void test_gw_backend_recv (const int fd, buffer * const b) {
+    char buf[16384];
+    ssize_t rd;
+    while ((rd = recv(fd, buf, sizeof(buf), MSG_DONTWAIT)) > 0)
+        buffer_append_string_len(b, buf, (size_t)rd);
+    assert(rd < 0 && errno == EAGAIN);
+}
+
+static void test_gw_backend_send (const int fd, const int type, const int id, const char * const content, const size_t len) {
+    FCGI_Header header;
+    fcgi_header(&header, (unsigned char)type, id, (int)len, 0);
+    assert(sizeof(header) == write(fd, &header, sizeof(header)));
+    assert((ssize_t)len == write(fd, content, len));
+}
+
+static const char * test_gw_record (const buffer * const b, size_t * const off, int * const type, int * const id, size_t * const len) {
+    /* parse next record (content and padding) at offset in b */
+    const FCGI_Header * const h = (const FCGI_Header *)(b->ptr + *off);
+    assert(*off + sizeof(*h) <= buffer_string_length(b));
+    assert(FCGI_VERSION_1 == h->version);
+    *type = h->type;
+    *id = (h->requestIdB1 << 8) | h->requestIdB0;
+    *len = (h->contentLengthB1 << 8) | h->contentLengthB0;
+    *off += sizeof(*h) + *len + h->paddingLength;
+    assert(*off <= buffer_string_length(b));
+    return (const char *)(h + 1);
+}
+
+static void test_gw_nv (buffer * const b, const char * const k, const char * const v) {
+    const char kv[2] = { (char)strlen(k), (char)strlen(v) };
+    buffer_append_string_len(b, kv, 2);
+    buffer_append_string(b, k);
+    buffer_append_string(b, v);
+}
+
+static void test_gw_get_values_result (const int fd, const char * const max_reqs, const char * const mpxs) {
+    buffer * const b = buffer_init();
+    test_gw_nv(b, FCGI_MAX_CONNS, "1");
+    test_gw_nv(b, FCGI_MAX_REQS, max_reqs);
+    test_gw_nv(b, FCGI_MPXS_CONNS, mpxs);
+    test_gw_backend_send(fd, FCGI_GET_VALUES_RESULT, FCGI_NULL_REQUEST_ID,
+                         CONST_BUF_LEN(b));
+    buffer_free(b);
+}
+
+static int test_gw_mpx_connect (test_gw * const t, gw_handler_ctx * const hctx) {
+    /* attach first request; backend accepts and receives FCGI_GET_VALUES */
+    assert(1 == gw_mpx_attach(hctx, &t->r));
+    gw_mpx * const mpx = hctx->mpx;
+    assert(NULL != mpx && mpx == t->proc->mpx);
+    assert(GW_MPX_PROBE == mpx->state);
+
+    const int fd = accept(t->lfd, NULL, NULL);
+    assert(fd >= 0);
+    buffer * const b = buffer_init();
+    test_gw_backend_recv(fd, b);
+    size_t off = 0, len;
+    int type, id;
+    const char * const s = test_gw_record(b, &off, &type, &id, &len);
+    assert(FCGI_GET_VALUES == type);
+    assert(FCGI_NULL_REQUEST_ID == id);
+    assert(NULL != memmem(s, len, CONST_STR_LEN(FCGI_MAX_REQS)));
+    assert(NULL != memmem(s, len, CONST_STR_LEN(FCGI_MPXS_CONNS)));
+    assert(off == buffer_string_length(b));
+    buffer_free(b);
+    return fd;
+}
+
+static void test_gw_mpx_probe (void) {
+    test_gw t;
+    test_gw_init(&t, 1);
+    gw_handler_ctx *hctx[5];
+
+    /* requests wait on shared connection while backend is probed */
+    hctx[0] = test_gw_hctx(&t);
+    const int fd = test_gw_mpx_connect(&t, hctx[0]);
+    gw_mpx * const mpx = t.proc->mpx;
+    for (int i = 1; i < 5; ++i) {
+        hctx[i] = test_gw_hctx(&t);
+        assert(1 == gw_mpx_attach(hctx[i], &t.r));
+        assert(mpx == hctx[i]->mpx);
+    }
+    for (int i = 0; i < 5; ++i)
+        assert(i+1 == hctx[i]->request_id);
+    assert(5 == mpx->nstreams);
+    assert(GW_MPX_STREAMS_DEFAULT == mpx->max_streams);
+    assert(NULL == mpx->next);
+
+    /* FCGI_GET_VALUES_RESULT enables multiplexing; FCGI_MAX_REQS limits
+     * requests per connection, and requests beyond limit are restarted */
+    test_gw_get_values_result(fd, "4", "1");
+    const int jobs = test_joblist_appended;
+    gw_mpx_handle_fdevent(mpx, FDEVENT_IN);
+    assert(GW_MPX_READY == mpx->state);
+    assert(1 == t.proc->mpx_supported);
+    assert(1 == t.proc->mpx_max_conns);
+    assert(4 == t.proc->mpx_max_reqs);
+    assert(4 == mpx->max_streams);
+    assert(4 == mpx->nstreams);
+    assert(jobs + 5 == test_joblist_appended);
+    for (int i = 0; i < 4; ++i) {
+        assert(mpx == hctx[i]->mpx);
+        assert(0 == hctx[i]->mpx_event);
+    }
+    assert(NULL == hctx[4]->mpx);
+    assert(GW_MPX_EV_RESTART == hctx[4]->mpx_event);
+
+    /* connection full and FCGI_MAX_CONNS reached; use separate connection */
+    assert(0 == gw_mpx_attach(hctx[4], &t.r));
+    assert(mpx == t.proc->mpx && NULL == mpx->next);
+
+    for (int i = 0; i < 5; ++i)
+        test_gw_hctx_free(&t, hctx[i]);
+    assert(0 == mpx->nstreams);
+    assert(0 == t.proc->load);
+    close(fd);
+    test_gw_free(&t);
+}
+
+static void test_gw_mpx_fallback (void) {
+    /* backend which does not multiplex: FCGI_UNKNOWN_TYPE reply,
+     * FCGI_MPXS_CONNS=0, connection closed, or no reply within timeout */
+    for (int i = 0; i < 4; ++i) {
+        test_gw t;
+        test_gw_init(&t, 1);
+        gw_handler_ctx * const hctx = test_gw_hctx(&t);
+        int fd = test_gw_mpx_connect(&t, hctx);
+        gw_mpx * const mpx = hctx->mpx;
+        switch (i) {
+          case 0: {
+            FCGI_UnknownTypeBody body;
+            memset(&body, 0, sizeof(body));
+            body.type = FCGI_GET_VALUES;
+            test_gw_backend_send(fd, FCGI_UNKNOWN_TYPE, FCGI_NULL_REQUEST_ID,
+                                 (const char *)&body, sizeof(body));
+            gw_mpx_handle_fdevent(mpx, FDEVENT_IN);
+            break;
+          }
+          case 1:
+            test_gw_get_values_result(fd, "4", "0");
+            gw_mpx_handle_fdevent(mpx, FDEVENT_IN);
+            break;
+          case 2:
+            close(fd);
+            fd = -1;
+            gw_mpx_handle_fdevent(mpx, FDEVENT_IN | FDEVENT_RDHUP);
+            break;
+          case 3:
+            gw_mpx_trigger(t.host);
+            assert(mpx == t.proc->mpx); /* probe not yet timed out */
+            log_epoch_secs += 2;
+            gw_mpx_trigger(t.host);
+            break;
+        }
+        /*(mpx freed)*/
+        assert(NULL == t.proc->mpx);
+        assert(0 == t.proc->mpx_supported);
+        assert(NULL == hctx->mpx);
+        assert(GW_MPX_EV_RESTART == hctx->mpx_event);
+
+        /* restarted request uses separate connection */
+        assert(0 == gw_mpx_attach(hctx, &t.r));
+        assert(NULL == t.proc->mpx);
+
+        test_gw_hctx_free(&t, hctx);
+        if (-1 != fd) close(fd);
+        test_gw_free(&t);
+    }
+}
+
+static int test_gw_mpx_ready (test_gw * const t, gw_handler_ctx * const hctx, const char * const max_reqs) {
+    const int fd = test_gw_mpx_connect(t, hctx);
+    test_gw_get_values_result(fd, max_reqs, "1");
+    gw_mpx_handle_fdevent(hctx->mpx, FDEVENT_IN);
+    assert(GW_MPX_READY == hctx->mpx->state);
+    return fd;
+}
+
+static void test_gw_mpx_abort (void) {
+    test_gw t;
+    test_gw_init(&t, 1);
+    gw_handler_ctx *hctx[6];
+    hctx[0] = test_gw_hctx(&t);
+    const int fd = test_gw_mpx_ready(&t, hctx[0], "4");
+    gw_mpx * const mpx = hctx[0]->mpx;
+    buffer * const b = buffer_init();
+
+    /* send request id 1 */
+    hctx[0]->state = GW_STATE_WRITE;
+    chunkqueue_append_mem(t.r.reqbody_queue, CONST_STR_LEN("abc"));
+    hctx[0]->wb_reqlen = 3;
+    fcgi_stdin_append(hctx[0]);
+    assert(0 == gw_mpx_stream_write(hctx[0]));
+    assert(chunkqueue_is_empty(hctx[0]->wb));
+    assert(chunkqueue_is_empty(mpx->wb));
+    assert(mpx->wb->bytes_in == hctx[0]->mpx_wb_end);
+
+    for (int i = 1; i < 4; ++i) {
+        hctx[i] = test_gw_hctx(&t);
+        assert(1 == gw_mpx_attach(hctx[i], &t.r));
+        assert(i+1 == hctx[i]->request_id);
+    }
+    hctx[4] = test_gw_hctx(&t);
+    assert(0 == gw_mpx_attach(hctx[4], &t.r)); /* full */
+
+    /* request id 1 reset after request sent: FCGI_ABORT_REQUEST queued and
+     * request id remains in use until FCGI_END_REQUEST from backend */
+    test_gw_hctx_free(&t, hctx[0]);
+    assert(NULL == mpx->streams[1]);
+    assert(mpx->aborting[1]);
+    assert(4 == mpx->nstreams);
+    assert(mpx->fdn->events & FDEVENT_OUT);
+    assert(0 == gw_mpx_attach(hctx[4], &t.r)); /* full */
+
+    /* request id 2 reset before request sent: request id released */
+    test_gw_hctx_free(&t, hctx[1]);
+    assert(NULL == mpx->streams[2]);
+    assert(!mpx->aborting[2]);
+    assert(3 == mpx->nstreams);
+
+    /* request id 1 is skipped while aborting */
+    assert(1 == gw_mpx_attach(hctx[4], &t.r));
+    assert(2 == hctx[4]->request_id);
+    assert(4 == mpx->nstreams);
+
+    /* backend receives request records, then FCGI_ABORT_REQUEST */
+    gw_mpx_handle_fdevent(mpx, FDEVENT_OUT);
+    assert(chunkqueue_is_empty(mpx->wb));
+    assert(!(mpx->fdn->events & FDEVENT_OUT));
+    test_gw_backend_recv(fd, b);
+    size_t off = 0, len;
+    int type, id;
+    test_gw_record(b, &off, &type, &id, &len);
+    assert(FCGI_STDIN == type && 1 == id && 3 == len);
+    test_gw_record(b, &off, &type, &id, &len);
+    assert(FCGI_STDIN == type && 1 == id && 0 == len);
+    test_gw_record(b, &off, &type, &id, &len);
+    assert(FCGI_ABORT_REQUEST == type && 1 == id && 0 == len);
+    assert(off == buffer_string_length(b));
+
+    /* records for aborted request id are discarded; FCGI_END_REQUEST
+     * releases request id */
+    FCGI_EndRequestBody end;
+    memset(&end, 0, sizeof(end));
+    end.protocolStatus = FCGI_REQUEST_COMPLETE;
+    buffer_clear(test_response);
+    test_gw_backend_send(fd, FCGI_STDOUT, 1, CONST_STR_LEN("late"));
+    test_gw_backend_send(fd, FCGI_END_REQUEST, 1,
+                         (const char *)&end, sizeof(end));
+    gw_mpx_handle_fdevent(mpx, FDEVENT_IN);
+    assert(buffer_string_is_empty(test_response));
+    assert(!mpx->aborting[1]);
+    assert(3 == mpx->nstreams);
+
+    /* released request id 1 is reused */
+    hctx[5] = test_gw_hctx(&t);
+    assert(1 == gw_mpx_attach(hctx[5], &t.r));
+    assert(1 == hctx[5]->request_id);
+    assert(4 == mpx->nstreams);
+
+    /* records are passed to request with matching request id */
+    test_gw_backend_send(fd, FCGI_STDOUT, 3, CONST_STR_LEN("hello"));
+    gw_mpx_handle_fdevent(mpx, FDEVENT_IN);
+    assert(sizeof(FCGI_Header) + 5 == buffer_string_length(test_response));
+    assert(0 == memcmp(test_response->ptr + sizeof(FCGI_Header), "hello", 5));
+
+    /* FCGI_END_REQUEST finishes request and releases request id */
+    buffer_clear(test_response);
+    test_gw_backend_send(fd, FCGI_END_REQUEST, 3,
+                         (const char *)&end, sizeof(end));
+    gw_mpx_handle_fdevent(mpx, FDEVENT_IN);
+    assert(2*sizeof(FCGI_Header) == buffer_string_length(test_response));
+    assert(NULL == mpx->streams[3]);
+    assert(3 == mpx->nstreams);
+    /*(hctx[2] freed by gw_connection_close())*/
+
+    test_gw_hctx_free(&t, hctx[3]);
+    test_gw_hctx_free(&t, hctx[4]);
+    test_gw_hctx_free(&t, hctx[5]);
+    assert(0 == mpx->nstreams);
+    assert(0 == t.proc->load);
+
+    /* idle shared connection closed after idle timeout */
+    gw_mpx_trigger(t.host);
+    assert(mpx == t.proc->mpx);
+    log_epoch_secs += t.host->idle_timeout + 1;
+    gw_mpx_trigger(t.host);
+    assert(NULL == t.proc->mpx);
+
+    buffer_free(b);
+    close(fd);
+    test_gw_free(&t);
+}
+
+static void test_gw_mpx_reqbody (void) {
+    test_gw t;
+    test_gw_init(&t, 1);
+    gw_handler_ctx * const hctx = test_gw_hctx(&t);
+    const int fd = test_gw_mpx_ready(&t, hctx, "4");
+    gw_mpx * const mpx = hctx->mpx;
+    buffer * const b = buffer_init();
+    buffer * const body = buffer_init();
+    for (int i = 0; i < 100000; ++i)
+        { const char c = (char)('a' + i % 26); buffer_append_string_len(body, &c, 1); }
+
+    /* request body is split into FCGI_STDIN records of at most 64k - 1 */
+    hctx->state = GW_STATE_WRITE;
+    hctx->wb_reqlen = 100000;
+    chunkqueue_append_mem(t.r.reqbody_queue, body->ptr, 70000);
+    fcgi_stdin_append(hctx);
+    assert(70000 + 2*sizeof(FCGI_Header) == hctx->wb->bytes_in);
+
+    /* records move to shared connection; partially written */
+    test_write_max = 16384;
+    const off_t bytes_in = mpx->wb->bytes_in;
+    assert(0 == gw_mpx_stream_write(hctx));
+    assert(chunkqueue_is_empty(hctx->wb));
+    assert(bytes_in + hctx->wb->bytes_in == hctx->mpx_wb_end);
+    assert(mpx->wb->bytes_in == hctx->mpx_wb_end);
+    assert(bytes_in + 16384 == mpx->wb->bytes_out);
+
+    /* more request body is left in hctx->wb until prior records are sent */
+    chunkqueue_append_mem(t.r.reqbody_queue, body->ptr+70000, 30000);
+    fcgi_stdin_append(hctx);
+    const off_t wb_len = hctx->wb->bytes_in - hctx->wb->bytes_out;
+    assert(30000 + 2*sizeof(FCGI_Header) == wb_len);
+    assert(0 == gw_mpx_stream_write(hctx));
+    assert(wb_len == hctx->wb->bytes_in - hctx->wb->bytes_out);
+    assert(mpx->wb->bytes_in == hctx->mpx_wb_end);
+
+    /* request is resumed once prior records are sent */
+    int jobs = test_joblist_appended;
+    do {
+        assert(jobs == test_joblist_appended);
+        gw_mpx_handle_fdevent(mpx, FDEVENT_OUT);
+        test_gw_backend_recv(fd, b);
+    } while (!chunkqueue_is_empty(mpx->wb));
+    assert(jobs + 1 == test_joblist_appended);
+    assert(0 == gw_mpx_stream_write(hctx));
+    assert(chunkqueue_is_empty(hctx->wb));
+    do {
+        gw_mpx_handle_fdevent(mpx, FDEVENT_OUT);
+        test_gw_backend_recv(fd, b);
+    } while (!chunkqueue_is_empty(mpx->wb));
+    test_write_max = 0;
+
+    /* backend receives complete request body in order */
+    static const size_t lens[] = { 65535, 4465, 30000, 0 };
+    buffer * const content = buffer_init();
+    size_t off = 0;
+    for (size_t i = 0; i < sizeof(lens)/sizeof(*lens); ++i) {
+        size_t len;
+        int type, id;
+        const char * const s = test_gw_record(b, &off, &type, &id, &len);
+        assert(FCGI_STDIN == type && hctx->request_id == id);
+        assert(lens[i] == len);
+        buffer_append_string_len(content, s, len);
+    }
+    assert(off == buffer_string_length(b));
+    assert(buffer_is_equal(content, body));
+
+    buffer_free(content);
+    buffer_free(body);
+    buffer_free(b);
+    test_gw_hctx_free(&t, hctx);
+    close(fd);
+    test_gw_free(&t);
+}
+
+static void test_gw_h2c_init (test_gw * const t) {
+    test_gw_init(t, 1);
+    t->con.dst_addr_buf = buffer_init_string("127.0.0.1");
+    t->r.tmp_buf = buffer_init();
+    t->r.write_queue = chunkqueue_init();
+    t->r.http_method = HTTP_METHOD_GET;
+    buffer_copy_string(&t->r.target, "/x");
+}
+
+static void test_gw_h2c_free (test_gw * const t) {
+    array_free_data(&t->r.rqst_headers);
+    free(t->r.target.ptr);
+    chunkqueue_free(t->r.write_queue);
+    buffer_free(t->r.tmp_buf);
+    buffer_free(t->con.dst_addr_buf);
+    test_gw_free(t);
+}
+
+static proxy_handler_ctx * test_gw_h2c_hctx (test_gw * const t) {
+    proxy_handler_ctx * const hctx =
+      (proxy_handler_ctx *)handler_ctx_init(sizeof(proxy_handler_ctx));
+    hctx->gw.host = t->host;
+    hctx->gw.proc = t->proc;
+    gw_host_assign(t->host);
+    gw_proc_load_inc(t->host, t->proc);
+    hctx->gw.r = &t->r;
+    hctx->gw.plugin_data = &t->p;
+    hctx->gw.mpx_proto = &proxy_h2c_proto;
+    return hctx;
+}
+
+static void test_gw_h2c_request (proxy_handler_ctx * const hctx) {
+    /* frame request into hctx->gw.wb and move frames to shared connection */
+    assert(HANDLER_GO_ON == proxy_create_env_h2c(hctx));
+    hctx->gw.opts.parse = test_gw_parse;
+    hctx->gw.state = GW_STATE_WRITE;
+    assert(0 == gw_mpx_stream_write(&hctx->gw));
+}
+
+static void test_gw_h2c_send (const int fd, const int type, const int flags, const uint32_t id, const void * const payload, const uint32_t len) {
+    unsigned char f[9];
+    proxy_h2c_frame_hdr(f, len, type, flags, id);
+    assert(sizeof(f) == write(fd, f, sizeof(f)));
+    if (len) assert((ssize_t)len == write(fd, payload, len));
+}
+
+static void test_gw_h2c_send_u32 (const int fd, const int type, const uint32_t id, const uint32_t v) {
+    /* RST_STREAM or WINDOW_UPDATE */
+    const unsigned char p[4] = {
+      (v >> 24) & 0xff, (v >> 16) & 0xff, (v >> 8) & 0xff, v & 0xff
+    };
+    test_gw_h2c_send(fd, type, 0, id, p, sizeof(p));
+}
+
+static void test_gw_h2c_setting (buffer * const b, const int id, const uint32_t v) {
+    const char s[6] = {
+      0, (char)id,
+      (char)((v >> 24) & 0xff), (char)((v >> 16) & 0xff),
+      (char)((v >>  8) & 0xff), (char)( v        & 0xff)
+    };
+    buffer_append_string_len(b, s, sizeof(s));
+}
+
+static void test_gw_h2c_status (const int fd, hpack_table * const enc, const uint32_t id, const int flags, const char * const status) {
+    /* HEADERS frame with complete header block for response status */
+    buffer * const hb = buffer_init();
+    hpack_encode_field(enc, hb, CONST_STR_LEN(":status"), status, 3,
+                       HPACK_FIELD_INDEX);
+    test_gw_h2c_send(fd, H2_FTYPE_HEADERS, H2_FLAG_END_HEADERS | flags, id,
+                     CONST_BUF_LEN(hb));
+    buffer_free(hb);
+}
+
+static const unsigned char * test_gw_h2c_frame (const buffer * const b, size_t * const off, int * const type, int * const flags, uint32_t * const id, uint32_t * const len) {
+    /* parse next frame at offset in b */
+    const unsigned char * const s = (const unsigned char *)b->ptr + *off;
+    assert(*off + 9 <= buffer_string_length(b));
+    *len = ((uint32_t)s[0] << 16) | ((uint32_t)s[1] << 8) | s[2];
+    *type = s[3];
+    *flags = s[4];
+    *id = proxy_h2c_u32(s+5) & 0x7fffffff;
+    *off += 9 + *len;
+    assert(*off <= buffer_string_length(b));
+    return s + 9;
+}
+
+static void test_gw_h2c_field (void *ctx, const char *k, uint32_t klen, const char *v, uint32_t vlen) {
+    buffer * const b = ctx;
+    buffer_append_string_len(b, k, klen);
+    buffer_append_string_len(b, CONST_STR_LEN(": "));
+    buffer_append_string_len(b, v, vlen);
+    buffer_append_string_len(b, CONST_STR_LEN("\n"));
+}
+
+static int test_gw_h2c_connect (test_gw * const t, proxy_handler_ctx * const hctx) {
+    /* attach first request; backend accepts and receives connection preface,
+     * SETTINGS, and WINDOW_UPDATE for connection receive window */
+    assert(1 == gw_mpx_attach(&hctx->gw, &t->r));
+    gw_mpx * const mpx = hctx->gw.mpx;
+    assert(NULL != mpx && mpx == t->proc->mpx);
+    assert(GW_MPX_PROBE == mpx->state);
+
+    const int fd = accept(t->lfd, NULL, NULL);
+    assert(fd >= 0);
+    buffer * const b = buffer_init();
+    test_gw_backend_recv(fd, b);
+    static const char preface[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+    assert(0 == memcmp(b->ptr, preface, sizeof(preface)-1));
+    size_t off = sizeof(preface)-1;
+    int type, flags;
+    uint32_t id, len;
+    const unsigned char *s =
+      test_gw_h2c_frame(b, &off, &type, &flags, &id, &len);
+    assert(H2_FTYPE_SETTINGS == type && 0 == flags && 0 == id && 6 == len);
+    assert(0 == s[0] && 2 == s[1] && 0 == proxy_h2c_u32(s+2)); /*ENABLE_PUSH*/
+    s = test_gw_h2c_frame(b, &off, &type, &flags, &id, &len);
+    assert(H2_FTYPE_WINDOW_UPDATE == type && 0 == id && 4 == len);
+    assert(H2C_CONN_WINDOW - H2_WINDOW_SIZE == proxy_h2c_u32(s));
+    assert(off == buffer_string_length(b));
+    buffer_free(b);
+    return fd;
+}
+
+static int test_gw_h2c_ready (test_gw * const t, proxy_handler_ctx * const hctx, const uint32_t max_streams) {
+    const int fd = test_gw_h2c_connect(t, hctx);
+    gw_mpx * const mpx = hctx->gw.mpx;
+    buffer * const b = buffer_init();
+    test_gw_h2c_setting(b, H2_SETTINGS_MAX_CONCURRENT_STREAMS, max_streams);
+    test_gw_h2c_send(fd, H2_FTYPE_SETTINGS, 0, 0, CONST_BUF_LEN(b));
+    gw_mpx_handle_fdevent(mpx, FDEVENT_IN);
+    assert(GW_MPX_READY == mpx->state);
+
+    /* SETTINGS acknowledged */
+    gw_mpx_handle_fdevent(mpx, FDEVENT_OUT);
+    buffer_clear(b);
+    test_gw_backend_recv(fd, b);
+    size_t off = 0;
+    int type, flags;
+    uint32_t id, len;
+    test_gw_h2c_frame(b, &off, &type, &flags, &id, &len);
+    assert(H2_FTYPE_SETTINGS == type && H2_FLAG_ACK == flags && 0 == len);
+    assert(off == buffer_string_length(b));
+    buffer_free(b);
+    return fd;
+}
+
+static void test_gw_h2c_probe (void) {
+    test_gw t;
+    test_gw_h2c_init(&t);
+    proxy_handler_ctx *hctx[3];
+    buffer * const b = buffer_init();
+
+    /* requests wait on shared connection until server SETTINGS */
+    hctx[0] = test_gw_h2c_hctx(&t);
+    const int fd = test_gw_h2c_connect(&t, hctx[0]);
+    gw_mpx * const mpx = t.proc->mpx;
+    proxy_h2c * const h2 = mpx->pctx;
+    for (int i = 1; i < 3; ++i) {
+        hctx[i] = test_gw_h2c_hctx(&t);
+        assert(1 == gw_mpx_attach(&hctx[i]->gw, &t.r));
+        assert(mpx == hctx[i]->gw.mpx);
+    }
+
+    /* SETTINGS enables multiplexing; SETTINGS_MAX_CONCURRENT_STREAMS limits
+     * requests per connection, and requests beyond limit are restarted */
+    test_gw_h2c_setting(b, H2_SETTINGS_MAX_CONCURRENT_STREAMS, 2);
+    test_gw_h2c_setting(b, H2_SETTINGS_INITIAL_WINDOW_SIZE, 1000);
+    test_gw_h2c_send(fd, H2_FTYPE_SETTINGS, 0, 0, CONST_BUF_LEN(b));
+    gw_mpx_handle_fdevent(mpx, FDEVENT_IN);
+    assert(GW_MPX_READY == mpx->state);
+    assert(1 == t.proc->mpx_supported);
+    assert(2 == t.proc->mpx_max_reqs);
+    assert(2 == mpx->max_streams);
+    assert(2 == mpx->nstreams);
+    assert(1000 == h2->init_swin);
+    assert(NULL == hctx[2]->gw.mpx);
+    assert(GW_MPX_EV_RESTART == hctx[2]->gw.mpx_event);
+
+    /* SETTINGS acknowledged */
+    gw_mpx_handle_fdevent(mpx, FDEVENT_OUT);
+    buffer_clear(b);
+    test_gw_backend_recv(fd, b);
+    size_t off = 0;
+    int type, flags;
+    uint32_t id, len;
+    test_gw_h2c_frame(b, &off, &type, &flags, &id, &len);
+    assert(H2_FTYPE_SETTINGS == type && H2_FLAG_ACK == flags && 0 == len);
+    assert(off == buffer_string_length(b));
+
+    /* later SETTINGS_MAX_CONCURRENT_STREAMS changes limit;
+     * SETTINGS ACK from backend is accepted */
+    buffer_clear(b);
+    test_gw_h2c_setting(b, H2_SETTINGS_MAX_CONCURRENT_STREAMS, 3);
+    test_gw_h2c_send(fd, H2_FTYPE_SETTINGS, 0, 0, CONST_BUF_LEN(b));
+    test_gw_h2c_send(fd, H2_FTYPE_SETTINGS, H2_FLAG_ACK, 0, NULL, 0);
+    gw_mpx_handle_fdevent(mpx, FDEVENT_IN);
+    assert(mpx == t.proc->mpx);
+    assert(3 == t.proc->mpx_max_reqs);
+    assert(3 == mpx->max_streams);
+    assert(1 == gw_mpx_attach(&hctx[2]->gw, &t.r));
+    assert(3 == mpx->nstreams);
+
+    /* SETTINGS_INITIAL_WINDOW_SIZE adjusts send window of open streams */
+    test_gw_h2c_request(hctx[0]);
+    proxy_h2c_stream * const st = h2->streams + hctx[0]->gw.request_id;
+    assert(1 == st->id && 1000 == st->swin);
+    buffer_clear(b);
+    test_gw_h2c_setting(b, H2_SETTINGS_INITIAL_WINDOW_SIZE, 1500);
+    test_gw_h2c_send(fd, H2_FTYPE_SETTINGS, 0, 0, CONST_BUF_LEN(b));
+    gw_mpx_handle_fdevent(mpx, FDEVENT_IN);
+    assert(1500 == st->swin);
+
+    /* stream send window exceeding 2^31-1 is a connection error */
+    st->swin = 0x7fffffff - 100;
+    buffer_clear(b);
+    test_gw_h2c_setting(b, H2_SETTINGS_INITIAL_WINDOW_SIZE, 1601);
+    test_gw_h2c_send(fd, H2_FTYPE_SETTINGS, 0, 0, CONST_BUF_LEN(b));
+    gw_mpx_handle_fdevent(mpx, FDEVENT_IN);
+    /*(mpx freed)*/
+    assert(NULL == t.proc->mpx);
+    for (int i = 0; i < 3; ++i) {
+        assert(NULL == hctx[i]->gw.mpx);
+        assert(GW_MPX_EV_ERROR == hctx[i]->gw.mpx_event);
+        test_gw_hctx_free(&t, &hctx[i]->gw);
+    }
+    assert(0 == t.proc->load);
+
+    buffer_free(b);
+    close(fd);
+    test_gw_h2c_free(&t);
+}
+
+static void test_gw_h2c_fallback (void) {
+    /* HTTP/1.1 backend: HTTP/1.1 response to connection preface, first frame
+     * other than SETTINGS, or connection closed */
+    for (int i = 0; i < 3; ++i) {
+        test_gw t;
+        test_gw_h2c_init(&t);
+        proxy_handler_ctx * const hctx = test_gw_h2c_hctx(&t);
+        int fd = test_gw_h2c_connect(&t, hctx);
+        gw_mpx * const mpx = hctx->gw.mpx;
+        switch (i) {
+          case 0: {
+            static const char resp[] =
+              "HTTP/1.1 400 Bad Request\r\nConnection: close\r\n\r\n";
+            assert(sizeof(resp)-1 == write(fd, resp, sizeof(resp)-1));
+            gw_mpx_handle_fdevent(mpx, FDEVENT_IN);
+            break;
+          }
+          case 1: {
+            static const unsigned char opaque[8];
+            test_gw_h2c_send(fd, H2_FTYPE_PING, 0, 0, opaque, sizeof(opaque));
+            gw_mpx_handle_fdevent(mpx, FDEVENT_IN);
+            break;
+          }
+          case 2:
+            close(fd);
+            fd = -1;
+            gw_mpx_handle_fdevent(mpx, FDEVENT_IN | FDEVENT_RDHUP);
+            break;
+        }
+        /*(mpx freed)*/
+        assert(NULL == t.proc->mpx);
+        assert(0 == t.proc->mpx_supported);
+        assert(NULL == hctx->gw.mpx);
+        assert(GW_MPX_EV_RESTART == hctx->gw.mpx_event);
+
+        /* restarted request is sent as HTTP/1.1 on separate connection */
+        assert(0 == gw_mpx_attach(&hctx->gw, &t.r));
+        assert(NULL == t.proc->mpx);
+
+        test_gw_hctx_free(&t, &hctx->gw);
+        if (-1 != fd) close(fd);
+        test_gw_h2c_free(&t);
+    }
+}
+
+static void test_gw_h2c_headers (void) {
+    test_gw t;
+    test_gw_h2c_init(&t);
+    proxy_handler_ctx *hctx = test_gw_h2c_hctx(&t);
+    const int fd = test_gw_h2c_ready(&t, hctx, 4);
+    gw_mpx * const mpx = hctx->gw.mpx;
+    buffer * const b = buffer_init();
+    buffer * const hb = buffer_init();
+    buffer * const v = buffer_init();
+    hpack_table dec, enc;
+    hpack_table_init(&dec, HPACK_TABLE_SIZE_DEFAULT);
+    hpack_table_init(&enc, HPACK_TABLE_SIZE_DEFAULT);
+
+    /* large request header block is split into HEADERS and CONTINUATION
+     * frames; request without body ends stream with HEADERS;
+     * connection-specific header fields are omitted */
+    for (int i = 0; i < 40000; ++i) {
+        const char c = (char)('a' + i % 26);
+        buffer_append_string_len(v, &c, 1);
+    }
+    http_header_request_set(&t.r, HTTP_HEADER_OTHER, CONST_STR_LEN("X-Large"),
+                            CONST_BUF_LEN(v));
+    http_header_request_set(&t.r, HTTP_HEADER_CONNECTION,
+                            CONST_STR_LEN("Connection"),
+                            CONST_STR_LEN("keep-alive"));
+    test_gw_h2c_request(hctx);
+    assert(chunkqueue_is_empty(hctx->gw.wb));
+    test_gw_backend_recv(fd, b);
+    size_t off = 0;
+    int type, flags, n = 0;
+    uint32_t id, len;
+    do {
+        const unsigned char * const s =
+          test_gw_h2c_frame(b, &off, &type, &flags, &id, &len);
+        assert((n ? H2_FTYPE_CONTINUATION : H2_FTYPE_HEADERS) == type);
+        assert(1 == id);
+        assert((n ? 0 : H2_FLAG_END_STREAM) == (flags & H2_FLAG_END_STREAM));
+        assert((flags & H2_FLAG_END_HEADERS) || H2_FRAME_SIZE == len);
+        buffer_append_string_len(hb, (const char *)s, len);
+        ++n;
+    } while (!(flags & H2_FLAG_END_HEADERS));
+    assert(n > 1);
+    assert(off == buffer_string_length(b));
+    buffer * const fields = buffer_init();
+    assert(0 == hpack_decode(&dec, (unsigned char *)hb->ptr,
+                             buffer_string_length(hb), b,
+                             test_gw_h2c_field, fields));
+    assert(0 == strncmp(fields->ptr, ":method: GET\n:scheme: http\n"
+                                     ":path: /x\n", 30));
+    assert(NULL != strstr(fields->ptr, "\nx-forwarded-for: 127.0.0.1\n"));
+    assert(NULL != strstr(fields->ptr, "\nx-large: abcdefghijklmnopqrstuvwxyz"));
+    assert(NULL != strstr(fields->ptr, v->ptr));
+    assert(NULL == strstr(fields->ptr, "\nconnection:"));
+    buffer_free(fields);
+
+    /* response header block in HEADERS and CONTINUATION is passed on as
+     * HTTP/1.1 response header (omitting connection-specific fields) */
+    buffer_clear(hb);
+    hpack_encode_field(&enc, hb, CONST_STR_LEN(":status"), CONST_STR_LEN("200"),
+                       HPACK_FIELD_INDEX);
+    hpack_encode_field(&enc, hb, CONST_STR_LEN("content-type"),
+                       CONST_STR_LEN("text/plain"), HPACK_FIELD_INDEX);
+    hpack_encode_field(&enc, hb, CONST_STR_LEN("connection"),
+                       CONST_STR_LEN("close"), HPACK_FIELD_INDEX);
+    test_gw_h2c_send(fd, H2_FTYPE_HEADERS, 0, 1, hb->ptr, 1);
+    test_gw_h2c_send(fd, H2_FTYPE_CONTINUATION, H2_FLAG_END_HEADERS, 1,
+                     hb->ptr+1, buffer_string_length(hb)-1);
+    buffer_clear(test_response);
+    gw_mpx_handle_fdevent(mpx, FDEVENT_IN);
+    assert(buffer_eq_slen(test_response, CONST_STR_LEN(
+      "HTTP/1.1 200\r\ncontent-type: text/plain\r\n\r\n")));
+
+    /* DATA with END_STREAM ends response and releases request id */
+    buffer_clear(test_response);
+    test_gw_h2c_send(fd, H2_FTYPE_DATA, H2_FLAG_END_STREAM, 1, "hello", 5);
+    gw_mpx_handle_fdevent(mpx, FDEVENT_IN);
+    assert(buffer_eq_slen(test_response, CONST_STR_LEN("hello")));
+    assert(0 == mpx->nstreams);
+    assert(chunkqueue_is_empty(mpx->wb)); /*(no RST_STREAM)*/
+    /*(hctx freed by gw_connection_close())*/
+
+    /* next request uses next stream id; header block interrupted by another
+     * frame is a connection error */
+    hctx = test_gw_h2c_hctx(&t);
+    assert(1 == gw_mpx_attach(&hctx->gw, &t.r));
+    test_gw_h2c_request(hctx);
+    buffer_clear(b);
+    test_gw_backend_recv(fd, b);
+    off = 0;
+    test_gw_h2c_frame(b, &off, &type, &flags, &id, &len);
+    assert(H2_FTYPE_HEADERS == type && 3 == id);
+    buffer_clear(hb);
+    hpack_encode_field(&enc, hb, CONST_STR_LEN(":status"), CONST_STR_LEN("200"),
+                       HPACK_FIELD_INDEX);
+    test_gw_h2c_send(fd, H2_FTYPE_HEADERS, 0, 3, CONST_BUF_LEN(hb));
+    test_gw_h2c_send(fd, H2_FTYPE_DATA, 0, 3, "x", 1);
+    gw_mpx_handle_fdevent(mpx, FDEVENT_IN);
+    /*(mpx freed)*/
+    assert(NULL == t.proc->mpx);
+    assert(NULL == hctx->gw.mpx);
+    assert(GW_MPX_EV_ERROR == hctx->gw.mpx_event);
+    test_gw_hctx_free(&t, &hctx->gw);
+    assert(0 == t.proc->load);
+
+    hpack_table_free(&enc);
+    hpack_table_free(&dec);
+    buffer_free(v);
+    buffer_free(hb);
+    buffer_free(b);
+    close(fd);
+    test_gw_h2c_free(&t);
+}
+
+static void test_gw_h2c_flow (void) {
+    test_gw t;
+    test_gw_h2c_init(&t);
+    proxy_handler_ctx * const hctx = test_gw_h2c_hctx(&t);
+    const int fd = test_gw_h2c_ready(&t, hctx, 4);
+    gw_mpx * const mpx = hctx->gw.mpx;
+    proxy_h2c * const h2 = mpx->pctx;
+    proxy_h2c_stream * const st = h2->streams + hctx->gw.request_id;
+    buffer * const b = buffer_init();
+    buffer * const body = buffer_init();
+    buffer * const content = buffer_init();
+    hpack_table enc;
+    hpack_table_init(&enc, HPACK_TABLE_SIZE_DEFAULT);
+    for (int i = 0; i < 100000; ++i) {
+        const char c = (char)('a' + i % 26);
+        buffer_append_string_len(body, &c, 1);
+    }
+
+    /* request body is sent in DATA frames up to stream and connection send
+     * windows (65535 initially); remainder waits in hctx->gw.wb */
+    t.r.http_method = HTTP_METHOD_POST;
+    t.r.reqbody_length = 100000;
+    chunkqueue_append_mem(t.r.reqbody_queue, CONST_BUF_LEN(body));
+    test_gw_h2c_request(hctx);
+    assert(0 == st->swin && 0 == h2->swin);
+    assert(100000 - 65535 + 9 == chunkqueue_length(hctx->gw.wb));
+    test_gw_backend_recv(fd, b);
+    static const uint32_t lens[] = { 16384, 16384, 16384, 16383,
+                                     16384, 16384, 1697, 0 };
+    size_t off = 0;
+    int type, flags;
+    uint32_t id, len;
+    test_gw_h2c_frame(b, &off, &type, &flags, &id, &len);
+    assert(H2_FTYPE_HEADERS == type && H2_FLAG_END_HEADERS == flags);
+    for (int i = 0; i < 4; ++i) {
+        const unsigned char * const s =
+          test_gw_h2c_frame(b, &off, &type, &flags, &id, &len);
+        assert(H2_FTYPE_DATA == type && 0 == flags && 1 == id);
+        assert(lens[i] == len);
+        buffer_append_string_len(content, (const char *)s, len);
+    }
+    assert(off == buffer_string_length(b));
+
+    /* stream WINDOW_UPDATE resumes request, which then waits for
+     * connection send window */
+    int jobs = test_joblist_appended;
+    test_gw_h2c_send_u32(fd, H2_FTYPE_WINDOW_UPDATE, 1, 40000);
+    gw_mpx_handle_fdevent(mpx, FDEVENT_IN);
+    assert(40000 == st->swin);
+    assert(jobs + 1 == test_joblist_appended);
+    const off_t bytes_in = mpx->wb->bytes_in;
+    assert(0 == gw_mpx_stream_write(&hctx->gw));
+    assert(bytes_in == mpx->wb->bytes_in);
+
+    /* connection WINDOW_UPDATE resumes waiting requests */
+    test_gw_h2c_send_u32(fd, H2_FTYPE_WINDOW_UPDATE, 0, 100000);
+    gw_mpx_handle_fdevent(mpx, FDEVENT_IN);
+    assert(100000 == h2->swin);
+    assert(jobs + 2 == test_joblist_appended);
+    assert(0 == gw_mpx_stream_write(&hctx->gw));
+    assert(chunkqueue_is_empty(hctx->gw.wb));
+    assert(40000 - 34465 == st->swin);
+    assert(100000 - 34465 == h2->swin);
+    buffer_clear(b);
+    test_gw_backend_recv(fd, b);
+    off = 0;
+    for (int i = 4; i < 8; ++i) {
+        const unsigned char * const s =
+          test_gw_h2c_frame(b, &off, &type, &flags, &id, &len);
+        assert(H2_FTYPE_DATA == type && 1 == id && lens[i] == len);
+        assert((7 == i ? H2_FLAG_END_STREAM : 0) == flags);
+        buffer_append_string_len(content, (const char *)s, len);
+    }
+    assert(off == buffer_string_length(b));
+    assert(buffer_is_equal(content, body));
+
+    /* receive windows are replenished with WINDOW_UPDATE once below half */
+    h2->rwin = H2C_CONN_WINDOW/2 + 20000;
+    test_gw_h2c_status(fd, &enc, 1, 0, "200");
+    buffer_clear(content);
+    buffer_append_string_len(content, body->ptr, 16384);
+    test_gw_h2c_send(fd, H2_FTYPE_DATA, 0, 1, CONST_BUF_LEN(content));
+    test_gw_h2c_send(fd, H2_FTYPE_DATA, 0, 1, CONST_BUF_LEN(content));
+    test_gw_h2c_send(fd, H2_FTYPE_DATA, 0, 1, content->ptr, 7232);
+    buffer_clear(test_response);
+    gw_mpx_handle_fdevent(mpx, FDEVENT_IN);
+    assert(sizeof("HTTP/1.1 200\r\n\r\n")-1 + 40000
+           == buffer_string_length(test_response));
+    assert(H2C_CONN_WINDOW - 7232 == h2->rwin);
+    assert(H2_WINDOW_SIZE - 7232 == st->rwin);
+    gw_mpx_handle_fdevent(mpx, FDEVENT_OUT);
+    buffer_clear(b);
+    test_gw_backend_recv(fd, b);
+    off = 0;
+    const unsigned char *s =
+      test_gw_h2c_frame(b, &off, &type, &flags, &id, &len);
+    assert(H2_FTYPE_WINDOW_UPDATE == type && 0 == id);
+    assert(H2C_CONN_WINDOW/2 + 12768 == proxy_h2c_u32(s));
+    s = test_gw_h2c_frame(b, &off, &type, &flags, &id, &len);
+    assert(H2_FTYPE_WINDOW_UPDATE == type && 1 == id);
+    assert(32768 == proxy_h2c_u32(s));
+    assert(off == buffer_string_length(b));
+
+    /* stream receive window is not replenished while response is backlogged
+     * (slow client); replenished when request resumes */
+    t.r.conf.stream_response_body |= FDEVENT_STREAM_RESPONSE_BUFMIN;
+    chunkqueue_append_mem(t.r.write_queue, body->ptr, 65536);
+    for (int i = 0; i < 3; ++i)
+        test_gw_h2c_send(fd, H2_FTYPE_DATA, 0, 1, CONST_BUF_LEN(content));
+    gw_mpx_handle_fdevent(mpx, FDEVENT_IN);
+    assert(H2_WINDOW_SIZE - 7232 - 3*16384 == st->rwin);
+    assert(chunkqueue_is_empty(mpx->wb));
+    chunkqueue_reset(t.r.write_queue);
+    proxy_h2c_resume(mpx, &hctx->gw);
+    assert(H2_WINDOW_SIZE == st->rwin);
+    gw_mpx_handle_fdevent(mpx, FDEVENT_OUT);
+    buffer_clear(b);
+    test_gw_backend_recv(fd, b);
+    off = 0;
+    s = test_gw_h2c_frame(b, &off, &type, &flags, &id, &len);
+    assert(H2_FTYPE_WINDOW_UPDATE == type && 1 == id);
+    assert(7232 + 3*16384 == proxy_h2c_u32(s));
+    assert(off == buffer_string_length(b));
+
+    /* DATA exceeding stream receive window resets stream */
+    chunkqueue_append_mem(t.r.write_queue, body->ptr, 65536);
+    for (int i = 0; i < 4; ++i)
+        test_gw_h2c_send(fd, H2_FTYPE_DATA, 0, 1, CONST_BUF_LEN(content));
+    gw_mpx_handle_fdevent(mpx, FDEVENT_IN);
+    assert(NULL == hctx->gw.mpx);
+    assert(GW_MPX_EV_ERROR == hctx->gw.mpx_event);
+    assert(0 == mpx->nstreams);
+    gw_mpx_handle_fdevent(mpx, FDEVENT_OUT);
+    buffer_clear(b);
+    test_gw_backend_recv(fd, b);
+    off = 0;
+    s = test_gw_h2c_frame(b, &off, &type, &flags, &id, &len);
+    assert(H2_FTYPE_RST_STREAM == type && 1 == id);
+    assert(H2_E_FLOW_CONTROL_ERROR == proxy_h2c_u32(s));
+    assert(off == buffer_string_length(b));
+    chunkqueue_reset(t.r.write_queue);
+    t.r.conf.stream_response_body = 0;
+    t.r.http_method = HTTP_METHOD_GET;
+    t.r.reqbody_length = 0;
+
+    test_gw_hctx_free(&t, &hctx->gw);
+    hpack_table_free(&enc);
+    buffer_free(content);
+    buffer_free(body);
+    buffer_free(b);
+    close(fd);
+    test_gw_h2c_free(&t);
+}
+
+static void test_gw_h2c_retry (void) {
+    test_gw t;
+    test_gw_h2c_init(&t);
+    proxy_handler_ctx *hctx[4];
+    hctx[0] = test_gw_h2c_hctx(&t);
+    const int fd = test_gw_h2c_ready(&t, hctx[0], 8);
+    gw_mpx * const mpx = hctx[0]->gw.mpx;
+    buffer * const b = buffer_init();
+    hpack_table enc;
+    hpack_table_init(&enc, HPACK_TABLE_SIZE_DEFAULT);
+    for (int i = 1; i < 4; ++i) {
+        hctx[i] = test_gw_h2c_hctx(&t);
+        assert(1 == gw_mpx_attach(&hctx[i]->gw, &t.r));
+    }
+    for (int i = 0; i < 4; ++i)
+        test_gw_h2c_request(hctx[i]); /* stream ids 1, 3, 5, 7 */
+    test_gw_backend_recv(fd, b);
+
+    /* RST_STREAM REFUSED_STREAM before response: request is retried;
+     * RST_STREAM with other error: request fails */
+    test_gw_h2c_send_u32(fd, H2_FTYPE_RST_STREAM, 1, H2_E_REFUSED_STREAM);
+    test_gw_h2c_send_u32(fd, H2_FTYPE_RST_STREAM, 3, H2_E_PROTOCOL_ERROR);
+    gw_mpx_handle_fdevent(mpx, FDEVENT_IN);
+    assert(NULL == hctx[0]->gw.mpx);
+    assert(GW_MPX_EV_RESTART == hctx[0]->gw.mpx_event);
+    assert(chunkqueue_is_empty(hctx[0]->gw.wb));
+    assert(NULL == hctx[1]->gw.mpx);
+    assert(GW_MPX_EV_ERROR == hctx[1]->gw.mpx_event);
+    assert(2 == mpx->nstreams);
+
+    /* GOAWAY: streams above last stream id are retried, and connection
+     * is drained (no new streams) */
+    static const unsigned char goaway[8] = { 0, 0, 0, 5, 0, 0, 0, 0 };
+    test_gw_h2c_send(fd, H2_FTYPE_GOAWAY, 0, 0, goaway, sizeof(goaway));
+    gw_mpx_handle_fdevent(mpx, FDEVENT_IN);
+    assert(GW_MPX_DRAIN == mpx->state);
+    assert(mpx == hctx[2]->gw.mpx);
+    assert(NULL == hctx[3]->gw.mpx);
+    assert(GW_MPX_EV_RESTART == hctx[3]->gw.mpx_event);
+    assert(1 == mpx->nstreams);
+
+    /* retried requests use new connection (ready without probe) */
+    assert(1 == gw_mpx_attach(&hctx[0]->gw, &t.r));
+    assert(1 == gw_mpx_attach(&hctx[3]->gw, &t.r));
+    gw_mpx * const mpx2 = hctx[0]->gw.mpx;
+    assert(mpx2 != mpx && mpx2 == hctx[3]->gw.mpx);
+    assert(mpx2 == t.proc->mpx && mpx == mpx2->next);
+    assert(GW_MPX_READY == mpx2->state);
+    const int fd2 = accept(t.lfd, NULL, NULL);
+    assert(fd2 >= 0);
+
+    /* draining connection is closed once last response ends */
+    test_gw_h2c_status(fd, &enc, 5, H2_FLAG_END_STREAM, "204");
+    buffer_clear(test_response);
+    gw_mpx_handle_fdevent(mpx, FDEVENT_IN);
+    assert(buffer_eq_slen(test_response, CONST_STR_LEN("HTTP/1.1 204\r\n\r\n")));
+    /*(hctx[2] freed by gw_connection_close(); mpx freed)*/
+    assert(mpx2 == t.proc->mpx && NULL == mpx2->next);
+
+    test_gw_hctx_free(&t, &hctx[0]->gw);
+    test_gw_hctx_free(&t, &hctx[1]->gw);
+    test_gw_hctx_free(&t, &hctx[3]->gw);
+    assert(0 == mpx2->nstreams);
+    assert(0 == t.proc->load);
+
+    hpack_table_free(&enc);
+    buffer_free(b);
+    close(fd2);
+    close(fd);
+    test_gw_h2c_free(&t);
+}
+
+static int test_gw_counter (const char * const k, const size_t klen) {
+    const data_integer * const di =
+      (const data_integer *)array_get_element_klen(&plugin_stats, k, klen);
+    return di ? di->value : 0;
+}
+
+static void test_gw_host_cost (void) {
+    gw_host * const host = gw_host_init();
+    const time_t cur_ts = log_epoch_secs;
+    const uint64_t now = gw_time_us();
+
+    /* cost of idle host without samples is latency floor */
+    assert(GW_EWMA_FLOOR_US == gw_host_cost(host, cur_ts, now));
+
+    /* latency * (outstanding + 1) */
+    host->ewma_us = 9000;
+    host->ewma_ts = now;
+    assert(10000 == gw_host_cost(host, cur_ts, now));
+    host->load = 1;
+    assert(20000 == gw_host_cost(host, cur_ts, now));
+
+    /* latency decays with time since last sample */
+    assert(11000 == gw_host_cost(host, cur_ts, now + GW_EWMA_DECAY_US));
+    assert(2*GW_EWMA_FLOOR_US
+           == gw_host_cost(host, cur_ts, now + GW_EWMA_DECAY_US*16));
+    assert(20000 == gw_host_cost(host, cur_ts, now - 1));/*(clock not before)*/
+
+    /* cost inflated during slow-start after host is (re)enabled */
+    host->slow_start = 10;
+    host->enabled_ts = cur_ts;
+    assert(200000 == gw_host_cost(host, cur_ts, now));
+    assert(40000 == gw_host_cost(host, cur_ts + 4, now));
+    assert(20000 == gw_host_cost(host, cur_ts + 10, now));
+    host->enabled_ts = cur_ts + 10; /*(ejected until)*/
+    assert(200000 == gw_host_cost(host, cur_ts, now));
+
+    gw_host_free(host);
+}
+
+static void test_gw_host_latency (void) {
+    gw_host * const host = gw_host_init();
+    gw_handler_ctx hctx;
+    memset(&hctx, 0, sizeof(hctx));
+
+    /* peak-EWMA rises immediately to sample above average */
+    hctx.ttfb_ts = gw_time_us() - 50000;
+    gw_host_latency(host, &hctx);
+    assert(0 == hctx.ttfb_ts);
+    assert(host->ewma_us >= 50000 && host->ewma_us < 60000);
+    const uint32_t peak = host->ewma_us;
+
+    /* ... and decays toward sample below average with weight dt/(dt+tau) */
+    host->ewma_ts -= GW_EWMA_DECAY_US;
+    hctx.ttfb_ts = gw_time_us();
+    gw_host_latency(host, &hctx);
+    assert(host->ewma_us >= peak/2 - 1000 && host->ewma_us <= peak/2 + 1000);
+
+    /* sample long after prior sample replaces average */
+    host->ewma_ts -= (uint64_t)GW_EWMA_DECAY_US * 16;
+    hctx.ttfb_ts = gw_time_us();
+    gw_host_latency(host, &hctx);
+    assert(host->ewma_us < 10000);
+
+    gw_host_free(host);
+}
+
+static void test_gw_host_outcome (void) {
+    log_error_st * const errh = log_error_st_init();
+    buffer * const id = buffer_init_string("test");
+    gw_host * const host = gw_host_init();
+    host->id = id;
+    time_t cur_ts = log_epoch_secs;
+    #define test_gw_ejected() \
+            test_gw_counter(CONST_STR_LEN("gw.backend.test.ejected"))
+    const int ejected = test_gw_ejected();
+
+    /* errors below minimum number of requests in window do not eject */
+    for (int i = 1; i < GW_OUTLIER_MIN_REQS; ++i)
+        gw_host_outcome(host, 1, errh);
+    assert(0 == host->ejections);
+    assert(cur_ts == host->win_ts);
+    assert(GW_OUTLIER_MIN_REQS - 1 == host->win_reqs);
+
+    /* error rate at threshold ejects host; ramps up after ejection */
+    gw_host_outcome(host, 1, errh);
+    assert(1 == host->ejections);
+    assert(cur_ts + GW_OUTLIER_WINDOW == host->ejected_until);
+    assert(host->ejected_until == host->enabled_ts);
+    assert(ejected + 1 == test_gw_ejected());
+    assert(0 == host->win_reqs && 0 == host->win_errs);
+
+    /* errors while ejected (e.g. requests in progress) do not eject again */
+    for (int i = 0; i < GW_OUTLIER_MIN_REQS * 2; ++i)
+        gw_host_outcome(host, 1, errh);
+    assert(1 == host->ejections);
+    assert(ejected + 1 == test_gw_ejected());
+
+    /* consecutive ejections increase ejection period, up to a limit */
+    for (int n = 2; n <= GW_OUTLIER_MAX_EJECTIONS + 1; ++n) {
+        log_epoch_secs = cur_ts = host->ejected_until + 1;
+        for (int i = 0; i < GW_OUTLIER_MIN_REQS; ++i)
+            gw_host_outcome(host, 1, errh);
+        const int e = n < GW_OUTLIER_MAX_EJECTIONS
+          ? n
+          : GW_OUTLIER_MAX_EJECTIONS;
+        assert(e == host->ejections);
+        assert(cur_ts + GW_OUTLIER_WINDOW * e == host->ejected_until);
+        assert(ejected + n == test_gw_ejected());
+    }
+
+    /* error rate below threshold does not eject */
+    log_epoch_secs = cur_ts = host->ejected_until + 1;
+    for (int i = 0; i < GW_OUTLIER_MIN_REQS * 2; ++i)
+        gw_host_outcome(host, (0 == i % 3), errh);
+    assert(host->ejected_until < cur_ts);
+    assert(GW_OUTLIER_MIN_REQS * 2 == host->win_reqs);
+    assert((GW_OUTLIER_MIN_REQS * 2 + 2) / 3 == host->win_errs);
+
+    /* window without excess errors resets consecutive ejections */
+    log_epoch_secs = cur_ts += GW_OUTLIER_WINDOW;
+    gw_host_outcome(host, 0, errh);
+    assert(0 == host->ejections);
+    assert(cur_ts == host->win_ts && 1 == host->win_reqs);
+
+    #undef test_gw_ejected
+    gw_host_free(host);
+    buffer_free(id);
+    log_error_st_free(errh);
+}
+
+static void test_gw_host_get_latency (void) {
+    gw_host *hosts[3];
+    gw_extension ext;
+    memset(&ext, 0, sizeof(ext));
+    ext.hosts = hosts;
+    ext.used = 3;
+    const uint64_t now = gw_time_us();
+    for (int i = 0; i < 3; ++i) {
+        hosts[i] = gw_host_init();
+        hosts[i]->active_procs = 1;
+        hosts[i]->ewma_ts = now;
+    }
+    hosts[0]->ewma_us = 30000;
+    hosts[1]->ewma_us = 10000;
+    hosts[2]->ewma_us = 20000;
+
+    /* least-latency: lowest cost */
+    assert(1 == gw_host_get_latency(&ext, GW_BALANCE_LEAST_LATENCY));
+    hosts[1]->load = 2;
+    assert(2 == gw_host_get_latency(&ext, GW_BALANCE_LEAST_LATENCY));
+
+    /* ejected (and inactive) hosts skipped */
+    hosts[2]->ejected_until = log_epoch_secs;
+    assert(0 == gw_host_get_latency(&ext, GW_BALANCE_LEAST_LATENCY));
+    hosts[0]->active_procs = 0;
+    assert(1 == gw_host_get_latency(&ext, GW_BALANCE_LEAST_LATENCY));
+
+    /* all active hosts ejected: ejected hosts are used */
+    hosts[1]->ejected_until = log_epoch_secs;
+    assert(2 == gw_host_get_latency(&ext, GW_BALANCE_LEAST_LATENCY));
+    hosts[1]->active_procs = 0;
+    hosts[2]->active_procs = 0;
+    assert(-1 == gw_host_get_latency(&ext, GW_BALANCE_LEAST_LATENCY));
+
+    /* power-of-two: better of two hosts chosen at random */
+    for (int i = 0; i < 3; ++i) {
+        hosts[i]->active_procs = 1;
+        hosts[i]->ejected_until = 0;
+        hosts[i]->load = 0;
+    }
+    int chosen[3] = { 0, 0, 0 };
+    for (int i = 0; i < 300; ++i) {
+        const int ndx = gw_host_get_latency(&ext, GW_BALANCE_P2C);
+        assert(ndx >= 0 && ndx < 3);
+        ++chosen[ndx];
+    }
+    assert(0 == chosen[0]); /* slowest host never better of two */
+    assert(chosen[1] > chosen[2] && chosen[2] > 0);
+
+    for (int i = 0; i < 3; ++i)
+        gw_host_free(hosts[i]);
+}
+
+static void test_gw_host_get_consistent (void) {
+    enum { NHOSTS = 5, NKEYS = 1000 };
+    gw_host *hosts[NHOSTS];
+    buffer *addrs[NHOSTS];
+    gw_extension ext;
+    memset(&ext, 0, sizeof(ext));
+    ext.hosts = hosts;
+    ext.used = NHOSTS;
+    for (int i = 0; i < NHOSTS; ++i) {
+        char a[16];
+        snprintf(a, sizeof(a), "10.0.0.%d", i+1);
+        addrs[i] = buffer_init_string(a);
+        hosts[i] = gw_host_init();
+        hosts[i]->host = addrs[i];
+        hosts[i]->port = 80;
+        hosts[i]->active_procs = 1;
+    }
+    request_st r;
+    memset(&r, 0, sizeof(r));
+    static int ndx[NKEYS];
+    int count[NHOSTS] = { 0, 0, 0, 0, 0 };
+    char path[32];
+
+    /* keys spread across hosts */
+    for (int k = 0; k < NKEYS; ++k) {
+        snprintf(path, sizeof(path), "/path/%d", k);
+        buffer_copy_string(&r.uri.path, path);
+        ndx[k] = gw_host_get_consistent(&r, &ext, NULL);
+        assert(ndx[k] >= 0 && ndx[k] < NHOSTS);
+        ++count[ndx[k]];
+    }
+    for (int i = 0; i < NHOSTS; ++i)
+        assert(count[i] > NKEYS / NHOSTS / 2);
+
+    /* removing a host remaps only keys of that host */
+    hosts[2]->active_procs = 0;
+    for (int k = 0; k < NKEYS; ++k) {
+        snprintf(path, sizeof(path), "/path/%d", k);
+        buffer_copy_string(&r.uri.path, path);
+        const int n = gw_host_get_consistent(&r, &ext, NULL);
+        assert(n >= 0 && 2 != n);
+        if (2 != ndx[k]) assert(n == ndx[k]);
+    }
+
+    /* re-adding host restores mapping; hosts identified by address and port
+     * (not position in list) */
+    hosts[2]->active_procs = 1;
+    gw_host * const h0 = hosts[0];
+    hosts[0] = hosts[NHOSTS-1];
+    hosts[NHOSTS-1] = h0;
+    for (int k = 0; k < NKEYS; ++k) {
+        snprintf(path, sizeof(path), "/path/%d", k);
+        buffer_copy_string(&r.uri.path, path);
+        const int n = gw_host_get_consistent(&r, &ext, NULL);
+        assert(n == (0 == ndx[k] ? NHOSTS-1 : NHOSTS-1 == ndx[k] ? 0 : ndx[k]));
+    }
+    hosts[NHOSTS-1] = hosts[0];
+    hosts[0] = h0;
+
+    /* bounded loads: host at capacity is skipped; other keys not remapped */
+    hosts[1]->load = 10;
+    for (int k = 0; k < NKEYS; ++k) {
+        snprintf(path, sizeof(path), "/path/%d", k);
+        buffer_copy_string(&r.uri.path, path);
+        const int n = gw_host_get_consistent(&r, &ext, NULL);
+        assert(n >= 0 && 1 != n);
+        if (1 != ndx[k]) assert(n == ndx[k]);
+    }
+    hosts[1]->load = 0;
+
+    /* balance key "cookie:<name>"; request path if cookie absent */
+    buffer * const key = buffer_init_string("cookie:sid");
+    for (int k = 0; k < NKEYS; ++k) {
+        snprintf(path, sizeof(path), "/path/%d", k);
+        buffer_copy_string(&r.uri.path, path);
+        assert(ndx[k] == gw_host_get_consistent(&r, &ext, key));
+    }
+    http_header_request_set(&r, HTTP_HEADER_COOKIE, CONST_STR_LEN("Cookie"),
+                            CONST_STR_LEN("a=1; sid=abc123"));
+    const int n = gw_host_get_consistent(&r, &ext, key);
+    for (int k = 0; k < NKEYS; ++k) {
+        snprintf(path, sizeof(path), "/path/%d", k);
+        buffer_copy_string(&r.uri.path, path);
+        assert(n == gw_host_get_consistent(&r, &ext, key));
+    }
+
+    /* no active hosts */
+    for (int i = 0; i < NHOSTS; ++i)
+        hosts[i]->active_procs = 0;
+    assert(-1 == gw_host_get_consistent(&r, &ext, NULL));
+
+    buffer_free(key);
+    array_free_data(&r.rqst_headers);
+    free(r.uri.path.ptr);
+    for (int i = 0; i < NHOSTS; ++i) {
+        gw_host_free(hosts[i]);
+        buffer_free(addrs[i]);
+    }
+}
+
+static void test_gw_queue (void) {
+    test_gw t;
+    test_gw_init(&t, 0);
+    gw_host * const host = t.host;
+    gw_proc * const proc = t.proc;
+    host->max_reqs_per_proc = 1;
+    host->queue_size = 3;
+    host->queue_timeout = 2;
+    gw_handler_ctx *hctx[5];
+    for (int i = 0; i < 5; ++i) {
+        hctx[i] = handler_ctx_init(0);
+        hctx[i]->host = host;
+        hctx[i]->r = &t.r;
+    }
+    #define test_gw_queued() \
+            test_gw_counter(CONST_STR_LEN("gw.backend.test.queued"))
+    const int timeouts =
+      test_gw_counter(CONST_STR_LEN("gw.backend.test.queue-timeouts"));
+
+    /* requests wait in order while proc is at max-requests-per-proc */
+    proc->load = 1;
+    for (int i = 0; i < 3; ++i) {
+        assert(HANDLER_WAIT_FOR_EVENT == gw_write_request(hctx[i], &t.r));
+        assert(GW_QUEUE_WAITING == hctx[i]->queue_state);
+        assert(NULL == hctx[i]->proc);
+    }
+    assert(3 == host->queue_len);
+    assert(3 == test_gw_queued());
+    assert(hctx[0] == host->queue_first && hctx[2] == host->queue_last);
+    assert(hctx[1] == hctx[0]->queue_next && hctx[2] == hctx[1]->queue_next);
+    assert(HANDLER_WAIT_FOR_EVENT == gw_write_request(hctx[0], &t.r));
+
+    /* queue full; try another host */
+    assert(HANDLER_ERROR == gw_write_request(hctx[3], &t.r));
+    assert(GW_QUEUE_NONE == hctx[3]->queue_state);
+    assert(NULL == hctx[3]->proc);
+    assert(3 == host->queue_len);
+
+    /* first request woken when proc has capacity; capacity reserved for
+     * woken request until it resumes */
+    int jobs = test_joblist_appended;
+    proc->load = 0;
+    gw_queue_wake(host);
+    assert(GW_QUEUE_WOKEN == hctx[0]->queue_state);
+    assert(1 == host->queue_woken);
+    assert(2 == host->queue_len && hctx[1] == host->queue_first);
+    assert(jobs + 1 == test_joblist_appended);
+    gw_queue_wake(host);
+    assert(1 == host->queue_woken);
+    assert(2 == host->queue_len);
+    assert(jobs + 1 == test_joblist_appended);
+
+    /* new request does not pass woken or waiting requests */
+    assert(HANDLER_WAIT_FOR_EVENT == gw_write_request(hctx[3], &t.r));
+    assert(hctx[3] == host->queue_last);
+    assert(3 == host->queue_len);
+
+    /* woken request finding proc at capacity again keeps place at head */
+    proc->load = 1;
+    assert(HANDLER_WAIT_FOR_EVENT == gw_write_request(hctx[0], &t.r));
+    assert(GW_QUEUE_WAITING == hctx[0]->queue_state);
+    assert(hctx[0] == host->queue_first);
+    assert(0 == host->queue_woken);
+    assert(4 == host->queue_len); /*(may exceed queue-size by woken)*/
+
+    /* woken request resumes and is assigned proc */
+    proc->load = 0;
+    gw_queue_wake(host);
+    assert(GW_QUEUE_WOKEN == hctx[0]->queue_state);
+    test_socket_errno = EMFILE;
+    assert(HANDLER_WAIT_FOR_FD == gw_write_request(hctx[0], &t.r));
+    test_socket_errno = 0;
+    assert(GW_QUEUE_NONE == hctx[0]->queue_state);
+    assert(0 == host->queue_woken);
+    assert(proc == hctx[0]->proc && 1 == proc->load);
+    assert(3 == host->queue_len && hctx[1] == host->queue_first);
+
+    /* requests waiting longer than queue-timeout expire, oldest first */
+    jobs = test_joblist_appended;
+    gw_queue_trigger(host);
+    assert(3 == host->queue_len);
+    hctx[1]->queue_ts -= 2000000;
+    hctx[3]->queue_ts -= 2000000;
+    gw_queue_trigger(host);
+    assert(GW_QUEUE_TIMEOUT == hctx[1]->queue_state);
+    assert(GW_QUEUE_WAITING == hctx[2]->queue_state); /*(stops at hctx[2])*/
+    assert(GW_QUEUE_WAITING == hctx[3]->queue_state);
+    assert(2 == host->queue_len && hctx[2] == host->queue_first);
+    assert(jobs + 1 == test_joblist_appended);
+    assert(timeouts + 1 ==
+      test_gw_counter(CONST_STR_LEN("gw.backend.test.queue-timeouts")));
+    gw_queue_detach(hctx[1]);
+    assert(GW_QUEUE_NONE == hctx[1]->queue_state);
+    assert(2 == host->queue_len);
+
+    /* reset of waiting request removes it from queue */
+    gw_queue_detach(hctx[2]);
+    assert(GW_QUEUE_NONE == hctx[2]->queue_state);
+    assert(1 == host->queue_len && hctx[3] == host->queue_first);
+    assert(hctx[3] == host->queue_last);
+    assert(1 == test_gw_queued());
+
+    /* request release wakes next request; reset of woken request releases
+     * reserved capacity */
+    gw_host_assign(host); /*(host load released by gw_backend_close())*/
+    gw_backend_close(hctx[0], &t.r);
+    assert(0 == host->load);
+    assert(0 == proc->load);
+    assert(GW_QUEUE_WOKEN == hctx[3]->queue_state); /*(woken on release)*/
+    assert(1 == host->queue_woken);
+    assert(0 == host->queue_len && NULL == host->queue_first);
+    gw_queue_detach(hctx[3]);
+    assert(0 == host->queue_woken);
+    assert(0 == test_gw_queued());
+
+    #undef test_gw_queued
+    for (int i = 0; i < 5; ++i)
+        handler_ctx_free(hctx[i]);
+    test_gw_free(&t);
+}
+
+static void test_gw_hc (void) {
+    test_gw t;
+    test_gw_init(&t, 0);
+    gw_host * const host = t.host;
+    gw_proc * const proc = t.proc;
+    host->hc_interval = 5;
+    host->hc_timeout = 2;
+    host->hc_rise = 2;
+    host->hc_fall = 2;
+    buffer_copy_string(proc->unixsocket, t.proc->connection_name->ptr);
+    #define test_gw_hc_down() \
+            test_gw_counter(CONST_STR_LEN("gw.backend.test.0.health-check-down"))
+    const int down = test_gw_hc_down();
+
+    /* failure to create probe socket counts as failed probe */
+    test_socket_errno = EMFILE;
+    gw_hc_trigger(&t.srv, host);
+    gw_hc * const hc = proc->hc;
+    assert(NULL != hc && -1 == hc->fd);
+    assert(1 == hc->fail && 0 == proc->hc_down);
+    assert(PROC_STATE_RUNNING == proc->state);
+    gw_hc_trigger(&t.srv, host); /*(not before hc_interval)*/
+    assert(1 == hc->fail);
+    log_epoch_secs += host->hc_interval;
+    gw_hc_trigger(&t.srv, host);
+    assert(2 == hc->fail && 1 == proc->hc_down);
+    assert(PROC_STATE_OVERLOADED == proc->state);
+    assert(down + 1 == test_gw_hc_down());
+    test_socket_errno = 0;
+
+    /* proc re-enabled after hc_rise passed probes (connect) */
+    log_epoch_secs += host->hc_interval;
+    gw_hc_trigger(&t.srv, host);
+    assert(0 == hc->fail && 1 == hc->ok && 1 == proc->hc_down);
+    assert(-1 == hc->fd);
+    gw_proc_check_enable(host, proc, t.srv.errh); /*(not by disable_time)*/
+    assert(PROC_STATE_OVERLOADED == proc->state);
+    log_epoch_secs += host->hc_interval;
+    gw_hc_trigger(&t.srv, host);
+    assert(2 == hc->ok && 0 == proc->hc_down);
+    assert(PROC_STATE_RUNNING == proc->state);
+
+    /* FCGI_GET_VALUES probe without response within hc_timeout fails */
+    host->hc_proto = &fcgi_hc_proto;
+    log_epoch_secs += host->hc_interval;
+    gw_hc_trigger(&t.srv, host);
+    assert(-1 != hc->fd && GW_HC_RECV == hc->state);
+    log_epoch_secs += host->hc_timeout - 1;
+    gw_hc_trigger(&t.srv, host);
+    assert(-1 != hc->fd && 0 == hc->fail);
+    log_epoch_secs += 1;
+    gw_hc_trigger(&t.srv, host);
+    assert(-1 == hc->fd && 1 == hc->fail);
+
+    /* connect refused fails */
+    close(t.lfd); /*(socket path exists; backend not listening)*/
+    t.lfd = socket(AF_UNIX, SOCK_STREAM, 0);
+    log_epoch_secs += host->hc_interval;
+    gw_hc_trigger(&t.srv, host);
+    assert(2 == hc->fail && 1 == proc->hc_down);
+    assert(PROC_STATE_OVERLOADED == proc->state);
+    assert(down + 2 == test_gw_hc_down());
+
+    /* respawned proc is enabled; prior probe results are reset */
+    close(t.lfd);
+    unlink(((struct sockaddr_un *)proc->saddr)->sun_path);
+    t.lfd = socket(AF_UNIX, SOCK_STREAM, 0);
+    assert(0 == bind(t.lfd, proc->saddr, proc->saddrlen));
+    assert(0 == listen(t.lfd, 8));
+    gw_proc_set_state(host, proc, PROC_STATE_DIED);
+    host->bin_path = proc->unixsocket;/*(not used; backend already listening)*/
+    assert(0 == gw_spawn_connection(host, proc, t.srv.errh, 0));
+    host->bin_path = NULL;
+    assert(PROC_STATE_RUNNING == proc->state);
+    assert(0 == proc->hc_down);
+    assert(0 == hc->fail && 0 == hc->ok && -1 == hc->fd);
+
+    /* new proc probed without delay; FCGI_GET_VALUES_RESULT passes */
+    gw_hc_trigger(&t.srv, host);
+    assert(-1 != hc->fd && GW_HC_RECV == hc->state);
+    close(accept(t.lfd, NULL, NULL)); /*(gw_spawn_connection() connect)*/
+    const int fd = accept(t.lfd, NULL, NULL);
+    assert(fd >= 0);
+    buffer * const b = buffer_init();
+    test_gw_backend_recv(fd, b);
+    size_t off = 0, len;
+    int type, id;
+    test_gw_record(b, &off, &type, &id, &len);
+    assert(FCGI_GET_VALUES == type && FCGI_NULL_REQUEST_ID == id);
+    test_gw_get_values_result(fd, "4", "1");
+    gw_hc_handle_fdevent(hc, FDEVENT_IN);
+    assert(-1 == hc->fd && 1 == hc->ok);
+    assert(PROC_STATE_RUNNING == proc->state);
+    buffer_free(b);
+    close(fd);
+
+    #undef test_gw_hc_down
+    test_gw_free(&t);
+}
+
+int main (void) {
+    assert(NULL != mkdtemp(test_dir));
+    log_epoch_secs = 1000000;
+    test_response = buffer_init();
+
+    test_gw_mpx_probe();
+    test_gw_mpx_fallback();
+    test_gw_mpx_abort();
+    test_gw_mpx_reqbody();
+    test_gw_h2c_probe();
+    test_gw_h2c_fallback();
+    test_gw_h2c_headers();
+    test_gw_h2c_flow();
+    test_gw_h2c_retry();
+    test_gw_host_cost();
+    test_gw_host_latency();
+    test_gw_host_outcome();
+    test_gw_host_get_latency();
+    test_gw_host_get_consistent();
+    test_gw_queue();
+    test_gw_hc();
+
+    buffer_free(test_response);
+    assert(0 == rmdir(test_dir));
+    array_free_data(&plugin_stats);
+    return 0;
+}
+
+/*
+ * stub functions
+ */
+
+array plugin_stats;
+
+void connection_list_append(connections *conns, connection *con) {
+    UNUSED(conns);
+    UNUSED(con);
+    ++test_joblist_appended;
+}
+
+static fdnode test_fdnodes[1024];
+
+fdnode * fdevent_register(fdevents *ev, int fd, fdevent_handler handler, void *ctx) {
+    UNUSED(ev);
+    assert(fd >= 0 && fd < (int)(sizeof(test_fdnodes)/sizeof(*test_fdnodes)));
+    fdnode * const fdn = test_fdnodes + fd;
+    fdn->handler = handler;
+    fdn->ctx = ctx;
+    fdn->fd = fd;
+    fdn->events = 0;
+    return fdn;
+}
+
+void fdevent_unregister(fdevents *ev, int fd) {
+    UNUSED(ev);
+    UNUSED(fd);
+}
+
+void fdevent_sched_close(fdevents *ev, int fd, int issock) {
+    UNUSED(ev);
+    UNUSED(issock);
+    close(fd);
+}
+
+void fdevent_fdnode_event_set(fdevents *ev, fdnode *fdn, int events) {
+    UNUSED(ev);
+    if (fdn) fdn->events = events;
+}
+
+void fdevent_fdnode_event_add(fdevents *ev, fdnode *fdn, int event) {
+    UNUSED(ev);
+    if (fdn) fdn->events |= event;
+}
+
+void fdevent_fdnode_event_clr(fdevents *ev, fdnode *fdn, int event) {
+    UNUSED(ev);
+    if (fdn) fdn->events &= ~event;
+}
+
+void fdevent_fdnode_event_del(fdevents *ev, fdnode *fdn) {
+    UNUSED(ev);
+    if (fdn) fdn->events = 0;
+}
+
+int fdevent_socket_nb_cloexec(int domain, int type, int protocol) {
+    if (test_socket_errno) {
+        errno = test_socket_errno;
+        return -1;
+    }
+    const int fd = socket(domain, type, protocol);
+    if (-1 != fd) {
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+        fcntl(fd, F_SETFL, O_NONBLOCK | O_RDWR);
+    }
+    return fd;
+}
+
+int fdevent_socket_cloexec(int domain, int type, int protocol) {
+    return socket(domain, type, protocol);
+}
+
+void fdevent_setfd_cloexec(int fd) {
+    UNUSED(fd);
+}
+
+int fdevent_set_tcp_nodelay (const int fd, const int opt) {
+    UNUSED(fd);
+    UNUSED(opt);
+    return 0;
+}
+
+int fdevent_set_so_reuseaddr (const int fd, const int opt) {
+    UNUSED(fd);
+    UNUSED(opt);
+    return 0;
+}
+
+int fdevent_connect_status(int fd) {
+    UNUSED(fd);
+    return 0;
+}
+
+char ** fdevent_environ(void) {
+    return NULL;
+}
+
+pid_t fdevent_fork_execve(const char *name, char *argv[], char *envp[], int fdin, int fdout, int fderr, int dfd) {
+    UNUSED(name);
+    UNUSED(argv);
+    UNUSED(envp);
+    UNUSED(fdin);
+    UNUSED(fdout);
+    UNUSED(fderr);
+    UNUSED(dfd);
+    return -1;
+}
+
+int fdevent_open_cloexec(const char *pathname, int symlinks, int flags, mode_t mode) {
+    UNUSED(pathname);
+    UNUSED(symlinks);
+    UNUSED(flags);
+    UNUSED(mode);
+    return -1;
+}
+
+int fdevent_open_dirname(char *path, int symlinks) {
+    UNUSED(path);
+    UNUSED(symlinks);
+    return -1;
+}
+
+int fdevent_mkstemp_append(char *path) {
+    UNUSED(path);
+    return -1;
+}
+
+void file_cache_release (file_cache_entry *fce) {
+    UNUSED(fce);
+}
+
+int li_rand_pseudo (void) {
+    return rand();
+}
+
+int http_cgi_headers(request_st *r, http_cgi_opts *opts, http_cgi_header_append_cb cb, void *vdata) {
+    UNUSED(r);
+    UNUSED(opts);
+    UNUSED(cb);
+    UNUSED(vdata);
+    return -1;
+}
+
+int http_chunk_decode_append_mem(request_st * const r, const char * const mem, const size_t len) {
+    UNUSED(r);
+    UNUSED(mem);
+    UNUSED(len);
+    return -1;
+}
+
+int http_chunk_transfer_cqlen(request_st *r, chunkqueue *src, size_t len) {
+    UNUSED(r);
+    UNUSED(src);
+    UNUSED(len);
+    return -1;
+}
+
+int http_chunk_append_buffer(request_st *r, buffer *mem) {
+    UNUSED(r);
+    UNUSED(mem);
+    return -1;
+}
+
+void http_response_backend_done (request_st *r) {
+    UNUSED(r);
+}
+
+void http_response_backend_error (request_st *r) {
+    UNUSED(r);
+}
+
+handler_t http_response_parse_headers(request_st *r, http_response_opts *opts, buffer *hdrs) {
+    UNUSED(r);
+    UNUSED(opts);
+    UNUSED(hdrs);
+    return HANDLER_ERROR;
+}
+
+handler_t http_response_read(request_st *r, http_response_opts *opts, buffer *b, fdnode *fdn) {
+    UNUSED(r);
+    UNUSED(opts);
+    UNUSED(b);
+    UNUSED(fdn);
+    return HANDLER_ERROR;
+}
+
+handler_t connection_handle_read_post_error(request_st *r, int http_status) {
+    UNUSED(r);
+    UNUSED(http_status);
+    return HANDLER_ERROR;
+}
+
+handler_t connection_handle_read_post_state(request_st *r) {
+    UNUSED(r);
+    return HANDLER_ERROR;
+}
+
+void connection_response_reset(request_st *r) {
+    UNUSED(r);
+}
+
+void http_response_upgrade_read_body_unknown(request_st *r) {
+    UNUSED(r);
+}
+
+int config_plugin_values_init_block(server * const srv, const array * const ca, const config_plugin_keys_t * const cpk, const char * const mname, config_plugin_value_t *cpv) {
+    UNUSED(srv);
+    UNUSED(ca);
+    UNUSED(cpk);
+    UNUSED(mname);
+    UNUSED(cpv);
+    return 0;
+}
+
+int config_plugin_values_init(server *srv, void *p_d, const config_plugin_keys_t *cpk, const char *mname) {
+    UNUSED(srv);
+    UNUSED(p_d);
+    UNUSED(cpk);
+    UNUSED(mname);
+    return 0;
+}
+
+int config_check_cond_next(request_st *r, const config_plugin_value_t *cvlist, int i, int used) {
+    UNUSED(r);
+    UNUSED(cvlist);
+    UNUSED(i);
+    return used;
+}
+
+int config_feature_bool(const server *srv, const char *feature, int default_value) {
+    UNUSED(srv);
+    UNUSED(feature);
+    return default_value;
+}
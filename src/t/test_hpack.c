@@ -0,0 +1,206 @@
+#include "first.h"
+
+#undef NDEBUG
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hpack.h"
+
+static void test_hpack_field_cb (void *ctx, const char *k, uint32_t klen, const char *v, uint32_t vlen) {
+    buffer * const b = ctx;
+    buffer_append_string_len(b, k, klen);
+    buffer_append_string_len(b, CONST_STR_LEN(": "));
+    buffer_append_string_len(b, v, vlen);
+    buffer_append_string_len(b, CONST_STR_LEN("\n"));
+}
+
+static int test_hpack_decode_hex (hpack_table * const t, const char *hex, buffer * const out) {
+    unsigned char s[256];
+    size_t len = 0;
+    for (; *hex; ++hex) {
+        if (*hex == ' ') continue;
+        s[len++] = (unsigned char)strtoul((char[]){hex[0], hex[1], '\0'}, NULL, 16);
+        ++hex;
+    }
+    buffer * const tb = buffer_init();
+    buffer_clear(out);
+    const int rc = hpack_decode(t, s, len, tb, test_hpack_field_cb, out);
+    buffer_free(tb);
+    return rc;
+}
+
+static void test_hpack_decode (void) {
+    /* RFC 7541 Appendix C.3 Request Examples without Huffman Coding */
+    hpack_table t;
+    buffer * const out = buffer_init();
+    hpack_table_init(&t, HPACK_TABLE_SIZE_DEFAULT);
+
+    assert(0 == test_hpack_decode_hex(&t,
+      "8286 8441 0f77 7777 2e65 7861 6d70 6c65 2e63 6f6d", out));
+    assert(buffer_is_equal_string(out, CONST_STR_LEN(
+      ":method: GET\n:scheme: http\n:path: /\n"
+      ":authority: www.example.com\n")));
+    assert(57 == t.size);
+
+    assert(0 == test_hpack_decode_hex(&t,
+      "8286 84be 5808 6e6f 2d63 6163 6865", out));
+    assert(buffer_is_equal_string(out, CONST_STR_LEN(
+      ":method: GET\n:scheme: http\n:path: /\n"
+      ":authority: www.example.com\ncache-control: no-cache\n")));
+    assert(110 == t.size);
+
+    assert(0 == test_hpack_decode_hex(&t,
+      "8287 85bf 400a 6375 7374 6f6d 2d6b 6579 0c63 7573 746f 6d2d 7661"
+      "6c75 65", out));
+    assert(buffer_is_equal_string(out, CONST_STR_LEN(
+      ":method: GET\n:scheme: https\n:path: /index.html\n"
+      ":authority: www.example.com\ncustom-key: custom-value\n")));
+    assert(164 == t.size);
+    assert(3 == t.used);
+    hpack_table_free(&t);
+
+    /* RFC 7541 Appendix C.4 Request Examples with Huffman Coding */
+    hpack_table_init(&t, HPACK_TABLE_SIZE_DEFAULT);
+    assert(0 == test_hpack_decode_hex(&t,
+      "8286 8441 8cf1 e3c2 e5f2 3a6b a0ab 90f4 ff", out));
+    assert(buffer_is_equal_string(out, CONST_STR_LEN(
+      ":method: GET\n:scheme: http\n:path: /\n"
+      ":authority: www.example.com\n")));
+    assert(0 == test_hpack_decode_hex(&t,
+      "8286 84be 5886 a8eb 1064 9cbf", out));
+    assert(0 == test_hpack_decode_hex(&t,
+      "8287 85bf 4088 25a8 49e9 5ba9 7d7f 8925 a849 e95b b8e8 b4bf", out));
+    assert(buffer_is_equal_string(out, CONST_STR_LEN(
+      ":method: GET\n:scheme: https\n:path: /index.html\n"
+      ":authority: www.example.com\ncustom-key: custom-value\n")));
+    assert(164 == t.size);
+    hpack_table_free(&t);
+
+    /* RFC 7541 Appendix C.6 Response Examples with Huffman Coding
+     * (table size 256; entries are evicted) */
+    hpack_table_init(&t, 256);
+    assert(0 == test_hpack_decode_hex(&t,
+      "4882 6402 5885 aec3 771a 4b61 96d0 7abe 9410 54d4 44a8 2005 9504"
+      "0b81 66e0 82a6 2d1b ff6e 919d 29ad 1718 63c7 8f0b 97c8 e9ae 82ae"
+      "43d3", out));
+    assert(buffer_is_equal_string(out, CONST_STR_LEN(
+      ":status: 302\ncache-control: private\n"
+      "date: Mon, 21 Oct 2013 20:13:21 GMT\n"
+      "location: https://www.example.com\n")));
+    assert(222 == t.size);
+    assert(0 == test_hpack_decode_hex(&t, "4883 640e ffc1 c0bf", out));
+    assert(buffer_is_equal_string(out, CONST_STR_LEN(
+      ":status: 307\ncache-control: private\n"
+      "date: Mon, 21 Oct 2013 20:13:21 GMT\n"
+      "location: https://www.example.com\n")));
+    assert(222 == t.size);
+    assert(0 == test_hpack_decode_hex(&t,
+      "88c1 6196 d07a be94 1054 d444 a820 0595 040b 8166 e084 a62d 1bff"
+      "c05a 839b d9ab 77ad 94e7 821d d7f2 e6c7 b335 dfdf cd5b 3960 d5af"
+      "2708 7f36 72c1 ab27 0fb5 291f 9587 3160 65c0 03ed 4ee5 b106 3d50"
+      "07", out));
+    assert(buffer_is_equal_string(out, CONST_STR_LEN(
+      ":status: 200\ncache-control: private\n"
+      "date: Mon, 21 Oct 2013 20:13:22 GMT\n"
+      "location: https://www.example.com\ncontent-encoding: gzip\n"
+      "set-cookie: foo=ASDJKHQKBZXOQWEOPIUAXQWEOIU; max-age=3600; version=1\n")));
+    assert(215 == t.size);
+    assert(3 == t.used);
+
+    /* dynamic table size update (only at start of header block) */
+    assert(0 == test_hpack_decode_hex(&t, "20 88", out));
+    assert(0 == t.size && 0 == t.used);
+    assert(-1 == test_hpack_decode_hex(&t, "3fe201", out)); /*(257 > limit)*/
+    assert(-1 == test_hpack_decode_hex(&t, "88 20", out));
+    hpack_table_free(&t);
+
+    /* decoding errors */
+    hpack_table_init(&t, HPACK_TABLE_SIZE_DEFAULT);
+    assert(-1 == test_hpack_decode_hex(&t, "80", out));   /* index 0 */
+    assert(-1 == test_hpack_decode_hex(&t, "be", out));   /* index > len */
+    assert(-1 == test_hpack_decode_hex(&t, "400a 6375", out)); /* truncated */
+    assert(-1 == test_hpack_decode_hex(&t, "ff", out));   /* truncated int */
+    assert(0 == test_hpack_decode_hex(&t, "0081 1f00", out)); /* "a" */
+    assert(buffer_is_equal_string(out, CONST_STR_LEN("a: \n")));
+    assert(-1 == test_hpack_decode_hex(&t, "0081 1800", out)); /* pad 0 */
+    assert(-1 == test_hpack_decode_hex(&t, "0081 ff00", out)); /* pad > 7 */
+    assert(-1 == test_hpack_decode_hex(&t,  /* EOS */
+      "0084 ffff ffff 00", out));
+    hpack_table_free(&t);
+
+    buffer_free(out);
+}
+
+static void test_hpack_encode (void) {
+    hpack_table enc, dec;
+    buffer * const b = buffer_init();
+    buffer * const tb = buffer_init();
+    buffer * const out = buffer_init();
+    hpack_table_init(&enc, HPACK_TABLE_SIZE_DEFAULT);
+    hpack_table_init(&dec, HPACK_TABLE_SIZE_DEFAULT);
+
+    /* RFC 7541 Appendix C.3 (same encoding choices) */
+    hpack_encode_field(&enc, b, CONST_STR_LEN(":method"), CONST_STR_LEN("GET"), HPACK_FIELD_INDEX);
+    hpack_encode_field(&enc, b, CONST_STR_LEN(":scheme"), CONST_STR_LEN("http"), HPACK_FIELD_INDEX);
+    hpack_encode_field(&enc, b, CONST_STR_LEN(":path"), CONST_STR_LEN("/"), HPACK_FIELD_NOINDEX);
+    hpack_encode_field(&enc, b, CONST_STR_LEN(":authority"), CONST_STR_LEN("www.example.com"), HPACK_FIELD_INDEX);
+    assert(buffer_is_equal_string(b, CONST_STR_LEN(
+      "\x82\x86\x84\x41\x0fwww.example.com")));
+    assert(0 == hpack_decode(&dec, (unsigned char *)b->ptr, buffer_string_length(b), tb, test_hpack_field_cb, out));
+    buffer_clear(b);
+    hpack_encode_field(&enc, b, CONST_STR_LEN(":method"), CONST_STR_LEN("GET"), HPACK_FIELD_INDEX);
+    hpack_encode_field(&enc, b, CONST_STR_LEN(":scheme"), CONST_STR_LEN("http"), HPACK_FIELD_INDEX);
+    hpack_encode_field(&enc, b, CONST_STR_LEN(":path"), CONST_STR_LEN("/"), HPACK_FIELD_NOINDEX);
+    hpack_encode_field(&enc, b, CONST_STR_LEN(":authority"), CONST_STR_LEN("www.example.com"), HPACK_FIELD_INDEX);
+    hpack_encode_field(&enc, b, CONST_STR_LEN("Cache-Control"), CONST_STR_LEN("no-cache"), HPACK_FIELD_INDEX);
+    assert(buffer_is_equal_string(b, CONST_STR_LEN(
+      "\x82\x86\x84\xbe\x58\x08no-cache")));
+    assert(0 == hpack_decode(&dec, (unsigned char *)b->ptr, buffer_string_length(b), tb, test_hpack_field_cb, out));
+    buffer_clear(b);
+    hpack_encode_field(&enc, b, CONST_STR_LEN("Custom-Key"), CONST_STR_LEN("custom-value"), HPACK_FIELD_INDEX);
+    assert(buffer_is_equal_string(b, CONST_STR_LEN(
+      "\x40\x0a" "custom-key\x0c" "custom-value")));
+    assert(164 == enc.size);
+    assert(0 == hpack_decode(&dec, (unsigned char *)b->ptr, buffer_string_length(b), tb, test_hpack_field_cb, out));
+    assert(164 == dec.size);
+    buffer_clear(b);
+    buffer_clear(out);
+
+    /* round trip; names are lowercased */
+    hpack_encode_field(&enc, b, CONST_STR_LEN("X-Request-Id"), CONST_STR_LEN("1234"), HPACK_FIELD_NOINDEX);
+    hpack_encode_field(&enc, b, CONST_STR_LEN("Authorization"), CONST_STR_LEN("Basic Zm9v"), HPACK_FIELD_NEVERINDEX);
+    hpack_encode_field(&enc, b, CONST_STR_LEN("custom-key"), CONST_STR_LEN("custom-value"), HPACK_FIELD_INDEX);
+    assert(0 == hpack_decode(&dec, (unsigned char *)b->ptr, buffer_string_length(b), tb, test_hpack_field_cb, out));
+    assert(buffer_is_equal_string(out, CONST_STR_LEN(
+      "x-request-id: 1234\nauthorization: Basic Zm9v\n"
+      "custom-key: custom-value\n")));
+    assert(b->ptr[buffer_string_length(b)-1] == '\xbe'); /*(indexed)*/
+    assert(enc.size == dec.size && enc.used == dec.used);
+    buffer_clear(b);
+    buffer_clear(out);
+
+    /* size update is sent at start of next header block */
+    hpack_table_resize(&enc, 0);
+    assert(0 == enc.used && enc.update);
+    hpack_encode_field(&enc, b, CONST_STR_LEN("custom-key"), CONST_STR_LEN("custom-value"), HPACK_FIELD_INDEX);
+    assert(!enc.update && 0 == enc.used);
+    assert(b->ptr[0] == '\x20');
+    hpack_table_free(&dec);
+    hpack_table_init(&dec, HPACK_TABLE_SIZE_DEFAULT);
+    assert(0 == hpack_decode(&dec, (unsigned char *)b->ptr, buffer_string_length(b), tb, test_hpack_field_cb, out));
+    assert(buffer_is_equal_string(out, CONST_STR_LEN("custom-key: custom-value\n")));
+    assert(0 == dec.max_size && 0 == dec.used);
+
+    hpack_table_free(&enc);
+    hpack_table_free(&dec);
+    buffer_free(out);
+    buffer_free(tb);
+    buffer_free(b);
+}
+
+int main (void) {
+    test_hpack_decode();
+    test_hpack_encode();
+    return 0;
+}
@@ -0,0 +1,309 @@
+#include "first.h"
+
+#undef NDEBUG
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "io_prefetch.c"
+
+#ifdef IO_PREFETCH
+
+static int test_submitted;
+static int test_joblist_appended;
+static async_job *test_job;
+
+static int test_io_prefetch_counter (const char * const k, const size_t klen) {
+    const data_integer * const di =
+      (const data_integer *)array_get_element_klen(&plugin_stats, k, klen);
+    return di ? di->value : 0;
+}
+
+static void test_io_prefetch_run (void) {
+    /* run job as worker thread would */
+    char * const buf = io_prefetch_tctx_init(NULL);
+    assert(NULL != test_job);
+    test_job->run(test_job, buf, NULL);
+    io_prefetch_tctx_free(buf);
+}
+
+static void test_io_prefetch_complete (void) {
+    /* complete job as async_pool would in main thread */
+    async_job * const job = test_job;
+    test_job = NULL;
+    job->done = 1;
+    if (NULL == job->r)
+        job->free(job); /* detached */
+    else
+        job->complete(job);
+}
+
+static void test_io_prefetch_defer (const char * const fn) {
+    server srv;
+    memset(&srv, 0, sizeof(srv));
+    srv.srvconf.io_threads = 1;
+
+    chunkqueue cq;
+    memset(&cq, 0, sizeof(cq));
+    chunk c;
+    memset(&c, 0, sizeof(c));
+    c.type = FILE_CHUNK;
+    c.mem = buffer_init_string(fn);
+    c.file.fd = -1;
+    c.file.start = 0;
+    c.file.length = 3 * IO_PREFETCH_WINDOW + 1000;
+    cq.first = cq.last = &c;
+
+    connection con;
+    memset(&con, 0, sizeof(con));
+    con.write_queue = &cq;
+    con.request.con = &con;
+    con.srv = &srv;
+    con.io_prefetch_fd = -1;
+    con.is_writable = 1;
+
+    /* prefetch disabled */
+    assert(0 == io_prefetch_defer(&con));
+    assert(0 == test_submitted);
+
+    io_prefetch_init(&srv);
+    assert(NULL != io_pool);
+
+    /* file not yet open: open, fstat, and first window read in worker */
+    assert(1 == io_prefetch_defer(&con));
+    assert(1 == test_submitted);
+    assert(0 == con.is_writable);
+    assert(NULL != con.io_prefetch);
+    io_prefetch_job *j = con.io_prefetch;
+    assert(-1 == j->fd);
+    assert(0 == strcmp(j->fn, fn));
+    assert(0 == j->offset && IO_PREFETCH_WINDOW == j->len);
+    assert(1 == test_io_prefetch_counter(CONST_STR_LEN("server.io-prefetch.deferred")));
+
+    /* write remains deferred while prefetch is pending */
+    assert(1 == io_prefetch_defer(&con));
+    assert(1 == test_submitted);
+
+    test_io_prefetch_run();
+    assert(j->opened && -1 != j->fd && 0 == j->err);
+    test_io_prefetch_complete();
+    /* fd opened in worker thread is handed to chunk; write resumed */
+    assert(-1 != c.file.fd);
+    assert(NULL == con.io_prefetch);
+    assert(1 == con.is_writable);
+    assert(1 == test_joblist_appended);
+    assert(c.file.fd == con.io_prefetch_fd);
+    assert(IO_PREFETCH_WINDOW == con.io_prefetch_end);
+
+    /* within window already prefetched: not probed again */
+    c.offset = IO_PREFETCH_WINDOW - 1;
+    assert(0 == io_prefetch_defer(&con));
+    assert(0 == test_io_prefetch_counter(CONST_STR_LEN("server.io-prefetch.cached")));
+    assert(1 == test_submitted);
+
+    /* next window probed; data is in page cache after prefetch (read) */
+    {
+        char buf[4096];
+        for (off_t o = IO_PREFETCH_WINDOW; o < 2*IO_PREFETCH_WINDOW; o += (off_t)sizeof(buf))
+            assert(sizeof(buf) == (size_t)pread(c.file.fd, buf, sizeof(buf), o));
+    }
+    c.offset = IO_PREFETCH_WINDOW;
+    assert(0 == io_prefetch_defer(&con));
+    assert(1 == test_io_prefetch_counter(CONST_STR_LEN("server.io-prefetch.cached")));
+    assert(2*IO_PREFETCH_WINDOW == con.io_prefetch_end);
+    assert(1 == test_submitted);
+
+    /* window is truncated at end of chunk; probe might or might not find
+     * data in page cache (not dropped from page cache on all filesystems) */
+    c.offset = 3 * IO_PREFETCH_WINDOW;
+  #ifdef POSIX_FADV_DONTNEED
+    posix_fadvise(c.file.fd, 0, 0, POSIX_FADV_DONTNEED);
+  #endif
+    if (io_prefetch_defer(&con)) {
+        assert(2 == test_submitted);
+        j = con.io_prefetch;
+        /* reads from dup() of chunk fd */
+        assert(-1 != j->fd && j->fd != c.file.fd);
+        assert(!j->opened);
+        assert(3*IO_PREFETCH_WINDOW == j->offset && 1000 == j->len);
+
+        /* request reset before prefetch completes: job detached and freed
+         * when it completes; chunk fd remains open */
+        io_prefetch_detach(&con);
+        assert(NULL == con.io_prefetch);
+        assert(-1 == con.io_prefetch_fd);
+        assert(NULL == test_job->r);
+        test_io_prefetch_run();
+        test_io_prefetch_complete();
+        assert(1 == test_joblist_appended);
+        assert(-1 != fcntl(c.file.fd, F_GETFD));
+    }
+    else {
+        assert(2 == test_io_prefetch_counter(CONST_STR_LEN("server.io-prefetch.cached")));
+        assert(3*IO_PREFETCH_WINDOW + 1000 == con.io_prefetch_end);
+    }
+
+    /* chunks not prefetched: temp files, cached file content, mem chunks */
+    const int submitted = test_submitted;
+    con.io_prefetch_fd = -1;
+    c.offset = 0;
+    c.file.is_temp = 1;
+    assert(0 == io_prefetch_defer(&con));
+    c.file.is_temp = 0;
+    c.file.ref = (struct file_cache_entry *)&c; /*(any non-NULL)*/
+    assert(0 == io_prefetch_defer(&con));
+    c.file.ref = NULL;
+    c.type = MEM_CHUNK;
+    assert(0 == io_prefetch_defer(&con));
+    c.type = FILE_CHUNK;
+    c.offset = c.file.length;
+    assert(0 == io_prefetch_defer(&con));
+    assert(submitted == test_submitted);
+
+    io_prefetch_detach(&con);
+    io_prefetch_free();
+    assert(NULL == io_pool);
+    close(c.file.fd);
+    buffer_free(c.mem);
+}
+
+static void test_io_prefetch_open (const char * const fn) {
+    async_job *io_job;
+    server srv;
+    memset(&srv, 0, sizeof(srv));
+    srv.srvconf.io_threads = 1;
+    io_prefetch_init(&srv);
+
+    chunkqueue cq;
+    memset(&cq, 0, sizeof(cq));
+    chunk c;
+    memset(&c, 0, sizeof(c));
+    c.type = FILE_CHUNK;
+    c.mem = buffer_init_string("/nonexistent/lighttpd_test_io_prefetch");
+    c.file.fd = -1;
+    c.file.length = 100;
+    cq.first = cq.last = &c;
+
+    connection con;
+    memset(&con, 0, sizeof(con));
+    con.write_queue = &cq;
+    con.request.con = &con;
+    con.srv = &srv;
+    con.io_prefetch_fd = -1;
+
+    /* error opening file in worker thread is counted; chunk fd not set,
+     * and write resumes (and reports the error) */
+    const int errors =
+      test_io_prefetch_counter(CONST_STR_LEN("server.io-prefetch.errors"));
+    assert(1 == io_prefetch_defer(&con));
+    test_io_prefetch_run();
+    test_io_prefetch_complete();
+    assert(errors + 1 ==
+      test_io_prefetch_counter(CONST_STR_LEN("server.io-prefetch.errors")));
+    assert(-1 == c.file.fd);
+    assert(1 == con.is_writable);
+
+    /* request reset before prefetch completes: job detached and freed
+     * (with fd opened in worker thread) when it completes */
+    buffer_copy_string(c.mem, fn);
+    assert(1 == io_prefetch_defer(&con));
+    io_job = test_job;
+    io_prefetch_detach(&con);
+    assert(NULL == con.io_prefetch);
+    assert(NULL == io_job->r);
+    test_io_prefetch_run();
+    const int fd = ((io_prefetch_job *)io_job)->fd;
+    assert(-1 != fd);
+    test_io_prefetch_complete();
+    assert(-1 == fcntl(fd, F_GETFD)); /*(closed)*/
+    assert(-1 == c.file.fd);
+
+    io_prefetch_free();
+    buffer_free(c.mem);
+}
+
+#endif /* IO_PREFETCH */
+
+int main (void) {
+  #ifdef IO_PREFETCH
+    char fn[] = "/tmp/lighttpd_test_io_prefetch.XXXXXX";
+    const int fd = mkstemp(fn);
+    assert(fd >= 0);
+    char buf[4096];
+    memset(buf, 'x', sizeof(buf));
+    for (off_t o = 0; o < 3 * IO_PREFETCH_WINDOW + 1000; o += sizeof(buf))
+        assert(sizeof(buf) == (size_t)write(fd, buf, sizeof(buf)));
+    fsync(fd);
+    close(fd);
+
+    test_io_prefetch_defer(fn);
+    test_io_prefetch_open(fn);
+
+    unlink(fn);
+    array_free_data(&plugin_stats);
+  #endif
+    return 0;
+}
+
+/*
+ * stub functions
+ */
+
+array plugin_stats;
+
+static int test_pool;
+
+void async_pool_free (async_pool *pool) {
+    assert(NULL == pool || pool == (async_pool *)&test_pool);
+}
+
+#ifdef IO_PREFETCH
+
+async_pool * async_pool_init (const char *name, unsigned int nthreads, void *(*tctx_init)(void *ctx), void (*tctx_free)(void *tctx), void *ctx) {
+    UNUSED(name);
+    UNUSED(nthreads);
+    UNUSED(tctx_init);
+    UNUSED(tctx_free);
+    UNUSED(ctx);
+    return (async_pool *)&test_pool;
+}
+
+int async_pool_submit (async_pool *pool, request_st *r, async_job *job) {
+    assert(pool == (async_pool *)&test_pool);
+    assert(NULL == test_job);
+    job->r = r;
+    job->done = 0;
+    job->next = NULL;
+    test_job = job;
+    ++test_submitted;
+    return 1; /* queued */
+}
+
+void async_job_detach (async_job *job) {
+    if (job->done)
+        job->free(job);
+    else
+        job->r = NULL;
+}
+
+int fdevent_open_cloexec(const char *pathname, int symlinks, int flags, mode_t mode) {
+    UNUSED(symlinks);
+    return open(pathname, flags | O_CLOEXEC, mode);
+}
+
+void fdevent_setfd_cloexec(int fd) {
+    UNUSED(fd);
+}
+
+void connection_list_append(connections *conns, connection *con) {
+    UNUSED(conns);
+    UNUSED(con);
+    ++test_joblist_appended;
+}
+
+#endif /* IO_PREFETCH */
@@ -0,0 +1,126 @@
+#include "first.h"
+
+#undef NDEBUG
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>     /* STDERR_FILENO */
+
+#include "ipset.h"
+#include "log.h"
+
+static int test_ipset_contains_str (const ipset *s, const char *str) {
+    sock_addr addr;
+    if (1 != sock_addr_inet_pton(&addr, str, AF_INET, 0)) {
+      #ifdef HAVE_IPV6
+        assert(1 == sock_addr_inet_pton(&addr, str, AF_INET6, 0));
+      #else
+        assert(0);
+      #endif
+    }
+    return ipset_contains(s, &addr);
+}
+
+static void test_ipset_insert (log_error_st * const errh) {
+    ipset * const s = ipset_init();
+
+    assert(!test_ipset_contains_str(s, "10.0.0.1"));
+
+    assert(ipset_insert_list(s, "10.0.0.0/8, 192.168.1.0/24 172.16.5.5", errh));
+    assert(test_ipset_contains_str(s, "10.0.0.1"));
+    assert(test_ipset_contains_str(s, "10.255.255.255"));
+    assert(!test_ipset_contains_str(s, "11.0.0.1"));
+    assert(test_ipset_contains_str(s, "192.168.1.77"));
+    assert(!test_ipset_contains_str(s, "192.168.2.77"));
+    assert(test_ipset_contains_str(s, "172.16.5.5"));
+    assert(!test_ipset_contains_str(s, "172.16.5.4"));
+
+    /* overlapping and nested prefixes, inserted in various orders */
+    assert(ipset_insert_list(s, "192.168.0.0/23", errh));
+    assert(test_ipset_contains_str(s, "192.168.0.1"));
+    assert(test_ipset_contains_str(s, "192.168.1.1"));
+    assert(!test_ipset_contains_str(s, "192.168.2.1"));
+    assert(ipset_insert_list(s, "172.16.5.6/31", errh));
+    assert(test_ipset_contains_str(s, "172.16.5.7"));
+    assert(!test_ipset_contains_str(s, "172.16.5.8"));
+
+    /* many prefixes */
+    char str[32];
+    for (int i = 0; i < 4096; ++i) {
+        snprintf(str, sizeof(str), "100.%d.%d.0/24", i >> 4, (i & 0xF) << 4);
+        assert(ipset_insert_str(s, str, strlen(str), errh));
+    }
+    assert(test_ipset_contains_str(s, "100.0.0.9"));
+    assert(test_ipset_contains_str(s, "100.255.240.9"));
+    assert(!test_ipset_contains_str(s, "100.255.241.9"));
+    assert(test_ipset_contains_str(s, "10.0.0.1"));
+
+  #ifdef HAVE_IPV6
+    assert(ipset_insert_list(s, "2001:db8::/32", errh));
+    assert(test_ipset_contains_str(s, "2001:db8::1"));
+    assert(!test_ipset_contains_str(s, "2001:db9::1"));
+    /* IPv4 prefix matches IPv4-mapped IPv6 addr */
+    assert(test_ipset_contains_str(s, "::ffff:10.1.2.3"));
+    assert(!test_ipset_contains_str(s, "::ffff:11.1.2.3"));
+  #endif
+
+    assert(!ipset_insert_list(s, "10.0.0.0/33", errh));
+    assert(!ipset_insert_list(s, "10.0.0.0/-1", errh));
+    assert(!ipset_insert_list(s, "10.0.0.0/", errh));
+    assert(!ipset_insert_list(s, "10.0.0.0/x", errh));
+    assert(!ipset_insert_list(s, "not-an-addr", errh));
+
+    ipset_free(s);
+}
+
+static void test_ipset_zero_prefix (log_error_st * const errh) {
+    /* /0 matches every addr of the same family */
+    ipset * const s = ipset_init();
+    assert(ipset_insert_list(s, "0.0.0.0/0", errh));
+    assert(test_ipset_contains_str(s, "0.0.0.0"));
+    assert(test_ipset_contains_str(s, "10.0.0.1"));
+    assert(test_ipset_contains_str(s, "255.255.255.255"));
+  #ifdef HAVE_IPV6
+    assert(test_ipset_contains_str(s, "::ffff:10.1.2.3"));
+    assert(!test_ipset_contains_str(s, "2001:db8::1"));
+    assert(ipset_insert_list(s, "::/0", errh));
+    assert(test_ipset_contains_str(s, "2001:db8::1"));
+    assert(test_ipset_contains_str(s, "::1"));
+  #endif
+    ipset_free(s);
+}
+
+static void test_ipset_load_file (log_error_st * const errh) {
+    char fn[] = "/tmp/lighttpd_test_ipset.XXXXXX";
+    const int fd = mkstemp(fn);
+    assert(fd >= 0);
+    static const char data[] =
+      "# comment\n"
+      "\n"
+      "10.1.0.0/16  # trailing comment\n"
+      "  192.0.2.1\n";
+    assert((ssize_t)sizeof(data)-1 == write(fd, data, sizeof(data)-1));
+    close(fd);
+
+    ipset * const s = ipset_init();
+    assert(ipset_load_file(s, fn, errh));
+    assert(2 == s->count);
+    assert(test_ipset_contains_str(s, "10.1.2.3"));
+    assert(!test_ipset_contains_str(s, "10.2.2.3"));
+    assert(test_ipset_contains_str(s, "192.0.2.1"));
+    ipset_free(s);
+    unlink(fn);
+}
+
+int main (void) {
+    log_error_st * const errh = log_error_st_init();
+    errh->errorlog_fd = -1; /* (disable) */
+
+    test_ipset_insert(errh);
+    test_ipset_zero_prefix(errh);
+    test_ipset_load_file(errh);
+
+    log_error_st_free(errh);
+    return 0;
+}
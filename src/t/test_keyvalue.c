@@ -11,7 +11,7 @@
 #include "base.h"   /* struct server */
 #include "plugin_config.h" /* struct cond_match_t */
 
-#ifdef HAVE_PCRE_H
+#ifdef HAVE_PCRE
 static pcre_keyvalue_buffer * test_keyvalue_test_kvb_init (void) {
     pcre_keyvalue_buffer *kvb = pcre_keyvalue_buffer_init();
 
@@ -29,10 +29,10 @@ static pcre_keyvalue_buffer * test_keyvalue_test_kvb_init (void) {
       { "/?file=$1&$2",            sizeof("/?file=$1&$2"), 0 }
     };
 
-    assert(pcre_keyvalue_buffer_append(errh, kvb, kvstr+0, kvstr+1));
-    assert(pcre_keyvalue_buffer_append(errh, kvb, kvstr+2, kvstr+3));
-    assert(pcre_keyvalue_buffer_append(errh, kvb, kvstr+4, kvstr+5));
-    assert(pcre_keyvalue_buffer_append(errh, kvb, kvstr+6, kvstr+7));
+    assert(pcre_keyvalue_buffer_append(errh, kvb, kvstr+0, kvstr+1, 1));
+    assert(pcre_keyvalue_buffer_append(errh, kvb, kvstr+2, kvstr+3, 1));
+    assert(pcre_keyvalue_buffer_append(errh, kvb, kvstr+4, kvstr+5, 1));
+    assert(pcre_keyvalue_buffer_append(errh, kvb, kvstr+6, kvstr+7, 1));
 
     log_error_st_free(errh);
 
@@ -117,11 +117,46 @@ static void test_keyvalue_pcre_keyvalue_buffer_process (void) {
     buffer_free(query);
     pcre_keyvalue_buffer_free(kvb);
 }
+
+static void test_keyvalue_pcre_keyvalue_literal_prefix (void) {
+    static const struct {
+      const char *re;
+      const char *pfx;
+    } tests[] = {
+      { "^/foo($|\\?.+)",         "/foo" }
+     ,{ "^/a\\.b/c",               "/a.b/c" }
+     ,{ "^/abc?",                  "/ab" }
+     ,{ "^/ab+c",                  "/ab" }
+     ,{ "^/ab{2}",                 "/a" }
+     ,{ "^/a\\d",                  "/a" }
+     ,{ "/foo",                    "" }
+     ,{ "^/foo|^/bar",             "" }
+     ,{ "^/foo(a|b)",              "/foo" }
+     ,{ "^/foo[|]",                "/foo" }
+     ,{ "^/foo[]|]",               "/foo" }
+     ,{ "^/foo[[:alpha:]]",        "" }
+     ,{ "^/foo\\Q|\\E",            "" }
+     ,{ "^/f o(?x)",               "" }
+     ,{ "^/foo(?#|)",              "" }
+    };
+    char pfx[256];
+    buffer b;
+
+    for (uint32_t i = 0; i < sizeof(tests)/sizeof(*tests); ++i) {
+        b.ptr = (char *)tests[i].re;
+        b.used = strlen(tests[i].re)+1;
+        b.size = 0;
+        uint32_t n = pcre_keyvalue_literal_prefix(&b, pfx, sizeof(pfx));
+        assert(n == strlen(tests[i].pfx));
+        assert(0 == memcmp(pfx, tests[i].pfx, n));
+    }
+}
 #endif
 
 int main (void) {
-  #ifdef HAVE_PCRE_H
+  #ifdef HAVE_PCRE
     test_keyvalue_pcre_keyvalue_buffer_process();
+    test_keyvalue_pcre_keyvalue_literal_prefix();
   #endif
     return 0;
 }
@@ -0,0 +1,210 @@
+#include "first.h"
+
+#undef NDEBUG
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "mod_authn_file.c"
+
+static void test_mod_authn_file_write(const char * const fn, const char * const data, const size_t len) {
+    const int fd = open(fn, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    assert(fd >= 0);
+    assert((ssize_t)len == write(fd, data, len));
+    assert(0 == close(fd));
+}
+
+static int test_mod_authn_file_htpasswd_lookup(authn_file_db * const db, const char * const user, buffer * const pw, log_error_st * const errh) {
+    buffer_clear(pw);
+    return mod_authn_file_htpasswd_get(db, user, strlen(user), pw, errh);
+}
+
+static void test_mod_authn_file_htpasswd(log_error_st * const errh) {
+    char fn[] = "/tmp/lighttpd_test_authn_file.XXXXXX";
+    const int fd = mkstemp(fn);
+    assert(fd >= 0);
+    close(fd);
+
+    static const char data[] =
+      "# comment\n"
+      "\n"
+      "alice:pw-alice\n"
+      "bad line without separator\n"
+      "bob:pw-bob\n"
+      "alice:pw-alice-dup\n"
+      "carol:\n"
+      "dave:pw:with:colons";  /*(no trailing newline)*/
+    test_mod_authn_file_write(fn, CONST_STR_LEN(data));
+
+    authn_file_db db;
+    memset(&db, 0, sizeof(db));
+    buffer * const b = buffer_init_string(fn);
+    db.fn = b;
+    buffer * const pw = buffer_init();
+
+    assert(0 == test_mod_authn_file_htpasswd_lookup(&db, "alice", pw, errh));
+    assert(buffer_is_equal_string(pw, CONST_STR_LEN("pw-alice"))); /*(first)*/
+    assert(0 == test_mod_authn_file_htpasswd_lookup(&db, "bob", pw, errh));
+    assert(buffer_is_equal_string(pw, CONST_STR_LEN("pw-bob")));
+    assert(0 == test_mod_authn_file_htpasswd_lookup(&db, "carol", pw, errh));
+    assert(buffer_string_is_empty(pw));
+    assert(0 == test_mod_authn_file_htpasswd_lookup(&db, "dave", pw, errh));
+    assert(buffer_is_equal_string(pw, CONST_STR_LEN("pw:with:colons")));
+    assert(-1 == test_mod_authn_file_htpasswd_lookup(&db, "eve", pw, errh));
+    assert(-1 == test_mod_authn_file_htpasswd_lookup(&db, "alic", pw, errh));
+    assert(-1 == test_mod_authn_file_htpasswd_lookup(&db, "# comment", pw, errh));
+    assert(5 == db.used);
+    const char * const loaded = db.data;
+
+    /* unchanged file is not reloaded */
+    assert(0 == test_mod_authn_file_htpasswd_lookup(&db, "bob", pw, errh));
+    assert(loaded == db.data);
+
+    /* changed file is reloaded; many entries (hash table collisions) */
+    buffer * const tb = buffer_init();
+    for (int i = 0; i < 2000; ++i) {
+        char line[64];
+        const int n = snprintf(line, sizeof(line), "user%d:pw%d\n", i, i);
+        buffer_append_string_len(tb, line, (size_t)n);
+    }
+    test_mod_authn_file_write(fn, CONST_BUF_LEN(tb));
+    assert(-1 == test_mod_authn_file_htpasswd_lookup(&db, "alice", pw, errh));
+    assert(2000 == db.used);
+    for (int i = 0; i < 2000; i += 7) {
+        char user[32], pwd[32];
+        snprintf(user, sizeof(user), "user%d", i);
+        const int n = snprintf(pwd, sizeof(pwd), "pw%d", i);
+        assert(0 == test_mod_authn_file_htpasswd_lookup(&db, user, pw, errh));
+        assert(buffer_is_equal_string(pw, pwd, (size_t)n));
+    }
+    assert(0 == test_mod_authn_file_htpasswd_lookup(&db, "user1999", pw, errh));
+
+    /* missing file */
+    unlink(fn);
+    assert(-1 == test_mod_authn_file_htpasswd_lookup(&db, "user1", pw, errh));
+
+    mod_authn_file_db_clear(&db);
+    buffer_free(tb);
+    buffer_free(pw);
+    buffer_free(b);
+}
+
+static void test_mod_authn_file_htdigest(log_error_st * const errh) {
+    char fn[] = "/tmp/lighttpd_test_authn_file.XXXXXX";
+    const int fd = mkstemp(fn);
+    assert(fd >= 0);
+    close(fd);
+
+    static const char data[] =
+      "alice:realm1:0123456789abcdef0123456789abcdef\n"
+      "alice:realm2:00112233445566778899aabbccddeeff\n"
+      "bob:realm1:0123\n"  /*(digest length mismatch; skipped)*/
+      "bob:realm1:ffeeddccbbaa99887766554433221100\n"
+      "carol-no-realm:ffeeddccbbaa99887766554433221100\n";
+    test_mod_authn_file_write(fn, CONST_STR_LEN(data));
+
+    authn_file_db db;
+    memset(&db, 0, sizeof(db));
+    buffer * const b = buffer_init_string(fn);
+    db.fn = b;
+    db.realm = 1;
+
+    plugin_data p;
+    memset(&p, 0, sizeof(p));
+    p.defaults.auth_htdigest_userfile = &db;
+    request_st r;
+    memset(&r, 0, sizeof(r));
+    r.conf.errh = errh;
+
+    http_auth_info_t ai;
+    memset(&ai, 0, sizeof(ai));
+    ai.dalgo = HTTP_AUTH_DIGEST_MD5;
+    ai.dlen = 16;
+
+    ai.username = "alice";
+    ai.ulen = 5;
+    ai.realm = "realm2";
+    ai.rlen = 6;
+    assert(0 == mod_authn_file_htdigest_get(&r, &p, &ai));
+    assert(0x00 == ai.digest[0] && 0x11 == ai.digest[1] && 0xff == ai.digest[15]);
+    ai.realm = "realm1";
+    assert(0 == mod_authn_file_htdigest_get(&r, &p, &ai));
+    assert(0x01 == ai.digest[0] && 0xef == ai.digest[15]);
+    ai.realm = "realm3";
+    assert(-1 == mod_authn_file_htdigest_get(&r, &p, &ai));
+
+    ai.username = "bob";
+    ai.ulen = 3;
+    ai.realm = "realm1";
+    assert(0 == mod_authn_file_htdigest_get(&r, &p, &ai));
+    assert(0xff == ai.digest[0] && 0x00 == ai.digest[15]);
+
+    ai.username = "carol-no-realm";
+    ai.ulen = sizeof("carol-no-realm")-1;
+    assert(-1 == mod_authn_file_htdigest_get(&r, &p, &ai));
+
+    unlink(fn);
+    mod_authn_file_db_clear(&db);
+    buffer_free(b);
+}
+
+int main (void) {
+    log_error_st * const errh = log_error_st_init();
+    errh->errorlog_fd = -1; /* (disable) */
+
+    test_mod_authn_file_htpasswd(errh);
+    test_mod_authn_file_htdigest(errh);
+
+    log_error_st_free(errh);
+    return 0;
+}
+
+/*
+ * stub functions
+ */
+
+stat_cache_entry * stat_cache_get_entry(const buffer *name) {
+    static stat_cache_entry sce;
+    return (0 == stat(name->ptr, &sce.st)) ? &sce : NULL;
+}
+
+char * fdevent_load_file (const char * const fn, off_t *lim, log_error_st *errh, void *(malloc_fn)(size_t), void(free_fn)(void *)) {
+    UNUSED(errh);
+    UNUSED(free_fn);
+    struct stat st;
+    const int fd = open(fn, O_RDONLY);
+    if (fd < 0) return NULL;
+    assert(0 == fstat(fd, &st) && st.st_size < *lim);
+    char * const buf = malloc_fn((size_t)st.st_size + 1);
+    assert(buf);
+    assert(st.st_size == read(fd, buf, (size_t)st.st_size));
+    close(fd);
+    buf[st.st_size] = '\0';
+    *lim = st.st_size;
+    return buf;
+}
+
+int config_plugin_values_init(server *srv, void *p_d, const config_plugin_keys_t *cpk, const char *mname) {
+    UNUSED(srv);
+    UNUSED(p_d);
+    UNUSED(cpk);
+    UNUSED(mname);
+    return 0;
+}
+
+int config_check_cond(request_st *r, int context_ndx) {
+    UNUSED(r);
+    UNUSED(context_ndx);
+    return 0;
+}
+
+int config_check_cond_next(request_st *r, const config_plugin_value_t *cvlist, int i, int used) {
+    UNUSED(r);
+    UNUSED(cvlist);
+    UNUSED(i);
+    return used;
+}
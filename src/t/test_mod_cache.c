@@ -0,0 +1,399 @@
+#include "first.h"
+
+#undef NDEBUG
+#include <sys/types.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "mod_cache.c"
+
+static int test_joblist_appended;
+static buffer *test_output;
+static plugin test_proxy;
+
+typedef struct {
+    connection con;
+    request_st r;
+    void *plugin_ctx[1];
+    chunkqueue cq;
+    chunk c;
+} test_request;
+
+static int test_mod_cache_counter (const char * const k, const size_t klen) {
+    const data_integer * const di =
+      (const data_integer *)array_get_element_klen(&plugin_stats, k, klen);
+    return di ? di->value : 0;
+}
+
+static void test_mod_cache_request_init (test_request * const t, server * const srv, const char * const target) {
+    memset(t, 0, sizeof(*t));
+    t->con.srv = srv;
+    t->r.con = &t->con;
+    t->r.plugin_ctx = t->plugin_ctx;
+    t->r.write_queue = &t->cq;
+    t->r.http_method = HTTP_METHOD_GET;
+    buffer_copy_string_len(&t->r.uri.scheme, CONST_STR_LEN("http"));
+    buffer_copy_string_len(&t->r.uri.authority, CONST_STR_LEN("example.com"));
+    buffer_copy_string(&t->r.target, target);
+}
+
+static void test_mod_cache_request_free (test_request * const t) {
+    free(t->r.uri.scheme.ptr);
+    free(t->r.uri.authority.ptr);
+    free(t->r.target.ptr);
+    buffer_free(t->c.mem);
+    array_free_data(&t->r.rqst_headers);
+    array_free_data(&t->r.resp_headers);
+}
+
+static void test_mod_cache_request_reset (test_request * const t) {
+    /* reset response (e.g. before request is processed again) */
+    t->r.http_status = 0;
+    t->r.resp_body_finished = 0;
+    t->r.async_callback = 0;
+    t->r.handler_module = NULL;
+    t->r.resp_htags = 0;
+    array_reset_data_strings(&t->r.resp_headers);
+    buffer_clear(test_output);
+}
+
+static void test_mod_cache_response (test_request * const t, const char * const cc, const char * const body) {
+    /* response from backend */
+    t->r.handler_module = &test_proxy;
+    t->r.http_status = 200;
+    if (cc)
+        http_header_response_set(&t->r, HTTP_HEADER_CACHE_CONTROL,
+                                 CONST_STR_LEN("Cache-Control"),
+                                 cc, strlen(cc));
+    t->c.type = MEM_CHUNK;
+    t->c.mem = buffer_init_string(body);
+    t->cq.first = t->cq.last = &t->c;
+    t->r.resp_body_finished = 1;
+}
+
+static void test_mod_cache_collapse (plugin_data * const p, server * const srv) {
+    test_request t[4];
+    for (int i = 0; i < 4; ++i)
+        test_mod_cache_request_init(t+i, srv, "/collapse");
+
+    /* first request to miss cache is sent to backend (leader) */
+    assert(HANDLER_GO_ON == mod_cache_uri_handler(&t[0].r, p));
+    handler_ctx * const leader = t[0].plugin_ctx[0];
+    assert(NULL != leader && CACHE_COLLAPSE_LEADER == leader->collapse);
+    assert(NULL != p->pending_list && NULL == p->pending_list->next);
+
+    /* concurrent requests for same response wait for leader */
+    for (int i = 1; i < 4; ++i) {
+        assert(HANDLER_WAIT_FOR_EVENT == mod_cache_uri_handler(&t[i].r, p));
+        handler_ctx * const hctx = t[i].plugin_ctx[0];
+        assert(NULL != hctx && CACHE_COLLAPSE_WAITING == hctx->collapse);
+    }
+    /* (waiting request processed again before leader response received) */
+    assert(HANDLER_WAIT_FOR_EVENT == mod_cache_uri_handler(&t[1].r, p));
+    assert(0 == test_joblist_appended);
+
+    /* waiter reset is removed from waiters of leader */
+    assert(HANDLER_GO_ON == mod_cache_handle_request_reset(&t[3].r, p));
+    assert(NULL == t[3].plugin_ctx[0]);
+
+    /* response of leader stored in cache and shared with waiters */
+    test_mod_cache_response(&t[0], "max-age=60", "collapsed response");
+    assert(HANDLER_GO_ON == mod_cache_handle_response_start(&t[0].r, p));
+    assert(NULL == t[0].plugin_ctx[0]);
+    assert(NULL == p->pending_list && NULL == p->pending);
+    assert(2 == test_joblist_appended);
+    const int collapsed =
+      test_mod_cache_counter(CONST_STR_LEN("cache.collapsed"));
+    for (int i = 1; i < 3; ++i) {
+        assert(1 == t[i].r.async_callback);
+        handler_ctx * const hctx = t[i].plugin_ctx[0];
+        assert(CACHE_COLLAPSE_RELEASED == hctx->collapse && NULL != hctx->ce);
+        test_mod_cache_request_reset(&t[i]);
+        assert(HANDLER_FINISHED == mod_cache_uri_handler(&t[i].r, p));
+        assert(NULL == t[i].plugin_ctx[0]);
+        assert(200 == t[i].r.http_status);
+        assert(buffer_is_equal_string(test_output,
+                                      CONST_STR_LEN("collapsed response")));
+    }
+    assert(collapsed + 2
+           == test_mod_cache_counter(CONST_STR_LEN("cache.collapsed")));
+    assert(0 == t[3].r.async_callback);
+
+    /* later request is served from cache (not collapsed) */
+    test_mod_cache_request_reset(&t[3]);
+    assert(HANDLER_FINISHED == mod_cache_uri_handler(&t[3].r, p));
+    assert(collapsed + 2
+           == test_mod_cache_counter(CONST_STR_LEN("cache.collapsed")));
+
+    for (int i = 0; i < 4; ++i)
+        test_mod_cache_request_free(t+i);
+    test_joblist_appended = 0;
+}
+
+static void test_mod_cache_collapse_release (plugin_data * const p, server * const srv) {
+    test_request t[2];
+    test_mod_cache_request_init(t+0, srv, "/private");
+    test_mod_cache_request_init(t+1, srv, "/private");
+
+    /* response not cacheable; waiter is sent to backend independently */
+    assert(HANDLER_GO_ON == mod_cache_uri_handler(&t[0].r, p));
+    assert(HANDLER_WAIT_FOR_EVENT == mod_cache_uri_handler(&t[1].r, p));
+    test_mod_cache_response(&t[0], "private, max-age=60", "private response");
+    assert(HANDLER_GO_ON == mod_cache_handle_response_start(&t[0].r, p));
+    assert(1 == test_joblist_appended);
+    assert(HANDLER_GO_ON == mod_cache_uri_handler(&t[1].r, p));
+    handler_ctx *hctx = t[1].plugin_ctx[0];
+    assert(NULL != hctx && CACHE_COLLAPSE_RELEASED == hctx->collapse);
+    assert(NULL == p->pending_list); /*(released waiter does not lead)*/
+    assert(HANDLER_GO_ON == mod_cache_handle_request_reset(&t[1].r, p));
+    test_mod_cache_request_free(t+0);
+    test_mod_cache_request_free(t+1);
+
+    /* response must be revalidated upon each use; not shared */
+    test_mod_cache_request_init(t+0, srv, "/no-cache");
+    test_mod_cache_request_init(t+1, srv, "/no-cache");
+    assert(HANDLER_GO_ON == mod_cache_uri_handler(&t[0].r, p));
+    assert(HANDLER_WAIT_FOR_EVENT == mod_cache_uri_handler(&t[1].r, p));
+    test_mod_cache_response(&t[0], "no-cache", "must revalidate");
+    http_header_response_set(&t[0].r, HTTP_HEADER_ETAG, CONST_STR_LEN("ETag"),
+                             CONST_STR_LEN("\"1\""));
+    assert(HANDLER_GO_ON == mod_cache_handle_response_start(&t[0].r, p));
+    hctx = t[1].plugin_ctx[0];
+    assert(NULL != hctx->ce); /*(stored, but not fresh)*/
+    assert(HANDLER_GO_ON == mod_cache_uri_handler(&t[1].r, p));
+    assert(0 == t[1].r.http_status);
+    hctx = t[1].plugin_ctx[0];
+    assert(NULL != hctx->ce); /*(revalidating stale entry with backend)*/
+    assert(HANDLER_GO_ON == mod_cache_handle_request_reset(&t[1].r, p));
+    test_mod_cache_request_free(t+0);
+    test_mod_cache_request_free(t+1);
+
+    /* response varies on request header not matching that of waiter */
+    test_mod_cache_request_init(t+0, srv, "/vary");
+    test_mod_cache_request_init(t+1, srv, "/vary");
+    http_header_request_set(&t[0].r, HTTP_HEADER_OTHER,
+                            CONST_STR_LEN("Accept-Language"),
+                            CONST_STR_LEN("en"));
+    http_header_request_set(&t[1].r, HTTP_HEADER_OTHER,
+                            CONST_STR_LEN("Accept-Language"),
+                            CONST_STR_LEN("de"));
+    assert(HANDLER_GO_ON == mod_cache_uri_handler(&t[0].r, p));
+    assert(HANDLER_WAIT_FOR_EVENT == mod_cache_uri_handler(&t[1].r, p));
+    test_mod_cache_response(&t[0], "max-age=60", "english");
+    http_header_response_set(&t[0].r, HTTP_HEADER_VARY, CONST_STR_LEN("Vary"),
+                             CONST_STR_LEN("Accept-Language"));
+    assert(HANDLER_GO_ON == mod_cache_handle_response_start(&t[0].r, p));
+    test_mod_cache_request_reset(&t[1]);
+    assert(HANDLER_GO_ON == mod_cache_uri_handler(&t[1].r, p));
+    assert(0 == t[1].r.http_status);
+    assert(HANDLER_GO_ON == mod_cache_handle_request_reset(&t[1].r, p));
+    /* (request with matching header value is served from cache) */
+    test_mod_cache_request_reset(&t[0]);
+    assert(HANDLER_FINISHED == mod_cache_uri_handler(&t[0].r, p));
+    assert(buffer_is_equal_string(test_output, CONST_STR_LEN("english")));
+    test_mod_cache_request_free(t+0);
+    test_mod_cache_request_free(t+1);
+
+    /* leader reset; waiter is sent to backend independently */
+    test_mod_cache_request_init(t+0, srv, "/reset");
+    test_mod_cache_request_init(t+1, srv, "/reset");
+    test_joblist_appended = 0;
+    assert(HANDLER_GO_ON == mod_cache_uri_handler(&t[0].r, p));
+    assert(HANDLER_WAIT_FOR_EVENT == mod_cache_uri_handler(&t[1].r, p));
+    assert(HANDLER_GO_ON == mod_cache_handle_request_reset(&t[0].r, p));
+    assert(NULL == p->pending_list);
+    assert(1 == test_joblist_appended);
+    hctx = t[1].plugin_ctx[0];
+    assert(CACHE_COLLAPSE_RELEASED == hctx->collapse && NULL == hctx->ce);
+    assert(HANDLER_GO_ON == mod_cache_uri_handler(&t[1].r, p));
+    assert(HANDLER_GO_ON == mod_cache_handle_request_reset(&t[1].r, p));
+    test_mod_cache_request_free(t+0);
+    test_mod_cache_request_free(t+1);
+
+    test_joblist_appended = 0;
+}
+
+static void test_mod_cache_collapse_timeout (plugin_data * const p, server * const srv) {
+    test_request t[3];
+    for (int i = 0; i < 3; ++i)
+        test_mod_cache_request_init(t+i, srv, "/slow");
+
+    assert(HANDLER_GO_ON == mod_cache_uri_handler(&t[0].r, p));
+    assert(HANDLER_WAIT_FOR_EVENT == mod_cache_uri_handler(&t[1].r, p));
+
+    /* waiters released after cache.collapse-timeout */
+    const int timeouts =
+      test_mod_cache_counter(CONST_STR_LEN("cache.collapse-timeouts"));
+    log_epoch_secs += p->collapse_timeout - 1;
+    mod_cache_trigger(srv, p);
+    assert(0 == test_joblist_appended);
+    log_epoch_secs += 1;
+    mod_cache_trigger(srv, p);
+    assert(1 == test_joblist_appended);
+    assert(timeouts + 1
+           == test_mod_cache_counter(CONST_STR_LEN("cache.collapse-timeouts")));
+    assert(HANDLER_GO_ON == mod_cache_uri_handler(&t[1].r, p));
+
+    /* later requests do not wait for timed out leader */
+    assert(HANDLER_GO_ON == mod_cache_uri_handler(&t[2].r, p));
+    handler_ctx * const hctx = t[2].plugin_ctx[0];
+    assert(CACHE_COLLAPSE_NONE == hctx->collapse);
+    log_epoch_secs += 100;
+    mod_cache_trigger(srv, p);
+    assert(1 == test_joblist_appended);
+
+    /* leader still pending; response stored when received */
+    test_mod_cache_response(&t[0], "max-age=60", "slow response");
+    assert(HANDLER_GO_ON == mod_cache_handle_response_start(&t[0].r, p));
+    assert(NULL == p->pending_list);
+    assert(HANDLER_GO_ON == mod_cache_handle_request_reset(&t[1].r, p));
+    assert(HANDLER_GO_ON == mod_cache_handle_request_reset(&t[2].r, p));
+    test_mod_cache_request_reset(&t[2]);
+    assert(HANDLER_FINISHED == mod_cache_uri_handler(&t[2].r, p));
+    assert(buffer_is_equal_string(test_output, CONST_STR_LEN("slow response")));
+
+    for (int i = 0; i < 3; ++i)
+        test_mod_cache_request_free(t+i);
+    test_joblist_appended = 0;
+}
+
+static void test_mod_cache_collapse_disabled (plugin_data * const p, server * const srv) {
+    test_request t[2];
+    test_mod_cache_request_init(t+0, srv, "/disabled");
+    test_mod_cache_request_init(t+1, srv, "/disabled");
+
+    /* cache.collapse disabled; concurrent requests sent to backend */
+    p->defaults.collapse = 0;
+    assert(HANDLER_GO_ON == mod_cache_uri_handler(&t[0].r, p));
+    assert(HANDLER_GO_ON == mod_cache_uri_handler(&t[1].r, p));
+    assert(NULL == p->pending_list);
+    p->defaults.collapse = 1;
+    for (int i = 0; i < 2; ++i) {
+        assert(HANDLER_GO_ON == mod_cache_handle_request_reset(&t[i].r, p));
+        test_mod_cache_request_free(t+i);
+    }
+
+    /* requests which do not use cache are not collapsed */
+    test_mod_cache_request_init(t+0, srv, "/no-cache-request");
+    test_mod_cache_request_init(t+1, srv, "/no-cache-request");
+    http_header_request_set(&t[0].r, HTTP_HEADER_CACHE_CONTROL,
+                            CONST_STR_LEN("Cache-Control"),
+                            CONST_STR_LEN("no-cache"));
+    http_header_request_set(&t[1].r, HTTP_HEADER_CACHE_CONTROL,
+                            CONST_STR_LEN("Cache-Control"),
+                            CONST_STR_LEN("no-cache"));
+    assert(HANDLER_GO_ON == mod_cache_uri_handler(&t[0].r, p));
+    assert(HANDLER_GO_ON == mod_cache_uri_handler(&t[1].r, p));
+    assert(NULL == p->pending_list);
+
+    for (int i = 0; i < 2; ++i) {
+        assert(HANDLER_GO_ON == mod_cache_handle_request_reset(&t[i].r, p));
+        test_mod_cache_request_free(t+i);
+    }
+}
+
+int main (void) {
+    server srv;
+    memset(&srv, 0, sizeof(srv));
+    log_epoch_secs = 1000000;
+    test_output = buffer_init();
+    test_proxy.name = "proxy";
+
+    plugin_data * const p = mod_cache_init();
+    assert(NULL != p);
+    p->id = 0;
+    p->defaults.enabled = 1;
+    p->defaults.collapse = 1;
+    p->max[0] = 1024 * 1024;
+    p->max_entry = 1024 * 1024;
+    p->collapse_timeout = 5;
+
+    test_mod_cache_collapse(p, &srv);
+    test_mod_cache_collapse_release(p, &srv);
+    test_mod_cache_collapse_timeout(p, &srv);
+    test_mod_cache_collapse_disabled(p, &srv);
+
+    mod_cache_free(p);
+    free(p);
+    buffer_free(test_output);
+    array_free_data(&plugin_stats);
+    return 0;
+}
+
+/*
+ * stub functions
+ */
+
+array plugin_stats;
+
+void connection_list_append(connections *conns, connection *con) {
+    UNUSED(conns);
+    UNUSED(con);
+    ++test_joblist_appended;
+}
+
+off_t chunkqueue_length(chunkqueue *cq) {
+    off_t len = 0;
+    for (const chunk *c = cq->first; c; c = c->next) {
+        assert(MEM_CHUNK == c->type);
+        len += (off_t)buffer_string_length(c->mem) - c->offset;
+    }
+    return len;
+}
+
+int http_chunk_append_mem(request_st *r, const char * mem, size_t len) {
+    UNUSED(r);
+    buffer_append_string_len(test_output, mem, len);
+    return 0;
+}
+
+int http_chunk_append_file_fd(request_st *r, const buffer *fn, int fd, off_t sz) {
+    UNUSED(r);
+    UNUSED(fn);
+    UNUSED(fd);
+    UNUSED(sz);
+    return -1;
+}
+
+void http_response_body_clear(request_st *r, int preserve_length) {
+    UNUSED(r);
+    UNUSED(preserve_length);
+    buffer_clear(test_output);
+}
+
+const buffer * strftime_cache_get(time_t last_mod) {
+    UNUSED(last_mod);
+    static buffer b = { "Thu, 01 Jan 1970 00:00:00 GMT",
+                        sizeof("Thu, 01 Jan 1970 00:00:00 GMT"), 0 };
+    return &b;
+}
+
+int fdevent_open_cloexec(const char *pathname, int symlinks, int flags, mode_t mode) {
+    UNUSED(pathname);
+    UNUSED(symlinks);
+    UNUSED(flags);
+    UNUSED(mode);
+    return -1;
+}
+
+int fdevent_mkstemp_append(char *path) {
+    UNUSED(path);
+    return -1;
+}
+
+int config_plugin_values_init(server *srv, void *p_d, const config_plugin_keys_t *cpk, const char *mname) {
+    UNUSED(srv);
+    UNUSED(p_d);
+    UNUSED(cpk);
+    UNUSED(mname);
+    return 0;
+}
+
+int config_check_cond_next(request_st *r, const config_plugin_value_t *cvlist, int i, int used) {
+    UNUSED(r);
+    UNUSED(cvlist);
+    UNUSED(i);
+    return used;
+}
@@ -0,0 +1,349 @@
+#include "first.h"
+
+#undef NDEBUG
+#include <sys/types.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "mod_deflate.c"
+
+static buffer *test_output;
+
+static int test_mod_deflate_counter (const char * const k, const size_t klen) {
+    const data_integer * const di =
+      (const data_integer *)array_get_element_klen(&plugin_stats, k, klen);
+    return di ? di->value : -1;
+}
+
+static void test_mod_deflate_adaptive_level (plugin_data * const p) {
+    const int gzip = HTTP_ACCEPT_ENCODING_GZIP;
+    const off_t mid = 64 KByte;
+
+    p->conf.compression_level = -1;
+    p->conf.compression_level_min = 1;
+
+    /* no pressure: deflate.compression-level (or 9 if not set) */
+    p->pressure = 0;
+    assert(9 == mod_deflate_adaptive_level(p, gzip, mid));
+    p->conf.compression_level = 6;
+    assert(6 == mod_deflate_adaptive_level(p, gzip, mid));
+    assert(6 == mod_deflate_adaptive_level(p, gzip, 1 KByte));
+
+    /* full pressure: deflate.compression-level-min */
+    p->pressure = 1000;
+    assert(1 == mod_deflate_adaptive_level(p, gzip, mid));
+
+    /* level scaled between bounds by pressure */
+    p->pressure = 500;
+    p->conf.compression_level = 9;
+    assert(5 == mod_deflate_adaptive_level(p, gzip, mid));
+    assert(5 == mod_deflate_adaptive_level(p, HTTP_ACCEPT_ENCODING_DEFLATE, mid));
+    assert(5 == mod_deflate_adaptive_level(p, HTTP_ACCEPT_ENCODING_BR, mid));
+
+    /* raised for small responses, lowered for large responses */
+    assert(7 == mod_deflate_adaptive_level(p, gzip, DEFLATE_ADAPTIVE_SMALL));
+    assert(3 == mod_deflate_adaptive_level(p, gzip, DEFLATE_ADAPTIVE_LARGE));
+    p->pressure = 1000;
+    assert(5 == mod_deflate_adaptive_level(p, gzip, 100));
+    assert(1 == mod_deflate_adaptive_level(p, gzip, DEFLATE_ADAPTIVE_LARGE));
+
+    /* min larger than max is limited to max */
+    p->conf.compression_level = 4;
+    p->conf.compression_level_min = 6;
+    assert(4 == mod_deflate_adaptive_level(p, gzip, mid));
+
+    /* bzip2 block size is not adapted */
+    p->conf.compression_level = 3;
+    p->conf.compression_level_min = 1;
+    assert(3 == mod_deflate_adaptive_level(p, HTTP_ACCEPT_ENCODING_BZIP2, mid));
+
+    p->pressure = 0;
+}
+
+static void test_mod_deflate_adaptive_trigger (plugin_data * const p) {
+    /* no-op unless deflate.compression-level-min is configured */
+    p->adaptive = 0;
+    p->busy_usec = 1000000;
+    mod_deflate_trigger(NULL, p);
+    assert(0 == p->pressure);
+    assert(1000000 == p->busy_usec);
+    p->adaptive = 1;
+    p->busy_usec = 0;
+    p->busy_avg = 0;
+
+    /* pressure raised quickly by single long compress call */
+    p->lag_usec = DEFLATE_ADAPTIVE_LAG_HIGH + 1;
+    mod_deflate_trigger(NULL, p);
+    assert(250 == p->pressure);
+    assert(0 == p->lag_usec && 0 == p->busy_usec);
+    assert(250 == test_mod_deflate_counter(CONST_STR_LEN("deflate.pressure")));
+
+    /* pressure raised when smoothed busy time is high; limited to 1000 */
+    int triggers = 0;
+    do {
+        p->busy_usec = 2000000; /*(limited to 1 sec)*/
+        mod_deflate_trigger(NULL, p);
+        assert(p->busy_avg <= 1000000);
+        ++triggers;
+    } while (p->busy_avg <= DEFLATE_ADAPTIVE_BUSY_HIGH);
+    assert(triggers > 1); /*(smoothed; not a single busy second)*/
+    assert(250 + 250 == p->pressure);
+    for (int i = 0; i < 4; ++i) {
+        p->busy_usec = 1000000;
+        mod_deflate_trigger(NULL, p);
+    }
+    assert(1000 == p->pressure);
+
+    /* pressure unchanged between low and high limits */
+    p->busy_avg = (DEFLATE_ADAPTIVE_BUSY_HIGH + DEFLATE_ADAPTIVE_BUSY_LOW) / 2;
+    p->busy_usec = p->busy_avg;
+    mod_deflate_trigger(NULL, p);
+    assert(1000 == p->pressure);
+    p->busy_avg = 0;
+    p->lag_usec = (DEFLATE_ADAPTIVE_LAG_HIGH + DEFLATE_ADAPTIVE_LAG_LOW) / 2;
+    mod_deflate_trigger(NULL, p);
+    assert(1000 == p->pressure);
+
+    /* pressure lowered slowly when idle; not below 0 */
+    mod_deflate_trigger(NULL, p);
+    assert(950 == p->pressure);
+    for (int i = 0; i < 25; ++i)
+        mod_deflate_trigger(NULL, p);
+    assert(0 == p->pressure);
+    assert(0 == test_mod_deflate_counter(CONST_STR_LEN("deflate.pressure")));
+}
+
+static void test_mod_deflate_adaptive_measure (plugin_data * const p) {
+    struct timespec ts0;
+    p->busy_usec = 0;
+    p->lag_usec = 0;
+
+    /* time since ts0 accumulated; longest call recorded */
+    log_clock_gettime_monotonic(&ts0);
+    ts0.tv_sec -= 1;
+    ts0.tv_nsec = 0;
+    mod_deflate_adaptive_measure(p, &ts0);
+    assert(p->busy_usec >= 1000000 && p->busy_usec == p->lag_usec);
+    p->busy_usec = 0;
+    p->lag_usec = 0;
+    log_clock_gettime_monotonic(&ts0);
+    if (ts0.tv_nsec >= 20000000)
+        ts0.tv_nsec -= 20000000;
+    else {
+        --ts0.tv_sec;
+        ts0.tv_nsec += 1000000000 - 20000000;
+    }
+    mod_deflate_adaptive_measure(p, &ts0);
+    const uint32_t u = p->busy_usec;
+    assert(u >= 20000 && u == p->lag_usec);
+    mod_deflate_adaptive_measure(p, &ts0);
+    assert(p->busy_usec >= 2*u && p->lag_usec >= u && p->lag_usec < p->busy_usec);
+
+    /* single call limited to 1 sec; clock stepped backwards is ignored */
+    p->busy_usec = 0;
+    p->lag_usec = 0;
+    ts0.tv_sec -= 100;
+    mod_deflate_adaptive_measure(p, &ts0);
+    assert(1000000 == p->busy_usec && 1000000 == p->lag_usec);
+    ts0.tv_sec += 200;
+    mod_deflate_adaptive_measure(p, &ts0);
+    assert(1000000 == p->busy_usec && 1000000 == p->lag_usec);
+
+    p->busy_usec = 0;
+    p->lag_usec = 0;
+}
+
+static void test_mod_deflate_note_ratio (plugin_data * const p) {
+    request_st r;
+    memset(&r, 0, sizeof(r));
+
+    /* compression ratio and level set in environment; bytes saved counted */
+    p->bytes_saved = 0;
+    mod_deflate_note_ratio(&r, p, 1000, 4000, 6);
+    const buffer *vb;
+    vb = http_header_env_get(&r, CONST_STR_LEN("ratio"));
+    assert(NULL != vb && buffer_is_equal_string(vb, CONST_STR_LEN("25")));
+    vb = http_header_env_get(&r, CONST_STR_LEN("deflate-level"));
+    assert(NULL != vb && buffer_is_equal_string(vb, CONST_STR_LEN("6")));
+    assert(6 == test_mod_deflate_counter(CONST_STR_LEN("deflate.level")));
+    mod_deflate_note_ratio(&r, p, 1024, 1024 + 2000, 0);
+    assert(5000 == p->bytes_saved);
+    assert(4 == test_mod_deflate_counter(CONST_STR_LEN("deflate.kbytes-saved")));
+    assert(6 == test_mod_deflate_counter(CONST_STR_LEN("deflate.level")));
+
+    /* kbytes saved counter clamped to int */
+    p->bytes_saved = (off_t)INT_MAX << 10;
+    mod_deflate_note_ratio(&r, p, 1024, 1024 + 2048, 0);
+    assert(INT_MAX == test_mod_deflate_counter(CONST_STR_LEN("deflate.kbytes-saved")));
+    p->bytes_saved = 0;
+
+    array_free_data(&r.env);
+}
+
+#ifdef USE_ZLIB
+static off_t test_mod_deflate_stream (plugin_data * const p, const int level, const char * const data, const size_t len) {
+    request_st r;
+    memset(&r, 0, sizeof(r));
+    handler_ctx hctx;
+    memset(&hctx, 0, sizeof(hctx));
+    hctx.plugin_data = p;
+    hctx.compression_type = HTTP_ACCEPT_ENCODING_GZIP;
+    hctx.compression_level = level;
+    hctx.r = &r;
+    hctx.cache_fd = -1;
+    buffer_clear(&p->tmp_buf);
+    hctx.output = &p->tmp_buf;
+    buffer_clear(test_output);
+
+    assert(0 == mod_deflate_stream_init(&hctx));
+    assert(0 == mod_deflate_compress(&hctx, (unsigned char *)data, (off_t)len));
+    assert(0 == mod_deflate_stream_flush(&hctx, 1));
+    assert(0 == mod_deflate_stream_end(&hctx));
+    assert((off_t)len == hctx.bytes_in);
+    assert(hctx.bytes_out == (off_t)buffer_string_length(test_output));
+    assert(0x1f == (unsigned char)test_output->ptr[0]); /*(gzip magic)*/
+    return hctx.bytes_out;
+}
+
+static void test_mod_deflate_stream_level (plugin_data * const p) {
+    /* compression level chosen for response is used by encoder */
+    static const char * const words[] = {
+      "lighttpd ", "deflate ", "adaptive ", "level ", "pressure ",
+      "response ", "event ", "loop ", "<div> ", "</div>\n", "0123 ", "x "
+    };
+    buffer * const b = buffer_init();
+    uint32_t x = 1;
+    while (buffer_string_length(b) < 256 KByte) {
+        x = x * 1103515245 + 12345;
+        buffer_append_string(b, words[(x >> 16) % (sizeof(words)/sizeof(*words))]);
+    }
+    const off_t out1 = test_mod_deflate_stream(p, 1, CONST_BUF_LEN(b));
+    const off_t out9 = test_mod_deflate_stream(p, 9, CONST_BUF_LEN(b));
+    assert(out9 < out1);
+    assert(out1 < (off_t)buffer_string_length(b));
+    buffer_free(b);
+}
+#endif
+
+int main (void) {
+    plugin_data * const p = mod_deflate_init();
+    assert(NULL != p);
+    test_output = buffer_init();
+
+    test_mod_deflate_adaptive_level(p);
+    test_mod_deflate_adaptive_trigger(p);
+    test_mod_deflate_adaptive_measure(p);
+    test_mod_deflate_note_ratio(p);
+  #ifdef USE_ZLIB
+    test_mod_deflate_stream_level(p);
+  #endif
+
+    buffer_free(test_output);
+    mod_deflate_free(p);
+    free(p);
+    array_free_data(&plugin_stats);
+    return 0;
+}
+
+/*
+ * stub functions
+ */
+
+array plugin_stats;
+
+int http_chunk_append_mem(request_st *r, const char * mem, size_t len) {
+    UNUSED(r);
+    buffer_append_string_len(test_output, mem, len);
+    return 0;
+}
+
+int http_chunk_append_file(request_st *r, const buffer *fn) {
+    UNUSED(r);
+    UNUSED(fn);
+    return -1;
+}
+
+int http_chunk_append_file_fd(request_st *r, const buffer *fn, int fd, off_t sz) {
+    UNUSED(r);
+    UNUSED(fn);
+    UNUSED(fd);
+    UNUSED(sz);
+    return -1;
+}
+
+void http_response_body_clear(request_st *r, int preserve_length) {
+    UNUSED(r);
+    UNUSED(preserve_length);
+}
+
+chunkqueue *chunkqueue_init(void) {
+    return NULL;
+}
+
+void chunkqueue_free(chunkqueue *cq) {
+    UNUSED(cq);
+}
+
+void chunkqueue_reset(chunkqueue *cq) {
+    UNUSED(cq);
+}
+
+off_t chunkqueue_length(chunkqueue *cq) {
+    UNUSED(cq);
+    return 0;
+}
+
+void chunkqueue_append_chunkqueue(chunkqueue * restrict cq, chunkqueue * restrict src) {
+    UNUSED(cq);
+    UNUSED(src);
+}
+
+void chunkqueue_mark_written(chunkqueue *cq, off_t len) {
+    UNUSED(cq);
+    UNUSED(len);
+}
+
+void chunkqueue_remove_finished_chunks(chunkqueue *cq) {
+    UNUSED(cq);
+}
+
+stat_cache_entry * stat_cache_get_entry(const buffer *name) {
+    UNUSED(name);
+    return NULL;
+}
+
+void stat_cache_invalidate_entry(const char *name, uint32_t len) {
+    UNUSED(name);
+    UNUSED(len);
+}
+
+int fdevent_open_cloexec(const char *pathname, int symlinks, int flags, mode_t mode) {
+    UNUSED(pathname);
+    UNUSED(symlinks);
+    UNUSED(flags);
+    UNUSED(mode);
+    return -1;
+}
+
+int fdevent_rename(const char *oldpath, const char *newpath) {
+    UNUSED(oldpath);
+    UNUSED(newpath);
+    return -1;
+}
+
+int config_plugin_values_init(server *srv, void *p_d, const config_plugin_keys_t *cpk, const char *mname) {
+    UNUSED(srv);
+    UNUSED(p_d);
+    UNUSED(cpk);
+    UNUSED(mname);
+    return 0;
+}
+
+int config_check_cond_next(request_st *r, const config_plugin_value_t *cvlist, int i, int used) {
+    UNUSED(r);
+    UNUSED(cvlist);
+    UNUSED(i);
+    return used;
+}
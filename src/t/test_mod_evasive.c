@@ -0,0 +1,238 @@
+#include "first.h"
+
+#undef NDEBUG
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "mod_evasive.c"
+
+static void test_mod_evasive_addr(sock_addr * const addr, const char * const str) {
+    if (1 != sock_addr_inet_pton(addr, str, AF_INET, 0)) {
+      #ifdef HAVE_IPV6
+        assert(1 == sock_addr_inet_pton(addr, str, AF_INET6, 0));
+      #else
+        assert(0);
+      #endif
+    }
+}
+
+static void test_mod_evasive_ip_key(plugin_data * const p) {
+    sock_addr a, b;
+    uint8_t ka[16], kb[16];
+
+    /* per IP (default prefix) */
+    test_mod_evasive_addr(&a, "10.0.0.1");
+    test_mod_evasive_addr(&b, "10.0.0.2");
+    assert(mod_evasive_ip_key(p, &a, ka));
+    assert(mod_evasive_ip_key(p, &b, kb));
+    assert(0 != memcmp(ka, kb, 16));
+
+    /* clients grouped by network prefix */
+    p->v4_prefix = 24;
+    assert(mod_evasive_ip_key(p, &a, ka));
+    assert(mod_evasive_ip_key(p, &b, kb));
+    assert(0 == memcmp(ka, kb, 16));
+    test_mod_evasive_addr(&b, "10.0.1.2");
+    assert(mod_evasive_ip_key(p, &b, kb));
+    assert(0 != memcmp(ka, kb, 16));
+    p->v4_prefix = 32;
+
+  #ifdef HAVE_IPV6
+    /* IPv4 addr and IPv4-mapped IPv6 addr map to the same key */
+    test_mod_evasive_addr(&b, "::ffff:10.0.0.1");
+    assert(mod_evasive_ip_key(p, &a, ka));
+    assert(mod_evasive_ip_key(p, &b, kb));
+    assert(0 == memcmp(ka, kb, 16));
+
+    p->v6_prefix = 64;
+    test_mod_evasive_addr(&a, "2001:db8::1");
+    test_mod_evasive_addr(&b, "2001:db8::ffff:2");
+    assert(mod_evasive_ip_key(p, &a, ka));
+    assert(mod_evasive_ip_key(p, &b, kb));
+    assert(0 == memcmp(ka, kb, 16));
+    test_mod_evasive_addr(&b, "2001:db8:0:1::1");
+    assert(mod_evasive_ip_key(p, &b, kb));
+    assert(0 != memcmp(ka, kb, 16));
+    p->v6_prefix = 128;
+  #endif
+}
+
+static void test_mod_evasive_ip_table(plugin_data * const p) {
+    sock_addr addr;
+    char str[32];
+    evasive_ip *e[300];
+
+    /* same addr returns same entry; table grows and entries remain found */
+    for (int i = 0; i < 300; ++i) {
+        snprintf(str, sizeof(str), "192.168.%d.%d", i >> 8, i & 0xFF);
+        test_mod_evasive_addr(&addr, str);
+        e[i] = mod_evasive_ip_get(p, &addr);
+        assert(NULL != e[i]);
+    }
+    assert(p->ips.used == 300);
+    assert(p->ips.size >= 300);
+    for (int i = 0; i < 300; ++i) {
+        snprintf(str, sizeof(str), "192.168.%d.%d", i >> 8, i & 0xFF);
+        test_mod_evasive_addr(&addr, str);
+        assert(e[i] == mod_evasive_ip_get(p, &addr));
+    }
+    assert(p->ips.used == 300);
+
+    /* idle entries with no open connections are evicted by periodic timer */
+    e[7]->conns = 1;
+    log_epoch_secs = (log_epoch_secs + EVASIVE_IP_IDLE + 8) & ~(time_t)7;
+    mod_evasive_periodic(NULL, p);
+    assert(p->ips.used == 1);
+    test_mod_evasive_addr(&addr, "192.168.0.7");
+    assert(e[7] == mod_evasive_ip_get(p, &addr));
+    e[7]->conns = 0;
+    log_epoch_secs += EVASIVE_IP_IDLE + 5; /*(not multiple of 8; no-op)*/
+    mod_evasive_periodic(NULL, p);
+    assert(p->ips.used == 1);
+    log_epoch_secs = (log_epoch_secs + 8) & ~(time_t)7;
+    mod_evasive_periodic(NULL, p);
+    assert(p->ips.used == 0);
+}
+
+static void test_mod_evasive_rate_limit(plugin_data * const p) {
+    sock_addr addr;
+    plugin_config pconf;
+    memset(&pconf, 0, sizeof(pconf));
+    pconf.max_rps = 2;
+    pconf.burst = 1;
+
+    test_mod_evasive_addr(&addr, "172.16.0.1");
+    evasive_ip * const e = mod_evasive_ip_get(p, &addr);
+    assert(NULL != e);
+
+    /* bucket starts full: max_rps + burst requests allowed */
+    assert(0 == mod_evasive_rate_limit(&pconf, e));
+    assert(0 == mod_evasive_rate_limit(&pconf, e));
+    assert(0 == mod_evasive_rate_limit(&pconf, e));
+    assert(1 == mod_evasive_rate_limit(&pconf, e));
+    assert(1 == mod_evasive_rate_limit(&pconf, e));
+
+    /* refilled at max_rps tokens per sec */
+    ++log_epoch_secs;
+    assert(0 == mod_evasive_rate_limit(&pconf, e));
+    assert(0 == mod_evasive_rate_limit(&pconf, e));
+    assert(1 == mod_evasive_rate_limit(&pconf, e));
+
+    /* refill capped at max_rps + burst */
+    log_epoch_secs += 100;
+    for (int i = 0; i < 3; ++i)
+        assert(0 == mod_evasive_rate_limit(&pconf, e));
+    assert(1 == mod_evasive_rate_limit(&pconf, e));
+
+    /* smaller capacity in a different config context */
+    log_epoch_secs += 100;
+    pconf.burst = 0;
+    pconf.max_rps = 1;
+    assert(0 == mod_evasive_rate_limit(&pconf, e));
+    assert(1 == mod_evasive_rate_limit(&pconf, e));
+}
+
+static void test_mod_evasive_uri_handler(plugin_data * const p) {
+    void *plugin_ctx[1] = { NULL };
+    connection con;
+    request_st r;
+    memset(&con, 0, sizeof(con));
+    memset(&r, 0, sizeof(r));
+    con.plugin_ctx = plugin_ctx;
+    con.dst_addr_buf = buffer_init_string("10.1.1.1");
+    test_mod_evasive_addr(&con.dst_addr, "10.1.1.1");
+    r.con = &con;
+    p->id = 0;
+    p->defaults.silent = 1;
+
+    /* connections from client addr are counted at accept and close */
+    connection con2 = con;
+    void *plugin_ctx2[1] = { NULL };
+    con2.plugin_ctx = plugin_ctx2;
+    mod_evasive_handle_con_accept(&con, p);
+    mod_evasive_handle_con_accept(&con2, p);
+    evasive_ip * const e = plugin_ctx[0];
+    assert(NULL != e);
+    assert(e == plugin_ctx2[0]);
+    assert(2 == e->conns);
+
+    /* no limits configured */
+    assert(HANDLER_GO_ON == mod_evasive_uri_handler(&r, p));
+
+    /* max-conns-per-ip */
+    p->defaults.max_conns = 1;
+    assert(HANDLER_FINISHED == mod_evasive_uri_handler(&r, p));
+    assert(403 == r.http_status);
+    mod_evasive_handle_con_close(&con2, p);
+    assert(NULL == plugin_ctx2[0]);
+    assert(1 == e->conns);
+    r.http_status = 0;
+    assert(HANDLER_GO_ON == mod_evasive_uri_handler(&r, p));
+    p->defaults.max_conns = 0;
+
+    /* max-requests-per-sec */
+    p->defaults.max_rps = 1;
+    log_epoch_secs += 100;
+    assert(HANDLER_GO_ON == mod_evasive_uri_handler(&r, p));
+    assert(HANDLER_FINISHED == mod_evasive_uri_handler(&r, p));
+    assert(429 == r.http_status);
+    assert(NULL != http_header_response_get(&r, HTTP_HEADER_OTHER,
+                                            CONST_STR_LEN("Retry-After")));
+    p->defaults.http_status = 503;
+    r.http_status = 0;
+    assert(HANDLER_FINISHED == mod_evasive_uri_handler(&r, p));
+    assert(503 == r.http_status);
+    p->defaults.max_rps = 0;
+    p->defaults.http_status = 0;
+
+    mod_evasive_handle_con_close(&con, p);
+    assert(0 == e->conns);
+
+    array_free_data(&r.resp_headers);
+    buffer_free(con.dst_addr_buf);
+}
+
+int main (void) {
+    log_epoch_secs = 1000000;
+    plugin_data * const p = mod_evasive_init();
+    assert(NULL != p);
+
+    test_mod_evasive_ip_key(p);
+    test_mod_evasive_ip_table(p);
+    test_mod_evasive_rate_limit(p);
+    test_mod_evasive_uri_handler(p);
+
+    mod_evasive_free(p);
+    free(p);
+    return 0;
+}
+
+/*
+ * stub functions
+ */
+
+int li_rand_pseudo(void) {
+    return 0;
+}
+
+int config_plugin_values_init(server *srv, void *p_d, const config_plugin_keys_t *cpk, const char *mname) {
+    UNUSED(srv);
+    UNUSED(p_d);
+    UNUSED(cpk);
+    UNUSED(mname);
+    return 0;
+}
+
+int config_check_cond(request_st *r, int context_ndx) {
+    UNUSED(r);
+    UNUSED(context_ndx);
+    return 0;
+}
+
+int config_check_cond_next(request_st *r, const config_plugin_value_t *cvlist, int i, int used) {
+    UNUSED(r);
+    UNUSED(cvlist);
+    UNUSED(i);
+    return used;
+}
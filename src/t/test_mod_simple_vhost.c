@@ -61,3 +61,10 @@ int config_check_cond(request_st *r, int context_ndx) {
     UNUSED(context_ndx);
     return 0;
 }
+
+int config_check_cond_next(request_st *r, const config_plugin_value_t *cvlist, int i, int used) {
+    UNUSED(r);
+    UNUSED(cvlist);
+    UNUSED(i);
+    return used;
+}
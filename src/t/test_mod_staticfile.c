@@ -0,0 +1,414 @@
+#include "first.h"
+
+#undef NDEBUG
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mod_staticfile.c"
+#include "http-header-glue.c"
+#include "stat_cache.c"
+
+static char test_dir[] = "/tmp/lighttpd_test_mod_staticfile.XXXXXX";
+static buffer *test_sent; /* path of file sent as response body */
+
+static void test_mod_staticfile_accept_encoding (void) {
+    static const struct {
+        const char *accept_encoding;
+        const char *enc;
+        int acceptable;
+    } tests[] = {
+      { "",                       "gzip", 0 }
+     ,{ "gzip",                   "gzip", 1 }
+     ,{ "GZip",                   "gzip", 1 }
+     ,{ "gzip, br",               "br",   1 }
+     ,{ " ,\tdeflate ;q=0.5 ,br", "br",   1 }
+     ,{ "deflate",                "gzip", 0 }
+     ,{ "gzip2, x-gzip",          "gzip", 0 }
+     ,{ "identity",               "gzip", 0 }
+     ,{ "identity, gzip",         "gzip", 1 }
+     /* q=0 excludes coding */
+     ,{ "gzip;q=0",               "gzip", 0 }
+     ,{ "gzip; Q=0.000",          "gzip", 0 }
+     ,{ "gzip;q=0.001",           "gzip", 1 }
+     ,{ "gzip;q=1",               "gzip", 1 }
+     ,{ "gzip;q=0, br",           "br",   1 }
+     /* "*" matches codings not listed; explicit coding takes precedence */
+     ,{ "*",                      "br",   1 }
+     ,{ "*;q=0",                  "br",   0 }
+     ,{ "*, br;q=0",              "br",   0 }
+     ,{ "br;q=0, *",              "br",   0 }
+     ,{ "br;q=0, *",              "gzip", 1 }
+     ,{ "*;q=0, gzip",            "gzip", 1 }
+     ,{ "gzip, *;q=0",            "gzip", 1 }
+    };
+
+    for (size_t i = 0; i < sizeof(tests)/sizeof(*tests); ++i) {
+        assert(tests[i].acceptable
+               == mod_staticfile_accept_encoding(tests[i].accept_encoding,
+                                                 tests[i].enc,
+                                                 strlen(tests[i].enc)));
+    }
+}
+
+static void test_mod_staticfile_file (const buffer * const path, const char * const ext, const char * const content, const time_t mtime) {
+    /* create file (path + ext) with content and mtime */
+    buffer * const b = buffer_init_buffer(path);
+    buffer_append_string(b, ext);
+    const int fd = open(b->ptr, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    assert(fd >= 0);
+    assert((ssize_t)strlen(content) == write(fd, content, strlen(content)));
+    assert(0 == close(fd));
+    struct timeval tv[2];
+    tv[0].tv_sec = tv[1].tv_sec = mtime;
+    tv[0].tv_usec = tv[1].tv_usec = 0;
+    assert(0 == utimes(b->ptr, tv));
+    buffer_free(b);
+}
+
+static void test_mod_staticfile_unlink (const buffer * const path, const char * const ext) {
+    buffer * const b = buffer_init_buffer(path);
+    buffer_append_string(b, ext);
+    assert(0 == unlink(b->ptr));
+    buffer_free(b);
+}
+
+static void test_mod_staticfile_reset (request_st * const r, const char * const ae) {
+    /* reset response; set request Accept-Encoding (if not NULL) */
+    r->http_status = 0;
+    r->resp_body_finished = 0;
+    r->resp_htags = 0;
+    array_reset_data_strings(&r->resp_headers);
+    buffer_clear(&r->physical.etag);
+    buffer_clear(test_sent);
+    if (ae)
+        http_header_request_set(r, HTTP_HEADER_ACCEPT_ENCODING,
+                                CONST_STR_LEN("Accept-Encoding"),
+                                ae, strlen(ae));
+    else
+        http_header_request_unset(r, HTTP_HEADER_ACCEPT_ENCODING,
+                                  CONST_STR_LEN("Accept-Encoding"));
+}
+
+static void test_mod_staticfile_send (request_st * const r, plugin_data * const p, const char * const ae) {
+    test_mod_staticfile_reset(r, ae);
+    mod_staticfile_send_precompressed(r, p);
+    assert(200 == r->http_status);
+}
+
+static int test_mod_staticfile_sent (const request_st * const r, const char * const ext) {
+    /* check that file (path + ext) was sent */
+    const size_t len = buffer_string_length(&r->physical.path);
+    return buffer_string_length(test_sent) == len + strlen(ext)
+        && 0 == memcmp(test_sent->ptr, r->physical.path.ptr, len)
+        && 0 == strcmp(test_sent->ptr + len, ext);
+}
+
+static const buffer * test_mod_staticfile_header (const request_st * const r, const enum http_header_e id, const char * const k, const uint32_t klen) {
+    return http_header_response_get(r, id, k, klen);
+}
+
+static int test_mod_staticfile_etag_variant (const buffer * const etag, const char * const enc) {
+    /* check ETag of pre-compressed file, e.g. "...-gzip" */
+    const size_t len = buffer_string_length(etag);
+    const size_t elen = strlen(enc);
+    return len > elen + 3
+        && etag->ptr[0] == '"'
+        && etag->ptr[len-elen-2] == '-'
+        && 0 == memcmp(etag->ptr+len-elen-1, enc, elen)
+        && etag->ptr[len-1] == '"';
+}
+
+static void test_mod_staticfile_precompressed (void) {
+    server_socket srv_socket;
+    connection con;
+    request_st r;
+    memset(&srv_socket, 0, sizeof(srv_socket));
+    memset(&con, 0, sizeof(con));
+    memset(&r, 0, sizeof(r));
+    con.srv_socket = &srv_socket;
+    r.con = &con;
+    r.http_method = HTTP_METHOD_GET;
+    r.conf.errh = log_error_st_init();
+    r.conf.follow_symlink = 1;
+    r.conf.etag_flags = ETAG_USE_MTIME | ETAG_USE_SIZE;
+    array * const mimetypes = array_init(1);
+    array_set_key_value(mimetypes, CONST_STR_LEN(".js"),
+                        CONST_STR_LEN("text/javascript"));
+    r.conf.mimetypes = mimetypes;
+
+    /* server preference order of content-codings */
+    plugin_data * const p = mod_staticfile_init();
+    array * const precompressed = array_init(2);
+    array_insert_value(precompressed, CONST_STR_LEN("br"));
+    array_insert_value(precompressed, CONST_STR_LEN("gzip"));
+    p->conf.precompressed = precompressed;
+
+    buffer * const path = &r.physical.path;
+    buffer_copy_string(path, test_dir);
+    buffer_append_string_len(path, CONST_STR_LEN("/file.js"));
+    test_mod_staticfile_file(path, "",    "original content", 1000);
+    test_mod_staticfile_file(path, ".br", "brotli",           1000);
+    test_mod_staticfile_file(path, ".gz", "gzip data",        1001);
+    const buffer *vb;
+
+    /* no acceptable coding: original file is sent, and Vary is set since
+     * response depends on Accept-Encoding */
+    test_mod_staticfile_send(&r, p, NULL);
+    assert(test_mod_staticfile_sent(&r, ""));
+    assert(NULL == test_mod_staticfile_header(&r, HTTP_HEADER_CONTENT_ENCODING,
+                                              CONST_STR_LEN("Content-Encoding")));
+    vb = test_mod_staticfile_header(&r, HTTP_HEADER_VARY, CONST_STR_LEN("Vary"));
+    assert(NULL != vb && buffer_eq_slen(vb, CONST_STR_LEN("Accept-Encoding")));
+    vb = test_mod_staticfile_header(&r, HTTP_HEADER_ETAG, CONST_STR_LEN("ETag"));
+    assert(NULL != vb && !buffer_string_is_empty(vb));
+    buffer * const etag = buffer_init_buffer(vb);
+
+    static const char * const identity[] = {
+      "identity", "deflate, br;q=0, gzip;q=0", "*;q=0"
+    };
+    for (size_t i = 0; i < sizeof(identity)/sizeof(*identity); ++i) {
+        test_mod_staticfile_send(&r, p, identity[i]);
+        assert(test_mod_staticfile_sent(&r, ""));
+        assert(NULL == test_mod_staticfile_header(&r,
+                         HTTP_HEADER_CONTENT_ENCODING,
+                         CONST_STR_LEN("Content-Encoding")));
+        vb = test_mod_staticfile_header(&r, HTTP_HEADER_ETAG,
+                                        CONST_STR_LEN("ETag"));
+        assert(buffer_is_equal(vb, etag));
+    }
+
+    /* first acceptable coding in server preference order is sent (qvalues
+     * other than q=0 not used); Content-Type is that of original file;
+     * ETag is variant ETag of sibling file */
+    static const struct {
+        const char *accept_encoding;
+        const char *enc;
+        const char *ext;
+    } variants[] = {
+      { "br",              "br",   ".br" }
+     ,{ "gzip, br;q=0.5",  "br",   ".br" }
+     ,{ "gzip",            "gzip", ".gz" }
+     ,{ "*",               "br",   ".br" }
+     ,{ "br;q=0, *",       "gzip", ".gz" }
+     ,{ "*;q=0, gzip",     "gzip", ".gz" }
+    };
+    for (size_t i = 0; i < sizeof(variants)/sizeof(*variants); ++i) {
+        test_mod_staticfile_send(&r, p, variants[i].accept_encoding);
+        assert(test_mod_staticfile_sent(&r, variants[i].ext));
+        vb = test_mod_staticfile_header(&r, HTTP_HEADER_CONTENT_ENCODING,
+                                        CONST_STR_LEN("Content-Encoding"));
+        assert(NULL != vb && buffer_is_equal_string(vb, variants[i].enc,
+                                                    strlen(variants[i].enc)));
+        vb = test_mod_staticfile_header(&r, HTTP_HEADER_CONTENT_TYPE,
+                                        CONST_STR_LEN("Content-Type"));
+        assert(NULL != vb && buffer_eq_slen(vb, CONST_STR_LEN("text/javascript")));
+        vb = test_mod_staticfile_header(&r, HTTP_HEADER_ETAG,
+                                        CONST_STR_LEN("ETag"));
+        assert(NULL != vb && !buffer_is_equal(vb, etag));
+        assert(test_mod_staticfile_etag_variant(vb, variants[i].enc));
+        vb = test_mod_staticfile_header(&r, HTTP_HEADER_VARY,
+                                        CONST_STR_LEN("Vary"));
+        assert(NULL != vb && buffer_eq_slen(vb, CONST_STR_LEN("Accept-Encoding")));
+    }
+
+    /* conditional request matches variant ETag */
+    vb = test_mod_staticfile_header(&r, HTTP_HEADER_ETAG, CONST_STR_LEN("ETag"));
+    http_header_request_set(&r, HTTP_HEADER_IF_NONE_MATCH,
+                            CONST_STR_LEN("If-None-Match"), CONST_BUF_LEN(vb));
+    test_mod_staticfile_reset(&r, "gzip");
+    mod_staticfile_send_precompressed(&r, p);
+    assert(304 == r.http_status);
+    test_mod_staticfile_reset(&r, "br");
+    mod_staticfile_send_precompressed(&r, p);
+    assert(200 == r.http_status);
+    assert(test_mod_staticfile_sent(&r, ".br"));
+    http_header_request_unset(&r, HTTP_HEADER_IF_NONE_MATCH,
+                              CONST_STR_LEN("If-None-Match"));
+
+    /* existing Vary is extended, and not repeated */
+    test_mod_staticfile_reset(&r, "gzip");
+    http_header_response_set(&r, HTTP_HEADER_VARY, CONST_STR_LEN("Vary"),
+                             CONST_STR_LEN("Cookie"));
+    mod_staticfile_send_precompressed(&r, p);
+    vb = test_mod_staticfile_header(&r, HTTP_HEADER_VARY, CONST_STR_LEN("Vary"));
+    assert(NULL != vb && buffer_eq_slen(vb, CONST_STR_LEN("Cookie,Accept-Encoding")));
+    test_mod_staticfile_reset(&r, "gzip");
+    http_header_response_set(&r, HTTP_HEADER_VARY, CONST_STR_LEN("Vary"),
+                             CONST_STR_LEN("Accept-Encoding, Cookie"));
+    mod_staticfile_send_precompressed(&r, p);
+    vb = test_mod_staticfile_header(&r, HTTP_HEADER_VARY, CONST_STR_LEN("Vary"));
+    assert(NULL != vb && buffer_eq_slen(vb, CONST_STR_LEN("Accept-Encoding, Cookie")));
+
+    /* sibling older than original file (stale) is not sent */
+    ++log_epoch_secs; /*(stat_cache entries expire)*/
+    test_mod_staticfile_file(path, ".br", "brotli", 999);
+    test_mod_staticfile_send(&r, p, "br, gzip");
+    assert(test_mod_staticfile_sent(&r, ".gz"));
+    test_mod_staticfile_send(&r, p, "br");
+    assert(test_mod_staticfile_sent(&r, ""));
+    vb = test_mod_staticfile_header(&r, HTTP_HEADER_ETAG, CONST_STR_LEN("ETag"));
+    assert(buffer_is_equal(vb, etag));
+    vb = test_mod_staticfile_header(&r, HTTP_HEADER_VARY, CONST_STR_LEN("Vary"));
+    assert(NULL != vb); /*(.gz is still a variant)*/
+
+    /* no usable sibling: original file is sent without Vary */
+    ++log_epoch_secs;
+    test_mod_staticfile_unlink(path, ".gz");
+    test_mod_staticfile_send(&r, p, "br, gzip");
+    assert(test_mod_staticfile_sent(&r, ""));
+    assert(NULL == test_mod_staticfile_header(&r, HTTP_HEADER_VARY,
+                                              CONST_STR_LEN("Vary")));
+
+    /* sibling removed after stat() (cached in stat_cache): original file is
+     * sent with original ETag and without Content-Encoding */
+    ++log_epoch_secs;
+    test_mod_staticfile_file(path, ".gz", "gzip data", 1001);
+    test_mod_staticfile_send(&r, p, "gzip");
+    assert(test_mod_staticfile_sent(&r, ".gz"));
+    test_mod_staticfile_unlink(path, ".gz");
+    test_mod_staticfile_send(&r, p, "gzip");
+    assert(test_mod_staticfile_sent(&r, ""));
+    assert(NULL == test_mod_staticfile_header(&r, HTTP_HEADER_CONTENT_ENCODING,
+                                              CONST_STR_LEN("Content-Encoding")));
+    vb = test_mod_staticfile_header(&r, HTTP_HEADER_ETAG, CONST_STR_LEN("ETag"));
+    assert(buffer_is_equal(vb, etag));
+
+    test_mod_staticfile_unlink(path, ".br");
+    test_mod_staticfile_unlink(path, "");
+    buffer_free(etag);
+    array_free(precompressed);
+    mod_staticfile_free(p);
+    free(p);
+    array_free(mimetypes);
+    free(r.physical.path.ptr);
+    free(r.physical.etag.ptr);
+    array_free_data(&r.rqst_headers);
+    array_free_data(&r.resp_headers);
+    log_error_st_free(r.conf.errh);
+}
+
+int main (void) {
+    assert(NULL != mkdtemp(test_dir));
+    log_epoch_secs = 1000000;
+    test_sent = buffer_init();
+
+    test_mod_staticfile_accept_encoding();
+    test_mod_staticfile_precompressed();
+
+    stat_cache_free();
+    buffer_free(test_sent);
+    assert(0 == rmdir(test_dir));
+    return 0;
+}
+
+/*
+ * stub functions
+ */
+
+int config_plugin_values_init(server *srv, void *p_d, const config_plugin_keys_t *cpk, const char *mname) {
+    UNUSED(srv);
+    UNUSED(p_d);
+    UNUSED(cpk);
+    UNUSED(mname);
+    return 0;
+}
+
+int config_check_cond_next(request_st *r, const config_plugin_value_t *cvlist, int i, int used) {
+    UNUSED(r);
+    UNUSED(cvlist);
+    UNUSED(i);
+    return used;
+}
+
+void fdevent_fdnode_event_clr(fdevents *ev, fdnode *fdn, int event) {
+    UNUSED(ev);
+    UNUSED(fdn);
+    UNUSED(event);
+}
+
+int fdevent_ioctl_fionread (int fd, int fdfmt, int *toread) {
+    UNUSED(fd);
+    UNUSED(fdfmt);
+    *toread = 0;
+    return 0;
+}
+
+int fdevent_open_cloexec(const char *pathname, int symlinks, int flags, mode_t mode) {
+    UNUSED(symlinks);
+    return open(pathname, flags | O_CLOEXEC, mode);
+}
+
+int fdevent_mkstemp_append(char *path) {
+    UNUSED(path);
+    return -1;
+}
+
+void fdevent_setfd_cloexec(int fd) {
+    UNUSED(fd);
+}
+
+file_cache_entry * file_cache_get (const buffer *name, const struct stat *st, int allow_large) {
+    UNUSED(name);
+    UNUSED(st);
+    UNUSED(allow_large);
+    return NULL;
+}
+
+void file_cache_release (file_cache_entry *fce) {
+    UNUSED(fce);
+}
+
+int http_chunk_append_buffer(request_st *r, buffer *mem) {
+    UNUSED(r);
+    UNUSED(mem);
+    return -1;
+}
+
+int http_chunk_decode_append_mem(request_st * const r, const char * const mem, const size_t len) {
+    UNUSED(r);
+    UNUSED(mem);
+    UNUSED(len);
+    return -1;
+}
+
+int http_chunk_decode_append_buffer(request_st * const r, buffer * const mem) {
+    UNUSED(r);
+    UNUSED(mem);
+    return -1;
+}
+
+int http_chunk_append_file_fd(request_st *r, const buffer *fn, int fd, off_t sz) {
+    UNUSED(r);
+    UNUSED(sz);
+    buffer_copy_buffer(test_sent, fn);
+    close(fd);
+    return 0;
+}
+
+void http_chunk_append_file_ref(request_st *r, const buffer *fn, struct file_cache_entry *ref, off_t offset, off_t len) {
+    UNUSED(r);
+    UNUSED(fn);
+    UNUSED(ref);
+    UNUSED(offset);
+    UNUSED(len);
+}
+
+int http_chunk_append_file_range(request_st *r, const buffer *fn, off_t offset, off_t len) {
+    UNUSED(r);
+    UNUSED(fn);
+    UNUSED(offset);
+    UNUSED(len);
+    return -1;
+}
+
+void http_chunk_close(request_st *r) {
+    UNUSED(r);
+}
@@ -0,0 +1,169 @@
+#include "first.h"
+
+#undef NDEBUG
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "stat_cache.c"
+
+static char test_dir[] = "/tmp/lighttpd_test_stat_cache.XXXXXX";
+
+static void test_stat_cache_name (buffer * const b, const char * const fn) {
+    buffer_copy_string(b, test_dir);
+    buffer_append_string(b, fn);
+}
+
+static void test_stat_cache_touch (const buffer * const name) {
+    const int fd = open(name->ptr, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    assert(fd >= 0);
+    assert(0 == close(fd));
+}
+
+static void test_stat_cache_negative (void) {
+    buffer * const b = buffer_init();
+    stat_cache_entry *sce;
+
+    /* missing path cached as negative entry; errno is reported */
+    test_stat_cache_name(b, "/missing");
+    errno = 0;
+    assert(NULL == stat_cache_get_entry(b));
+    assert(ENOENT == errno);
+    assert(1 == sc.negative);
+    sce = stat_cache_sptree_find(&sc.files, CONST_BUF_LEN(b));
+    assert(NULL != sce && ENOENT == sce->stat_errno);
+
+    /* negative entry hit within same second; path not stat() again */
+    test_stat_cache_touch(b);
+    errno = 0;
+    assert(NULL == stat_cache_get_entry(b));
+    assert(ENOENT == errno);
+    assert(1 == sc.negative);
+
+    /* negative entry expires the next second; entry becomes positive */
+    ++log_epoch_secs;
+    sce = stat_cache_get_entry(b);
+    assert(NULL != sce && 0 == sce->stat_errno && S_ISREG(sce->st.st_mode));
+    assert(0 == sc.negative);
+
+    /* positive entry becomes negative when path is removed */
+    assert(0 == unlink(b->ptr));
+    stat_cache_invalidate_entry(CONST_BUF_LEN(b));
+    assert(NULL == stat_cache_get_entry(b));
+    assert(ENOENT == errno);
+    assert(1 == sc.negative);
+
+    /* invalidated negative entry is stat() again */
+    test_stat_cache_touch(b);
+    stat_cache_invalidate_entry(CONST_BUF_LEN(b));
+    sce = stat_cache_get_entry(b);
+    assert(NULL != sce && 0 == sce->stat_errno);
+    assert(0 == sc.negative);
+
+    /* ENOTDIR (path below regular file) is cached */
+    test_stat_cache_name(b, "/missing/file");
+    assert(NULL == stat_cache_get_entry(b));
+    assert(ENOTDIR == errno);
+    assert(1 == sc.negative);
+    errno = 0;
+    assert(NULL == stat_cache_get_entry(b));
+    assert(ENOTDIR == errno);
+
+    /* other errors are not cached */
+    buffer_copy_string_len(b, CONST_STR_LEN("relative"));
+    assert(NULL == stat_cache_get_entry(b));
+    assert(EINVAL == errno);
+    assert(1 == sc.negative);
+
+    /* stat_cache_update_entry() clears negative entry */
+    test_stat_cache_name(b, "/missing/file");
+    struct stat st;
+    memset(&st, 0, sizeof(st));
+    st.st_mode = S_IFREG;
+    stat_cache_update_entry(CONST_BUF_LEN(b), &st, NULL);
+    assert(0 == sc.negative);
+    sce = stat_cache_get_entry(b);
+    assert(NULL != sce && 0 == sce->stat_errno);
+
+    /* expired negative entries are removed by periodic cleanup */
+    test_stat_cache_name(b, "/missing2");
+    assert(NULL == stat_cache_get_entry(b));
+    assert(1 == sc.negative);
+    log_epoch_secs += 3;
+    stat_cache_trigger_cleanup();
+    assert(0 == sc.negative);
+    assert(NULL == sc.files);
+
+    test_stat_cache_name(b, "/missing");
+    unlink(b->ptr);
+    stat_cache_free();
+    buffer_free(b);
+}
+
+static void test_stat_cache_negative_limit (void) {
+    buffer * const b = buffer_init();
+    char fn[32];
+
+    /* negative entries limited to share of cache entries */
+    for (int i = 0; i < STAT_CACHE_NEGATIVE_MIN + 100; ++i) {
+        snprintf(fn, sizeof(fn), "/missing%d", i);
+        test_stat_cache_name(b, fn);
+        assert(NULL == stat_cache_get_entry(b));
+        assert(ENOENT == errno);
+    }
+    assert(STAT_CACHE_NEGATIVE_MIN == sc.negative);
+    assert(STAT_CACHE_NEGATIVE_MIN == splaytree_size(sc.files));
+
+    /* positive entries are still cached */
+    test_stat_cache_name(b, "");
+    assert(NULL != stat_cache_get_entry(b));
+    assert(STAT_CACHE_NEGATIVE_MIN + 1 == splaytree_size(sc.files));
+
+    stat_cache_free();
+    assert(0 == sc.negative);
+
+    /* nothing cached with stat-cache-engine "disable" */
+    buffer_copy_string_len(b, CONST_STR_LEN("disable"));
+    assert(0 == stat_cache_choose_engine(b, NULL));
+    test_stat_cache_name(b, "/missing");
+    assert(NULL == stat_cache_get_entry(b));
+    assert(ENOENT == errno);
+    assert(0 == sc.negative);
+    assert(NULL == sc.files);
+
+    stat_cache_free();
+    buffer_free(b);
+}
+
+int main (void) {
+    assert(NULL != mkdtemp(test_dir));
+    log_epoch_secs = 1000000;
+
+    test_stat_cache_negative();
+    test_stat_cache_negative_limit();
+
+    assert(0 == rmdir(test_dir));
+    return 0;
+}
+
+/*
+ * stub functions
+ */
+
+int etag_create(buffer *etag, const struct stat *st, int flags) {
+    UNUSED(etag);
+    UNUSED(st);
+    UNUSED(flags);
+    return 0;
+}
+
+int fdevent_open_cloexec(const char *pathname, int symlinks, int flags, mode_t mode) {
+    UNUSED(symlinks);
+    return open(pathname, flags | O_CLOEXEC, mode);
+}
@@ -0,0 +1,61 @@
+#include "first.h"
+
+#include "trie.h"
+#include "buffer.h"     /* force_assert() */
+
+#include <stdlib.h>
+
+void trie_init (trie * const t)
+{
+    t->nodes = NULL;
+    t->used = 0;
+    t->size = 0;
+}
+
+void trie_free (trie * const t)
+{
+    free(t->nodes);
+    trie_init(t);
+}
+
+static uint32_t trie_node_new (trie * const t, const unsigned char c)
+{
+    if (t->used == t->size) {
+        t->size = t->size ? t->size << 1 : 16;
+        t->nodes = realloc(t->nodes, t->size * sizeof(trie_node));
+        force_assert(NULL != t->nodes);
+    }
+    trie_node * const node = t->nodes + t->used;
+    node->child = 0;
+    node->next = 0;
+    node->v = -1;
+    node->c = c;
+    return t->used++;
+}
+
+int32_t trie_insert (trie * const t, const char * const k, const uint32_t klen, const int32_t v, const int rev)
+{
+    if (0 == t->used) trie_node_new(t, '\0'); /* root */
+
+    uint32_t n = 0;
+    for (uint32_t i = 0; i < klen; ++i) {
+        const unsigned char c = (unsigned char)k[rev ? klen - 1 - i : i];
+        /* find child on c, or insert new child in sorted sibling list
+         * (t->nodes may be realloc'd by trie_node_new(); use indexes) */
+        uint32_t prev = 0, x = t->nodes[n].child;
+        for (; x && t->nodes[x].c < c; x = t->nodes[x].next) prev = x;
+        if (!x || t->nodes[x].c != c) {
+            const uint32_t y = trie_node_new(t, c);
+            t->nodes[y].next = x;
+            if (prev)
+                t->nodes[prev].next = y;
+            else
+                t->nodes[n].child = y;
+            x = y;
+        }
+        n = x;
+    }
+
+    if (t->nodes[n].v < 0) t->nodes[n].v = v;
+    return t->nodes[n].v;
+}
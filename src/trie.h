@@ -0,0 +1,48 @@
+#ifndef LI_TRIE_H
+#define LI_TRIE_H
+#include "first.h"
+
+/* byte trie mapping keys to int32_t values
+ *
+ * Nodes are stored in a single array, with children of a node kept in a
+ * sibling list sorted by byte.  Callers walk the trie one byte at a time
+ * with trie_child(), which allows prefix, longest-prefix, and (with keys
+ * inserted reversed) suffix matching without copying the input. */
+
+typedef struct trie_node {
+    uint32_t child;   /* ndx of first child (0 if none; root is never child)*/
+    uint32_t next;    /* ndx of next sibling (0 if none) */
+    int32_t v;        /* value of key ending at this node (-1 if none) */
+    unsigned char c;  /* byte on edge from parent to this node */
+} trie_node;
+
+typedef struct trie {
+    trie_node *nodes; /* nodes[0] is root (empty key) */
+    uint32_t used;
+    uint32_t size;
+} trie;
+
+__attribute_cold__
+void trie_init (trie *t);
+
+__attribute_cold__
+void trie_free (trie *t);
+
+/* insert key; returns value already stored for key, if any, else v
+ * (rev: insert bytes of key in reverse order, for suffix matching) */
+__attribute_cold__
+int32_t trie_insert (trie *t, const char *k, uint32_t klen, int32_t v, int rev);
+
+__attribute_pure__
+static inline uint32_t trie_child (const trie *t, uint32_t n, unsigned char c);
+
+static inline uint32_t trie_child (const trie * const t, uint32_t n, const unsigned char c)
+{
+    /* return ndx of child of node n on byte c, or 0 if none
+     * (trie must not be empty; check t->used before walking trie) */
+    const trie_node * const nodes = t->nodes;
+    for (n = nodes[n].child; n && nodes[n].c < c; n = nodes[n].next) ;
+    return (n && nodes[n].c == c) ? n : 0;
+}
+
+#endif